@@ -20,13 +20,11 @@
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-HRESULT CDfsResolver::CDfsResolverEntry::Init(LPCWSTR unc, ULONG uncLen, ULONG uncValid, LPCWSTR server, LPCWSTR share, ULONG timeout)
+HRESULT CDfsResolver::CDfsResolverEntry::Init(LPCWSTR unc, ULONG uncLen, ULONG hash)
 {
 	assert(unc);
 	assert(uncLen);
 
-	assert(uncLen >= uncValid);
-
 	memset(this, 0, sizeof(*this));
 
 	m_unc = (LPWSTR) malloc((uncLen + 1) * sizeof(WCHAR));
@@ -41,27 +39,49 @@ HRESULT CDfsResolver::CDfsResolverEntry::Init(LPCWSTR unc, ULONG uncLen, ULONG u
 	// Terminate
 	m_unc[uncLen] = UNICODE_NULL;
 
-	m_uncLen	= uncLen;
-	m_uncValid  = (uncValid) ? uncValid : uncLen;
+	m_uncLen = uncLen;
+	m_hash	 = hash;
+
+	// Held by bucket
+	m_refs	 = 1;
+
+	// Never expires while pending
+	m_tick	 = ~0u;
+
+	return S_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	if(server && share)
+HRESULT CDfsResolver::CDfsResolverEntry::Complete(ULONG uncValid, LPCWSTR resolved, ULONG timeout)
+{
+	assert(m_unc);
+	assert(m_uncLen >= uncValid);
+	assert(!m_resolved);
+
+	HRESULT hr = S_OK;
+
+	m_uncValid = (uncValid) ? uncValid : m_uncLen;
+
+	if(resolved)
 	{
-		uncLen = wcslen(server) + wcslen(share) + 3 + 1;
+		ULONG const resolvedLen = wcslen(resolved);
 
-		m_resolved = (LPWSTR) malloc(uncLen * sizeof(WCHAR));
+		m_resolved = (LPWSTR) malloc((resolvedLen + 1) * sizeof(WCHAR));
 
-		if(!m_resolved)
+		if(m_resolved)
 		{
-			free(m_unc);
-
-			m_unc	 = 0;
-			m_uncLen = 0;
-			uncValid = 0;
+			wcscpy(m_resolved, resolved);
 
-			return E_OUTOFMEMORY;
+			m_resolvedLen = resolvedLen;
 		}
+		else
+		{
+			// Drop entry on next validation
+			timeout = 0;
 
-		m_resolvedLen = swprintf(m_resolved, L"\\\\%s\\%s", server, share);
+			hr = E_OUTOFMEMORY;
+		}
 	}
 
 	ULONG const tick = ::GetTickCount();
@@ -74,7 +94,7 @@ HRESULT CDfsResolver::CDfsResolverEntry::Init(LPCWSTR unc, ULONG uncLen, ULONG u
 		m_tick = ~0u;
 	}
 
-	return S_OK;
+	return hr;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -92,6 +112,11 @@ void CDfsResolver::CDfsResolverEntry::Close()
 		free(m_resolved);
 	}
 
+	if(m_ready)
+	{
+		::CloseHandle(m_ready);
+	}
+
 	memset(this, 0, sizeof(*this));
 }
 
@@ -99,49 +124,128 @@ void CDfsResolver::CDfsResolverEntry::Close()
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+CDfsResolver::CDfsResolver(CDfsResolverSource *source) : m_source(source), m_refreshes(0)
+{
+	memset(m_shards, 0, sizeof(m_shards));
+
+	for(ULONG index = 0; index < c_shards; ++index)
+	{
+		::InitializeCriticalSection(&m_shards[index].m_lock);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 CDfsResolver::~CDfsResolver()
 {
-	if(m_map)
+	// Background refreshes hold references to us
+	while(m_refreshes)
 	{
-		for(ULONG index = 0; index < m_count; ++index)
+		::Sleep(10);
+	}
+
+	for(ULONG index = 0; index < c_shards; ++index)
+	{
+		CDfsResolverShard *const shard = m_shards + index;
+
+		for(ULONG bucket = 0; bucket < c_buckets; ++bucket)
 		{
-			m_map[index].Close();
+			while(shard->m_buckets[bucket])
+			{
+				CacheUnlink(shard, shard->m_buckets[bucket]);
+			}
 		}
 
-		free(m_map);
-		m_map = 0;
+		::DeleteCriticalSection(&shard->m_lock);
 	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ULONG CDfsResolver::Hash(LPCWSTR unc, ULONG uncLen)
+{
+	assert(unc);
 
-	m_count	   = 0;
-	m_capacity = 0;
+	// FNV-1a, case insensitive
+	ULONG hash = 2166136261u;
 
-	::DeleteCriticalSection(&m_lock);
+	for(ULONG index = 0; index < uncLen; ++index)
+	{
+		hash ^= towupper(unc[index]);
+		hash *= 16777619u;
+	}
+
+	return hash;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void CDfsResolver::CacheValidate()
+void CDfsResolver::Release(CDfsResolverEntry *entry)
 {
-	if(m_count)
+	assert(entry);
+	assert(entry->m_refs > 0);
+
+	if(!::InterlockedDecrement(&entry->m_refs))
 	{
-		ULONG const tick = ::GetTickCount();
+		assert(!entry->m_linked);
 
-		for(LONG index = m_count - 1; index >= 0; --index)
-		{	
-			if(tick > m_map[index].m_tick)
-			{
-				m_map[index].Close();
+		entry->Close();
+
+		free(entry);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-				m_count--;
+void CDfsResolver::CacheUnlink(CDfsResolverShard *shard, CDfsResolverEntry *entry)
+{
+	assert(shard);
+	assert(entry);
+	assert(entry->m_linked);
+
+	CDfsResolverEntry **link = &shard->m_buckets[(entry->m_hash / c_shards) % c_buckets];
+
+	while(*link != entry)
+	{
+		assert(*link);
 
-				if((ULONG) index < m_count)
+		link = &(*link)->m_next;
+	}
+
+	*link = entry->m_next;
+
+	entry->m_next	= 0;
+	entry->m_linked = false;
+
+	assert(shard->m_count);
+	shard->m_count--;
+
+	// Drop bucket's reference
+	Release(entry);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CDfsResolver::CacheValidate(CDfsResolverShard *shard, ULONG tick)
+{
+	assert(shard);
+
+	if(shard->m_count)
+	{
+		for(ULONG bucket = 0; bucket < c_buckets; ++bucket)
+		{
+			CDfsResolverEntry *entry = shard->m_buckets[bucket];
+
+			while(entry)
+			{
+				CDfsResolverEntry *const next = entry->m_next;
+
+				if(!entry->m_pending && (tick > entry->m_tick))
 				{
-					memmove(m_map + index, 
-							m_map + index + 1, 
-							(m_count - index) * sizeof(CDfsResolverEntry));
+					CacheUnlink(shard, entry);
 				}
 
-				memset(m_map + m_count, 0, sizeof(CDfsResolverEntry));
+				entry = next;
 			}
 		}
 	}
@@ -149,71 +253,189 @@ void CDfsResolver::CacheValidate()
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-ULONG CDfsResolver::CacheAdd(LPCWSTR unc, ULONG uncLen, ULONG uncValid, ULONG timeout, LPCWSTR server, LPCWSTR share)
+CDfsResolver::CDfsResolverEntry* CDfsResolver::CacheLookup(CDfsResolverShard *shard, LPCWSTR unc, ULONG uncLen, ULONG hash)
 {
+	assert(shard);
 	assert(unc);
 	assert(uncLen);
+
+	// Search in already resolved paths
+	for(CDfsResolverEntry *entry = shard->m_buckets[(hash / c_shards) % c_buckets]; entry; entry = entry->m_next)
+	{
+		if((entry->m_hash == hash) && (entry->m_uncLen == uncLen))
+		{
+			if(!_wcsnicmp(entry->m_unc, unc, uncLen))
+			{
+				return entry;
+			}
+		}
+	}	
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ULONG CDfsResolver::QueryNetwork(LPCWSTR unc, LPWSTR resolved, ULONG resolvedSize, ULONG *uncValid, ULONG *timeout)
+{
+	assert(unc);
+	assert(resolved);
+	assert(resolvedSize);
+	assert(uncValid);
 	assert(timeout);
 
-	assert(m_capacity >= m_count);
+	ULONG err = ERROR_SUCCESS;
 
-	// Cache buffer to be extended?
-	if(m_count == m_capacity)
-	{
-		ULONG const capacity = m_capacity + c_increment;
+	// Ping target so that it is in the System's DFS cache we are going to query. 
+	// This also ensures that we use the same target as other local components 
+	// in fault-tolerant and/or load-balanced scenarios.
+	ULONG const attr = ::GetFileAttributes(unc);
 
-		CDfsResolverEntry *const map = (CDfsResolverEntry*) malloc(capacity * sizeof(CDfsResolverEntry));
+	if(attr == INVALID_FILE_ATTRIBUTES)
+	{
+		err = ::GetLastError();		
 
-		if(!map)
+		// Skip DFS API if path is invalid
+		if(err != ERROR_BAD_NET_NAME)
 		{
-			return ~0u;
+			err = ERROR_SUCCESS;
 		}
+	}
+
+	if(ERROR_SUCCESS != err)
+	{
+		return err;
+	}
+
+	DFS_INFO_4 *dfsInfo = 0;
+
+	// Have DFS link resolved. Use client-only API to avoid issues with DFS implementations
+	// that do not fully support the MSFT DFS APIs. NetApp is one of those...
+	err = ::NetDfsGetClientInfo((LPWSTR) unc, 0,0,4, (unsigned char**) &dfsInfo);
+
+	if(ERROR_SUCCESS == err)
+	{
+		// Default is first entry
+		LPCWSTR const entry = dfsInfo->EntryPath;
 
-		m_capacity = capacity;
+		LPCWSTR server = dfsInfo->Storage->ServerName;
+		LPCWSTR share  = dfsInfo->Storage->ShareName;
 
-		memset(map, 0, capacity * sizeof(CDfsResolverEntry));
+		// Note: The returned Volume state is always DFS_VOLUME_STATE_INCONSISTENT, 
+		// so we ignore them here
 
-		if(m_map)
+		// If more than one target were returned,
+		if(dfsInfo->NumberOfStorages > 1)
 		{
-			memcpy(map, m_map, m_count * sizeof(CDfsResolverEntry));
+			// look for first target that is online and/or active
+			for(ULONG index = 0; index < dfsInfo->NumberOfStorages; ++index)
+			{
+				if(dfsInfo->Storage[index].State & (DFS_STORAGE_STATE_ONLINE | DFS_STORAGE_STATE_ACTIVE))
+				{
+					server = dfsInfo->Storage[index].ServerName;
+					share  = dfsInfo->Storage[index].ShareName;
 
-			free(m_map);
+					break;
+				}
+			}
 		}
 
-		m_map = map;
-	}
+		ULONG const entryLen = wcslen(entry);
 
-	if(FAILED(m_map[m_count].Init(unc, uncLen, uncValid, server, share, timeout)))
-	{
-		return ~0u;
+		assert(!wcsnicmp(unc + 1, entry, entryLen));
+
+		*uncValid = entryLen + 1;
+		*timeout  = dfsInfo->Timeout;
+
+		memset(resolved, 0, resolvedSize * sizeof(WCHAR));
+
+		if(_snwprintf(resolved, resolvedSize - 1, L"\\\\%s\\%s", server, share) < 0)
+		{
+			err = ERROR_INSUFFICIENT_BUFFER;
+		}
+
+		::NetApiBufferFree(dfsInfo);
 	}
 
-	return m_count++;
-}	
+	return err;
+}
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-ULONG CDfsResolver::CacheLookup(LPCWSTR unc, ULONG uncLen)
+DWORD CDfsResolver::Refresh(void *context)
 {
-	assert(unc);
-	assert(uncLen);
+	CDfsResolverRefresh *const refresh = (CDfsResolverRefresh*) context;
+	assert(refresh);
+
+	CDfsResolver	  *const me	   = refresh->m_resolver;
+	CDfsResolverEntry *const entry = refresh->m_entry;
+
+	free(refresh);
+
+	assert(me);
+	assert(entry);
+	assert(entry->m_refreshing);
 
-	if(m_count)
+	WCHAR resolved[c_bufferSize + 2] = {0};
+	ULONG uncValid = 0;
+	ULONG timeout  = 0;
+
+	CDfsResolverEntry *update = 0;
+
+	// Query again, referrals may have changed in the meantime
+	if(ERROR_SUCCESS == me->Query(entry->m_unc, resolved, c_bufferSize, &uncValid, &timeout))
 	{
-		// Search in already resolved paths
-		for(ULONG index = 0; index < m_count; ++index)
+		update = (CDfsResolverEntry*) malloc(sizeof(CDfsResolverEntry));
+
+		if(update)
 		{
-			if(m_map[index].m_uncLen == uncLen)
+			if(FAILED(update->Init(entry->m_unc, entry->m_uncLen, entry->m_hash)) || 
+			   FAILED(update->Complete(uncValid, resolved, timeout)))
 			{
-				if(!_wcsnicmp(m_map[index].m_unc, unc, uncLen))
-				{
-					return index;
-				}
+				update->Close();
+
+				free(update);
+				update = 0;
 			}
-		}	
+		}
+	}
+
+	CDfsResolverShard *const shard = me->CacheShard(entry->m_hash);
+
+	::EnterCriticalSection(&shard->m_lock);
+
+	entry->m_refreshing = false;
+
+	// Replace entry if it is still cached, otherwise keep it until expiry
+	if(update && entry->m_linked)
+	{
+		me->CacheUnlink(shard, entry);
+
+		CDfsResolverEntry **const bucket = &shard->m_buckets[(update->m_hash / c_shards) % c_buckets];
+
+		update->m_next	 = *bucket;
+		update->m_linked = true;
+
+		*bucket = update;
+		shard->m_count++;
+
+		update = 0;
+	}
+
+	::LeaveCriticalSection(&shard->m_lock);
+
+	if(update)
+	{
+		update->Close();
+
+		free(update);
 	}
 
-	return ~0u;
+	Release(entry);
+
+	::InterlockedDecrement(&me->m_refreshes);
+
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -294,19 +516,19 @@ ULONG CDfsResolver::ResolveDFSTarget(LPWSTR target, LPWSTR device, ULONG deviceL
 
 		wcscpy(target + targetLen, findData.cFileName);
 
-		ULONG pos = ~0u;
+		CDfsResolverEntry *entry = 0;
 
 		// Try to resolve target server/share
-		if(S_OK == FindTarget(target, pathLen, &pos))
+		if(S_OK == FindTarget(target, pathLen, &entry))
 		{
-			assert(pos < m_count);
-			assert(m_map[pos].m_resolved);
-			assert(m_map[pos].m_resolvedLen);
+			assert(entry);
+			assert(entry->m_resolved);
+			assert(entry->m_resolvedLen);
 
 			// Does it match with given server/share?
 			if(!wcsnicmp(device + 24, 
-						 m_map[pos].m_resolved + 1, 
-						 m_map[pos].m_resolvedLen - 1))
+						 entry->m_resolved + 1, 
+						 entry->m_resolvedLen - 1))
 			{	
 
 				// Default to simple link
@@ -331,7 +553,7 @@ ULONG CDfsResolver::ResolveDFSTarget(LPWSTR target, LPWSTR device, ULONG deviceL
 				wcscpy(device + 2, start);
 
 				// Estimate start of path components
-				start = device + 24 + m_map[pos].m_resolvedLen - 1;
+				start = device + 24 + entry->m_resolvedLen - 1;
 
 				// Move path components to final position
 				memmove(device + wcslen(device),
@@ -339,8 +561,6 @@ ULONG CDfsResolver::ResolveDFSTarget(LPWSTR target, LPWSTR device, ULONG deviceL
 						((device + deviceLen) - start + 1) * sizeof(WCHAR));
 
 				err = NO_ERROR;
-
-				break;
 			}
 			else
 			{
@@ -349,21 +569,23 @@ ULONG CDfsResolver::ResolveDFSTarget(LPWSTR target, LPWSTR device, ULONG deviceL
 				wcscpy(targetNext, target);
 
 				// Target already queried?
-				if(wcsnicmp(target, m_map[pos].m_resolved, m_map[pos].m_resolvedLen))
+				if(wcsnicmp(target, entry->m_resolved, entry->m_resolvedLen))
 				{
-					assert(c_bufferSize >= m_map[pos].m_resolvedLen);
+					assert(c_bufferSize >= entry->m_resolvedLen);
 					// Take next level
-					wcscpy(targetNext, m_map[pos].m_resolved);
+					wcscpy(targetNext, entry->m_resolved);
 				}
 
 				// Recursive call
 				err = ResolveDFSTarget(targetNext, device, deviceLen, depth + 1);
+			}
 
-				// Matched?
-				if(NO_ERROR == err)
-				{
-					break;
-				}
+			Release(entry);
+
+			// Matched?
+			if(NO_ERROR == err)
+			{
+				break;
 			}
 		}
 	}
@@ -416,13 +638,9 @@ ULONG CDfsResolver::ResolveDevice(LPWSTR device, ULONG deviceLen, LPCWSTR drive)
 		return wcslen(device);
 	}
 
-	::EnterCriticalSection(&m_lock);
-
 	// See whether this url belongs to DFS namespace, involve our cache
 	if(S_OK != FindTarget(target, targetLen))
 	{
-		::LeaveCriticalSection(&m_lock);
-
 		return 0;
 	}
 
@@ -434,8 +652,6 @@ ULONG CDfsResolver::ResolveDevice(LPWSTR device, ULONG deviceLen, LPCWSTR drive)
 
 	err = ResolveDFSTarget(target, device, deviceLen);
 
-	::LeaveCriticalSection(&m_lock);
-
 	if(NO_ERROR != err)
 	{
 		return 0;
@@ -450,116 +666,176 @@ ULONG CDfsResolver::ResolveDevice(LPWSTR device, ULONG deviceLen, LPCWSTR drive)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-HRESULT CDfsResolver::FindTarget(LPWSTR unc, ULONG uncLen, ULONG *cachePos)
+HRESULT CDfsResolver::FindTarget(LPCWSTR unc, ULONG uncLen, CDfsResolverEntry **entry)
 {
 	assert(unc);
 	assert(uncLen);
-	
-	// First look up path in cache
-	ULONG pos = CacheLookup(unc, uncLen);
 
-	if(pos != ~0u)
-	{
-		assert(pos < m_count);
+	ULONG const hash = Hash(unc, uncLen);
+	ULONG const tick = ::GetTickCount();
 
-		if(cachePos)
-		{
-			*cachePos = pos;
-		}
+	CDfsResolverShard *const shard = CacheShard(hash);
 
-		// Positive entry?
-		return (m_map[pos].m_resolved) ? S_OK : S_FALSE;
-	}
+	bool owner	 = false;
+	bool refresh = false;
 
-	HRESULT hr = S_OK;
-	ULONG err  = ERROR_SUCCESS;
+	::EnterCriticalSection(&shard->m_lock);
 
-	// Ping target so that it is in the System's DFS cache we are going to query. 
-	// This also ensures that we use the same target as other local components 
-	// in fault-tolerant and/or load-balanced scenarios.
-	ULONG const attr = ::GetFileAttributes(unc);
+	// First look up path in cache
+	CDfsResolverEntry *found = CacheLookup(shard, unc, uncLen, hash);
 
-	if(attr == INVALID_FILE_ATTRIBUTES)
+	if(found && !found->m_pending && (tick > found->m_tick))
 	{
-		err = ::GetLastError();		
+		// Outdated
+		CacheUnlink(shard, found);
+		found = 0;
+	}
 
-		// Skip DFS API if path is invalid
-		if(err != ERROR_BAD_NET_NAME)
+	if(found)
+	{
+		::InterlockedIncrement(&found->m_refs);
+
+		// Positive entry about to expire?
+		if(!found->m_pending && found->m_resolved && !found->m_refreshing)
 		{
-			err = ERROR_SUCCESS;
+			if(found->m_tick - tick < c_refresh * 1000)
+			{
+				found->m_refreshing = true;
+				refresh = true;
+
+				::InterlockedIncrement(&m_refreshes);
+				::InterlockedIncrement(&found->m_refs);
+			}
 		}
 	}
-
-	if(ERROR_SUCCESS == err)
+	else
 	{
-		DFS_INFO_4 *dfsInfo = 0;
+		// Discard outdated cache entries
+		CacheValidate(shard, tick);
 
-		// Have DFS link resolved. Use client-only API to avoid issues with DFS implementations
-		// that do not fully support the MSFT DFS APIs. NetApp is one of those...
-		err = ::NetDfsGetClientInfo(unc, 0,0,4, (unsigned char**) &dfsInfo);
+		found = (CDfsResolverEntry*) malloc(sizeof(CDfsResolverEntry));
 
-		if(ERROR_SUCCESS == err)
+		if(found)
 		{
-			// Default is first entry
-			LPCWSTR const entry = dfsInfo->EntryPath;
+			if(SUCCEEDED(found->Init(unc, uncLen, hash)))
+			{
+				// Others wait on this one until it is resolved
+				found->m_ready = ::CreateEvent(0, true, false, 0);
+			}
+
+			if(found->m_ready)
+			{
+				CDfsResolverEntry **const bucket = &shard->m_buckets[(hash / c_shards) % c_buckets];
+
+				found->m_pending = true;
+				found->m_linked	 = true;
+				found->m_next	 = *bucket;
 
-			LPCWSTR server = dfsInfo->Storage->ServerName;
-			LPCWSTR share  = dfsInfo->Storage->ShareName;
+				*bucket = found;
+				shard->m_count++;
 
-			// Note: The returned Volume state is always DFS_VOLUME_STATE_INCONSISTENT, 
-			// so we ignore them here
+				// and ours
+				::InterlockedIncrement(&found->m_refs);
 
-			// If more than one target were returned,
-			if(dfsInfo->NumberOfStorages > 1)
+				owner = true;
+			}
+			else
 			{
-				// look for first target that is online and/or active
-				for(ULONG index = 0; index < dfsInfo->NumberOfStorages; ++index)
-				{
-					if(dfsInfo->Storage[index].State & (DFS_STORAGE_STATE_ONLINE | DFS_STORAGE_STATE_ACTIVE))
-					{
-						server = dfsInfo->Storage[index].ServerName;
-						share  = dfsInfo->Storage[index].ShareName;
+				found->Close();
 
-						break;
-					}
-				}
+				free(found);
+				found = 0;
 			}
+		}
+	}
 
-			hr = E_OUTOFMEMORY;
+	::LeaveCriticalSection(&shard->m_lock);
 
-			ULONG const entryLen = wcslen(entry);
+	if(!found)
+	{
+		return E_OUTOFMEMORY;
+	}
 
-			assert(entryLen + 1 <= uncLen);
-			assert(!wcsnicmp(unc + 1, entry, entryLen));
+	HRESULT hr = S_OK;
 
-			// Add positive entry to cache
-			pos = CacheAdd(unc, uncLen, entryLen + 1, dfsInfo->Timeout, server, share);
+	if(owner)
+	{
+		WCHAR resolved[c_bufferSize + 2] = {0};
+		ULONG uncValid = 0;
+		ULONG timeout  = 0;
 
-			if(pos != ~0u)
-			{
-				if(cachePos)
-				{
-					*cachePos = pos;
-				}
+		// Query outside of any lock
+		ULONG const err = Query(unc, resolved, c_bufferSize, &uncValid, &timeout);
 
-				hr = S_OK;
-			}
+		::EnterCriticalSection(&shard->m_lock);
 
-			::NetApiBufferFree(dfsInfo);
+		if(ERROR_SUCCESS == err)
+		{
+			// Add positive entry to cache
+			hr = found->Complete(uncValid, resolved, timeout);
+		}
+		else
+		{
+			// Add negative entry to cache
+			found->Complete(0, 0, c_timeout);
 		}
+
+		found->m_pending = false;
+
+		::LeaveCriticalSection(&shard->m_lock);
+
+		::SetEvent(found->m_ready);
+	}
+	else if(found->m_pending)
+	{
+		// Same name is being resolved already
+		::WaitForSingleObject(found->m_ready, INFINITE);
 	}
 
-	if(ERROR_SUCCESS != err)
+	if(refresh)
 	{
-		hr = S_FALSE;
+		CDfsResolverRefresh *const context = (CDfsResolverRefresh*) malloc(sizeof(CDfsResolverRefresh));
 
-		// Add negative entry to cache
-		if(~0u == CacheAdd(unc, uncLen))
+		if(context)
 		{
-			hr = E_OUTOFMEMORY;
+			context->m_resolver = this;
+			context->m_entry	= found;
+		}
+
+		if(!context || !::QueueUserWorkItem(Refresh, context, WT_EXECUTEDEFAULT))
+		{
+			// Try again on next hit
+			::EnterCriticalSection(&shard->m_lock);
+			found->m_refreshing = false;
+			::LeaveCriticalSection(&shard->m_lock);
+
+			if(context)
+			{
+				free(context);
+			}
+
+			Release(found);
+
+			::InterlockedDecrement(&m_refreshes);
 		}
 	}
 
+	if(SUCCEEDED(hr))
+	{
+		// Positive entry?
+		hr = (found->m_resolved) ? S_OK : S_FALSE;
+	}
+
+	if((S_OK == hr) && entry)
+	{
+		// Caller releases
+		*entry = found;
+	}
+	else
+	{
+		Release(found);
+	}
+
 	return hr;
 }
 
@@ -587,26 +863,16 @@ HRESULT CDfsResolver::ResolveTarget(LPWSTR path, ULONG pathLen)
 		return S_FALSE;
 	}
 
-	// Serialize cache access and all calls to the DFS API
-	::EnterCriticalSection(&m_lock);
-
-	// Discard outdated cache entries
-	CacheValidate();
-
-	ULONG cachePos = ~0u;
+	CDfsResolverEntry *entry = 0;
 
 	// Check if first component is a valid DFS namespace component
-	HRESULT hr = FindTarget(path, pathLen, &cachePos);
+	HRESULT hr = FindTarget(path, pathLen, &entry);
 
 	if(S_OK == hr)
 	{
-		assert(cachePos != ~0u);
-		assert(cachePos < m_count);
-
 		for(;;)
 		{
-			CDfsResolverEntry const*const entry = m_map + cachePos;
-
+			assert(entry);
 			assert(pathLen == entry->m_uncLen);
 			assert(pathLen >= entry->m_uncValid);
 
@@ -632,8 +898,11 @@ HRESULT CDfsResolver::ResolveTarget(LPWSTR path, ULONG pathLen)
 
 			wcsncpy(path, entry->m_resolved, entry->m_resolvedLen);
 
+			Release(entry);
+			entry = 0;
+
 			// Resolve substituted path again
-			hr = FindTarget(path, pathLen, &cachePos);
+			hr = FindTarget(path, pathLen, &entry);
 
 			// Error or end of DFS chain?
 			if(S_OK != hr)
@@ -643,7 +912,10 @@ HRESULT CDfsResolver::ResolveTarget(LPWSTR path, ULONG pathLen)
 		}	
 	}
 
-	::LeaveCriticalSection(&m_lock);
+	if(entry)
+	{
+		Release(entry);
+	}
 
 	return hr;
 }
@@ -826,3 +1098,419 @@ HRESULT CDfsResolver::ResolveDrive(LPCWSTR path, ULONG pathLen, LPWSTR *resolved
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Runs the resolver against a stand-in for the DFS client which answers links below \\corp\dfs from a
+ * table, after a configurable latency. Checks substitution, positive and negative lifetimes, background
+ * refresh, single-flight lookups and that referrals are not serialized. Then times cached normalization.
+ */
+class TestSource : public CDfsResolverSource
+{
+public:
+
+	enum { c_links = 1100 };
+
+	struct Link
+	{
+		WCHAR	Name[32];
+		WCHAR	Target[64];
+		ULONG	Timeout;
+	};
+
+	TestSource() : m_count(0), m_latency(0), m_queries(0), m_active(0), m_peak(0)
+	{ }
+
+	void Add(LPCWSTR name, LPCWSTR target, ULONG timeout = 600)
+	{
+		Link *link = Find(name, wcslen(name));
+
+		if(!link)
+		{
+			link = m_links + m_count++;
+		}
+
+		wcscpy(link->Name, name);
+		wcscpy(link->Target, target);
+
+		link->Timeout = timeout;
+	}
+
+	virtual ULONG Query(LPCWSTR unc, LPWSTR resolved, ULONG resolvedSize, ULONG *uncValid, ULONG *timeout)
+	{
+		::InterlockedIncrement(&m_queries);
+
+		LONG const active = ::InterlockedIncrement(&m_active);
+
+		for(LONG peak = m_peak; active > peak; peak = m_peak)
+		{
+			__atomic_compare_exchange_n(&m_peak, &peak, active, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+		}
+
+		if(m_latency)
+		{
+			::Sleep(m_latency);
+		}
+
+		::InterlockedDecrement(&m_active);
+
+		static WCHAR const root[] = L"\\\\corp\\dfs\\";
+
+		ULONG const rootLen = wcslen(root);
+
+		if(_wcsnicmp(unc, root, rootLen))
+		{
+			return ERROR_NOT_FOUND;
+		}
+
+		LPCWSTR const name = unc + rootLen;
+		LPCWSTR end		   = wcschr(name, L'\\');
+
+		if(!end)
+		{
+			end = name + wcslen(name);
+		}
+
+		Link const* link = Find(name, end - name);
+
+		if(!link)
+		{
+			return ERROR_NOT_FOUND;
+		}
+
+		if(wcslen(link->Target) >= resolvedSize)
+		{
+			return ERROR_INSUFFICIENT_BUFFER;
+		}
+
+		wcscpy(resolved, link->Target);
+
+		*uncValid = end - unc;
+		*timeout  = link->Timeout;
+
+		return ERROR_SUCCESS;
+	}
+
+	Link* Find(LPCWSTR name, ULONG nameLen)
+	{
+		for(ULONG index = 0; index < m_count; ++index)
+		{
+			if((wcslen(m_links[index].Name) == nameLen) && !_wcsnicmp(m_links[index].Name, name, nameLen))
+			{
+				return m_links + index;
+			}
+		}
+
+		return 0;
+	}
+
+	Link			m_links[c_links];
+	ULONG			m_count;
+
+	ULONG			m_latency;		// milliseconds
+	LONG			m_queries;
+	LONG			m_active;
+	LONG			m_peak;			// most queries in parallel
+};
+
+struct TestJob
+{
+	CDfsResolver*	Resolver;
+	LPCWSTR			Path;
+	LPCWSTR			Expected;
+	ULONG			Count;			// paths, Path formatted with its index, Expected with index % 8 and index
+	ULONG			Rounds;
+	LONG			Failed;
+};
+
+static char const* TestNarrow(LPCWSTR text)
+{
+	static char buffer[256];
+
+	ULONG pos = 0;
+
+	for(; text && text[pos] && (pos < sizeof(buffer) - 1); ++pos)
+	{
+		buffer[pos] = (char) text[pos];
+	}
+
+	buffer[pos] = 0;
+
+	return buffer;
+}
+
+static bool TestResolve(CDfsResolver *resolver, LPCWSTR path, LPCWSTR expected, HRESULT expectedHr = -1)
+{
+	LPWSTR resolved = 0;
+
+	HRESULT const hr = resolver->Resolve(path, &resolved);
+
+	bool result = SUCCEEDED(hr) && resolved && !wcscmp(resolved, expected);
+
+	if(-1 != expectedHr)
+	{
+		result = (hr == expectedHr) && (!expected || (resolved && !wcscmp(resolved, expected)));
+	}
+
+	if(!result)
+	{
+		printf("ERROR ON %s", TestNarrow(path));
+		printf(" -> %s hr[0x%x]\n", TestNarrow(resolved), (unsigned) hr);
+	}
+
+	if(resolved)
+	{
+		free(resolved);
+	}
+
+	return result;
+}
+
+static DWORD __stdcall TestThread(void *context)
+{
+	TestJob *const job = (TestJob*) context;
+
+	for(ULONG round = 0; round < job->Rounds; ++round)
+	{
+		for(ULONG index = 0; index < job->Count; ++index)
+		{
+			WCHAR path[128];
+			WCHAR expected[128];
+
+			swprintf(path, 128, job->Path, index);
+			swprintf(expected, 128, job->Expected, index % 8, index);
+
+			LPWSTR resolved = 0;
+
+			if(FAILED(job->Resolver->Resolve(path, &resolved)) || !resolved || wcscmp(resolved, expected))
+			{
+				::InterlockedIncrement(&job->Failed);
+			}
+
+			if(resolved)
+			{
+				free(resolved);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static LONG TestParallel(TestJob *jobs, ULONG count)
+{
+	HANDLE threads[16];
+
+	assert(count <= sizeof(threads) / sizeof(threads[0]));
+
+	for(ULONG index = 0; index < count; ++index)
+	{
+		threads[index] = ::CreateThread(0, 0, TestThread, jobs + index, 0, 0);
+	}
+
+	LONG failed = 0;
+
+	for(ULONG index = 0; index < count; ++index)
+	{
+		::WaitForSingleObject(threads[index], INFINITE);
+		::CloseHandle(threads[index]);
+
+		failed += jobs[index].Failed;
+	}
+
+	return failed;
+}
+
+int main(void)
+{
+	TestSource *const source = new TestSource;
+
+	source->Add(L"eng", L"\\\\srv1\\eng");
+	source->Add(L"ops", L"\\\\srv2\\ops", 20);		// refreshed on each hit
+	source->Add(L"hr",  L"\\\\srv3\\hr");
+
+	CDfsResolver *resolver = new CDfsResolver(source);
+
+	int failed = 0;
+
+	// Links substituted by their targets, the rest stays
+	failed += !TestResolve(resolver, L"\\\\corp\\dfs\\eng\\src\\a.c",	L"\\\\srv1\\eng\\src\\a.c");
+	failed += !TestResolve(resolver, L"\\\\CORP\\DFS\\ENG\\src\\a.c",	L"\\\\srv1\\eng\\src\\a.c");
+	failed += !TestResolve(resolver, L"\\\\corp\\dfs\\eng\\src\\",		L"\\\\srv1\\eng\\src\\");
+	failed += !TestResolve(resolver, L"\\\\srv9\\share\\x\\y",			L"\\\\srv9\\share\\x\\y", S_FALSE);
+	failed += !TestResolve(resolver, L"\\\\srv9\\share",				0, E_UNEXPECTED);
+	failed += !TestResolve(resolver, L"x",								0, E_INVALIDARG);
+
+	// Drive letters are replaced by their connection first
+	CSimWin32::Connect(L'X', L"\\\\corp\\dfs\\eng");
+
+	failed += !TestResolve(resolver, L"X:\\src\\a.c",					L"\\\\srv1\\eng\\src\\a.c");
+	failed += !TestResolve(resolver, L"Y:\\src\\a.c",					0, HRESULT_FROM_WIN32(ERROR_NOT_CONNECTED));
+
+	// Both the link and the substituted path are cached, regardless of case
+	LONG queries = source->m_queries;
+
+	failed += !TestResolve(resolver, L"\\\\Corp\\Dfs\\Eng\\src\\a.c",	L"\\\\srv1\\eng\\src\\a.c");
+	failed += !TestResolve(resolver, L"\\\\srv9\\share\\x\\y",			L"\\\\srv9\\share\\x\\y", S_FALSE);
+
+	if(source->m_queries != queries)
+	{
+		printf("ERROR ON CACHED [%d]\n", source->m_queries - queries);
+		failed++;
+	}
+
+	// Negative entries expire after 300 seconds, positive ones after their referral's timeout
+	CSimWin32::Advance(301 * 1000);
+	queries = source->m_queries;
+
+	failed += !TestResolve(resolver, L"\\\\srv9\\share\\x\\y",			L"\\\\srv9\\share\\x\\y", S_FALSE);
+	failed += !TestResolve(resolver, L"\\\\corp\\dfs\\eng\\src\\a.c",	L"\\\\srv1\\eng\\src\\a.c");
+
+	if(source->m_queries != queries + 2)
+	{
+		printf("ERROR ON NEGATIVE EXPIRY [%d]\n", source->m_queries - queries);
+		failed++;
+	}
+
+	CSimWin32::Advance(300 * 1000);
+	queries = source->m_queries;
+
+	failed += !TestResolve(resolver, L"\\\\corp\\dfs\\eng\\src\\a.c",	L"\\\\srv1\\eng\\src\\a.c");
+
+	if(source->m_queries != queries + 1)
+	{
+		printf("ERROR ON POSITIVE EXPIRY [%d]\n", source->m_queries - queries);
+		failed++;
+	}
+
+	// Entries close to expiry answer from cache and are refreshed in background
+	failed += !TestResolve(resolver, L"\\\\corp\\dfs\\ops\\a",			L"\\\\srv2\\ops\\a");
+
+	source->Add(L"ops", L"\\\\srv4\\ops", 20);
+
+	failed += !TestResolve(resolver, L"\\\\corp\\dfs\\ops\\a",			L"\\\\srv2\\ops\\a");
+
+	CSimWin32::Drain();
+
+	failed += !TestResolve(resolver, L"\\\\corp\\dfs\\ops\\a",			L"\\\\srv4\\ops\\a");
+
+	CSimWin32::Drain();
+
+	// Concurrent lookups of one name query once, the others wait for it
+	source->m_latency = 50;
+	queries			  = source->m_queries;
+
+	TestJob jobs[16];
+
+	for(ULONG index = 0; index < 16; ++index)
+	{
+		TestJob const job = { resolver, L"\\\\corp\\dfs\\hr\\doc", L"\\\\srv3\\hr\\doc", 1, 1, 0 };
+
+		jobs[index] = job;
+	}
+
+	failed += TestParallel(jobs, 8);
+
+	// The link and the substituted path
+	if(source->m_queries != queries + 2)
+	{
+		printf("ERROR ON SINGLE FLIGHT [%d]\n", source->m_queries - queries);
+		failed++;
+	}
+
+	// Lookups of different names are not serialized by each other's referral
+	WCHAR names[16][16];
+	WCHAR paths[16][64];
+	WCHAR targets[16][64];
+
+	source->m_peak = 0;
+
+	for(ULONG index = 0; index < 16; ++index)
+	{
+		swprintf(names[index], 16, L"p%u", index);
+		swprintf(targets[index], 64, L"\\\\srv%u\\p%u", index, index);
+		swprintf(paths[index], 64, L"\\\\corp\\dfs\\p%u\\f", index);
+
+		source->Add(names[index], targets[index]);
+
+		wcscat(targets[index], L"\\f");
+
+		TestJob const job = { resolver, paths[index], targets[index], 1, 1, 0 };
+
+		jobs[index] = job;
+	}
+
+	failed += TestParallel(jobs, 16);
+
+	if(source->m_peak < 2)
+	{
+		printf("ERROR ON PARALLEL [%d]\n", source->m_peak);
+		failed++;
+	}
+
+	printf("16 parallel lookups, up to %d referrals in flight\n", source->m_peak);
+
+	// Normalization of cached names, by 1 and 4 threads
+	source->m_latency = 0;
+
+	for(ULONG index = 0; index < 1024; ++index)
+	{
+		WCHAR name[16];
+		WCHAR target[64];
+
+		swprintf(name, 16, L"l%u", index);
+		swprintf(target, 64, L"\\\\srv%u\\l%u", index % 8, index);
+
+		source->Add(name, target);
+	}
+
+	for(ULONG threads = 1; threads <= 4; threads *= 4)
+	{
+		for(ULONG index = 0; index < threads; ++index)
+		{
+			// First round fills the cache
+			TestJob const job = { resolver, L"\\\\corp\\dfs\\l%u\\dir\\file.txt", L"\\\\srv%u\\l%u\\dir\\file.txt", 1024, 1, 0 };
+
+			jobs[index] = job;
+		}
+
+		failed += TestParallel(jobs, 1);
+
+		for(ULONG index = 0; index < threads; ++index)
+		{
+			jobs[index].Rounds = 50;
+		}
+
+		struct timespec begin, end;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+
+		queries = source->m_queries;
+
+		failed += TestParallel(jobs, threads);
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double const seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+		printf("%u threads, %.0f normalizations/s, %d referrals\n", threads, threads * 1024 * 50 / seconds, source->m_queries - queries);
+	}
+
+	delete resolver;
+	delete source;
+
+	if(CSimWin32::Handles())
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimWin32::Handles());
+		failed++;
+	}
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
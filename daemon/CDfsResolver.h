@@ -18,22 +18,52 @@
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+class CDfsResolverSource
+{
+	// Answers DFS referrals for the resolver cache. Replace it to resolve without network access
+
+public:
+
+	virtual						~CDfsResolverSource()
+								{ }
+
+	// Returns Win32 error. On success, resolved receives the target as \\server\share, uncValid
+	// the length of the matched UNC prefix and timeout the referral's lifetime in seconds.
+	virtual ULONG				Query(LPCWSTR unc, LPWSTR resolved, ULONG resolvedSize, ULONG *uncValid, ULONG *timeout) = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 class CDfsResolver  
 {
-	// Cache resolved DFS names, use aged positive/negative cache entries
+	// Cache resolved DFS names, use aged positive/negative cache entries. The cache is split into
+	// shards of hashed buckets, each with its own lock. Referrals are never queried under a lock,
+	// concurrent lookups of the same name wait for the first one. Positive entries close to their
+	// expiry are refreshed in background.
 
 	enum constants
 	{
-		c_increment		= 4,
+		c_shards		= 16,
+		c_buckets		= 32,	// per shard
 		c_timeout		= 300,	// 300 sec, timeout used for negative entries
+		c_refresh		= 30,	// 30 sec, refresh positive entries expiring within
 		c_bufferSize	= 512,
 	};
 
 	struct CDfsResolverEntry
 	{
-		HRESULT		Init(LPCWSTR unc, ULONG uncLen, ULONG uncValid, LPCWSTR server, LPCWSTR share, ULONG timeout);
+		HRESULT		Init(LPCWSTR unc, ULONG uncLen, ULONG hash);
+		HRESULT		Complete(ULONG uncValid, LPCWSTR resolved, ULONG timeout);
 		void		Close();	
 
+		CDfsResolverEntry*	m_next;			// bucket chain
+		LONG		m_refs;					// bucket holds one
+		HANDLE		m_ready;				// Event, set if no longer pending
+		bool		m_pending;
+		bool		m_refreshing;
+		bool		m_linked;
+		ULONG		m_hash;
+
 		LPWSTR		m_unc;		
 		ULONG		m_uncLen;
 		ULONG		m_uncValid;
@@ -43,11 +73,25 @@ class CDfsResolver
 		ULONG		m_tick;
 	};
 
+	struct CDfsResolverShard
+	{
+		CRITICAL_SECTION	m_lock;
+		CDfsResolverEntry*	m_buckets[c_buckets];
+		ULONG				m_count;
+	};
+
+	struct CDfsResolverRefresh
+	{
+		CDfsResolver*		m_resolver;
+		CDfsResolverEntry*	m_entry;		// referenced
+	};
+
 public:
-								CDfsResolver() : m_map(0), m_count(0), m_capacity(0)
-								{ ::InitializeCriticalSection(&m_lock); }
+								CDfsResolver(CDfsResolverSource *source = 0);
 								~CDfsResolver();
 
+	void						SetSource(CDfsResolverSource *source);
+
 	HRESULT						Resolve(LPCWSTR path, LPWSTR *resolved);
 	HRESULT						ResolvePath(LPCWSTR path, ULONG pathLen, LPWSTR *resolved);
 	HRESULT						ResolveDrive(LPCWSTR path, ULONG pathLen, LPWSTR *resolved);
@@ -55,23 +99,51 @@ public:
 	
 private:
 	
-	HRESULT						FindTarget(LPWSTR unc, ULONG uncLen, ULONG *cachePos = 0);
+	HRESULT						FindTarget(LPCWSTR unc, ULONG uncLen, CDfsResolverEntry **entry = 0);
 	HRESULT						ResolveTarget(LPWSTR path, ULONG pathLen);
 	ULONG						ResolveDFSTarget(LPWSTR target, LPWSTR device, ULONG deviceLen, ULONG depth = 0);
+	ULONG						Query(LPCWSTR unc, LPWSTR resolved, ULONG resolvedSize, ULONG *uncValid, ULONG *timeout);
 
-	void						CacheValidate();
-	ULONG						CacheLookup(LPCWSTR unc, ULONG uncLen);
-	ULONG						CacheAdd(LPCWSTR unc, ULONG uncLen, ULONG uncValid = 0,
-										 ULONG timeout = c_timeout, 
-										 LPCWSTR server = 0, LPCWSTR share = 0);
+	void						CacheValidate(CDfsResolverShard *shard, ULONG tick);
+	CDfsResolverEntry*			CacheLookup(CDfsResolverShard *shard, LPCWSTR unc, ULONG uncLen, ULONG hash);
+	void						CacheUnlink(CDfsResolverShard *shard, CDfsResolverEntry *entry);
+	CDfsResolverShard*			CacheShard(ULONG hash);
+
+	static ULONG				Hash(LPCWSTR unc, ULONG uncLen);
+	static void					Release(CDfsResolverEntry *entry);
+	static ULONG				QueryNetwork(LPCWSTR unc, LPWSTR resolved, ULONG resolvedSize, ULONG *uncValid, ULONG *timeout);
+	static DWORD	__stdcall	Refresh(void *context);
 	
 								// DATA
-	CDfsResolverEntry*			m_map;
-	ULONG						m_count;
-	ULONG						m_capacity;
-
-	CRITICAL_SECTION			m_lock;
+	CDfsResolverShard			m_shards[c_shards];
+	CDfsResolverSource*			m_source;			// 0 := use DFS client API
+	LONG						m_refreshes;		// background refreshes in progress
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+void CDfsResolver::SetSource(CDfsResolverSource *source)
+{
+	m_source = source;
+}
+
+inline
+CDfsResolver::CDfsResolverShard* CDfsResolver::CacheShard(ULONG hash)
+{
+	return m_shards + (hash % c_shards);
+}
+
+inline
+ULONG CDfsResolver::Query(LPCWSTR unc, LPWSTR resolved, ULONG resolvedSize, ULONG *uncValid, ULONG *timeout)
+{
+	if(m_source)
+	{
+		return m_source->Query(unc, resolved, resolvedSize, uncValid, timeout);
+	}
+
+	return QueryNetwork(unc, resolved, resolvedSize, uncValid, timeout);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #endif // !defined(AFX_CDfsResolver_H__7A8B8AA6_9F38_4944_ACDA_25EE47780ADA__INCLUDED_)
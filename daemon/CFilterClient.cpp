@@ -13,6 +13,7 @@
 #include <Iphlpapi.h>
 #include <tlhelp32.h>
 #include "CFilterClient.h"
+#include "CFilterScanner.h"
 
 #pragma comment(lib,"psapi.lib")
 
@@ -1286,6 +1287,7 @@ HRESULT	CFilterClient::ManageEntity(LPCWSTR path, ULONG flags, CFilterClientData
 		control->Version    = FILFILE_CONTROL_VERSION;
 		control->Size	    = controlSize;
 		control->Flags		= flags & ~FILFILE_CONTROL_DIRECTORY;
+		control->Value2		= data.Mode;
 
 		if(normalized)
 		{
@@ -1460,46 +1462,114 @@ HRESULT	CFilterClient::GetList(LPWSTR *entries, ULONG *entriesSize, ULONG flags)
 						// cook entries ?
 						if( !(flags & FILFILE_CONTROL_DIRECTORY))
 						{
-							ULONG index = 0;
+							outSize = DenormalizeList(buffer, outSize);
+						}
 
-							while(index < outSize)
-							{
-								if(!buffer[index])
-								{
-									break;
-								}
+						hr = E_OUTOFMEMORY;
 
-								LPWSTR const current = buffer + index;
+						*entries = (LPWSTR) malloc(outSize * sizeof(WCHAR));
 
-								ULONG len = wcslen(current);
+						if(*entries)
+						{
+							memcpy(*entries, buffer, outSize * sizeof(WCHAR));
 
-								// denormalize entries inplace
-								ULONG const newLen = DenormalizePath(current, len);
+							*entriesSize = outSize;
 
-								if(newLen && (newLen < len))
-								{
-									::MoveMemory(current + newLen, current + len, (outSize - (index + len)) * sizeof(WCHAR));
+							hr = S_OK;
+						}
+					}
+				}
+			}
+			else
+			{
+				hr = HRESULT_FROM_WIN32(::GetLastError());
+			}
 
-									outSize -= len - newLen;
+			::CloseHandle(device);
+		}
 
-									memset(current + outSize, 0, (len - newLen) * sizeof(WCHAR));
+		free(buffer);
+	}
 
-									len = newLen;
-								}
+	return hr;
+}
 
-								index += 1 + len;
-							}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+HRESULT	CFilterClient::GetListPage(ULONG *cursor, ULONG *generation, LPWSTR *entries, ULONG *entriesSize, ULONG flags)
+{
+	if(!cursor || !generation || !entries || !entriesSize)
+	{
+		return E_INVALIDARG;
+	}
+
+	*entries	 = 0;
+	*entriesSize = 0;
+
+	HRESULT hr = E_OUTOFMEMORY;
+
+	ULONG const bufferSize = FILFILE_BUFFER_SIZE;
+	UCHAR *buffer		   = (UCHAR*) malloc(bufferSize);
+
+	if(buffer)
+	{
+		memset(buffer, 0, bufferSize);
+
+		FILFILE_CONTROL control;
+		memset(&control, 0, sizeof(control));
+
+		control.Magic	 = FILFILE_CONTROL_MAGIC;
+		control.Version  = FILFILE_CONTROL_VERSION;
+		control.Size	 = sizeof(FILFILE_CONTROL);
+		control.Flags	 = flags | FILFILE_CONTROL_PAGED;
+		control.Value1	 = *cursor;
+		control.Value2	 = *generation;
+
+		hr = E_NOINTERFACE;
+
+		HANDLE device = ::CreateFile(s_deviceName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0,0);
+
+		if(INVALID_HANDLE_VALUE != device)
+		{
+			ULONG outSize = 0;
+
+			// call driver
+			if(::DeviceIoControl(device, IOCTL_FILFILE_ENUM_ENTITIES, &control, control.Size, buffer, bufferSize, &outSize, 0))
+			{
+				hr = E_UNEXPECTED;
+
+				if(outSize >= sizeof(FILFILE_ENUM_PAGE))
+				{
+					FILFILE_ENUM_PAGE const*const page = (FILFILE_ENUM_PAGE*) buffer;
+
+					*cursor		= page->Cursor;
+					*generation = page->Generation;
+
+					hr = S_FALSE;
+
+					if(page->Count && !(page->Flags & FILFILE_ENUM_UNCHANGED))
+					{
+						LPWSTR const paths = (LPWSTR) (buffer + sizeof(FILFILE_ENUM_PAGE));
+
+						ULONG pathsSize = (outSize - sizeof(FILFILE_ENUM_PAGE)) / sizeof(WCHAR);
+
+						// cook entries ?
+						if( !(flags & FILFILE_CONTROL_DIRECTORY))
+						{
+							pathsSize = DenormalizeList(paths, pathsSize);
 						}
 
 						hr = E_OUTOFMEMORY;
 
-						*entries = (LPWSTR) malloc(outSize * sizeof(WCHAR));
+						// terminate entire list
+						*entries = (LPWSTR) malloc((pathsSize + 1) * sizeof(WCHAR));
 
 						if(*entries)
 						{
-							memcpy(*entries, buffer, outSize * sizeof(WCHAR));
+							memcpy(*entries, paths, pathsSize * sizeof(WCHAR));
+							(*entries)[pathsSize] = UNICODE_NULL;
 
-							*entriesSize = outSize;
+							*entriesSize = pathsSize + 1;
 
 							hr = S_OK;
 						}
@@ -1522,6 +1592,43 @@ HRESULT	CFilterClient::GetList(LPWSTR *entries, ULONG *entriesSize, ULONG flags)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+ULONG CFilterClient::DenormalizeList(LPWSTR entries, ULONG entriesSize)
+{
+	ULONG index = 0;
+
+	while(index < entriesSize)
+	{
+		if(!entries[index])
+		{
+			break;
+		}
+
+		LPWSTR const current = entries + index;
+
+		ULONG len = wcslen(current);
+
+		// denormalize entries inplace
+		ULONG const newLen = DenormalizePath(current, len);
+
+		if(newLen && (newLen < len))
+		{
+			::MoveMemory(current + newLen, current + len, (entriesSize - (index + len)) * sizeof(WCHAR));
+
+			entriesSize -= len - newLen;
+
+			memset(current + entriesSize, 0, (len - newLen) * sizeof(WCHAR));
+
+			len = newLen;
+		}
+
+		index += 1 + len;
+	}
+
+	return entriesSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 HRESULT	CFilterClient::OpenNativeHandle(LPCWSTR path, HANDLE *file, bool createIf, bool shared)
 {
 	if(!path || !file)
@@ -1556,7 +1663,7 @@ HRESULT	CFilterClient::OpenNativeHandle(LPCWSTR path, HANDLE *file, bool createI
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-HRESULT	CFilterClient::OpenNativeHandleInternal(LPCWSTR normalized, HANDLE *file, ULONG flags)
+HRESULT	CFilterClient::OpenNativeHandleInternal(LPCWSTR normalized, HANDLE *file, ULONG flags, HANDLE device)
 {
 	if(!normalized || !file)
 	{
@@ -1585,9 +1692,22 @@ HRESULT	CFilterClient::OpenNativeHandleInternal(LPCWSTR normalized, HANDLE *file
 
 		hr = E_NOINTERFACE;
 
-		HANDLE device = ::CreateFile(s_deviceName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0,0);
+		HANDLE owned = 0;
 
-		if(INVALID_HANDLE_VALUE != device)
+		// Use caller's device handle, if any
+		if(!device)
+		{
+			owned = ::CreateFile(s_deviceName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0,0);
+
+			if(INVALID_HANDLE_VALUE == owned)
+			{
+				owned = 0;
+			}
+
+			device = owned;
+		}
+
+		if(device && (INVALID_HANDLE_VALUE != device))
 		{
 			FILFILE_CONTROL_OUT out;
 			memset(&out, 0, sizeof(out));
@@ -1611,7 +1731,10 @@ HRESULT	CFilterClient::OpenNativeHandleInternal(LPCWSTR normalized, HANDLE *file
 				hr = HRESULT_FROM_WIN32(::GetLastError());
 			}
 
-			::CloseHandle(device);
+			if(owned)
+			{
+				::CloseHandle(owned);
+			}
 		}
 
 		free(control);
@@ -1951,6 +2074,27 @@ HRESULT	CFilterClient::SetAutoConfigInternal(LPCWSTR path, ULONG deepness, CFilt
 
 HRESULT	CFilterClient::ManageEncryption(HANDLE fileHandle, ULONG flags, CFilterClientData &data)
 {
+	HANDLE device = ::CreateFile(s_deviceName, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0,0);
+
+	if(INVALID_HANDLE_VALUE == device)
+	{
+		return E_NOINTERFACE;
+	}
+
+	HRESULT const hr = ManageEncryptionInternal(device, fileHandle, flags, data);
+
+	::CloseHandle(device);
+
+	return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+HRESULT	CFilterClient::ManageEncryptionInternal(HANDLE device, HANDLE fileHandle, ULONG flags, CFilterClientData &data)
+{
+	assert(device);
+	assert(device != INVALID_HANDLE_VALUE);
+
 	// Data layout: One   := Session Key
 	//				Two	  := Header Payload
 	//				Three := current Session Key, if Session Key will change
@@ -2005,6 +2149,7 @@ HRESULT	CFilterClient::ManageEncryption(HANDLE fileHandle, ULONG flags, CFilterC
 		control->Size	    = controlSize;
 		control->Flags		= flags | FILFILE_CONTROL_HANDLE;
 		control->Value1		= (ULONG_PTR) fileHandle;
+		control->Value2		= data.Mode;
 
 		// Session Key
 		control->CryptoSize	  = data.OneSize;
@@ -2035,26 +2180,191 @@ HRESULT	CFilterClient::ManageEncryption(HANDLE fileHandle, ULONG flags, CFilterC
 			}
 		}
 
-		hr = E_NOINTERFACE;
+		hr		   = S_OK;
+		ULONG junk = 0;
 
-		HANDLE device = ::CreateFile(s_deviceName, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0,0);
+		if(!::DeviceIoControl(device, IOCTL_FILFILE_ENCRYPTION, control, control->Size, 0,0, &junk, 0))
+		{
+			hr = HRESULT_FROM_WIN32(::GetLastError());
+		}
 
-		if(INVALID_HANDLE_VALUE != device)
+		memset(control, 0, controlSize);
+
+		free(control);
+	}
+
+	return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilterClientScanner : public CFilterScannerTarget
+{
+	// Changes the encryption of single files through the driver, each Worker uses its own driver handle
+
+public:
+
+	// Flags:	FILFILE_CONTROL_ADD											Encrypt plain files
+	//			FILFILE_CONTROL_REM											Decrypt encrypted files
+	//			FILFILE_CONTROL_ADD | FILFILE_CONTROL_REM					Re-encrypt encrypted files
+	//			FILFILE_CONTROL_ADD | FILFILE_CONTROL_REM | FILFILE_CONTROL_SET	Rewrap FileKey of encrypted files
+								CFilterClientScanner(ULONG flags, CFilterClient::CFilterClientData const& data) : m_flags(flags), m_data(data), m_native(0), m_nativeLen(0)
+								{ }
+								~CFilterClientScanner()
+								{ free(m_native); }
+
+	HRESULT						Init(LPCWSTR directory);
+
+	virtual HRESULT				Attach(void **context);
+	virtual void				Detach(void *context);
+	virtual HRESULT				Process(void *context, LPCWSTR relative, ULONG relativeLen);
+
+private:
+
+	ULONG						m_flags;
+	CFilterClient::CFilterClientData m_data;	// caller's buffers, valid for the scan
+
+	LPWSTR						m_native;		// normalized path, with trailing backslash
+	ULONG						m_nativeLen;
+};
+
+HRESULT CFilterClientScanner::Init(LPCWSTR directory)
+{
+	assert(directory);
+
+	// Normalize root only once, files are addressed relative to it
+	HRESULT hr = CFilterClient::NormalizePath(directory, &m_native);
+
+	if(SUCCEEDED(hr))
+	{
+		m_nativeLen = wcslen(m_native);
+
+		LPWSTR const native = (LPWSTR) realloc(m_native, (m_nativeLen + 2) * sizeof(WCHAR));
+
+		if(!native)
 		{
-			hr		   = S_OK;
-			ULONG junk = 0;
+			return E_OUTOFMEMORY;
+		}
+
+		m_native = native;
+
+		if(m_native[m_nativeLen - 1] != L'\\')
+		{
+			m_native[m_nativeLen++] = L'\\';
+			m_native[m_nativeLen]	= UNICODE_NULL;
+		}
+	}
+
+	return hr;
+}
+
+HRESULT CFilterClientScanner::Attach(void **context)
+{
+	assert(context);
+
+	HANDLE const device = ::CreateFile(CFilterClient::s_deviceName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0,0);
+
+	if(INVALID_HANDLE_VALUE == device)
+	{
+		return E_NOINTERFACE;
+	}
+
+	*context = device;
+
+	return S_OK;
+}
+
+void CFilterClientScanner::Detach(void *context)
+{
+	assert(context);
+
+	::CloseHandle((HANDLE) context);
+}
+
+HRESULT CFilterClientScanner::Process(void *context, LPCWSTR relative, ULONG relativeLen)
+{
+	HANDLE const device = (HANDLE) context;
+
+	assert(device);
+	assert(relative);
+	assert(m_native);
+
+	LPWSTR const native = (LPWSTR) malloc((m_nativeLen + relativeLen + 1) * sizeof(WCHAR));
+
+	if(!native)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	wcscpy(native, m_native);
+	wcscpy(native + m_nativeLen, relative);
+
+	HANDLE file = 0;
+
+	HRESULT hr = CFilterClient::OpenNativeHandleInternal(native, &file, FILFILE_CONTROL_NULL, device);
+
+	free(native);
+
+	if(SUCCEEDED(hr))
+	{
+		bool const encrypted = SUCCEEDED(CFilterClient::CheckHeaderInternal(device, file));
+
+		// Already in requested state?
+		if((FILFILE_CONTROL_ADD == (m_flags & (FILFILE_CONTROL_ADD | FILFILE_CONTROL_REM))) ? encrypted : !encrypted)
+		{
+			hr = S_FALSE;
+		}
+		else
+		{
+			hr = CFilterClient::ManageEncryptionInternal(device, file, m_flags, m_data);
 
-			if(!::DeviceIoControl(device, IOCTL_FILFILE_ENCRYPTION, control, control->Size, 0,0, &junk, 0))
+			if(SUCCEEDED(hr))
 			{
-				hr = HRESULT_FROM_WIN32(::GetLastError());
+				hr = S_OK;
 			}
-
-			::CloseHandle(device);
 		}
 
-		memset(control, 0, controlSize);
+		::CloseHandle(file);
+	}
 
-		free(control);
+	return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+HRESULT	CFilterClient::ChangeEncryptionTree(LPCWSTR directory, UCHAR const*key, ULONG keySize, 
+											UCHAR const* payload, ULONG payloadSize, 
+											UCHAR const* currKey, ULONG currKeySize, 
+											ULONG threads, ULONG *failed)
+{
+	if(!directory || !key || !keySize || !payload || !payloadSize || !currKey || !currKeySize)
+	{
+		return E_INVALIDARG;
+	}
+
+	CFilterClientScanner target(FILFILE_CONTROL_REM | FILFILE_CONTROL_ADD | FILFILE_CONTROL_SET,
+								CFilterClientData(key, keySize, payload, payloadSize, currKey, currKeySize));
+
+	HRESULT hr = target.Init(directory);
+
+	if(SUCCEEDED(hr))
+	{
+		CFilterScanner scanner;
+
+		hr = scanner.Start(directory, &target, threads);
+
+		if(SUCCEEDED(hr))
+		{
+			hr = scanner.Wait();
+
+			if(failed)
+			{
+				CFilterScanner::Progress progress;
+				scanner.GetProgress(&progress);
+
+				*failed = progress.Failed;
+			}
+		}
 	}
 
 	return hr;
@@ -2062,6 +2372,38 @@ HRESULT	CFilterClient::ManageEncryption(HANDLE fileHandle, ULONG flags, CFilterC
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+HRESULT	CFilterClient::CheckHeaderInternal(HANDLE device, HANDLE fileHandle)
+{
+	assert(device);
+	assert(device != INVALID_HANDLE_VALUE);
+
+	if(!fileHandle || (INVALID_HANDLE_VALUE == fileHandle))
+	{
+		return E_INVALIDARG;
+	}
+
+	FILFILE_CONTROL control;
+	memset(&control, 0, sizeof(control));
+
+	control.Magic	= FILFILE_CONTROL_MAGIC;
+	control.Version = FILFILE_CONTROL_VERSION;
+	control.Size	= sizeof(FILFILE_CONTROL);
+	control.Flags	= FILFILE_CONTROL_HANDLE;
+	control.Value1	= (ULONG_PTR) fileHandle;
+
+	ULONG junk = 0;
+
+	// Boolean query, no Payload requested
+	if(!::DeviceIoControl(device, IOCTL_FILFILE_GET_HEADER, &control, control.Size, 0,0, &junk, 0))
+	{
+		return HRESULT_FROM_WIN32(::GetLastError());
+	}
+
+	return S_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 HRESULT	CFilterClient::PollRequest(LPCWSTR *path, ULONG *cookie, UCHAR **payload, ULONG *payloadSize)
 {
 	if(!path)
@@ -2379,6 +2721,80 @@ HRESULT CFilterClient::SetControlReadOnly(BOOL bReadOnly)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+HRESULT CFilterClient::GetStatistics(FILFILE_STATISTICS **statistics, ULONG *count, bool reset)
+{
+	if(!statistics || !count)
+	{
+		return E_INVALIDARG;
+	}
+
+	*statistics = 0;
+	*count		= 0;
+
+	FILFILE_CONTROL control;
+	memset(&control, 0, sizeof(control));
+
+	control.Magic	 = FILFILE_CONTROL_MAGIC;
+	control.Version  = FILFILE_CONTROL_VERSION;
+	control.Size	 = sizeof(FILFILE_CONTROL);
+	control.Flags	 = (reset) ? FILFILE_CONTROL_REM : FILFILE_CONTROL_NULL;
+
+	HRESULT hr = E_NOINTERFACE;
+
+	HANDLE device = ::CreateFile(s_deviceName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0,0);
+
+	if(INVALID_HANDLE_VALUE != device)
+	{
+		// Start with room for some Volumes, grow on demand
+		ULONG entries = 32;
+
+		for(;;)
+		{
+			hr = E_OUTOFMEMORY;
+
+			ULONG const bufferSize	   = entries * sizeof(FILFILE_STATISTICS);
+			FILFILE_STATISTICS *buffer = (FILFILE_STATISTICS*) malloc(bufferSize);
+
+			if(!buffer)
+			{
+				break;
+			}
+
+			memset(buffer, 0, bufferSize);
+
+			ULONG outSize = 0;
+
+			// call driver
+			if(::DeviceIoControl(device, IOCTL_FILFILE_STATISTICS, &control, control.Size, buffer, bufferSize, &outSize, 0))
+			{
+				hr = S_OK;
+
+				*statistics = buffer;
+				*count		= outSize / sizeof(FILFILE_STATISTICS);
+
+				break;
+			}
+
+			hr = HRESULT_FROM_WIN32(::GetLastError());
+
+			free(buffer);
+
+			if((HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER) != hr) || (entries >= 1024))
+			{
+				break;
+			}
+
+			entries *= 2;
+		}
+
+		::CloseHandle(device);
+	}
+
+	return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 HRESULT CFilterClient::Connection(HANDLE random, HANDLE key, HANDLE notify,ULONG ulPid)
 {
 	FILFILE_CONTROL control;
@@ -18,6 +18,8 @@
 
 class CFilterClient  
 {
+	friend class CFilterClientScanner;
+
 	enum NetProvider
 	{
 		NETWORK_PROVIDER_NULL		= 0,
@@ -49,15 +51,17 @@ public:
 	// Types: cancel == EVENT, progress == SEMAPHORE
 	static HRESULT					WipeFile(HANDLE file, HANDLE cancel = 0, HANDLE progress = 0, 
 		ULONG flags = 0, int *patterns = 0, int patternsSize = 0);
-	static HRESULT					WipeOnDelete(bool activate = false, int *patterns = 0, int patternsSize = 0);
+	static HRESULT					WipeOnDelete(bool activate = false, int *patterns = 0, int patternsSize = 0, bool background = false);
 
 	// STATE
 	static ULONG					GetDriverState();
 	static HRESULT					SetDriverState(ULONG state);	
 
 	// ENTITY regular
+	// Mode: cipher mode for new files (CTR 1, CFB 2, EME 3, EME2 4, XTS 5), 0 := driver default
+	//       XTS may add 4096 byte data units as (3 << 4), otherwise 512 byte ones are used
 	static HRESULT					AddEntity(LPCWSTR entityPath, UCHAR const* key, ULONG keySize, 
-		UCHAR const* payload, ULONG payloadSize);
+		UCHAR const* payload, ULONG payloadSize, ULONG mode = 0);
 
 	static HRESULT                  AddCredibleProcess(DWORD pid);
 
@@ -68,10 +72,15 @@ public:
 	static HRESULT					EnumEntities(LPWSTR *entities = 0, ULONG *entitiesSize = 0, bool native = false);
 	static HRESULT					RemoveEntities();
 
+	// Paged enumeration: start with cursor and generation zero, continue while cursor is non-zero.
+	// Returns S_FALSE without entries if there are none or nothing has changed since given generation
+	static HRESULT					EnumEntitiesPage(ULONG *cursor, ULONG *generation, LPWSTR *entities, ULONG *entitiesSize, bool native = false);
+
 	// ENTITY negative
 	static HRESULT					AddNegEntity(LPCWSTR entityPath);
 	static HRESULT					RemoveNegEntity(LPCWSTR entityPath);
 	static HRESULT					EnumNegEntities(LPWSTR *entities = 0, ULONG *entitiesSize = 0, bool native = false);
+	static HRESULT					EnumNegEntitiesPage(ULONG *cursor, ULONG *generation, LPWSTR *entities, ULONG *entitiesSize, bool native = false);
 	static HRESULT					RemoveNegEntities();
 
 	// Location BLACK list
@@ -97,12 +106,22 @@ public:
 
 	// ENCRYPTION
 	static HRESULT					AddEncryption(HANDLE file, UCHAR const* key, ULONG keySize, 
-		UCHAR const* payload, ULONG payloadSize);		
+		UCHAR const* payload, ULONG payloadSize, ULONG mode = 0);		
 	static HRESULT					RemoveEncryption(HANDLE file, UCHAR const*key, ULONG keySize, bool recover = false);
 	static HRESULT					ChangeEncryption(HANDLE file, UCHAR const*key, ULONG keySize, 
 		UCHAR const* payload, ULONG payloadSize, 
 		UCHAR const* currKey, ULONG currKeySize, 
 		bool fileData = false);
+	// Change Session Key of all encrypted files below given directory using multiple threads.
+	// Only the FileKey within each Header is rewrapped, file data remains untouched.
+	static HRESULT					ChangeEncryptionTree(LPCWSTR directory, UCHAR const*key, ULONG keySize, 
+		UCHAR const* payload, ULONG payloadSize, 
+		UCHAR const* currKey, ULONG currKeySize, 
+		ULONG threads = 0, ULONG *failed = 0);
+
+	// STATISTICS - driver wide counters followed by one entry per Volume. Free using free().
+	// If reset is set, counters restart from zero after the snapshot was taken.
+	static HRESULT					GetStatistics(FILFILE_STATISTICS **statistics, ULONG *count, bool reset = false);
 
 	// Register/Unregister callback functions
 	static HRESULT					RegisterCallbacks(void* context = 0, f_requestRandom rand = 0, 
@@ -129,7 +148,8 @@ private:
 			Two(two),
 			TwoSize(twoSize),
 			Three(three),
-			ThreeSize(threeSize)
+			ThreeSize(threeSize),
+			Mode(0)
 		{ }
 		UCHAR const* One;
 		ULONG		 OneSize;
@@ -137,6 +157,7 @@ private:
 		ULONG		 TwoSize;
 		UCHAR const* Three;
 		ULONG		 ThreeSize;
+		ULONG		 Mode;		// cipher mode, 0 := default
 	};
 
 	static HRESULT					PollRequest(LPCWSTR *path, ULONG *cookie = 0, 
@@ -150,6 +171,8 @@ private:
 	static HRESULT					WorkerStop();
 
 	static HRESULT					ManageEncryption(HANDLE fileHandle, ULONG flags, CFilterClientData &data);
+	static HRESULT					ManageEncryptionInternal(HANDLE device, HANDLE fileHandle, ULONG flags, CFilterClientData &data);
+	static HRESULT					CheckHeaderInternal(HANDLE device, HANDLE fileHandle);
 	static HRESULT					ManageEntity(LPCWSTR entityPath, ULONG flags, CFilterClientData &data);
 
 	static HRESULT					NormalizePath(LPCWSTR path, LPWSTR *normalizedPath, ULONG flags = 0);
@@ -170,8 +193,10 @@ private:
 	static ULONG					DenormalizeDynamicDisk(LPWSTR path, ULONG pathLen);
 
 	static HRESULT					GetList(LPWSTR *entries, ULONG *entriesSize, ULONG flags);
+	static HRESULT					GetListPage(ULONG *cursor, ULONG *generation, LPWSTR *entries, ULONG *entriesSize, ULONG flags);
+	static ULONG					DenormalizeList(LPWSTR entries, ULONG entriesSize);
 	static HRESULT					Connection(HANDLE random = 0, HANDLE key = 0, HANDLE notify = 0,ULONG ulPid=0);
-	static HRESULT					OpenNativeHandleInternal(LPCWSTR normalized, HANDLE *fileHandle, ULONG flags);
+	static HRESULT					OpenNativeHandleInternal(LPCWSTR normalized, HANDLE *fileHandle, ULONG flags, HANDLE device = 0);
 
 	static HRESULT					SetAutoConfigInternal(LPCWSTR path, ULONG deepness, CFilterClientData &data);
 	static HRESULT					GetHeaderInternal(LPCWSTR path, HANDLE file, ULONG flags, 
@@ -196,11 +221,14 @@ private:
 
 inline
 HRESULT	CFilterClient::AddEntity(LPCWSTR entityPath, UCHAR const* key, ULONG keySize, 
-								 UCHAR const* payload, ULONG payloadSize)
+								 UCHAR const* payload, ULONG payloadSize, ULONG mode)
 {
+	CFilterClientData data(key, keySize, payload, payloadSize);
+	data.Mode = mode;
+
 	return ManageEntity(entityPath, 
 		FILFILE_CONTROL_ADD, 
-		CFilterClientData(key, keySize, payload, payloadSize));
+		data);
 }
 
 inline
@@ -221,6 +249,11 @@ inline HRESULT	CFilterClient::EnumEntities(LPWSTR *entities, ULONG *entitiesSize
 	return GetList(entities,entitiesSize,(native) ? FILFILE_CONTROL_DIRECTORY : FILFILE_CONTROL_NULL);
 }
 
+inline HRESULT	CFilterClient::EnumEntitiesPage(ULONG *cursor, ULONG *generation, LPWSTR *entities, ULONG *entitiesSize, bool native)
+{
+	return GetListPage(cursor,generation,entities,entitiesSize,(native) ? FILFILE_CONTROL_DIRECTORY : FILFILE_CONTROL_NULL);
+}
+
 inline HRESULT	CFilterClient::CheckEntity(LPCWSTR entityPath)
 {
 	return ManageEntity(entityPath,FILFILE_CONTROL_NULL,CFilterClientData());
@@ -261,6 +294,11 @@ inline HRESULT	CFilterClient::EnumNegEntities(LPWSTR *entities, ULONG *entitiesS
 	return GetList(entities,entitiesSize,(native) ? FILFILE_CONTROL_DIRECTORY | FILFILE_CONTROL_ACTIVE: FILFILE_CONTROL_ACTIVE);
 }
 
+inline HRESULT	CFilterClient::EnumNegEntitiesPage(ULONG *cursor, ULONG *generation, LPWSTR *entities, ULONG *entitiesSize, bool native)
+{
+	return GetListPage(cursor,generation,entities,entitiesSize,(native) ? FILFILE_CONTROL_DIRECTORY | FILFILE_CONTROL_ACTIVE: FILFILE_CONTROL_ACTIVE);
+}
+
 inline HRESULT	CFilterClient::CheckBlacklist(LPCWSTR path, bool directory)
 {
 	return ManageEntity(path, (directory) ? FILFILE_CONTROL_DIRECTORY | FILFILE_CONTROL_BLACKLIST: FILFILE_CONTROL_BLACKLIST, CFilterClientData());
@@ -286,9 +324,12 @@ inline HRESULT	CFilterClient::SetAutoConfig(LPCWSTR path, UCHAR const* payload,
 	return SetAutoConfigInternal(path, ~0u, CFilterClientData(payload, payloadSize));
 }
 
-inline HRESULT	CFilterClient::AddEncryption(HANDLE file, UCHAR const* key, ULONG keySize,UCHAR const* payload, ULONG payloadSize)
+inline HRESULT	CFilterClient::AddEncryption(HANDLE file, UCHAR const* key, ULONG keySize,UCHAR const* payload, ULONG payloadSize, ULONG mode)
 {
-	return ManageEncryption(file, FILFILE_CONTROL_ADD,CFilterClientData(key, keySize, payload, payloadSize));
+	CFilterClientData data(key, keySize, payload, payloadSize);
+	data.Mode = mode;
+
+	return ManageEncryption(file, FILFILE_CONTROL_ADD, data);
 }
 
 inline HRESULT	CFilterClient::RemoveEncryption(HANDLE file, UCHAR const* key, ULONG keySize, bool recover)
@@ -318,9 +359,14 @@ inline HRESULT	CFilterClient::WipeFile(HANDLE file, HANDLE cancel, HANDLE progre
 	return Wiper(flags, patterns, patternsSize, file, cancel, progress);
 }	
 
-inline HRESULT CFilterClient::WipeOnDelete(bool activate, int *patterns, int patternsSize)
+inline HRESULT CFilterClient::WipeOnDelete(bool activate, int *patterns, int patternsSize, bool background)
 {
-	ULONG const flags = (activate) ? FILFILE_CONTROL_ACTIVE | FILFILE_CONTROL_WIPE_ON_DELETE: FILFILE_CONTROL_WIPE_ON_DELETE;
+	ULONG flags = (activate) ? FILFILE_CONTROL_ACTIVE | FILFILE_CONTROL_WIPE_ON_DELETE: FILFILE_CONTROL_WIPE_ON_DELETE;
+
+	if(background)
+	{
+		flags |= FILFILE_CONTROL_BACKGROUND;
+	}
 
 	return Wiper(flags, patterns, patternsSize);
 }
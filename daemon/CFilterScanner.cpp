@@ -0,0 +1,956 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterScanner.cpp: implementation of the CFilterScanner class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "stdafx.h"
+#include <windows.h>
+#include <wchar.h>
+#include <assert.h>
+
+#pragma warning(disable: 4267) // "conversion from 'size_t' to 'ULONG', possible loss of data"
+#pragma warning(disable: 4996) // "This function or variable may be unsafe..."
+
+#include "CFilterScanner.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CFilterScanner::CFilterScanner()
+{
+	memset(this, 0, sizeof(*this));
+
+	::InitializeCriticalSection(&m_lock);
+	::InitializeCriticalSection(&m_filesLock);
+}
+
+CFilterScanner::~CFilterScanner()
+{
+	Close();
+
+	::DeleteCriticalSection(&m_filesLock);
+	::DeleteCriticalSection(&m_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+HRESULT CFilterScanner::Start(LPCWSTR directory, CFilterScannerTarget *target, ULONG workers, ULONG walkers, ULONG depth)
+{
+	if(!directory || !*directory || !target)
+	{
+		return E_INVALIDARG;
+	}
+	// Already running?
+	if(m_threadsCount)
+	{
+		return E_UNEXPECTED;
+	}
+
+	if(!workers)
+	{
+		SYSTEM_INFO info;
+		memset(&info, 0, sizeof(info));
+
+		::GetSystemInfo(&info);
+
+		// The work is I/O bound, so use some more threads than CPUs
+		workers = 2 * info.dwNumberOfProcessors;
+	}
+	if(!walkers)
+	{
+		walkers = c_walkers;
+	}
+	if(!depth)
+	{
+		depth = c_depth;
+	}
+
+	// Leave room for at least one Worker
+	if(walkers >= c_threadsMax)
+	{
+		walkers = c_threadsMax - 1;
+	}
+	if(walkers + workers > c_threadsMax)
+	{
+		workers = c_threadsMax - walkers;
+	}
+
+	m_target = target;
+
+	memset(&m_progress, 0, sizeof(m_progress));
+
+	HRESULT hr = E_OUTOFMEMORY;
+
+	m_rootLen = wcslen(directory);
+	m_root	  = (LPWSTR) malloc((m_rootLen + 2) * sizeof(WCHAR));
+
+	if(m_root)
+	{
+		wcscpy(m_root, directory);
+
+		// Files are addressed relative to it
+		if(m_root[m_rootLen - 1] != L'\\')
+		{
+			m_root[m_rootLen++] = L'\\';
+			m_root[m_rootLen]	= UNICODE_NULL;
+		}
+
+		m_files		= (LPWSTR*) malloc(depth * sizeof(LPWSTR));
+		m_filesSize = depth;
+
+		if(m_files)
+		{
+			memset(m_files, 0, depth * sizeof(LPWSTR));
+
+			hr = S_OK;
+		}
+	}
+
+	if(SUCCEEDED(hr))
+	{
+		m_cancel			= ::CreateEvent(0, true, false, 0);
+		m_walked			= ::CreateEvent(0, true, false, 0);
+		m_directoriesQueued = ::CreateSemaphore(0, 0, MAXLONG, 0);
+		m_filesQueued		= ::CreateSemaphore(0, 0, depth, 0);
+		m_filesFree			= ::CreateSemaphore(0, depth, depth, 0);
+
+		if(!m_cancel || !m_walked || !m_directoriesQueued || !m_filesQueued || !m_filesFree)
+		{
+			hr = HRESULT_FROM_WIN32(::GetLastError());
+		}
+	}
+
+	if(SUCCEEDED(hr))
+	{
+		// Each Worker keeps its target context, e.g. a driver handle, for all its files
+		for(ULONG index = 0; index < workers; ++index)
+		{
+			m_workers[index].Scanner = this;
+
+			hr = m_target->Attach(&m_workers[index].Context);
+
+			if(FAILED(hr))
+			{
+				break;
+			}
+
+			m_workers[index].Attached = true;
+		}
+	}
+
+	if(SUCCEEDED(hr))
+	{
+		// Seed directory queue with root
+		hr = PushDirectory(m_root, m_rootLen);
+	}
+
+	if(SUCCEEDED(hr))
+	{
+		for(ULONG index = 0; index < walkers + workers; ++index)
+		{
+			DWORD junk = 0;
+
+			m_threads[index] = (index < walkers) ? ::CreateThread(0,0, Walker, this, 0, &junk)
+												 : ::CreateThread(0,0, Worker, m_workers + (index - walkers), 0, &junk);
+			if(!m_threads[index])
+			{
+				hr = HRESULT_FROM_WIN32(::GetLastError());
+				break;
+			}
+
+			m_threadsCount++;
+		}
+
+		// Do not leave a half started job behind
+		if(FAILED(hr) && m_threadsCount)
+		{
+			Cancel();
+			Wait();
+		}
+	}
+
+	if(FAILED(hr))
+	{
+		Close();
+	}
+
+	return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+HRESULT CFilterScanner::Wait(ULONG timeout)
+{
+	if(!m_threadsCount)
+	{
+		return S_OK;
+	}
+
+	DWORD const result = ::WaitForMultipleObjects(m_threadsCount, m_threads, true, timeout);
+
+	if(WAIT_TIMEOUT == result)
+	{
+		return HRESULT_FROM_WIN32(WAIT_TIMEOUT);
+	}
+	if(WAIT_FAILED == result)
+	{
+		return HRESULT_FROM_WIN32(::GetLastError());
+	}
+
+	if(m_cancel && (WAIT_OBJECT_0 == ::WaitForSingleObject(m_cancel, 0)))
+	{
+		return E_ABORT;
+	}
+
+	return (m_progress.Failed) ? S_FALSE : S_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CFilterScanner::Close()
+{
+	if(m_threadsCount)
+	{
+		Cancel();
+		Wait();
+
+		for(ULONG index = 0; index < m_threadsCount; ++index)
+		{
+			::CloseHandle(m_threads[index]);
+			m_threads[index] = 0;
+		}
+
+		m_threadsCount = 0;
+	}
+
+	for(ULONG index = 0; index < c_threadsMax; ++index)
+	{
+		if(m_workers[index].Attached)
+		{
+			m_target->Detach(m_workers[index].Context);
+
+			m_workers[index].Context  = 0;
+			m_workers[index].Attached = false;
+		}
+	}
+
+	HANDLE *const handles[] = { &m_cancel, &m_walked, &m_directoriesQueued, &m_filesQueued, &m_filesFree };
+
+	for(ULONG index = 0; index < sizeof(handles)/sizeof(handles[0]); ++index)
+	{
+		if(*handles[index])
+		{
+			::CloseHandle(*handles[index]);
+			*handles[index] = 0;
+		}
+	}
+
+	for(ULONG index = 0; index < m_directoriesCount; ++index)
+	{
+		free(m_directories[index]);
+	}
+
+	if(m_directories)
+	{
+		free(m_directories);
+		m_directories = 0;
+	}
+
+	m_directoriesCount	  = 0;
+	m_directoriesCapacity = 0;
+	m_pending			  = 0;
+
+	if(m_files)
+	{
+		for(ULONG index = 0; index < m_filesSize; ++index)
+		{
+			if(m_files[index])
+			{
+				free(m_files[index]);
+			}
+		}
+
+		free(m_files);
+		m_files = 0;
+	}
+
+	m_filesSize = 0;
+	m_filesHead = 0;
+	m_filesTail = 0;
+
+	if(m_root)
+	{
+		free(m_root);
+		m_root = 0;
+	}
+
+	m_rootLen = 0;
+	m_target  = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+HRESULT CFilterScanner::PushDirectory(LPCWSTR directory, ULONG directoryLen)
+{
+	assert(directory);
+	assert(directoryLen);
+
+	// Store with trailing backslash
+	LPWSTR const entry = (LPWSTR) malloc((directoryLen + 2) * sizeof(WCHAR));
+
+	if(!entry)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	wcsncpy(entry, directory, directoryLen);
+
+	if(entry[directoryLen - 1] != L'\\')
+	{
+		entry[directoryLen++] = L'\\';
+	}
+
+	entry[directoryLen] = UNICODE_NULL;
+
+	HRESULT hr = S_OK;
+
+	::EnterCriticalSection(&m_lock);
+
+	if(m_directoriesCount == m_directoriesCapacity)
+	{
+		LPWSTR *const directories = (LPWSTR*) realloc(m_directories, (m_directoriesCapacity + c_increment) * sizeof(LPWSTR));
+
+		if(directories)
+		{
+			m_directories		   = directories;
+			m_directoriesCapacity += c_increment;
+		}
+		else
+		{
+			hr = E_OUTOFMEMORY;
+		}
+	}
+
+	if(SUCCEEDED(hr))
+	{
+		m_directories[m_directoriesCount++] = entry;
+
+		::InterlockedIncrement(&m_pending);
+	}
+
+	::LeaveCriticalSection(&m_lock);
+
+	if(SUCCEEDED(hr))
+	{
+		::ReleaseSemaphore(m_directoriesQueued, 1, 0);
+	}
+	else
+	{
+		free(entry);
+	}
+
+	return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CFilterScanner::PushFile(LPCWSTR path, ULONG pathLen)
+{
+	assert(path);
+	assert(pathLen);
+
+	// Wait for a free slot, this throttles the Walkers to the Workers' pace
+	HANDLE const handles[2] = { m_cancel, m_filesFree };
+
+	if(WAIT_OBJECT_0 + 1 != ::WaitForMultipleObjects(2, handles, false, INFINITE))
+	{
+		return false;
+	}
+
+	LPWSTR const entry = (LPWSTR) malloc((pathLen + 1) * sizeof(WCHAR));
+
+	if(!entry)
+	{
+		::ReleaseSemaphore(m_filesFree, 1, 0);
+		::InterlockedIncrement(&m_progress.Failed);
+
+		return true;
+	}
+
+	wcsncpy(entry, path, pathLen);
+	entry[pathLen] = UNICODE_NULL;
+
+	::EnterCriticalSection(&m_filesLock);
+
+	assert(!m_files[m_filesTail]);
+	m_files[m_filesTail] = entry;
+	m_filesTail			 = (m_filesTail + 1) % m_filesSize;
+
+	::LeaveCriticalSection(&m_filesLock);
+
+	::ReleaseSemaphore(m_filesQueued, 1, 0);
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LPWSTR CFilterScanner::PopFile()
+{
+	::EnterCriticalSection(&m_filesLock);
+
+	LPWSTR const entry = m_files[m_filesHead];
+	assert(entry);
+
+	m_files[m_filesHead] = 0;
+	m_filesHead			 = (m_filesHead + 1) % m_filesSize;
+
+	::LeaveCriticalSection(&m_filesLock);
+
+	::ReleaseSemaphore(m_filesFree, 1, 0);
+
+	return entry;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DWORD __stdcall CFilterScanner::Walker(void *context)
+{
+	CFilterScanner *const scanner = (CFilterScanner*) context;
+	assert(scanner);
+
+	HANDLE const handles[3] = { scanner->m_cancel, scanner->m_walked, scanner->m_directoriesQueued };
+
+	while(WAIT_OBJECT_0 + 2 == ::WaitForMultipleObjects(3, handles, false, INFINITE))
+	{
+		LPWSTR directory = 0;
+
+		::EnterCriticalSection(&scanner->m_lock);
+
+		// Work depth first to keep the queue small
+		if(scanner->m_directoriesCount)
+		{
+			directory = scanner->m_directories[--scanner->m_directoriesCount];
+		}
+
+		::LeaveCriticalSection(&scanner->m_lock);
+
+		if(directory)
+		{
+			scanner->WalkDirectory(directory);
+
+			free(directory);
+		}
+
+		// Last one?
+		if(!::InterlockedDecrement(&scanner->m_pending))
+		{
+			::SetEvent(scanner->m_walked);
+		}
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CFilterScanner::WalkDirectory(LPCWSTR directory)
+{
+	assert(directory);
+
+	ULONG const directoryLen = wcslen(directory);
+	assert(directoryLen >= m_rootLen);
+
+	LPWSTR const path = (LPWSTR) malloc((directoryLen + MAX_PATH + 1) * sizeof(WCHAR));
+
+	if(!path)
+	{
+		::InterlockedIncrement(&m_progress.Failed);
+		return;
+	}
+
+	wcscpy(path, directory);
+	wcscpy(path + directoryLen, L"*");
+
+	WIN32_FIND_DATAW find;
+	memset(&find, 0, sizeof(find));
+
+	HANDLE const search = ::FindFirstFileW(path, &find);
+
+	if(INVALID_HANDLE_VALUE != search)
+	{
+		::InterlockedIncrement(&m_progress.Directories);
+
+		do
+		{
+			if(!wcscmp(find.cFileName, L".") || !wcscmp(find.cFileName, L".."))
+			{
+				continue;
+			}
+
+			ULONG const nameLen = wcslen(find.cFileName);
+
+			wcscpy(path + directoryLen, find.cFileName);
+
+			if(find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				// Do not follow junctions and the like
+				if( !(find.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+				{
+					if(FAILED(PushDirectory(path, directoryLen + nameLen)))
+					{
+						::InterlockedIncrement(&m_progress.Failed);
+					}
+				}
+
+				continue;
+			}
+
+			::InterlockedIncrement(&m_progress.Files);
+
+			// Queue path relative to root
+			if(!PushFile(path + m_rootLen, directoryLen + nameLen - m_rootLen))
+			{
+				// Canceled
+				break;
+			}
+		}
+		while(::FindNextFileW(search, &find));
+
+		::FindClose(search);
+	}
+	else
+	{
+		::InterlockedIncrement(&m_progress.Failed);
+	}
+
+	free(path);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DWORD __stdcall CFilterScanner::Worker(void *context)
+{
+	CFilterScannerWorker *const worker = (CFilterScannerWorker*) context;
+	assert(worker);
+
+	CFilterScanner *const scanner = worker->Scanner;
+	assert(scanner);
+	assert(worker->Attached);
+
+	// Drain file queue completely before the end of enumeration is honored
+	HANDLE const handles[3] = { scanner->m_cancel, scanner->m_filesQueued, scanner->m_walked };
+
+	while(WAIT_OBJECT_0 + 1 == ::WaitForMultipleObjects(3, handles, false, INFINITE))
+	{
+		LPWSTR const relative = scanner->PopFile();
+
+		scanner->ProcessFile(worker->Context, relative);
+
+		free(relative);
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CFilterScanner::ProcessFile(void *context, LPCWSTR relative)
+{
+	assert(relative);
+	assert(m_target);
+
+	HRESULT const hr = m_target->Process(context, relative, wcslen(relative));
+
+	::InterlockedIncrement((S_OK == hr) ? &m_progress.Processed : SUCCEEDED(hr) ? &m_progress.Skipped : &m_progress.Failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Scans trees on the local file system through the Win32 stand-ins, with a target that only counts. Every
+ * file must be handed over exactly once, symbolic links to directories are not followed, and the queue
+ * depth bounds the files in flight. Canceling stops walkers and workers. With a file count argument,
+ * e.g. CFilterScanner_test 1000000, a tree of that size is created and scanned by 1 to 8 walkers.
+ */
+class TestTarget : public CFilterScannerTarget
+{
+public:
+
+	TestTarget(ULONG files, ULONG latency = 0) : m_seen((LONG volatile*) calloc(files, sizeof(LONG))), m_files(files), m_latency(latency),
+												 m_attached(0), m_active(0), m_peak(0), m_twice(0), m_unknown(0)
+	{ }
+
+	~TestTarget()
+	{ free((void*) m_seen); }
+
+	virtual HRESULT Attach(void **context)
+	{
+		*context = (void*) (ULONG_PTR) (::InterlockedIncrement(&m_attached) + 0x100);
+
+		return S_OK;
+	}
+
+	virtual void Detach(void *context)
+	{
+		if((ULONG_PTR) context <= 0x100)
+		{
+			::InterlockedIncrement(&m_unknown);
+		}
+
+		::InterlockedDecrement(&m_attached);
+	}
+
+	// Files are named f<index>, those ending in .enc already are, those in .bad fail
+	virtual HRESULT Process(void *context, LPCWSTR relative, ULONG relativeLen)
+	{
+		LONG const active = ::InterlockedIncrement(&m_active);
+
+		LONG peak = __atomic_load_n(&m_peak, __ATOMIC_SEQ_CST);
+
+		while((active > peak) && !__atomic_compare_exchange_n(&m_peak, &peak, active, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		{ }
+
+		if(m_latency)
+		{
+			usleep(m_latency);
+		}
+
+		HRESULT hr = S_OK;
+
+		LPCWSTR const name = wcsrchr(relative, L'\\') ? wcsrchr(relative, L'\\') + 1 : relative;
+		ULONG const index  = wcstoul(name + 1, 0, 10);
+
+		if(!context || (L'f' != name[0]) || (index >= m_files) || (relativeLen != wcslen(relative)))
+		{
+			::InterlockedIncrement(&m_unknown);
+		}
+		else if(::InterlockedIncrement(m_seen + index) > 1)
+		{
+			::InterlockedIncrement(&m_twice);
+		}
+
+		if(wcsstr(name, L".enc"))
+		{
+			hr = S_FALSE;
+		}
+		else if(wcsstr(name, L".bad"))
+		{
+			hr = E_INVALIDARG;
+		}
+
+		::InterlockedDecrement(&m_active);
+
+		return hr;
+	}
+
+	LONG volatile*	m_seen;
+	ULONG			m_files;
+	ULONG			m_latency;		// microseconds per file
+
+	LONG volatile	m_attached;
+	LONG volatile	m_active;
+	LONG volatile	m_peak;
+	LONG volatile	m_twice;
+	LONG volatile	m_unknown;
+};
+
+static int TestRemove(char const* path, struct stat const* info, int flag, struct FTW *ftw)
+{
+	(void) info;
+	(void) flag;
+	(void) ftw;
+
+	return remove(path);
+}
+
+// Creates directories wide * wide below root, each with up to files, and returns the number of files
+static ULONG TestTree(char const* root, ULONG wide, ULONG files, ULONG limit = ~0u)
+{
+	ULONG count = 0;
+
+	char path[PATH_MAX];
+
+	for(ULONG outer = 0; outer < wide; ++outer)
+	{
+		snprintf(path, sizeof(path), "%s/d%u", root, outer);
+		mkdir(path, 0700);
+
+		for(ULONG inner = 0; inner < wide; ++inner)
+		{
+			snprintf(path, sizeof(path), "%s/d%u/d%u", root, outer, inner);
+			mkdir(path, 0700);
+
+			for(ULONG file = 0; (file < files) && (count < limit); ++file, ++count)
+			{
+				snprintf(path, sizeof(path), "%s/d%u/d%u/f%u", root, outer, inner, count);
+
+				int const fd = open(path, O_CREAT | O_WRONLY, 0600);
+
+				if(fd < 0)
+				{
+					return count;
+				}
+
+				close(fd);
+			}
+		}
+	}
+
+	return count;
+}
+
+static void TestPath(char const* local, WCHAR *path, ULONG pathSize)
+{
+	ULONG pos = 0;
+
+	for(; local[pos] && (pos + 1 < pathSize); ++pos)
+	{
+		path[pos] = ('/' == local[pos]) ? L'\\' : (WCHAR) (unsigned char) local[pos];
+	}
+
+	path[pos] = UNICODE_NULL;
+}
+
+static double TestClock()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int TestScan()
+{
+	int failed = 0;
+
+	char root[] = "/tmp/CFilterScanner.XXXXXX";
+
+	if(!mkdtemp(root))
+	{
+		printf("ERROR ON TREE\n");
+		return 1;
+	}
+
+	// 8 * 8 directories with 20 files each, plus some in the root
+	ULONG files = TestTree(root, 8, 20);
+
+	char path[PATH_MAX];
+
+	for(ULONG index = 0; index < 4; ++index, ++files)
+	{
+		snprintf(path, sizeof(path), "%s/f%u%s", root, files, (index & 1) ? ".enc" : (index & 2) ? ".bad" : "");
+		close(open(path, O_CREAT | O_WRONLY, 0600));
+	}
+
+	// Links to directories are not followed, an empty directory is still walked
+	snprintf(path, sizeof(path), "%s/d0", root);
+	char link[PATH_MAX];
+	snprintf(link, sizeof(link), "%s/d1/link", root);
+
+	if(symlink(path, link))
+	{
+		printf("ERROR ON LINK\n");
+		failed++;
+	}
+
+	snprintf(path, sizeof(path), "%s/empty", root);
+	mkdir(path, 0700);
+
+	WCHAR directory[PATH_MAX];
+	TestPath(root, directory, PATH_MAX);
+
+	TestTarget target(files, 20);
+
+	CFilterScanner scanner;
+
+	HRESULT hr = scanner.Start(directory, &target, 8, 2, 4);
+
+	if(SUCCEEDED(hr))
+	{
+		hr = scanner.Wait();
+	}
+
+	CFilterScanner::Progress progress;
+	scanner.GetProgress(&progress);
+
+	// 1 + 8 + 64 + empty
+	if((S_FALSE != hr) || (74 != progress.Directories) || ((LONG) files != progress.Files) ||
+	   ((LONG) files - 3 != progress.Processed) || (2 != progress.Skipped) || (1 != progress.Failed))
+	{
+		printf("ERROR ON SCAN hr[0x%x] directories[%d] files[%d] processed[%d] skipped[%d] failed[%d]\n",
+			   hr, progress.Directories, progress.Files, progress.Processed, progress.Skipped, progress.Failed);
+		failed++;
+	}
+
+	for(ULONG index = 0; index < files; ++index)
+	{
+		if(1 != target.m_seen[index])
+		{
+			printf("ERROR ON FILE [%u] seen[%d]\n", index, target.m_seen[index]);
+			failed++;
+			break;
+		}
+	}
+
+	// Workers run in parallel, one file each
+	if(target.m_twice || target.m_unknown || (target.m_peak < 2) || (target.m_peak > 8))
+	{
+		printf("ERROR ON WORKERS twice[%d] unknown[%d] peak[%d]\n", target.m_twice, target.m_unknown, target.m_peak);
+		failed++;
+	}
+
+	scanner.Close();
+
+	if(target.m_attached)
+	{
+		printf("ERROR ON DETACH [%d]\n", target.m_attached);
+		failed++;
+	}
+
+	// Cancel a slow scan early
+	TestTarget slow(files, 2000);
+
+	hr = scanner.Start(directory, &slow, 2, 1, 2);
+
+	if(SUCCEEDED(hr))
+	{
+		::Sleep(20);
+
+		scanner.Cancel();
+
+		hr = scanner.Wait();
+	}
+
+	scanner.GetProgress(&progress);
+
+	if((E_ABORT != hr) || (progress.Processed >= (LONG) files / 2))
+	{
+		printf("ERROR ON CANCEL hr[0x%x] processed[%d]\n", hr, progress.Processed);
+		failed++;
+	}
+
+	scanner.Close();
+
+	// A missing root fails, but runs to completion
+	TestTarget none(1);
+
+	wcscat(directory, L"\\missing");
+
+	hr = scanner.Start(directory, &none, 1, 1, 1);
+
+	if(SUCCEEDED(hr))
+	{
+		hr = scanner.Wait();
+	}
+
+	scanner.GetProgress(&progress);
+
+	if((S_FALSE != hr) || (1 != progress.Failed) || progress.Files)
+	{
+		printf("ERROR ON MISSING hr[0x%x] failed[%d]\n", hr, progress.Failed);
+		failed++;
+	}
+
+	scanner.Close();
+
+	nftw(root, TestRemove, 16, FTW_DEPTH | FTW_PHYS);
+
+	return failed;
+}
+
+static int Benchmark(ULONG count)
+{
+	int failed = 0;
+
+	char root[] = "/tmp/CFilterScanner.XXXXXX";
+
+	if(!mkdtemp(root))
+	{
+		printf("ERROR ON TREE\n");
+		return 1;
+	}
+
+	// 1000 directories of 1000 files for 1M
+	ULONG wide = 1;
+
+	while(wide * wide * 1000 < count)
+	{
+		wide++;
+	}
+
+	double start = TestClock();
+
+	ULONG const files = TestTree(root, wide, (count + wide * wide - 1) / (wide * wide), count);
+
+	printf("%u files in %u directories created in %.1f s\n", files, wide * wide + wide + 1, TestClock() - start);
+
+	WCHAR directory[PATH_MAX];
+	TestPath(root, directory, PATH_MAX);
+
+	for(ULONG walkers = 1; walkers <= 8; walkers *= 2)
+	{
+		TestTarget target(files);
+
+		CFilterScanner scanner;
+
+		start = TestClock();
+
+		HRESULT hr = scanner.Start(directory, &target, 8, walkers);
+
+		if(SUCCEEDED(hr))
+		{
+			hr = scanner.Wait();
+		}
+
+		double const seconds = TestClock() - start;
+
+		CFilterScanner::Progress progress;
+		scanner.GetProgress(&progress);
+
+		if((S_OK != hr) || ((LONG) files != progress.Processed) || target.m_twice)
+		{
+			printf("ERROR ON BENCHMARK hr[0x%x] processed[%d]\n", hr, progress.Processed);
+			failed++;
+		}
+
+		printf("%u walkers, 8 workers: %.2f s, %.0f files/s\n", walkers, seconds, files / seconds);
+	}
+
+	nftw(root, TestRemove, 16, FTW_DEPTH | FTW_PHYS);
+
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	int failed = TestScan();
+
+	if(argc > 1)
+	{
+		failed += Benchmark((ULONG) atoi(argv[1]));
+	}
+
+	if(CSimWin32::Handles())
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimWin32::Handles());
+		failed++;
+	}
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
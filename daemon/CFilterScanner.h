@@ -0,0 +1,147 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterScanner.h: interface for the CFilterScanner class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilterScanner_H__3E1F6C52_8B0D_4C7A_9D35_61A4F2E0B7C4__INCLUDED_)
+#define AFX_CFilterScanner_H__3E1F6C52_8B0D_4C7A_9D35_61A4F2E0B7C4__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilterScannerTarget
+{
+	// Applies the scanner's operation to single files. Replace it to scan without the driver
+
+public:
+
+	virtual						~CFilterScannerTarget()
+								{ }
+
+	// Called by each Worker before its first file and after its last one, context is passed to Process
+	virtual HRESULT				Attach(void **context) = 0;
+	virtual void				Detach(void *context) = 0;
+
+	// Path is relative to the scanned directory. Returns S_OK if the file was changed, S_FALSE if it
+	// already was in the requested state
+	virtual HRESULT				Process(void *context, LPCWSTR relative, ULONG relativeLen) = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilterScanner
+{
+	// Applies one operation to all files below a directory. Walker threads enumerate the tree and feed
+	// a bounded file queue, Worker threads drain it and hand each file to the target. The queue depth
+	// limits the number of outstanding file operations.
+
+	enum constants
+	{
+		c_increment		= 64,
+		c_threadsMax	= 32,
+		c_walkers		= 2,	// default Walker threads
+		c_depth			= 64,	// default file queue depth
+	};
+
+	struct CFilterScannerWorker
+	{
+		CFilterScanner*			Scanner;
+		void*					Context;		// of target, for all files
+		bool					Attached;
+	};
+
+public:
+
+	struct Progress
+	{
+		LONG					Directories;	// enumerated
+		LONG					Files;			// enumerated
+		LONG					Processed;		// successfully changed
+		LONG					Skipped;		// already in the requested state
+		LONG					Failed;
+	};
+
+								CFilterScanner();
+								~CFilterScanner();
+
+	HRESULT						Start(LPCWSTR directory, CFilterScannerTarget *target,
+									  ULONG workers = 0, ULONG walkers = 0, ULONG depth = 0);
+	HRESULT						Wait(ULONG timeout = INFINITE);
+	void						Cancel();
+	void						Close();
+
+	void						GetProgress(Progress *progress) const;
+
+private:
+
+	HRESULT						PushDirectory(LPCWSTR directory, ULONG directoryLen);
+	bool						PushFile(LPCWSTR path, ULONG pathLen);
+	LPWSTR						PopFile();
+
+	void						WalkDirectory(LPCWSTR directory);
+	void						ProcessFile(void *context, LPCWSTR relative);
+
+	static DWORD	__stdcall	Walker(void *context);
+	static DWORD	__stdcall	Worker(void *context);
+
+								// DATA
+	CRITICAL_SECTION			m_lock;				// Sync for directory queue
+	LPWSTR*						m_directories;
+	ULONG						m_directoriesCount;
+	ULONG						m_directoriesCapacity;
+	HANDLE						m_directoriesQueued;	// Semaphore
+	LONG						m_pending;			// queued and currently enumerated directories
+	HANDLE						m_walked;			// Event, set if enumeration is complete
+
+	CRITICAL_SECTION			m_filesLock;		// Sync for file queue
+	LPWSTR*						m_files;			// Ring buffer
+	ULONG						m_filesSize;
+	ULONG						m_filesHead;
+	ULONG						m_filesTail;
+	HANDLE						m_filesQueued;		// Semaphore
+	HANDLE						m_filesFree;		// Semaphore
+
+	HANDLE						m_cancel;			// Event
+	HANDLE						m_threads[c_threadsMax];
+	CFilterScannerWorker		m_workers[c_threadsMax];
+	ULONG						m_threadsCount;
+
+	LPWSTR						m_root;				// Win32 path, with trailing backslash
+	ULONG						m_rootLen;
+
+	CFilterScannerTarget*		m_target;
+
+	Progress					m_progress;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+void CFilterScanner::Cancel()
+{
+	if(m_cancel)
+	{
+		::SetEvent(m_cancel);
+	}
+}
+
+inline
+void CFilterScanner::GetProgress(Progress *progress) const
+{
+	assert(progress);
+
+	progress->Directories = m_progress.Directories;
+	progress->Files		  = m_progress.Files;
+	progress->Processed	  = m_progress.Processed;
+	progress->Skipped	  = m_progress.Skipped;
+	progress->Failed	  = m_progress.Failed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // !defined(AFX_CFilterScanner_H__3E1F6C52_8B0D_4C7A_9D35_61A4F2E0B7C4__INCLUDED_)
@@ -34,6 +34,8 @@ enum FILFILE_CONTROL_FLAGS
 	FILFILE_CONTROL_WIPE_ON_DELETE	= 0x800,
 	FILFILE_CONTROL_RECOVER			= 0x1000,
 	FILFILE_CONTROL_APPLICATION		= 0x2000,
+	FILFILE_CONTROL_BACKGROUND		= 0x4000,
+	FILFILE_CONTROL_PAGED			= 0x8000,
 };
 
 struct FILFILE_CONTROL
@@ -84,6 +86,72 @@ struct FILFILE_CONTROL_OUT
 	ULONG			PayloadSize;
 };	
 
+// Paged Entity enumeration: Value1 holds the Cursor, Value2 the Generation of the previous page,
+// both zero to start over. The page is returned as this struct, followed by Count zero terminated
+// paths. A Cursor taken under a different Generation restarts the enumeration.
+enum FILFILE_ENUM_FLAGS
+{
+	FILFILE_ENUM_RESTARTED			= 0x1,	// Entities changed, page starts over from the first one
+	FILFILE_ENUM_UNCHANGED			= 0x2,	// Entities unchanged since given Generation, no paths follow
+};
+
+struct FILFILE_ENUM_PAGE
+{
+	ULONG			Generation;		// of the Entities the page was taken from
+	ULONG			Cursor;			// to be passed on for the next page, 0 := enumeration complete
+	ULONG			Count;			// paths following
+	ULONG			Flags;			// FILFILE_ENUM_FLAGS
+};
+
+enum FILFILE_STATISTICS_COUNTER
+{
+	FILFILE_STAT_CREATE_TRACKED		= 0,	// creates on tracked files and directories
+	FILFILE_STAT_CREATE_SKIPPED		= 1,	// creates passed through
+	FILFILE_STAT_HEADER_PROBES		= 2,	// Header reads from disk
+	FILFILE_STAT_KEY_REQUESTS		= 3,	// Key requests answered by user mode
+	FILFILE_STAT_KEY_FAILED			= 4,	// Key requests failed or timed out
+	FILFILE_STAT_KEY_WAIT			= 5,	// overall time waited for Keys, in milliseconds
+	FILFILE_STAT_BOUNCE_BUFFERS		= 6,	// intermediate buffers allocated on read/write
+	FILFILE_STAT_NONALIGNED_RMW		= 7,	// read/modify/write cycles on non-aligned requests
+	FILFILE_STAT_CACHE_HITS			= 8,	// Header cache
+	FILFILE_STAT_CACHE_MISSES		= 9,
+	FILFILE_STAT_AUTOCONFIG_OPENS	= 10,	// AutoConfig files looked up on disk
+	FILFILE_STAT_AUTOCONFIG_AVOIDED	= 11,	// dito, answered from cache of missing ones
+	FILFILE_STAT_DECISION_HITS		= 12,	// directory opens passed through by cached decision
+	FILFILE_STAT_READAHEAD_HITS		= 13,	// non-cached redirector reads served from decrypted window
+	FILFILE_STAT_WIPE_DEFERRED		= 14,	// deleted files wiped in background
+	FILFILE_STAT_WIPE_FAILED		= 15,	// dito, wipe or delete failed, kept for retry
+	FILFILE_STAT_COUNT				= 16,
+
+	FILFILE_STAT_MODES				= 8,	// indexed by cipher mode
+	FILFILE_STAT_HISTOGRAM			= 16,	// Key wait buckets, bucket N counts waits below 2^N milliseconds
+
+	FILFILE_STAT_STAGE_PRECREATE	= 0,	// decision stages, timed if ProfileDecisions is set
+	FILFILE_STAT_STAGE_POSTCREATE	= 1,
+	FILFILE_STAT_STAGE_ENTITY		= 2,	// lookup of active Entities
+	FILFILE_STAT_STAGE_BLACKLIST	= 3,
+	FILFILE_STAT_STAGE_APPLIST		= 4,
+	FILFILE_STAT_STAGE_HEADER		= 5,	// Header reads from disk
+	FILFILE_STAT_STAGE_TRACKER		= 6,	// FO lookup on read/write
+	FILFILE_STAT_STAGES				= 8,
+	FILFILE_STAT_LATENCY			= 8,	// Stage buckets, bucket N counts stages below 4^N microseconds
+};
+
+struct FILFILE_STATISTICS
+{
+	ULONG			Volume;			// Volume identifier, 0 := driver wide counters
+	ULONG			Mode;			// cipher mode used on new files
+
+	ULONGLONG		Counter[FILFILE_STAT_COUNT];
+	ULONGLONG		Encrypted[FILFILE_STAT_MODES];		// bytes, per cipher mode
+	ULONGLONG		Decrypted[FILFILE_STAT_MODES];		// dito
+	ULONGLONG		KeyWait[FILFILE_STAT_HISTOGRAM];
+
+	ULONGLONG		StageCalls[FILFILE_STAT_STAGES];
+	ULONGLONG		StageTime[FILFILE_STAT_STAGES];		// microseconds
+	ULONGLONG		StageLatency[FILFILE_STAT_STAGES][FILFILE_STAT_LATENCY];
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #ifndef CTL_CODE
@@ -119,6 +187,8 @@ struct FILFILE_CONTROL_OUT
 
 #define IOCTL_FILFILE_SET_READONLY			CTL_CODE(IOCTL_FILFILE_BASE, 0x0610, METHOD_BUFFERED,   FILE_WRITE_ACCESS)
 
+#define IOCTL_FILFILE_STATISTICS			CTL_CODE(IOCTL_FILFILE_BASE, 0x0612, METHOD_OUT_DIRECT,	FILE_READ_ACCESS)
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #endif // _FILFILE_IOCONTROL_H_
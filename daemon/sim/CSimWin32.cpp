@@ -0,0 +1,879 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CSimWin32.cpp: implementation of the CSimWin32 class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "windows.h"
+#include "lmdfs.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum SimHandleType
+{
+	c_handleEvent	  = 0x45564e54,
+	c_handleThread	  = 0x54485244,
+	c_handleSemaphore = 0x53454d41,
+	c_handleFind	  = 0x46494e44,
+};
+
+struct SimHandle
+{
+	ULONG				Type;
+
+	pthread_mutex_t		Lock;
+	pthread_cond_t		Signal;
+	bool				Signaled;
+	bool				Manual;
+
+	LONG				Count;		// of semaphores
+	LONG				Maximum;
+
+	pthread_t			Thread;
+};
+
+struct SimFind
+{
+	ULONG				Type;
+
+	DIR*				Directory;
+	char				Path[PATH_MAX];		// of the directory, with trailing slash
+	ULONG				PathLength;
+};
+
+struct SimWork
+{
+	LPTHREAD_START_ROUTINE	Routine;
+	void*					Context;
+	SimHandle*				Handle;		// 0 for work items
+};
+
+static pthread_mutex_t		s_lock	= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		s_idle	= PTHREAD_COND_INITIALIZER;
+
+// Waits on several handles sleep here, each signal wakes them to check all of theirs again
+static pthread_mutex_t		s_waitLock	  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		s_waitAny	  = PTHREAD_COND_INITIALIZER;
+static LONG volatile		s_waitAnyCount = 0;
+
+static ULONG volatile		s_tick	= 1;
+static LONG					s_work	= 0;
+static LONG volatile		s_handles = 0;
+
+static WCHAR				s_connections[CSimWin32::c_drives][CSimWin32::c_uncLength];
+
+static __thread DWORD		s_lastError = 0;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void Fail(char const* message)
+{
+	fprintf(stderr, "sim: %s\n", message);
+	abort();
+}
+
+static SimHandle* NewHandle(ULONG type, bool manual, bool signaled)
+{
+	SimHandle *const handle = (SimHandle*) calloc(1, sizeof(SimHandle));
+
+	if(!handle)
+	{
+		return 0;
+	}
+
+	handle->Type	 = type;
+	handle->Manual	 = manual;
+	handle->Signaled = signaled;
+
+	pthread_mutex_init(&handle->Lock, 0);
+	pthread_cond_init(&handle->Signal, 0);
+
+	InterlockedIncrement(&s_handles);
+
+	return handle;
+}
+
+static SimHandle* Handle(HANDLE handle)
+{
+	SimHandle *const sim = (SimHandle*) handle;
+
+	if(!sim || ((sim->Type != c_handleEvent) && (sim->Type != c_handleThread) && (sim->Type != c_handleSemaphore)))
+	{
+		Fail("invalid handle");
+	}
+
+	return sim;
+}
+
+static void SignalAny()
+{
+	if(__atomic_load_n(&s_waitAnyCount, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&s_waitLock);
+		pthread_cond_broadcast(&s_waitAny);
+		pthread_mutex_unlock(&s_waitLock);
+	}
+}
+
+static void Signal(SimHandle *handle)
+{
+	pthread_mutex_lock(&handle->Lock);
+
+	handle->Signaled = true;
+
+	pthread_cond_broadcast(&handle->Signal);
+	pthread_mutex_unlock(&handle->Lock);
+
+	SignalAny();
+}
+
+// Takes the handle if it is signaled, as a satisfied wait does. Called under its lock
+static bool Acquire(SimHandle *handle)
+{
+	if(c_handleSemaphore == handle->Type)
+	{
+		if(!handle->Count)
+		{
+			return false;
+		}
+
+		handle->Count--;
+
+		return true;
+	}
+
+	if(!handle->Signaled)
+	{
+		return false;
+	}
+
+	// Auto-reset events release one waiter
+	if((c_handleEvent == handle->Type) && !handle->Manual)
+	{
+		handle->Signaled = false;
+	}
+
+	return true;
+}
+
+static void Deadline(struct timespec *deadline, DWORD milliseconds)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+
+	deadline->tv_sec  += milliseconds / 1000;
+	deadline->tv_nsec += (milliseconds % 1000) * 1000000L;
+
+	if(deadline->tv_nsec >= 1000000000L)
+	{
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+static void* Start(void *context)
+{
+	SimWork *const work = (SimWork*) context;
+
+	work->Routine(work->Context);
+
+	if(work->Handle)
+	{
+		Signal(work->Handle);
+	}
+	else
+	{
+		pthread_mutex_lock(&s_lock);
+
+		if(!--s_work)
+		{
+			pthread_cond_broadcast(&s_idle);
+		}
+
+		pthread_mutex_unlock(&s_lock);
+	}
+
+	free(work);
+
+	return 0;
+}
+
+static bool Run(LPTHREAD_START_ROUTINE routine, void *context, SimHandle *handle)
+{
+	SimWork *const work = (SimWork*) malloc(sizeof(SimWork));
+
+	if(!work)
+	{
+		return false;
+	}
+
+	work->Routine = routine;
+	work->Context = context;
+	work->Handle  = handle;
+
+	pthread_t thread;
+
+	if(pthread_create(handle ? &handle->Thread : &thread, 0, Start, work))
+	{
+		free(work);
+		return false;
+	}
+
+	if(!handle)
+	{
+		pthread_detach(thread);
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CSimWin32::Advance(ULONG milliseconds)
+{
+	__atomic_add_fetch(&s_tick, milliseconds, __ATOMIC_SEQ_CST);
+}
+
+void CSimWin32::Connect(WCHAR drive, LPCWSTR unc)
+{
+	ULONG const index = towupper(drive) - L'A';
+
+	if(index >= c_drives)
+	{
+		Fail("invalid drive");
+	}
+
+	s_connections[index][0] = UNICODE_NULL;
+
+	if(unc)
+	{
+		wcsncpy(s_connections[index], unc, c_uncLength - 1);
+	}
+}
+
+void CSimWin32::Drain()
+{
+	pthread_mutex_lock(&s_lock);
+
+	while(s_work)
+	{
+		pthread_cond_wait(&s_idle, &s_lock);
+	}
+
+	pthread_mutex_unlock(&s_lock);
+}
+
+LONG CSimWin32::Handles()
+{
+	return s_handles;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SYNCHRONIZATION
+
+void InitializeCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_t *const mutex = (pthread_mutex_t*) malloc(sizeof(pthread_mutex_t));
+
+	if(!mutex)
+	{
+		Fail("out of memory");
+	}
+
+	pthread_mutexattr_t attributes;
+	pthread_mutexattr_init(&attributes);
+	pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+
+	pthread_mutex_init(mutex, &attributes);
+	pthread_mutexattr_destroy(&attributes);
+
+	section->Mutex = mutex;
+}
+
+void DeleteCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_destroy((pthread_mutex_t*) section->Mutex);
+	free(section->Mutex);
+
+	section->Mutex = 0;
+}
+
+void EnterCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_lock((pthread_mutex_t*) section->Mutex);
+}
+
+void LeaveCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_unlock((pthread_mutex_t*) section->Mutex);
+}
+
+LONG InterlockedIncrement(LONG volatile *value)
+{
+	return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+LONG InterlockedDecrement(LONG volatile *value)
+{
+	return __atomic_sub_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+LONG InterlockedExchangeAdd(LONG volatile *value, LONG add)
+{
+	return __atomic_fetch_add(value, add, __ATOMIC_SEQ_CST);
+}
+
+HANDLE CreateEvent(void *attributes, BOOL manual, BOOL initial, LPCWSTR name)
+{
+	if(attributes || name)
+	{
+		Fail("named events not supported");
+	}
+
+	return NewHandle(c_handleEvent, manual ? true : false, initial ? true : false);
+}
+
+BOOL SetEvent(HANDLE event)
+{
+	Signal(Handle(event));
+
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE event)
+{
+	SimHandle *const handle = Handle(event);
+
+	pthread_mutex_lock(&handle->Lock);
+	handle->Signaled = false;
+	pthread_mutex_unlock(&handle->Lock);
+
+	return TRUE;
+}
+
+HANDLE CreateSemaphore(void *attributes, LONG initial, LONG maximum, LPCWSTR name)
+{
+	if(attributes || name)
+	{
+		Fail("named semaphores not supported");
+	}
+
+	if((maximum <= 0) || (initial < 0) || (initial > maximum))
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+
+	SimHandle *const handle = NewHandle(c_handleSemaphore, false, false);
+
+	if(handle)
+	{
+		handle->Count	= initial;
+		handle->Maximum = maximum;
+	}
+
+	return handle;
+}
+
+BOOL ReleaseSemaphore(HANDLE semaphore, LONG release, LONG *previous)
+{
+	SimHandle *const handle = Handle(semaphore);
+
+	if(c_handleSemaphore != handle->Type)
+	{
+		Fail("not a semaphore");
+	}
+
+	pthread_mutex_lock(&handle->Lock);
+
+	if((release <= 0) || (release > handle->Maximum - handle->Count))
+	{
+		pthread_mutex_unlock(&handle->Lock);
+
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	if(previous)
+	{
+		*previous = handle->Count;
+	}
+
+	handle->Count += release;
+
+	pthread_cond_broadcast(&handle->Signal);
+	pthread_mutex_unlock(&handle->Lock);
+
+	SignalAny();
+
+	return TRUE;
+}
+
+DWORD WaitForSingleObject(HANDLE object, DWORD milliseconds)
+{
+	SimHandle *const handle = Handle(object);
+
+	struct timespec deadline;
+	Deadline(&deadline, milliseconds);
+
+	DWORD result = WAIT_OBJECT_0;
+
+	pthread_mutex_lock(&handle->Lock);
+
+	while(!Acquire(handle))
+	{
+		if(INFINITE == milliseconds)
+		{
+			pthread_cond_wait(&handle->Signal, &handle->Lock);
+		}
+		else if(pthread_cond_timedwait(&handle->Signal, &handle->Lock, &deadline))
+		{
+			result = WAIT_TIMEOUT;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&handle->Lock);
+
+	return result;
+}
+
+DWORD WaitForMultipleObjects(DWORD count, HANDLE const* handles, BOOL all, DWORD milliseconds)
+{
+	if(!count || !handles)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return WAIT_FAILED;
+	}
+
+	struct timespec deadline;
+	Deadline(&deadline, milliseconds);
+
+	if(all)
+	{
+		// One after the other, which is the same for threads and manual events only
+		for(DWORD index = 0; index < count; ++index)
+		{
+			SimHandle *const handle = Handle(handles[index]);
+
+			if(!handle->Manual)
+			{
+				Fail("wait for all on auto reset objects not supported");
+			}
+
+			pthread_mutex_lock(&handle->Lock);
+
+			while(!handle->Signaled)
+			{
+				if(INFINITE == milliseconds)
+				{
+					pthread_cond_wait(&handle->Signal, &handle->Lock);
+				}
+				else if(pthread_cond_timedwait(&handle->Signal, &handle->Lock, &deadline))
+				{
+					pthread_mutex_unlock(&handle->Lock);
+
+					return WAIT_TIMEOUT;
+				}
+			}
+
+			pthread_mutex_unlock(&handle->Lock);
+		}
+
+		return WAIT_OBJECT_0;
+	}
+
+	DWORD result = WAIT_TIMEOUT;
+
+	pthread_mutex_lock(&s_waitLock);
+
+	// Announced before looking, so that signals from now on wake us
+	__atomic_add_fetch(&s_waitAnyCount, 1, __ATOMIC_SEQ_CST);
+
+	for(;;)
+	{
+		// The first signaled one in order wins, as on Win32
+		for(DWORD index = 0; index < count; ++index)
+		{
+			SimHandle *const handle = Handle(handles[index]);
+
+			pthread_mutex_lock(&handle->Lock);
+			bool const acquired = Acquire(handle);
+			pthread_mutex_unlock(&handle->Lock);
+
+			if(acquired)
+			{
+				result = WAIT_OBJECT_0 + index;
+				break;
+			}
+		}
+
+		if(WAIT_TIMEOUT != result)
+		{
+			break;
+		}
+
+		if(INFINITE == milliseconds)
+		{
+			pthread_cond_wait(&s_waitAny, &s_waitLock);
+		}
+		else if(pthread_cond_timedwait(&s_waitAny, &s_waitLock, &deadline))
+		{
+			break;
+		}
+	}
+
+	__atomic_sub_fetch(&s_waitAnyCount, 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_unlock(&s_waitLock);
+
+	return result;
+}
+
+BOOL CloseHandle(HANDLE object)
+{
+	SimHandle *const handle = Handle(object);
+
+	if(c_handleThread == handle->Type)
+	{
+		// Threads are joined on their last handle, waiting first is up to the caller
+		pthread_join(handle->Thread, 0);
+	}
+
+	pthread_cond_destroy(&handle->Signal);
+	pthread_mutex_destroy(&handle->Lock);
+
+	handle->Type = 0;
+	free(handle);
+
+	InterlockedDecrement(&s_handles);
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// THREADS
+
+HANDLE CreateThread(void *attributes, SIZE_T stackSize, LPTHREAD_START_ROUTINE routine, void *context, DWORD flags, LPDWORD id)
+{
+	if(attributes || flags)
+	{
+		Fail("thread attributes not supported");
+	}
+
+	SimHandle *const handle = NewHandle(c_handleThread, true, false);
+
+	if(!handle)
+	{
+		return 0;
+	}
+
+	if(!Run(routine, context, handle))
+	{
+		CloseHandle(handle);
+		return 0;
+	}
+
+	if(id)
+	{
+		*id = (DWORD) (ULONG_PTR) handle;
+	}
+
+	return handle;
+}
+
+BOOL QueueUserWorkItem(LPTHREAD_START_ROUTINE routine, void *context, ULONG flags)
+{
+	(void) flags;
+
+	pthread_mutex_lock(&s_lock);
+	s_work++;
+	pthread_mutex_unlock(&s_lock);
+
+	if(!Run(routine, context, 0))
+	{
+		pthread_mutex_lock(&s_lock);
+
+		if(!--s_work)
+		{
+			pthread_cond_broadcast(&s_idle);
+		}
+
+		pthread_mutex_unlock(&s_lock);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void Sleep(DWORD milliseconds)
+{
+	usleep(milliseconds * 1000);
+}
+
+DWORD GetTickCount()
+{
+	return __atomic_load_n(&s_tick, __ATOMIC_SEQ_CST);
+}
+
+DWORD GetLastError()
+{
+	return s_lastError;
+}
+
+void SetLastError(DWORD error)
+{
+	s_lastError = error;
+}
+
+void GetSystemInfo(SYSTEM_INFO *info)
+{
+	long const processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+	info->dwNumberOfProcessors = (processors > 0) ? (DWORD) processors : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FILES AND NETWORK
+
+// Maps paths without drive and server name to the local file system, characters are taken as bytes
+static bool LocalPath(LPCWSTR path, ULONG pathLength, char *local, ULONG localSize)
+{
+	if(!path || (L'\\' != path[0]) || (L'\\' == path[1]) || (pathLength >= localSize))
+	{
+		return false;
+	}
+
+	for(ULONG pos = 0; pos < pathLength; ++pos)
+	{
+		if(path[pos] > 0xff)
+		{
+			return false;
+		}
+
+		local[pos] = (L'\\' == path[pos]) ? '/' : (char) path[pos];
+	}
+
+	local[pathLength] = 0;
+
+	return true;
+}
+
+static DWORD LocalAttributes(char const* path, unsigned char type)
+{
+	struct stat info;
+
+	switch(type)
+	{
+		case DT_DIR:
+			return FILE_ATTRIBUTE_DIRECTORY;
+
+		case DT_REG:
+			return FILE_ATTRIBUTE_NORMAL;
+
+		case DT_LNK:
+			// As junctions, which are directories too if their target is one
+			return FILE_ATTRIBUTE_REPARSE_POINT | ((!stat(path, &info) && S_ISDIR(info.st_mode)) ? FILE_ATTRIBUTE_DIRECTORY : 0);
+
+		default:
+			break;
+	}
+
+	if(lstat(path, &info))
+	{
+		return INVALID_FILE_ATTRIBUTES;
+	}
+
+	return LocalAttributes(path, S_ISDIR(info.st_mode) ? DT_DIR : S_ISLNK(info.st_mode) ? DT_LNK : DT_REG);
+}
+
+DWORD GetFileAttributes(LPCWSTR path)
+{
+	char local[PATH_MAX];
+
+	if(!LocalPath(path, path ? (ULONG) wcslen(path) : 0, local, sizeof(local)))
+	{
+		// No network below
+		SetLastError(ERROR_BAD_NET_NAME);
+
+		return INVALID_FILE_ATTRIBUTES;
+	}
+
+	DWORD const attributes = LocalAttributes(local, DT_UNKNOWN);
+
+	if(INVALID_FILE_ATTRIBUTES == attributes)
+	{
+		SetLastError(ERROR_FILE_NOT_FOUND);
+	}
+
+	return attributes;
+}
+
+HANDLE FindFirstFile(LPCWSTR pattern, WIN32_FIND_DATA *data)
+{
+	ULONG const patternLength = pattern ? (ULONG) wcslen(pattern) : 0;
+
+	// Only all entries of a directory, as in \tmp\*
+	if((patternLength < 2) || wcscmp(pattern + patternLength - 2, L"\\*"))
+	{
+		SetLastError(pattern && (L'\\' == pattern[0]) && (L'\\' != pattern[1]) ? ERROR_NOT_SUPPORTED : ERROR_PATH_NOT_FOUND);
+
+		return INVALID_HANDLE_VALUE;
+	}
+
+	SimFind *const find = (SimFind*) calloc(1, sizeof(SimFind));
+
+	if(!find)
+	{
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+
+		return INVALID_HANDLE_VALUE;
+	}
+
+	if(!LocalPath(pattern, patternLength - 1, find->Path, sizeof(find->Path) - MAX_PATH) || !(find->Directory = opendir(find->Path)))
+	{
+		free(find);
+
+		SetLastError(ERROR_PATH_NOT_FOUND);
+
+		return INVALID_HANDLE_VALUE;
+	}
+
+	find->Type		 = c_handleFind;
+	find->PathLength = (ULONG) strlen(find->Path);
+
+	InterlockedIncrement(&s_handles);
+
+	// Every directory has at least . and ..
+	if(!FindNextFile(find, data))
+	{
+		FindClose(find);
+
+		SetLastError(ERROR_FILE_NOT_FOUND);
+
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return find;
+}
+
+BOOL FindNextFile(HANDLE handle, WIN32_FIND_DATA *data)
+{
+	SimFind *const find = (SimFind*) handle;
+
+	if(!find || (c_handleFind != find->Type) || !data)
+	{
+		Fail("invalid find handle");
+	}
+
+	while(struct dirent const* entry = readdir(find->Directory))
+	{
+		ULONG const nameLength = (ULONG) strlen(entry->d_name);
+
+		// Win32 names are shorter
+		if(nameLength >= MAX_PATH)
+		{
+			continue;
+		}
+
+		memcpy(find->Path + find->PathLength, entry->d_name, nameLength + 1);
+
+		data->dwFileAttributes = LocalAttributes(find->Path, entry->d_type);
+
+		if(INVALID_FILE_ATTRIBUTES == data->dwFileAttributes)
+		{
+			// Gone meanwhile
+			continue;
+		}
+
+		for(ULONG pos = 0; pos <= nameLength; ++pos)
+		{
+			data->cFileName[pos] = (WCHAR) (unsigned char) entry->d_name[pos];
+		}
+
+		return TRUE;
+	}
+
+	SetLastError(ERROR_NO_MORE_FILES);
+
+	return FALSE;
+}
+
+BOOL FindClose(HANDLE handle)
+{
+	SimFind *const find = (SimFind*) handle;
+
+	if(!find || (c_handleFind != find->Type))
+	{
+		Fail("invalid find handle");
+	}
+
+	closedir(find->Directory);
+
+	find->Type = 0;
+	free(find);
+
+	InterlockedDecrement(&s_handles);
+
+	return TRUE;
+}
+
+DWORD WNetGetConnection(LPCWSTR local, LPWSTR remote, LPDWORD remoteLength)
+{
+	if(!local || !remote || !remoteLength || !local[0] || (local[1] != L':'))
+	{
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	ULONG const index = towupper(local[0]) - L'A';
+
+	if((index >= CSimWin32::c_drives) || !s_connections[index][0])
+	{
+		return ERROR_NOT_CONNECTED;
+	}
+
+	ULONG const length = (ULONG) wcslen(s_connections[index]);
+
+	if(*remoteLength <= length)
+	{
+		*remoteLength = length + 1;
+
+		return ERROR_INSUFFICIENT_BUFFER;
+	}
+
+	wcscpy(remote, s_connections[index]);
+
+	return NO_ERROR;
+}
+
+NET_API_STATUS NetDfsGetClientInfo(LPWSTR entryPath, LPWSTR serverName, LPWSTR shareName, DWORD level, BYTE **buffer)
+{
+	(void) entryPath;
+	(void) serverName;
+	(void) shareName;
+	(void) level;
+
+	*buffer = 0;
+
+	return ERROR_NOT_FOUND;
+}
+
+NET_API_STATUS NetApiBufferFree(void *buffer)
+{
+	free(buffer);
+
+	return NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
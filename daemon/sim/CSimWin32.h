@@ -0,0 +1,38 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CSimWin32.h: interface for the CSimWin32 class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CSimWin32_H__4E0B6D2A_95C3_4F7E_B1A8_6C2D9E13F705__INCLUDED_)
+#define AFX_CSimWin32_H__4E0B6D2A_95C3_4F7E_B1A8_6C2D9E13F705__INCLUDED_
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CSimWin32
+{
+	// Implements the Win32 calls of windows.h on POSIX. The tick count is virtual and only moves on
+	// Advance(), so that cache lifetimes can be tested without waiting. Work items run on threads of
+	// their own. Drive connections are a table set by Connect(), there is no network below. Paths
+	// without drive and server name are those of the local file system.
+
+public:
+
+	enum c_constants
+	{
+		c_drives	= 26,
+		c_uncLength	= 256,
+	};
+
+	static void				Advance(ULONG milliseconds);
+	static void				Connect(WCHAR drive, LPCWSTR unc);		// 0 unc disconnects
+	static void				Drain();								// waits for queued work items
+
+	static LONG				Handles();								// outstanding
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CSimWin32_H__4E0B6D2A_95C3_4F7E_B1A8_6C2D9E13F705__INCLUDED_)
@@ -0,0 +1,12 @@
+// lm.h - user mode stand-in, see CSimWin32
+
+#ifndef _SIM_LM_H_
+#define _SIM_LM_H_
+
+#include "windows.h"
+
+typedef DWORD		NET_API_STATUS;
+
+NET_API_STATUS		NetApiBufferFree(void *buffer);
+
+#endif // _SIM_LM_H_
@@ -0,0 +1,32 @@
+// lmdfs.h - user mode stand-in, see CSimWin32. There is no DFS client, referrals always fail.
+
+#ifndef _SIM_LMDFS_H_
+#define _SIM_LMDFS_H_
+
+#include "lm.h"
+
+#define DFS_STORAGE_STATE_OFFLINE	0x0001
+#define DFS_STORAGE_STATE_ONLINE	0x0002
+#define DFS_STORAGE_STATE_ACTIVE	0x0004
+
+struct DFS_STORAGE_INFO
+{
+	ULONG			State;
+	LPWSTR			ServerName;
+	LPWSTR			ShareName;
+};
+
+struct DFS_INFO_4
+{
+	LPWSTR				EntryPath;
+	LPWSTR				Comment;
+	DWORD				State;
+	ULONG				Timeout;
+	BYTE				Guid[16];
+	DWORD				NumberOfStorages;
+	DFS_STORAGE_INFO*	Storage;
+};
+
+NET_API_STATUS		NetDfsGetClientInfo(LPWSTR entryPath, LPWSTR serverName, LPWSTR shareName, DWORD level, BYTE **buffer);
+
+#endif // _SIM_LMDFS_H_
@@ -0,0 +1,13 @@
+// tchar.h - user mode stand-in, the daemon is always built for UNICODE
+
+#ifndef _SIM_TCHAR_H_
+#define _SIM_TCHAR_H_
+
+#include "windows.h"
+
+typedef WCHAR		TCHAR;
+
+#define _T(x)		L##x
+#define _TEXT(x)	L##x
+
+#endif // _SIM_TCHAR_H_
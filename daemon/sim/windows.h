@@ -0,0 +1,168 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// windows.h - user mode stand-in for the Win32 headers of the daemon, see CSimWin32
+//
+// Author: Michael Alexander Priske
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SIM_WINDOWS_H_
+#define _SIM_WINDOWS_H_
+
+// Only what the daemon's portable parts use is defined here, with the names and semantics of Win32 on top
+// of pthreads. WCHAR is the native wchar_t, so the C library's wide string functions apply unchanged.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <wchar.h>
+#include <wctype.h>
+
+// COMPILER ///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define __stdcall
+#define __cdecl
+#define WINAPI
+#define CALLBACK
+
+// TYPES //////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef unsigned char		UCHAR, BYTE;
+typedef unsigned short		USHORT, WORD;
+typedef int					LONG, BOOL, INT;
+typedef unsigned int		ULONG, DWORD, UINT;
+typedef long long			LONGLONG;
+typedef unsigned long long	ULONGLONG;
+typedef uintptr_t			ULONG_PTR;
+typedef size_t				SIZE_T;
+typedef LONG				HRESULT;
+typedef wchar_t				WCHAR;
+typedef WCHAR*				LPWSTR;
+typedef WCHAR const*		LPCWSTR;
+typedef void*				LPVOID;
+typedef void*				HANDLE;
+typedef DWORD*				LPDWORD;
+
+#define TRUE				1
+#define FALSE				0
+#define UNICODE_NULL		((WCHAR) 0)
+#define INFINITE			0xffffffff
+#define MAX_PATH			260
+#define MAXLONG				0x7fffffff
+
+#define INVALID_HANDLE_VALUE		((HANDLE) (intptr_t) -1)
+#define INVALID_FILE_ATTRIBUTES		((DWORD) -1)
+#define FILE_ATTRIBUTE_DIRECTORY	0x00000010
+#define FILE_ATTRIBUTE_NORMAL		0x00000080
+#define FILE_ATTRIBUTE_REPARSE_POINT	0x00000400
+
+// ERRORS /////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define ERROR_SUCCESS				0
+#define NO_ERROR					0
+#define ERROR_FILE_NOT_FOUND		2
+#define ERROR_PATH_NOT_FOUND		3
+#define ERROR_NOT_ENOUGH_MEMORY		8
+#define ERROR_NO_MORE_FILES			18
+#define ERROR_NOT_SUPPORTED			50
+#define ERROR_BAD_NET_NAME			67
+#define ERROR_INVALID_PARAMETER		87
+#define ERROR_INSUFFICIENT_BUFFER	122
+#define ERROR_NOT_CONNECTED			2250
+#define ERROR_NOT_FOUND				1168
+
+#define S_OK						((HRESULT) 0)
+#define S_FALSE						((HRESULT) 1)
+#define E_UNEXPECTED				((HRESULT) 0x8000ffff)
+#define E_NOINTERFACE				((HRESULT) 0x80004002)
+#define E_ABORT						((HRESULT) 0x80004004)
+#define E_OUTOFMEMORY				((HRESULT) 0x8007000e)
+#define E_INVALIDARG				((HRESULT) 0x80070057)
+
+#define SUCCEEDED(hr)				(((HRESULT) (hr)) >= 0)
+#define FAILED(hr)					(((HRESULT) (hr)) < 0)
+#define HRESULT_FROM_WIN32(err)		((HRESULT) (err) <= 0 ? (HRESULT) (err) : (HRESULT) (((err) & 0x0000ffff) | 0x80070000))
+
+// STRINGS ////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define _wcsnicmp					wcsncasecmp
+#define wcsnicmp					wcsncasecmp
+#define _wcsicmp					wcscasecmp
+#define _snwprintf					swprintf
+
+// SYNCHRONIZATION ////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct CRITICAL_SECTION
+{
+	void*			Mutex;					// recursive, as critical sections are
+};
+
+void	InitializeCriticalSection(CRITICAL_SECTION *section);
+void	DeleteCriticalSection(CRITICAL_SECTION *section);
+void	EnterCriticalSection(CRITICAL_SECTION *section);
+void	LeaveCriticalSection(CRITICAL_SECTION *section);
+
+LONG	InterlockedIncrement(LONG volatile *value);
+LONG	InterlockedDecrement(LONG volatile *value);
+LONG	InterlockedExchangeAdd(LONG volatile *value, LONG add);
+
+#define WAIT_OBJECT_0				0
+#define WAIT_TIMEOUT				258
+#define WAIT_FAILED					((DWORD) 0xffffffff)
+
+HANDLE	CreateEvent(void *attributes, BOOL manual, BOOL initial, LPCWSTR name);
+BOOL	SetEvent(HANDLE event);
+BOOL	ResetEvent(HANDLE event);
+HANDLE	CreateSemaphore(void *attributes, LONG initial, LONG maximum, LPCWSTR name);
+BOOL	ReleaseSemaphore(HANDLE semaphore, LONG release, LONG *previous);
+DWORD	WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+DWORD	WaitForMultipleObjects(DWORD count, HANDLE const* handles, BOOL all, DWORD milliseconds);
+BOOL	CloseHandle(HANDLE handle);
+
+// THREADS ////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef DWORD (__stdcall *LPTHREAD_START_ROUTINE)(void *context);
+
+#define WT_EXECUTEDEFAULT			0x00000000
+
+HANDLE	CreateThread(void *attributes, SIZE_T stackSize, LPTHREAD_START_ROUTINE routine, void *context, DWORD flags, LPDWORD id);
+BOOL	QueueUserWorkItem(LPTHREAD_START_ROUTINE routine, void *context, ULONG flags);
+void	Sleep(DWORD milliseconds);
+DWORD	GetTickCount();
+DWORD	GetLastError();
+void	SetLastError(DWORD error);
+
+struct SYSTEM_INFO
+{
+	DWORD			dwNumberOfProcessors;
+};
+
+void	GetSystemInfo(SYSTEM_INFO *info);
+
+// FILES AND NETWORK //////////////////////////////////////////////////////////////////////////////////////////////
+
+// Paths without drive or server name are those of the local file system, e.g. \tmp\a for /tmp/a
+struct WIN32_FIND_DATA
+{
+	DWORD			dwFileAttributes;
+	WCHAR			cFileName[MAX_PATH];
+};
+
+typedef WIN32_FIND_DATA				WIN32_FIND_DATAW;
+
+#define FindFirstFileW				FindFirstFile
+#define FindNextFileW				FindNextFile
+
+DWORD	GetFileAttributes(LPCWSTR path);
+HANDLE	FindFirstFile(LPCWSTR pattern, WIN32_FIND_DATA *data);
+BOOL	FindNextFile(HANDLE find, WIN32_FIND_DATA *data);
+BOOL	FindClose(HANDLE find);
+DWORD	WNetGetConnection(LPCWSTR local, LPWSTR remote, LPDWORD remoteLength);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "CSimWin32.h"
+
+#endif // _SIM_WINDOWS_H_
@@ -0,0 +1,470 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatBatch.cpp: implementation of the CFilFormatBatch class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "CFilFormatBatch.h"
+
+#if !PGP_WIN32
+ #include <sys/types.h>
+ #include <sys/stat.h>
+ #include <dirent.h>
+ #include <time.h>
+ #include <unistd.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CFilFormatBatch::CFilFormatBatch()
+{
+	m_entries	= 0;
+	m_count		= 0;
+	m_capacity	= 0;
+
+	m_next		= 0;
+	m_failed	= 0;
+	m_bytes		= 0;
+	m_seconds	= 0;
+
+	m_operation = 0;
+	m_report	= 0;
+	m_context	= 0;
+
+	#if PGP_WIN32
+	 ::InitializeCriticalSection(&m_lock);
+	#else
+	 pthread_mutex_init(&m_lock, 0);
+	#endif
+}
+
+CFilFormatBatch::~CFilFormatBatch()
+{
+	Close();
+
+	#if PGP_WIN32
+	 ::DeleteCriticalSection(&m_lock);
+	#else
+	 pthread_mutex_destroy(&m_lock);
+	#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CFilFormatBatch::Close()
+{
+	for(PGPUInt32 index = 0; index < m_count; ++index)
+	{
+		free(m_entries[index].Path);
+	}
+
+	free(m_entries);
+
+	m_entries  = 0;
+	m_count	   = 0;
+	m_capacity = 0;
+	m_next	   = 0;
+	m_failed   = 0;
+	m_bytes	   = 0;
+	m_seconds  = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatBatch::Add(char const* path, bool recursive)
+{
+	assert(path);
+
+	size_t length = strlen(path);
+
+	if(!length)
+	{
+		return kPGPError_BadParams;
+	}
+
+	char *const copy = (char*) malloc(length + 1);
+
+	if(!copy)
+	{
+		return kPGPError_OutOfMemory;
+	}
+
+	memcpy(copy, path, length + 1);
+
+	// Ignore trailing separators, but keep a lone root
+	while((length > 1) && ((copy[length - 1] == '/') || (copy[length - 1] == '\\')))
+	{
+		copy[--length] = 0;
+	}
+
+	// Output paths start with the name of the given file or directory
+	PGPUInt32 relative = (PGPUInt32) length;
+
+	while(relative && (copy[relative - 1] != '/') && (copy[relative - 1] != '\\'))
+	{
+		relative--;
+	}
+
+	PGPError err = kPGPError_NoErr;
+
+	#if PGP_WIN32
+	 DWORD const attributes = ::GetFileAttributesA(copy);
+
+	 bool const directory = (attributes != INVALID_FILE_ATTRIBUTES) && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+	#else
+	 struct stat info;
+
+	 bool const directory = !stat(copy, &info) && S_ISDIR(info.st_mode);
+	#endif
+
+	if(directory && recursive)
+	{
+		err = AddDirectory(copy, relative);
+	}
+	else
+	{
+		// Missing files are reported by the Operation
+		err = AddFile(copy, relative);
+	}
+
+	free(copy);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatBatch::AddFile(char const* path, PGPUInt32 relative)
+{
+	assert(path);
+
+	if(m_count == m_capacity)
+	{
+		Entry *const entries = (Entry*) realloc(m_entries, (m_capacity + c_increment) * sizeof(Entry));
+
+		if(!entries)
+		{
+			return kPGPError_OutOfMemory;
+		}
+
+		m_entries	= entries;
+		m_capacity += c_increment;
+	}
+
+	size_t const length = strlen(path) + 1;
+
+	Entry *const entry = m_entries + m_count;
+
+	memset(entry, 0, sizeof(Entry));
+
+	entry->Path = (char*) malloc(length);
+
+	if(!entry->Path)
+	{
+		return kPGPError_OutOfMemory;
+	}
+
+	memcpy(entry->Path, path, length);
+
+	entry->Relative = relative;
+
+	m_count++;
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatBatch::AddDirectory(char const* path, PGPUInt32 relative)
+{
+	assert(path);
+
+	size_t const pathLength = strlen(path);
+
+	// Large enough for any entry name
+	char *const child = (char*) malloc(pathLength + 1 + 260 + 1);
+
+	if(!child)
+	{
+		return kPGPError_OutOfMemory;
+	}
+
+	memcpy(child, path, pathLength);
+	child[pathLength] = '/';
+
+	PGPError err = kPGPError_NoErr;
+
+	#if PGP_WIN32
+	{
+		memcpy(child + pathLength + 1, "*", 2);
+
+		WIN32_FIND_DATAA find;
+
+		HANDLE const handle = ::FindFirstFileA(child, &find);
+
+		if(handle == INVALID_HANDLE_VALUE)
+		{
+			free(child);
+
+			return kPGPError_FileOpFailed;
+		}
+
+		do
+		{
+			if(!strcmp(find.cFileName, ".") || !strcmp(find.cFileName, ".."))
+			{
+				continue;
+			}
+
+			// Do not follow junctions
+			if(find.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+			{
+				continue;
+			}
+
+			strcpy(child + pathLength + 1, find.cFileName);
+
+			err = (find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? AddDirectory(child, relative)
+																	 : AddFile(child, relative);
+		}
+		while(IsntPGPError(err) && ::FindNextFileA(handle, &find));
+
+		::FindClose(handle);
+	}
+	#else
+	{
+		DIR *const dir = opendir(path);
+
+		if(!dir)
+		{
+			free(child);
+
+			return kPGPError_FileOpFailed;
+		}
+
+		struct dirent *next;
+
+		while(IsntPGPError(err) && (0 != (next = readdir(dir))))
+		{
+			if(!strcmp(next->d_name, ".") || !strcmp(next->d_name, ".."))
+			{
+				continue;
+			}
+
+			if(strlen(next->d_name) > 260)
+			{
+				continue;
+			}
+
+			strcpy(child + pathLength + 1, next->d_name);
+
+			struct stat info;
+
+			// Do not follow symbolic links, skip devices and sockets
+			if(lstat(child, &info))
+			{
+				continue;
+			}
+
+			if(S_ISDIR(info.st_mode))
+			{
+				err = AddDirectory(child, relative);
+			}
+			else if(S_ISREG(info.st_mode))
+			{
+				err = AddFile(child, relative);
+			}
+		}
+
+		closedir(dir);
+	}
+	#endif
+
+	free(child);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatBatch::Run(PGPUInt32 threads, Operation operation, Report report, void *context)
+{
+	assert(operation);
+
+	if(!threads)
+	{
+		threads = Processors();
+	}
+
+	if(threads > c_threadsMax)
+	{
+		threads = c_threadsMax;
+	}
+
+	if(threads > m_count)
+	{
+		threads = (m_count) ? m_count : 1;
+	}
+
+	m_operation = operation;
+	m_report	= report;
+	m_context	= context;
+
+	m_next	 = 0;
+	m_failed = 0;
+	m_bytes	 = 0;
+
+	double const start = Clock();
+
+	PGPUInt32 started = 0;
+
+	#if PGP_WIN32
+	 HANDLE handles[c_threadsMax];
+	#else
+	 pthread_t handles[c_threadsMax];
+	#endif
+
+	// The calling thread is the first Worker
+	for(; started < threads - 1; ++started)
+	{
+		#if PGP_WIN32
+		 DWORD junk = 0;
+
+		 handles[started] = ::CreateThread(0,0, Worker, this, 0, &junk);
+
+		 if(!handles[started])
+		#else
+		 if(pthread_create(handles + started, 0, Worker, this))
+		#endif
+		{
+			// Run with less
+			break;
+		}
+	}
+
+	Work();
+
+	for(PGPUInt32 index = 0; index < started; ++index)
+	{
+		#if PGP_WIN32
+		 ::WaitForSingleObject(handles[index], INFINITE);
+		 ::CloseHandle(handles[index]);
+		#else
+		 pthread_join(handles[index], 0);
+		#endif
+	}
+
+	m_seconds = Clock() - start;
+
+	return (m_failed) ? kPGPError_UnknownError : kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CFilFormatBatch::Work()
+{
+	for(;;)
+	{
+		Lock();
+
+		PGPUInt32 const index = m_next;
+
+		if(index < m_count)
+		{
+			m_next++;
+		}
+
+		Unlock();
+
+		if(index >= m_count)
+		{
+			break;
+		}
+
+		Entry *const entry = m_entries + index;
+
+		double const start = Clock();
+
+		entry->Error   = m_operation(m_context, entry);
+		entry->Seconds = Clock() - start;
+
+		Lock();
+
+		if(IsPGPError(entry->Error))
+		{
+			m_failed++;
+		}
+		else
+		{
+			m_bytes += entry->Bytes;
+		}
+
+		if(m_report)
+		{
+			m_report(m_context, entry);
+		}
+
+		Unlock();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if PGP_WIN32
+DWORD __stdcall CFilFormatBatch::Worker(void *context)
+#else
+void* CFilFormatBatch::Worker(void *context)
+#endif
+{
+	assert(context);
+
+	CFilFormatBatch *const batch = (CFilFormatBatch*) context;
+
+	batch->Work();
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPUInt32 CFilFormatBatch::Processors()
+{
+	#if PGP_WIN32
+	 SYSTEM_INFO info;
+
+	 ::GetSystemInfo(&info);
+
+	 PGPUInt32 const count = info.dwNumberOfProcessors;
+	#else
+	 long const count = sysconf(_SC_NPROCESSORS_ONLN);
+	#endif
+
+	return (count > 0) ? (PGPUInt32) count : 1;
+}
+
+double CFilFormatBatch::Clock()
+{
+	#if PGP_WIN32
+	 LARGE_INTEGER frequency, counter;
+
+	 ::QueryPerformanceFrequency(&frequency);
+	 ::QueryPerformanceCounter(&counter);
+
+	 return (double) counter.QuadPart / (double) frequency.QuadPart;
+	#else
+	 struct timespec now;
+
+	 clock_gettime(CLOCK_MONOTONIC, &now);
+
+	 return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+	#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatBatch.h: interface for the CFilFormatBatch class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilFormatBatch_H__2A5D8E14_C7B3_4F60_9E21_84B0D3F6A15C__INCLUDED_)
+#define AFX_CFilFormatBatch_H__2A5D8E14_C7B3_4F60_9E21_84B0D3F6A15C__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "FilFormat.h"
+
+#if PGP_WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilFormatBatch
+{
+	// Applies one operation to many files. All files are collected up front, directories are walked
+	// recursively if requested. Worker threads then take files in order from a shared index, each
+	// using its own CFilFormatFile, so I/O of one file overlaps with crypto of others.
+
+public:
+
+	enum c_constants
+	{
+		c_increment		= 256,
+		c_threadsMax	= 64,
+	};
+
+	struct Entry
+	{
+		char*					Path;
+		PGPUInt32				Relative;	// offset of path below the given root, including root name
+		PGPError				Error;
+		PGPUInt64				Bytes;		// processed
+		double					Seconds;
+	};
+
+	// Called on Worker threads, must set entry->Bytes
+	typedef PGPError			(*Operation)(void *context, Entry *entry);
+	// Called serialized after each file
+	typedef void				(*Report)(void *context, Entry const* entry);
+
+								CFilFormatBatch();
+								~CFilFormatBatch();
+
+	PGPError					Add(char const* path, bool recursive);
+	PGPError					Run(PGPUInt32 threads, Operation operation, Report report, void *context);
+	void						Close();
+
+	PGPUInt32					Count() const;
+	PGPUInt32					Failed() const;
+	PGPUInt64					Bytes() const;
+	double						Seconds() const;
+
+	static PGPUInt32			Processors();
+	static double				Clock();
+
+private:
+
+	PGPError					AddFile(char const* path, PGPUInt32 relative);
+	PGPError					AddDirectory(char const* path, PGPUInt32 relative);
+	void						Work();
+
+	void						Lock();
+	void						Unlock();
+
+	#if PGP_WIN32
+	 static DWORD	__stdcall	Worker(void *context);
+	#else
+	 static void*				Worker(void *context);
+	#endif
+
+								// DATA
+	Entry*						m_entries;
+	PGPUInt32					m_count;
+	PGPUInt32					m_capacity;
+
+	PGPUInt32					m_next;			// next Entry to process
+	PGPUInt32					m_failed;
+	PGPUInt64					m_bytes;
+	double						m_seconds;		// wall clock of last Run
+
+	Operation					m_operation;
+	Report						m_report;
+	void*						m_context;
+
+	#if PGP_WIN32
+	 CRITICAL_SECTION			m_lock;
+	#else
+	 pthread_mutex_t			m_lock;
+	#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+PGPUInt32 CFilFormatBatch::Count() const
+{
+	return m_count;
+}
+
+inline
+PGPUInt32 CFilFormatBatch::Failed() const
+{
+	return m_failed;
+}
+
+inline
+PGPUInt64 CFilFormatBatch::Bytes() const
+{
+	return m_bytes;
+}
+
+inline
+double CFilFormatBatch::Seconds() const
+{
+	return m_seconds;
+}
+
+inline
+void CFilFormatBatch::Lock()
+{
+	#if PGP_WIN32
+	 ::EnterCriticalSection(&m_lock);
+	#else
+	 pthread_mutex_lock(&m_lock);
+	#endif
+}
+
+inline
+void CFilFormatBatch::Unlock()
+{
+	#if PGP_WIN32
+	 ::LeaveCriticalSection(&m_lock);
+	#else
+	 pthread_mutex_unlock(&m_lock);
+	#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilFormatBatch_H__2A5D8E14_C7B3_4F60_9E21_84B0D3F6A15C__INCLUDED_)
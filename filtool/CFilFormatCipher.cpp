@@ -0,0 +1,1041 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatCipher.cpp: implementation of the CFilFormatCipher class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "CFilFormatHeader.h"
+#include "CFilFormatCipher.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CFilFormatCipher::CFilFormatCipher()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+CFilFormatCipher::~CFilFormatCipher()
+{
+	Close();
+}
+
+void CFilFormatCipher::Close()
+{
+	if(m_aes)
+	{
+		PGPFreeSymmetricCipherContext(m_aes);
+	}
+
+	if(m_eme)
+	{
+		PGPFreeEMEContext(m_eme);
+	}
+
+	if(m_eme2)
+	{
+		PGPFreeEME2Context(m_eme2);
+	}
+
+	if(m_xts)
+	{
+		PGPFreeXTSContext(m_xts);
+	}
+
+	if(m_mgr)
+	{
+		PGPFreeMemoryMgr(m_mgr);
+	}
+
+	// be paranoid
+	memset(this, 0, sizeof(*this));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatCipher::Init(PGPUInt32 cipher, PGPByte const* fileKey, PGPUInt32 keySize, PGPUInt64 nonce)
+{
+	assert(fileKey);
+
+	Close();
+
+	if(!keySize || (keySize > sizeof(m_key)))
+	{
+		return kPGPError_BadParams;
+	}
+
+	m_mode	  = (cipher >> 16) & FILFORMAT_CIPHER_MODE_MASK;
+	m_keySize = keySize;
+	m_nonce	  = nonce;
+
+	memcpy(m_key, fileKey, keySize);
+
+	PGPError err = PGPNewMemoryMgrPosix(malloc, free, realloc, &m_mgr);
+
+	if(IsPGPError(err))
+	{
+		return err;
+	}
+
+	PGPSymmetricCipherContextRef aes = 0;
+
+	err = PGPNewSymmetricCipherContext(m_mgr, Algorithm(keySize), &aes);
+
+	if(IsPGPError(err))
+	{
+		return err;
+	}
+
+	switch(m_mode)
+	{
+		case FILFORMAT_CIPHER_MODE_CTR:
+		case FILFORMAT_CIPHER_MODE_CFB:
+			m_aes = aes;
+			aes   = 0;
+
+			err = PGPInitSymmetricCipher(m_aes, m_key);
+			break;
+
+		case FILFORMAT_CIPHER_MODE_EME:
+			err = PGPNewEMEContext(aes, &m_eme);
+
+			if(IsntPGPError(err))
+			{
+				aes = 0;	// AES now belongs to EME
+
+				err = PGPInitEME(m_eme, m_key);
+			}
+			break;
+
+		case FILFORMAT_CIPHER_MODE_EME_2:
+			err = PGPNewEME2Context(aes, &m_eme2);
+
+			if(IsntPGPError(err))
+			{
+				aes = 0;	// AES now belongs to EME2
+
+				err = PGPInitEME2(m_eme2, m_key);
+			}
+			break;
+
+		case FILFORMAT_CIPHER_MODE_XTS:
+		{
+			// Data key followed by tweak key, see CFilterCipherXTS
+			PGPByte keys[2 * FILFORMAT_KEY_SIZE + c_aesBlockSize];
+
+			err = PGPInitSymmetricCipher(aes, m_key);
+
+			if(IsntPGPError(err))
+			{
+				memcpy(keys, m_key, keySize);
+
+				err = DeriveTweakKey(keys);
+			}
+
+			if(IsntPGPError(err))
+			{
+				PGPUInt32 const unit = ((cipher >> 16) >> FILFORMAT_CIPHER_UNIT_SHIFT) & FILFORMAT_CIPHER_UNIT_MASK;
+
+				err = PGPNewXTSContext(aes, FILFORMAT_SECTOR_SIZE << unit, &m_xts);
+
+				// AES now belongs to XTS, unless parameters were rejected
+				if(err != kPGPError_BadParams)
+				{
+					aes = 0;
+				}
+
+				if(IsntPGPError(err))
+				{
+					err = PGPInitXTS(m_xts, keys);
+				}
+			}
+
+			memset(keys, 0, sizeof(keys));
+			break;
+		}
+
+		default:
+			err = kPGPError_FeatureNotAvailable;
+			break;
+	}
+
+	if(aes)
+	{
+		PGPFreeSymmetricCipherContext(aes);
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatCipher::DeriveTweakKey(PGPByte *keys)
+{
+	assert(keys);
+
+	// Tweak key := E(FileKey, "XTS" | counter), using a key schedule of our own
+	PGPSymmetricCipherContextRef aes = 0;
+
+	PGPError err = PGPNewSymmetricCipherContext(m_mgr, Algorithm(m_keySize), &aes);
+
+	if(IsntPGPError(err))
+	{
+		err = PGPInitSymmetricCipher(aes, m_key);
+
+		if(IsntPGPError(err))
+		{
+			PGPByte block[c_aesBlockSize];
+
+			for(PGPUInt32 index = 0; (index * sizeof(block)) < m_keySize; ++index)
+			{
+				memset(block, 0, sizeof(block));
+
+				block[0]  = 'X';
+				block[1]  = 'T';
+				block[2]  = 'S';
+				block[15] = (PGPByte) (index + 1);
+
+				err = PGPSymmetricCipherEncrypt(aes, block, keys + m_keySize + index * sizeof(block));
+
+				if(IsPGPError(err))
+				{
+					break;
+				}
+			}
+
+			memset(block, 0, sizeof(block));
+		}
+
+		PGPFreeSymmetricCipherContext(aes);
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatCipher::CodeCTR(PGPByte *buffer, PGPSize size, PGPUInt64 offset)
+{
+	assert(buffer);
+	assert(m_aes);
+
+	PGPByte stream[c_aesBlockSize];
+
+	for(PGPSize current = 0; current < size; current += c_aesBlockSize)
+	{
+		// build CTR block (Nonce | Offset)
+		CFilFormatHeader::Store64(stream,	  m_nonce);
+		CFilFormatHeader::Store64(stream + 8, offset + current);
+
+		PGPSymmetricCipherEncrypt(m_aes, stream, stream);
+
+		PGPSize const remaining = (size - current < c_aesBlockSize) ? size - current : (PGPSize) c_aesBlockSize;
+
+		for(PGPSize index = 0; index < remaining; ++index)
+		{
+			buffer[current + index] ^= stream[index];
+		}
+	}
+
+	memset(stream, 0, sizeof(stream));
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatCipher::CodeCFB(PGPByte *buffer, PGPSize size, PGPUInt64 offset, bool encode)
+{
+	assert(buffer);
+	assert(m_aes);
+
+	if(size % c_aesBlockSize)
+	{
+		return kPGPError_BadParams;
+	}
+
+	PGPByte output[c_aesBlockSize];
+
+	for(PGPSize current = 0; current < size; )
+	{
+		// IV is restarted on each sector
+		CFilFormatHeader::Store64(output,	  m_nonce);
+		CFilFormatHeader::Store64(output + 8, offset + current);
+
+		do
+		{
+			PGPSymmetricCipherEncrypt(m_aes, output, output);
+
+			for(PGPUInt32 index = 0; index < c_aesBlockSize; ++index)
+			{
+				PGPByte const c = buffer[current + index];
+
+				if(encode)
+				{
+					output[index] ^= c;
+					buffer[current + index] = output[index];
+				}
+				else
+				{
+					buffer[current + index] = c ^ output[index];
+					output[index] = c;
+				}
+			}
+
+			current += c_aesBlockSize;
+		}
+		while((current < size) && (current & (FILFORMAT_SECTOR_SIZE - 1)));
+	}
+
+	memset(output, 0, sizeof(output));
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatCipher::Encode(PGPByte *buffer, PGPSize size, PGPUInt64 offset)
+{
+	assert(buffer);
+
+	if((size % c_blockSize) || (offset % c_blockSize))
+	{
+		return kPGPError_BadParams;
+	}
+
+	switch(m_mode)
+	{
+		case FILFORMAT_CIPHER_MODE_CTR:
+			return CodeCTR(buffer, size, offset);
+		case FILFORMAT_CIPHER_MODE_CFB:
+			return CodeCFB(buffer, size, offset, true);
+		case FILFORMAT_CIPHER_MODE_EME:
+			return PGPEMEEncrypt(m_eme, buffer, size, buffer, offset / c_blockSize, m_nonce);
+		case FILFORMAT_CIPHER_MODE_EME_2:
+			return PGPEME2Encrypt(m_eme2, buffer, size, buffer, offset / c_blockSize, m_nonce);
+		case FILFORMAT_CIPHER_MODE_XTS:
+			return PGPXTSEncryptAt(m_xts, buffer, size, buffer, offset, m_nonce);
+		default:
+			break;
+	}
+
+	return kPGPError_ImproperInitialization;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatCipher::Decode(PGPByte *buffer, PGPSize size, PGPUInt64 offset)
+{
+	assert(buffer);
+
+	if((size % c_blockSize) || (offset % c_blockSize))
+	{
+		return kPGPError_BadParams;
+	}
+
+	switch(m_mode)
+	{
+		case FILFORMAT_CIPHER_MODE_CTR:
+			return CodeCTR(buffer, size, offset);
+		case FILFORMAT_CIPHER_MODE_CFB:
+			return CodeCFB(buffer, size, offset, false);
+		case FILFORMAT_CIPHER_MODE_EME:
+			return PGPEMEDecrypt(m_eme, buffer, size, buffer, offset / c_blockSize, m_nonce);
+		case FILFORMAT_CIPHER_MODE_EME_2:
+			return PGPEME2Decrypt(m_eme2, buffer, size, buffer, offset / c_blockSize, m_nonce);
+		case FILFORMAT_CIPHER_MODE_XTS:
+			return PGPXTSDecryptAt(m_xts, buffer, size, buffer, offset, m_nonce);
+		default:
+			break;
+	}
+
+	return kPGPError_ImproperInitialization;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatCipher::WrapKey(PGPByte const* entityKey, PGPUInt32 entityKeySize, PGPByte *fileKey, bool unwrap)
+{
+	assert(entityKey);
+	assert(fileKey);
+
+	// Same as CFilterContext::EncodeFileKey: always AES-256 with the zero filled EntityKey,
+	// both halves of the FileKey are chained in a CBC-like fashion.
+	if(!entityKeySize || (entityKeySize > FILFORMAT_KEY_SIZE))
+	{
+		return kPGPError_BadParams;
+	}
+
+	PGPByte key[FILFORMAT_KEY_SIZE];
+	memset(key, 0, sizeof(key));
+	memcpy(key, entityKey, entityKeySize);
+
+	PGPMemoryMgrRef mgr = 0;
+	PGPSymmetricCipherContextRef aes = 0;
+
+	PGPError err = PGPNewMemoryMgrPosix(malloc, free, realloc, &mgr);
+
+	if(IsntPGPError(err))
+	{
+		err = PGPNewSymmetricCipherContext(mgr, kPGPCipherAlgorithm_AES256, &aes);
+
+		if(IsntPGPError(err))
+		{
+			err = PGPInitSymmetricCipher(aes, key);
+
+			if(IsntPGPError(err))
+			{
+				PGPByte *const s = fileKey;
+				PGPByte *const t = fileKey + c_aesBlockSize;
+
+				if(unwrap)
+				{
+					PGPSymmetricCipherDecrypt(aes, t, t);
+				}
+				else
+				{
+					PGPSymmetricCipherEncrypt(aes, s, s);
+				}
+
+				for(PGPUInt32 index = 0; index < c_aesBlockSize; ++index)
+				{
+					t[index] ^= s[index];
+				}
+
+				if(unwrap)
+				{
+					PGPSymmetricCipherDecrypt(aes, s, s);
+				}
+				else
+				{
+					PGPSymmetricCipherEncrypt(aes, t, t);
+				}
+			}
+
+			PGPFreeSymmetricCipherContext(aes);
+		}
+
+		PGPFreeMemoryMgr(mgr);
+	}
+
+	memset(key, 0, sizeof(key));
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Same encoding as CFilterCipherEME::GetPadding: 1 byte is a 255 in the last byte,
+ * 2-512 bytes are stored LSB first in the last two bytes, remaining bytes repeat the LSB.
+ *
+ * Return zero for malformed padding
+ */
+PGPUInt32 CFilFormatCipher::GetPadding(PGPByte const* source, PGPUInt32 size)
+{
+	assert(source);
+	assert(size);
+	assert(0 == (size % c_blockSize));
+
+	PGPUInt32 padded = source[size - 1];
+
+	if(padded == 0xff)
+	{
+		return 1;
+	}
+
+	padded = (padded << 8) | source[size - 2];
+
+	if(padded > c_blockSize || padded <= 1)
+	{
+		return 0;
+	}
+
+	source += size - padded;
+
+	for(PGPUInt32 index = 0; index < padded - 2; index++)
+	{
+		if(source[index] != (PGPByte) padded)
+		{
+			return 0;
+		}
+	}
+
+	return padded;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPUInt32 CFilFormatCipher::AddPadding(PGPByte *target, PGPUInt32 size)
+{
+	assert(target);
+
+	target += size;
+
+	PGPUInt32 const padded = ComputePadding(size);
+
+	if(padded == 1)
+	{
+		target[0] = 0xff;
+	}
+	else
+	{
+		// Last byte gets MSB of padding
+		target[padded - 1] = (PGPByte) (padded >> 8);
+
+		for(PGPUInt32 index = 0; index < padded - 1; ++index)
+		{
+			target[index] = (PGPByte) padded;
+		}
+	}
+
+	return padded;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+
+/*
+ * Known answers of the driver's data encoding: two sectors at offset 0x400 behind the Header, with
+ * the Nonce of the Header block. They were computed with an independent implementation of each mode
+ * on top of plain AES (CTR and CFB IV := Nonce | byte offset, restarted per sector for CFB; EME and
+ * XTS tweak := Nonce | unit and unit | Nonce, both LSB first), not with this code or the driver.
+ */
+
+static PGPByte const s_key256[32] =
+{
+	0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f,
+	0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f
+};
+
+static PGPByte const s_key128[16] =
+{
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f
+};
+
+static PGPByte const s_entityKey[24] =
+{
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37
+};
+
+#define KAT_NONCE	0x0123456789abcdefULL
+#define KAT_OFFSET	0x400
+#define KAT_SIZE	1024
+
+/* CTR, AES-128 */
+static PGPByte const s_ctr[1024] =
+{
+	0x56, 0x57, 0x00, 0xdf, 0x11, 0x17, 0xbb, 0xcb, 0x2f, 0x4c, 0x60, 0x88, 0x65, 0x19, 0xc6, 0xbd,
+	0xa3, 0xed, 0x61, 0xbd, 0x19, 0xce, 0xcb, 0xe2, 0x25, 0x0d, 0xdf, 0x24, 0x15, 0xd6, 0x40, 0xb9,
+	0xcb, 0x24, 0xac, 0x1e, 0x03, 0xd4, 0x6c, 0x72, 0x0f, 0x0f, 0x1f, 0x54, 0xdc, 0x2b, 0x6d, 0x46,
+	0xe4, 0x64, 0xfa, 0x78, 0xfd, 0xd6, 0x26, 0x95, 0xf6, 0x13, 0xf9, 0x19, 0xa2, 0x11, 0xbe, 0x6e,
+	0xa0, 0x26, 0xa8, 0xa1, 0x5e, 0x3f, 0xf1, 0xd0, 0x0a, 0x35, 0x11, 0x75, 0x31, 0xa4, 0x36, 0x85,
+	0x1b, 0x89, 0x4d, 0x15, 0xec, 0xdc, 0xaf, 0xbe, 0x26, 0x56, 0xa5, 0xfc, 0x58, 0x85, 0xe3, 0xce,
+	0x95, 0x8b, 0xef, 0x96, 0x60, 0xf6, 0x0d, 0xa7, 0x57, 0x87, 0xc2, 0x05, 0xf7, 0x3e, 0xbd, 0xfb,
+	0x24, 0x55, 0xae, 0x86, 0x75, 0x5d, 0xc5, 0x24, 0xe9, 0x5d, 0xcc, 0xd3, 0x96, 0xe1, 0x88, 0xfd,
+	0x4a, 0x15, 0x59, 0x07, 0x84, 0xaf, 0xf2, 0x0c, 0x27, 0xda, 0xca, 0x31, 0x81, 0x61, 0xcb, 0x2b,
+	0xd6, 0x0a, 0xfc, 0xd9, 0x92, 0xe0, 0x28, 0x81, 0x75, 0x2c, 0x29, 0x03, 0x91, 0x78, 0x81, 0x89,
+	0x9b, 0x0b, 0xce, 0xb3, 0xc8, 0xd3, 0x83, 0x88, 0xa7, 0x61, 0x61, 0xc2, 0x6e, 0x5f, 0x11, 0xfb,
+	0x7d, 0x57, 0xe5, 0x7b, 0x8d, 0x47, 0x02, 0x3f, 0x87, 0x53, 0x4b, 0xde, 0xd1, 0x82, 0x7f, 0xaf,
+	0xc6, 0x18, 0xe4, 0xab, 0x80, 0x37, 0x20, 0xf8, 0xca, 0x16, 0x8e, 0x9e, 0xe3, 0xdd, 0x13, 0x1e,
+	0xa2, 0x84, 0x3d, 0xf7, 0xdc, 0x04, 0xbc, 0xdb, 0x4b, 0x47, 0x92, 0x32, 0x30, 0xe0, 0xe5, 0xb0,
+	0x45, 0x39, 0x00, 0xce, 0x2a, 0x33, 0x40, 0x4e, 0x9a, 0x0d, 0x4d, 0x77, 0x9e, 0x0d, 0x65, 0x80,
+	0xfc, 0x15, 0x89, 0xf1, 0x8b, 0x4a, 0x8a, 0xf6, 0xed, 0x2b, 0x24, 0xfc, 0x04, 0x6b, 0x38, 0x61,
+	0x49, 0x63, 0x31, 0xf4, 0x23, 0x1f, 0xf9, 0xdb, 0xee, 0xc0, 0x4e, 0xb1, 0xa2, 0xd4, 0x69, 0x47,
+	0x48, 0xbc, 0x29, 0x99, 0x98, 0x9d, 0xdd, 0xdc, 0xc0, 0x2e, 0x31, 0x8c, 0x38, 0x86, 0xf4, 0x31,
+	0x3c, 0xe1, 0xae, 0xef, 0x70, 0x11, 0xb4, 0xf8, 0x7f, 0xf5, 0xec, 0x0d, 0xe0, 0x4b, 0x79, 0xdb,
+	0x25, 0xc4, 0x4b, 0xdf, 0x97, 0x0a, 0x0d, 0x5c, 0x45, 0x13, 0x94, 0x9e, 0x43, 0x08, 0xbc, 0x81,
+	0xe4, 0x0b, 0x21, 0xb9, 0x12, 0xd6, 0x34, 0x8a, 0x30, 0xb9, 0xce, 0x1c, 0xe4, 0x2f, 0x05, 0x3e,
+	0x1d, 0x5d, 0x09, 0xb6, 0xea, 0x46, 0x81, 0xd1, 0xe8, 0xd5, 0x3b, 0x5d, 0xb3, 0x54, 0xf7, 0x56,
+	0x09, 0xbb, 0x94, 0xdd, 0x49, 0x82, 0xda, 0x03, 0x8d, 0x44, 0xeb, 0x22, 0x72, 0x01, 0x4b, 0x5a,
+	0x4d, 0x9e, 0xa2, 0x43, 0xe9, 0xf4, 0x76, 0x11, 0xf2, 0xfd, 0xac, 0xe4, 0xaf, 0xb2, 0x43, 0xc9,
+	0x82, 0x0a, 0x66, 0x64, 0x24, 0xf1, 0xdc, 0x06, 0xfa, 0x93, 0x44, 0xd4, 0x98, 0x49, 0x5e, 0x6a,
+	0x02, 0x08, 0x4d, 0x09, 0x55, 0x9d, 0x50, 0x2d, 0xb1, 0xc7, 0xa4, 0x06, 0x60, 0x39, 0x73, 0x24,
+	0xbe, 0x93, 0xcb, 0x6e, 0xae, 0xf9, 0x7e, 0xea, 0x66, 0xd1, 0x67, 0xb9, 0x6a, 0x9d, 0x49, 0xb7,
+	0x08, 0x25, 0x25, 0xaa, 0xb5, 0x20, 0xcb, 0xc6, 0x1b, 0x10, 0xbb, 0x42, 0x1e, 0x81, 0xec, 0xc2,
+	0xf5, 0x7b, 0xd7, 0x03, 0x3d, 0x90, 0x86, 0xed, 0x30, 0x63, 0x46, 0xda, 0xa4, 0x02, 0xf4, 0x05,
+	0x86, 0x4f, 0x4a, 0xc9, 0xd3, 0x95, 0xaa, 0xda, 0x99, 0xf9, 0x4e, 0x7b, 0x9a, 0xe4, 0x80, 0x85,
+	0x2c, 0xca, 0xd7, 0x9c, 0x27, 0xd5, 0x99, 0x98, 0x68, 0xa6, 0xc8, 0x3e, 0x63, 0xf8, 0x82, 0x32,
+	0x0c, 0x19, 0x07, 0xf8, 0x54, 0x0c, 0x4c, 0x63, 0xf1, 0x27, 0x5e, 0x7f, 0x96, 0xb2, 0x86, 0x42,
+	0x16, 0xeb, 0x1f, 0xec, 0xa3, 0x80, 0x9d, 0x5b, 0xfd, 0x7d, 0xc9, 0xd9, 0x9a, 0xb9, 0x97, 0xb7,
+	0xe2, 0x67, 0x5f, 0x69, 0xb2, 0xc1, 0x98, 0x5c, 0xb9, 0x67, 0x5c, 0xb6, 0x9c, 0xc7, 0xd7, 0xe4,
+	0x02, 0x12, 0x5f, 0x59, 0xf0, 0x86, 0x6e, 0x83, 0xb7, 0xac, 0x76, 0x72, 0xf1, 0xae, 0x20, 0xe7,
+	0xb1, 0x48, 0x45, 0xa0, 0xb4, 0x56, 0x41, 0xa8, 0x2d, 0x94, 0x78, 0x2a, 0x55, 0x7e, 0x04, 0x10,
+	0xe5, 0x4b, 0xb9, 0x6c, 0x9c, 0x04, 0xb5, 0xfb, 0x3a, 0x2e, 0x7c, 0x15, 0xad, 0xb7, 0x9d, 0x65,
+	0xf9, 0xc7, 0xf4, 0xba, 0xcc, 0xcc, 0xb3, 0x05, 0x25, 0x84, 0x7d, 0xb9, 0xad, 0xa2, 0x88, 0x39,
+	0x40, 0x5f, 0xf0, 0xd8, 0xfa, 0x70, 0x91, 0x99, 0x84, 0x2a, 0xd4, 0x92, 0xa0, 0x1f, 0x77, 0xae,
+	0x19, 0x53, 0xd9, 0x55, 0x17, 0x13, 0x41, 0x4a, 0x28, 0x35, 0xaf, 0x29, 0x22, 0x36, 0x17, 0x7d,
+	0xf7, 0x8a, 0x73, 0x5e, 0x52, 0x8e, 0xe7, 0x88, 0x2a, 0x7f, 0xd4, 0x5f, 0x68, 0x73, 0xd5, 0x28,
+	0x27, 0xf0, 0xbc, 0x9f, 0x88, 0x31, 0x56, 0x66, 0xd1, 0xe3, 0x30, 0xb0, 0xd9, 0xe9, 0xa6, 0x21,
+	0xb7, 0x7d, 0xca, 0x8f, 0xff, 0x6c, 0xa4, 0x62, 0x23, 0x17, 0xaa, 0x53, 0x29, 0x4a, 0x1c, 0x5d,
+	0x40, 0xea, 0x5e, 0x95, 0xf3, 0x7d, 0xe1, 0xcd, 0x96, 0x52, 0xdc, 0x88, 0x2d, 0xec, 0x71, 0x06,
+	0x96, 0x7b, 0xc3, 0x71, 0x2e, 0x5a, 0x58, 0x64, 0xd5, 0xcf, 0xd3, 0x38, 0x68, 0xd4, 0x5d, 0x3c,
+	0xac, 0xbb, 0x49, 0x5e, 0x91, 0x7c, 0xd4, 0x60, 0x1c, 0xcd, 0x23, 0x18, 0x42, 0x09, 0x2b, 0x3a,
+	0x7b, 0x4b, 0xd4, 0x17, 0xca, 0xec, 0xc6, 0xb7, 0xed, 0x99, 0x9c, 0x4e, 0x65, 0x65, 0x37, 0x8b,
+	0xa5, 0xde, 0x87, 0x36, 0x24, 0x25, 0xbd, 0x0e, 0x4f, 0x99, 0xe3, 0x01, 0xae, 0xca, 0xb0, 0x5d,
+	0x6b, 0x7d, 0x00, 0x61, 0xdb, 0xff, 0x23, 0x1a, 0x1d, 0x07, 0x0f, 0xd5, 0x63, 0x61, 0x5e, 0xa1,
+	0xb5, 0x14, 0xe7, 0xfb, 0x40, 0x26, 0xe3, 0x3d, 0xda, 0x26, 0xb6, 0xb1, 0xd7, 0x33, 0x18, 0x38,
+	0xfd, 0x0c, 0x22, 0xc6, 0x98, 0x7e, 0x33, 0x89, 0x25, 0x27, 0x0c, 0x51, 0x5a, 0x09, 0x60, 0xc0,
+	0xf6, 0x11, 0x42, 0x1c, 0xb2, 0x64, 0xe4, 0xce, 0xa7, 0xd8, 0xcb, 0x55, 0xa0, 0x7c, 0x58, 0x6b,
+	0x3d, 0x02, 0x8d, 0xb1, 0xb1, 0x5c, 0x67, 0xa3, 0xa7, 0xe2, 0x26, 0x95, 0x4e, 0xa5, 0x93, 0x12,
+	0x9a, 0x80, 0xf8, 0x40, 0x58, 0xf1, 0x06, 0x43, 0xce, 0x6f, 0xf9, 0x03, 0x1b, 0x55, 0xb5, 0x23,
+	0x46, 0x57, 0xdc, 0x75, 0x95, 0xd7, 0x3e, 0x9d, 0x70, 0x7c, 0x32, 0xef, 0x73, 0x64, 0x80, 0x5c,
+	0x57, 0x96, 0x31, 0xc6, 0xf5, 0x84, 0x22, 0x74, 0xc6, 0x16, 0x0c, 0x94, 0x8f, 0x26, 0x38, 0xc8,
+	0x2d, 0x6e, 0x65, 0xdf, 0xcb, 0x2e, 0x8d, 0x52, 0xea, 0x1c, 0xb1, 0xc1, 0xda, 0xdf, 0xfc, 0xb3,
+	0x11, 0x13, 0x28, 0x41, 0x79, 0x8c, 0xa8, 0x97, 0x4d, 0x11, 0xb9, 0x44, 0x26, 0xd4, 0x28, 0x44,
+	0x24, 0xc6, 0x92, 0xe8, 0x28, 0x0d, 0x92, 0xe8, 0xc2, 0x80, 0x9f, 0xf7, 0x73, 0x39, 0x7a, 0x1a,
+	0xdb, 0xd4, 0x07, 0x77, 0x67, 0x90, 0x24, 0xd4, 0x62, 0xc9, 0x3c, 0x67, 0x53, 0xbf, 0x1e, 0xfb,
+	0x0b, 0x2c, 0xd2, 0xa8, 0x2d, 0x45, 0xbc, 0x94, 0x15, 0x1f, 0xc7, 0xd8, 0x90, 0x22, 0xf0, 0x00,
+	0x78, 0x8f, 0xe5, 0xe7, 0xf7, 0xe9, 0xc2, 0x1e, 0xeb, 0x18, 0x3c, 0x22, 0x52, 0xa2, 0x52, 0xa0,
+	0xb3, 0x97, 0x06, 0x91, 0x11, 0x6a, 0xc0, 0xa9, 0x32, 0xf8, 0xc2, 0x99, 0xa6, 0x5b, 0xb0, 0x3f,
+	0x03, 0x48, 0x25, 0xc8, 0xbb, 0x7b, 0x0b, 0x41, 0xef, 0xdc, 0x61, 0xa1, 0xcc, 0x61, 0xae, 0xff
+};
+
+/* CFB, AES-256 */
+static PGPByte const s_cfb[1024] =
+{
+	0x06, 0xfa, 0x28, 0x79, 0x8f, 0x7f, 0x25, 0xa2, 0x63, 0x67, 0xbf, 0xb0, 0x09, 0x12, 0xdf, 0xe6,
+	0x6f, 0x89, 0xb3, 0x97, 0xc7, 0xb5, 0xa1, 0xc2, 0x8f, 0x0a, 0x48, 0x92, 0xec, 0x4e, 0x15, 0x10,
+	0x28, 0xeb, 0x48, 0xaf, 0x87, 0xb7, 0x5a, 0xbf, 0xaa, 0x5b, 0xcd, 0xaa, 0x3c, 0x26, 0xf5, 0xd5,
+	0x62, 0xe2, 0xa5, 0xef, 0x8f, 0xea, 0x4b, 0x0e, 0x6a, 0x06, 0x2f, 0xc1, 0x6c, 0xe7, 0x63, 0xb0,
+	0x76, 0x2f, 0xd2, 0x33, 0x7c, 0xc8, 0x9a, 0x08, 0x13, 0xf7, 0x87, 0x34, 0xbd, 0x3a, 0x28, 0xd5,
+	0xc4, 0x01, 0x0b, 0xd0, 0x6e, 0xe0, 0x5f, 0xff, 0x15, 0xba, 0xd5, 0x9c, 0x13, 0xd1, 0xc7, 0x4f,
+	0xf4, 0xaf, 0x71, 0x25, 0x8f, 0x69, 0xe1, 0xef, 0xe8, 0x87, 0xb8, 0xb1, 0xd6, 0xd0, 0xc1, 0xe6,
+	0x86, 0xc1, 0x7e, 0xd6, 0x8f, 0xb7, 0x21, 0xe6, 0x2e, 0xa1, 0x7f, 0x12, 0x37, 0xe5, 0xd2, 0x3b,
+	0x0f, 0x9d, 0xca, 0xde, 0xbd, 0x6d, 0x31, 0xa6, 0x09, 0x0b, 0xba, 0x7b, 0x01, 0xa6, 0x08, 0x7c,
+	0x95, 0x42, 0x65, 0x35, 0x61, 0x56, 0xa3, 0x59, 0xf0, 0x2a, 0x39, 0x4b, 0x52, 0x65, 0xf4, 0xde,
+	0xf3, 0xe3, 0xf7, 0x56, 0x25, 0xcf, 0x4a, 0x2a, 0x27, 0x25, 0xda, 0x5b, 0xf1, 0xa0, 0x96, 0x92,
+	0xcb, 0x42, 0x62, 0x87, 0x55, 0x46, 0x5b, 0x6e, 0xec, 0x0f, 0xfb, 0xcf, 0x7d, 0xaf, 0xed, 0x62,
+	0x78, 0x65, 0xed, 0x39, 0x4e, 0x17, 0x67, 0xa8, 0x1a, 0x94, 0xc8, 0xf7, 0x44, 0xda, 0xcc, 0x19,
+	0x5d, 0x98, 0xaf, 0x6e, 0xde, 0x2c, 0xb4, 0xd7, 0xaf, 0x6f, 0x62, 0x1f, 0xc0, 0x73, 0x9a, 0x04,
+	0x98, 0x66, 0xbf, 0x0b, 0x19, 0xf2, 0xe2, 0xb8, 0xf6, 0x7d, 0x85, 0x04, 0x0d, 0xcf, 0x72, 0xb4,
+	0x02, 0x9b, 0x5b, 0x7d, 0x5d, 0x0b, 0x3d, 0x25, 0x9b, 0xf1, 0x9b, 0x7e, 0x8a, 0x78, 0xf7, 0x2f,
+	0xd3, 0x4d, 0x23, 0xf6, 0x4c, 0x31, 0x00, 0x40, 0xae, 0x90, 0xc7, 0x82, 0x89, 0xc4, 0x8e, 0x9f,
+	0xb8, 0x52, 0x19, 0xb7, 0xb1, 0xf2, 0x4f, 0x03, 0xe7, 0x85, 0xb0, 0x3e, 0xe7, 0x72, 0x97, 0x73,
+	0x99, 0xd4, 0x5c, 0x5d, 0xfe, 0xbc, 0x60, 0xba, 0xfc, 0x5d, 0xe7, 0x86, 0x05, 0x77, 0x52, 0x4c,
+	0x23, 0xe6, 0xc9, 0x45, 0x6b, 0xee, 0x25, 0xf4, 0xa7, 0x6b, 0x60, 0x49, 0x5a, 0xe1, 0x1b, 0x5f,
+	0xc2, 0x52, 0xba, 0xcb, 0x19, 0xdc, 0x8d, 0x87, 0x54, 0x04, 0xd2, 0x20, 0xbb, 0x84, 0x3d, 0xe6,
+	0x8b, 0xdd, 0xfe, 0xa9, 0xef, 0x9e, 0x72, 0xf2, 0x01, 0xd4, 0x28, 0x78, 0x8d, 0xa1, 0xc6, 0x13,
+	0x31, 0x4d, 0xe6, 0x0d, 0x4e, 0x8a, 0xd9, 0xba, 0xa8, 0x61, 0x7f, 0xcb, 0x30, 0xb6, 0xff, 0x3e,
+	0xd3, 0xaf, 0x8d, 0x84, 0xc4, 0x13, 0x81, 0xca, 0x6e, 0x6d, 0xba, 0x2c, 0x94, 0x5e, 0x6a, 0x08,
+	0xf6, 0x8d, 0x09, 0xf2, 0xd5, 0xc3, 0x07, 0x39, 0x76, 0x26, 0x1b, 0xba, 0xe7, 0xce, 0xc1, 0x65,
+	0xc1, 0x4a, 0x52, 0xdd, 0xdd, 0x01, 0xe7, 0x2a, 0xfa, 0xdb, 0x38, 0x67, 0x26, 0xbe, 0x27, 0xd5,
+	0x3e, 0x7a, 0x20, 0x4a, 0x1b, 0x1e, 0x8f, 0xf5, 0x65, 0xb8, 0x37, 0xfe, 0x0f, 0x0a, 0x19, 0x18,
+	0x49, 0x86, 0x1a, 0x61, 0x3e, 0xd7, 0xff, 0xe4, 0x90, 0xa7, 0xf3, 0x39, 0xb1, 0xb6, 0xde, 0x0e,
+	0xa5, 0x20, 0xe7, 0xa9, 0xfc, 0x4b, 0x3a, 0x15, 0x9f, 0xc3, 0x59, 0xa9, 0x9c, 0xef, 0x5a, 0x6b,
+	0x80, 0xa3, 0xbd, 0xb4, 0xc5, 0x03, 0x3f, 0x59, 0xc7, 0x6f, 0x0c, 0x1d, 0x4e, 0x8c, 0xfb, 0xe4,
+	0x85, 0x69, 0x1c, 0xcd, 0x95, 0xaa, 0xa8, 0x03, 0xfc, 0xe1, 0xc8, 0x55, 0x59, 0x0a, 0x37, 0x75,
+	0xf5, 0x7f, 0x28, 0xea, 0x3e, 0x3e, 0x82, 0x81, 0x69, 0x7d, 0x29, 0x30, 0xa4, 0x39, 0x5a, 0x52,
+	0xc1, 0xfb, 0x17, 0xdd, 0xd1, 0x35, 0x75, 0x0f, 0xfd, 0xcb, 0x21, 0x15, 0x56, 0x7f, 0x85, 0x0f,
+	0xb5, 0x37, 0xfa, 0xf1, 0x53, 0xea, 0x0e, 0x2a, 0x29, 0x4f, 0xdb, 0xe9, 0x80, 0x95, 0x39, 0xc2,
+	0x8e, 0xcc, 0xd9, 0x7a, 0x5d, 0x1f, 0x29, 0xeb, 0x3d, 0x77, 0x20, 0x1a, 0xf1, 0x8c, 0x65, 0x37,
+	0x53, 0x36, 0x95, 0xf9, 0x4c, 0x88, 0x62, 0x62, 0x09, 0x10, 0xba, 0xa1, 0xcd, 0x93, 0xda, 0xe2,
+	0x14, 0x14, 0x45, 0x93, 0xc3, 0x30, 0x2f, 0x6b, 0x5c, 0x30, 0x27, 0x6b, 0x48, 0xaa, 0x89, 0xc4,
+	0x2e, 0xe4, 0x96, 0x80, 0xdb, 0x84, 0xe1, 0x7c, 0xf0, 0xc4, 0x28, 0x94, 0x7c, 0x6d, 0xc5, 0x56,
+	0x33, 0xbd, 0x61, 0xb9, 0x47, 0x4b, 0x32, 0xa1, 0x4a, 0x1d, 0xf1, 0x00, 0x64, 0xd7, 0x22, 0x00,
+	0xc1, 0x09, 0xb0, 0x81, 0x67, 0xa1, 0x6b, 0xe7, 0x88, 0xad, 0x3d, 0x72, 0x80, 0x0f, 0xba, 0x3b,
+	0x19, 0x55, 0x0a, 0x45, 0x88, 0x00, 0x3e, 0x5f, 0xe3, 0x0d, 0xb5, 0xc9, 0xc7, 0xc4, 0xde, 0x8f,
+	0xe8, 0x06, 0x35, 0xf1, 0x55, 0xb4, 0x77, 0x5d, 0x9f, 0x96, 0x3b, 0x39, 0x6b, 0xbc, 0x40, 0x51,
+	0xa4, 0xc8, 0xf5, 0xb8, 0x06, 0x68, 0xb7, 0xaf, 0x62, 0x30, 0xcf, 0xf4, 0xa5, 0x2d, 0x97, 0xd5,
+	0x53, 0xfb, 0x84, 0x09, 0x2a, 0xfb, 0x0f, 0xb7, 0x15, 0xa7, 0x3d, 0xfd, 0xce, 0xd4, 0x9b, 0xd4,
+	0xb5, 0x89, 0x85, 0x9e, 0x17, 0x79, 0xd0, 0x08, 0xa5, 0x8a, 0x91, 0xac, 0xa1, 0xfb, 0x80, 0xee,
+	0xe2, 0x46, 0xd4, 0x9f, 0xc3, 0xd3, 0x79, 0xa5, 0x2d, 0x05, 0xa1, 0x64, 0x2a, 0x1d, 0x88, 0xeb,
+	0xff, 0x85, 0x59, 0xe0, 0x9b, 0x8d, 0x60, 0x28, 0xdf, 0xc3, 0x09, 0x3b, 0x78, 0xca, 0xd8, 0x0d,
+	0xca, 0x19, 0xf6, 0xe3, 0xe6, 0xaa, 0x0e, 0x28, 0xcd, 0x7e, 0x60, 0x95, 0x73, 0xeb, 0x18, 0x44,
+	0x11, 0x8b, 0x6c, 0x33, 0x81, 0x43, 0x2e, 0x85, 0xa7, 0x95, 0x15, 0x13, 0x91, 0x09, 0x72, 0x46,
+	0x27, 0x30, 0x8d, 0x4c, 0xc5, 0xfd, 0x0a, 0xd8, 0x27, 0x73, 0x40, 0x8d, 0xa6, 0x0b, 0x63, 0x0e,
+	0x12, 0x02, 0x58, 0x37, 0x14, 0xbd, 0xa5, 0x34, 0x13, 0x65, 0xac, 0x9f, 0x77, 0x2e, 0x4a, 0xb6,
+	0x11, 0x8f, 0xdd, 0x8f, 0xfc, 0x62, 0x8d, 0xc2, 0x04, 0x95, 0x50, 0xb3, 0xad, 0x67, 0xd1, 0x22,
+	0x4c, 0x75, 0xd4, 0x04, 0xb0, 0x73, 0x05, 0xf4, 0x16, 0x50, 0x8d, 0x0f, 0x24, 0xb9, 0xa2, 0x99,
+	0xe6, 0x2e, 0x6a, 0xab, 0x1d, 0xa4, 0xfa, 0xe0, 0xf9, 0xa3, 0xa3, 0xcc, 0xc6, 0xca, 0x27, 0xa1,
+	0xf0, 0xa8, 0xfd, 0x59, 0x36, 0x4e, 0x1c, 0x3c, 0xdf, 0x1a, 0x09, 0x60, 0x38, 0x02, 0x4c, 0xf9,
+	0xd4, 0x29, 0xa3, 0xa8, 0xdf, 0x30, 0x35, 0x49, 0xdc, 0x12, 0x4f, 0xce, 0xd5, 0x4b, 0x28, 0x89,
+	0x4b, 0x65, 0xc6, 0xa8, 0x4f, 0x58, 0x8b, 0xf7, 0xf9, 0xad, 0xcb, 0x9e, 0x69, 0x33, 0x69, 0xc1,
+	0x1f, 0xd0, 0xe4, 0x58, 0x60, 0x2f, 0x9a, 0xf7, 0x98, 0xb1, 0x24, 0x9c, 0x96, 0xbb, 0x92, 0x7a,
+	0x0f, 0x10, 0xbb, 0x0e, 0x4c, 0xe6, 0x44, 0xf1, 0x2a, 0x3b, 0x47, 0x07, 0x08, 0xd9, 0xa0, 0xed,
+	0x42, 0x77, 0xd1, 0x61, 0x88, 0x2b, 0xb9, 0x96, 0xfb, 0xe6, 0x73, 0xc5, 0x2d, 0x88, 0xd8, 0x6c,
+	0xf2, 0x76, 0x80, 0xcb, 0xc2, 0xa7, 0xf3, 0xa8, 0xcc, 0x2b, 0x96, 0xc8, 0x76, 0xe8, 0x5e, 0x03,
+	0x1e, 0x73, 0xdb, 0xbc, 0x8b, 0xa6, 0x2f, 0x08, 0x23, 0x62, 0xbe, 0x84, 0x06, 0x3b, 0x18, 0x67,
+	0x4e, 0xe6, 0x6a, 0x89, 0xfa, 0xdd, 0x0a, 0x5b, 0x2d, 0xf8, 0xea, 0x2e, 0xdc, 0xbd, 0xde, 0x65,
+	0xe9, 0xd0, 0x44, 0xe1, 0xd6, 0xdf, 0xe5, 0x49, 0xcc, 0xe6, 0x07, 0xbd, 0xdb, 0x42, 0x8f, 0x25
+};
+
+/* EME, AES-256 */
+static PGPByte const s_eme[1024] =
+{
+	0x5d, 0xe7, 0xb5, 0x7e, 0xae, 0xb8, 0x07, 0x51, 0x51, 0xc4, 0x48, 0x2e, 0x23, 0x04, 0xdd, 0x9b,
+	0xdd, 0x16, 0xd7, 0x9a, 0x31, 0x09, 0x03, 0x0d, 0xfd, 0x9d, 0x70, 0xac, 0xa6, 0x30, 0x11, 0x1a,
+	0x56, 0x5e, 0x33, 0x19, 0x8a, 0x3e, 0x51, 0xcc, 0xc8, 0x95, 0xbb, 0x01, 0xff, 0x58, 0x72, 0x5f,
+	0xc6, 0x32, 0xce, 0x95, 0x09, 0x28, 0x29, 0xce, 0x7e, 0x2a, 0x73, 0xea, 0xaf, 0x65, 0x94, 0x6d,
+	0x1e, 0x84, 0x99, 0xb4, 0x13, 0x9c, 0x94, 0x41, 0x68, 0xb1, 0xcf, 0x89, 0x0c, 0x1d, 0x60, 0x9d,
+	0xee, 0xce, 0x2e, 0xef, 0x2b, 0x92, 0x5f, 0x02, 0xa8, 0xdb, 0x69, 0x50, 0x20, 0x82, 0xa5, 0x8c,
+	0x42, 0xaa, 0x86, 0x9a, 0xc8, 0x27, 0x9a, 0x3f, 0x28, 0x55, 0xe2, 0x3c, 0x78, 0x6b, 0x44, 0x54,
+	0x5c, 0x58, 0x40, 0x7b, 0x15, 0x2e, 0x47, 0xf6, 0x19, 0x22, 0xd0, 0x6b, 0x0d, 0x54, 0xa3, 0xe1,
+	0x71, 0x04, 0xeb, 0x9f, 0x6d, 0xa0, 0x91, 0xc4, 0x84, 0xe3, 0x59, 0xda, 0x3d, 0x46, 0xc9, 0x1e,
+	0xee, 0xc4, 0xe2, 0x89, 0x33, 0x9c, 0xaf, 0xf1, 0x4f, 0x69, 0x29, 0x59, 0xe6, 0xdb, 0xdb, 0xbf,
+	0x83, 0x0e, 0x4b, 0x33, 0xba, 0xce, 0x64, 0xa8, 0xe8, 0x9b, 0x72, 0x85, 0x38, 0x66, 0xb5, 0x4d,
+	0xf2, 0x75, 0x47, 0x58, 0xf9, 0xc0, 0xec, 0xbf, 0x52, 0x4c, 0x77, 0x8c, 0x9d, 0x99, 0x57, 0xd7,
+	0x45, 0x82, 0x44, 0xb1, 0x35, 0x39, 0x87, 0x52, 0x7e, 0xf1, 0x98, 0x76, 0xab, 0x1e, 0x57, 0xcb,
+	0x68, 0x15, 0x82, 0x58, 0xc8, 0xe5, 0x91, 0xac, 0x0e, 0xea, 0x79, 0xb6, 0x5e, 0xfd, 0xe6, 0xf2,
+	0xae, 0x86, 0x99, 0x59, 0x8d, 0x1e, 0xf9, 0x5f, 0xf7, 0x4e, 0xb9, 0x2e, 0xac, 0x45, 0x8f, 0x11,
+	0xd2, 0x0f, 0xab, 0x25, 0x67, 0xc7, 0x6e, 0x2a, 0x42, 0xf5, 0x9e, 0x26, 0x4c, 0xf4, 0xa0, 0xd4,
+	0xf2, 0x5f, 0x4e, 0xf2, 0x85, 0xff, 0x42, 0x8a, 0xad, 0x51, 0x84, 0xe6, 0xf4, 0x9f, 0x8c, 0xe6,
+	0x18, 0x5c, 0x84, 0x00, 0x94, 0xb7, 0x68, 0xce, 0x60, 0x1c, 0x9d, 0xda, 0x23, 0xc7, 0xfe, 0xb0,
+	0x10, 0xf9, 0x8d, 0x1e, 0x02, 0xe1, 0x74, 0x3c, 0x7e, 0xc5, 0x5e, 0xd5, 0x14, 0x6e, 0xd3, 0xa5,
+	0xda, 0x51, 0x5c, 0x29, 0x17, 0xb6, 0xa1, 0x26, 0xc9, 0x5b, 0xe8, 0x4c, 0x8c, 0x02, 0x58, 0x31,
+	0xb8, 0xd3, 0xb3, 0xdd, 0x6b, 0x01, 0xe0, 0x64, 0xb0, 0xe7, 0xdb, 0xd5, 0x67, 0x7d, 0x19, 0x24,
+	0x5c, 0x40, 0xf5, 0x9a, 0x6a, 0xc8, 0x86, 0x2c, 0x74, 0x8f, 0x3e, 0x21, 0x1b, 0xe4, 0xde, 0xe1,
+	0x20, 0x48, 0xce, 0x0c, 0x4b, 0x99, 0xa6, 0x7b, 0xf6, 0x9f, 0xb6, 0xd2, 0x62, 0x6a, 0x00, 0x65,
+	0x8b, 0x51, 0xf9, 0x24, 0x0c, 0x36, 0xae, 0xf4, 0xbf, 0x1b, 0x0a, 0x58, 0x26, 0xd6, 0x69, 0x0e,
+	0xcc, 0xf5, 0xbd, 0xaa, 0x93, 0x22, 0xaa, 0x11, 0x19, 0x59, 0xa3, 0x4b, 0x4d, 0x57, 0xfe, 0xb0,
+	0x66, 0xcc, 0xa9, 0xff, 0x02, 0x6a, 0xee, 0x4b, 0x99, 0xfe, 0x78, 0xaa, 0xed, 0xf3, 0xdb, 0xfd,
+	0x5d, 0x02, 0x0c, 0x5f, 0x3c, 0xd3, 0x64, 0x8c, 0xf6, 0x99, 0xca, 0x76, 0xe7, 0x22, 0x61, 0x46,
+	0xd0, 0x86, 0xfb, 0x3d, 0xb5, 0xa7, 0xfd, 0xde, 0xf3, 0x9d, 0xd7, 0xb8, 0x11, 0xf9, 0x6e, 0x5e,
+	0x26, 0xbc, 0xeb, 0x3e, 0x0a, 0x6f, 0xa1, 0x0a, 0x7d, 0x35, 0x99, 0xd4, 0x8c, 0x24, 0x1b, 0x03,
+	0xb9, 0xac, 0x07, 0x3b, 0x95, 0xe6, 0xd1, 0xea, 0x07, 0x6b, 0xe7, 0x9c, 0x74, 0xff, 0xe5, 0x71,
+	0x28, 0x98, 0xb3, 0x51, 0x4d, 0xed, 0x8c, 0x81, 0x5a, 0x97, 0xc6, 0x1c, 0xcf, 0x86, 0x16, 0x43,
+	0x2c, 0xc8, 0x7c, 0xb0, 0xab, 0xef, 0x0b, 0x3f, 0x34, 0xbb, 0x8f, 0xc7, 0x39, 0x94, 0x6b, 0xac,
+	0x2e, 0xde, 0xd2, 0x08, 0xd5, 0x63, 0xe3, 0xea, 0x9a, 0x72, 0x42, 0xcf, 0xe3, 0xad, 0x1b, 0x5e,
+	0x4a, 0x16, 0x79, 0xb9, 0x94, 0x22, 0xed, 0x5f, 0x54, 0x59, 0x5a, 0x7f, 0x9c, 0x2b, 0x1c, 0x32,
+	0xff, 0x1d, 0xea, 0x8b, 0xcd, 0xe3, 0xbb, 0x69, 0x22, 0x78, 0xb9, 0xa2, 0x6a, 0xf5, 0x11, 0xcd,
+	0x33, 0xed, 0xcc, 0x38, 0x14, 0xb9, 0xc8, 0x55, 0x80, 0xc3, 0x38, 0xcb, 0xba, 0xea, 0x4b, 0xc8,
+	0x96, 0x37, 0x0b, 0x46, 0x73, 0xb7, 0xce, 0xaa, 0x6d, 0x4d, 0xdc, 0x57, 0x5e, 0x1b, 0x81, 0x1a,
+	0xde, 0x7d, 0x30, 0x58, 0x73, 0xba, 0xb0, 0x47, 0x6f, 0x96, 0x06, 0xcc, 0x4f, 0x68, 0x8f, 0x62,
+	0xef, 0xe6, 0x37, 0x8c, 0xb1, 0xd3, 0x91, 0x4b, 0xbd, 0x31, 0x08, 0xc3, 0xee, 0xe0, 0x81, 0x94,
+	0x98, 0x56, 0x35, 0x66, 0x15, 0xdc, 0x94, 0x48, 0xe9, 0x9b, 0x2f, 0xcd, 0x83, 0x86, 0x42, 0x8c,
+	0x73, 0x2b, 0xd0, 0x3d, 0xd9, 0xc7, 0x4e, 0xa7, 0xf8, 0x99, 0xa5, 0x22, 0xad, 0x81, 0x78, 0xa4,
+	0x4d, 0xe4, 0x77, 0x36, 0x6b, 0x07, 0x09, 0x8b, 0x2a, 0x18, 0xc6, 0x9e, 0xda, 0x19, 0x40, 0x9c,
+	0xe0, 0xd2, 0xc8, 0xb8, 0xb6, 0xf7, 0xcd, 0x18, 0x3e, 0xd0, 0xad, 0x6d, 0xb5, 0xd1, 0xeb, 0x07,
+	0x84, 0x90, 0xc1, 0xb8, 0x98, 0x5c, 0x9e, 0x44, 0x0a, 0x61, 0xc6, 0x7a, 0xfb, 0x02, 0xe6, 0xff,
+	0x5c, 0xba, 0x1c, 0xde, 0xac, 0xfa, 0x37, 0x82, 0xa1, 0xa4, 0x02, 0x0d, 0x4d, 0x81, 0x56, 0xca,
+	0x4d, 0x9a, 0x41, 0xc9, 0x7f, 0xb7, 0x3a, 0xcd, 0x17, 0x51, 0xeb, 0x06, 0x65, 0xf8, 0x24, 0x0b,
+	0x42, 0xb5, 0x59, 0x10, 0x81, 0xc2, 0x98, 0x87, 0x9c, 0x41, 0xea, 0x27, 0x65, 0xd5, 0xc8, 0x14,
+	0x36, 0xaf, 0x04, 0x06, 0x21, 0xd2, 0xe9, 0x81, 0x89, 0x0d, 0x5b, 0x2e, 0x91, 0x86, 0x2a, 0xe9,
+	0xd2, 0xe9, 0xa8, 0xd5, 0x59, 0xa9, 0xe6, 0x3d, 0xa1, 0x25, 0xb9, 0xdc, 0xb9, 0x27, 0x20, 0xe9,
+	0x15, 0xd6, 0x85, 0xe2, 0x86, 0x2d, 0xba, 0xca, 0xd8, 0xa6, 0xf3, 0x69, 0xa1, 0x7d, 0xa6, 0xf2,
+	0x38, 0x75, 0x05, 0x22, 0x2c, 0xe6, 0x25, 0xb2, 0x2e, 0xf6, 0xe5, 0x08, 0x29, 0xdc, 0xe7, 0xd8,
+	0x81, 0x2d, 0x75, 0x27, 0xd9, 0xad, 0x3f, 0xe9, 0x4a, 0xd1, 0x28, 0xec, 0xa9, 0xf9, 0x4e, 0x2d,
+	0xd1, 0x57, 0x39, 0x68, 0xa1, 0xbc, 0xf1, 0xae, 0x87, 0x5b, 0xf0, 0xbb, 0xa8, 0x3b, 0x06, 0x6c,
+	0x77, 0x45, 0xd7, 0x67, 0x74, 0x4b, 0x70, 0x01, 0x21, 0xa8, 0x42, 0x5a, 0x42, 0x6a, 0xbc, 0xa3,
+	0x1c, 0xed, 0x0d, 0x37, 0x79, 0xef, 0x5a, 0x7c, 0x94, 0x1d, 0x82, 0x8d, 0xb6, 0x31, 0x3d, 0xce,
+	0x95, 0x2c, 0xb2, 0xd7, 0xc9, 0x18, 0x5c, 0x81, 0xf5, 0x52, 0xab, 0xb2, 0x27, 0x1f, 0xd7, 0x69,
+	0xb7, 0xe6, 0xfe, 0x11, 0x20, 0x7c, 0x44, 0xb2, 0x08, 0x0d, 0xd1, 0x18, 0xe7, 0x8c, 0x6e, 0x93,
+	0x36, 0xbb, 0x2d, 0x23, 0xca, 0xd5, 0x50, 0x28, 0x0b, 0x6b, 0xdf, 0xa3, 0x88, 0xe5, 0xc6, 0x8c,
+	0x98, 0xd2, 0x96, 0xab, 0x54, 0x17, 0xc3, 0x14, 0xf0, 0x42, 0xbd, 0x23, 0xc3, 0xf0, 0x43, 0xaa,
+	0x31, 0x58, 0x71, 0x69, 0x2d, 0xde, 0xf6, 0x99, 0xcf, 0x67, 0xfc, 0xcd, 0xf1, 0xa6, 0x93, 0x15,
+	0xd7, 0xac, 0xdf, 0xf6, 0x7b, 0x7e, 0x18, 0x6b, 0x15, 0x89, 0xd2, 0x9e, 0xa9, 0x11, 0xc6, 0x89,
+	0xbb, 0x1c, 0xe7, 0xda, 0xe1, 0x0f, 0x9d, 0x64, 0x8e, 0xb6, 0x38, 0x66, 0x3a, 0x0b, 0x90, 0xb0,
+	0x83, 0x72, 0xd3, 0x44, 0x68, 0xe4, 0x1e, 0xd5, 0xd9, 0x64, 0x13, 0x16, 0x50, 0x5e, 0xc8, 0xfe,
+	0x02, 0x3a, 0x6d, 0xda, 0x2d, 0xb8, 0x50, 0xeb, 0x7c, 0xbd, 0xd7, 0xfe, 0xd3, 0x9e, 0x52, 0x97
+};
+
+/* XTS, AES-256, 512 byte data units */
+static PGPByte const s_xts[1024] =
+{
+	0x1c, 0x69, 0xe2, 0xe9, 0x4b, 0xd7, 0x29, 0x8a, 0x8e, 0x67, 0xff, 0xd0, 0x72, 0xbd, 0xe6, 0xfb,
+	0x01, 0xbf, 0x4c, 0x84, 0x9f, 0x47, 0xa3, 0x85, 0x53, 0x5d, 0xee, 0x24, 0x7d, 0xcd, 0x16, 0x03,
+	0x02, 0x58, 0x17, 0x50, 0x9e, 0x6e, 0x0c, 0xf5, 0x62, 0xaf, 0x4a, 0x7e, 0xe5, 0xb0, 0x6a, 0x7e,
+	0xe1, 0x16, 0xcd, 0x57, 0x63, 0x15, 0xd2, 0x88, 0xba, 0x92, 0x16, 0x46, 0xa6, 0x8b, 0x54, 0x32,
+	0xe3, 0x8b, 0x94, 0xe1, 0xb9, 0xfc, 0xe5, 0x0f, 0xcf, 0xb2, 0xbf, 0xf7, 0xaa, 0x40, 0x53, 0x10,
+	0xfa, 0xf1, 0x3f, 0xc9, 0x28, 0x56, 0xb2, 0x93, 0x1a, 0xa8, 0x83, 0x21, 0x9b, 0x38, 0x32, 0xda,
+	0x2e, 0x1f, 0x92, 0x30, 0xf7, 0x2a, 0x45, 0x50, 0xea, 0xd6, 0xf4, 0xd2, 0x92, 0x34, 0xce, 0xa3,
+	0x2a, 0x01, 0x58, 0x4e, 0x4f, 0x86, 0xd6, 0x35, 0x19, 0x81, 0x1b, 0x6e, 0x9c, 0x19, 0xbc, 0x91,
+	0x42, 0x80, 0x01, 0x50, 0x3d, 0x70, 0x4d, 0x29, 0x4d, 0xb4, 0xbc, 0xcf, 0x1d, 0x0a, 0x08, 0xc2,
+	0x8f, 0x65, 0x72, 0xa0, 0x7f, 0xa5, 0xd5, 0xfe, 0x40, 0xb0, 0x99, 0xf0, 0x21, 0x4f, 0xce, 0x1f,
+	0xb3, 0xd7, 0xb0, 0x67, 0x84, 0x46, 0x58, 0x2f, 0xa3, 0x0c, 0xa8, 0x37, 0x2c, 0x4b, 0x3d, 0xfb,
+	0x48, 0xeb, 0x6e, 0x5b, 0x03, 0xf0, 0x9b, 0x5c, 0x59, 0x5b, 0x7d, 0xae, 0xcf, 0x08, 0x4c, 0x49,
+	0xfb, 0x95, 0xd7, 0x08, 0xba, 0x75, 0x4d, 0x99, 0xaa, 0x30, 0x3f, 0x9a, 0x48, 0xae, 0x7e, 0x7b,
+	0xd6, 0xc0, 0x1f, 0xf2, 0x40, 0xe0, 0x58, 0xfc, 0xe9, 0x0c, 0x28, 0x58, 0x0b, 0x22, 0x53, 0x27,
+	0xb9, 0x9f, 0x56, 0xba, 0x4e, 0x5d, 0x12, 0x7b, 0x71, 0xf1, 0xb0, 0x14, 0x3f, 0x35, 0x6b, 0x4c,
+	0x85, 0xa9, 0x2d, 0x66, 0x83, 0xd2, 0x6c, 0x38, 0x38, 0x79, 0x92, 0x19, 0x39, 0x7e, 0xa0, 0x16,
+	0x66, 0xc4, 0xae, 0x76, 0x63, 0x12, 0xda, 0xee, 0x7c, 0x65, 0xad, 0xfd, 0xbb, 0x8f, 0x39, 0x0b,
+	0xb4, 0x47, 0x5c, 0xf3, 0x4a, 0x09, 0xe4, 0xb4, 0xbe, 0xdc, 0xcd, 0x37, 0x40, 0x16, 0xb0, 0x52,
+	0x2f, 0x32, 0x7d, 0xda, 0x7a, 0xd1, 0xf0, 0xb1, 0x9e, 0xc4, 0x67, 0xf4, 0x85, 0x11, 0xef, 0x7c,
+	0xcd, 0x67, 0xd2, 0xdc, 0x5a, 0x1f, 0x58, 0x49, 0x70, 0x73, 0x00, 0xa9, 0x66, 0xaf, 0x57, 0x43,
+	0xae, 0x48, 0x98, 0x0c, 0x0e, 0x0f, 0x97, 0x4c, 0x47, 0xd3, 0x92, 0x55, 0x17, 0xcc, 0xbe, 0xde,
+	0xe0, 0x56, 0x4d, 0x0c, 0x79, 0x39, 0x10, 0xe0, 0xd2, 0x03, 0x00, 0x9e, 0xe6, 0x4b, 0xb2, 0x7d,
+	0x46, 0x63, 0xbc, 0x9e, 0x10, 0xca, 0x91, 0x8f, 0xea, 0x57, 0x5a, 0x67, 0x34, 0x35, 0x2e, 0x2d,
+	0x71, 0xe6, 0x84, 0x95, 0x79, 0x60, 0x37, 0x82, 0xfd, 0xb9, 0xbc, 0x9a, 0x1a, 0xcf, 0x93, 0x42,
+	0x55, 0x1e, 0x8d, 0x3a, 0xbf, 0xa5, 0xbe, 0x19, 0x5f, 0x5b, 0x63, 0x91, 0x6a, 0x8c, 0x3d, 0x44,
+	0xa8, 0x1e, 0x25, 0x42, 0x13, 0x7a, 0x50, 0xf8, 0x05, 0xa1, 0x7b, 0x72, 0x65, 0x66, 0xf5, 0xad,
+	0xd5, 0x7a, 0x19, 0x9b, 0x46, 0x75, 0xa4, 0x09, 0xb1, 0xbf, 0x80, 0x9b, 0x83, 0x5d, 0x20, 0x57,
+	0x07, 0x2b, 0x6f, 0xf8, 0xa5, 0x52, 0x68, 0x02, 0x24, 0x3b, 0x9e, 0x11, 0xc8, 0x68, 0x25, 0x1c,
+	0x64, 0x44, 0x1f, 0x9d, 0x11, 0xf0, 0xab, 0xa5, 0x3d, 0x54, 0x83, 0x03, 0x1a, 0xcc, 0x4b, 0x45,
+	0xb3, 0xb4, 0x63, 0xfa, 0xf8, 0xd0, 0xcc, 0xfd, 0x00, 0xd1, 0xe4, 0x3a, 0xd2, 0x96, 0x62, 0x07,
+	0x8f, 0x78, 0x18, 0x68, 0x78, 0x76, 0xda, 0xa5, 0xf2, 0x12, 0xd1, 0x1b, 0x2d, 0xd6, 0xe8, 0xac,
+	0xeb, 0x7b, 0xec, 0xf6, 0x0f, 0xfd, 0xe8, 0xdf, 0xb2, 0xaa, 0x8e, 0xbc, 0xa7, 0xd7, 0x0d, 0xd8,
+	0x0e, 0x6a, 0x6d, 0xee, 0xde, 0xe8, 0xb8, 0xf1, 0xd8, 0x05, 0xa0, 0x9e, 0xa3, 0x00, 0xa3, 0x68,
+	0x6d, 0xaa, 0xee, 0xe6, 0xad, 0x31, 0x92, 0x23, 0xd7, 0x4e, 0x5b, 0x21, 0x33, 0x9c, 0x03, 0x7c,
+	0x31, 0xe0, 0x12, 0xf0, 0x8c, 0xd8, 0xf2, 0x97, 0x03, 0x37, 0x28, 0x71, 0xf6, 0xf8, 0xd2, 0xab,
+	0x6c, 0x98, 0x64, 0x4e, 0x2d, 0x59, 0x11, 0x60, 0xd0, 0x18, 0x0a, 0x43, 0x61, 0x0b, 0x40, 0x2b,
+	0x2e, 0x01, 0x32, 0x87, 0xb3, 0x34, 0x56, 0x76, 0x08, 0x92, 0xd1, 0xdf, 0x56, 0x62, 0x19, 0x76,
+	0xc7, 0x10, 0xef, 0x93, 0x00, 0x87, 0xa5, 0x78, 0x3c, 0xb7, 0xa3, 0xa6, 0x06, 0x6b, 0xfe, 0xc9,
+	0xd5, 0x10, 0xaa, 0x28, 0x67, 0x7f, 0x9d, 0x52, 0x71, 0x63, 0x2d, 0xca, 0x17, 0x99, 0xf5, 0x44,
+	0x3a, 0xa9, 0xb0, 0x77, 0x71, 0xed, 0xda, 0xae, 0xf2, 0x97, 0x54, 0x3a, 0x90, 0x68, 0xce, 0xc8,
+	0xb9, 0x0e, 0x45, 0xc3, 0x62, 0x74, 0xaa, 0xb9, 0xa6, 0xa6, 0xd1, 0x3b, 0x8b, 0x9d, 0x21, 0x1f,
+	0xa1, 0x92, 0xb6, 0xd8, 0xcf, 0x14, 0xf7, 0x7c, 0xac, 0x20, 0x01, 0x73, 0x23, 0xca, 0x44, 0x48,
+	0xf2, 0x61, 0xcb, 0xae, 0x5a, 0x6b, 0xff, 0xe9, 0xcf, 0x08, 0x06, 0x44, 0x97, 0xbb, 0x0d, 0x7c,
+	0xca, 0x38, 0xca, 0x94, 0x60, 0x0a, 0x7c, 0xc4, 0x9d, 0x8f, 0xfe, 0x56, 0x1e, 0x7a, 0x7f, 0x72,
+	0x67, 0x42, 0x7a, 0x48, 0x2c, 0x60, 0x63, 0x5a, 0x56, 0xdf, 0x98, 0x41, 0x72, 0x87, 0x1a, 0xa2,
+	0xc4, 0x63, 0x2c, 0x64, 0xe4, 0x1c, 0x07, 0x3e, 0x7b, 0x29, 0x3c, 0x08, 0x63, 0x1f, 0xe9, 0x8a,
+	0x3e, 0xa7, 0x2b, 0x80, 0xaf, 0x3b, 0x6e, 0xf9, 0x38, 0x19, 0xc7, 0xc8, 0x7e, 0xd6, 0x4b, 0x13,
+	0xeb, 0x24, 0xc2, 0x8a, 0x01, 0x7a, 0xdc, 0x30, 0x49, 0x2b, 0x62, 0xda, 0xb8, 0x3d, 0x5a, 0x5f,
+	0x05, 0x57, 0xce, 0x4b, 0x03, 0x73, 0x56, 0xf4, 0x47, 0x03, 0xbb, 0xef, 0x2e, 0x6b, 0x5f, 0xc8,
+	0x50, 0x24, 0x76, 0x65, 0xc9, 0x98, 0xae, 0xcd, 0xc2, 0x6e, 0x93, 0x25, 0x62, 0x86, 0x49, 0x0d,
+	0x0f, 0x65, 0xc3, 0x11, 0x90, 0xb9, 0xb2, 0x98, 0x75, 0xbb, 0x15, 0xe7, 0x75, 0xa7, 0x20, 0x10,
+	0x29, 0x9b, 0xd5, 0xc5, 0xeb, 0xa0, 0xb8, 0x31, 0x35, 0x3e, 0xf1, 0xfd, 0x4d, 0x25, 0xd0, 0x79,
+	0xee, 0x6a, 0x59, 0x74, 0x23, 0xc5, 0x4c, 0x79, 0xfb, 0xb2, 0x6c, 0x26, 0x06, 0x1a, 0x87, 0xbd,
+	0x83, 0xc6, 0xcc, 0x55, 0x91, 0xbe, 0x0c, 0x48, 0x85, 0x59, 0xa8, 0x85, 0x98, 0x32, 0xaf, 0xeb,
+	0x92, 0xe0, 0x96, 0x5b, 0xbf, 0x68, 0x3e, 0x72, 0xdb, 0x38, 0x49, 0xcd, 0x6e, 0xa7, 0x9d, 0x0b,
+	0x4c, 0xcc, 0x60, 0x59, 0x79, 0x48, 0x16, 0x60, 0xcf, 0xc5, 0xec, 0xae, 0x63, 0x12, 0x5a, 0x54,
+	0x61, 0x5a, 0x62, 0x6e, 0xe0, 0x06, 0x47, 0x48, 0x53, 0x16, 0xa6, 0x17, 0x40, 0x63, 0xa6, 0x47,
+	0x9f, 0xe4, 0x85, 0x11, 0xfd, 0xc1, 0x75, 0x26, 0x90, 0x8f, 0xb2, 0x20, 0x0c, 0xb3, 0xa7, 0x28,
+	0xfc, 0x7b, 0x76, 0x19, 0x42, 0xf8, 0xe2, 0x8d, 0x94, 0xa9, 0xc5, 0xf5, 0x49, 0x01, 0xf1, 0xe7,
+	0x30, 0x8a, 0x0b, 0x06, 0xde, 0x62, 0x3d, 0x12, 0xf4, 0xbd, 0x61, 0x2e, 0xef, 0xa9, 0x59, 0xa4,
+	0x88, 0xda, 0xec, 0xcb, 0xb2, 0xe1, 0x93, 0xf4, 0x75, 0x15, 0x92, 0x16, 0x58, 0x30, 0x2d, 0x49,
+	0x18, 0x0a, 0x29, 0x11, 0xf6, 0xa5, 0xe5, 0x6a, 0x80, 0x14, 0xc0, 0x58, 0xd8, 0x69, 0x1b, 0x64,
+	0xf3, 0xfb, 0x16, 0xc8, 0x90, 0xfa, 0xc6, 0x23, 0x25, 0x5d, 0x5f, 0xd8, 0xfb, 0xb6, 0x09, 0xfe,
+	0x48, 0xac, 0xc8, 0xa9, 0x20, 0xc4, 0x17, 0xaa, 0x04, 0xab, 0x0f, 0x27, 0xda, 0x67, 0x57, 0x04
+};
+
+/* XTS, AES-128, 4096 byte data units */
+static PGPByte const s_xts4096[1024] =
+{
+	0xbb, 0xcc, 0xe6, 0x31, 0x15, 0x27, 0xfd, 0xa9, 0x25, 0x55, 0xcd, 0x0e, 0xe4, 0xad, 0xdd, 0x44,
+	0x6c, 0x0d, 0x5e, 0xc3, 0xba, 0x1a, 0xef, 0x5e, 0x41, 0xce, 0xef, 0x1f, 0x0d, 0xaa, 0x4b, 0x3f,
+	0xff, 0xeb, 0xcb, 0xe4, 0x6b, 0xef, 0xef, 0xd8, 0xe7, 0x24, 0x3f, 0x18, 0x93, 0x9b, 0xa7, 0x11,
+	0x39, 0x5d, 0x86, 0xb2, 0x24, 0x79, 0x52, 0xae, 0x77, 0x6f, 0xc5, 0xf5, 0x81, 0x8d, 0xdd, 0xbb,
+	0xa6, 0x5a, 0x68, 0x63, 0x2c, 0x13, 0x41, 0xe8, 0xc1, 0x4c, 0x39, 0x06, 0xfe, 0xa9, 0xd3, 0xa3,
+	0xd0, 0xfe, 0x2b, 0x1e, 0x3f, 0xce, 0x24, 0x94, 0xdf, 0xac, 0x30, 0x8d, 0x6e, 0x3b, 0xec, 0xea,
+	0x5b, 0xee, 0x79, 0x9f, 0x43, 0x52, 0xdf, 0x29, 0x7d, 0xb3, 0x40, 0x73, 0x40, 0x60, 0x12, 0x9d,
+	0xe7, 0x95, 0x7e, 0xff, 0x71, 0x74, 0x7c, 0xf3, 0x6c, 0x9d, 0xd9, 0x9c, 0xef, 0xb0, 0x4a, 0x0c,
+	0x64, 0x2e, 0xc5, 0x62, 0x00, 0xdc, 0x55, 0x55, 0x49, 0x10, 0xd2, 0xb7, 0x32, 0xc6, 0xfa, 0xe8,
+	0xb2, 0xe5, 0x4d, 0x96, 0x18, 0x35, 0x74, 0x63, 0xca, 0x70, 0x9e, 0x0e, 0xd3, 0x38, 0x96, 0x6f,
+	0x3c, 0x47, 0x89, 0xc7, 0x41, 0xa2, 0x7d, 0x04, 0x53, 0x15, 0x25, 0x3b, 0xd1, 0x09, 0x95, 0x60,
+	0x3a, 0xf3, 0xed, 0x0f, 0x62, 0xbd, 0x9a, 0x46, 0x9f, 0xd5, 0x67, 0x9c, 0x85, 0x4e, 0x85, 0xd2,
+	0x7b, 0x8b, 0xb4, 0xb1, 0xc9, 0x32, 0x57, 0xd5, 0x37, 0xfd, 0x86, 0xe6, 0x69, 0x03, 0x5a, 0x7e,
+	0xd8, 0x72, 0x3f, 0xe2, 0xd7, 0xa6, 0xa5, 0xb0, 0x82, 0xd6, 0x83, 0x63, 0x4c, 0xae, 0x3e, 0x11,
+	0xc2, 0xf6, 0x2e, 0x68, 0xbc, 0xd4, 0x9e, 0xeb, 0xf4, 0x19, 0xf4, 0x0c, 0x26, 0xa9, 0xb4, 0xd7,
+	0x3a, 0xac, 0xee, 0xd4, 0x69, 0x7b, 0xcc, 0xb2, 0x0f, 0x1e, 0x28, 0x80, 0xb3, 0xaa, 0xcd, 0x98,
+	0xb3, 0x3f, 0xe1, 0xba, 0x5e, 0x67, 0x29, 0xe4, 0x8c, 0x13, 0xb1, 0x4f, 0xb6, 0xbd, 0xf9, 0x6e,
+	0x79, 0xfd, 0xeb, 0x38, 0xb4, 0x87, 0x60, 0xa1, 0x3a, 0x1a, 0x90, 0xed, 0x33, 0x0f, 0x3d, 0x76,
+	0xc1, 0x57, 0x3c, 0x11, 0xac, 0x58, 0x92, 0xfa, 0x55, 0xaa, 0x01, 0x78, 0xff, 0xf9, 0xd3, 0xbf,
+	0x88, 0x8a, 0x8e, 0x67, 0xeb, 0xa0, 0xc7, 0xd0, 0x46, 0xcc, 0xae, 0x14, 0x80, 0xb6, 0xb9, 0x18,
+	0xfb, 0xd0, 0xd8, 0xc0, 0x59, 0xa2, 0x1f, 0x97, 0x53, 0xbc, 0xaf, 0x3a, 0xb6, 0x59, 0xd2, 0x97,
+	0xdc, 0xee, 0x58, 0x44, 0x63, 0x45, 0xbf, 0x26, 0x79, 0x12, 0x71, 0xdc, 0xf4, 0xc5, 0xa0, 0x34,
+	0x8f, 0x8c, 0x29, 0x6c, 0x59, 0xba, 0x1d, 0x92, 0x97, 0xa2, 0xc0, 0x1c, 0x7e, 0x62, 0x16, 0xc1,
+	0x53, 0xba, 0xbb, 0xb1, 0x89, 0x52, 0xbe, 0x64, 0xe0, 0x50, 0xc0, 0x06, 0x39, 0x59, 0x1f, 0x35,
+	0x7e, 0x5b, 0xcb, 0x5a, 0x0f, 0x1f, 0x5e, 0xa9, 0xde, 0xe9, 0x8e, 0x61, 0xf2, 0x2c, 0x50, 0xe3,
+	0x46, 0xe1, 0x66, 0x85, 0x86, 0x95, 0x44, 0x4d, 0x60, 0xcd, 0x96, 0x93, 0x25, 0x74, 0xe5, 0xf2,
+	0x1e, 0xc6, 0x79, 0x16, 0xdc, 0xae, 0xa0, 0x00, 0xf6, 0x32, 0xcc, 0xa9, 0x3b, 0xb3, 0x0c, 0x68,
+	0x04, 0xaa, 0xd2, 0x86, 0xe8, 0xe3, 0xbc, 0xa7, 0xa6, 0x55, 0xb3, 0x72, 0x53, 0xae, 0xc9, 0x53,
+	0x20, 0x1d, 0x6d, 0xdb, 0x7b, 0x83, 0x9e, 0x60, 0xf5, 0x65, 0x30, 0xed, 0x09, 0xa6, 0xb9, 0x9b,
+	0xa7, 0x16, 0x29, 0xaf, 0xec, 0x35, 0x13, 0x2f, 0x6c, 0x68, 0x7d, 0xbb, 0x48, 0x91, 0x9b, 0x7b,
+	0x85, 0x43, 0x38, 0xb1, 0x09, 0x42, 0xaf, 0x6f, 0xc2, 0xef, 0xf2, 0x8d, 0xd0, 0xd1, 0xeb, 0x25,
+	0xf7, 0x22, 0x2e, 0x6b, 0xde, 0x82, 0xe4, 0x6d, 0x50, 0x51, 0x54, 0x01, 0x48, 0x5e, 0x96, 0xbc,
+	0xe3, 0xc9, 0x1e, 0xd7, 0x49, 0xbd, 0xc9, 0x03, 0x89, 0xa7, 0x78, 0x78, 0x32, 0x93, 0xe1, 0xb0,
+	0x8d, 0x93, 0x47, 0x5d, 0x03, 0xd3, 0x9a, 0x09, 0x51, 0x63, 0x37, 0x97, 0xec, 0xb5, 0xa4, 0x15,
+	0x1f, 0x3a, 0xfe, 0x49, 0x76, 0x7e, 0x62, 0x11, 0x6b, 0xba, 0xc4, 0xd7, 0xa2, 0x3f, 0x77, 0x13,
+	0x35, 0x89, 0x9c, 0xdc, 0x27, 0x5c, 0x51, 0xfe, 0x14, 0x84, 0xab, 0x44, 0xa3, 0x95, 0xc1, 0xb3,
+	0x96, 0x00, 0x7a, 0x57, 0xf5, 0xbd, 0xc6, 0x7c, 0x01, 0x95, 0x06, 0xa7, 0x69, 0xe5, 0xd4, 0x32,
+	0xe8, 0xf9, 0xb3, 0x2a, 0x6f, 0xba, 0x93, 0xae, 0x93, 0x13, 0xcd, 0xc0, 0x13, 0xdd, 0x77, 0x9b,
+	0xaa, 0x8f, 0xeb, 0x0c, 0x0a, 0x0f, 0x9b, 0xd2, 0x9d, 0x8d, 0x55, 0x8b, 0x65, 0xdd, 0x58, 0x52,
+	0xd3, 0xa5, 0x63, 0x80, 0xae, 0xbd, 0xd0, 0x95, 0xbf, 0xc5, 0x58, 0xc5, 0x71, 0x3f, 0x7b, 0x6e,
+	0xfe, 0x07, 0x94, 0x96, 0x4d, 0x1c, 0x40, 0x90, 0x39, 0xe5, 0xb0, 0xf4, 0x22, 0x78, 0xfd, 0xc2,
+	0x2e, 0xc5, 0x66, 0x0c, 0xe5, 0x9c, 0xa3, 0x58, 0x61, 0x77, 0xeb, 0xb4, 0x2d, 0x2b, 0x03, 0xa3,
+	0xd2, 0x54, 0x7c, 0x40, 0x29, 0xc5, 0xca, 0x39, 0x6c, 0x6b, 0x4b, 0xc7, 0x9c, 0x64, 0xde, 0xd1,
+	0xb6, 0x6b, 0x87, 0x0e, 0xbc, 0x65, 0xf3, 0x19, 0xd2, 0x45, 0x87, 0xc5, 0x65, 0xac, 0x09, 0x3d,
+	0x12, 0x7d, 0x19, 0x4a, 0x3b, 0xc0, 0x37, 0x3a, 0xdb, 0xe5, 0x0a, 0xf7, 0x56, 0x5a, 0x1b, 0xe1,
+	0x34, 0x60, 0x7c, 0xbc, 0x08, 0xf0, 0x21, 0x06, 0x65, 0x43, 0x08, 0xff, 0x3c, 0x69, 0x93, 0x04,
+	0x97, 0xc4, 0xcc, 0xe5, 0x77, 0xaf, 0x7a, 0x83, 0xe9, 0x05, 0x5e, 0xcc, 0x52, 0x07, 0x54, 0x80,
+	0x35, 0x0e, 0xa5, 0xba, 0x21, 0x6a, 0x85, 0x0a, 0xd3, 0xee, 0xc7, 0x74, 0x09, 0x84, 0x3a, 0x44,
+	0x86, 0x49, 0x2e, 0x5b, 0x87, 0xb2, 0x90, 0x9e, 0x14, 0xe6, 0xfe, 0xc1, 0xbb, 0x6f, 0x23, 0x61,
+	0x1a, 0x5f, 0xb1, 0x71, 0x7f, 0x96, 0xee, 0x3c, 0x90, 0x47, 0x5b, 0x7d, 0x71, 0x4b, 0x51, 0x34,
+	0x79, 0xbd, 0x09, 0x1c, 0xf9, 0x28, 0xde, 0xec, 0x20, 0x2d, 0x34, 0x52, 0x08, 0x71, 0xe2, 0xaf,
+	0xaf, 0x8e, 0x56, 0x62, 0x77, 0x91, 0x18, 0x97, 0xe0, 0xa5, 0xb3, 0x78, 0x96, 0x4e, 0xd2, 0xb5,
+	0x25, 0x52, 0x12, 0xa3, 0x2f, 0x20, 0x70, 0x34, 0x22, 0xf8, 0xcc, 0xac, 0x34, 0xe7, 0xfd, 0x79,
+	0x7e, 0x07, 0x51, 0x37, 0xa2, 0x59, 0x5a, 0xad, 0x0a, 0x12, 0xbc, 0x76, 0x2e, 0x51, 0xb7, 0x2f,
+	0x13, 0xfb, 0x13, 0xc5, 0x94, 0xd8, 0x2a, 0x0f, 0x60, 0x38, 0x32, 0x45, 0xa4, 0x36, 0xfd, 0x67,
+	0xb8, 0x4d, 0x14, 0xff, 0xfa, 0x33, 0xaf, 0xb6, 0xd2, 0x48, 0x45, 0x95, 0x61, 0x98, 0x57, 0xc7,
+	0xe8, 0x59, 0xd0, 0x12, 0xc5, 0x81, 0x4a, 0xc0, 0x68, 0x01, 0x58, 0x36, 0x37, 0x9d, 0xc0, 0xad,
+	0xd4, 0xd7, 0xbf, 0x66, 0x1d, 0x3d, 0x56, 0x27, 0x08, 0xd8, 0xc9, 0x3b, 0x0f, 0xf8, 0x82, 0xdc,
+	0x71, 0x34, 0x1d, 0x5c, 0x8f, 0xae, 0xd4, 0xfa, 0x35, 0x85, 0x93, 0xd3, 0x70, 0xb9, 0xb8, 0xd0,
+	0x62, 0xa5, 0xaa, 0x50, 0xa8, 0x6b, 0xe5, 0xf0, 0x4e, 0xd1, 0xf1, 0x2e, 0xc3, 0x08, 0x10, 0x35,
+	0x48, 0x55, 0x08, 0x9f, 0x9f, 0xc1, 0xc1, 0x6f, 0xb8, 0xf8, 0xa3, 0x6a, 0x94, 0x99, 0x69, 0x6c,
+	0x70, 0x0e, 0x82, 0x34, 0x43, 0x9c, 0x3b, 0x13, 0xc9, 0x7b, 0xd2, 0xf9, 0x89, 0x28, 0xc6, 0x88,
+	0x8e, 0xe0, 0x72, 0x00, 0xb0, 0x72, 0x87, 0x6c, 0xf2, 0x69, 0x43, 0x4b, 0x41, 0xe9, 0x5a, 0x1b,
+	0xeb, 0xff, 0x70, 0x45, 0x88, 0x07, 0xd1, 0x6a, 0x12, 0xe0, 0x97, 0xa9, 0xc5, 0xb4, 0xa1, 0x54
+};
+
+/* s_key256 wrapped with s_entityKey, as in the Header block */
+static PGPByte const s_wrapped[32] =
+{
+	0x16, 0x7a, 0x62, 0xaa, 0x94, 0x52, 0xbd, 0xfb, 0x73, 0x58, 0xa8, 0x83, 0x13, 0x2d, 0xe9, 0x61,
+	0x27, 0xbb, 0xf2, 0x1d, 0x69, 0xd4, 0xda, 0xfb, 0xc6, 0xae, 0x8e, 0x9c, 0x64, 0xb0, 0xd2, 0x9f
+};
+
+static int CipherTest(char const* name, PGPUInt32 mode, PGPByte const* key, PGPUInt32 keySize, PGPByte const* expected)
+{
+	PGPByte plain[KAT_SIZE];
+	PGPByte buffer[KAT_SIZE];
+
+	for(PGPUInt32 index = 0; index < KAT_SIZE; ++index)
+	{
+		plain[index] = (PGPByte) (index * 7 + 3);
+	}
+
+	memcpy(buffer, plain, sizeof(buffer));
+
+	CFilFormatCipher cipher;
+
+	// Cipher field of the Header block: mode in the upper 16bit
+	PGPError err = cipher.Init(mode << 16, key, keySize, KAT_NONCE);
+
+	if(IsntPGPError(err))
+	{
+		err = cipher.Encode(buffer, sizeof(buffer), KAT_OFFSET);
+	}
+
+	if(IsntPGPError(err) && memcmp(buffer, expected, sizeof(buffer)))
+	{
+		err = kPGPError_SelfTestFailed;
+	}
+
+	// Decode sector by sector, the driver does not see requests at once
+	if(IsntPGPError(err))
+	{
+		err = cipher.Decode(buffer + FILFORMAT_SECTOR_SIZE, FILFORMAT_SECTOR_SIZE, KAT_OFFSET + FILFORMAT_SECTOR_SIZE);
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = cipher.Decode(buffer, FILFORMAT_SECTOR_SIZE, KAT_OFFSET);
+	}
+
+	if(IsntPGPError(err) && memcmp(buffer, plain, sizeof(buffer)))
+	{
+		err = kPGPError_SelfTestFailed;
+	}
+
+	if(IsPGPError(err))
+	{
+		printf("ERROR ON CIPHER TEST %s [%d]\n", name, (int) err);
+
+		return 1;
+	}
+
+	printf("Cipher test %s passed\n", name);
+
+	return 0;
+}
+
+
+static int WrapTest()
+{
+	PGPByte fileKey[FILFORMAT_KEY_SIZE];
+	memcpy(fileKey, s_key256, sizeof(fileKey));
+
+	PGPError err = CFilFormatCipher::WrapKey(s_entityKey, sizeof(s_entityKey), fileKey, false);
+
+	if(IsntPGPError(err) && memcmp(fileKey, s_wrapped, sizeof(fileKey)))
+	{
+		err = kPGPError_SelfTestFailed;
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = CFilFormatCipher::WrapKey(s_entityKey, sizeof(s_entityKey), fileKey, true);
+	}
+
+	if(IsntPGPError(err) && memcmp(fileKey, s_key256, sizeof(fileKey)))
+	{
+		err = kPGPError_SelfTestFailed;
+	}
+
+	if(IsPGPError(err))
+	{
+		printf("ERROR ON WRAP TEST [%d]\n", (int) err);
+
+		return 1;
+	}
+
+	printf("Wrap test passed\n");
+
+	return 0;
+}
+
+
+static int PaddingTest()
+{
+	static PGPUInt32 const sizes[] = { 0, 1, 2, 255, 256, 510, 511, 512, 513, 1023 };
+
+	int failed = 0;
+
+	for(unsigned size = 0; size < sizeof(sizes) / sizeof(sizes[0]); ++size)
+	{
+		PGPByte buffer[2 * CFilFormatCipher::c_blockSize];
+		memset(buffer, 0xcc, sizeof(buffer));
+
+		PGPUInt32 const padded = CFilFormatCipher::AddPadding(buffer, sizes[size]);
+		PGPUInt32 const total  = sizes[size] + padded;
+
+		if((total % CFilFormatCipher::c_blockSize) || (padded != CFilFormatCipher::ComputePadding(sizes[size])) || (CFilFormatCipher::GetPadding(buffer, total) != padded))
+		{
+			printf("ERROR ON PADDING TEST Size[%u]\n", sizes[size]);
+
+			failed++;
+		}
+	}
+
+	// One byte is a single 0xff, a whole block ends with its size LSB first
+	PGPByte buffer[CFilFormatCipher::c_blockSize];
+
+	if((CFilFormatCipher::AddPadding(buffer, CFilFormatCipher::c_blockSize - 1) != 1) || (buffer[CFilFormatCipher::c_blockSize - 1] != 0xff))
+	{
+		printf("ERROR ON PADDING TEST single byte\n");
+
+		failed++;
+	}
+
+	if((CFilFormatCipher::AddPadding(buffer, 0) != CFilFormatCipher::c_blockSize) || (buffer[CFilFormatCipher::c_blockSize - 2] != 0x00) || (buffer[CFilFormatCipher::c_blockSize - 1] != 0x02) || (buffer[0] != 0x00))
+	{
+		printf("ERROR ON PADDING TEST whole block\n");
+
+		failed++;
+	}
+
+	return failed;
+}
+
+
+int main(void)
+{
+	int failed = 0;
+
+	failed += CipherTest("CTR", FILFORMAT_CIPHER_MODE_CTR, s_key128, sizeof(s_key128), s_ctr);
+	failed += CipherTest("CFB", FILFORMAT_CIPHER_MODE_CFB, s_key256, sizeof(s_key256), s_cfb);
+	failed += CipherTest("EME", FILFORMAT_CIPHER_MODE_EME, s_key256, sizeof(s_key256), s_eme);
+	failed += CipherTest("XTS", FILFORMAT_CIPHER_MODE_XTS, s_key256, sizeof(s_key256), s_xts);
+	failed += CipherTest("XTS/4096", FILFORMAT_CIPHER_MODE_XTS | (FILFORMAT_CIPHER_UNIT_4096 << FILFORMAT_CIPHER_UNIT_SHIFT), s_key128, sizeof(s_key128), s_xts4096);
+
+	failed += WrapTest();
+	failed += PaddingTest();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
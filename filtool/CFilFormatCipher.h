@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatCipher.h: interface for the CFilFormatCipher class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilFormatCipher_H__A4E27B93_5D1C_4E08_9F36_C8B20D71E4A9__INCLUDED_)
+#define AFX_CFilFormatCipher_H__A4E27B93_5D1C_4E08_9F36_C8B20D71E4A9__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "FilFormat.h"
+
+extern "C"
+{
+	#include "pgpMemoryMgr.h"
+	#include "pgpSymmetricCipher.h"
+	#include "pgpEME.h"
+	#include "pgpEME2.h"
+	#include "pgpXTS.h"
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilFormatCipher
+{
+	// User mode counterpart of the driver's cipher classes (CFilterCipherCTR, -CFB, -EME, -XTS) and
+	// FileKey wrapping of CFilterContext::EncodeFileKey. Output must match theirs byte by byte.
+
+public:
+
+	enum c_constants
+	{
+		c_blockSize		= FILFORMAT_BLOCK_SIZE,		// bytes, Encode/Decode granularity
+		c_aesBlockSize	= 16,
+	};
+
+								CFilFormatCipher();
+								~CFilFormatCipher();
+
+	PGPError					Init(PGPUInt32 cipher, PGPByte const* fileKey, PGPUInt32 keySize, PGPUInt64 nonce);
+	void						Close();
+
+	// Offset is relative to the end of the Header, as the driver's FILFILE_CRYPT_CONTEXT
+	PGPError					Encode(PGPByte *buffer, PGPSize size, PGPUInt64 offset);
+	PGPError					Decode(PGPByte *buffer, PGPSize size, PGPUInt64 offset);
+
+	PGPUInt32					Mode() const;
+
+	static PGPError				WrapKey(PGPByte const* entityKey, PGPUInt32 entityKeySize, PGPByte *fileKey, bool unwrap);
+
+	static PGPUInt32			GetPadding(PGPByte const* source, PGPUInt32 size);
+	static PGPUInt32			AddPadding(PGPByte *target, PGPUInt32 size);
+	static PGPUInt32			ComputePadding(PGPUInt64 size);
+
+private:
+
+	PGPError					CodeCTR(PGPByte *buffer, PGPSize size, PGPUInt64 offset);
+	PGPError					CodeCFB(PGPByte *buffer, PGPSize size, PGPUInt64 offset, bool encode);
+	PGPError					DeriveTweakKey(PGPByte *keys);
+
+	static PGPCipherAlgorithm	Algorithm(PGPUInt32 keySize);
+
+								// DATA
+	PGPUInt32					m_mode;
+	PGPUInt32					m_keySize;
+	PGPUInt64					m_nonce;
+
+	PGPMemoryMgrRef				m_mgr;
+	PGPSymmetricCipherContextRef m_aes;			// CTR, CFB
+	PGPEMEContextRef			m_eme;
+	PGPEME2ContextRef			m_eme2;
+	PGPXTSContextRef			m_xts;
+
+	PGPByte						m_key[FILFORMAT_KEY_SIZE];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+PGPUInt32 CFilFormatCipher::Mode() const
+{
+	return m_mode;
+}
+
+inline
+PGPUInt32 CFilFormatCipher::ComputePadding(PGPUInt64 size)
+{
+	return c_blockSize - (PGPUInt32) (size & (c_blockSize - 1));
+}
+
+inline
+PGPCipherAlgorithm CFilFormatCipher::Algorithm(PGPUInt32 keySize)
+{
+	return (keySize == 16) ? kPGPCipherAlgorithm_AES128
+		 : (keySize == 24) ? kPGPCipherAlgorithm_AES192
+		 : kPGPCipherAlgorithm_AES256;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilFormatCipher_H__A4E27B93_5D1C_4E08_9F36_C8B20D71E4A9__INCLUDED_)
@@ -0,0 +1,1048 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatFile.cpp: implementation of the CFilFormatFile class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "CFilFormatFile.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CFilFormatFile::CFilFormatFile()
+{
+	m_dataSize	= 0;
+	m_codedSize	= 0;
+	m_buffer	= 0;
+}
+
+CFilFormatFile::~CFilFormatFile()
+{
+	Close();
+}
+
+void CFilFormatFile::Close()
+{
+	if(m_buffer)
+	{
+		// be paranoid
+		memset(m_buffer, 0, c_chunkSize);
+		free(m_buffer);
+	}
+
+	m_cipher.Close();
+	m_header.Close();
+	m_io.Close();
+
+	m_dataSize	= 0;
+	m_codedSize	= 0;
+	m_buffer	= 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatFile::Open(char const* path, bool writable)
+{
+	assert(path);
+
+	Close();
+
+	PGPError err = m_io.Map(path, writable);
+
+	if(IsPGPError(err))
+	{
+		return err;
+	}
+
+	if(!m_io.Data())
+	{
+		return kPGPError_CorruptData;
+	}
+
+	err = m_header.Parse(m_io.Data(), (m_io.Size() < ~0u) ? (PGPSize) m_io.Size() : ~0u);
+
+	if(IsPGPError(err))
+	{
+		return err;
+	}
+
+	PGPUInt64 const encrypted = m_io.Size() - m_header.m_block.BlockSize;
+
+	// AutoConfig and zero sized files have neither data nor Tail
+	if(!m_header.IsAutoConfig() && encrypted)
+	{
+		if(encrypted < FILFORMAT_TAIL)
+		{
+			return kPGPError_CorruptData;
+		}
+
+		m_dataSize	= encrypted - FILFORMAT_TAIL;
+		m_codedSize	= m_dataSize + CFilFormatCipher::ComputePadding(m_dataSize);
+	}
+
+	m_buffer = (PGPByte*) malloc(c_chunkSize);
+
+	return (m_buffer) ? kPGPError_NoErr : kPGPError_OutOfMemory;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatFile::InitCipher(PGPByte const* entityKey, PGPUInt32 entityKeySize)
+{
+	assert(entityKey);
+
+	if(m_header.IsAutoConfig())
+	{
+		return kPGPError_FeatureNotAvailable;
+	}
+
+	PGPByte fileKey[FILFORMAT_KEY_SIZE];
+	memcpy(fileKey, m_header.m_block.FileKey, sizeof(fileKey));
+
+	PGPError err = CFilFormatCipher::WrapKey(entityKey, entityKeySize, fileKey, true);
+
+	if(IsntPGPError(err))
+	{
+		err = m_cipher.Init(m_header.m_block.Cipher, fileKey, m_header.KeySize(), m_header.m_block.Nonce);
+	}
+
+	memset(fileKey, 0, sizeof(fileKey));
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatFile::Process(CFilFormatIo *target, PGPUInt64 begin, PGPUInt64 end)
+{
+	assert(m_buffer);
+	assert(0 == (begin % CFilFormatCipher::c_blockSize));
+	assert(end <= m_codedSize);
+
+	PGPByte const* source = m_io.Data() + m_header.m_block.BlockSize;
+
+	for(PGPUInt64 offset = begin; offset < end; )
+	{
+		PGPSize const size = (end - offset > c_chunkSize) ? (PGPSize) c_chunkSize : (PGPSize) (end - offset);
+
+		memcpy(m_buffer, source + offset, size);
+
+		PGPError err = m_cipher.Decode(m_buffer, size, offset);
+
+		if(IsPGPError(err))
+		{
+			return err;
+		}
+
+		// Last block holds the Padding, a wrong EntityKey is detected here
+		if(offset + size == m_codedSize)
+		{
+			PGPUInt32 const padded = CFilFormatCipher::GetPadding(m_buffer + size - CFilFormatCipher::c_blockSize,
+																  CFilFormatCipher::c_blockSize);
+
+			if(padded != CFilFormatCipher::ComputePadding(m_dataSize))
+			{
+				return kPGPError_BadIntegrity;
+			}
+		}
+
+		if(target && (offset < m_dataSize))
+		{
+			PGPUInt64 const valid = m_dataSize - offset;
+
+			err = target->Write(m_buffer, (valid < size) ? (PGPSize) valid : size);
+
+			if(IsPGPError(err))
+			{
+				return err;
+			}
+		}
+
+		offset += size;
+	}
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatFile::Verify(PGPByte const* entityKey, PGPUInt32 entityKeySize, PGPUInt32 flags)
+{
+	// Header was verified on Open
+	if(!entityKey || !(flags & (VERIFY_TAIL | VERIFY_DATA)) || !m_codedSize)
+	{
+		return kPGPError_NoErr;
+	}
+
+	PGPError err = InitCipher(entityKey, entityKeySize);
+
+	if(IsntPGPError(err))
+	{
+		PGPUInt64 const begin = (flags & VERIFY_DATA) ? 0 : m_codedSize - CFilFormatCipher::c_blockSize;
+
+		err = Process(0, begin, m_codedSize);
+	}
+
+	m_cipher.Close();
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatFile::Decrypt(PGPByte const* entityKey, PGPUInt32 entityKeySize, char const* target)
+{
+	assert(entityKey);
+	assert(target);
+
+	PGPError err = InitCipher(entityKey, entityKeySize);
+
+	if(IsntPGPError(err))
+	{
+		CFilFormatIo output;
+
+		err = output.Create(target);
+
+		if(IsntPGPError(err))
+		{
+			err = Process(&output, 0, m_codedSize);
+		}
+	}
+
+	m_cipher.Close();
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatFile::Rewrap(PGPByte const* entityKey, PGPUInt32 entityKeySize,
+								PGPByte const* newEntityKey, PGPUInt32 newEntityKeySize, char const* target)
+{
+	assert(entityKey);
+	assert(newEntityKey);
+
+	// Ensure the current EntityKey is the right one before the FileKey gets re-encrypted
+	PGPError err = Verify(entityKey, entityKeySize, VERIFY_TAIL);
+
+	if(IsPGPError(err))
+	{
+		return err;
+	}
+
+	PGPUInt32 const blockSize = m_header.m_block.BlockSize;
+	PGPUInt32 const present	  = CFilFormatHeader::RewrapLength(m_header.m_block.PayloadSize);
+	// In place, only the sectors holding block and Payload are rewritten
+	PGPUInt32 const length	  = (target) ? blockSize : present;
+
+	// The copy must fit into the second half of the block, the caller rewrites the file otherwise
+	if(!target && (length > blockSize / 2))
+	{
+		return kPGPError_BufferTooSmall;
+	}
+
+	PGPByte *const header = (PGPByte*) malloc(length);
+
+	if(!header)
+	{
+		return kPGPError_OutOfMemory;
+	}
+
+	// Keep Header as it is, except the wrapped FileKey. Same as CFilterCipherManager::RewrapHeader
+	if(target)
+	{
+		memcpy(header, m_io.Data(), blockSize);
+	}
+
+	PGPByte const* const parsed = m_header.m_payload - FILFORMAT_HEADER_BLOCK_SIZE;
+
+	// A Header recovered from its copy is taken from there, the copy does not go along
+	memcpy(header, parsed, present);
+
+	if(target && (parsed != m_io.Data()))
+	{
+		err = CFilFormatIo::Randomize(header + blockSize / 2, present);
+	}
+
+	PGPByte *const fileKey = header + (FILFORMAT_HEADER_BLOCK_SIZE - FILFORMAT_KEY_SIZE);
+
+	if(IsntPGPError(err))
+	{
+		err = CFilFormatCipher::WrapKey(entityKey, entityKeySize, fileKey, true);
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = CFilFormatCipher::WrapKey(newEntityKey, newEntityKeySize, fileKey, false);
+	}
+
+	if(IsntPGPError(err) && !target)
+	{
+		err = RewrapHeader(header, length);
+	}
+	else if(IsntPGPError(err))
+	{
+		CFilFormatIo output;
+
+		err = output.Create(target);
+
+		if(IsntPGPError(err))
+		{
+			err = output.Write(header, blockSize);
+
+			if(IsntPGPError(err) && (m_io.Size() > blockSize))
+			{
+				err = output.Write(m_io.Data() + blockSize, (PGPSize) (m_io.Size() - blockSize));
+			}
+		}
+	}
+
+	memset(header, 0, length);
+	free(header);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatFile::RewrapHeader(PGPByte *image, PGPUInt32 length)
+{
+	assert(image);
+	assert(length);
+
+	PGPUInt32 const shadow = m_header.m_block.BlockSize / 2;
+
+	// First the copy into the random fill of the second half, make it durable before touching
+	// the present image. If the latter gets torn, Open() finds the copy
+	PGPError err = m_io.WriteAt(shadow, image, length);
+
+	if(IsntPGPError(err))
+	{
+		err = m_io.Flush();
+	}
+
+	// Then swap
+	if(IsntPGPError(err))
+	{
+		err = m_io.WriteAt(0, image, length);
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = m_io.Flush();
+	}
+
+	PGPByte *const check = (PGPByte*) malloc(length);
+
+	if(!check)
+	{
+		err = kPGPError_OutOfMemory;
+	}
+
+	// Read back to verify what has been written
+	if(IsntPGPError(err))
+	{
+		err = m_io.ReadAt(0, check, length);
+
+		if(IsntPGPError(err) && memcmp(check, image, length))
+		{
+			err = kPGPError_CorruptData;
+		}
+	}
+
+	free(check);
+
+	if(IsntPGPError(err))
+	{
+		// Replace the copy with random fill again, so the FileKey wrapped with the old EntityKey
+		// does not linger. If that fails, the copy equals the present image, which is harmless
+		if(IsntPGPError(CFilFormatIo::Randomize(image, length)))
+		{
+			m_io.WriteAt(shadow, image, length);
+		}
+
+		// The mapping sees the new Header
+		err = m_header.Parse(m_io.Data(), m_header.m_block.BlockSize);
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatFile::Encrypt(char const* source, char const* target,
+								 PGPByte const* entityKey, PGPUInt32 entityKeySize, PGPUInt32 mode,
+								 PGPByte const* payload, PGPUInt32 payloadSize)
+{
+	assert(source);
+	assert(target);
+	assert(entityKey);
+
+	// FileKey gets the EntityKey's size and cipher, as the driver does
+	PGPUInt32 const sym = (entityKeySize == 16) ? FILFORMAT_CIPHER_SYM_AES128
+						: (entityKeySize == 24) ? FILFORMAT_CIPHER_SYM_AES192
+						: (entityKeySize == 32) ? FILFORMAT_CIPHER_SYM_AES256
+						: FILFORMAT_CIPHER_SYM_NULL;
+
+	PGPUInt32 const unit = (mode >> FILFORMAT_CIPHER_UNIT_SHIFT) & FILFORMAT_CIPHER_UNIT_MASK;
+
+	if(!sym || (mode & ~0xff) || (unit && ((unit != FILFORMAT_CIPHER_UNIT_4096) || ((mode & FILFORMAT_CIPHER_MODE_MASK) != FILFORMAT_CIPHER_MODE_XTS))))
+	{
+		return kPGPError_BadParams;
+	}
+
+	PGPUInt32 const cipher = (mode << 16) | sym;
+
+	CFilFormatIo input;
+
+	PGPError err = input.Map(source);
+
+	if(IsPGPError(err))
+	{
+		return err;
+	}
+
+	PGPByte fileKey[FILFORMAT_KEY_SIZE];
+	PGPUInt64 nonce = 0;
+
+	err = CFilFormatIo::Randomize(fileKey, sizeof(fileKey));
+
+	while(IsntPGPError(err) && !nonce)
+	{
+		err = CFilFormatIo::Randomize((PGPByte*) &nonce, sizeof(nonce));
+	}
+
+	CFilFormatCipher coder;
+
+	if(IsntPGPError(err))
+	{
+		err = coder.Init(cipher, fileKey, entityKeySize, nonce);
+	}
+
+	CFilFormatHeader header;
+
+	if(IsntPGPError(err))
+	{
+		err = CFilFormatCipher::WrapKey(entityKey, entityKeySize, fileKey, false);
+
+		if(IsntPGPError(err))
+		{
+			err = header.Init(cipher, fileKey, nonce, payload, payloadSize);
+		}
+	}
+
+	memset(fileKey, 0, sizeof(fileKey));
+
+	if(IsPGPError(err))
+	{
+		return err;
+	}
+
+	PGPSize const bufferSize = (header.m_block.BlockSize > c_chunkSize) ? header.m_block.BlockSize : (PGPSize) c_chunkSize;
+
+	PGPByte *const buffer = (PGPByte*) malloc(bufferSize);
+
+	if(!buffer)
+	{
+		return kPGPError_OutOfMemory;
+	}
+
+	CFilFormatIo output;
+
+	err = output.Create(target);
+
+	if(IsntPGPError(err))
+	{
+		// Fill unused Header bytes with random data
+		err = CFilFormatIo::Randomize(buffer, header.m_block.BlockSize);
+
+		if(IsntPGPError(err))
+		{
+			err = header.Write(buffer, header.m_block.BlockSize);
+		}
+
+		if(IsntPGPError(err))
+		{
+			err = output.Write(buffer, header.m_block.BlockSize);
+		}
+	}
+
+	PGPUInt64 const dataSize = input.Size();
+
+	// Zero sized files consist of the Header only
+	if(IsntPGPError(err) && dataSize)
+	{
+		PGPUInt64 const codedSize = dataSize + CFilFormatCipher::ComputePadding(dataSize);
+
+		for(PGPUInt64 offset = 0; offset < codedSize; )
+		{
+			PGPSize const size = (codedSize - offset > c_chunkSize) ? (PGPSize) c_chunkSize : (PGPSize) (codedSize - offset);
+
+			if(offset + size < codedSize)
+			{
+				memcpy(buffer, input.Data() + offset, size);
+			}
+			else
+			{
+				PGPUInt32 const valid = (PGPUInt32) (dataSize - offset);
+
+				memcpy(buffer, input.Data() + offset, valid);
+
+				CFilFormatCipher::AddPadding(buffer, valid);
+			}
+
+			err = coder.Encode(buffer, size, offset);
+
+			if(IsntPGPError(err))
+			{
+				err = output.Write(buffer, size);
+			}
+
+			if(IsPGPError(err))
+			{
+				break;
+			}
+
+			offset += size;
+		}
+
+		// Filler completes the Tail, it is random and not encrypted
+		PGPUInt32 const filler = (PGPUInt32) (dataSize & (CFilFormatCipher::c_blockSize - 1));
+
+		if(IsntPGPError(err) && filler)
+		{
+			err = CFilFormatIo::Randomize(buffer, filler);
+
+			if(IsntPGPError(err))
+			{
+				err = output.Write(buffer, filler);
+			}
+		}
+	}
+
+	memset(buffer, 0, bufferSize);
+	free(buffer);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+
+#include "CFilFormatBatch.h"
+
+/*
+ * Round trip of all cipher modes and sizes around the block and chunk boundaries,
+ * FileKey rewrapping, in place as well, and detection of a wrong EntityKey. Run in
+ * a scratch directory. Given a file count, also reports the in place rewrap rate.
+ */
+static int FileTest(PGPUInt32 mode, PGPUInt64 size)
+{
+	static PGPByte const key[32]	= { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+	static PGPByte const other[24]	= { 0xa5, 0x5a };
+	static PGPByte const payload[]	= "opaque payload";
+
+	PGPByte *const plain = (PGPByte*) malloc((size_t) size + 1);
+
+	for(PGPUInt64 index = 0; index < size; ++index)
+	{
+		plain[index] = (PGPByte) (index * 13 + (index >> 9));
+	}
+
+	FILE *stream = fopen("plain.tmp", "wb");
+	fwrite(plain, 1, (size_t) size, stream);
+	fclose(stream);
+
+	int failed = 1;
+
+	PGPError err = CFilFormatFile::Encrypt("plain.tmp", "coded.tmp", key, sizeof(key), mode, payload, sizeof(payload));
+
+	if(IsntPGPError(err))
+	{
+		CFilFormatFile file;
+
+		err = file.Open("coded.tmp");
+
+		if(IsntPGPError(err))
+		{
+			PGPUInt64 const expected = file.Header().m_block.BlockSize + ((size) ? size + FILFORMAT_TAIL : 0);
+
+			if((file.FileSize() != expected) || (file.DataSize() != size))
+			{
+				err = kPGPError_CorruptData;
+			}
+		}
+
+		if(IsntPGPError(err))
+		{
+			err = file.Verify(key, sizeof(key), CFilFormatFile::VERIFY_DATA);
+		}
+
+		// Wrong key must be detected, unless the Padding is the single 0xff byte that a wrong key
+		// decrypts to as well, once in 256 times
+		if(IsntPGPError(err) && size && (CFilFormatCipher::ComputePadding(size) > 1) && IsntPGPError(file.Verify(other, sizeof(other), CFilFormatFile::VERIFY_TAIL)))
+		{
+			err = kPGPError_SelfTestFailed;
+		}
+
+		if(IsntPGPError(err))
+		{
+			err = file.Rewrap(key, sizeof(key), other, sizeof(other), "rewrap.tmp");
+		}
+
+		file.Close();
+
+		if(IsntPGPError(err))
+		{
+			err = file.Open("rewrap.tmp");
+		}
+
+		if(IsntPGPError(err))
+		{
+			err = file.Decrypt(other, sizeof(other), "clear.tmp");
+		}
+
+		if(IsntPGPError(err))
+		{
+			CFilFormatIo clear;
+
+			err = clear.Map("clear.tmp");
+
+			if(IsntPGPError(err) && ((clear.Size() != size) || (size && memcmp(clear.Data(), plain, (size_t) size))))
+			{
+				err = kPGPError_SelfTestFailed;
+			}
+		}
+	}
+
+	if(IsntPGPError(err))
+	{
+		failed = 0;
+	}
+	else
+	{
+		printf("ERROR ON FILE TEST Mode[0x%x] Size[%llu] [%d]\n", mode, (unsigned long long) size, (int) err);
+	}
+
+	free(plain);
+
+	remove("plain.tmp");
+	remove("coded.tmp");
+	remove("rewrap.tmp");
+	remove("clear.tmp");
+
+	return failed;
+}
+
+static bool HasCopy(char const* path)
+{
+	CFilFormatIo io;
+
+	if(IsPGPError(io.Map(path)) || (io.Size() < FILFORMAT_HEADER_ALIGN))
+	{
+		return false;
+	}
+
+	PGPUInt32 const shadow = CFilFormatHeader::Load32(io.Data() + 12) / 2;
+
+	return (CFilFormatHeader::Load32(io.Data() + shadow) == FILFORMAT_MAGIC);
+}
+
+static int RewrapTest(PGPUInt32 mode, PGPUInt64 size)
+{
+	static PGPByte const key[16]	= { 0x10, 0x20, 0x30 };
+	static PGPByte const other[32]	= { 0x5a, 0xa5, 0x5a };
+	static PGPByte const payload[]	= "opaque payload";
+
+	PGPByte *const plain = (PGPByte*) malloc((size_t) size + 1);
+
+	for(PGPUInt64 index = 0; index < size; ++index)
+	{
+		plain[index] = (PGPByte) (index * 7 + 3);
+	}
+
+	FILE *stream = fopen("plain.tmp", "wb");
+	fwrite(plain, 1, (size_t) size, stream);
+	fclose(stream);
+
+	free(plain);
+
+	CFilFormatFile file;
+
+	PGPError err = CFilFormatFile::Encrypt("plain.tmp", "coded.tmp", key, sizeof(key), mode, payload, sizeof(payload));
+
+	PGPUInt64 fileSize = 0;
+
+	// In place, only the Header changes and no copy is left behind
+	if(IsntPGPError(err))
+	{
+		err = file.Open("coded.tmp", true);
+	}
+
+	if(IsntPGPError(err))
+	{
+		fileSize = file.FileSize();
+
+		err = file.Rewrap(key, sizeof(key), other, sizeof(other));
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = file.Verify(other, sizeof(other), CFilFormatFile::VERIFY_DATA);
+	}
+
+	file.Close();
+
+	if(IsntPGPError(err) && HasCopy("coded.tmp"))
+	{
+		err = kPGPError_SelfTestFailed;
+	}
+
+	PGPUInt32 const length = CFilFormatHeader::RewrapLength(sizeof(payload));
+
+	// Interrupt the next one: the copy is durable, the present image is torn
+	if(IsntPGPError(err))
+	{
+		CFilFormatIo io;
+
+		err = io.Map("coded.tmp", true);
+
+		PGPByte image[FILFORMAT_HEADER_ALIGN];
+
+		if(IsntPGPError(err))
+		{
+			memcpy(image, io.Data(), length);
+
+			PGPByte *const fileKey = image + (FILFORMAT_HEADER_BLOCK_SIZE - FILFORMAT_KEY_SIZE);
+
+			err = CFilFormatCipher::WrapKey(other, sizeof(other), fileKey, true);
+
+			if(IsntPGPError(err))
+			{
+				err = CFilFormatCipher::WrapKey(key, sizeof(key), fileKey, false);
+			}
+		}
+
+		if(IsntPGPError(err))
+		{
+			err = io.WriteAt(CFilFormatHeader::Load32(image + 12) / 2, image, length);
+		}
+
+		if(IsntPGPError(err))
+		{
+			err = io.WriteAt(FILFORMAT_HEADER_BLOCK_SIZE, (PGPByte const*) "torn", 4);
+		}
+	}
+
+	// The copy is found, carries the new FileKey and does not go along with a copy rewrap
+	if(IsntPGPError(err))
+	{
+		err = file.Open("coded.tmp", true);
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = file.Verify(key, sizeof(key), CFilFormatFile::VERIFY_DATA);
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = file.Rewrap(key, sizeof(key), other, sizeof(other), "rewrap.tmp");
+	}
+
+	if(IsntPGPError(err) && HasCopy("rewrap.tmp"))
+	{
+		err = kPGPError_SelfTestFailed;
+	}
+
+	// Rewrap in place repairs the present image
+	if(IsntPGPError(err))
+	{
+		err = file.Rewrap(key, sizeof(key), other, sizeof(other));
+	}
+
+	file.Close();
+
+	if(IsntPGPError(err) && HasCopy("coded.tmp"))
+	{
+		err = kPGPError_SelfTestFailed;
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = file.Open("coded.tmp");
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = file.Verify(other, sizeof(other), CFilFormatFile::VERIFY_DATA);
+	}
+
+	if(IsntPGPError(err) && (file.FileSize() != fileSize))
+	{
+		err = kPGPError_SelfTestFailed;
+	}
+
+	file.Close();
+
+	// Without a copy, a torn Header stays an error
+	if(IsntPGPError(err))
+	{
+		CFilFormatIo io;
+
+		err = io.Map("coded.tmp", true);
+
+		if(IsntPGPError(err))
+		{
+			err = io.WriteAt(FILFORMAT_HEADER_BLOCK_SIZE, (PGPByte const*) "torn", 4);
+		}
+	}
+
+	if(IsntPGPError(err) && (kPGPError_BadIntegrity != file.Open("coded.tmp")))
+	{
+		err = kPGPError_SelfTestFailed;
+	}
+
+	file.Close();
+
+	int failed = 0;
+
+	if(IsPGPError(err))
+	{
+		printf("ERROR ON REWRAP TEST Mode[0x%x] Size[%llu] [%d]\n", mode, (unsigned long long) size, (int) err);
+
+		failed = 1;
+	}
+
+	// A Payload too large for a copy in half of the block must be rewritten as a whole
+	static PGPByte large[3000];
+
+	err = CFilFormatFile::Encrypt("plain.tmp", "coded.tmp", key, sizeof(key), mode, large, sizeof(large));
+
+	if(IsntPGPError(err))
+	{
+		err = file.Open("coded.tmp", true);
+	}
+
+	if(IsntPGPError(err) && (kPGPError_BufferTooSmall != file.Rewrap(key, sizeof(key), other, sizeof(other))))
+	{
+		err = kPGPError_SelfTestFailed;
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = file.Verify(key, sizeof(key), CFilFormatFile::VERIFY_DATA);
+	}
+
+	file.Close();
+
+	if(IsPGPError(err))
+	{
+		printf("ERROR ON REWRAP LARGE PAYLOAD Mode[0x%x] Size[%llu] [%d]\n", mode, (unsigned long long) size, (int) err);
+
+		failed = 1;
+	}
+
+	remove("plain.tmp");
+	remove("coded.tmp");
+	remove("rewrap.tmp");
+
+	return failed;
+}
+
+struct BenchmarkContext
+{
+	PGPByte const*	From;
+	PGPByte const*	To;
+	PGPUInt32		KeySize;
+	bool			Copy;		// rewrite the whole file, as before the in place rewrap
+};
+
+static PGPError BenchmarkRewrap(void *context, CFilFormatBatch::Entry *entry)
+{
+	BenchmarkContext const* bench = (BenchmarkContext const*) context;
+
+	CFilFormatFile file;
+
+	PGPError err = file.Open(entry->Path, !bench->Copy);
+
+	if(IsPGPError(err))
+	{
+		return err;
+	}
+
+	entry->Bytes = file.FileSize();
+
+	if(!bench->Copy)
+	{
+		return file.Rewrap(bench->From, bench->KeySize, bench->To, bench->KeySize);
+	}
+
+	char target[512];
+	snprintf(target, sizeof(target), "%s.new", entry->Path);
+
+	err = file.Rewrap(bench->From, bench->KeySize, bench->To, bench->KeySize, target);
+
+	file.Close();
+
+	if(IsntPGPError(err))
+	{
+		err = CFilFormatIo::Replace(target, entry->Path);
+	}
+
+	return err;
+}
+
+static int Benchmark(PGPUInt32 count)
+{
+	static PGPByte const keys[2][32] = { { 0x11, 0x22 }, { 0x33, 0x44 } };
+	static PGPByte const payload[]	 = "opaque payload";
+
+	static PGPUInt32 const threads[] = { 1, 2, 4, 8 };
+
+	enum { c_perDirectory = 1000, c_plain = 4096 };
+
+	// One encrypted image, written count times
+	static PGPByte plain[c_plain];
+
+	FILE *stream = fopen("bench.plain", "wb");
+	fwrite(plain, 1, sizeof(plain), stream);
+	fclose(stream);
+
+	CFilFormatFile::Encrypt("bench.plain", "bench.coded", keys[0], sizeof(keys[0]), FILFORMAT_CIPHER_MODE_EME, payload, sizeof(payload));
+
+	CFilFormatIo image;
+
+	if(IsPGPError(image.Map("bench.coded")))
+	{
+		printf("ERROR ON BENCHMARK SETUP\n");
+		return 1;
+	}
+
+	double start = CFilFormatBatch::Clock();
+
+	char path[64];
+
+	for(PGPUInt32 index = 0; index < count; ++index)
+	{
+		snprintf(path, sizeof(path), "bench/d%u/f%u", index / c_perDirectory, index);
+
+		CFilFormatIo io;
+
+		if(((index % c_perDirectory) && IsPGPError(io.Create(path))) ||
+		   (!(index % c_perDirectory) && (IsPGPError(CFilFormatIo::CreateParents(path)) || IsPGPError(io.Create(path)))) ||
+		   IsPGPError(io.Write(image.Data(), (PGPSize) image.Size())))
+		{
+			printf("ERROR ON BENCHMARK SETUP %s\n", path);
+			return 1;
+		}
+	}
+
+	printf("%u files of %llu bytes created in %.1f s\n", count, (unsigned long long) image.Size(), CFilFormatBatch::Clock() - start);
+
+	CFilFormatBatch batch;
+
+	batch.Add("bench", true);
+
+	BenchmarkContext context = { keys[0], keys[1], sizeof(keys[0]), false };
+
+	int failed = 0;
+
+	for(PGPUInt32 round = 0; round <= sizeof(threads) / sizeof(threads[0]); ++round)
+	{
+		// Last round rewrites each file through a copy, as before
+		context.Copy = (round == sizeof(threads) / sizeof(threads[0]));
+
+		PGPUInt32 const workers = (context.Copy) ? threads[round - 1] : threads[round];
+
+		batch.Run(workers, BenchmarkRewrap, 0, &context);
+
+		printf("%s, %u threads: %.2f s, %.0f files/s, %u failed\n", (context.Copy) ? "copy" : "in place", workers,
+			   batch.Seconds(), (batch.Seconds() > 0) ? batch.Count() / batch.Seconds() : 0.0, batch.Failed());
+
+		failed += batch.Failed();
+
+		// Back and forth
+		PGPByte const* swap = context.From;
+		context.From = context.To;
+		context.To	 = swap;
+	}
+
+	image.Close();
+
+	start = CFilFormatBatch::Clock();
+
+	for(PGPUInt32 index = 0; index < count; ++index)
+	{
+		snprintf(path, sizeof(path), "bench/d%u/f%u", index / c_perDirectory, index);
+		remove(path);
+
+		if(!((index + 1) % c_perDirectory) || (index + 1 == count))
+		{
+			snprintf(path, sizeof(path), "bench/d%u", index / c_perDirectory);
+			remove(path);
+		}
+	}
+
+	remove("bench");
+	remove("bench.plain");
+	remove("bench.coded");
+
+	return failed;
+}
+
+
+
+int main(int argc, char **argv)
+{
+	static PGPUInt32 const modes[] =
+	{
+		FILFORMAT_CIPHER_MODE_CTR,
+		FILFORMAT_CIPHER_MODE_CFB,
+		FILFORMAT_CIPHER_MODE_EME,
+		FILFORMAT_CIPHER_MODE_EME_2,
+		FILFORMAT_CIPHER_MODE_XTS,
+		FILFORMAT_CIPHER_MODE_XTS | (FILFORMAT_CIPHER_UNIT_4096 << FILFORMAT_CIPHER_UNIT_SHIFT),
+	};
+
+	static PGPUInt64 const sizes[] =
+	{
+		0, 1, 2, 511, 512, 513, 4096, 4097, CFilFormatFile::c_chunkSize - 1, CFilFormatFile::c_chunkSize, 3 * CFilFormatFile::c_chunkSize + 700,
+	};
+
+	int failed = 0;
+
+	for(unsigned mode = 0; mode < sizeof(modes) / sizeof(modes[0]); ++mode)
+	{
+		for(unsigned size = 0; size < sizeof(sizes) / sizeof(sizes[0]); ++size)
+		{
+			failed += FileTest(modes[mode], sizes[size]);
+		}
+
+		failed += RewrapTest(modes[mode], 0) + RewrapTest(modes[mode], 4097);
+
+		printf("File tests Mode[0x%x] done\n", modes[mode]);
+	}
+
+	if(argc > 1)
+	{
+		failed += Benchmark((PGPUInt32) atoi(argv[1]));
+	}
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,102 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatFile.h: interface for the CFilFormatFile class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilFormatFile_H__6D93F0B4_2E7A_4C15_8B0D_A1C7E54F9382__INCLUDED_)
+#define AFX_CFilFormatFile_H__6D93F0B4_2E7A_4C15_8B0D_A1C7E54F9382__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "FilFormat.h"
+#include "CFilFormatHeader.h"
+#include "CFilFormatCipher.h"
+#include "CFilFormatIo.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilFormatFile
+{
+	// Offline access to one encrypted file, without the driver. The EntityKey (DEK) is given by the
+	// caller, the FileKey (FEK) is unwrapped from the Header. Data is processed in c_chunkSize pieces.
+	// Rewrap() without target rewrites only the Header of a file opened writable, the same way
+	// CFilterCipherManager::RewrapHeader does.
+
+public:
+
+	enum c_constants
+	{
+		c_chunkSize		= 1024 * 1024,		// bytes per Encode/Decode and write call
+	};
+
+	enum c_verifyFlags
+	{
+		VERIFY_HEADER	= 0x0,				// Magic, sizes and Payload crc only
+		VERIFY_TAIL		= 0x1,				// decrypt last block, check Padding as RetrieveTail does
+		VERIFY_DATA		= 0x2,				// decrypt all data
+	};
+
+								CFilFormatFile();
+								~CFilFormatFile();
+
+	PGPError					Open(char const* path, bool writable = false);
+	void						Close();
+
+	PGPError					Verify(PGPByte const* entityKey, PGPUInt32 entityKeySize, PGPUInt32 flags);
+	PGPError					Decrypt(PGPByte const* entityKey, PGPUInt32 entityKeySize, char const* target);
+	PGPError					Rewrap(PGPByte const* entityKey, PGPUInt32 entityKeySize,
+									   PGPByte const* newEntityKey, PGPUInt32 newEntityKeySize, char const* target = 0);
+
+	static PGPError				Encrypt(char const* source, char const* target,
+										PGPByte const* entityKey, PGPUInt32 entityKeySize, PGPUInt32 mode,
+										PGPByte const* payload, PGPUInt32 payloadSize);
+
+	CFilFormatHeader const&		Header() const;
+	PGPUInt64					FileSize() const;
+	PGPUInt64					DataSize() const;
+
+private:
+
+	PGPError					InitCipher(PGPByte const* entityKey, PGPUInt32 entityKeySize);
+	PGPError					Process(CFilFormatIo *target, PGPUInt64 begin, PGPUInt64 end);
+	PGPError					RewrapHeader(PGPByte *image, PGPUInt32 length);
+
+								// DATA
+	CFilFormatIo				m_io;
+	CFilFormatHeader			m_header;
+	CFilFormatCipher			m_cipher;
+
+	PGPUInt64					m_dataSize;		// plain data
+	PGPUInt64					m_codedSize;	// plain data plus Padding, excluding Filler
+
+	PGPByte*					m_buffer;		// c_chunkSize bytes
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+CFilFormatHeader const& CFilFormatFile::Header() const
+{
+	return m_header;
+}
+
+inline
+PGPUInt64 CFilFormatFile::FileSize() const
+{
+	return m_io.Size();
+}
+
+inline
+PGPUInt64 CFilFormatFile::DataSize() const
+{
+	return m_dataSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilFormatFile_H__6D93F0B4_2E7A_4C15_8B0D_A1C7E54F9382__INCLUDED_)
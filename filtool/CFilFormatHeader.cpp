@@ -0,0 +1,243 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatHeader.cpp: implementation of the CFilFormatHeader class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "CFilFormatHeader.h"
+
+extern "C"
+{
+	#include "pgpMiniUtil.h"
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CFilFormatHeader::CFilFormatHeader()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+CFilFormatHeader::~CFilFormatHeader()
+{
+	Close();
+}
+
+void CFilFormatHeader::Close()
+{
+	if(m_payloadCopy)
+	{
+		free(m_payloadCopy);
+	}
+
+	// be paranoid
+	memset(this, 0, sizeof(*this));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPUInt32 CFilFormatHeader::Crc32(PGPByte const* buffer, PGPUInt32 bufferSize)
+{
+	// Same as CFilterBase::Crc32: reflected polynomial, zero start value, no final inversion
+	return (buffer && bufferSize) ? pgpCRC32(0, buffer, (int) bufferSize) : 0;
+}
+
+PGPUInt32 CFilFormatHeader::KeySize() const
+{
+	switch(m_block.Cipher & 0xffff)
+	{
+		case FILFORMAT_CIPHER_SYM_AES128:
+			return 16;
+		case FILFORMAT_CIPHER_SYM_AES192:
+			return 24;
+		case FILFORMAT_CIPHER_SYM_AES256:
+			return 32;
+		default:
+			break;
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatHeader::Init(PGPUInt32 cipher, PGPByte const* wrappedKey, PGPUInt64 nonce,
+								PGPByte const* payload, PGPUInt32 payloadSize, PGPUInt32 deepness)
+{
+	assert(wrappedKey);
+
+	// The driver refuses files without Payload
+	if(!payload || !payloadSize)
+	{
+		return kPGPError_BadParams;
+	}
+
+	Close();
+
+	m_payloadCopy = (PGPByte*) malloc(payloadSize);
+
+	if(!m_payloadCopy)
+	{
+		return kPGPError_OutOfMemory;
+	}
+
+	memcpy(m_payloadCopy, payload, payloadSize);
+
+	m_payload = m_payloadCopy;
+
+	m_block.Magic		= FILFORMAT_MAGIC;
+	// Minor version tells about data units larger than a sector, as the driver does
+	m_block.Version		= (((cipher >> 16) >> FILFORMAT_CIPHER_UNIT_SHIFT) & FILFORMAT_CIPHER_UNIT_MASK) ? 2 : 1;
+	m_block.Cipher		= cipher;
+	m_block.BlockSize	= ComputeBlockSize(payloadSize);
+	m_block.PayloadSize	= payloadSize;
+	m_block.PayloadCrc	= Crc32(payload, payloadSize);
+	m_block.Deepness	= deepness;
+	m_block.Nonce		= nonce;
+
+	memcpy(m_block.FileKey, wrappedKey, sizeof(m_block.FileKey));
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CFilFormatHeader::Load(FILFORMAT_HEADER_BLOCK *block, PGPByte const* buffer)
+{
+	assert(block);
+	assert(buffer);
+
+	block->Magic		= Load32(buffer + 0);
+	block->Version		= Load32(buffer + 4);
+	block->Cipher		= Load32(buffer + 8);
+	block->BlockSize	= Load32(buffer + 12);
+	block->PayloadSize	= Load32(buffer + 16);
+	block->PayloadCrc	= Load32(buffer + 20);
+	block->Deepness		= Load32(buffer + 24);
+	block->Reserved		= Load32(buffer + 28);
+	block->Nonce		= Load64(buffer + 32);
+
+	memcpy(block->FileKey, buffer + 40, sizeof(block->FileKey));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CFilFormatHeader::Recover(PGPByte const* buffer)
+{
+	assert(buffer);
+
+	// Same checks as CFilterCipherManager::RecoverHeader. The block size was checked against the buffer
+	PGPUInt32 const shadow = m_block.BlockSize / 2;
+
+	if(!shadow || (shadow % FILFORMAT_SECTOR_SIZE))
+	{
+		return false;
+	}
+
+	FILFORMAT_HEADER_BLOCK copy;
+
+	Load(&copy, buffer + shadow);
+
+	if((copy.Magic != FILFORMAT_MAGIC) ||
+	   (copy.BlockSize != m_block.BlockSize) ||
+	   (copy.Nonce != m_block.Nonce) ||
+	   (FILFORMAT_HEADER_BLOCK_SIZE + copy.PayloadSize > shadow))
+	{
+		return false;
+	}
+
+	if(Crc32(buffer + shadow + FILFORMAT_HEADER_BLOCK_SIZE, copy.PayloadSize) != copy.PayloadCrc)
+	{
+		return false;
+	}
+
+	m_block	  = copy;
+	m_payload = buffer + shadow + FILFORMAT_HEADER_BLOCK_SIZE;
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatHeader::Parse(PGPByte const* buffer, PGPSize bufferSize)
+{
+	assert(buffer);
+
+	Close();
+
+	if(bufferSize < FILFORMAT_HEADER_BLOCK_SIZE)
+	{
+		return kPGPError_CorruptData;
+	}
+
+	Load(&m_block, buffer);
+
+	if(m_block.Magic != FILFORMAT_MAGIC)
+	{
+		return kPGPError_CorruptData;
+	}
+
+	// Header must be complete and leave room for its Payload
+	if((m_block.BlockSize % FILFORMAT_SECTOR_SIZE) ||
+	   (m_block.BlockSize > bufferSize) ||
+	   (m_block.PayloadSize >= m_block.BlockSize - FILFORMAT_HEADER_BLOCK_SIZE))
+	{
+		return kPGPError_CorruptData;
+	}
+
+	m_payload = buffer + FILFORMAT_HEADER_BLOCK_SIZE;
+
+	if((Crc32(m_payload, m_block.PayloadSize) != m_block.PayloadCrc) && !Recover(buffer))
+	{
+		return kPGPError_BadIntegrity;
+	}
+
+	if(!IsAutoConfig())
+	{
+		// Same checks as CFilterCipherManager::RecognizeHeader
+		if(!((m_block.Cipher >> 16) & FILFORMAT_CIPHER_MODE_MASK) || !KeySize())
+		{
+			return kPGPError_CorruptData;
+		}
+	}
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatHeader::Write(PGPByte *buffer, PGPSize bufferSize) const
+{
+	assert(buffer);
+	assert(m_payload);
+
+	// Caller fills the unused Header bytes with random data
+	if(bufferSize < m_block.BlockSize)
+	{
+		return kPGPError_BadParams;
+	}
+
+	Store32(buffer + 0,  m_block.Magic);
+	Store32(buffer + 4,  m_block.Version);
+	Store32(buffer + 8,  m_block.Cipher);
+	Store32(buffer + 12, m_block.BlockSize);
+	Store32(buffer + 16, m_block.PayloadSize);
+	Store32(buffer + 20, m_block.PayloadCrc);
+	Store32(buffer + 24, m_block.Deepness);
+	Store32(buffer + 28, m_block.Reserved);
+	Store64(buffer + 32, m_block.Nonce);
+
+	memcpy(buffer + 40, m_block.FileKey, sizeof(m_block.FileKey));
+	memcpy(buffer + FILFORMAT_HEADER_BLOCK_SIZE, m_payload, m_block.PayloadSize);
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
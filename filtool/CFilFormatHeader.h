@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatHeader.h: interface for the CFilFormatHeader class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilFormatHeader_H__0C8D5E21_6A3F_4B97_B1E4_2F9A07C6D853__INCLUDED_)
+#define AFX_CFilFormatHeader_H__0C8D5E21_6A3F_4B97_B1E4_2F9A07C6D853__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "FilFormat.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilFormatHeader
+{
+	// Parses and builds the Header of encrypted files the same way CFilterCipherManager does.
+	// The Payload is opaque, it is referenced on Parse() and copied on Init(). Parse() falls
+	// back to the copy an interrupted rewrap leaves in the second half of the block.
+
+public:
+
+								CFilFormatHeader();
+								~CFilFormatHeader();
+
+	PGPError					Init(PGPUInt32 cipher, PGPByte const* wrappedKey, PGPUInt64 nonce,
+									 PGPByte const* payload, PGPUInt32 payloadSize, PGPUInt32 deepness = 0);
+	void						Close();
+
+	PGPError					Parse(PGPByte const* buffer, PGPSize bufferSize);
+	PGPError					Write(PGPByte *buffer, PGPSize bufferSize) const;
+
+	bool						IsAutoConfig() const;
+	PGPUInt32					KeySize() const;
+
+	static PGPUInt32			Crc32(PGPByte const* buffer, PGPUInt32 bufferSize);
+	static PGPUInt32			ComputeBlockSize(PGPUInt32 payloadSize);
+
+	static PGPUInt32			Load32(PGPByte const* buffer);
+	static PGPUInt64			Load64(PGPByte const* buffer);
+	static void					Store32(PGPByte *buffer, PGPUInt32 value);
+	static void					Store64(PGPByte *buffer, PGPUInt64 value);
+
+	static PGPUInt32			RewrapLength(PGPUInt32 payloadSize);
+
+								// DATA
+	FILFORMAT_HEADER_BLOCK		m_block;
+
+	PGPByte const*				m_payload;
+	PGPByte*					m_payloadCopy;		// owned, if Init() was used
+
+private:
+
+	static void					Load(FILFORMAT_HEADER_BLOCK *block, PGPByte const* buffer);
+	bool						Recover(PGPByte const* buffer);
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+bool CFilFormatHeader::IsAutoConfig() const
+{
+	return (m_block.Cipher == (PGPUInt32) FILFORMAT_CIPHER_SYM_AUTOCONF);
+}
+
+inline
+PGPUInt32 CFilFormatHeader::ComputeBlockSize(PGPUInt32 payloadSize)
+{
+	return (FILFORMAT_HEADER_BLOCK_SIZE + payloadSize + (FILFORMAT_HEADER_ALIGN - 1)) & ~(FILFORMAT_HEADER_ALIGN - 1);
+}
+
+inline
+PGPUInt32 CFilFormatHeader::RewrapLength(PGPUInt32 payloadSize)
+{
+	// Sectors holding the block and its Payload, as CFilterCipherManager::RewrapHeader rewrites them
+	return (FILFORMAT_HEADER_BLOCK_SIZE + payloadSize + (FILFORMAT_SECTOR_SIZE - 1)) & ~(FILFORMAT_SECTOR_SIZE - 1);
+}
+
+inline
+PGPUInt32 CFilFormatHeader::Load32(PGPByte const* buffer)
+{
+	return (PGPUInt32) buffer[0] | ((PGPUInt32) buffer[1] << 8) | ((PGPUInt32) buffer[2] << 16) | ((PGPUInt32) buffer[3] << 24);
+}
+
+inline
+PGPUInt64 CFilFormatHeader::Load64(PGPByte const* buffer)
+{
+	return (PGPUInt64) Load32(buffer) | ((PGPUInt64) Load32(buffer + 4) << 32);
+}
+
+inline
+void CFilFormatHeader::Store32(PGPByte *buffer, PGPUInt32 value)
+{
+	buffer[0] = (PGPByte) value;
+	buffer[1] = (PGPByte) (value >> 8);
+	buffer[2] = (PGPByte) (value >> 16);
+	buffer[3] = (PGPByte) (value >> 24);
+}
+
+inline
+void CFilFormatHeader::Store64(PGPByte *buffer, PGPUInt64 value)
+{
+	Store32(buffer, (PGPUInt32) value);
+	Store32(buffer + 4, (PGPUInt32) (value >> 32));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilFormatHeader_H__0C8D5E21_6A3F_4B97_B1E4_2F9A07C6D853__INCLUDED_)
@@ -0,0 +1,475 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatIo.cpp: implementation of the CFilFormatIo class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "CFilFormatIo.h"
+
+#if PGP_WIN32
+ #include <wincrypt.h>
+#else
+ #include <sys/types.h>
+ #include <sys/stat.h>
+ #include <sys/mman.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+ #include <errno.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CFilFormatIo::CFilFormatIo()
+{
+	m_data = 0;
+	m_size = 0;
+
+	#if PGP_WIN32
+	 m_file	   = INVALID_HANDLE_VALUE;
+	 m_mapping = 0;
+	#else
+	 m_file	   = -1;
+	#endif
+}
+
+CFilFormatIo::~CFilFormatIo()
+{
+	Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CFilFormatIo::Close()
+{
+	#if PGP_WIN32
+	{
+		if(m_data)
+		{
+			::UnmapViewOfFile(m_data);
+		}
+
+		if(m_mapping)
+		{
+			::CloseHandle(m_mapping);
+		}
+
+		if(m_file != INVALID_HANDLE_VALUE)
+		{
+			::CloseHandle(m_file);
+		}
+
+		m_file	  = INVALID_HANDLE_VALUE;
+		m_mapping = 0;
+	}
+	#else
+	{
+		if(m_data)
+		{
+			munmap(m_data, (size_t) m_size);
+		}
+
+		if(m_file != -1)
+		{
+			close(m_file);
+		}
+
+		m_file = -1;
+	}
+	#endif
+
+	m_data = 0;
+	m_size = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatIo::Map(char const* path, bool writable)
+{
+	assert(path);
+
+	Close();
+
+	#if PGP_WIN32
+	{
+		DWORD const access = (writable) ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+
+		m_file = ::CreateFileA(path, access, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+		if(m_file == INVALID_HANDLE_VALUE)
+		{
+			return kPGPError_CantOpenFile;
+		}
+
+		LARGE_INTEGER size;
+
+		if(!::GetFileSizeEx(m_file, &size))
+		{
+			return kPGPError_FileOpFailed;
+		}
+
+		m_size = size.QuadPart;
+
+		// Empty files cannot be mapped
+		if(m_size)
+		{
+			m_mapping = ::CreateFileMapping(m_file, 0, PAGE_READONLY, 0, 0, 0);
+
+			if(!m_mapping)
+			{
+				return kPGPError_FileOpFailed;
+			}
+
+			m_data = (PGPByte*) ::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+
+			if(!m_data)
+			{
+				return kPGPError_FileOpFailed;
+			}
+		}
+	}
+	#else
+	{
+		m_file = open(path, (writable) ? O_RDWR : O_RDONLY);
+
+		if(m_file == -1)
+		{
+			return (errno == ENOENT) ? kPGPError_FileNotFound : kPGPError_CantOpenFile;
+		}
+
+		struct stat info;
+
+		if(fstat(m_file, &info) || !S_ISREG(info.st_mode))
+		{
+			return kPGPError_FileOpFailed;
+		}
+
+		m_size = (PGPUInt64) info.st_size;
+
+		if(m_size)
+		{
+			void *const data = mmap(0, (size_t) m_size, PROT_READ, MAP_SHARED, m_file, 0);
+
+			if(data == MAP_FAILED)
+			{
+				return kPGPError_FileOpFailed;
+			}
+
+			m_data = (PGPByte*) data;
+
+			// Files are read front to back exactly once
+			madvise(m_data, (size_t) m_size, MADV_SEQUENTIAL);
+		}
+	}
+	#endif
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatIo::Create(char const* path)
+{
+	assert(path);
+
+	Close();
+
+	#if PGP_WIN32
+	 m_file = ::CreateFileA(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+	 if(m_file == INVALID_HANDLE_VALUE)
+	#else
+	 m_file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	 if(m_file == -1)
+	#endif
+	{
+		return kPGPError_CantOpenFile;
+	}
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatIo::Write(PGPByte const* buffer, PGPSize size)
+{
+	assert(buffer);
+
+	while(size)
+	{
+		#if PGP_WIN32
+		 DWORD written = 0;
+
+		 if(!::WriteFile(m_file, buffer, (size > 0x40000000) ? 0x40000000 : (DWORD) size, &written, 0) || !written)
+		 {
+			 return kPGPError_WriteFailed;
+		 }
+		#else
+		 ssize_t const written = write(m_file, buffer, size);
+
+		 if(written <= 0)
+		 {
+			 if((written == -1) && (errno == EINTR))
+			 {
+				 continue;
+			 }
+
+			 return kPGPError_WriteFailed;
+		 }
+		#endif
+
+		buffer += written;
+		size   -= written;
+		m_size += written;
+	}
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatIo::WriteAt(PGPUInt64 offset, PGPByte const* buffer, PGPSize size)
+{
+	assert(buffer);
+
+	// The mapping, if any, sees the written data. The file does not grow
+	if(offset + size > m_size)
+	{
+		return kPGPError_BadParams;
+	}
+
+	while(size)
+	{
+		#if PGP_WIN32
+		 OVERLAPPED position;
+
+		 memset(&position, 0, sizeof(position));
+
+		 position.Offset	 = (DWORD) offset;
+		 position.OffsetHigh = (DWORD) (offset >> 32);
+
+		 DWORD written = 0;
+
+		 if(!::WriteFile(m_file, buffer, (size > 0x40000000) ? 0x40000000 : (DWORD) size, &written, &position) || !written)
+		 {
+			 return kPGPError_WriteFailed;
+		 }
+		#else
+		 ssize_t const written = pwrite(m_file, buffer, size, (off_t) offset);
+
+		 if(written <= 0)
+		 {
+			 if((written == -1) && (errno == EINTR))
+			 {
+				 continue;
+			 }
+
+			 return kPGPError_WriteFailed;
+		 }
+		#endif
+
+		buffer += written;
+		offset += written;
+		size   -= written;
+	}
+
+	return kPGPError_NoErr;
+}
+
+PGPError CFilFormatIo::ReadAt(PGPUInt64 offset, PGPByte *buffer, PGPSize size)
+{
+	assert(buffer);
+
+	if(offset + size > m_size)
+	{
+		return kPGPError_BadParams;
+	}
+
+	while(size)
+	{
+		#if PGP_WIN32
+		 OVERLAPPED position;
+
+		 memset(&position, 0, sizeof(position));
+
+		 position.Offset	 = (DWORD) offset;
+		 position.OffsetHigh = (DWORD) (offset >> 32);
+
+		 DWORD got = 0;
+
+		 if(!::ReadFile(m_file, buffer, (size > 0x40000000) ? 0x40000000 : (DWORD) size, &got, &position) || !got)
+		 {
+			 return kPGPError_ReadFailed;
+		 }
+		#else
+		 ssize_t const got = pread(m_file, buffer, size, (off_t) offset);
+
+		 if(got <= 0)
+		 {
+			 if((got == -1) && (errno == EINTR))
+			 {
+				 continue;
+			 }
+
+			 return kPGPError_ReadFailed;
+		 }
+		#endif
+
+		buffer += got;
+		offset += got;
+		size   -= got;
+	}
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatIo::Flush()
+{
+	// Orders in place updates, data written before is durable afterwards
+	#if PGP_WIN32
+	 if(!::FlushFileBuffers(m_file))
+	#else
+	 if(fsync(m_file))
+	#endif
+	{
+		return kPGPError_WriteFailed;
+	}
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatIo::Randomize(PGPByte *buffer, PGPSize size)
+{
+	assert(buffer);
+
+	#if PGP_WIN32
+	{
+		HCRYPTPROV provider = 0;
+
+		if(!::CryptAcquireContext(&provider, 0, 0, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT | CRYPT_SILENT))
+		{
+			return kPGPError_UnknownError;
+		}
+
+		BOOL const success = ::CryptGenRandom(provider, (DWORD) size, buffer);
+
+		::CryptReleaseContext(provider, 0);
+
+		return (success) ? kPGPError_NoErr : kPGPError_UnknownError;
+	}
+	#else
+	{
+		int const random = open("/dev/urandom", O_RDONLY);
+
+		if(random == -1)
+		{
+			return kPGPError_UnknownError;
+		}
+
+		while(size)
+		{
+			ssize_t const got = read(random, buffer, size);
+
+			if(got <= 0)
+			{
+				if((got == -1) && (errno == EINTR))
+				{
+					continue;
+				}
+
+				close(random);
+
+				return kPGPError_ReadFailed;
+			}
+
+			buffer += got;
+			size   -= got;
+		}
+
+		close(random);
+
+		return kPGPError_NoErr;
+	}
+	#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatIo::CreateParents(char const* path)
+{
+	assert(path);
+
+	size_t const length = strlen(path);
+
+	char *const copy = (char*) malloc(length + 1);
+
+	if(!copy)
+	{
+		return kPGPError_OutOfMemory;
+	}
+
+	memcpy(copy, path, length + 1);
+
+	PGPError err = kPGPError_NoErr;
+
+	// Create each directory component, skip a leading root
+	for(size_t index = 1; index < length; ++index)
+	{
+		if((copy[index] != '/') && (copy[index] != '\\'))
+		{
+			continue;
+		}
+
+		copy[index] = 0;
+
+		#if PGP_WIN32
+		 if(!::CreateDirectoryA(copy, 0) && (::GetLastError() != ERROR_ALREADY_EXISTS))
+		#else
+		 if(mkdir(copy, 0700) && (errno != EEXIST))
+		#endif
+		{
+			err = kPGPError_CantOpenFile;
+			break;
+		}
+
+		copy[index] = path[index];
+	}
+
+	free(copy);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatIo::Replace(char const* source, char const* target)
+{
+	assert(source);
+	assert(target);
+
+	// Atomic on the same volume, target must not be open
+	#if PGP_WIN32
+	 if(!::MoveFileExA(source, target, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	#else
+	 if(rename(source, target))
+	#endif
+	{
+		return kPGPError_FileOpFailed;
+	}
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatIo.h: interface for the CFilFormatIo class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilFormatIo_H__E71C4A08_3B95_4D2F_A6C1_5F08B93D27E6__INCLUDED_)
+#define AFX_CFilFormatIo_H__E71C4A08_3B95_4D2F_A6C1_5F08B93D27E6__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "FilFormat.h"
+
+#if PGP_WIN32
+#include <windows.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilFormatIo
+{
+	// Platform file access: input files are mapped read-only and read sequentially, output files
+	// are written with large sequential writes. Files mapped writable are updated in place with
+	// positional writes. Besides the threads and directory walk of CFilFormatBatch, nothing else
+	// in the library depends on the OS.
+
+public:
+
+								CFilFormatIo();
+								~CFilFormatIo();
+
+	PGPError					Map(char const* path, bool writable = false);
+	PGPError					Create(char const* path);
+	void						Close();
+
+	PGPError					Write(PGPByte const* buffer, PGPSize size);
+	PGPError					WriteAt(PGPUInt64 offset, PGPByte const* buffer, PGPSize size);
+	PGPError					ReadAt(PGPUInt64 offset, PGPByte *buffer, PGPSize size);
+	PGPError					Flush();
+
+	PGPByte const*				Data() const;
+	PGPUInt64					Size() const;
+
+	static PGPError				Randomize(PGPByte *buffer, PGPSize size);
+	static PGPError				CreateParents(char const* path);
+	static PGPError				Replace(char const* source, char const* target);
+
+private:
+
+								// DATA
+	PGPByte*					m_data;
+	PGPUInt64					m_size;
+
+	#if PGP_WIN32
+	 HANDLE						m_file;
+	 HANDLE						m_mapping;
+	#else
+	 int						m_file;
+	#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+PGPByte const* CFilFormatIo::Data() const
+{
+	return m_data;
+}
+
+inline
+PGPUInt64 CFilFormatIo::Size() const
+{
+	return m_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilFormatIo_H__E71C4A08_3B95_4D2F_A6C1_5F08B93D27E6__INCLUDED_)
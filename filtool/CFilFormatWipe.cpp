@@ -0,0 +1,1561 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatWipe.cpp: implementation of the CFilFormatWipe class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <aio.h>
+
+#include "CFilFormatIo.h"
+#include "CFilFormatWipe.h"
+
+extern "C"
+{
+	#include "pgpMemoryMgr.h"
+	#include "pgpSymmetricCipher.h"
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct CFilFormatWipe::Buffer
+{
+	PGPByte*						Data;			// c_bufferSize, page aligned
+	struct aiocb					Request;
+	bool							Busy;			// write in flight
+};
+
+struct CFilFormatWipe::Pass
+{
+	Buffer							Buffers[c_buffers];
+	PGPUInt64						Ranges[2 * c_ranges];	// start and end of allocated ranges
+
+	PGPMemoryMgrRef					Mgr;
+	PGPSymmetricCipherContextRef	Aes;			// keystream of random passes
+	PGPByte							Counter[16];	// low 64 bits count blocks, little endian
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// STATICS ////
+
+// Same as CWipePattern::s_patterns of the driver
+int const CFilFormatWipe::s_patterns[] =
+{
+	// 2 random passes
+	-2,
+	// 1 bit
+	2,  0x000, 0xfff,
+	// 2 bit
+	2,  0x555, 0xaaa,
+	// random pass
+	-1,
+	// 3 bit
+	6,  0x249, 0x492, 0x6DB, 0x924, 0xB6D, 0xDB6,
+	// 4 bit
+	12, 0x111, 0x222, 0x333, 0x444, 0x666, 0x777, 0x888, 0x999, 0xBBB, 0xCCC, 0xDDD, 0xEEE,
+	// The following patterns have the first bit per block flipped
+	8,  0x1000, 0x1249, 0x1492, 0x16DB, 0x1924, 0x1B6D, 0x1DB6, 0x1FFF,
+	14, 0x1111, 0x1222, 0x1333, 0x1444, 0x1555, 0x1666, 0x1777, 0x1888, 0x1999, 0x1AAA, 0x1BBB, 0x1CCC, 0x1DDD, 0x1EEE,
+	// random pass
+	-1,
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CFilFormatWipe::CFilFormatWipe()
+{
+	memset(m_patterns, 0, sizeof(m_patterns));
+
+	m_patternsCount = 0;
+	m_flags			= 0;
+
+	m_queue			= 0;
+	m_queueTail		= &m_queue;
+	m_failed		= 0;
+	m_stop			= false;
+	m_running		= false;
+
+	pthread_mutex_init(&m_lock, 0);
+	pthread_cond_init(&m_queued, 0);
+}
+
+CFilFormatWipe::~CFilFormatWipe()
+{
+	Close();
+
+	pthread_cond_destroy(&m_queued);
+	pthread_mutex_destroy(&m_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::Init(int const* patterns, PGPUInt32 patternsCount, PGPUInt32 flags)
+{
+	Close();
+
+	if(!patternsCount || (patternsCount > c_patternsMax))
+	{
+		return kPGPError_BadParams;
+	}
+
+	if(patterns)
+	{
+		for(PGPUInt32 index = 0; index < patternsCount; ++index)
+		{
+			// random, or 12 bits plus the flip bit
+			if((patterns[index] < c_random) || (patterns[index] > 0x1fff))
+			{
+				return kPGPError_BadParams;
+			}
+
+			m_patterns[index] = patterns[index];
+		}
+	}
+	else
+	{
+		PGPByte random[c_patternsMax];
+
+		PGPError const err = CFilFormatIo::Randomize(random, sizeof(random));
+
+		if(IsPGPError(err))
+		{
+			return err;
+		}
+
+		patternsCount = Generate(m_patterns, patternsCount, random);
+	}
+
+	m_patternsCount = patternsCount;
+	m_flags			= flags;
+
+	return kPGPError_NoErr;
+}
+
+void CFilFormatWipe::Close()
+{
+	WorkerStop();
+
+	// Not wiped, files stay hidden for Recover
+	while(m_queue)
+	{
+		Item *const item = m_queue;
+		m_queue = item->Next;
+
+		free(item);
+	}
+
+	m_queueTail = &m_queue;
+
+	memset(m_patterns, 0, sizeof(m_patterns));
+	m_patternsCount = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CFilFormatWipe::Fill(int pattern, PGPByte *target, PGPUInt32 targetSize)
+{
+	// target buffer must be at least 3 bytes long
+	if(!target || (targetSize < 3))
+	{
+		return false;
+	}
+	// reject the random pattern - as it's handled elsewhere
+	if(pattern < 0)
+	{
+		return false;
+	}
+
+	if(!pattern)
+	{
+		memset(target, 0, targetSize);
+	}
+	else
+	{
+		PGPUInt32 bits = pattern & 0xfff;
+		bits		  |= bits << 12;
+
+		// set first 3 values manually
+		target[0] = (PGPByte) ((bits >> 4) & 0xff);
+		target[1] = (PGPByte) ((bits >> 8) & 0xff);
+		target[2] = (PGPByte) (bits & 0xff);
+
+		PGPUInt32 index;
+
+		// double copied size in each run
+		for(index = 3; index < targetSize / 2; index *= 2)
+		{
+			memcpy(target + index, target, index);
+		}
+
+		// bytes left ?
+		if(index < targetSize)
+		{
+			memcpy(target + index, target, targetSize - index);
+		}
+
+		// invert the first bit of every 512 byte block, if selected
+		if(pattern & 0x1000)
+		{
+			for(index = 0; index < targetSize; index += 512)
+			{
+				target[index] ^= 0x80;
+			}
+		}
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPUInt32 CFilFormatWipe::Generate(int *patterns, PGPUInt32 patternsCount, PGPByte const* random)
+{
+	PGPUInt32 const tableSize = sizeof(s_patterns) / sizeof(s_patterns[0]);
+
+	if(!patterns || !patternsCount)
+	{
+		return 0;
+	}
+
+	// ensure bounds
+	if(patternsCount > c_patternsMax)
+	{
+		patternsCount = c_patternsMax;
+	}
+
+	// initialize with the random pattern
+	for(PGPUInt32 index = 0; index < patternsCount; ++index)
+	{
+		patterns[index] = c_random;
+	}
+
+	PGPUInt32 index  = 0;
+	int		  passes = (int) patternsCount;
+	int*	  target = patterns;
+
+	do
+	{
+		// wrapped ?
+		if(index >= tableSize)
+		{
+			index = 0;
+		}
+
+		int const pattern = s_patterns[index];
+
+		index++;
+
+		if(pattern < 0)
+		{
+			// random passes
+			target += -pattern;
+			passes -= -pattern;
+		}
+		else
+		{
+			// use as much as fit
+			int count = (pattern > passes) ? passes : pattern;
+
+			passes -= count;
+
+			while(count)
+			{
+				assert(target < patterns + patternsCount);
+				assert(index < tableSize);
+
+				*target++ = s_patterns[index];
+				index++;
+
+				count--;
+			}
+		}
+	}
+	while(passes > 0);
+
+	if(patternsCount > 2)
+	{
+		if(random)
+		{
+			// shuffle selected patterns
+			for(PGPUInt32 index = 2; index < patternsCount; ++index)
+			{
+				PGPUInt32 const dest = random[index - 2] % patternsCount;
+
+				if(dest > 1)
+				{
+					int const temp	= patterns[index];
+					patterns[index]	= patterns[dest];
+					patterns[dest]	= temp;
+				}
+			}
+		}
+
+		// ensure random pattern at start and end
+		if((patterns[patternsCount - 1] >= 0) && (patterns[1] < 0))
+		{
+			patterns[1]					= patterns[patternsCount - 1];
+			patterns[patternsCount - 1] = c_random;
+		}
+	}
+
+	return patternsCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::WipeFile(char const* path, PGPUInt64 *written)
+{
+	return Wipe(path, m_flags, written);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::Wipe(char const* path, PGPUInt32 flags, PGPUInt64 *written)
+{
+	if(!path || !m_patternsCount)
+	{
+		return kPGPError_BadParams;
+	}
+
+	PGPUInt64 bytes = 0;
+
+	if(written)
+	{
+		*written = 0;
+	}
+
+	int const file = open(path, O_WRONLY);
+
+	if(file < 0)
+	{
+		return (ENOENT == errno) ? kPGPError_FileNotFound : kPGPError_CantOpenFile;
+	}
+
+	struct stat status;
+
+	if(fstat(file, &status) || !S_ISREG(status.st_mode))
+	{
+		close(file);
+
+		return kPGPError_CantOpenFile;
+	}
+
+	PGPUInt64 const eof = status.st_size;
+
+	// fewer blocks than the size needs?
+	bool const sparse = (PGPUInt64) status.st_blocks * 512 < eof;
+
+	PGPError err = kPGPError_NoErr;
+
+	if(eof)
+	{
+		Pass *const pass = (Pass*) calloc(1, sizeof(Pass));
+
+		if(!pass)
+		{
+			err = kPGPError_OutOfMemory;
+		}
+
+		for(PGPUInt32 index = 0; IsntPGPError(err) && (index < c_buffers); ++index)
+		{
+			void *data = 0;
+
+			if(posix_memalign(&data, 4096, c_bufferSize))
+			{
+				err = kPGPError_OutOfMemory;
+				break;
+			}
+
+			pass->Buffers[index].Data = (PGPByte*) data;
+		}
+
+		if(IsntPGPError(err))
+		{
+			err = PGPNewMemoryMgrPosix(malloc, free, realloc, &pass->Mgr);
+		}
+
+		if(IsntPGPError(err))
+		{
+			err = PGPNewSymmetricCipherContext(pass->Mgr, kPGPCipherAlgorithm_AES128, &pass->Aes);
+		}
+
+		if(IsntPGPError(err))
+		{
+			// fresh key and counter per wipe
+			PGPByte seed[16 + sizeof(pass->Counter)];
+
+			err = CFilFormatIo::Randomize(seed, sizeof(seed));
+
+			if(IsntPGPError(err))
+			{
+				memcpy(pass->Counter, seed + 16, sizeof(pass->Counter));
+
+				err = PGPInitSymmetricCipher(pass->Aes, seed);
+			}
+
+			// be paranoid
+			memset(seed, 0, sizeof(seed));
+		}
+
+		for(PGPUInt32 index = 0; IsntPGPError(err) && (index < m_patternsCount); ++index)
+		{
+			err = WipePass(file, pass, m_patterns[index], eof, sparse, &bytes);
+
+			// on the device before the next pass
+			if(IsntPGPError(err) && fdatasync(file))
+			{
+				err = kPGPError_WriteFailed;
+			}
+		}
+
+		if(pass)
+		{
+			if(pass->Aes)
+			{
+				PGPFreeSymmetricCipherContext(pass->Aes);
+			}
+
+			if(pass->Mgr)
+			{
+				PGPFreeMemoryMgr(pass->Mgr);
+			}
+
+			for(PGPUInt32 index = 0; index < c_buffers; ++index)
+			{
+				free(pass->Buffers[index].Data);
+			}
+
+			// be paranoid
+			memset(pass, 0, sizeof(Pass));
+
+			free(pass);
+		}
+	}
+
+	if(IsntPGPError(err))
+	{
+		err = WipePost(file, path, flags);
+	}
+
+	close(file);
+
+	if(written)
+	{
+		*written = bytes;
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::WipePass(int file, Pass *pass, int pattern, PGPUInt64 eof, bool sparse, PGPUInt64 *written)
+{
+	assert(file >= 0);
+	assert(pass);
+	assert(eof);
+	assert(written);
+
+	if(pattern >= 0)
+	{
+		// value patterns fill the buffers once per pass
+		for(PGPUInt32 index = 0; index < c_buffers; ++index)
+		{
+			Fill(pattern, pass->Buffers[index].Data, c_bufferSize);
+		}
+	}
+
+	PGPError err = kPGPError_NoErr;
+
+	PGPUInt64 offset	 = 0;
+	PGPUInt64 rangeEnd	 = (sparse) ? 0 : eof;
+	PGPUInt32 rangesCount = 0;
+	PGPUInt32 rangesIndex = 0;
+	PGPUInt32 slot		 = 0;
+
+	while(offset < eof)
+	{
+		if(offset >= rangeEnd)
+		{
+			// next allocated range, holes are skipped
+			if(rangesIndex >= rangesCount)
+			{
+				rangesCount = c_ranges;
+				rangesIndex = 0;
+
+				if(IsPGPError(QueryRanges(file, offset, eof, pass->Ranges, &rangesCount)))
+				{
+					// wipe all instead
+					pass->Ranges[0] = offset;
+					pass->Ranges[1] = eof;
+
+					rangesCount = 1;
+				}
+
+				if(!rangesCount)
+				{
+					break;
+				}
+			}
+
+			// on sector boundaries, as the driver does
+			PGPUInt64 start = pass->Ranges[2 * rangesIndex] & ~((PGPUInt64) c_sectorSize - 1);
+			PGPUInt64 end	= (pass->Ranges[2 * rangesIndex + 1] + c_sectorSize - 1) & ~((PGPUInt64) c_sectorSize - 1);
+
+			rangesIndex++;
+
+			if(start < offset)
+			{
+				start = offset;
+			}
+
+			if(end > eof)
+			{
+				end = eof;
+			}
+
+			if(end > start)
+			{
+				offset	 = start;
+				rangeEnd = end;
+			}
+
+			continue;
+		}
+
+		Buffer *const buffer = &pass->Buffers[slot];
+
+		slot = (slot + 1) % c_buffers;
+
+		// reuse the oldest buffer once its write is done
+		err = Wait(buffer);
+
+		if(IsPGPError(err))
+		{
+			break;
+		}
+
+		PGPUInt32 const length = (rangeEnd - offset > c_bufferSize) ? (PGPUInt32) c_bufferSize : (PGPUInt32) (rangeEnd - offset);
+
+		if(pattern < 0)
+		{
+			err = Keystream(pass, buffer->Data, length);
+
+			if(IsPGPError(err))
+			{
+				break;
+			}
+		}
+
+		err = Write(file, buffer, offset, length);
+
+		if(IsPGPError(err))
+		{
+			break;
+		}
+
+		offset	 += length;
+		*written += length;
+	}
+
+	// drain, even on errors
+	for(PGPUInt32 index = 0; index < c_buffers; ++index)
+	{
+		PGPError const wait = Wait(&pass->Buffers[index]);
+
+		if(IsntPGPError(err))
+		{
+			err = wait;
+		}
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::WipePost(int file, char const* path, PGPUInt32 flags)
+{
+	assert(file >= 0);
+	assert(path);
+
+	PGPError err = kPGPError_NoErr;
+
+	char *current = 0;
+
+	if(flags & WIPE_RENAME)
+	{
+		char const* name = strrchr(path, '/');
+		int const directory = (name) ? (int) (name - path + 1) : 0;
+
+		current = (char*) malloc(directory + 16);
+
+		if(!current)
+		{
+			return kPGPError_OutOfMemory;
+		}
+
+		err = kPGPError_FileOpFailed;
+
+		// as the driver: try some generic names, never replace an existing file
+		for(int index = 0; index < 16; ++index)
+		{
+			sprintf(current, "%.*swiped%02d", directory, path, index);
+
+			if(!link(path, current))
+			{
+				unlink(path);
+
+				err = kPGPError_NoErr;
+				break;
+			}
+
+			if(EEXIST != errno)
+			{
+				break;
+			}
+		}
+
+		if(IsPGPError(err))
+		{
+			free(current);
+			current = 0;
+		}
+	}
+
+	if((flags & WIPE_TRUNCATE) && ftruncate(file, 0))
+	{
+		if(IsntPGPError(err))
+		{
+			err = kPGPError_FileOpFailed;
+		}
+	}
+
+	if((flags & WIPE_DELETE) && unlink((current) ? current : path))
+	{
+		if(IsntPGPError(err))
+		{
+			err = kPGPError_FileOpFailed;
+		}
+	}
+
+	free(current);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::Write(int file, Buffer *buffer, PGPUInt64 offset, PGPUInt32 length)
+{
+	assert(buffer);
+	assert(!buffer->Busy);
+
+	memset(&buffer->Request, 0, sizeof(buffer->Request));
+
+	buffer->Request.aio_fildes = file;
+	buffer->Request.aio_buf	   = buffer->Data;
+	buffer->Request.aio_nbytes = length;
+	buffer->Request.aio_offset = (off_t) offset;
+
+	if(aio_write(&buffer->Request))
+	{
+		return kPGPError_WriteFailed;
+	}
+
+	buffer->Busy = true;
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::Wait(Buffer *buffer)
+{
+	assert(buffer);
+
+	if(!buffer->Busy)
+	{
+		return kPGPError_NoErr;
+	}
+
+	struct aiocb const* list[1] = { &buffer->Request };
+
+	int status;
+
+	while(EINPROGRESS == (status = aio_error(&buffer->Request)))
+	{
+		aio_suspend(list, 1, 0);
+	}
+
+	buffer->Busy = false;
+
+	ssize_t const done = aio_return(&buffer->Request);
+
+	if(status || (done != (ssize_t) buffer->Request.aio_nbytes))
+	{
+		return (ENOSPC == status) ? kPGPError_DiskFull : kPGPError_WriteFailed;
+	}
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::QueryRanges(int file, PGPUInt64 offset, PGPUInt64 eof, PGPUInt64 *ranges, PGPUInt32 *rangesCount)
+{
+	assert(ranges);
+	assert(rangesCount);
+
+	#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	 PGPUInt32 count = 0;
+
+	 while((count < *rangesCount) && (offset < eof))
+	 {
+		off_t const data = lseek(file, (off_t) offset, SEEK_DATA);
+
+		if(data < 0)
+		{
+			// no more data
+			if(ENXIO == errno)
+			{
+				break;
+			}
+
+			return kPGPError_FileOpFailed;
+		}
+
+		if((PGPUInt64) data >= eof)
+		{
+			break;
+		}
+
+		off_t const hole = lseek(file, data, SEEK_HOLE);
+
+		if(hole < 0)
+		{
+			return kPGPError_FileOpFailed;
+		}
+
+		ranges[2 * count]	  = data;
+		ranges[2 * count + 1] = ((PGPUInt64) hole > eof) ? eof : hole;
+
+		offset = ranges[2 * count + 1];
+		count++;
+	 }
+
+	 *rangesCount = count;
+
+	 return kPGPError_NoErr;
+	#else
+	 (void) file;
+	 (void) offset;
+	 (void) eof;
+
+	 return kPGPError_FeatureNotAvailable;
+	#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::Keystream(Pass *pass, PGPByte *buffer, PGPUInt32 length)
+{
+	assert(pass);
+	assert(pass->Aes);
+	assert(buffer);
+
+	for(PGPUInt32 index = 0; index < length; index += sizeof(pass->Counter))
+	{
+		PGPByte block[sizeof(pass->Counter)];
+
+		PGPError const err = PGPSymmetricCipherEncrypt(pass->Aes, pass->Counter, block);
+
+		if(IsPGPError(err))
+		{
+			return err;
+		}
+
+		PGPUInt32 const size = (length - index < sizeof(block)) ? length - index : sizeof(block);
+
+		memcpy(buffer + index, block, size);
+
+		// next block, carry within the low 64 bits
+		for(PGPUInt32 pos = 0; (pos < 8) && !++pass->Counter[pos]; ++pos)
+		{
+			;
+		}
+	}
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::Defer(char const* path)
+{
+	if(!path)
+	{
+		return kPGPError_BadParams;
+	}
+
+	// Without worker, caller wipes synchronously
+	if(!m_running)
+	{
+		return kPGPError_ImproperInitialization;
+	}
+
+	char *const hidden = Hide(path);
+
+	if(!hidden)
+	{
+		return kPGPError_FileOpFailed;
+	}
+
+	// If queuing fails, the file is still found by Recover
+	PGPError const err = Enqueue(hidden);
+
+	free(hidden);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::Recover(char const* directory)
+{
+	if(!directory)
+	{
+		return kPGPError_BadParams;
+	}
+
+	DIR *const dir = opendir(directory);
+
+	if(!dir)
+	{
+		return (ENOENT == errno) ? kPGPError_FileNotFound : kPGPError_CantOpenFile;
+	}
+
+	PGPError err = kPGPError_NoErr;
+
+	while(IsntPGPError(err))
+	{
+		struct dirent const* entry = readdir(dir);
+
+		if(!entry)
+		{
+			break;
+		}
+
+		if(!IsHidden(entry->d_name))
+		{
+			continue;
+		}
+
+		size_t const length = strlen(directory);
+		char *const path	= (char*) malloc(length + strlen(entry->d_name) + 2);
+
+		if(!path)
+		{
+			err = kPGPError_OutOfMemory;
+			break;
+		}
+
+		sprintf(path, "%s%s%s", directory, (length && ('/' != directory[length - 1])) ? "/" : "", entry->d_name);
+
+		err = Enqueue(path);
+
+		free(path);
+	}
+
+	closedir(dir);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::Enqueue(char const* path)
+{
+	assert(path);
+
+	size_t const length = strlen(path);
+
+	Item *const item = (Item*) malloc(sizeof(Item) + length);
+
+	if(!item)
+	{
+		return kPGPError_OutOfMemory;
+	}
+
+	item->Next = 0;
+	memcpy(item->Path, path, length + 1);
+
+	pthread_mutex_lock(&m_lock);
+
+	*m_queueTail = item;
+	m_queueTail	 = &item->Next;
+
+	pthread_cond_signal(&m_queued);
+	pthread_mutex_unlock(&m_lock);
+
+	return kPGPError_NoErr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+char* CFilFormatWipe::Hide(char const* path)
+{
+	assert(path);
+
+	char const* name = strrchr(path, '/');
+	int const directory = (name) ? (int) (name - path + 1) : 0;
+
+	char *const hidden = (char*) malloc(directory + 16);
+
+	if(!hidden)
+	{
+		return 0;
+	}
+
+	for(int tries = 0; tries < 16; ++tries)
+	{
+		PGPUInt32 random = 0;
+
+		if(IsPGPError(CFilFormatIo::Randomize((PGPByte*) &random, sizeof(random))))
+		{
+			break;
+		}
+
+		sprintf(hidden, "%.*s~wipe%08x", directory, path, (unsigned int) random);
+
+		// never replace an existing file
+		if(!link(path, hidden))
+		{
+			unlink(path);
+
+			return hidden;
+		}
+
+		if(EEXIST != errno)
+		{
+			break;
+		}
+	}
+
+	free(hidden);
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CFilFormatWipe::IsHidden(char const* name)
+{
+	assert(name);
+
+	if(strncmp(name, "~wipe", 5) || (strlen(name) != 5 + 8))
+	{
+		return false;
+	}
+
+	for(int index = 5; index < 5 + 8; ++index)
+	{
+		if(!strchr("0123456789abcdef", name[index]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PGPError CFilFormatWipe::WorkerStart()
+{
+	if(m_running)
+	{
+		return kPGPError_NoErr;
+	}
+
+	if(!m_patternsCount)
+	{
+		return kPGPError_ImproperInitialization;
+	}
+
+	m_stop = false;
+
+	if(pthread_create(&m_worker, 0, Worker, this))
+	{
+		return kPGPError_OutOfMemory;
+	}
+
+	m_running = true;
+
+	return kPGPError_NoErr;
+}
+
+void CFilFormatWipe::WorkerStop()
+{
+	if(!m_running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&m_lock);
+
+	m_stop = true;
+
+	pthread_cond_signal(&m_queued);
+	pthread_mutex_unlock(&m_lock);
+
+	pthread_join(m_worker, 0);
+
+	m_running = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void* CFilFormatWipe::Worker(void *context)
+{
+	assert(context);
+
+	((CFilFormatWipe*) context)->Work();
+
+	return 0;
+}
+
+void CFilFormatWipe::Work()
+{
+	for(;;)
+	{
+		pthread_mutex_lock(&m_lock);
+
+		while(!m_queue && !m_stop)
+		{
+			pthread_cond_wait(&m_queued, &m_lock);
+		}
+
+		// Finish queued files before leaving
+		Item *const item = m_queue;
+
+		if(item)
+		{
+			m_queue = item->Next;
+
+			if(!m_queue)
+			{
+				m_queueTail = &m_queue;
+			}
+		}
+
+		pthread_mutex_unlock(&m_lock);
+
+		if(!item)
+		{
+			break;
+		}
+
+		// Deferred files are always deleted
+		PGPError const err = Wipe(item->Path, m_flags | WIPE_DELETE, 0);
+
+		// Gone meanwhile is fine, others stay hidden for the next Recover
+		if(IsPGPError(err) && (kPGPError_FileNotFound != err))
+		{
+			pthread_mutex_lock(&m_lock);
+			m_failed++;
+			pthread_mutex_unlock(&m_lock);
+		}
+
+		free(item);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include "CFilFormatBatch.h"
+
+/*
+ * Pattern fills, pattern sets, wipes of plain and sparse files, removal and the background queue.
+ * Run in a scratch directory. Given a size in MB, also reports the throughput per pattern set.
+ */
+static PGPByte* Load(char const* path, PGPUInt64 size)
+{
+	PGPByte *const data = (PGPByte*) malloc((size_t) size + 1);
+
+	FILE *const stream = fopen(path, "rb");
+
+	if(!data || !stream || (fread(data, 1, (size_t) size, stream) != size))
+	{
+		free(data);
+
+		if(stream)
+		{
+			fclose(stream);
+		}
+
+		return 0;
+	}
+
+	fclose(stream);
+
+	return data;
+}
+
+static bool Create(char const* path, PGPUInt64 size, PGPUInt64 hole)
+{
+	FILE *const stream = fopen(path, "wb");
+
+	if(!stream)
+	{
+		return false;
+	}
+
+	// data, then an optional hole, then data again
+	for(PGPUInt64 index = 0; index < size; ++index)
+	{
+		if(hole && (index == size / 4))
+		{
+			fseek(stream, (long) hole, SEEK_CUR);
+			index += hole - 1;
+			continue;
+		}
+
+		fputc((int) (index * 7 + 1) & 0xff, stream);
+	}
+
+	fclose(stream);
+
+	return true;
+}
+
+static bool Exists(char const* path)
+{
+	struct stat status;
+
+	return !stat(path, &status);
+}
+
+static int FillTest()
+{
+	int failed = 0;
+
+	PGPByte buffer[2048];
+
+	// 2 bit pattern is a single repeated byte
+	CFilFormatWipe::Fill(0x555, buffer, sizeof(buffer));
+
+	for(PGPUInt32 index = 0; index < sizeof(buffer); ++index)
+	{
+		if(0x55 != buffer[index])
+		{
+			printf("ERROR ON Fill(0x555) at %u\n", index);
+			failed++;
+			break;
+		}
+	}
+
+	// 3 bit patterns repeat every 3 bytes
+	static PGPByte const triple[3] = { 0x24, 0x92, 0x49 };
+
+	CFilFormatWipe::Fill(0x249, buffer, sizeof(buffer) - 1);
+
+	for(PGPUInt32 index = 0; index < sizeof(buffer) - 1; ++index)
+	{
+		if(triple[index % 3] != buffer[index])
+		{
+			printf("ERROR ON Fill(0x249) at %u\n", index);
+			failed++;
+			break;
+		}
+	}
+
+	// flip bit on each 512 byte block
+	CFilFormatWipe::Fill(0x1000, buffer, sizeof(buffer));
+
+	for(PGPUInt32 index = 0; index < sizeof(buffer); ++index)
+	{
+		if(buffer[index] != ((index % 512) ? 0 : 0x80))
+		{
+			printf("ERROR ON Fill(0x1000) at %u\n", index);
+			failed++;
+			break;
+		}
+	}
+
+	if(CFilFormatWipe::Fill(CFilFormatWipe::c_random, buffer, sizeof(buffer)) || CFilFormatWipe::Fill(0x555, buffer, 2))
+	{
+		printf("ERROR ON Fill: random or small buffer accepted\n");
+		failed++;
+	}
+
+	return failed;
+}
+
+static int GenerateTest()
+{
+	int failed = 0;
+
+	PGPByte random[CFilFormatWipe::c_patternsMax];
+
+	for(PGPUInt32 index = 0; index < sizeof(random); ++index)
+	{
+		random[index] = (PGPByte) (index * 37 + 11);
+	}
+
+	static PGPUInt32 const counts[] = { 1, 3, 7, 35, 50 };
+
+	for(PGPUInt32 test = 0; test < sizeof(counts) / sizeof(counts[0]); ++test)
+	{
+		int patterns[CFilFormatWipe::c_patternsMax];
+
+		PGPUInt32 const count = CFilFormatWipe::Generate(patterns, counts[test], random);
+
+		if(count != counts[test])
+		{
+			printf("ERROR ON Generate(%u): count %u\n", counts[test], count);
+			failed++;
+			continue;
+		}
+
+		// random passes at start and end, each value pattern once
+		bool ok = (patterns[0] < 0) && (patterns[count - 1] < 0);
+
+		for(PGPUInt32 index = 0; ok && (index < count); ++index)
+		{
+			if(patterns[index] > 0x1fff)
+			{
+				ok = false;
+			}
+
+			for(PGPUInt32 other = index + 1; ok && (other < count); ++other)
+			{
+				if((patterns[index] >= 0) && (patterns[index] == patterns[other]))
+				{
+					ok = false;
+				}
+			}
+		}
+
+		if(!ok)
+		{
+			printf("ERROR ON Generate(%u): bad pattern set\n", count);
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+static int WipeTest()
+{
+	int failed = 0;
+
+	PGPUInt64 const size = 3 * CFilFormatWipe::c_bufferSize + 1000;
+
+	// last pattern is what is left
+	static int const patterns[] = { CFilFormatWipe::c_random, 0x249 };
+
+	CFilFormatWipe wipe;
+
+	if(IsPGPError(wipe.Init(patterns, 2, 0)))
+	{
+		printf("ERROR ON Init\n");
+		return 1;
+	}
+
+	PGPUInt64 written = 0;
+
+	if(!Create("plain.tmp", size, 0) || IsPGPError(wipe.WipeFile("plain.tmp", &written)) || (written != 2 * size))
+	{
+		printf("ERROR ON WipeFile(plain.tmp)\n");
+		return 1;
+	}
+
+	PGPByte *data = Load("plain.tmp", size);
+
+	PGPByte expected[3 * 512];
+	CFilFormatWipe::Fill(0x249, expected, sizeof(expected));
+
+	for(PGPUInt64 index = 0; data && (index < size); index += 512)
+	{
+		PGPUInt32 const length = (size - index < 512) ? (PGPUInt32) (size - index) : 512;
+
+		// each buffer starts the pattern anew
+		if(memcmp(data + index, expected + (index % CFilFormatWipe::c_bufferSize) % 3, length))
+		{
+			printf("ERROR ON WipeFile: pattern at 0x%llx\n", (unsigned long long) index);
+			failed++;
+			break;
+		}
+	}
+
+	free(data);
+
+	// random passes differ between wipes and from the data
+	static int const random[] = { CFilFormatWipe::c_random };
+
+	wipe.Init(random, 1, 0);
+
+	Create("one.tmp", size, 0);
+	Create("two.tmp", size, 0);
+
+	PGPByte *const original = Load("one.tmp", size);
+
+	if(IsPGPError(wipe.WipeFile("one.tmp")) || IsPGPError(wipe.WipeFile("two.tmp")))
+	{
+		printf("ERROR ON WipeFile(random)\n");
+		failed++;
+	}
+
+	PGPByte *const one = Load("one.tmp", size);
+	PGPByte *const two = Load("two.tmp", size);
+
+	if(!original || !one || !two || !memcmp(one, two, (size_t) size) || !memcmp(one, original, (size_t) size))
+	{
+		printf("ERROR ON WipeFile: random passes\n");
+		failed++;
+	}
+
+	free(original);
+	free(one);
+	free(two);
+
+	unlink("plain.tmp");
+	unlink("one.tmp");
+	unlink("two.tmp");
+
+	return failed;
+}
+
+static int SparseTest()
+{
+	int failed = 0;
+
+	PGPUInt64 const size = 8 * CFilFormatWipe::c_bufferSize;
+	PGPUInt64 const hole = 4 * CFilFormatWipe::c_bufferSize;
+
+	if(!Create("sparse.tmp", size, hole))
+	{
+		printf("ERROR ON Create(sparse.tmp)\n");
+		return 1;
+	}
+
+	struct stat before;
+	stat("sparse.tmp", &before);
+
+	// File system without holes?
+	if((PGPUInt64) before.st_blocks * 512 >= size)
+	{
+		printf("sparse files not supported here, skipped\n");
+		unlink("sparse.tmp");
+		return 0;
+	}
+
+	static int const patterns[] = { 0x555 };
+
+	CFilFormatWipe wipe;
+	wipe.Init(patterns, 1, 0);
+
+	PGPUInt64 written = 0;
+
+	if(IsPGPError(wipe.WipeFile("sparse.tmp", &written)) || (written >= size) || (written < size - hole))
+	{
+		printf("ERROR ON WipeFile(sparse.tmp): %llu bytes written\n", (unsigned long long) written);
+		failed++;
+	}
+
+	struct stat after;
+	stat("sparse.tmp", &after);
+
+	if(after.st_blocks > before.st_blocks)
+	{
+		printf("ERROR ON WipeFile(sparse.tmp): holes filled\n");
+		failed++;
+	}
+
+	// data ranges overwritten, holes still read as zeros
+	PGPByte *const data = Load("sparse.tmp", size);
+
+	for(PGPUInt64 index = 0; data && (index < size); ++index)
+	{
+		bool const inHole = (index >= size / 4) && (index < size / 4 + hole);
+
+		if(!inHole && (0x55 != data[index]))
+		{
+			printf("ERROR ON WipeFile(sparse.tmp): data at 0x%llx\n", (unsigned long long) index);
+			failed++;
+			break;
+		}
+
+		if(inHole && data[index] && (0x55 != data[index]))
+		{
+			printf("ERROR ON WipeFile(sparse.tmp): hole at 0x%llx\n", (unsigned long long) index);
+			failed++;
+			break;
+		}
+	}
+
+	free(data);
+	unlink("sparse.tmp");
+
+	return failed;
+}
+
+static int RemoveTest()
+{
+	int failed = 0;
+
+	static int const patterns[] = { 0, CFilFormatWipe::c_random };
+
+	CFilFormatWipe wipe;
+	wipe.Init(patterns, 2, CFilFormatWipe::WIPE_RENAME | CFilFormatWipe::WIPE_TRUNCATE | CFilFormatWipe::WIPE_DELETE);
+
+	// name taken by another file is skipped, not replaced
+	Create("wiped00", 10, 0);
+	Create("gone.tmp", 5000, 0);
+
+	if(IsPGPError(wipe.WipeFile("gone.tmp")) || Exists("gone.tmp") || Exists("wiped01") || !Exists("wiped00"))
+	{
+		printf("ERROR ON WipeFile(gone.tmp): not removed\n");
+		failed++;
+	}
+
+	unlink("wiped00");
+
+	// directories and missing files are rejected
+	if((kPGPError_CantOpenFile != wipe.WipeFile(".")) || (kPGPError_FileNotFound != wipe.WipeFile("missing.tmp")))
+	{
+		printf("ERROR ON WipeFile: directory or missing file accepted\n");
+		failed++;
+	}
+
+	return failed;
+}
+
+static int DeferTest()
+{
+	int failed = 0;
+
+	static int const patterns[] = { CFilFormatWipe::c_random };
+
+	// left over from a crash, found by Recover
+	Create("~wipe0badf00d", 3000, 0);
+	Create("~wipe-not-ours", 10, 0);
+
+	Create("deferred1.tmp", 2 * CFilFormatWipe::c_bufferSize, 0);
+	Create("deferred2.tmp", 100, 0);
+
+	CFilFormatWipe wipe;
+	wipe.Init(patterns, 1, 0);
+
+	if(kPGPError_ImproperInitialization != wipe.Defer("deferred1.tmp"))
+	{
+		printf("ERROR ON Defer: accepted without worker\n");
+		failed++;
+	}
+
+	if(IsPGPError(wipe.WorkerStart()) ||
+	   IsPGPError(wipe.Defer("deferred1.tmp")) ||
+	   IsPGPError(wipe.Defer("deferred2.tmp")) ||
+	   IsPGPError(wipe.Recover(".")))
+	{
+		printf("ERROR ON Defer\n");
+		failed++;
+	}
+
+	// hidden at once
+	if(Exists("deferred1.tmp") || Exists("deferred2.tmp"))
+	{
+		printf("ERROR ON Defer: not hidden\n");
+		failed++;
+	}
+
+	wipe.WorkerStop();
+
+	DIR *const dir = opendir(".");
+
+	for(struct dirent const* entry = readdir(dir); entry; entry = readdir(dir))
+	{
+		if(!strncmp(entry->d_name, "~wipe0", 5) && strcmp(entry->d_name, "~wipe-not-ours"))
+		{
+			printf("ERROR ON Defer: %s left\n", entry->d_name);
+			failed++;
+		}
+	}
+
+	closedir(dir);
+
+	if(!Exists("~wipe-not-ours") || wipe.Failed())
+	{
+		printf("ERROR ON Recover: %u failed\n", wipe.Failed());
+		failed++;
+	}
+
+	unlink("~wipe-not-ours");
+
+	return failed;
+}
+
+static void Benchmark(PGPUInt64 size)
+{
+	static PGPUInt32 const sets[] = { 1, 3, 7, 35 };
+
+	Create("bench.tmp", size, 0);
+
+	for(PGPUInt32 set = 0; set < sizeof(sets) / sizeof(sets[0]); ++set)
+	{
+		CFilFormatWipe wipe;
+
+		// generated set, as the driver would use
+		wipe.Init(0, sets[set], 0);
+
+		PGPUInt64 written = 0;
+
+		double const start = CFilFormatBatch::Clock();
+		PGPError const err = wipe.WipeFile("bench.tmp", &written);
+		double const seconds = CFilFormatBatch::Clock() - start;
+
+		printf("%2u passes: %llu bytes in %.2f s, %.1f MB/s%s\n",
+			   sets[set], (unsigned long long) written, seconds,
+			   (seconds > 0) ? written / seconds / (1024 * 1024) : 0.0,
+			   IsPGPError(err) ? " (failed)" : "");
+	}
+
+	unlink("bench.tmp");
+}
+
+int main(int argc, char **argv)
+{
+	int failed = FillTest() + GenerateTest() + WipeTest() + SparseTest() + RemoveTest() + DeferTest();
+
+	if(argc > 1)
+	{
+		Benchmark((PGPUInt64) atoi(argv[1]) * 1024 * 1024);
+	}
+
+	printf("%d failed\n", failed);
+
+	return failed;
+}
+
+#endif /* UNITTEST */
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
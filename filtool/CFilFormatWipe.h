@@ -0,0 +1,122 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilFormatWipe.h: interface for the CFilFormatWipe class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilFormatWipe_H__6D2B9F40_E8A3_4C71_B5D6_0A3F7C18E924__INCLUDED_)
+#define AFX_CFilFormatWipe_H__6D2B9F40_E8A3_4C71_B5D6_0A3F7C18E924__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "FilFormat.h"
+
+#include <pthread.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilFormatWipe
+{
+	// User mode counterpart of CFilterWiper for regular files on POSIX systems. Each pass overwrites the
+	// allocated ranges of the file with c_buffers asynchronous writes in flight and is flushed to the device
+	// before the next one starts. Value patterns are those of CWipePattern, random passes are an AES-CTR
+	// keystream keyed once per wipe. Holes of sparse files are found with SEEK_DATA/SEEK_HOLE and skipped.
+	// Deferred files are renamed to a generic name first, which also marks them for Recover after a crash.
+
+public:
+
+	enum c_constants
+	{
+		c_buffers		= 3,					// writes in flight
+		c_bufferSize	= 1024 * 1024,
+		c_ranges		= 32,					// allocated ranges fetched at once
+		c_sectorSize	= FILFORMAT_SECTOR_SIZE,
+		c_patternsMax	= 50,
+		c_random		= -1,					// pattern of a random pass
+	};
+
+	enum c_flags
+	{
+		WIPE_RENAME		= 0x1,					// overwrite the name, as FILFILE_WIPE_RENAME of the driver
+		WIPE_TRUNCATE	= 0x2,					// hide the original size
+		WIPE_DELETE		= 0x4,
+	};
+
+								CFilFormatWipe();
+								~CFilFormatWipe();
+
+	PGPError					Init(int const* patterns, PGPUInt32 patternsCount, PGPUInt32 flags);
+	void						Close();
+
+	PGPError					WipeFile(char const* path, PGPUInt64 *written = 0);
+
+								// Wipe and delete in background
+	PGPError					Defer(char const* path);
+	PGPError					Recover(char const* directory);
+	PGPError					WorkerStart();
+	void						WorkerStop();
+
+	PGPUInt32					Failed() const;
+
+	static bool					Fill(int pattern, PGPByte *target, PGPUInt32 targetSize);
+	static PGPUInt32			Generate(int *patterns, PGPUInt32 patternsCount, PGPByte const* random = 0);
+
+private:
+
+	struct Buffer;
+	struct Pass;
+
+	struct Item
+	{
+		Item*					Next;
+		char					Path[1];		// generic name, follows this struct
+	};
+
+	PGPError					Wipe(char const* path, PGPUInt32 flags, PGPUInt64 *written);
+	PGPError					WipePass(int file, Pass *pass, int pattern, PGPUInt64 eof, bool sparse, PGPUInt64 *written);
+	PGPError					WipePost(int file, char const* path, PGPUInt32 flags);
+	PGPError					Write(int file, Buffer *buffer, PGPUInt64 offset, PGPUInt32 length);
+	PGPError					Wait(Buffer *buffer);
+	PGPError					QueryRanges(int file, PGPUInt64 offset, PGPUInt64 eof, PGPUInt64 *ranges, PGPUInt32 *rangesCount);
+	PGPError					Keystream(Pass *pass, PGPByte *buffer, PGPUInt32 length);
+
+	PGPError					Enqueue(char const* path);
+	void						Work();
+
+	static char*				Hide(char const* path);
+	static bool					IsHidden(char const* name);
+	static void*				Worker(void *context);
+
+	static int const			s_patterns[];
+
+								// DATA
+	int							m_patterns[c_patternsMax];
+	PGPUInt32					m_patternsCount;
+	PGPUInt32					m_flags;
+
+	Item*						m_queue;		// deferred files, in order
+	Item**						m_queueTail;
+	PGPUInt32					m_failed;		// deferred files not wiped, kept under their generic name
+	bool						m_stop;
+	bool						m_running;
+
+	pthread_t					m_worker;
+	pthread_mutex_t				m_lock;
+	pthread_cond_t				m_queued;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+PGPUInt32 CFilFormatWipe::Failed() const
+{
+	return m_failed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilFormatWipe_H__6D2B9F40_E8A3_4C71_B5D6_0A3F7C18E924__INCLUDED_)
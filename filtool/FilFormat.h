@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// FilFormat.h: on-disk format of encrypted files, as written by the filter driver.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_FilFormat_H__5B0E2C7A_91D4_4F63_8A2E_D7C41B96E305__INCLUDED_)
+#define AFX_FilFormat_H__5B0E2C7A_91D4_4F63_8A2E_D7C41B96E305__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+extern "C"
+{
+	#include "pgpBase.h"
+	#include "pgpErrors.h"
+}
+
+// Values below mirror fsfd/CFilterBase.h and the driver's built in EME layout. They must never
+// change independently, otherwise files are no longer byte compatible.
+
+enum FILFORMAT_CIPHER_SYM
+{
+	FILFORMAT_CIPHER_SYM_NULL		= 0,
+	FILFORMAT_CIPHER_SYM_AES128		= 1,
+	FILFORMAT_CIPHER_SYM_AES192		= 2,
+	FILFORMAT_CIPHER_SYM_AES256		= 3,
+
+	FILFORMAT_CIPHER_SYM_AUTOCONF	= 0xffff,
+};
+
+enum FILFORMAT_CIPHER_MODE
+{
+	FILFORMAT_CIPHER_MODE_NULL		= 0,
+	FILFORMAT_CIPHER_MODE_CTR		= 1,
+	FILFORMAT_CIPHER_MODE_CFB		= 2,
+	FILFORMAT_CIPHER_MODE_EME		= 3,
+	FILFORMAT_CIPHER_MODE_EME_2		= 4,
+	FILFORMAT_CIPHER_MODE_XTS		= 5,
+
+	FILFORMAT_CIPHER_MODE_MASK		= 0xf,
+};
+
+enum FILFORMAT_CIPHER_UNIT
+{
+	FILFORMAT_CIPHER_UNIT_512		= 0,
+	FILFORMAT_CIPHER_UNIT_4096		= 3,
+
+	FILFORMAT_CIPHER_UNIT_SHIFT		= 4,
+	FILFORMAT_CIPHER_UNIT_MASK		= 0xf,
+};
+
+enum FILFORMAT_LAYOUT
+{
+	FILFORMAT_MAGIC					= 0x58444B58,	// FILF_POOL_TAG 'XDKX'
+
+	FILFORMAT_SECTOR_SIZE			= 512,
+	FILFORMAT_HEADER_ALIGN			= 0x1000,		// CFilterHeader::c_align
+	FILFORMAT_BLOCK_SIZE			= 512,			// CFilterContext::c_blockSize (EME)
+	FILFORMAT_TAIL					= 512,			// CFilterContext::c_tail, Padding plus Filler
+
+	FILFORMAT_KEY_SIZE				= 32,			// FileKey is always stored with 256 bits
+};
+
+///////////////////////////////////////////////////////////////////
+// Encrypted File Layout := [Header | EncData | Tail]
+//
+// Header := [Block | Payload | Padding to next boundary]
+// Tail	  := [Padding | Filler]
+// with sizeof(Padding + Filler) := FILFORMAT_TAIL
+//
+// EncData and Padding are encrypted together, the Filler is random
+// and as long as the plain data's remainder on a block boundary.
+///////////////////////////////////////////////////////////////////
+
+struct FILFORMAT_HEADER_BLOCK
+{
+									// NOTE: all numeric values are little endian (Intel).
+	PGPUInt32		Magic;
+	PGPUInt32		Version;		// Major: upper 16bit -- Minor: lower 16bit
+	PGPUInt32		Cipher;			// Cipher mode: upper 16bit -- symmetric cipher: lower 16bit
+	PGPUInt32		BlockSize;		// Header size inclusive Payload, aligned on FILFORMAT_HEADER_ALIGN
+	PGPUInt32		PayloadSize;
+	PGPUInt32		PayloadCrc;
+	PGPUInt32		Deepness;
+	PGPUInt32		Reserved;
+	PGPUInt64		Nonce;
+	PGPByte			FileKey[FILFORMAT_KEY_SIZE];	// wrapped with the EntityKey
+};
+
+// Same as sizeof(FILFILE_HEADER_BLOCK) of the driver
+#define FILFORMAT_HEADER_BLOCK_SIZE	(8 * 4 + 8 + FILFORMAT_KEY_SIZE)
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_FilFormat_H__5B0E2C7A_91D4_4F63_8A2E_D7C41B96E305__INCLUDED_)
@@ -0,0 +1,525 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// filtool.cpp: offline tool for encrypted files, works without the filter driver.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CFilFormatFile.h"
+#include "CFilFormatBatch.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static char const s_usage[] =
+	"usage: filtool info    [options] <path>...\n"
+	"       filtool verify  [options] [-k key] [-d] <path>...\n"
+	"       filtool decrypt [options] -k key -o dir <path>...\n"
+	"       filtool encrypt [options] -k key -p payload [-m mode] [-u 4096] -o dir <path>...\n"
+	"       filtool rewrap  [options] -k key -n newkey (-o dir | -i) <path>...\n"
+	"\n"
+	"  key, newkey   file holding a raw 128, 192 or 256 bit EntityKey\n"
+	"  payload       file holding the opaque Header Payload\n"
+	"  mode          ctr, cfb, eme, eme2 or xts (default eme)\n"
+	"  -d            decrypt all data, otherwise only the Tail is checked\n"
+	"  -i            rewrap in place, only the Header is rewritten\n"
+	"\n"
+	"options:\n"
+	"  -r            process directories recursively, output trees are mirrored below dir\n"
+	"  -j count      worker threads (default one per processor)\n"
+	"  -t            report per file and aggregate throughput\n";
+
+struct FilToolArgs
+{
+	char const*		Command;
+	char const*		Key;
+	char const*		NewKey;
+	char const*		Payload;
+	char const*		Directory;
+	PGPUInt32		Mode;
+	PGPUInt32		Threads;
+	bool			Data;
+	bool			InPlace;
+	bool			Recursive;
+	bool			Throughput;
+	int				First;		// index of first path
+};
+
+struct FilToolContext
+{
+	FilToolArgs const*	Args;
+	PGPByte*			Key;
+	PGPUInt32			KeySize;
+	PGPByte*			NewKey;
+	PGPUInt32			NewKeySize;
+	PGPByte*			Payload;
+	PGPUInt32			PayloadSize;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PGPByte* ReadAll(char const* path, PGPUInt32 *size)
+{
+	CFilFormatIo io;
+
+	if(IsPGPError(io.Map(path)) || !io.Size() || (io.Size() > 0x100000))
+	{
+		return 0;
+	}
+
+	PGPByte *const data = (PGPByte*) malloc((size_t) io.Size());
+
+	if(data)
+	{
+		memcpy(data, io.Data(), (size_t) io.Size());
+
+		*size = (PGPUInt32) io.Size();
+	}
+
+	return data;
+}
+
+static char* TargetPath(char const* directory, CFilFormatBatch::Entry const* entry)
+{
+	// Keep the name and, for walked trees, the relative path of the source
+	char const* name = entry->Path + entry->Relative;
+
+	size_t const length = strlen(directory) + 1 + strlen(name) + 1;
+
+	char *const target = (char*) malloc(length);
+
+	if(target)
+	{
+		sprintf(target, "%s/%s", directory, name);
+
+		if(IsPGPError(CFilFormatIo::CreateParents(target)))
+		{
+			free(target);
+			return 0;
+		}
+	}
+
+	return target;
+}
+
+static char const* ModeName(PGPUInt32 cipher)
+{
+	switch((cipher >> 16) & FILFORMAT_CIPHER_MODE_MASK)
+	{
+		case FILFORMAT_CIPHER_MODE_CTR:		return "CTR";
+		case FILFORMAT_CIPHER_MODE_CFB:		return "CFB";
+		case FILFORMAT_CIPHER_MODE_EME:		return "EME";
+		case FILFORMAT_CIPHER_MODE_EME_2:	return "EME2";
+		case FILFORMAT_CIPHER_MODE_XTS:		return "XTS";
+		default:							break;
+	}
+
+	return "unknown";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool ParseArgs(int argc, char **argv, FilToolArgs *args)
+{
+	memset(args, 0, sizeof(*args));
+
+	if(argc < 3)
+	{
+		return false;
+	}
+
+	args->Command = argv[1];
+	args->Mode	  = FILFORMAT_CIPHER_MODE_EME;
+
+	int index = 2;
+
+	for(; (index < argc) && (argv[index][0] == '-'); ++index)
+	{
+		char const* option = argv[index];
+
+		if(!strcmp(option, "-d"))
+		{
+			args->Data = true;
+			continue;
+		}
+		if(!strcmp(option, "-i"))
+		{
+			args->InPlace = true;
+			continue;
+		}
+		if(!strcmp(option, "-r"))
+		{
+			args->Recursive = true;
+			continue;
+		}
+		if(!strcmp(option, "-t"))
+		{
+			args->Throughput = true;
+			continue;
+		}
+
+		// All other options take a value
+		if(++index >= argc)
+		{
+			return false;
+		}
+
+		char const* value = argv[index];
+
+		if(!strcmp(option, "-k"))
+		{
+			args->Key = value;
+		}
+		else if(!strcmp(option, "-n"))
+		{
+			args->NewKey = value;
+		}
+		else if(!strcmp(option, "-p"))
+		{
+			args->Payload = value;
+		}
+		else if(!strcmp(option, "-o"))
+		{
+			args->Directory = value;
+		}
+		else if(!strcmp(option, "-m"))
+		{
+			PGPUInt32 const unit = args->Mode & ~FILFORMAT_CIPHER_MODE_MASK;
+
+			if(!strcmp(value, "ctr"))		args->Mode = FILFORMAT_CIPHER_MODE_CTR;
+			else if(!strcmp(value, "cfb"))	args->Mode = FILFORMAT_CIPHER_MODE_CFB;
+			else if(!strcmp(value, "eme"))	args->Mode = FILFORMAT_CIPHER_MODE_EME;
+			else if(!strcmp(value, "eme2"))	args->Mode = FILFORMAT_CIPHER_MODE_EME_2;
+			else if(!strcmp(value, "xts"))	args->Mode = FILFORMAT_CIPHER_MODE_XTS;
+			else							return false;
+
+			args->Mode |= unit;
+		}
+		else if(!strcmp(option, "-j"))
+		{
+			args->Threads = (PGPUInt32) atoi(value);
+
+			if(!args->Threads)
+			{
+				return false;
+			}
+		}
+		else if(!strcmp(option, "-u"))
+		{
+			if(!strcmp(value, "4096"))
+			{
+				args->Mode |= FILFORMAT_CIPHER_UNIT_4096 << FILFORMAT_CIPHER_UNIT_SHIFT;
+			}
+			else if(strcmp(value, "512"))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	args->First = index;
+
+	return (index < argc);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PGPError Info(char const* path, PGPUInt64 *bytes)
+{
+	CFilFormatFile file;
+
+	PGPError const err = file.Open(path);
+
+	if(IsntPGPError(err))
+	{
+		FILFORMAT_HEADER_BLOCK const& block = file.Header().m_block;
+
+		if(file.Header().IsAutoConfig())
+		{
+			printf("%s: AutoConfig Version[%u] Payload[%u] Deepness[0x%x]\n", path,
+				   block.Version, block.PayloadSize, block.Deepness);
+		}
+		else
+		{
+			printf("%s: Version[%u] Cipher[AES%u-%s/%u] Header[%u] Payload[%u] Data[%llu] Nonce[0x%llx]\n", path,
+				   block.Version,
+				   file.Header().KeySize() * 8, ModeName(block.Cipher),
+				   FILFORMAT_SECTOR_SIZE << (((block.Cipher >> 16) >> FILFORMAT_CIPHER_UNIT_SHIFT) & FILFORMAT_CIPHER_UNIT_MASK),
+				   block.BlockSize, block.PayloadSize,
+				   (unsigned long long) file.DataSize(), (unsigned long long) block.Nonce);
+		}
+
+		*bytes = file.FileSize();
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PGPError Operation(void *context, CFilFormatBatch::Entry *entry)
+{
+	FilToolContext const* tool = (FilToolContext const*) context;
+	FilToolArgs const& args	   = *tool->Args;
+
+	char const* path = entry->Path;
+
+	if(!strcmp(args.Command, "info"))
+	{
+		return Info(path, &entry->Bytes);
+	}
+
+	if(!strcmp(args.Command, "encrypt"))
+	{
+		CFilFormatIo source;
+
+		PGPError err = source.Map(path);
+
+		if(IsPGPError(err))
+		{
+			return err;
+		}
+
+		entry->Bytes = source.Size();
+
+		source.Close();
+
+		char *const target = TargetPath(args.Directory, entry);
+
+		if(!target)
+		{
+			return kPGPError_CantOpenFile;
+		}
+
+		err = CFilFormatFile::Encrypt(path, target, tool->Key, tool->KeySize, args.Mode, tool->Payload, tool->PayloadSize);
+
+		free(target);
+
+		return err;
+	}
+
+	CFilFormatFile file;
+
+	PGPError err = file.Open(path, args.InPlace);
+
+	if(IsPGPError(err))
+	{
+		return err;
+	}
+
+	entry->Bytes = file.FileSize();
+
+	if(!strcmp(args.Command, "verify"))
+	{
+		return file.Verify(tool->Key, tool->KeySize, (args.Data) ? CFilFormatFile::VERIFY_DATA : CFilFormatFile::VERIFY_TAIL);
+	}
+
+	if(args.InPlace)
+	{
+		err = file.Rewrap(tool->Key, tool->KeySize, tool->NewKey, tool->NewKeySize);
+
+		if(err != kPGPError_BufferTooSmall)
+		{
+			return err;
+		}
+
+		// No room for a copy of the Header, write the file anew next to it and swap
+		char *const target = (char*) malloc(strlen(path) + sizeof(".rewrap"));
+
+		if(!target)
+		{
+			return kPGPError_OutOfMemory;
+		}
+
+		sprintf(target, "%s.rewrap", path);
+
+		err = file.Rewrap(tool->Key, tool->KeySize, tool->NewKey, tool->NewKeySize, target);
+
+		file.Close();
+
+		if(IsntPGPError(err))
+		{
+			err = CFilFormatIo::Replace(target, path);
+		}
+
+		if(IsPGPError(err))
+		{
+			remove(target);
+		}
+
+		free(target);
+
+		return err;
+	}
+
+	char *const target = TargetPath(args.Directory, entry);
+
+	if(!target)
+	{
+		return kPGPError_CantOpenFile;
+	}
+
+	if(!strcmp(args.Command, "decrypt"))
+	{
+		err = file.Decrypt(tool->Key, tool->KeySize, target);
+	}
+	else
+	{
+		err = file.Rewrap(tool->Key, tool->KeySize, tool->NewKey, tool->NewKeySize, target);
+	}
+
+	free(target);
+
+	return err;
+}
+
+static void Report(void *context, CFilFormatBatch::Entry const* entry)
+{
+	FilToolContext const* tool = (FilToolContext const*) context;
+	FilToolArgs const& args	   = *tool->Args;
+
+	if(IsPGPError(entry->Error))
+	{
+		fprintf(stderr, "%s: %s failed [%d]\n", entry->Path, args.Command, (int) entry->Error);
+	}
+	else if(args.Throughput)
+	{
+		printf("%s: OK %llu bytes %.3f s %.1f MB/s\n", entry->Path, (unsigned long long) entry->Bytes, entry->Seconds,
+			   (entry->Seconds > 0) ? (double) entry->Bytes / entry->Seconds / 1e6 : 0.0);
+	}
+	else if(strcmp(args.Command, "info"))
+	{
+		printf("%s: OK\n", entry->Path);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+	FilToolArgs args;
+
+	if(!ParseArgs(argc, argv, &args))
+	{
+		fputs(s_usage, stderr);
+		return 2;
+	}
+
+	bool const info	   = !strcmp(args.Command, "info");
+	bool const verify  = !strcmp(args.Command, "verify");
+	bool const encrypt = !strcmp(args.Command, "encrypt");
+	bool const rewrap  = !strcmp(args.Command, "rewrap");
+
+	if(!info && !verify && !encrypt && !rewrap && strcmp(args.Command, "decrypt"))
+	{
+		fputs(s_usage, stderr);
+		return 2;
+	}
+
+	// Check required options, in place only rewraps
+	if((!info && !verify && (!args.Key || (!args.Directory && !args.InPlace))) || (encrypt && !args.Payload) || (rewrap && !args.NewKey) ||
+	   (args.InPlace && (!rewrap || args.Directory)))
+	{
+		fputs(s_usage, stderr);
+		return 2;
+	}
+
+	FilToolContext tool;
+
+	memset(&tool, 0, sizeof(tool));
+
+	tool.Args = &args;
+
+	if(args.Key && !info)
+	{
+		tool.Key = ReadAll(args.Key, &tool.KeySize);
+
+		if(!tool.Key || ((tool.KeySize != 16) && (tool.KeySize != 24) && (tool.KeySize != 32)))
+		{
+			fprintf(stderr, "filtool: invalid key file %s\n", args.Key);
+			return 2;
+		}
+	}
+
+	if(args.NewKey)
+	{
+		tool.NewKey = ReadAll(args.NewKey, &tool.NewKeySize);
+
+		if(!tool.NewKey || ((tool.NewKeySize != 16) && (tool.NewKeySize != 24) && (tool.NewKeySize != 32)))
+		{
+			fprintf(stderr, "filtool: invalid key file %s\n", args.NewKey);
+			return 2;
+		}
+	}
+
+	if(args.Payload)
+	{
+		tool.Payload = ReadAll(args.Payload, &tool.PayloadSize);
+
+		if(!tool.Payload)
+		{
+			fprintf(stderr, "filtool: invalid payload file %s\n", args.Payload);
+			return 2;
+		}
+	}
+
+	CFilFormatBatch batch;
+
+	PGPError err = kPGPError_NoErr;
+
+	for(int index = args.First; IsntPGPError(err) && (index < argc); ++index)
+	{
+		err = batch.Add(argv[index], args.Recursive);
+	}
+
+	if(IsPGPError(err))
+	{
+		fprintf(stderr, "filtool: cannot collect files [%d]\n", (int) err);
+	}
+	else
+	{
+		batch.Run(args.Threads, Operation, Report, &tool);
+
+		if(args.Throughput)
+		{
+			printf("%u files, %u failed, %llu bytes %.3f s %.1f MB/s\n", batch.Count(), batch.Failed(),
+				   (unsigned long long) batch.Bytes(), batch.Seconds(),
+				   (batch.Seconds() > 0) ? (double) batch.Bytes() / batch.Seconds() / 1e6 : 0.0);
+		}
+	}
+
+	if(tool.Key)
+	{
+		memset(tool.Key, 0, tool.KeySize);
+		free(tool.Key);
+	}
+
+	if(tool.NewKey)
+	{
+		memset(tool.NewKey, 0, tool.NewKeySize);
+		free(tool.NewKey);
+	}
+
+	if(tool.Payload)
+	{
+		free(tool.Payload);
+	}
+
+	if(IsPGPError(err))
+	{
+		return 2;
+	}
+
+	return (batch.Failed()) ? 1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
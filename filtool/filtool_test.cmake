@@ -0,0 +1,160 @@
+# CLI test of filtool, run by ctest:
+#   cmake -DFILTOOL=<path to filtool> -DWORK=<scratch directory> -P filtool_test.cmake
+#
+# Encrypts a small tree in each mode, then checks info, verify, rewrap and decrypt on it,
+# the exit codes for failed files and bad arguments, and the throughput report.
+
+cmake_minimum_required(VERSION 3.15)
+
+if(NOT FILTOOL OR NOT WORK)
+	message(FATAL_ERROR "FILTOOL and WORK must be given")
+endif()
+
+# Run filtool in WORK, expect the exit code and optionally a pattern in its output
+function(filtool expected pattern)
+	execute_process(COMMAND ${FILTOOL} ${ARGN}
+					WORKING_DIRECTORY ${WORK}
+					RESULT_VARIABLE result
+					OUTPUT_VARIABLE output
+					ERROR_VARIABLE output)
+
+	if(NOT result EQUAL expected)
+		message(FATAL_ERROR "filtool ${ARGN}: exit code ${result}, expected ${expected}\n${output}")
+	endif()
+
+	if(pattern AND NOT output MATCHES "${pattern}")
+		message(FATAL_ERROR "filtool ${ARGN}: output does not match '${pattern}'\n${output}")
+	endif()
+
+	set(output "${output}" PARENT_SCOPE)
+endfunction()
+
+# Compare each file of the plain tree with its counterpart below the given directory
+function(compare directory)
+	foreach(name ${plain})
+		file(SHA256 ${WORK}/${name} expected)
+		file(SHA256 ${WORK}/${directory}/${name} actual)
+
+		if(NOT expected STREQUAL actual)
+			message(FATAL_ERROR "${directory}/${name} differs from ${name}")
+		endif()
+	endforeach()
+endfunction()
+
+file(REMOVE_RECURSE ${WORK})
+file(MAKE_DIRECTORY ${WORK}/src/sub/deep)
+
+# Keys are raw bytes, printable ones are good enough
+file(WRITE ${WORK}/key		"0123456789abcdef0123456789abcdef")
+file(WRITE ${WORK}/newkey	"fedcba9876543210")
+file(WRITE ${WORK}/wrongkey	"0123456789abcdef0123456789abcdeF")
+file(WRITE ${WORK}/payload	"opaque payload")
+
+# Sizes around the block and the 1 MB chunk boundaries, and an empty file
+string(REPEAT "The quick brown fox jumps over the lazy dog 0123456789 " 20000 large)
+string(SUBSTRING "${large}" 0 511 small)
+
+file(WRITE ${WORK}/src/large.txt		"${large}")
+file(WRITE ${WORK}/src/sub/small.txt	"${small}")
+file(WRITE ${WORK}/src/sub/one.txt		"x")
+file(WRITE ${WORK}/src/sub/deep/empty	"")
+
+set(plain src/large.txt src/sub/small.txt src/sub/one.txt src/sub/deep/empty)
+
+foreach(mode ctr cfb eme eme2 xts xts4096)
+	set(options -m ${mode})
+	set(name ${mode})
+
+	if(mode STREQUAL "xts4096")
+		set(options -m xts -u 4096)
+		set(name "xts/4096")
+	endif()
+
+	string(TOUPPER "${name}" upper)
+
+	filtool(0 "" encrypt -r -j 3 -k key -p payload ${options} -o enc-${mode} src)
+	filtool(0 "AES256-${upper}.*AES256-${upper}.*AES256-${upper}.*AES256-${upper}" info -r enc-${mode})
+	filtool(0 "" verify -r -d -k key enc-${mode})
+
+	# Wrong key is detected from the Tail alone
+	filtool(1 "large.txt: verify failed" verify -k wrongkey enc-${mode}/src/large.txt)
+
+	filtool(0 "" rewrap -r -k key -n newkey -o rewrap-${mode} enc-${mode})
+	filtool(0 "" verify -r -d -k newkey rewrap-${mode})
+	filtool(1 "" verify -r -k key rewrap-${mode})
+
+	filtool(0 "" decrypt -r -j 2 -k newkey -o clear-${mode} rewrap-${mode})
+	compare(clear-${mode}/rewrap-${mode}/enc-${mode})
+
+	# Rewrap leaves the data untouched
+	file(SIZE ${WORK}/enc-${mode}/src/large.txt before)
+	file(SIZE ${WORK}/rewrap-${mode}/enc-${mode}/src/large.txt after)
+
+	if(NOT before EQUAL after)
+		message(FATAL_ERROR "rewrap changed the size of large.txt in mode ${mode}")
+	endif()
+
+	# In place, only the Header changes
+	file(COPY ${WORK}/enc-${mode}/src DESTINATION ${WORK}/inplace-${mode})
+	filtool(0 "" rewrap -i -r -j 3 -k key -n newkey inplace-${mode})
+	filtool(0 "" verify -r -d -k newkey inplace-${mode})
+	filtool(1 "" verify -r -k key inplace-${mode})
+
+	file(READ ${WORK}/enc-${mode}/src/large.txt before OFFSET 4096 HEX)
+	file(READ ${WORK}/inplace-${mode}/src/large.txt after OFFSET 4096 HEX)
+
+	if(NOT before STREQUAL after)
+		message(FATAL_ERROR "rewrap -i changed the data of large.txt in mode ${mode}")
+	endif()
+endforeach()
+
+# A Payload too large for a copy of the Header in place is rewritten through a new file
+string(REPEAT "payload " 400 payload)
+file(WRITE ${WORK}/largepayload "${payload}")
+
+filtool(0 "" encrypt -k key -p largepayload -o large src/sub/small.txt)
+filtool(0 "" rewrap -i -k key -n newkey large/small.txt)
+filtool(0 "" decrypt -k newkey -o large-clear large/small.txt)
+file(SHA256 ${WORK}/src/sub/small.txt expected)
+file(SHA256 ${WORK}/large-clear/small.txt actual)
+
+if(NOT expected STREQUAL actual)
+	message(FATAL_ERROR "large-clear/small.txt differs from src/sub/small.txt")
+endif()
+
+if(EXISTS ${WORK}/large/small.txt.rewrap)
+	message(FATAL_ERROR "rewrap -i left large/small.txt.rewrap behind")
+endif()
+
+# Single files go directly below the output directory
+filtool(0 "" encrypt -k key -p payload -o single src/sub/small.txt)
+filtool(0 "small.txt: OK" decrypt -k key -o single-clear single/small.txt)
+file(SHA256 ${WORK}/src/sub/small.txt expected)
+file(SHA256 ${WORK}/single-clear/small.txt actual)
+
+if(NOT expected STREQUAL actual)
+	message(FATAL_ERROR "single-clear/small.txt differs from src/sub/small.txt")
+endif()
+
+# A damaged file fails, the others are still processed and reported
+file(COPY ${WORK}/enc-eme/src DESTINATION ${WORK}/damaged)
+file(WRITE ${WORK}/damaged/src/sub/small.txt "truncated")
+
+filtool(1 "small.txt: verify failed" verify -r -d -t -k key damaged)
+if(NOT output MATCHES "4 files, 1 failed")
+	message(FATAL_ERROR "damaged tree: summary missing\n${output}")
+endif()
+
+# Throughput report
+filtool(0 "large.txt: OK [0-9]+ bytes .* MB/s.*4 files, 0 failed, [0-9]+ bytes" verify -r -d -t -k key enc-eme)
+
+# Bad arguments and key files, missing inputs
+filtool(2 "usage" frobnicate src)
+filtool(2 "usage" decrypt -k key src/large.txt)
+filtool(2 "usage" encrypt -k key -o out src/large.txt)
+filtool(2 "usage" encrypt -k key -p payload -m rot13 -o out src/large.txt)
+filtool(2 "usage" verify -j 0 -k key enc-eme)
+filtool(2 "usage" rewrap -i -k key -n newkey -o out enc-eme)
+filtool(2 "usage" decrypt -i -k key enc-eme)
+filtool(2 "invalid key file" verify -k payload enc-eme)
+filtool(1 "missing: info failed" info missing)
@@ -241,6 +241,9 @@ CFilterHeader* CFilterAppListEntry::GetHeader(LUID const* luid)
 NTSTATUS CFilterAppList::Init()
 {
 	RtlZeroMemory(this, sizeof(*this));
+
+	// Zero is never a valid generation
+	m_generation = 1;
 	
 	return ExInitializeResourceLite(&m_lock);
 }
@@ -320,6 +323,32 @@ ULONG CFilterAppList::Search(LPCWSTR image, ULONG imageLength, ULONG type)
 
 #pragma PAGEDCODE
 
+void CFilterAppList::Update()
+{
+	PAGED_CODE();
+
+	// Lock must be held exclusively
+
+	ULONG types = FILFILE_APP_NULL;
+
+	for(ULONG pos = 0; pos < m_size; ++pos)
+	{
+		types |= m_entries[pos].m_type;
+	}
+
+	m_types = types;
+
+	// Skip zero on wrap, generations are stored with 24 bits
+	if(!(++m_generation & 0xffffff))
+	{
+		m_generation++;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
 NTSTATUS CFilterAppList::Add(LPCWSTR		image, 
 							 ULONG			imageLength, 
 							 ULONG			type, 
@@ -348,6 +377,11 @@ NTSTATUS CFilterAppList::Add(LPCWSTR		image,
 
 		status = m_entries[pos].Init(image, imageLength, type, header);
 
+		if(NT_SUCCESS(status))
+		{
+			Update();
+		}
+
 		ExReleaseResourceLite(&m_lock);
 		FsRtlExitFileSystem();
 
@@ -392,6 +426,8 @@ NTSTATUS CFilterAppList::Add(LPCWSTR		image,
 	if(NT_SUCCESS(status))
 	{
 		m_size++;
+
+		Update();
 	}
 
 	ExReleaseResourceLite(&m_lock);
@@ -441,6 +477,8 @@ NTSTATUS CFilterAppList::Remove(LPCWSTR image, ULONG imageLength, LUID const* lu
 				RtlZeroMemory(m_entries + m_size, sizeof(CFilterAppListEntry));
 			}
 
+			Update();
+
 			status = STATUS_SUCCESS;
 		}
 	}
@@ -483,6 +521,8 @@ NTSTATUS CFilterAppList::Remove(LUID const* luid)
 			}
 		}
 
+		Update();
+
 		ExReleaseResourceLite(&m_lock);
 	}
 
@@ -519,34 +559,39 @@ ULONG CFilterAppList::Check(IRP *irp, ULONG type, CFilterHeader *header, LUID co
 		return FILFILE_APP_NULL;
 	}
 
+	// No entry of given type at all?
+	if( !(m_types & type))
+	{
+		return FILFILE_APP_NULL;
+	}
+
+	ASSERT(CFilterControl::Extension());
+	CFilterProcess *const process = &CFilterControl::Extension()->Process;
+	ASSERT(process);
+
 	FsRtlEnterFileSystem();
-	ExAcquireResourceSharedLite(&m_lock, true);
 
-	ULONG pos;
+	// Fast path: Use process' cached classification, if still valid
+	ULONG const generation = m_generation;
 
-	// Search if we have at least one entry of given type
-	for(pos = 0; pos < m_size; ++pos)
-	{
-		if(m_entries[pos].m_type & type)
-		{
-			break;
-		}
-	}
+	process->Lock();
+	ULONG const cached = process->GetAppList(pid, generation);
+	process->Unlock();
 
-	// No entry of given type?
-	if(pos >= m_size)
+	if(FILFILE_APP_INVALID != cached)
 	{
-		ExReleaseResourceLite(&m_lock);
-		FsRtlExitFileSystem();
+		// Header needed only on White matches
+		if( !(cached & type & FILFILE_APP_WHITE) || !header)
+		{
+			FsRtlExitFileSystem();
 
-		return FILFILE_APP_NULL;
+			return cached & type;
+		}
 	}
 
-	pos = ~0u;
+	ExAcquireResourceSharedLite(&m_lock, true);
 
-	ASSERT(CFilterControl::Extension());
-	CFilterProcess *const process = &CFilterControl::Extension()->Process;
-	ASSERT(process);
+	ULONG pos = ~0u;
 
 	process->Lock();
 
@@ -558,12 +603,21 @@ ULONG CFilterAppList::Check(IRP *irp, ULONG type, CFilterHeader *header, LUID co
 	{
 		ASSERT(imageLength);
 		
-		// Search for image name with right type
-		pos = Search(image, imageLength, type);
+		// Search for image name of any type
+		pos = Search(image, imageLength);
 	}
 
+	// Cache classification for subsequent requests
+	process->SetAppList(pid, m_generation, (~0u != pos) ? m_entries[pos].m_type & (FILFILE_APP_WHITE | FILFILE_APP_BLACK) : FILFILE_APP_NULL);
+
 	process->Unlock();
 
+	// Entry of right type?
+	if((~0u != pos) && !(m_entries[pos].m_type & type))
+	{
+		pos = ~0u;
+	}
+
 	ULONG found = FILFILE_APP_NULL;
 
 	if(~0u != pos)
@@ -599,4 +653,283 @@ ULONG CFilterAppList::Check(IRP *irp, ULONG type, CFilterHeader *header, LUID co
 
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
\ No newline at end of file
+///////////////////////////////////////////////////////////////////////////////
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Classification of requesting processes against White and Black entries, answered from the per
+ * process cache until Add or Remove change the list. The cache is observed through the locks taken:
+ * a cached answer needs the process lock only, a classification takes it twice plus the AppList lock.
+ */
+static LPCWSTR TestWiden(char const* text, WCHAR *buffer)
+{
+	ULONG pos = 0;
+
+	for(; text[pos]; ++pos)
+	{
+		buffer[pos] = (WCHAR) text[pos];
+	}
+
+	buffer[pos] = UNICODE_NULL;
+
+	return buffer;
+}
+
+static bool TestProcess(ULONG pid, char const* image)
+{
+	char  text[128];
+	WCHAR path[128];
+
+	sprintf(text, "\\Device\\HarddiskVolume1\\Program Files\\%s", image);
+
+	UNICODE_STRING ustr;
+	RtlInitUnicodeString(&ustr, TestWiden(text, path));
+
+	return NT_SUCCESS(CFilterControl::Extension()->Process.Add(pid, &ustr));
+}
+
+static NTSTATUS TestAdd(CFilterAppList *list, char const* image, ULONG type)
+{
+	WCHAR name[64];
+	TestWiden(image, name);
+
+	CFilterHeader header;
+	RtlZeroMemory(&header, sizeof(header));
+
+	if(type & FILFILE_APP_WHITE)
+	{
+		UCHAR const key[16] = { 1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16 };
+
+		header.m_payloadSize = 32;
+		header.m_payload	 = (UCHAR*) ExAllocatePool(PagedPool, header.m_payloadSize);
+
+		RtlFillMemory(header.m_payload, header.m_payloadSize, (UCHAR) wcslen(name));
+
+		header.m_key.Init(FILFILE_CIPHER_SYM_AES128, key, sizeof(key));
+	}
+
+	NTSTATUS const status = list->Add(name, (ULONG) wcslen(name) * sizeof(WCHAR), type, &header);
+
+	// Ownership was taken on success
+	header.Close();
+
+	return status;
+}
+
+static ULONG TestCheck(CFilterAppList *list, ULONG pid, ULONG type, CFilterHeader *header, ULONG *locks)
+{
+	CSimKernel::SetProcess(pid);
+
+	IRP *const irp = IoAllocateIrp(1, false);
+
+	ULONG const before = CSimKernel::Statistics().LockAcquisitions;
+
+	ULONG const found = list->Check(irp, type, header);
+
+	if(locks)
+	{
+		*locks = CSimKernel::Statistics().LockAcquisitions - before;
+	}
+
+	IoFreeIrp(irp);
+
+	CSimKernel::SetProcess(CSimKernel::c_systemProcess);
+
+	return found;
+}
+
+static double TestTime(CFilterAppList *list, ULONG first, ULONG count)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	ULONG matched = 0;
+
+	for(ULONG pid = first; pid < first + count; ++pid)
+	{
+		matched += (FILFILE_APP_NULL != TestCheck(list, pid, FILFILE_APP_BLACK, 0, 0));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double const ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	return (matched == ~0u) ? 0 : ns / count;
+}
+
+int main(void)
+{
+	enum { c_fast = 1, c_slow = 3, c_entries = 256, c_bench = 48 };
+
+	CSimKernel::Init();
+
+	FILFILE_CONTROL_EXTENSION *const extension = (FILFILE_CONTROL_EXTENSION*) calloc(1, sizeof(FILFILE_CONTROL_EXTENSION));
+
+	DEVICE_OBJECT control;
+	RtlZeroMemory(&control, sizeof(control));
+
+	control.DeviceExtension   = extension;
+	CFilterControl::s_control = &control;
+
+	extension->Process.Init();
+
+	int failed = 0;
+
+	failed += !TestProcess(100, "WINWORD.EXE");
+	failed += !TestProcess(200, "notepad.exe");
+	failed += !TestProcess(300, "other.exe");
+
+	CFilterAppList list;
+	list.Init();
+
+	ULONG locks = 0;
+
+	// Empty list, no lock at all
+	if(FILFILE_APP_NULL != TestCheck(&list, 100, FILFILE_APP_WHITE, 0, &locks) || locks)
+	{
+		printf("ERROR ON EMPTY [%u]\n", locks);
+		failed++;
+	}
+
+	failed += NT_ERROR(TestAdd(&list, "winword.exe", FILFILE_APP_WHITE));
+
+	// No Black entry, answered without classification
+	if(FILFILE_APP_NULL != TestCheck(&list, 200, FILFILE_APP_BLACK, 0, &locks) || locks)
+	{
+		printf("ERROR ON TYPES [%u]\n", locks);
+		failed++;
+	}
+
+	failed += NT_ERROR(TestAdd(&list, "notepad.exe", FILFILE_APP_BLACK));
+
+	// Same image again
+	if(STATUS_OBJECT_NAME_COLLISION != TestAdd(&list, "NOTEPAD.EXE", FILFILE_APP_BLACK))
+	{
+		printf("ERROR ON COLLISION\n");
+		failed++;
+	}
+
+	struct
+	{
+		ULONG	Pid;
+		ULONG	Type;
+		ULONG	Found;
+	}
+	const answers[] =
+	{
+		{ 100, FILFILE_APP_WHITE,						FILFILE_APP_WHITE },
+		{ 100, FILFILE_APP_BLACK,						FILFILE_APP_NULL  },
+		{ 100, FILFILE_APP_WHITE | FILFILE_APP_BLACK,	FILFILE_APP_WHITE },
+		{ 200, FILFILE_APP_BLACK,						FILFILE_APP_BLACK },
+		{ 200, FILFILE_APP_WHITE,						FILFILE_APP_NULL  },
+		{ 300, FILFILE_APP_WHITE | FILFILE_APP_BLACK,	FILFILE_APP_NULL  },
+	};
+
+	// First request of each process classifies, the following ones use the cache
+	for(ULONG pos = 0; pos < sizeof(answers) / sizeof(answers[0]); ++pos)
+	{
+		ULONG const expected = (!pos || (answers[pos].Pid != answers[pos - 1].Pid)) ? c_slow : c_fast;
+
+		ULONG const found = TestCheck(&list, answers[pos].Pid, answers[pos].Type, 0, &locks);
+
+		if((found != answers[pos].Found) || (locks != expected))
+		{
+			printf("ERROR ON ANSWER pid[%u] type[%u] found[%u] locks[%u]\n", answers[pos].Pid, answers[pos].Type, found, locks);
+			failed++;
+		}
+	}
+
+	// Unknown process, not cached
+	for(ULONG round = 0; round < 2; ++round)
+	{
+		if(FILFILE_APP_NULL != TestCheck(&list, 400, FILFILE_APP_BLACK, 0, &locks) || (locks != c_slow))
+		{
+			printf("ERROR ON UNKNOWN [%u]\n", locks);
+			failed++;
+		}
+	}
+
+	// A White match with Header wanted takes the slow path for the copy
+	CFilterHeader header;
+	RtlZeroMemory(&header, sizeof(header));
+
+	if((FILFILE_APP_WHITE != TestCheck(&list, 100, FILFILE_APP_WHITE, &header, &locks)) || (locks != c_slow) ||
+	   (32 != header.m_payloadSize) || !header.m_payload || (11 != header.m_payload[31]) || (16 != header.m_key.m_size))
+	{
+		printf("ERROR ON HEADER [%u]\n", locks);
+		failed++;
+	}
+
+	header.Close();
+
+	// Removal invalidates all cached classifications
+	failed += NT_ERROR(list.Remove(L"NotePad.exe", 11 * sizeof(WCHAR)));
+
+	if((FILFILE_APP_NULL != TestCheck(&list, 200, FILFILE_APP_WHITE, 0, &locks)) || (locks != c_slow) ||
+	   (FILFILE_APP_NULL != TestCheck(&list, 200, FILFILE_APP_WHITE, 0, &locks)) || (locks != c_fast) ||
+	   (FILFILE_APP_WHITE != TestCheck(&list, 100, FILFILE_APP_WHITE, 0, &locks)) || (locks != c_slow))
+	{
+		printf("ERROR ON REMOVE [%u]\n", locks);
+		failed++;
+	}
+
+	// So does adding
+	failed += NT_ERROR(TestAdd(&list, "other.exe", FILFILE_APP_BLACK));
+
+	if((FILFILE_APP_BLACK != TestCheck(&list, 300, FILFILE_APP_BLACK, 0, &locks)) || (locks != c_slow) ||
+	   (FILFILE_APP_BLACK != TestCheck(&list, 300, FILFILE_APP_BLACK, 0, &locks)) || (locks != c_fast))
+	{
+		printf("ERROR ON ADD [%u]\n", locks);
+		failed++;
+	}
+
+	// Classification against a large list versus cached answers
+	for(ULONG pos = 0; pos < c_entries; ++pos)
+	{
+		char image[32];
+
+		sprintf(image, "app%u.exe", pos);
+
+		failed += NT_ERROR(TestAdd(&list, image, (pos & 1) ? FILFILE_APP_BLACK : FILFILE_APP_WHITE));
+	}
+
+	// Spread over the list, some match none
+	for(ULONG pos = 0; pos < c_bench; ++pos)
+	{
+		char image[32];
+
+		sprintf(image, "app%u.exe", pos * 7);
+
+		failed += !TestProcess(1000 + pos, image);
+	}
+
+	double const classified = TestTime(&list, 1000, c_bench);
+	double const cached		= TestTime(&list, 1000, c_bench);
+
+	printf("%u entries, Check() classified %.0f ns, cached %.0f ns\n", list.Size(), classified, cached);
+
+	list.Close();
+
+	extension->Process.Close(true);
+
+	CFilterControl::s_control = 0;
+	free(extension);
+
+	if(CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimKernel::Statistics().Outstanding);
+		failed++;
+	}
+
+	CSimKernel::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
@@ -70,12 +70,16 @@ public:
 private:
 
 	ULONG					Search(LPCWSTR image, ULONG imageLength, ULONG type = 0);
+	void					Update();
 
 							// DATA
 	CFilterAppListEntry*	m_entries;
 	ULONG					m_size;
 	ULONG					m_capacity;
 
+	ULONG					m_types;		// Types of all entries combined
+	ULONG					m_generation;	// Incremented on each change, invalidates cached process classifications
+
 	ERESOURCE				m_lock;
 };
 
@@ -0,0 +1,248 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterAutoConfigCache.cpp: implementation of the CFilterAutoConfigCache class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define DRIVER_USE_NTIFS	// use the NTIFS header
+#include "driver.h"
+
+#include "IoControl.h"
+#include "CFilterBase.h"
+#include "CFilterAutoConfigCache.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterAutoConfigCache::Init()
+{
+	PAGED_CODE();
+
+	RtlZeroMemory(this, sizeof(*this));
+
+	// translate seconds to ticks
+	m_timeout		= CFilterBase::GetTicksFromSeconds(c_timeout);
+	m_timeoutRemote = CFilterBase::GetTicksFromSeconds(c_timeoutRemote);
+
+	return ExInitializeResourceLite(&m_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterAutoConfigCache::Close()
+{
+	PAGED_CODE();
+
+	Clear();
+
+	FsRtlEnterFileSystem();
+	ExDeleteResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterAutoConfigCache::Clear()
+{
+	PAGED_CODE();
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceExclusiveLite(&m_lock, true);
+
+	for(ULONG index = 0; index < c_entries; ++index)
+	{
+		CFilterAutoConfigCacheEntry *const entry = m_entries + index;
+
+		if(entry->m_path)
+		{
+			ExFreePool(entry->m_path);
+		}
+
+		RtlZeroMemory(entry, sizeof(*entry));
+	}
+
+	m_next = 0;
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+bool CFilterAutoConfigCache::Check(LPCWSTR path, ULONG pathLength, ULONG flags)
+{
+	ASSERT(path);
+	ASSERT(pathLength);
+
+	PAGED_CODE();
+
+	ULONG const hash = CFilterBase::Hash(path, pathLength);
+
+	LARGE_INTEGER tick;
+	KeQueryTickCount(&tick);
+
+	bool found = false;
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceSharedLite(&m_lock, true);
+
+	for(ULONG index = 0; index < c_entries; ++index)
+	{
+		CFilterAutoConfigCacheEntry const* entry = m_entries + index;
+
+		if((entry->m_hash == hash) && (entry->m_pathLength == pathLength) && (entry->m_flags == flags))
+		{
+			if(IsValid(entry, tick.LowPart))
+			{
+				// Hash collisions must never hide an AutoConfig file
+				if(!_wcsnicmp(entry->m_path, path, pathLength / sizeof(WCHAR)))
+				{
+					found = true;
+					break;
+				}
+			}
+		}
+	}
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+
+	return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterAutoConfigCache::Add(LPCWSTR path, ULONG pathLength, ULONG flags, ULONG generation)
+{
+	ASSERT(path);
+	ASSERT(pathLength);
+
+	PAGED_CODE();
+
+	// Invalidated while the AutoConfig file was opened?
+	if(generation != Generation())
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	LPWSTR const copy = (LPWSTR) ExAllocatePool(PagedPool, pathLength);
+
+	if(!copy)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlCopyMemory(copy, path, pathLength);
+
+	ULONG const hash = CFilterBase::Hash(path, pathLength);
+
+	LARGE_INTEGER tick;
+	KeQueryTickCount(&tick);
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceExclusiveLite(&m_lock, true);
+
+	// Take first unused, stale or expired entry
+	ULONG pos = ~0u;
+
+	for(ULONG index = 0; index < c_entries; ++index)
+	{
+		if(!IsValid(m_entries + index, tick.LowPart))
+		{
+			pos = index;
+			break;
+		}
+	}
+
+	if(pos == ~0u)
+	{
+		pos = m_next;
+
+		m_next = (m_next + 1) % c_entries;
+	}
+
+	CFilterAutoConfigCacheEntry *const entry = m_entries + pos;
+
+	if(entry->m_path)
+	{
+		ExFreePool(entry->m_path);
+	}
+
+	entry->m_hash		= hash;
+	entry->m_flags		= flags;
+	entry->m_generation = generation;
+	entry->m_tick		= tick.LowPart;
+	entry->m_path		= copy;
+	entry->m_pathLength = pathLength;
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+bool CFilterAutoConfigCache::Match(LPCWSTR path, ULONG pathLength)
+{
+	PAGED_CODE();
+
+	if(!path || (pathLength < g_filFileAutoConfigNameLength * sizeof(WCHAR)))
+	{
+		return false;
+	}
+
+	ULONG end = pathLength / sizeof(WCHAR);
+
+	// Creating a stream creates the file too
+	for(ULONG index = end; index; --index)
+	{
+		WCHAR const wc = path[index - 1];
+
+		if((wc == L'\\') || (wc == L'/'))
+		{
+			break;
+		}
+
+		if(wc == L':')
+		{
+			end = index - 1;
+		}
+	}
+
+	// Trailing zero seen on some redirectors
+	if(end && !path[end - 1])
+	{
+		end--;
+	}
+
+	if(end < g_filFileAutoConfigNameLength)
+	{
+		return false;
+	}
+
+	ULONG const start = end - g_filFileAutoConfigNameLength;
+
+	// Last component only
+	if(start && (path[start - 1] != L'\\') && (path[start - 1] != L'/'))
+	{
+		return false;
+	}
+
+	return !_wcsnicmp(path + start, g_filFileAutoConfigName, g_filFileAutoConfigNameLength);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
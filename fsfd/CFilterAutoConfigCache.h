@@ -0,0 +1,107 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterAutoConfigCache.h: interface for the CFilterAutoConfigCache class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilterAutoConfigCache_H__8E3F1A62_D04B_4C7E_A95B_6F27C1D8E430__INCLUDED_)
+#define AFX_CFilterAutoConfigCache_H__8E3F1A62_D04B_4C7E_A95B_6F27C1D8E430__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilterAutoConfigCache
+{
+	// Remembers directories without AutoConfig file, so that creates below them do not have to open
+	// it again. Any creation of an AutoConfig file, by create, rename or link, and any move of a local
+	// directory bumps the generation and thereby invalidates all entries at once - before the request
+	// is sent down and after it has completed. Entries on redirectors expire early as files may change on the server unnoticed.
+
+	enum c_constants
+	{
+		c_entries			= 256,
+		c_timeout			= 600,		// seconds
+		c_timeoutRemote		= 15,		// dito, on redirectors
+	};
+
+public:
+
+	enum c_flags
+	{
+		AUTOCONFIG_RELATED	= 0x1,		// path of directory, not of AutoConfig file
+		AUTOCONFIG_REMOTE	= 0x2,
+	};
+
+	NTSTATUS				Init();
+	void					Close();
+	void					Clear();
+
+	bool					Check(LPCWSTR path, ULONG pathLength, ULONG flags);
+	NTSTATUS				Add(LPCWSTR path, ULONG pathLength, ULONG flags, ULONG generation);
+
+	ULONG					Generation() const;
+	void					Invalidate();
+
+	static bool				Match(LPCWSTR path, ULONG pathLength);
+
+private:
+
+	struct CFilterAutoConfigCacheEntry
+	{
+		ULONG				m_hash;
+		ULONG				m_flags;
+		ULONG				m_generation;
+		ULONG				m_tick;			// at insertion
+		LPWSTR				m_path;
+		ULONG				m_pathLength;	// in bytes
+	};
+
+	bool					IsValid(CFilterAutoConfigCacheEntry const* entry, ULONG tick) const;
+
+							// DATA
+	CFilterAutoConfigCacheEntry	m_entries[c_entries];
+	ULONG					m_next;			// replaced next, if none is free
+	ULONG					m_timeout;		// ticks
+	ULONG					m_timeoutRemote;
+
+	LONG volatile			m_generation;
+
+	ERESOURCE				m_lock;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+ULONG CFilterAutoConfigCache::Generation() const
+{
+	return (ULONG) m_generation;
+}
+
+inline
+void CFilterAutoConfigCache::Invalidate()
+{
+	// Callable from completion routines, stale entries are purged lazily
+	InterlockedIncrement((LONG*) &m_generation);
+}
+
+inline
+bool CFilterAutoConfigCache::IsValid(CFilterAutoConfigCacheEntry const* entry, ULONG tick) const
+{
+	ASSERT(entry);
+
+	if(!entry->m_path || (entry->m_generation != (ULONG) m_generation))
+	{
+		return false;
+	}
+
+	return (tick - entry->m_tick) <= ((entry->m_flags & AUTOCONFIG_REMOTE) ? m_timeoutRemote : m_timeout);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilterAutoConfigCache_H__8E3F1A62_D04B_4C7E_A95B_6F27C1D8E430__INCLUDED_)
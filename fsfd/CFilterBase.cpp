@@ -314,22 +314,7 @@ ULONG CFilterBase::Hash(LPCWSTR path, ULONG pathLength)
 		
 		for(ULONG index = 0; index < pathLength; ++index) 
 		{
-			// transform char to upcase
-			WCHAR upcase = path[index];
-
-			if(upcase >= 'a')
-			{
-				if(upcase <= 'z')
-				{
-					upcase -= ('a' - 'A');
-				}
-				else
-				{
-					upcase = RtlUpcaseUnicodeChar(upcase);
-				}
-			}
-
-			hash = (hash << 6) - hash + upcase;
+			hash = HashChar(hash, path[index]);
 		}
 	}
 	else
@@ -1223,6 +1208,56 @@ NTSTATUS CFilterBase::SetFileInfo(DEVICE_OBJECT *device, FILE_OBJECT *file, FILE
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#pragma PAGEDCODE
+
+NTSTATUS CFilterBase::FlushFile(DEVICE_OBJECT *device, FILE_OBJECT *file)
+{
+	ASSERT(device);
+	ASSERT(file);
+
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
+
+	IRP* const irp = IoAllocateIrp(device->StackSize, false);
+
+	if(irp)
+	{
+		IO_STATUS_BLOCK ioStatus = {0,0};
+
+		irp->UserIosb				= &ioStatus;
+		irp->UserEvent				= 0;
+		irp->RequestorMode			= KernelMode;
+		irp->Tail.Overlay.Thread	= PsGetCurrentThread();
+		irp->Flags				   |= IRP_SYNCHRONOUS_API;
+
+		IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+		ASSERT(stack);
+
+		stack->MajorFunction = IRP_MJ_FLUSH_BUFFERS;
+		stack->MinorFunction = IRP_MN_NORMAL;
+		stack->DeviceObject	 = device;
+		stack->FileObject	 = file;
+
+		status = SimpleSend(device, irp);
+
+		if(NT_ERROR(status))
+		{
+			DBGPRINT(("FlushFile -ERROR: IRP_MJ_FLUSH_BUFFERS [0x%08x]\n", status));
+		}
+
+		IoFreeIrp(irp);
+	}
+	else
+	{
+		DBGPRINT(("FlushFile -ERROR: IoAllocateIrp() failed\n"));
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 #pragma LOCKEDCODE
 
 NTSTATUS CFilterBase::ZeroData(DEVICE_OBJECT *device, FILE_OBJECT *file, LARGE_INTEGER *start, LARGE_INTEGER *end)
@@ -1310,7 +1345,7 @@ NTSTATUS CFilterBase::ZeroData(DEVICE_OBJECT *device, FILE_OBJECT *file, LARGE_I
 
 #pragma LOCKEDCODE
 
-NTSTATUS CFilterBase::ReadWrite(DEVICE_OBJECT *device, FILE_OBJECT *file, FILFILE_READ_WRITE const* readWrite)
+NTSTATUS CFilterBase::ReadWrite(DEVICE_OBJECT *device, FILE_OBJECT *file, FILFILE_READ_WRITE const* readWrite, ULONG *information)
 {
 	ASSERT(device);
 	ASSERT(file);
@@ -1377,6 +1412,12 @@ NTSTATUS CFilterBase::ReadWrite(DEVICE_OBJECT *device, FILE_OBJECT *file, FILFIL
 			}
 		}
 
+		if(information && (STATUS_PENDING != status))
+		{
+			// bytes actually transferred
+			*information = (ULONG) ioStatus.Information;
+		}
+
 		if(NT_ERROR(status))
 		{
 			DBGPRINT(("ReadWrite -ERROR: IoCallDriver() failed [0x%08x]\n", status));
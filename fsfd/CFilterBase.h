@@ -127,10 +127,22 @@ enum FILFILE_CIPHER_MODE
 	FILFILE_CIPHER_MODE_CFB		 = 2,
 	FILFILE_CIPHER_MODE_EME		 = 3,
 	FILFILE_CIPHER_MODE_EME_2	 = 4,
+	FILFILE_CIPHER_MODE_XTS		 = 5,
 
 	FILFILE_CIPHER_MODE_MASK	 = 0xf
 };
 
+// Size of the data unit a cipher mode tweaks, stored above the mode in the cipher mode word.
+// Only XTS can code parts of a data unit, so I/O and file layout stay sector aligned.
+enum FILFILE_CIPHER_UNIT
+{
+	FILFILE_CIPHER_UNIT_512		 = 0,		// all files without unit information
+	FILFILE_CIPHER_UNIT_4096	 = 3,		// log2(unit size / 512)
+
+	FILFILE_CIPHER_UNIT_SHIFT	 = 4,
+	FILFILE_CIPHER_UNIT_MASK	 = 0xf
+};
+
 // TODO: Make this available to clients
 #define FILFILE_CIPHER_MODE_DEFAULT (FILFILE_CIPHER_MODE_EME << 16);
 
@@ -147,8 +159,8 @@ struct FILFILE_HEADER_BLOCK
 									// NOTE: all numeric values are little endian (Intel).
 	ULONG			Magic;			// usually: 'FliF' -> FilF;
 
-	ULONG			Version;		// Major:       upper 16bit -- Minor: lower 16bit
-	ULONG			Cipher;			// Cipher mode: upper 16bit -- symmetric cipher: lower 16bit
+	ULONG			Version;		// Major:       upper 16bit -- Minor: lower 16bit [1:=512 byte data units, 2:=larger ones]
+	ULONG			Cipher;			// Cipher mode: upper 16bit (data unit in bits 4-7) -- symmetric cipher: lower 16bit
 
 	ULONG			BlockSize;		// Header size inclusive Payload, aligned (at least) on sector boundary
 	ULONG			PayloadSize;	// Payload size, the Payload follows directly this block and is opaque for the driver
@@ -227,6 +239,7 @@ enum FILFILE_TRACK_FLAGS
 	TRACK_APP_LIST				= 0x2000000,	// Application List involved
 	TRACK_SHARE_DIRTORY         =0x4000000,           //ʹ־
 	TRACK_READ_ONLY             =0x6000000,     //ֻ
+	TRACK_PENDED				= 0x8000000,	// create result, waits for key request
 
 	#ifdef FILFILE_SUPPORT_WEBDAV				// Unsupported device types:
 	 TRACK_UNSUPPORTED			= TRACK_NETWARE,
@@ -264,14 +277,19 @@ struct FILFILE_TRACK_CONTEXT
 	CFilterHeader		Header;
 	CFilterEntity		Entity;			
 	CFilterKey			EntityKey;
+	ULONG				Decision;		// generations of decision and AutoConfig cache at PreCreate
+	ULONG				DecisionAutoConfigs;
 };
 
+class CFilterCipher;
+
 struct FILFILE_CRYPT_CONTEXT
 {
 	LARGE_INTEGER		Nonce;
 	LARGE_INTEGER		Offset;
 	ULONG				Value;			// depends on context
 	CFilterKey			Key;
+	CFilterCipher*		Cipher;			// referenced, used instead of Key and Nonce if set
 };
 
 //////////////////////////////////
@@ -315,6 +333,7 @@ struct FILFILE_CONTROL_EXTENSION
 	CFilterProcess				Process;			// Tracks PID to image name	
 	CFilterCallbackDisp			Callback;			// Callback dispatcher
 	CFilterHeaderCache			HeaderCache;		// Cache Headers - currently only used by the management interface
+	CFilterStatistics			Statistics;			// Driver wide counters
 	CFilterEntityCont			Entities;			// Inactive Entities
 	CFilterWiper				Wiper;
 };
@@ -360,7 +379,7 @@ public:
 	static bool				IsCached(FILE_OBJECT *file);
 	static bool				IsStackBased(FILE_OBJECT *file);
 
-	static NTSTATUS			ReadWrite(DEVICE_OBJECT *device, FILE_OBJECT *file, FILFILE_READ_WRITE const* readWrite);
+	static NTSTATUS			ReadWrite(DEVICE_OBJECT *device, FILE_OBJECT *file, FILFILE_READ_WRITE const* readWrite, ULONG *information = 0);
 	static NTSTATUS			ReadNonAligned(DEVICE_OBJECT *device, FILE_OBJECT *file, FILFILE_READ_WRITE const* target);
 	static NTSTATUS			WriteNonAligned(DEVICE_OBJECT *device, FILE_OBJECT *file, FILFILE_READ_WRITE const* source);
 	static NTSTATUS			ZeroData(DEVICE_OBJECT *device, FILE_OBJECT *file, LARGE_INTEGER *start, LARGE_INTEGER *end);
@@ -380,6 +399,7 @@ public:
 	static NTSTATUS			GetFileSize(DEVICE_OBJECT *device, FILE_OBJECT *file, LARGE_INTEGER *fileSize);
 	static NTSTATUS			SetFileSize(DEVICE_OBJECT *device, FILE_OBJECT* file, LARGE_INTEGER *fileSize);
 	static NTSTATUS			SetFileInfo(DEVICE_OBJECT *device, FILE_OBJECT* file, FILE_INFORMATION_CLASS fileInfo, void* buffer, ULONG bufferSize);
+	static NTSTATUS			FlushFile(DEVICE_OBJECT *device, FILE_OBJECT* file);
 	
 	static NTSTATUS			SimpleRename(DEVICE_OBJECT *device, FILE_OBJECT *file, LPCWSTR fileName, ULONG fileNameLength, BOOLEAN replace);
 	
@@ -393,6 +413,7 @@ public:
 	static NTSTATUS			GetMacAddress(UCHAR macAddr[6]);
 	static ULONG			Crc32(UCHAR const* buffer, ULONG bufferSize);
 	static ULONG			Hash(LPCWSTR path, ULONG pathLength);
+	static ULONG			HashChar(ULONG hash, WCHAR wc);
 
 							// DATA
 	static ULONG			s_timeoutKeyRequest;
@@ -410,6 +431,25 @@ ULONG CFilterBase::GetTicksFromSeconds(ULONG seconds)
 	return (ULONG) (SECONDS(seconds) / KeQueryTimeIncrement());
 }
 
+inline
+ULONG CFilterBase::HashChar(ULONG hash, WCHAR wc)
+{
+	// transform char to upcase
+	if(wc >= 'a')
+	{
+		if(wc <= 'z')
+		{
+			wc -= ('a' - 'A');
+		}
+		else
+		{
+			wc = RtlUpcaseUnicodeChar(wc);
+		}
+	}
+
+	return (hash << 6) - hash + wc;
+}
+
 inline
 NTSTATUS CFilterBase::SetFileSize(DEVICE_OBJECT *device, FILE_OBJECT* file, LARGE_INTEGER *fileSize)
 {
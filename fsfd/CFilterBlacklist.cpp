@@ -23,6 +23,8 @@ void CFilterBlackList::Close()
 {
 	PAGED_CODE();
 
+	CloseIndex();
+
 	if(m_entries)
 	{
 		ASSERT(m_size <= m_capacity);
@@ -48,10 +50,14 @@ ULONG CFilterBlackList::Check(CFilterPath const* path, bool simple)
 
 	PAGED_CODE();
 
-	bool found = false;
-
 	ASSERT(m_size <= m_capacity);
 
+	// Use compiled index, if any
+	if(!simple && m_index)
+	{
+		return Lookup(path);
+	}
+
 	for(ULONG pos = 0; pos < m_size; ++pos)
 	{
 		ASSERT(m_entries);
@@ -93,6 +99,9 @@ NTSTATUS CFilterBlackList::Add(CFilterPath *path)
 		return STATUS_OBJECT_NAME_COLLISION;
 	}
 
+	// Positions change, so the index is stale now
+	CloseIndex();
+
 	if(m_capacity == m_size)
 	{
 		ULONG const capacity = m_capacity + c_incrementCount;
@@ -152,6 +161,9 @@ NTSTATUS CFilterBlackList::Remove(CFilterPath const* path)
 	ASSERT(pos < m_size);
 	ASSERT(m_entries);
 
+	// Positions change, so the index is stale now
+	CloseIndex();
+
 	m_entries[pos].Close();
 
 	m_size--;
@@ -168,6 +180,334 @@ NTSTATUS CFilterBlackList::Remove(CFilterPath const* path)
 	return STATUS_SUCCESS;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterBlackList::CloseIndex()
+{
+	PAGED_CODE();
+
+	if(m_index)
+	{
+		ExFreePool(m_index);
+		m_index = 0;
+	}
+
+	m_indexDirectories = 0;
+	m_indexFiles	   = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterBlackList::SortSlots(CFilterBlackListSlot *slots, ULONG size)
+{
+	ASSERT(slots || !size);
+
+	PAGED_CODE();
+
+	// Shell sort, no recursion and lists are compiled rarely
+	for(ULONG gap = size / 2; gap; gap /= 2)
+	{
+		for(ULONG index = gap; index < size; ++index)
+		{
+			CFilterBlackListSlot const slot = slots[index];
+
+			ULONG pos = index;
+
+			for(; (pos >= gap) && (slots[pos - gap].m_hash > slot.m_hash); pos -= gap)
+			{
+				slots[pos] = slots[pos - gap];
+			}
+
+			slots[pos] = slot;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterBlackList::Compile()
+{
+	PAGED_CODE();
+
+	ASSERT(m_size <= m_capacity);
+
+	CloseIndex();
+
+	if(!m_size)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	ASSERT(m_entries);
+
+	CFilterBlackListSlot *const index = (CFilterBlackListSlot*) ExAllocatePool(PagedPool, m_size * sizeof(CFilterBlackListSlot));
+
+	if(!index)
+	{
+		// Check() falls back to sequential search
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	ULONG directories = 0;
+	ULONG files		  = 0;
+	ULONG others	  = 0;
+
+	// Count classes first
+	for(ULONG pos = 0; pos < m_size; ++pos)
+	{
+		CFilterPath const*const entry = m_entries + pos;
+
+		if(entry->m_flags & TRACK_WILDCARD)
+		{
+			others++;
+		}
+		else if(entry->m_directory)
+		{
+			directories++;
+		}
+		else if(entry->m_file)
+		{
+			files++;
+		}
+		else
+		{
+			others++;
+		}
+	}
+
+	ULONG dirPos   = 0;
+	ULONG filePos  = directories;
+	ULONG otherPos = directories + files;
+
+	for(ULONG pos = 0; pos < m_size; ++pos)
+	{
+		CFilterPath const*const entry = m_entries + pos;
+
+		CFilterBlackListSlot *slot = 0;
+
+		if(entry->m_flags & TRACK_WILDCARD)
+		{
+			slot = index + otherPos++;
+
+			slot->m_hash = 0;
+
+			ULONG const length = entry->m_fileLength / sizeof(WCHAR);
+
+			// Pure suffix pattern, like '*.tmp'?
+			if((length > 1) && (entry->m_file[0] == L'*'))
+			{
+				UNICODE_STRING suffix;
+				suffix.Length		 = (USHORT) (entry->m_fileLength - sizeof(WCHAR));
+				suffix.MaximumLength = suffix.Length;
+				suffix.Buffer		 = entry->m_file + 1;
+
+				if(!FsRtlDoesNameContainWildCards(&suffix))
+				{
+					slot->m_hash = length - 1;
+				}
+			}
+		}
+		else if(entry->m_directory)
+		{
+			ASSERT(entry->m_directoryLength);
+
+			slot = index + dirPos++;
+
+			slot->m_hash = CFilterBase::Hash(entry->m_directory, entry->m_directoryLength);
+		}
+		else if(entry->m_file)
+		{
+			ASSERT(entry->m_fileLength);
+
+			slot = index + filePos++;
+
+			slot->m_hash = CFilterBase::Hash(entry->m_file, entry->m_fileLength);
+		}
+		else
+		{
+			slot = index + otherPos++;
+
+			slot->m_hash = 0;
+		}
+
+		slot->m_pos = pos;
+	}
+
+	ASSERT(dirPos == directories);
+	ASSERT(filePos == directories + files);
+	ASSERT(otherPos == m_size);
+
+	SortSlots(index, directories);
+	SortSlots(index + directories, files);
+
+	m_index			   = index;
+	m_indexDirectories = directories;
+	m_indexFiles	   = directories + files;
+
+	return STATUS_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+ULONG CFilterBlackList::LookupSlot(ULONG hash, ULONG start, ULONG end, CFilterPath const* path)
+{
+	ASSERT(path);
+	ASSERT(m_index);
+	
+	PAGED_CODE();
+
+	ULONG const limit = end;
+
+	// Binary search for first slot with given hash
+	while(start < end)
+	{
+		ULONG const middle = (start + end) / 2;
+
+		if(m_index[middle].m_hash < hash)
+		{
+			start = middle + 1;
+		}
+		else
+		{
+			end = middle;
+		}
+	}
+
+	// Verify all candidates with equal hash values
+	for(; start < limit; ++start)
+	{
+		if(m_index[start].m_hash != hash)
+		{
+			break;
+		}
+
+		ULONG const pos = m_index[start].m_pos;
+		ASSERT(pos < m_size);
+
+		if(m_entries[pos].MatchSpecial(path))
+		{
+			return pos;
+		}
+	}
+
+	return ~0u;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+ULONG CFilterBlackList::Lookup(CFilterPath const* path)
+{
+	ASSERT(path);
+	ASSERT(m_index);
+
+	PAGED_CODE();
+
+	ULONG pos = ~0u;
+
+	// Directory entries match on each directory component boundary of the candidate, so hash 
+	// candidate's path incrementally and lookup each prefix, starting with the root directory
+	if(m_indexDirectories && path->m_directory)
+	{
+		LPCWSTR const directory = path->m_directory;
+		ULONG const	  length	= path->m_directoryLength / sizeof(WCHAR);
+
+		ULONG hash = 0;
+
+		for(ULONG index = 0; index < length; ++index)
+		{
+			if(index && (directory[index] == L'\\'))
+			{
+				pos = LookupSlot(hash, 0, m_indexDirectories, path);
+
+				if(~0u != pos)
+				{
+					return pos;
+				}
+			}
+
+			hash = CFilterBase::HashChar(hash, directory[index]);
+
+			// Root directory?
+			if(!index)
+			{
+				pos = LookupSlot(hash, 0, m_indexDirectories, path);
+
+				if(~0u != pos)
+				{
+					return pos;
+				}
+			}
+		}
+
+		// Whole directory
+		if(length > 1)
+		{
+			pos = LookupSlot(hash, 0, m_indexDirectories, path);
+
+			if(~0u != pos)
+			{
+				return pos;
+			}
+		}
+	}
+
+	if(path->m_file)
+	{
+		ASSERT(path->m_fileLength);
+
+		// Plain file entries
+		if(m_indexFiles > m_indexDirectories)
+		{
+			pos = LookupSlot(CFilterBase::Hash(path->m_file, path->m_fileLength), m_indexDirectories, m_indexFiles, path);
+
+			if(~0u != pos)
+			{
+				return pos;
+			}
+		}
+	}
+
+	// Wildcards and the like
+	for(ULONG index = m_indexFiles; index < m_size; ++index)
+	{
+		CFilterBlackListSlot const*const slot = m_index + index;
+
+		CFilterPath const*const entry = m_entries + slot->m_pos;
+
+		// Suffix pattern?
+		if(slot->m_hash)
+		{
+			ASSERT(entry->m_flags & TRACK_WILDCARD);
+
+			ULONG const length = path->m_fileLength / sizeof(WCHAR);
+
+			if(path->m_file && (length >= slot->m_hash))
+			{
+				if(!_wcsnicmp(path->m_file + (length - slot->m_hash), entry->m_file + 1, slot->m_hash))
+				{
+					return slot->m_pos;
+				}
+			}
+		}
+		else if(entry->MatchSpecial(path))
+		{
+			return slot->m_pos;
+		}
+	}
+
+	return ~0u;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
@@ -612,6 +952,14 @@ NTSTATUS CFilterBlackListDisp::Set(LPCWSTR buffer, ULONG bufferSize, ULONG flags
 		Clear();
 	}
 
+	// Rebuild indices of changed lists, Check() works without them anyway
+	m_generic.Compile();
+
+	for(ULONG pos = 0; pos < m_size; ++pos)
+	{
+		m_custom[pos].Compile();
+	}
+
 	ExReleaseResourceLite(&m_lock);
 	FsRtlExitFileSystem();
 
@@ -621,3 +969,304 @@ NTSTATUS CFilterBlackListDisp::Set(LPCWSTR buffer, ULONG bufferSize, ULONG flags
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Differential test of the compiled index against the sequential scan, on generic entries of all
+ * kinds and candidates built the way PreCreate builds them. Then both are timed on a large list.
+ */
+static LPCWSTR TestWiden(char const* text, WCHAR *buffer)
+{
+	ULONG pos = 0;
+
+	for(; text[pos]; ++pos)
+	{
+		buffer[pos] = (WCHAR) text[pos];
+	}
+
+	buffer[pos] = UNICODE_NULL;
+
+	return buffer;
+}
+
+static char const* TestNarrow(LPCWSTR volume, LPCWSTR directory, LPCWSTR file)
+{
+	static char buffer[256];
+
+	LPCWSTR const parts[3] = { volume, directory, file };
+
+	ULONG pos = 0;
+
+	for(ULONG part = 0; part < 3; ++part)
+	{
+		for(LPCWSTR wc = parts[part]; *wc && (pos < sizeof(buffer) - 1); ++wc)
+		{
+			buffer[pos++] = (char) *wc;
+		}
+	}
+
+	buffer[pos] = 0;
+
+	return buffer;
+}
+
+static bool TestEntry(CFilterBlackList *compiled, CFilterBlackList *sequential, LPCWSTR path)
+{
+	CFilterBlackList *const lists[2] = { compiled, sequential };
+
+	for(ULONG list = 0; list < 2; ++list)
+	{
+		CFilterPath entry;
+
+		if(NT_ERROR(entry.InitClient(path, (ULONG) wcslen(path) * sizeof(WCHAR), CFilterPath::PATH_DEEPNESS)))
+		{
+			return false;
+		}
+
+		// As CFilterBlackListDisp::Manage() does
+		if(!entry.m_volume && !entry.m_directory && entry.m_file)
+		{
+			UNICODE_STRING ustr = {0,0,0};
+			entry.UnicodeString(&ustr);
+
+			if(FsRtlDoesNameContainWildCards(&ustr))
+			{
+				entry.m_flags |= TRACK_WILDCARD;
+			}
+		}
+
+		NTSTATUS const status = lists[list]->Add(&entry);
+
+		entry.Close();
+
+		if(NT_ERROR(status))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool TestCandidate(CFilterPath *candidate, LPCWSTR volume, LPCWSTR directory, LPCWSTR file)
+{
+	WCHAR path[256];
+
+	wcscpy(path, directory);
+	wcscat(path, file);
+
+	UNICODE_STRING device;
+	RtlInitUnicodeString(&device, volume);
+
+	if(NT_ERROR(candidate->Init(path, (ULONG) wcslen(path) * sizeof(WCHAR), FILFILE_DEVICE_VOLUME, &device)))
+	{
+		return false;
+	}
+
+	// As known after the create went down
+	return NT_SUCCESS(candidate->SetType(*file ? TRACK_TYPE_FILE : TRACK_TYPE_DIRECTORY));
+}
+
+static double TestTime(CFilterBlackList *list, CFilterPath *candidates, ULONG count, ULONG rounds)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	ULONG matched = 0;
+
+	for(ULONG round = 0; round < rounds; ++round)
+	{
+		for(ULONG pos = 0; pos < count; ++pos)
+		{
+			matched += (~0u != list->Check(candidates + pos));
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double const ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	return (matched == ~0u) ? 0 : ns / ((double) rounds * count);
+}
+
+int main(void)
+{
+	static LPCWSTR const entries[] =
+	{
+		L"\\Windows\\",
+		L"\\Program Files\\Common Files\\",
+		L"\\Device\\HarddiskVolume1\\Temp\\",
+		L"\\Users\\a\\note.txt",
+		L"desktop.ini",
+		L"thumbs.db",
+		L"*.tmp",
+		L"*.bak",
+		L"~$*",
+		L"*.d?c",
+	};
+
+	static LPCWSTR const volumes[] =
+	{
+		L"\\Device\\HarddiskVolume1",
+		L"\\Device\\HarddiskVolume2",
+	};
+
+	static LPCWSTR const directories[] =
+	{
+		L"\\", L"\\Windows\\", L"\\windows\\System32\\", L"\\WindowsOld\\", L"\\Temp\\", L"\\Temp\\x\\", L"\\Tem\\",
+		L"\\Program Files\\", L"\\Program Files\\Common Files\\y\\", L"\\Users\\a\\", L"\\Users\\ab\\", L"\\a\\Windows\\",
+		L"\\dir17\\", L"\\dir17x\\", L"\\a\\dir17\\", L"\\dir299\\deep\\er\\",
+	};
+
+	static LPCWSTR const files[] =
+	{
+		L"desktop.ini", L"DESKTOP.INI", L"desktop.ini2", L"a.tmp", L"tmp", L".tmp", L"~$doc.docx", L"x~$", L"note.txt",
+		L"file5.dat", L"file5.da", L"x.bak", L"y.doc", L"y.docx", L"z",
+	};
+
+	CSimKernel::Init();
+
+	CFilterBlackList compiled, sequential;
+
+	compiled.Init();
+	sequential.Init();
+
+	int failed = 0;
+
+	for(ULONG pos = 0; pos < sizeof(entries) / sizeof(entries[0]); ++pos)
+	{
+		failed += !TestEntry(&compiled, &sequential, entries[pos]);
+	}
+
+	// Enough plain directory and file entries for the index to matter
+	for(ULONG pos = 0; pos < 300; ++pos)
+	{
+		char  text[32];
+		WCHAR entry[32];
+
+		sprintf(text, "\\dir%u\\", pos);
+		failed += !TestEntry(&compiled, &sequential, TestWiden(text, entry));
+
+		sprintf(text, "file%u.dat", pos);
+		failed += !TestEntry(&compiled, &sequential, TestWiden(text, entry));
+	}
+
+	if(NT_ERROR(compiled.Compile()))
+	{
+		failed++;
+	}
+
+	ULONG const count = sizeof(volumes) / sizeof(volumes[0]) * sizeof(directories) / sizeof(directories[0]) * (sizeof(files) / sizeof(files[0]) + 1);
+
+	CFilterPath *const candidates = (CFilterPath*) calloc(count, sizeof(CFilterPath));
+
+	ULONG current = 0;
+	ULONG matches = 0;
+
+	for(ULONG volume = 0; volume < sizeof(volumes) / sizeof(volumes[0]); ++volume)
+	{
+		for(ULONG directory = 0; directory < sizeof(directories) / sizeof(directories[0]); ++directory)
+		{
+			for(ULONG file = 0; file <= sizeof(files) / sizeof(files[0]); ++file)
+			{
+				CFilterPath *const candidate = candidates + current++;
+
+				if(!TestCandidate(candidate, volumes[volume], directories[directory], (file < sizeof(files) / sizeof(files[0])) ? files[file] : L""))
+				{
+					printf("ERROR ON CANDIDATE %s\n", TestNarrow(volumes[volume], directories[directory], L""));
+					failed++;
+					continue;
+				}
+
+				ULONG const indexed = compiled.Check(candidate);
+				ULONG const scanned = sequential.Check(candidate);
+
+				// Both may find different entries, but must agree on whether there is one
+				if(((~0u == indexed) != (~0u == scanned)) || ((~0u != indexed) && !compiled.Entries()[indexed].MatchSpecial(candidate)))
+				{
+					printf("ERROR ON MATCH %s indexed[%d] sequential[%d]\n",
+						   TestNarrow(volumes[volume], directories[directory], (file < sizeof(files) / sizeof(files[0])) ? files[file] : L""), (int) indexed, (int) scanned);
+					failed++;
+				}
+
+				matches += (~0u != scanned);
+			}
+		}
+	}
+
+	// Some known answers
+	CFilterPath probe;
+
+	struct
+	{
+		LPCWSTR		Volume;
+		LPCWSTR		Directory;
+		LPCWSTR		File;
+		bool		Match;
+	}
+	const answers[] =
+	{
+		{ L"\\Device\\HarddiskVolume2", L"\\windows\\System32\\",	L"z",			true	},
+		{ L"\\Device\\HarddiskVolume2", L"\\WindowsOld\\",			L"z",			false	},
+		{ L"\\Device\\HarddiskVolume1", L"\\Temp\\x\\",				L"z",			true	},
+		{ L"\\Device\\HarddiskVolume2", L"\\Temp\\x\\",				L"z",			false	},
+		{ L"\\Device\\HarddiskVolume2", L"\\Users\\ab\\",			L"note.txt",	false	},
+		{ L"\\Device\\HarddiskVolume2", L"\\Users\\a\\",			L"note.txt",	true	},
+		{ L"\\Device\\HarddiskVolume2", L"\\",						L".tmp",		true	},
+		{ L"\\Device\\HarddiskVolume2", L"\\",						L"tmp",			false	},
+		{ L"\\Device\\HarddiskVolume2", L"\\a\\dir17\\",			L"z",			false	},
+		{ L"\\Device\\HarddiskVolume2", L"\\dir299\\deep\\er\\",	L"z",			true	},
+		{ L"\\Device\\HarddiskVolume2", L"\\",						L"y.doc",		true	},
+		{ L"\\Device\\HarddiskVolume2", L"\\",						L"y.docx",		false	},
+	};
+
+	for(ULONG pos = 0; pos < sizeof(answers) / sizeof(answers[0]); ++pos)
+	{
+		RtlZeroMemory(&probe, sizeof(probe));
+
+		if(!TestCandidate(&probe, answers[pos].Volume, answers[pos].Directory, answers[pos].File) ||
+		   ((~0u != compiled.Check(&probe)) != answers[pos].Match))
+		{
+			printf("ERROR ON ANSWER %s\n", TestNarrow(answers[pos].Volume, answers[pos].Directory, answers[pos].File));
+			failed++;
+		}
+
+		probe.Close();
+	}
+
+	printf("%u candidates, %u matched, %u entries\n", count, matches, compiled.Size());
+
+	double const indexed = TestTime(&compiled, candidates, count, 200);
+	double const scanned = TestTime(&sequential, candidates, count, 200);
+
+	printf("Check() indexed %.0f ns, sequential %.0f ns\n", indexed, scanned);
+
+	for(ULONG pos = 0; pos < count; ++pos)
+	{
+		candidates[pos].Close();
+	}
+
+	free(candidates);
+
+	compiled.Close();
+	sequential.Close();
+
+	if(CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimKernel::Statistics().Outstanding);
+		failed++;
+	}
+
+	CSimKernel::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
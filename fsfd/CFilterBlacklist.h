@@ -19,6 +19,12 @@ class CFilterBlackList
 {
 	enum c_constants			{ c_incrementCount = 4 };
 
+	struct CFilterBlackListSlot
+	{
+		ULONG					m_hash;		// Directory or File hash, Suffix length for Wildcards
+		ULONG					m_pos;		// Entry position
+	};
+
 public:
 
 	NTSTATUS					Init(LUID const* luid = 0);
@@ -31,14 +37,27 @@ public:
 	NTSTATUS					Add(CFilterPath *path);
 	NTSTATUS					Remove(CFilterPath const* path);
 
+	NTSTATUS					Compile();
+
 	CFilterPath const*			Entries() const;
 
 private:
 
+	ULONG						Lookup(CFilterPath const* path);
+	ULONG						LookupSlot(ULONG hash, ULONG start, ULONG end, CFilterPath const* path);
+	void						CloseIndex();
+
+	static void					SortSlots(CFilterBlackListSlot *slots, ULONG size);
+
 	CFilterPath*				m_entries;
 	ULONG						m_size;
 	ULONG						m_capacity;
 
+								// Compiled index: [Directories | Files | Others], first two sorted by hash
+	CFilterBlackListSlot*		m_index;
+	ULONG						m_indexDirectories;
+	ULONG						m_indexFiles;
+
 	LUID						m_luid;
 };
 
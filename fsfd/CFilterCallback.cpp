@@ -12,6 +12,7 @@
 #include "CFilterBase.h"
 #include "IoControl.h"
 #include "CFilterControl.h"
+#include "CFilterContext.h"
 
 #include "CFilterCallback.h"
 
@@ -32,9 +33,13 @@ NTSTATUS CFilterCallback::Init(LUID const* luid)
 	ExInitializeFastMutex(&m_lock);
 
 	KeInitializeEvent(&m_randomReady, SynchronizationEvent, false);
-	KeInitializeEvent(&m_keyReady,    SynchronizationEvent, false);
 	KeInitializeEvent(&m_notifyReady, SynchronizationEvent, false);
 
+	InitializeListHead(&m_keyQueue);
+
+	KeInitializeEvent(&m_workerStop, NotificationEvent, false);
+	KeInitializeEvent(&m_workerKick, SynchronizationEvent, false);
+
 	return STATUS_SUCCESS;
 }
 
@@ -85,25 +90,22 @@ void CFilterCallback::Close(bool wake)
 	m_notifySize = 0;
 	m_notifyFlags  = 0;
 
-	if(m_keyPath)
+	// Fail all key requests, their waiters hold own references
+	while(!IsListEmpty(&m_keyQueue))
 	{
-		ExFreePool(m_keyPath);
-		m_keyPath = 0;
+		KeyComplete(CONTAINING_RECORD(m_keyQueue.Flink, CFilterKeyRequest, m_link), STATUS_DEVICE_NOT_CONNECTED);
 	}
-	m_keyPathLength	 = 0;
 
-	m_keyCookie		 = 0;
-	m_keyPayload	 = 0;
-	m_keyPayloadSize = 0;
-
-	m_key.Clear();
+	m_keyCookie = 0;
 
 	ExReleaseFastMutex(&m_lock);
 
+	// Nothing left to time out
+	WorkerStop();
+
 	if(wake)
 	{
 		// wake up potentially waiting threads
-		KeSetEvent(&m_keyReady,    EVENT_INCREMENT, false);
 		KeSetEvent(&m_randomReady, EVENT_INCREMENT, false);
 		KeSetEvent(&m_notifyReady, EVENT_INCREMENT, false);
 
@@ -392,871 +394,2129 @@ NTSTATUS CFilterCallback::FireRandom(ULONG flags, UCHAR **random, ULONG *randomS
 
 #pragma PAGEDCODE
 
-NTSTATUS CFilterCallback::FireKey(ULONG flags, FILFILE_TRACK_CONTEXT *track)
+NTSTATUS CFilterCallback::FireKey(ULONG flags, FILFILE_TRACK_CONTEXT *track, IRP *irp)
+{
+	ASSERT(track);
+
+	PAGED_CODE();
+
+	KEVENT done;
+	KeInitializeEvent(&done, NotificationEvent, false);
+
+	CFilterKeyWaiter waiter;
+	RtlZeroMemory(&waiter, sizeof(waiter));
+
+	waiter.m_irp  = irp;
+	waiter.m_done = &done;
+
+	NTSTATUS status = PendKey(flags, track, &waiter);
+
+	if(STATUS_PENDING == status)
+	{
+		// Woken by completion, cancellation or the worker timing the request out
+		KeWaitForSingleObject(&done, Executive, KernelMode, false, 0);
+
+		LeaveKey(&waiter);
+
+		status = TakeKey(&waiter, track);
+	}
+
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallback::PendKey(ULONG flags, FILFILE_TRACK_CONTEXT *track, CFilterKeyWaiter *waiter)
 {
 	ASSERT(track);
+	ASSERT(waiter);
+	ASSERT(waiter->m_done || waiter->m_item.WorkerRoutine);
 
 	PAGED_CODE();
 		
 	ASSERT(track->Header.m_payload);
 	ASSERT(track->Header.m_payloadSize);
 
+	waiter->m_request = 0;
+	waiter->m_status  = STATUS_PENDING;
+
 	// Valid trigger?
 	if(!m_keyTrigger)
 	{
 		return STATUS_DEVICE_NOT_CONNECTED;
 	}
 
+	// use correct Deepness
+	track->Entity.m_deepness = track->Header.m_deepness;
+
+	bool start = false;
+
 	ExAcquireFastMutex(&m_lock);
 
-	// Another key request underway?
-	if(m_keyPath)
+	NTSTATUS status = STATUS_DEVICE_NOT_CONNECTED;
+
+	if(m_keyTrigger)
 	{
-		ASSERT(m_keyPayload);
-		ASSERT(m_keyPayloadSize);
+		// Join outstanding request for same Header or queue new one
+		status = KeyJoin(flags, track, waiter, &start);
+	}
 
-		DBGPRINT(("FireKey: Another key request is underway\n"));
+	ExReleaseFastMutex(&m_lock);
 
-		ExReleaseFastMutex(&m_lock);
+	if(start)
+	{
+		WorkerStart();
+	}
 
-		return STATUS_ALERTED;
+	// STATUS_DEVICE_BUSY is no error status
+	if(STATUS_PENDING != status)
+	{
+		DBGPRINT(("FireKey -ERROR: join failed [0x%x]\n", status));
 	}
 
-	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	return status;
+}
 
-	// use correct Deepness
-	track->Entity.m_deepness = track->Header.m_deepness;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterCallback::LeaveKey(CFilterKeyWaiter *waiter)
+{
+	ASSERT(waiter);
 
-	// defaults to file type
-	ULONG save = CFilterPath::PATH_PREFIX  | CFilterPath::PATH_VOLUME | CFilterPath::PATH_FILE;
+	PAGED_CODE();
 
-	if(flags & FILFILE_CONTROL_DIRECTORY)
+	if(!waiter->m_request || (STATUS_CANCELLED != waiter->m_status))
 	{
-		save = CFilterPath::PATH_PREFIX | CFilterPath::PATH_VOLUME | CFilterPath::PATH_DEEPNESS;
+		return;
 	}
-	
-	// Save Cipher algo and mode
-	m_key.m_cipher = track->Header.m_key.m_cipher;
 
-	// provide Path, Header and Payload
-	m_keyPath		 = track->Entity.CopyTo(save, &m_keyPathLength);
-	m_keyPayload	 = track->Header.m_payload;
-	m_keyPayloadSize = track->Header.m_payloadSize;
+	ExAcquireFastMutex(&m_lock);
 
-	DBGPRINT(("FireKey: Cookie[0x%x] Path[%ws] Payload[0x%x]\n", m_keyCookie, m_keyPath, m_keyPayloadSize));
+	CFilterKeyRequest *const request = waiter->m_request;
 
-	KeClearEvent(&m_keyReady);
-	// wake client
-	KeSetEvent(m_keyTrigger, EVENT_INCREMENT, false);
+	// Nobody waits any longer for a request the client has not seen yet?
+	if((STATUS_PENDING == request->m_status) && !request->m_waiters && !request->m_cookie)
+	{
+		KeyComplete(request, STATUS_CANCELLED);
+	}
 
 	ExReleaseFastMutex(&m_lock);
-	
-	LARGE_INTEGER timeout;
-	timeout.QuadPart = RELATIVE(SECONDS(CFilterBase::s_timeoutKeyRequest));
+}
 
-	// wait for response or time out
-	NTSTATUS const wait = KeWaitForSingleObject(&m_keyReady, Executive, KernelMode, false, &timeout);
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	ExAcquireFastMutex(&m_lock);
+#pragma PAGEDCODE
 
-	if(STATUS_SUCCESS == wait)
-	{
-		DBGPRINT(("FireKey: response received, Cookie[0x%x]\n", m_keyCookie));
+NTSTATUS CFilterCallback::TakeKey(CFilterKeyWaiter *waiter, FILFILE_TRACK_CONTEXT *track)
+{
+	ASSERT(waiter);
+	ASSERT(track);
+	ASSERT(STATUS_PENDING != waiter->m_status);
 
-		// valid data ?
-		if(m_key.m_size)
+	PAGED_CODE();
+
+	NTSTATUS const status = waiter->m_status;
+
+	CFilterKeyRequest *const request = waiter->m_request;
+
+	if(request)
+	{
+		if(NT_SUCCESS(status))
 		{
-			ASSERT(m_key.m_cipher);
+			ASSERT(request->m_key.m_size);
+			ASSERT(request->m_key.m_cipher);
 
 			// copy key
-			track->EntityKey = m_key;
+			track->EntityKey = request->m_key;
+		}
 
-			m_key.Clear();
+		waiter->m_request = 0;
 
-			status = STATUS_SUCCESS;
-		}
+		KeyRelease(request);
 	}
-	else
+
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallback::KeyJoin(ULONG flags, FILFILE_TRACK_CONTEXT *track, CFilterKeyWaiter *waiter, bool *start)
+{
+	ASSERT(track);
+	ASSERT(waiter);
+	ASSERT(start);
+
+	PAGED_CODE();
+
+	// Caller holds m_lock
+
+	CFilterKeyRequest *request = 0;
+
+	// Request for same Header already queued or underway?
+	for(LIST_ENTRY *entry = m_keyQueue.Flink; entry != &m_keyQueue; entry = entry->Flink)
 	{
-		DBGPRINT(("FireKey -WARN: timed out, Cookie[0x%x]\n", m_keyCookie));
+		CFilterKeyRequest *const candidate = CONTAINING_RECORD(entry, CFilterKeyRequest, m_link);
+		ASSERT(candidate);
 
-		KeClearEvent(m_keyTrigger);
+		if((candidate->m_flags == flags) && 
+		   (candidate->m_payloadCrc == track->Header.m_payloadCrc) && 
+		   (candidate->m_payloadSize == track->Header.m_payloadSize))
+		{
+			if(RtlEqualMemory(candidate->m_payload, track->Header.m_payload, candidate->m_payloadSize))
+			{
+				if(candidate->m_waiters >= c_keyWaitersMax)
+				{
+					return STATUS_DEVICE_BUSY;
+				}
+
+				DBGPRINT(("FireKey: join Cookie[0x%x] Waiters[%d]\n", candidate->m_cookie, candidate->m_waiters));
+
+				request = candidate;
+				break;
+			}
+		}
 	}
 
-	// if we awakened due to a disconnect, do not increment cookie
-	if(m_keyCookie)
+	if(!request)
 	{
-		// increment Cookie
-		m_keyCookie++;
+		// Fail fast rather than holding ever more creates
+		if(m_keyQueued >= c_keyQueueMax)
+		{
+			return STATUS_DEVICE_BUSY;
+		}
+
+		ULONG const payloadSize = track->Header.m_payloadSize;
 
-		// wraped ?
-		if(!m_keyCookie)
+		request = (CFilterKeyRequest*) ExAllocatePool(NonPagedPool, sizeof(CFilterKeyRequest) + payloadSize);
+
+		if(!request)
 		{
-			m_keyCookie = 1;
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		RtlZeroMemory(request, sizeof(CFilterKeyRequest));
+
+		// defaults to file type
+		ULONG save = CFilterPath::PATH_PREFIX  | CFilterPath::PATH_VOLUME | CFilterPath::PATH_FILE;
+
+		if(flags & FILFILE_CONTROL_DIRECTORY)
+		{
+			save = CFilterPath::PATH_PREFIX | CFilterPath::PATH_VOLUME | CFilterPath::PATH_DEEPNESS;
+		}
+
+		request->m_path = track->Entity.CopyTo(save, &request->m_pathLength);
+
+		if(!request->m_path)
+		{
+			ExFreePool(request);
+
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		// copy Payload, as the originating create may leave before others
+		request->m_payload = (UCHAR*) (request + 1);
+		RtlCopyMemory(request->m_payload, track->Header.m_payload, payloadSize);
+
+		request->m_payloadSize = payloadSize;
+		request->m_payloadCrc  = track->Header.m_payloadCrc;
+		request->m_flags	   = flags;
+		request->m_status	   = STATUS_PENDING;
+
+		// Save Cipher algo and mode
+		request->m_key.m_cipher = track->Header.m_key.m_cipher;
+
+		// referenced by queue
+		request->m_refCount = 1;
+
+		InitializeListHead(&request->m_pended);
+
+		LARGE_INTEGER tick;
+		KeQueryTickCount(&tick);
+
+		request->m_tick = tick.LowPart;
+
+		InsertTailList(&m_keyQueue, &request->m_link);
+		m_keyQueued++;
+
+		// Someone has to time out what the client does not answer
+		if(!m_workerActive)
+		{
+			m_workerActive = true;
+			*start		   = true;
 		}
 	}
 
-	// clear path
-	if(m_keyPath)
+	InterlockedIncrement(&request->m_waiters);
+	InterlockedIncrement(&request->m_refCount);
+
+	waiter->m_request = request;
+
+	// Hand to client, if first
+	KeyFire();
+
+	// Cancelled already?
+	if(!KeyAttach(waiter))
 	{
-		ExFreePool(m_keyPath);
-		m_keyPath = 0;
-	}
-	m_keyPathLength  = 0;
+		DBGPRINT(("FireKey: cancelled, Cookie[0x%x]\n", request->m_cookie));
 
-	m_keyPayload     = 0;
-	m_keyPayloadSize = 0;
+		InterlockedDecrement(&request->m_waiters);
 
-	ExReleaseFastMutex(&m_lock);
+		// Nobody waits any longer for a request the client has not seen yet?
+		if(!request->m_waiters && !request->m_cookie)
+		{
+			KeyComplete(request, STATUS_CANCELLED);
+		}
 
-	return status;
+		waiter->m_request = 0;
+
+		KeyRelease(request);
+
+		return STATUS_CANCELLED;
+	}
+
+	return STATUS_PENDING;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #pragma PAGEDCODE
 
-NTSTATUS CFilterCallback::RequestKey(ULONG flags, FILFILE_CONTROL_OUT *request, ULONG *requestSize)
+void CFilterCallback::KeyFire()
 {
-	ASSERT(request);
-	ASSERT(requestSize);
-
 	PAGED_CODE();
 
-	NTSTATUS status = STATUS_UNSUCCESSFUL;
-#ifdef _NET_SHARE
+	// Caller holds m_lock
 
-	// Key request:
-	if(m_keyCookie && m_keyPayload && m_keyPath)
-#else
-	if(m_keyCookie && m_keyPath)
-#endif
+	if(!m_keyTrigger || IsListEmpty(&m_keyQueue))
 	{
-		ASSERT(m_keyPathLength);
-		ASSERT(m_keyPayloadSize);
+		return;
+	}
 
-		ULONG const size = sizeof(FILFILE_CONTROL_OUT) + m_keyPathLength + m_keyPayloadSize;
+	CFilterKeyRequest *const request = CONTAINING_RECORD(m_keyQueue.Flink, CFilterKeyRequest, m_link);
+	ASSERT(request);
 
-		DBGPRINT(("RequestKey: ReqSize[0x%x] Size[0x%x] Cookie[0x%x]\n", *requestSize, size, m_keyCookie));
+	// Already handed to client?
+	if(request->m_cookie)
+	{
+		return;
+	}
 
-		status = STATUS_BUFFER_TOO_SMALL;
+	// Left by all its creates while queued? Drop it, which fires the next one
+	if(!request->m_waiters)
+	{
+		KeyComplete(request, STATUS_CANCELLED);
 
-		if(*requestSize >= size)
-		{
-			RtlZeroMemory(request, size);
+		return;
+	}
 
-			request->Flags		 = FILFILE_CONTROL_AUTOCONF;
-			request->Value		 = m_keyCookie,
-			request->PathSize	 = m_keyPathLength;
-			request->PayloadSize = m_keyPayloadSize;
+	ASSERT(m_keyCookie);
 
-			ULONG offset = sizeof(FILFILE_CONTROL_OUT);
-			
-			// copy Path into UserBuffer
-			RtlCopyMemory((UCHAR*) request + offset, m_keyPath, m_keyPathLength);
-			offset += m_keyPathLength;
+	request->m_cookie = m_keyCookie;
 
-			// copy Payload
-			RtlCopyMemory((UCHAR*) request + offset, m_keyPayload, m_keyPayloadSize);
+	// increment Cookie
+	m_keyCookie++;
 
-			*requestSize = size;
+	// wraped ?
+	if(!m_keyCookie)
+	{
+		m_keyCookie = 1;
+	}
 
-			status = STATUS_SUCCESS;
-		}
+	// Timeout starts now
+	LARGE_INTEGER tick;
+	KeQueryTickCount(&tick);
+
+	request->m_tick = tick.LowPart;
+
+	DBGPRINT(("FireKey: Cookie[0x%x] Path[%ws] Payload[0x%x]\n", request->m_cookie, request->m_path, request->m_payloadSize));
+
+	// Worker has to wake up earlier now
+	if(m_workerActive)
+	{
+		KeSetEvent(&m_workerKick, EVENT_INCREMENT, false);
 	}
 
-	return status;
+	// wake client
+	KeSetEvent(m_keyTrigger, EVENT_INCREMENT, false);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #pragma PAGEDCODE
 
-NTSTATUS CFilterCallback::RequestNotify(ULONG flags, FILFILE_CONTROL_OUT *request, ULONG *requestSize)
+void CFilterCallback::KeyComplete(CFilterKeyRequest *request, NTSTATUS status)
 {
 	ASSERT(request);
-	ASSERT(requestSize);
+	ASSERT(STATUS_PENDING == request->m_status);
+	ASSERT(STATUS_PENDING != status);
 
 	PAGED_CODE();
 
-	NTSTATUS status = STATUS_UNSUCCESSFUL;
-	if(m_notify)
+	// Caller holds m_lock
+
+	bool const head = (m_keyQueue.Flink == &request->m_link);
+
+	RemoveEntryList(&request->m_link);
+
+	ASSERT(m_keyQueued);
+	m_keyQueued--;
+
+	request->m_status = status;
+
+	LIST_ENTRY woken;
+	InitializeListHead(&woken);
+
+	KeyDetach(request, &woken);
+
+	// wake all joined creates, they hold own references
+	while(!IsListEmpty(&woken))
 	{
-		ExFreePool(m_notify);
-		m_notify=0;
-		m_notifySize=0;
+		CFilterKeyWaiter *const waiter = CONTAINING_RECORD(RemoveHeadList(&woken), CFilterKeyWaiter, m_link);
+		ASSERT(waiter);
+
+		waiter->m_status = status;
+
+		KeyNotify(waiter);
 	}
 
-	ULONG const size = sizeof(FILFILE_CONTROL_OUT) + m_notifySize;
+	// drop reference of queue
+	KeyRelease(request);
 
-	if(*requestSize >= size)
+	if(head)
 	{
-		m_notifySize=request->PathSize;
-		m_notify=(UCHAR*)ExAllocatePool(NonPagedPool,m_notifySize);
+		KeyFire();
+	}
+}
 
-		if (m_notify)
-		{
-			RtlZeroMemory(m_notify, (*requestSize-size));
-			DBGPRINT(("RequestNotify: ReqSize[0x%x]\n", *requestSize));
-			status = STATUS_BUFFER_TOO_SMALL;			
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-			//request->Flags	  = m_notifyFlags;
-			// copy Path into UserBuffer
-			RtlCopyMemory((UCHAR*) request + sizeof(FILFILE_CONTROL_OUT), m_notify, m_notifySize);
-			status = STATUS_SUCCESS;
-		}
-		else
+#pragma LOCKEDCODE
+
+bool CFilterCallback::KeyAttach(CFilterKeyWaiter *waiter)
+{
+	ASSERT(waiter);
+	ASSERT(waiter->m_request);
+
+	KIRQL irql;
+	IoAcquireCancelSpinLock(&irql);
+
+	IRP *const irp = waiter->m_irp;
+
+	if(irp)
+	{
+		if(irp->Cancel)
 		{
-			m_notifySize=0;
+			IoReleaseCancelSpinLock(irql);
+
+			return false;
 		}
+
+		irp->Tail.Overlay.DriverContext[0] = waiter;
+
+		IoSetCancelRoutine(irp, KeyCancel);
 	}
-	//}
 
-	return status;
+	InsertTailList(&waiter->m_request->m_pended, &waiter->m_link);
+
+	IoReleaseCancelSpinLock(irql);
+
+	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#pragma PAGEDCODE
+#pragma LOCKEDCODE
 
-NTSTATUS CFilterCallback::Request(ULONG flags, FILFILE_CONTROL_OUT *request, ULONG *requestSize)
+void CFilterCallback::KeyDetach(CFilterKeyRequest *request, LIST_ENTRY *woken)
 {
-	PAGED_CODE();
+	ASSERT(request);
+	ASSERT(woken);
 
-	NTSTATUS status = STATUS_INVALID_PARAMETER;
+	KIRQL irql;
+	IoAcquireCancelSpinLock(&irql);
 
-	if(request && requestSize)
+	LIST_ENTRY *entry = request->m_pended.Flink;
+
+	while(entry != &request->m_pended)
 	{
-		ExAcquireFastMutex(&m_lock);
+		CFilterKeyWaiter *const waiter = CONTAINING_RECORD(entry, CFilterKeyWaiter, m_link);
+		ASSERT(waiter);
 
-		__try
-		{
-			// dispatch accordingly
-			if(flags & FILFILE_CONTROL_NOTIFY)
-			{
-				status = RequestNotify(flags, request, requestSize);
-			}
-			else if(flags & FILFILE_CONTROL_AUTOCONF) 
-			{	
-				status = RequestKey(flags, request, requestSize);
-			}
-		}
-		__except(EXCEPTION_EXECUTE_HANDLER)
+		entry = entry->Flink;
+
+		// Being cancelled? Then its cancel routine unlinks and wakes it
+		if(waiter->m_irp && !IoSetCancelRoutine(waiter->m_irp, 0))
 		{
-			status = STATUS_INVALID_USER_BUFFER;
+			continue;
 		}
 
-		ExReleaseFastMutex(&m_lock);
+		RemoveEntryList(&waiter->m_link);
+		InsertTailList(woken, &waiter->m_link);
 	}
 
-	return status;
+	IoReleaseCancelSpinLock(irql);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#pragma PAGEDCODE
+#pragma LOCKEDCODE
 
-NTSTATUS CFilterCallback::Response(ULONG cookie, UCHAR *response, ULONG responseSize)
+void CFilterCallback::KeyNotify(CFilterKeyWaiter *waiter)
 {
-	PAGED_CODE();
+	ASSERT(waiter);
+	ASSERT(STATUS_PENDING != waiter->m_status);
 
-	DBGPRINT(("ClientResponse: Cookie[0x%x] Size[0x%x]\n", cookie, responseSize));
+	// Waiter may be gone once woken
+	if(waiter->m_done)
+	{
+		KeSetEvent(waiter->m_done, EVENT_INCREMENT, false);
+	}
+	else
+	{
+		// The create's caller waits
+		ExQueueWorkItem(&waiter->m_item, CriticalWorkQueue);
+	}
+}
 
-	NTSTATUS status = STATUS_INVALID_PARAMETER;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	ExAcquireFastMutex(&m_lock);
+#pragma LOCKEDCODE
 
-	if(cookie)
-	{
-		// Key response:
-		if(cookie == m_keyCookie)
-		{
-			ULONG cipher = FILFILE_CIPHER_MODE_DEFAULT;
+void CFilterCallback::KeyCancel(DEVICE_OBJECT *device, IRP *irp)
+{
+	UNREFERENCED_PARAMETER(device);
 
-			if(m_key.m_cipher)
-			{
-				cipher = m_key.m_cipher & (FILFILE_CIPHER_MODE_MASK << 16);
-			}
+	ASSERT(irp);
 
-			if (responseSize<0x20)
-			{
-				responseSize=0x20;				
-			}
-			
-			switch(responseSize)
-			{
-				case 128/8:
-					cipher |= FILFILE_CIPHER_SYM_AES128;
-					status = STATUS_SUCCESS;
-					break;
+	// Called with the cancel spin lock held
+	CFilterKeyWaiter *const waiter = (CFilterKeyWaiter*) irp->Tail.Overlay.DriverContext[0];
 
-				case 192/8:
-					cipher |= FILFILE_CIPHER_SYM_AES192;
-					status = STATUS_SUCCESS;
-					break;
+	ASSERT(waiter);
+	ASSERT(waiter->m_irp == irp);
+	ASSERT(waiter->m_request);
 
-				case 256/8:
-					cipher |= FILFILE_CIPHER_SYM_AES256;
-					status = STATUS_SUCCESS;
-					break;
+	RemoveEntryList(&waiter->m_link);
 
-				default:
-					// invalid key size
-					break;
-			}
+	IoReleaseCancelSpinLock(irp->CancelIrql);
 
-			m_key.Clear();
+	DBGPRINT(("FireKey: cancelled, Cookie[0x%x]\n", waiter->m_request->m_cookie));
 
-			if(NT_SUCCESS(status))
-			{
-				if(response)
-				{
-					ASSERT(response);
-					m_key.Init(cipher, response, responseSize);
-				}
-			}
+	// Just leave, others may still wait for the key
+	InterlockedDecrement(&waiter->m_request->m_waiters);
 
-			// wake kernel waiter
-			KeSetEvent(&m_keyReady, EVENT_INCREMENT, false);
-		}
-		else
-		{
-			DBGPRINT(("ClientResponse(Key): invalid Cookie\n"));
-		}
-	}
-	else
-	{
-		// Random response:
-		if(m_random)
-		{
-			ExFreePool(m_random);
-		}
+	waiter->m_status = STATUS_CANCELLED;
 
-		m_random	 = 0;
-		m_randomSize = 0;
+	KeyNotify(waiter);
+}
 
-		// new valid Random data ?
-		if(responseSize >= (2 * CFilterRandomizer::c_blockSize))
-		{
-			ASSERT(response);
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-			// round down to double block size 
-			responseSize &= -(2 * CFilterRandomizer::c_blockSize);
+#pragma PAGEDCODE
 
-			// ensure bounds
-			if(responseSize > CFilterRandomizer::c_sizeMax)
-			{
-				responseSize = CFilterRandomizer::c_sizeMax;
-			}
-			
-			status = STATUS_INSUFFICIENT_RESOURCES;
+void CFilterCallback::KeyRelease(CFilterKeyRequest *request)
+{
+	ASSERT(request);
 
-			m_random = (UCHAR*) ExAllocatePool(NonPagedPool, responseSize);
-		
-			if(m_random)
-			{
-				RtlCopyMemory(m_random, response, responseSize);
+	PAGED_CODE();
 
-				m_randomSize = responseSize;
+	if(!InterlockedDecrement(&request->m_refCount))
+	{
+		ASSERT(IsListEmpty(&request->m_pended));
 
-				status = STATUS_SUCCESS;
-			}
+		request->m_key.Clear();
+
+		if(request->m_path)
+		{
+			ExFreePool(request->m_path);
 		}
 
-		// wake kernel waiter, if any
-		KeSetEvent(&m_randomReady, EVENT_INCREMENT, false);
+		// be paranoid
+		RtlZeroMemory(request->m_payload, request->m_payloadSize);
+
+		ExFreePool(request);
 	}
+}
 
-	ExReleaseFastMutex(&m_lock);
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	return status;
-}
+#pragma PAGEDCODE
 
-NTSTATUS CFilterCallback::ResponseHeader(UCHAR *response, ULONG responseSize)
+NTSTATUS CFilterCallback::WorkerStart()
 {
 	PAGED_CODE();
 
-	DBGPRINT(("ClientResponseHeader:Size[0x%x]\n",responseSize));
-
-	NTSTATUS status = STATUS_INVALID_PARAMETER;
-
+	// A worker that has gone idle leaves its object behind
 	ExAcquireFastMutex(&m_lock);
+	void *const previous = m_worker;
+	m_worker = 0;
+	ExReleaseFastMutex(&m_lock);
 
-	if(m_notify)
+	if(previous)
 	{
-		ExFreePool(m_notify);
+		// It is on its way out already
+		KeWaitForSingleObject(previous, Executive, KernelMode, false, 0);
+
+		ObDereferenceObject(previous);
 	}
 
-	m_notify	 = 0;
-	m_notifySize = 0;
+	KeClearEvent(&m_workerStop);
 
-	// new valid Random data ?
-	if(responseSize >= 3*1024)
+	OBJECT_ATTRIBUTES oa;
+	InitializeObjectAttributes(&oa, 0, OBJ_KERNEL_HANDLE, 0,0);
+
+	HANDLE handle = 0;
+
+	NTSTATUS status = PsCreateSystemThread(&handle, THREAD_ALL_ACCESS, &oa, 0,0, Worker, this);
+
+	if(NT_SUCCESS(status))
 	{
-		ASSERT(response);
+		void *thread = 0;
 
-		// round down to double block size 
-		status = STATUS_INSUFFICIENT_RESOURCES;
-		m_notify = (UCHAR*) ExAllocatePool(NonPagedPool, responseSize);
+		status = ObReferenceObjectByHandle(handle, THREAD_ALL_ACCESS, 0, KernelMode, &thread, 0);
 
-		if(m_notify)
+		ZwClose(handle);
+
+		if(NT_SUCCESS(status))
 		{
-			RtlCopyMemory(m_notify, response, responseSize);
+			ASSERT(thread);
 
-			m_notifySize = responseSize;
+			ExAcquireFastMutex(&m_lock);
+			m_worker = thread;
+			ExReleaseFastMutex(&m_lock);
 
-			status = STATUS_SUCCESS;
+			return status;
 		}
 	}
 
-	// wake kernel waiter, if any
-	KeSetEvent(&m_notifyReady, EVENT_INCREMENT, false);
+	DBGPRINT(("CFilterCallback::WorkerStart -ERROR: failed with [0x%x]\n", status));
 
+	// Retried by the next request queued
+	ExAcquireFastMutex(&m_lock);
+	m_workerActive = false;
 	ExReleaseFastMutex(&m_lock);
 
 	return status;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #pragma PAGEDCODE
 
-NTSTATUS CFilterCallbackDisp::Init(FILFILE_CONTROL_EXTENSION *extension)
+NTSTATUS CFilterCallback::WorkerStop()
 {
-	ASSERT(extension);
-
 	PAGED_CODE();
 
-	RtlZeroMemory(this, sizeof(*this));
+	ExAcquireFastMutex(&m_lock);
+	void *const thread = m_worker;
+	m_worker = 0;
+	ExReleaseFastMutex(&m_lock);
 
-	m_headers = &extension->Context.Headers();
+	if(thread)
+	{
+		// Trigger stop, if not gone idle already
+		KeSetEvent(&m_workerStop, EVENT_INCREMENT, true);
 
-	InitializeListHead(&m_head);
+		KeWaitForSingleObject(thread, Executive, KernelMode, false, 0);
 
-	return ExInitializeResourceLite(&m_lock);
+		ObDereferenceObject(thread);
+
+		ExAcquireFastMutex(&m_lock);
+		m_workerActive = false;
+		ExReleaseFastMutex(&m_lock);
+	}
+
+	return STATUS_SUCCESS;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #pragma PAGEDCODE
 
-void CFilterCallbackDisp::Close()
+void CFilterCallback::Worker(void *context)
 {
 	PAGED_CODE();
 
-	FsRtlEnterFileSystem();
-	ExAcquireResourceExclusiveLite(&m_lock, true);
+	CFilterCallback *const me = (CFilterCallback*) context;
+	ASSERT(me);
 
-	while(!IsListEmpty(&m_head))
+	ULONG const timeoutKey	 = CFilterBase::GetTicksFromSeconds(CFilterBase::s_timeoutKeyRequest);
+	ULONG const timeoutQueue = CFilterBase::GetTicksFromSeconds(c_keyQueueWait);
+
+	void* events[2] = { &me->m_workerStop, &me->m_workerKick };
+
+	for(;;)
 	{
-		LIST_ENTRY *const entry = RemoveHeadList(&m_head);
-		ASSERT(entry);
+		ULONG wait = 0;		// ticks until the earliest deadline
 
-		CFilterCallback *const client = CONTAINING_RECORD(entry, CFilterCallback, m_link);          
-		ASSERT(client);
+		ExAcquireFastMutex(&me->m_lock);
 
-		client->Close();
+		LARGE_INTEGER tick;
+		KeQueryTickCount(&tick);
 
-		ExFreePool(client);
+		for(LIST_ENTRY *entry = me->m_keyQueue.Flink; entry != &me->m_keyQueue; entry = entry->Flink)
+		{
+			CFilterKeyRequest *const request = CONTAINING_RECORD(entry, CFilterKeyRequest, m_link);
+			ASSERT(request);
+
+			ULONG const timeout = (request->m_cookie) ? timeoutKey : timeoutQueue;
+			ULONG const elapsed = tick.LowPart - request->m_tick;
+
+			if(elapsed > timeout)
+			{
+				DBGPRINT(("FireKey -WARN: timed out, Cookie[0x%x]\n", request->m_cookie));
+
+				if(request->m_cookie && me->m_keyTrigger)
+				{
+					KeClearEvent(me->m_keyTrigger);
+				}
+
+				// Fails all joined creates and hands the next request to client
+				me->KeyComplete(request, STATUS_IO_TIMEOUT);
+
+				wait = 0;
+				break;
+			}
+
+			if(!wait || (timeout - elapsed + 1 < wait))
+			{
+				wait = timeout - elapsed + 1;
+			}
+		}
+
+		// Nothing left? The next request queued starts another worker
+		bool const idle = IsListEmpty(&me->m_keyQueue);
+
+		if(idle)
+		{
+			me->m_workerActive = false;
+		}
+
+		ExReleaseFastMutex(&me->m_lock);
+
+		if(idle)
+		{
+			break;
+		}
+
+		if(!wait)
+		{
+			// Look again after a timeout
+			continue;
+		}
+
+		LARGE_INTEGER timeout;
+		timeout.QuadPart = RELATIVE((LONGLONG) wait * KeQueryTimeIncrement());
+
+		NTSTATUS const status = KeWaitForMultipleObjects(2,
+														 events,
+														 WaitAny,
+														 Executive,
+														 KernelMode,
+														 false,
+														 &timeout,
+														 0);
+		if(STATUS_WAIT_0 == status)
+		{
+			break;
+		}
 	}
 
-	ExReleaseResourceLite(&m_lock);
-	
-	ExDeleteResourceLite(&m_lock);
-	FsRtlExitFileSystem();
+	// Our object is released by the next start or by the stop
+	PsTerminateSystemThread(STATUS_SUCCESS);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #pragma PAGEDCODE
 
-NTSTATUS CFilterCallbackDisp::Connect(HANDLE random, HANDLE key, HANDLE notify)
+NTSTATUS CFilterCallback::RequestKey(ULONG flags, FILFILE_CONTROL_OUT *request, ULONG *requestSize)
 {
-	ASSERT(random || key || notify);
+	ASSERT(request);
+	ASSERT(requestSize);
 
 	PAGED_CODE();
 
-	NTSTATUS status = STATUS_SUCCESS;
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
 
-	LUID luid = {0,0};
+	CFilterKeyRequest const* pending = 0;
 
-	if(CFilterControl::IsTerminalServices())
+	// Key request handed to client:
+	if(m_keyCookie && !IsListEmpty(&m_keyQueue))
 	{
-		status = CFilterBase::GetLuid(&luid);
+		pending = CONTAINING_RECORD(m_keyQueue.Flink, CFilterKeyRequest, m_link);
 
-		if(NT_ERROR(status))
+		if(!pending->m_cookie)
 		{
-			return status;
+			pending = 0;
 		}
+	}
 
-		ASSERT(luid.LowPart || luid.HighPart);
+	if(pending)
+	{
+		ASSERT(pending->m_path);
+		ASSERT(pending->m_pathLength);
+		ASSERT(pending->m_payloadSize);
+
+		ULONG const size = sizeof(FILFILE_CONTROL_OUT) + pending->m_pathLength + pending->m_payloadSize;
+
+		DBGPRINT(("RequestKey: ReqSize[0x%x] Size[0x%x] Cookie[0x%x]\n", *requestSize, size, pending->m_cookie));
+
+		status = STATUS_BUFFER_TOO_SMALL;
+
+		if(*requestSize >= size)
+		{
+			RtlZeroMemory(request, size);
+
+			request->Flags		 = FILFILE_CONTROL_AUTOCONF;
+			request->Value		 = pending->m_cookie,
+			request->PathSize	 = pending->m_pathLength;
+			request->PayloadSize = pending->m_payloadSize;
+
+			ULONG offset = sizeof(FILFILE_CONTROL_OUT);
+			
+			// copy Path into UserBuffer
+			RtlCopyMemory((UCHAR*) request + offset, pending->m_path, pending->m_pathLength);
+			offset += pending->m_pathLength;
+
+			// copy Payload
+			RtlCopyMemory((UCHAR*) request + offset, pending->m_payload, pending->m_payloadSize);
+
+			*requestSize = size;
+
+			status = STATUS_SUCCESS;
+		}
 	}
 
-	// Already connected?
-	CFilterCallback *client = Find(&luid);
+	return status;
+}
 
-	if(client)
-	{
-		DBGPRINT(("Connect: Update client LUID[0x%I64x]\n", luid));
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		// Just update client's handles
-		return client->Connect(random, key, notify);
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallback::RequestNotify(ULONG flags, FILFILE_CONTROL_OUT *request, ULONG *requestSize)
+{
+	ASSERT(request);
+	ASSERT(requestSize);
+
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	if(m_notify)
+	{
+		ExFreePool(m_notify);
+		m_notify=0;
+		m_notifySize=0;
 	}
 
-	status = STATUS_INSUFFICIENT_RESOURCES;
+	ULONG const size = sizeof(FILFILE_CONTROL_OUT) + m_notifySize;
+
+	if(*requestSize >= size)
+	{
+		m_notifySize=request->PathSize;
+		m_notify=(UCHAR*)ExAllocatePool(NonPagedPool,m_notifySize);
+
+		if (m_notify)
+		{
+			RtlZeroMemory(m_notify, (*requestSize-size));
+			DBGPRINT(("RequestNotify: ReqSize[0x%x]\n", *requestSize));
+			status = STATUS_BUFFER_TOO_SMALL;			
+
+			//request->Flags	  = m_notifyFlags;
+			// copy Path into UserBuffer
+			RtlCopyMemory((UCHAR*) request + sizeof(FILFILE_CONTROL_OUT), m_notify, m_notifySize);
+			status = STATUS_SUCCESS;
+		}
+		else
+		{
+			m_notifySize=0;
+		}
+	}
+	//}
+
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallback::Request(ULONG flags, FILFILE_CONTROL_OUT *request, ULONG *requestSize)
+{
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_INVALID_PARAMETER;
+
+	if(request && requestSize)
+	{
+		ExAcquireFastMutex(&m_lock);
+
+		__try
+		{
+			// dispatch accordingly
+			if(flags & FILFILE_CONTROL_NOTIFY)
+			{
+				status = RequestNotify(flags, request, requestSize);
+			}
+			else if(flags & FILFILE_CONTROL_AUTOCONF) 
+			{	
+				status = RequestKey(flags, request, requestSize);
+			}
+		}
+		__except(EXCEPTION_EXECUTE_HANDLER)
+		{
+			status = STATUS_INVALID_USER_BUFFER;
+		}
+
+		ExReleaseFastMutex(&m_lock);
+	}
+
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallback::Response(ULONG cookie, UCHAR *response, ULONG responseSize)
+{
+	PAGED_CODE();
+
+	DBGPRINT(("ClientResponse: Cookie[0x%x] Size[0x%x]\n", cookie, responseSize));
+
+	NTSTATUS status = STATUS_INVALID_PARAMETER;
+
+	ExAcquireFastMutex(&m_lock);
+
+	if(cookie)
+	{
+		CFilterKeyRequest *const pending = (IsListEmpty(&m_keyQueue)) ? 0 : CONTAINING_RECORD(m_keyQueue.Flink, CFilterKeyRequest, m_link);
+
+		// Key response:
+		if(pending && pending->m_cookie && (cookie == pending->m_cookie))
+		{
+			ULONG cipher = FILFILE_CIPHER_MODE_DEFAULT;
+
+			if(pending->m_key.m_cipher)
+			{
+				cipher = pending->m_key.m_cipher & (((FILFILE_CIPHER_UNIT_MASK << FILFILE_CIPHER_UNIT_SHIFT) | FILFILE_CIPHER_MODE_MASK) << 16);
+			}
+
+			if (responseSize<0x20)
+			{
+				responseSize=0x20;				
+			}
+			
+			switch(responseSize)
+			{
+				case 128/8:
+					cipher |= FILFILE_CIPHER_SYM_AES128;
+					status = STATUS_SUCCESS;
+					break;
+
+				case 192/8:
+					cipher |= FILFILE_CIPHER_SYM_AES192;
+					status = STATUS_SUCCESS;
+					break;
+
+				case 256/8:
+					cipher |= FILFILE_CIPHER_SYM_AES256;
+					status = STATUS_SUCCESS;
+					break;
+
+				default:
+					// invalid key size
+					break;
+			}
+
+			// Never hand out a Key whose mode cannot be coded
+			if(NT_SUCCESS(status) && !CFilterContext::IsCipherModeSupported(HIWORD(cipher)))
+			{
+				DBGPRINT(("ClientResponse(Key) -ERROR: unsupported cipher mode [0x%x]\n", HIWORD(cipher)));
+
+				status = STATUS_NOT_SUPPORTED;
+			}
+
+			pending->m_key.Clear();
+
+			if(NT_SUCCESS(status))
+			{
+				if(response)
+				{
+					ASSERT(response);
+					pending->m_key.Init(cipher, response, responseSize);
+				}
+			}
+
+			// wake kernel waiters, hand next request to client
+			KeyComplete(pending, (pending->m_key.m_size) ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL);
+		}
+		else
+		{
+			DBGPRINT(("ClientResponse(Key): invalid Cookie\n"));
+		}
+	}
+	else
+	{
+		// Random response:
+		if(m_random)
+		{
+			ExFreePool(m_random);
+		}
+
+		m_random	 = 0;
+		m_randomSize = 0;
+
+		// new valid Random data ?
+		if(responseSize >= (2 * CFilterRandomizer::c_blockSize))
+		{
+			ASSERT(response);
+
+			// round down to double block size 
+			responseSize &= -(2 * CFilterRandomizer::c_blockSize);
+
+			// ensure bounds
+			if(responseSize > CFilterRandomizer::c_sizeMax)
+			{
+				responseSize = CFilterRandomizer::c_sizeMax;
+			}
+			
+			status = STATUS_INSUFFICIENT_RESOURCES;
+
+			m_random = (UCHAR*) ExAllocatePool(NonPagedPool, responseSize);
+		
+			if(m_random)
+			{
+				RtlCopyMemory(m_random, response, responseSize);
+
+				m_randomSize = responseSize;
+
+				status = STATUS_SUCCESS;
+			}
+		}
+
+		// wake kernel waiter, if any
+		KeSetEvent(&m_randomReady, EVENT_INCREMENT, false);
+	}
+
+	ExReleaseFastMutex(&m_lock);
+
+	return status;
+}
+
+NTSTATUS CFilterCallback::ResponseHeader(UCHAR *response, ULONG responseSize)
+{
+	PAGED_CODE();
+
+	DBGPRINT(("ClientResponseHeader:Size[0x%x]\n",responseSize));
+
+	NTSTATUS status = STATUS_INVALID_PARAMETER;
+
+	ExAcquireFastMutex(&m_lock);
+
+	if(m_notify)
+	{
+		ExFreePool(m_notify);
+	}
+
+	m_notify	 = 0;
+	m_notifySize = 0;
+
+	// new valid Random data ?
+	if(responseSize >= 3*1024)
+	{
+		ASSERT(response);
+
+		// round down to double block size 
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		m_notify = (UCHAR*) ExAllocatePool(NonPagedPool, responseSize);
+
+		if(m_notify)
+		{
+			RtlCopyMemory(m_notify, response, responseSize);
+
+			m_notifySize = responseSize;
+
+			status = STATUS_SUCCESS;
+		}
+	}
+
+	// wake kernel waiter, if any
+	KeSetEvent(&m_notifyReady, EVENT_INCREMENT, false);
+
+	ExReleaseFastMutex(&m_lock);
+
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::Init(FILFILE_CONTROL_EXTENSION *extension)
+{
+	ASSERT(extension);
+
+	PAGED_CODE();
+
+	RtlZeroMemory(this, sizeof(*this));
+
+	m_headers = &extension->Context.Headers();
+
+	InitializeListHead(&m_head);
+
+	return ExInitializeResourceLite(&m_lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterCallbackDisp::Close()
+{
+	PAGED_CODE();
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceExclusiveLite(&m_lock, true);
+
+	while(!IsListEmpty(&m_head))
+	{
+		LIST_ENTRY *const entry = RemoveHeadList(&m_head);
+		ASSERT(entry);
+
+		CFilterCallback *const client = CONTAINING_RECORD(entry, CFilterCallback, m_link);          
+		ASSERT(client);
+
+		client->Close();
+
+		ExFreePool(client);
+	}
+
+	ExReleaseResourceLite(&m_lock);
+	
+	ExDeleteResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::Connect(HANDLE random, HANDLE key, HANDLE notify)
+{
+	ASSERT(random || key || notify);
+
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	LUID luid = {0,0};
+
+	if(CFilterControl::IsTerminalServices())
+	{
+		status = CFilterBase::GetLuid(&luid);
+
+		if(NT_ERROR(status))
+		{
+			return status;
+		}
+
+		ASSERT(luid.LowPart || luid.HighPart);
+	}
+
+	// Already connected?
+	CFilterCallback *client = Find(&luid);
+
+	if(client)
+	{
+		DBGPRINT(("Connect: Update client LUID[0x%I64x]\n", luid));
+
+		// Just update client's handles
+		return client->Connect(random, key, notify);
+	}
+
+	status = STATUS_INSUFFICIENT_RESOURCES;
+
+	client = (CFilterCallback*) ExAllocatePool(NonPagedPool, sizeof(CFilterCallback));
+
+	if(client)
+	{
+		client->Init(&luid);
+
+		status = client->Connect(random, key, notify);
+
+		if(NT_SUCCESS(status))
+		{
+			FsRtlEnterFileSystem();
+			ExAcquireResourceExclusiveLite(&m_lock, true);
+
+			// Add client to list
+			InsertTailList(&m_head, &client->m_link);
+
+			ExReleaseResourceLite(&m_lock);
+			FsRtlExitFileSystem();
+
+			// Mark LUID so that we are called on termination. This does not always work reliably...
+			SeMarkLogonSessionForTerminationNotification(&luid);
+
+			DBGPRINT(("Connect: Added client LUID[0x%I64x]\n", luid));
+		}
+		else
+		{
+			client->Close();
+
+			ExFreePool(client);
+		}
+	}
+	
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::Disconnect(LUID const* luid)
+{
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	LUID luidVal = {0,0};
+
+	if(CFilterControl::IsTerminalServices())
+	{
+		if(!luid)
+		{
+			status = CFilterBase::GetLuid(&luidVal);
+
+			if(NT_ERROR(status))
+			{
+				return status;
+			}
+		}
+		else
+		{
+			ASSERT(luid->LowPart || luid->HighPart);
+		}
+	}
+	
+	if(!luid)
+	{
+		luid = &luidVal;
+	}
+
+	CFilterCallback *client = 0;
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceExclusiveLite(&m_lock, true);
+
+	// Search for connected client with given LUID
+	for(LIST_ENTRY *entry = m_head.Flink; entry != &m_head; entry = entry->Flink)
+	{
+		CFilterCallback *const candidate = CONTAINING_RECORD(entry, CFilterCallback, m_link);          
+		ASSERT(candidate);
+
+		if(candidate->Check(luid))
+		{
+			client = candidate;
+
+			// Remove client from list
+			RemoveEntryList(entry);
+
+			break;
+		}
+	}
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+
+	status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+	if(client)
+	{
+		DBGPRINT(("Disconnect: Removed client LUID[0x%I64x]\n", *luid));
+
+		// Disconnect and cleanup
+		client->Connect();
+
+		ExFreePool(client);
+
+		// Inform caller when last client has disconnected
+		status = IsListEmpty(&m_head) ? STATUS_ALERTED : STATUS_SUCCESS;
+	}
+
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+CFilterCallback* CFilterCallbackDisp::Find(LUID const* luid)
+{
+	PAGED_CODE();
+
+	LUID luidVal = {0,0};
+
+	if(CFilterControl::IsTerminalServices())
+	{
+		if(luid)
+		{
+			luidVal = *luid;
+		}
+
+		if(!luidVal.LowPart && !luidVal.HighPart)
+		{
+			NTSTATUS status = CFilterBase::GetLuid(&luidVal);
+
+			if(NT_ERROR(status))
+			{
+				return 0;
+			}
+		}
+
+		ASSERT(luidVal.LowPart || luidVal.HighPart);
+	}
+
+	CFilterCallback *client = 0;
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceSharedLite(&m_lock, true);
+
+	// Search for connected client with given LUID
+	for(LIST_ENTRY *entry = m_head.Flink; entry != &m_head; entry = entry->Flink)
+	{
+		CFilterCallback *const candidate = CONTAINING_RECORD(entry, CFilterCallback, m_link);          
+		ASSERT(candidate);
+		
+		if(candidate->Check(&luidVal))
+		{
+			client = candidate;
+
+			break;
+		}
+	}
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+
+	return client;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::Request(ULONG flags, FILFILE_CONTROL_OUT *request, ULONG *requestSize)
+{
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+	CFilterCallback *const callback = Find();
+
+	if(callback)
+	{
+		status = callback->Request(flags, request, requestSize);
+	}
+
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::Response(ULONG keyCookie, UCHAR *response, ULONG responseSize)
+{
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+	CFilterCallback *const callback = Find();
+
+	if(callback)
+	{
+		status = callback->Response(keyCookie, response, responseSize);
+	}
+
+	return status;
+}
+
+NTSTATUS CFilterCallbackDisp::ResponseHeader(UCHAR *response, ULONG responseSize)
+{
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+	CFilterCallback *const callback = Find();
+
+	if(callback)
+	{
+		status = callback->ResponseHeader(response, responseSize);
+	}
+
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::FireNotify(ULONG flags, UCHAR** notify, ULONG notifySize)
+{
+	//ASSERT(notify);
+	//ASSERT(notifyLength);
+
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_DEVICE_NOT_CONNECTED;
+
+	//ͻʱGUID callbackͻ
+	CFilterCallback *const callback = Find();
+
+	if(callback)
+	{
+		status = callback->FireNotify(flags, notify, notifySize);
+	}
+
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::KeyKnown(FILFILE_TRACK_CONTEXT *track, CFilterCallback **callback)
+{
+	ASSERT(track);
+	ASSERT(callback);
+
+	PAGED_CODE();
+
+	ASSERT(m_headers);
+
+	ASSERT(!track->Entity.m_headerIdentifier);
+
+	ASSERT(track->Header.m_payload);
+	ASSERT(track->Header.m_payloadSize);
+	ASSERT(track->Header.m_payloadCrc);
+
+	// Find connected client for given LUID
+	*callback = Find(&track->Luid);
+
+	if(!*callback)
+	{
+		return STATUS_DEVICE_NOT_CONNECTED;
+	}
+
+	bool const terminal = CFilterControl::IsTerminalServices();
+
+	m_headers->LockShared();
+
+	// Check if Header is still unknown
+	ULONG const matched = m_headers->Match(&track->Header);
+
+	if(matched)
+	{
+		CFilterHeader const* header = m_headers->Get(matched);
+		ASSERT(header);
+
+		// In TS mode, check if active LUID is already authenticated
+		if(!terminal || (~0u != header->m_luids.Check(&track->Luid)))
+		{
+			// Set matched header identifier
+			track->Entity.m_headerIdentifier = matched;
+
+			// Copy corresponding key
+			track->EntityKey = header->m_key;
+		}
+	}
+
+	m_headers->Unlock();
+
+	// Header found?
+	return (track->Entity.m_headerIdentifier) ? STATUS_SUCCESS : STATUS_PENDING;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::FireKey(ULONG flags, FILFILE_TRACK_CONTEXT *track, IRP *irp)
+{
+	ASSERT(track);
+
+	PAGED_CODE();
+
+	CFilterCallback *callback = 0;
+
+	NTSTATUS const status = KeyKnown(track, &callback);
+
+	if(STATUS_PENDING != status)
+	{
+		return status;
+	}
+
+	ASSERT(callback);
+
+	// Creates for the same Header are coalesced into a single request
+	return callback->FireKey(flags, track, irp);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::PendKey(ULONG flags, FILFILE_TRACK_CONTEXT *track, CFilterKeyWaiter *waiter)
+{
+	ASSERT(track);
+	ASSERT(waiter);
+
+	PAGED_CODE();
+
+	CFilterCallback *callback = 0;
+
+	NTSTATUS const status = KeyKnown(track, &callback);
+
+	if(STATUS_PENDING != status)
+	{
+		return status;
+	}
+
+	ASSERT(callback);
+
+	// Waiter's work item runs once the key is there, unless decided at once
+	return callback->PendKey(flags, track, waiter);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::TakeKey(CFilterKeyWaiter *waiter, FILFILE_TRACK_CONTEXT *track)
+{
+	ASSERT(waiter);
+	ASSERT(track);
+
+	PAGED_CODE();
+
+	// A pending request still belongs to the client of this LUID
+	if(waiter->m_request && (STATUS_CANCELLED == waiter->m_status))
+	{
+		CFilterCallback *const callback = Find(&track->Luid);
+
+		if(callback)
+		{
+			callback->LeaveKey(waiter);
+		}
+	}
+
+	return CFilterCallback::TakeKey(waiter, track);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterCallbackDisp::FireRandom(ULONG flags, UCHAR **random, ULONG *randomSize)
+{
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_DEVICE_NOT_CONNECTED;
+
+	CFilterCallback *const callback = Find();
+
+	if(callback)
+	{
+		status = callback->FireRandom(flags, random, randomSize);
+	}
+
+	return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CSimFixture.h"
+
+/*
+ * Key requests of one client: creates needing the key of the same Header join a single request, the
+ * daemon sees distinct Headers one after another in arrival order, both the queue and the joiners of
+ * a request are bounded. Timeouts, cancelled creates and a disconnect end waits, a request nobody waits
+ * for any longer is never handed out.
+ *
+ * The kernel stand-in runs one thread, so synchronous creates are work items, each started while the
+ * previous one waits, and the daemon is a work item answering whatever it is handed. Timeouts are up
+ * to the worker, a system thread. Pended creates hold no thread: they are resumed by their work item,
+ * also when their IRP is cancelled or the request times out. A simulation then pends 1000 concurrent
+ * creates needing the keys of 8 Headers with a daemon taking 50ms per answer.
+ */
+enum
+{
+	c_testCreates	= 1000,
+	c_testHeaders	= 8,
+	c_testLatency	= 50,		// milliseconds per answer
+};
+
+struct TestCreate
+{
+	WORK_QUEUE_ITEM		m_item;
+	ULONG				m_header;	// seed of the Payload
+	IRP*				m_irp;
+	WORK_QUEUE_ITEM*	m_then;		// queued once done
+
+	NTSTATUS			m_status;
+	UCHAR				m_key;		// first key byte received
+};
+
+struct TestDaemon
+{
+	WORK_QUEUE_ITEM		m_item;
+	ULONG				m_latency;	// milliseconds
+	ULONG				m_answers;
+	ULONG				m_served[64];
+};
+
+static CFilterCallback*	s_testCallback;
+static ULONG			s_testParked;
+static ULONG			s_testPeak;
+
+static NTSTATUS TestFire(ULONG header, IRP *irp = 0, UCHAR *key = 0)
+{
+	FILFILE_TRACK_CONTEXT *const track = (FILFILE_TRACK_CONTEXT*) malloc(sizeof(FILFILE_TRACK_CONTEXT));
+
+	NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
+
+	if(CSimFixture::Track(track, header))
+	{
+		if(++s_testParked > s_testPeak)
+		{
+			s_testPeak = s_testParked;
+		}
+
+		status = s_testCallback->FireKey(0, track, irp);
+
+		s_testParked--;
+
+		if(NT_SUCCESS(status) && key)
+		{
+			*key = track->EntityKey.m_key[0];
+		}
+	}
+
+	track->Header.Close();
+	track->Entity.Close();
+	track->EntityKey.Clear();
+
+	free(track);
+
+	return status;
+}
+
+static VOID TestCreateRoutine(PVOID context)
+{
+	TestCreate *const create = (TestCreate*) context;
+
+	create->m_status = TestFire(create->m_header, create->m_irp, &create->m_key);
+
+	if(create->m_then)
+	{
+		ExQueueWorkItem(create->m_then, DelayedWorkQueue);
+	}
+}
+
+static VOID TestDaemonRoutine(PVOID context)
+{
+	TestDaemon *const daemon = (TestDaemon*) context;
+
+	UCHAR buffer[1024];
+
+	for(;;)
+	{
+		FILFILE_CONTROL_OUT *const request = (FILFILE_CONTROL_OUT*) buffer;
+		ULONG requestSize = sizeof(buffer);
+
+		if(NT_ERROR(s_testCallback->Request(FILFILE_CONTROL_AUTOCONF, request, &requestSize)))
+		{
+			break;
+		}
+
+		UCHAR const* payload = buffer + sizeof(FILFILE_CONTROL_OUT) + request->PathSize;
+		ULONG const header	 = payload[0] | (payload[1] << 8);
+
+		CSimKernel::Advance((LONGLONG) daemon->m_latency * 10000);
+
+		// Key derived from the Header
+		UCHAR key[32];
+		memset(key, (UCHAR) (header ^ 0xa5), sizeof(key));
+
+		if(daemon->m_answers < sizeof(daemon->m_served) / sizeof(daemon->m_served[0]))
+		{
+			daemon->m_served[daemon->m_answers] = header;
+		}
+
+		daemon->m_answers++;
+
+		s_testCallback->Response((ULONG) request->Value, key, sizeof(key));
+	}
+}
+
+static VOID TestDisconnectRoutine(PVOID context)
+{
+	UNREFERENCED_PARAMETER(context);
+
+	s_testCallback->Close();
+}
+
+static void TestDaemonInit(TestDaemon *daemon, ULONG latency = 0)
+{
+	RtlZeroMemory(daemon, sizeof(TestDaemon));
+
+	daemon->m_latency = latency;
+
+	ExInitializeWorkItem(&daemon->m_item, TestDaemonRoutine, daemon);
+}
+
+static TestCreate* TestCreates(ULONG count)
+{
+	TestCreate *const creates = (TestCreate*) calloc(count, sizeof(TestCreate));
+
+	for(ULONG pos = 0; pos < count; ++pos)
+	{
+		ExInitializeWorkItem(&creates[pos].m_item, TestCreateRoutine, creates + pos);
+	}
+
+	return creates;
+}
+
+static void TestQueue(TestCreate *creates, ULONG count, TestDaemon *daemon)
+{
+	for(ULONG pos = 0; pos < count; ++pos)
+	{
+		ExQueueWorkItem(&creates[pos].m_item, DelayedWorkQueue);
+	}
+
+	if(daemon)
+	{
+		ExQueueWorkItem(&daemon->m_item, DelayedWorkQueue);
+	}
+}
+
+struct TestPended
+{
+	CFilterKeyWaiter		m_waiter;
+	FILFILE_TRACK_CONTEXT	m_track;
+	IRP						m_irp;
+
+	NTSTATUS				m_status;	// STATUS_PENDING until resumed
+	UCHAR					m_key;
+};
+
+static VOID TestResumeRoutine(PVOID context)
+{
+	TestPended *const pended = (TestPended*) context;
+
+	s_testCallback->LeaveKey(&pended->m_waiter);
 
-	client = (CFilterCallback*) ExAllocatePool(NonPagedPool, sizeof(CFilterCallback));
+	pended->m_status = CFilterCallback::TakeKey(&pended->m_waiter, &pended->m_track);
 
-	if(client)
+	if(NT_SUCCESS(pended->m_status))
 	{
-		client->Init(&luid);
+		pended->m_key = pended->m_track.EntityKey.m_key[0];
+	}
 
-		status = client->Connect(random, key, notify);
+	pended->m_track.Header.Close();
+	pended->m_track.Entity.Close();
+	pended->m_track.EntityKey.Clear();
+}
 
-		if(NT_SUCCESS(status))
-		{
-			FsRtlEnterFileSystem();
-			ExAcquireResourceExclusiveLite(&m_lock, true);
+static TestPended* TestPend(ULONG count, ULONG header, ULONG headers = 1)
+{
+	TestPended *const pended = (TestPended*) calloc(count, sizeof(TestPended));
 
-			// Add client to list
-			InsertTailList(&m_head, &client->m_link);
+	for(ULONG pos = 0; pos < count; ++pos)
+	{
+		CSimFixture::Track(&pended[pos].m_track, header + pos % headers);
 
-			ExReleaseResourceLite(&m_lock);
-			FsRtlExitFileSystem();
+		pended[pos].m_waiter.m_irp = &pended[pos].m_irp;
 
-			// Mark LUID so that we are called on termination. This does not always work reliably...
-			SeMarkLogonSessionForTerminationNotification(&luid);
+		ExInitializeWorkItem(&pended[pos].m_waiter.m_item, TestResumeRoutine, pended + pos);
 
-			DBGPRINT(("Connect: Added client LUID[0x%I64x]\n", luid));
-		}
-		else
-		{
-			client->Close();
+		pended[pos].m_status = s_testCallback->PendKey(0, &pended[pos].m_track, &pended[pos].m_waiter);
 
-			ExFreePool(client);
+		if(STATUS_PENDING != pended[pos].m_status)
+		{
+			pended[pos].m_track.Header.Close();
+			pended[pos].m_track.Entity.Close();
 		}
 	}
-	
-	return status;
+
+	return pended;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int main(void)
+{
+	// The worker times out requests
+	CSimKernel::s_threads = true;
 
-#pragma PAGEDCODE
+	CSimFixture::Init();
 
-NTSTATUS CFilterCallbackDisp::Disconnect(LUID const* luid)
-{
-	PAGED_CODE();
+	int failed = 0;
 
-	NTSTATUS status = STATUS_SUCCESS;
+	LUID luid = { 0, 0 };
 
-	LUID luidVal = {0,0};
+	CFilterCallback callback;
+	callback.Init(&luid);
 
-	if(CFilterControl::IsTerminalServices())
-	{
-		if(!luid)
-		{
-			status = CFilterBase::GetLuid(&luidVal);
+	s_testCallback = &callback;
 
-			if(NT_ERROR(status))
-			{
-				return status;
-			}
-		}
-		else
-		{
-			ASSERT(luid->LowPart || luid->HighPart);
-		}
-	}
-	
-	if(!luid)
+	TestDaemon daemon;
+	UCHAR key = 0;
+
+	// No client yet
+	if(STATUS_DEVICE_NOT_CONNECTED != TestFire(1))
 	{
-		luid = &luidVal;
+		printf("ERROR ON NOT CONNECTED\n");
+		failed++;
 	}
 
-	CFilterCallback *client = 0;
-
-	FsRtlEnterFileSystem();
-	ExAcquireResourceExclusiveLite(&m_lock, true);
+	HANDLE trigger = CSimKernel::CreateEvent(SynchronizationEvent);
 
-	// Search for connected client with given LUID
-	for(LIST_ENTRY *entry = m_head.Flink; entry != &m_head; entry = entry->Flink)
+	if(NT_ERROR(callback.Connect(0, trigger, 0)))
 	{
-		CFilterCallback *const candidate = CONTAINING_RECORD(entry, CFilterCallback, m_link);          
-		ASSERT(candidate);
-
-		if(candidate->Check(luid))
-		{
-			client = candidate;
+		printf("ERROR ON CONNECT\n");
+		failed++;
+	}
 
-			// Remove client from list
-			RemoveEntryList(entry);
+	// Single create, single answer
+	TestDaemonInit(&daemon);
+	TestQueue(0, 0, &daemon);
 
-			break;
-		}
+	if((STATUS_SUCCESS != TestFire(1, 0, &key)) || (key != (1 ^ 0xa5)) || (1 != daemon.m_answers))
+	{
+		printf("ERROR ON SINGLE\n");
+		failed++;
 	}
 
-	ExReleaseResourceLite(&m_lock);
-	FsRtlExitFileSystem();
-
-	status = STATUS_OBJECT_NAME_NOT_FOUND;
+	// Creates needing the same Header join
+	TestCreate *creates = TestCreates(199);
 
-	if(client)
+	for(ULONG pos = 0; pos < 199; ++pos)
 	{
-		DBGPRINT(("Disconnect: Removed client LUID[0x%I64x]\n", *luid));
+		creates[pos].m_header = 2;
+	}
 
-		// Disconnect and cleanup
-		client->Connect();
+	TestDaemonInit(&daemon);
+	TestQueue(creates, 199, &daemon);
 
-		ExFreePool(client);
+	s_testPeak = 0;
 
-		// Inform caller when last client has disconnected
-		status = IsListEmpty(&m_head) ? STATUS_ALERTED : STATUS_SUCCESS;
+	if((STATUS_SUCCESS != TestFire(2, 0, &key)) || (key != (2 ^ 0xa5)) || (1 != daemon.m_answers) || (200 != s_testPeak))
+	{
+		printf("ERROR ON JOIN [%u %u]\n", daemon.m_answers, s_testPeak);
+		failed++;
 	}
 
-	return status;
-}
+	for(ULONG pos = 0; pos < 199; ++pos)
+	{
+		if((STATUS_SUCCESS != creates[pos].m_status) || (creates[pos].m_key != (2 ^ 0xa5)))
+		{
+			printf("ERROR ON JOINED [%u]\n", pos);
+			failed++;
+			break;
+		}
+	}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	free(creates);
 
-#pragma PAGEDCODE
+	// Distinct Headers are handed out one after another, in arrival order
+	ULONG const order[] = { 4, 5, 3, 4, 5 };
 
-CFilterCallback* CFilterCallbackDisp::Find(LUID const* luid)
-{
-	PAGED_CODE();
+	creates = TestCreates(5);
 
-	LUID luidVal = {0,0};
+	for(ULONG pos = 0; pos < 5; ++pos)
+	{
+		creates[pos].m_header = order[pos];
+	}
 
-	if(CFilterControl::IsTerminalServices())
+	TestDaemonInit(&daemon);
+	TestQueue(creates, 5, &daemon);
+
+	if((STATUS_SUCCESS != TestFire(3)) || (3 != daemon.m_answers) || (3 != daemon.m_served[0]) || (4 != daemon.m_served[1]) || (5 != daemon.m_served[2]))
 	{
-		if(luid)
+		printf("ERROR ON ORDER [%u]\n", daemon.m_answers);
+		failed++;
+	}
+
+	for(ULONG pos = 0; pos < 5; ++pos)
+	{
+		if((STATUS_SUCCESS != creates[pos].m_status) || (creates[pos].m_key != (UCHAR) (order[pos] ^ 0xa5)))
 		{
-			luidVal = *luid;
+			printf("ERROR ON ORDERED [%u]\n", pos);
+			failed++;
 		}
+	}
 
-		if(!luidVal.LowPart && !luidVal.HighPart)
-		{
-			NTSTATUS status = CFilterBase::GetLuid(&luidVal);
+	free(creates);
 
-			if(NT_ERROR(status))
-			{
-				return 0;
-			}
-		}
+	// At most 32 distinct Headers queued
+	creates = TestCreates(32);
 
-		ASSERT(luidVal.LowPart || luidVal.HighPart);
+	for(ULONG pos = 0; pos < 32; ++pos)
+	{
+		creates[pos].m_header = 101 + pos;
 	}
 
-	CFilterCallback *client = 0;
+	TestDaemonInit(&daemon);
+	TestQueue(creates, 32, &daemon);
 
-	FsRtlEnterFileSystem();
-	ExAcquireResourceSharedLite(&m_lock, true);
+	if((STATUS_SUCCESS != TestFire(100)) || (32 != daemon.m_answers) || (STATUS_DEVICE_BUSY != creates[31].m_status))
+	{
+		printf("ERROR ON QUEUE BOUND [%u 0x%x]\n", daemon.m_answers, creates[31].m_status);
+		failed++;
+	}
 
-	// Search for connected client with given LUID
-	for(LIST_ENTRY *entry = m_head.Flink; entry != &m_head; entry = entry->Flink)
+	for(ULONG pos = 0; pos < 31; ++pos)
 	{
-		CFilterCallback *const candidate = CONTAINING_RECORD(entry, CFilterCallback, m_link);          
-		ASSERT(candidate);
-		
-		if(candidate->Check(&luidVal))
+		if(STATUS_SUCCESS != creates[pos].m_status)
 		{
-			client = candidate;
-
-			break;
+			printf("ERROR ON QUEUED [%u]\n", pos);
+			failed++;
 		}
 	}
 
-	ExReleaseResourceLite(&m_lock);
-	FsRtlExitFileSystem();
+	free(creates);
 
-	return client;
-}
+	// At most 256 creates join a request
+	creates = TestCreates(256);
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	for(ULONG pos = 0; pos < 256; ++pos)
+	{
+		creates[pos].m_header = 200;
+	}
 
-#pragma PAGEDCODE
+	TestDaemonInit(&daemon);
+	TestQueue(creates, 256, &daemon);
 
-NTSTATUS CFilterCallbackDisp::Request(ULONG flags, FILFILE_CONTROL_OUT *request, ULONG *requestSize)
-{
-	PAGED_CODE();
+	if((STATUS_SUCCESS != TestFire(200)) || (1 != daemon.m_answers) || (STATUS_DEVICE_BUSY != creates[255].m_status) || (STATUS_SUCCESS != creates[254].m_status))
+	{
+		printf("ERROR ON WAITER BOUND [%u 0x%x]\n", daemon.m_answers, creates[255].m_status);
+		failed++;
+	}
 
-	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+	free(creates);
 
-	CFilterCallback *const callback = Find();
+	// Daemon does not answer
+	LONGLONG start = CSimKernel::Now();
 
-	if(callback)
+	if((STATUS_IO_TIMEOUT != TestFire(300)) || (CSimKernel::Now() - start < (LONGLONG) CFilterBase::s_timeoutKeyRequest * 10000000))
 	{
-		status = callback->Request(flags, request, requestSize);
+		printf("ERROR ON TIMEOUT\n");
+		failed++;
 	}
 
-	return status;
-}
+	TestDaemonInit(&daemon);
+	TestDaemonRoutine(&daemon);
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	if(daemon.m_answers)
+	{
+		printf("ERROR ON TIMED OUT REQUEST\n");
+		failed++;
+	}
 
-#pragma PAGEDCODE
+	// A cancelled create queued behind leaves, its request is never handed out
+	IRP cancelled;
+	RtlZeroMemory(&cancelled, sizeof(cancelled));
+	cancelled.Cancel = true;
 
-NTSTATUS CFilterCallbackDisp::Response(ULONG keyCookie, UCHAR *response, ULONG responseSize)
-{
-	PAGED_CODE();
+	creates = TestCreates(1);
 
-	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+	creates[0].m_header = 401;
+	creates[0].m_irp	= &cancelled;
+	creates[0].m_then	= &daemon.m_item;
 
-	CFilterCallback *const callback = Find();
+	TestDaemonInit(&daemon);
+	TestQueue(creates, 1, 0);
 
-	if(callback)
+	if((STATUS_SUCCESS != TestFire(400)) || (STATUS_CANCELLED != creates[0].m_status) || (1 != daemon.m_answers) || (400 != daemon.m_served[0]))
 	{
-		status = callback->Response(keyCookie, response, responseSize);
+		printf("ERROR ON CANCEL QUEUED [0x%x %u]\n", creates[0].m_status, daemon.m_answers);
+		failed++;
 	}
 
-	return status;
-}
+	free(creates);
 
-NTSTATUS CFilterCallbackDisp::ResponseHeader(UCHAR *response, ULONG responseSize)
-{
-	PAGED_CODE();
+	// A cancelled create leaves early, its request stays with the daemon
+	start = CSimKernel::Now();
 
-	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+	if((STATUS_CANCELLED != TestFire(402, &cancelled)) || (CSimKernel::Now() - start > 10000000))
+	{
+		printf("ERROR ON CANCEL\n");
+		failed++;
+	}
 
-	CFilterCallback *const callback = Find();
+	TestDaemonInit(&daemon);
+	TestDaemonRoutine(&daemon);
 
-	if(callback)
+	if((1 != daemon.m_answers) || (402 != daemon.m_served[0]))
 	{
-		status = callback->ResponseHeader(response, responseSize);
+		printf("ERROR ON CANCELLED REQUEST\n");
+		failed++;
 	}
 
-	return status;
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Disconnect fails waiting creates, later ones fail at once
+	WORK_QUEUE_ITEM disconnect;
+	ExInitializeWorkItem(&disconnect, TestDisconnectRoutine, 0);
+	ExQueueWorkItem(&disconnect, DelayedWorkQueue);
 
-#pragma PAGEDCODE
+	if((STATUS_DEVICE_NOT_CONNECTED != TestFire(500)) || (STATUS_DEVICE_NOT_CONNECTED != TestFire(501)))
+	{
+		printf("ERROR ON DISCONNECT\n");
+		failed++;
+	}
 
-NTSTATUS CFilterCallbackDisp::FireNotify(ULONG flags, UCHAR** notify, ULONG notifySize)
-{
-	//ASSERT(notify);
-	//ASSERT(notifyLength);
+	ZwClose(trigger);
 
-	PAGED_CODE();
+	// Pended creates are resumed by their work item
+	trigger = CSimKernel::CreateEvent(SynchronizationEvent);
+	callback.Connect(0, trigger, 0);
 
-	NTSTATUS status = STATUS_DEVICE_NOT_CONNECTED;
+	TestPended *pended = TestPend(100, 700);
 
-	//ͻʱGUID callbackͻ
-	CFilterCallback *const callback = Find();
+	ULONG early = 0;
 
-	if(callback)
+	for(ULONG pos = 0; pos < 100; ++pos)
 	{
-		status = callback->FireNotify(flags, notify, notifySize);
+		early += (STATUS_PENDING != pended[pos].m_status);
 	}
 
-	return status;
-}
+	TestDaemonInit(&daemon);
+	TestDaemonRoutine(&daemon);
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	CSimKernel::Run();
 
-#pragma PAGEDCODE
+	ULONG resumed = 0;
 
-NTSTATUS CFilterCallbackDisp::FireKey(ULONG flags, FILFILE_TRACK_CONTEXT *track)
-{
-	ASSERT(track);
+	for(ULONG pos = 0; pos < 100; ++pos)
+	{
+		resumed += (STATUS_SUCCESS == pended[pos].m_status) && (pended[pos].m_key == (UCHAR) (700 ^ 0xa5));
+	}
 
-	PAGED_CODE();
+	if(early || (100 != resumed) || (1 != daemon.m_answers))
+	{
+		printf("ERROR ON PENDED [%u %u %u]\n", early, resumed, daemon.m_answers);
+		failed++;
+	}
 
-	ASSERT(m_headers);
+	free(pended);
 
-	ASSERT(!track->Entity.m_headerIdentifier);
+	// Cancelling a pended create resumes it, the others joined go on waiting
+	pended = TestPend(2, 701);
 
-	ASSERT(track->Header.m_payload);
-	ASSERT(track->Header.m_payloadSize);
-	ASSERT(track->Header.m_payloadCrc);
+	if(!IoCancelIrp(&pended[0].m_irp) || IoCancelIrp(&pended[0].m_irp))
+	{
+		printf("ERROR ON CANCEL ROUTINE\n");
+		failed++;
+	}
 
-	LARGE_INTEGER time;
-	time.QuadPart = RELATIVE(MILLISECONDS(c_fireKeyLoopWait));
+	CSimKernel::Run();
 
-	NTSTATUS status = STATUS_DEVICE_NOT_CONNECTED;
+	if((STATUS_CANCELLED != pended[0].m_status) || (STATUS_PENDING != pended[1].m_status))
+	{
+		printf("ERROR ON PENDED CANCEL [0x%x 0x%x]\n", pended[0].m_status, pended[1].m_status);
+		failed++;
+	}
 
-	bool const terminal = CFilterControl::IsTerminalServices();
+	TestDaemonInit(&daemon);
+	TestDaemonRoutine(&daemon);
+
+	CSimKernel::Run();
 
-	for(ULONG loop = 0; loop < c_fireKeyLoopCount; ++loop)
+	if((STATUS_SUCCESS != pended[1].m_status) || (1 != daemon.m_answers) || pended[1].m_irp.CancelRoutine)
 	{
-		// Find connected client for given LUID
-		CFilterCallback *const callback = Find(&track->Luid);
+		printf("ERROR ON PENDED CANCEL JOINED [0x%x]\n", pended[1].m_status);
+		failed++;
+	}
 
-		if(!callback)
-		{
-			break;
-		}
+	free(pended);
 
-		m_headers->LockShared();
+	// Unanswered, the worker times it out
+	pended = TestPend(1, 702);
+	start  = CSimKernel::Now();
 
-		// Check if Header is still unknown
-		ULONG const matched = m_headers->Match(&track->Header);
+	LARGE_INTEGER delay;
+	delay.QuadPart = RELATIVE(SECONDS(CFilterBase::s_timeoutKeyRequest + 2));
 
-		if(matched)
-		{
-			CFilterHeader const* header = m_headers->Get(matched);
-			ASSERT(header);
+	KeDelayExecutionThread(KernelMode, false, &delay);
 
-			// In TS mode, check if active LUID is already authenticated
-			if(!terminal || (~0u != header->m_luids.Check(&track->Luid)))
-			{
-				// Set matched header identifier
-				track->Entity.m_headerIdentifier = matched;
+	if(STATUS_IO_TIMEOUT != pended[0].m_status)
+	{
+		printf("ERROR ON PENDED TIMEOUT [0x%x]\n", pended[0].m_status);
+		failed++;
+	}
 
-				// Copy corresponding key
-				track->EntityKey = header->m_key;
-			}
-		}
+	free(pended);
 
-		m_headers->Unlock();
+	// 1000 concurrent creates, 8 Headers, slow daemon
+	s_testParked = 0;
+	start		 = CSimKernel::Now();
 
-		// Header found?
-		if(track->Entity.m_headerIdentifier)
-		{
-			status = STATUS_SUCCESS;
-			break;
-		}
+	double const begin = CSimFixture::Now();
 
-		status = callback->FireKey(flags, track);
+	pended = TestPend(c_testCreates, 800, c_testHeaders);
 
-		// Another key request underway?
-		if(STATUS_ALERTED != status)
-		{
-			break;
-		}
+	TestDaemonInit(&daemon, c_testLatency);
+	TestDaemonRoutine(&daemon);
 
-		DBGPRINT(("FireKey: waiting ...\n"));
+	CSimKernel::Run();
 
-		KeDelayExecutionThread(KernelMode, false, &time);
+	double const end = CSimFixture::Now();
+
+	ULONG succeeded = 0;
 
-		status = STATUS_DEVICE_NOT_CONNECTED;
+	for(ULONG pos = 0; pos < c_testCreates; ++pos)
+	{
+		succeeded += (STATUS_SUCCESS == pended[pos].m_status) && (pended[pos].m_key == (UCHAR) ((800 + pos % c_testHeaders) ^ 0xa5));
 	}
 
-	return status;
-}
+	free(pended);
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	double const elapsed = (double) (CSimKernel::Now() - start) / 10000;
+	double const us		 = (end - begin) / (1e3 * c_testCreates);
 
-#pragma PAGEDCODE
+	if((c_testCreates != succeeded) || (c_testHeaders != daemon.m_answers) || (elapsed > c_testHeaders * c_testLatency) || s_testParked)
+	{
+		printf("ERROR ON SIMULATION [%u %u]\n", succeeded, daemon.m_answers);
+		failed++;
+	}
 
-NTSTATUS CFilterCallbackDisp::FireRandom(ULONG flags, UCHAR **random, ULONG *randomSize)
-{
-	PAGED_CODE();
+	printf("%u creates, %u Headers: %u key requests, %.0f ms, %u threads held, %.2f us per create\n", 
+		   c_testCreates, c_testHeaders, daemon.m_answers, elapsed, s_testParked, us);
 
-	NTSTATUS status = STATUS_DEVICE_NOT_CONNECTED;
+	callback.Close();
+	ZwClose(trigger);
 
-	CFilterCallback *const callback = Find();
+	failed += CSimFixture::Close();
 
-	if(callback)
-	{
-		status = callback->FireRandom(flags, random, randomSize);
-	}
+	printf("%d failed\n", failed);
 
-	return status;
+	return failed;	/* normal exit on zero */
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#endif /* UNITTEST */
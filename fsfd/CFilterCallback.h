@@ -18,10 +18,57 @@
 struct FILFILE_TRACK_CONTEXT;
 struct FILFILE_CONTROL_OUT;
 
+////////////////////////////////////
+
+struct CFilterKeyRequest
+{
+	// Key request of a client. Creates needing the key of the same Header join the request instead of
+	// issuing their own, and are all woken by its completion.
+
+	LIST_ENTRY				m_link;
+	LONG volatile			m_refCount;				// queue and waiters
+	LONG volatile			m_waiters;				//
+	ULONG					m_cookie;				// zero while queued behind others
+	ULONG					m_tick;					// when queued or handed to client
+	ULONG					m_flags;
+	NTSTATUS				m_status;				// STATUS_PENDING until completed
+	LIST_ENTRY				m_pended;				// CFilterKeyWaiters, under cancel spin lock
+
+	LPWSTR					m_path;
+	ULONG					m_pathLength;
+	UCHAR*					m_payload;				// follows structure
+	ULONG					m_payloadSize;			//
+	ULONG					m_payloadCrc;			//
+	CFilterKey				m_key;
+};
+
+////////////////////////////////////
+
+struct CFilterKeyWaiter
+{
+	// Create joined to a key request. A synchronous one sleeps on its event, a pended one is resumed by
+	// its work item once the request completes, its IRP is cancelled or the request times out. Either
+	// way, the key is then collected with TakeKey.
+
+	LIST_ENTRY				m_link;					// on request
+	CFilterKeyRequest*		m_request;				// referenced until taken
+	IRP*					m_irp;					// optional, its cancellation ends the wait
+	NTSTATUS				m_status;				// STATUS_PENDING until woken
+
+	KEVENT*					m_done;					// synchronous
+	WORK_QUEUE_ITEM			m_item;					// pended, set up by owner
+};
+
+////////////////////////////////////
+
 class CFilterCallback
 {
 	friend class CFilterCallbackDisp;
 
+	enum c_constants		{	c_keyQueueMax	= 32,		// distinct Headers queued per client
+								c_keyWaitersMax	= 256,		// creates joined per request
+								c_keyQueueWait	= 30,		// seconds spent queued at most
+							};
 public:
 
 	NTSTATUS				Init(LUID const* luid);
@@ -35,11 +82,28 @@ public:
 	NTSTATUS                ResponseHeader(UCHAR *response, ULONG responseSize);
 
 	NTSTATUS				FireNotify(ULONG flags, UCHAR** notify, ULONG notifySize);
-	NTSTATUS				FireKey(ULONG flags, FILFILE_TRACK_CONTEXT *track);
+	NTSTATUS				FireKey(ULONG flags, FILFILE_TRACK_CONTEXT *track, IRP *irp = 0);
+	NTSTATUS				PendKey(ULONG flags, FILFILE_TRACK_CONTEXT *track, CFilterKeyWaiter *waiter);
+	void					LeaveKey(CFilterKeyWaiter *waiter);
+	static NTSTATUS			TakeKey(CFilterKeyWaiter *waiter, FILFILE_TRACK_CONTEXT *track);
 	NTSTATUS				FireRandom(ULONG flags, UCHAR **random = 0, ULONG *randomSize = 0);
 
 private:
 
+	NTSTATUS				KeyJoin(ULONG flags, FILFILE_TRACK_CONTEXT *track, CFilterKeyWaiter *waiter, bool *start);
+	void					KeyFire();
+	void					KeyComplete(CFilterKeyRequest *request, NTSTATUS status);
+
+	static bool				KeyAttach(CFilterKeyWaiter *waiter);
+	static void				KeyDetach(CFilterKeyRequest *request, LIST_ENTRY *woken);
+	static void				KeyNotify(CFilterKeyWaiter *waiter);
+	static void				KeyCancel(DEVICE_OBJECT *device, IRP *irp);
+	static void				KeyRelease(CFilterKeyRequest *request);
+
+	NTSTATUS				WorkerStart();
+	NTSTATUS				WorkerStop();
+	static void NTAPI		Worker(void *context);
+
 	NTSTATUS				RequestKey(ULONG flags, FILFILE_CONTROL_OUT *request, ULONG *requestSize);
 	NTSTATUS				RequestNotify(ULONG flags, FILFILE_CONTROL_OUT *request, ULONG *requestSize);
 	
@@ -61,13 +125,14 @@ private:
 	ULONG					m_randomSize;			//
 	KEVENT					m_randomReady;			//
 	
-	LPWSTR					m_keyPath;				// Key requests
-	UCHAR*					m_keyPayload;			//
-	ULONG					m_keyPayloadSize;		//
-    ULONG					m_keyPathLength;		//
-	ULONG					m_keyCookie;			// current/next cookie
-	CFilterKey				m_key;					//
-	KEVENT					m_keyReady;				// 
+	LIST_ENTRY				m_keyQueue;				// Key requests, head is handed to client
+	ULONG					m_keyQueued;			//
+	ULONG					m_keyCookie;			// next cookie
+
+	void*					m_worker;				// referenced thread object, times out key requests
+	bool					m_workerActive;			// under m_lock
+	KEVENT					m_workerStop;			//
+	KEVENT					m_workerKick;			// deadline changed
 	KEVENT					m_notifyReady;	
 };
 
@@ -83,8 +148,6 @@ bool CFilterCallback::Check(LUID const* luid)
 class CFilterCallbackDisp
 {
 	enum c_constants		{	c_incrementCount   = 8,
-								c_fireKeyLoopCount = 120,
-								c_fireKeyLoopWait  = 300,	// effective timeout: ~30 sec 
 							};
 public:
 
@@ -99,12 +162,15 @@ public:
 	NTSTATUS                ResponseHeader(UCHAR *response, ULONG responseSize);
 
 	NTSTATUS				FireNotify(ULONG flags, UCHAR** notify, ULONG notifySize);
-	NTSTATUS				FireKey(ULONG flags, FILFILE_TRACK_CONTEXT *track);
+	NTSTATUS				FireKey(ULONG flags, FILFILE_TRACK_CONTEXT *track, IRP *irp = 0);
+	NTSTATUS				PendKey(ULONG flags, FILFILE_TRACK_CONTEXT *track, CFilterKeyWaiter *waiter);
+	NTSTATUS				TakeKey(CFilterKeyWaiter *waiter, FILFILE_TRACK_CONTEXT *track);
 	NTSTATUS				FireRandom(ULONG flags, UCHAR **random = 0, ULONG *randomSize = 0);
 		
 private:
 
 	CFilterCallback*		Find(LUID const* luid = 0);
+	NTSTATUS				KeyKnown(FILFILE_TRACK_CONTEXT *track, CFilterCallback **callback);
 
 							// DATA		
 	CFilterHeaderCont*		m_headers;
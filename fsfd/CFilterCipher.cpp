@@ -0,0 +1,211 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterCipher.cpp: implementation of the CFilterCipher class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define DRIVER_USE_NTIFS	// use the NTIFS header
+#include "driver.h"
+
+#include "CFilterBase.h"
+#include "CFilterContext.h"
+#include "CFilterCipher.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+CFilterCipher* CFilterCipher::Create(CFilterKey const* key, LARGE_INTEGER const* nonce)
+{
+	ASSERT(key);
+	ASSERT(key->m_size);
+	ASSERT(nonce);
+
+	PAGED_CODE();
+
+	CFilterCipher *const cipher = (CFilterCipher*) ExAllocatePool(NonPagedPool, sizeof(CFilterCipher));
+
+	if(cipher)
+	{
+		RtlZeroMemory(cipher, sizeof(CFilterCipher));
+
+		cipher->m_refCount	   = 1;
+		cipher->m_mode		   = CFilterContext::CipherMode(key->m_cipher);
+		cipher->m_unit		   = CFilterContext::CipherUnit(key->m_cipher);
+
+		cipher->m_crypt.Key	   = *key;
+		cipher->m_crypt.Nonce  = *nonce;
+	}
+
+	return cipher;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+template<typename t_cipher>
+void CFilterCipher::Close()
+{
+	if(m_state)
+	{
+		// Frees its contexts and wipes the expanded key
+		((t_cipher*) m_state)->Close();
+
+		ExFreePool(m_state);
+		m_state = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+void CFilterCipher::Release()
+{
+	ASSERT(m_refCount > 0);
+
+	if(!InterlockedDecrement(&m_refCount))
+	{
+		ASSERT(!m_busy);
+
+		switch(m_mode)
+		{
+			case FILFILE_CIPHER_MODE_CTR:
+				Close<CFilterCipherCTR>();
+				break;
+
+			case FILFILE_CIPHER_MODE_CFB:
+				Close<CFilterCipherCFB>();
+				break;
+
+			case FILFILE_CIPHER_MODE_EME:
+			case FILFILE_CIPHER_MODE_EME_2:
+				Close<CFilterCipherEME>();
+				break;
+
+			case FILFILE_CIPHER_MODE_XTS:
+				Close<CFilterCipherXTS>();
+				break;
+
+			default:
+				ASSERT(!m_state);
+				break;
+		}
+
+		// be paranoid
+		RtlZeroMemory(&m_crypt, sizeof(m_crypt));
+
+		ExFreePool(this);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+template<typename t_cipher>
+NTSTATUS CFilterCipher::Code(UCHAR *buffer, ULONG size, LARGE_INTEGER *offset, bool encode)
+{
+	// Requests start on cipher blocks, those that do not are left to the private path
+	if(!(offset->QuadPart % t_cipher::c_blockSize) && !InterlockedCompareExchange(&m_busy, 1, 0))
+	{
+		t_cipher *cipher = (t_cipher*) m_state;
+
+		if(!cipher)
+		{
+			// First use, expand the key
+			cipher = (t_cipher*) ExAllocatePool(NonPagedPool, sizeof(t_cipher));
+
+			if(cipher)
+			{
+				RtlZeroMemory(cipher, sizeof(t_cipher));
+
+				if(NT_SUCCESS(cipher->Init(&m_crypt)))
+				{
+					m_state = cipher;
+				}
+				else
+				{
+					cipher->Close();
+
+					ExFreePool(cipher);
+					cipher = 0;
+				}
+			}
+		}
+
+		NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
+
+		if(cipher)
+		{
+			cipher->SetOffset(offset);
+
+			status = (encode) ? cipher->Encode(buffer, size) : cipher->Decode(buffer, size);
+		}
+
+		InterlockedExchange(&m_busy, 0);
+
+		if(cipher)
+		{
+			return status;
+		}
+	}
+
+	// Busy or no memory, expand a private copy as before
+	FILFILE_CRYPT_CONTEXT crypt = m_crypt;
+	crypt.Offset = *offset;
+
+	NTSTATUS const status = (encode) ? CFilterContext::Encode(buffer, size, &crypt) : CFilterContext::Decode(buffer, size, &crypt);
+
+	// be paranoid
+	RtlZeroMemory(&crypt, sizeof(crypt));
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+NTSTATUS CFilterCipher::Code(UCHAR *buffer, ULONG size, LARGE_INTEGER *offset, bool encode)
+{
+	ASSERT(buffer);
+	ASSERT(size);
+	ASSERT(offset);
+
+	ASSERT(m_refCount > 0);
+
+	// Dispatch on cipher mode of the key
+	switch(m_mode)
+	{
+		case FILFILE_CIPHER_MODE_CTR:
+			return Code<CFilterCipherCTR>(buffer, size, offset, encode);
+
+		case FILFILE_CIPHER_MODE_CFB:
+			ASSERT(CFilterContext::IsCipherModeSupported(m_mode));
+			return Code<CFilterCipherCFB>(buffer, size, offset, encode);
+
+		case FILFILE_CIPHER_MODE_EME:
+		case FILFILE_CIPHER_MODE_EME_2:
+			ASSERT(CFilterContext::IsCipherModeSupported(m_mode));
+			return Code<CFilterCipherEME>(buffer, size, offset, encode);
+
+		case FILFILE_CIPHER_MODE_XTS:
+			ASSERT(CFilterContext::IsCipherModeSupported(m_mode));
+			return Code<CFilterCipherXTS>(buffer, size, offset, encode);
+
+		default:
+			break;
+	}
+
+	DBGPRINT(("CFilterCipher::Code -ERROR: unknown cipher mode[0x%x]\n", m_mode));
+
+	return STATUS_NOT_SUPPORTED;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterCipher.h: interface for the CFilterCipher class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilterCipher_H__5D2E7A91_C38B_4F06_9E14_A6B0F3D8C527__INCLUDED_)
+#define AFX_CFilterCipher_H__5D2E7A91_C38B_4F06_9E14_A6B0F3D8C527__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilterCipher
+{
+	// Refcounted FileKey and Nonce of a tracked stream, together with the cipher of the key's mode in expanded
+	// form. I/O paths reference it under the tracker lock instead of copying the FileKey, and code through it.
+	// Key and Nonce never change, a new FileKey gets a new object. The expanded state is set up on first use
+	// and is used by one request at a time; requests finding it busy expand a private one on the stack.
+
+public:
+
+	static CFilterCipher*		Create(CFilterKey const* key, LARGE_INTEGER const* nonce);
+
+	void						Reference();
+	void						Release();
+
+	NTSTATUS					Encode(UCHAR *buffer, ULONG size, LARGE_INTEGER *offset);
+	NTSTATUS					Decode(UCHAR *buffer, ULONG size, LARGE_INTEGER *offset);
+
+	ULONG						Mode() const;
+	ULONG						Unit() const;		// data unit, bytes
+
+private:
+
+	NTSTATUS					Code(UCHAR *buffer, ULONG size, LARGE_INTEGER *offset, bool encode);
+	template<typename t_cipher>
+	NTSTATUS					Code(UCHAR *buffer, ULONG size, LARGE_INTEGER *offset, bool encode);
+	template<typename t_cipher>
+	void						Close();
+
+								// DATA
+	LONG volatile				m_refCount;
+	LONG volatile				m_busy;				// expanded state in use
+	ULONG						m_mode;
+	ULONG						m_unit;
+
+	void*						m_state;			// expanded cipher of m_mode, NonPaged
+
+	FILFILE_CRYPT_CONTEXT		m_crypt;			// Key and Nonce, Offset unused
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+void CFilterCipher::Reference()
+{
+	ASSERT(m_refCount > 0);
+
+	InterlockedIncrement(&m_refCount);
+}
+
+inline
+NTSTATUS CFilterCipher::Encode(UCHAR *buffer, ULONG size, LARGE_INTEGER *offset)
+{
+	return Code(buffer, size, offset, true);
+}
+
+inline
+NTSTATUS CFilterCipher::Decode(UCHAR *buffer, ULONG size, LARGE_INTEGER *offset)
+{
+	return Code(buffer, size, offset, false);
+}
+
+inline
+ULONG CFilterCipher::Mode() const
+{
+	return m_mode;
+}
+
+inline
+ULONG CFilterCipher::Unit() const
+{
+	return m_unit;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // !defined(AFX_CFilterCipher_H__5D2E7A91_C38B_4F06_9E14_A6B0F3D8C527__INCLUDED_)
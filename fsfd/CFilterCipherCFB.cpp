@@ -11,15 +11,7 @@
 
 #include "CFilterBase.h"
 
-#ifdef FILFILE_USE_CFB
-
 #include "CFilterCipherCFB.h"
-// force template instances
-#if DBG
- template class RijndealCoder<AES_128>;
- template class RijndealCoder<AES_192>;
- template class RijndealCoder<AES_256>;
-#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -95,17 +87,12 @@ ULONG CFilterCipherCFB::AddPadding(UCHAR *target, ULONG size)
 
 #pragma LOCKEDCODE
 
-template<typename AES>
-NTSTATUS CFilterCipherCFB::Encode(UCHAR *buffer, ULONG size, AES &aes)
+NTSTATUS CFilterCipherCFB::Encode(UCHAR *buffer, ULONG size)
 {
 	ASSERT(buffer);
 	ASSERT(size);
 
 	ASSERT(0 == (size % c_blockSize));
-	ASSERT(m_key);
-	ASSERT(m_keySize == aes.c_keySize);
-
-	aes.Init(m_key, false);
 
 	ULONG current = 0;
 	UCHAR output[c_blockSize];
@@ -119,7 +106,7 @@ NTSTATUS CFilterCipherCFB::Encode(UCHAR *buffer, ULONG size, AES &aes)
 		do
 		{
 			// encode inplace
-			aes.EncodeBlock(output);
+			m_aes.EncodeBlock(output);
 
 			ULONG *b = (ULONG*) (buffer + current);
 			ULONG *o = (ULONG*) (output);
@@ -158,17 +145,12 @@ NTSTATUS CFilterCipherCFB::Encode(UCHAR *buffer, ULONG size, AES &aes)
 
 #pragma LOCKEDCODE
 
-template<typename AES>
-NTSTATUS CFilterCipherCFB::Decode(UCHAR *buffer, ULONG size, AES &aes)
+NTSTATUS CFilterCipherCFB::Decode(UCHAR *buffer, ULONG size)
 {
 	ASSERT(buffer);
 	ASSERT(size);
 
 	ASSERT(0 == (size % c_blockSize));
-	ASSERT(m_key);
-    ASSERT(m_keySize == aes.c_keySize);
-
-	aes.Init(m_key, false);
 
 	ULONG current = 0;
 	UCHAR output[c_blockSize];
@@ -182,7 +164,7 @@ NTSTATUS CFilterCipherCFB::Decode(UCHAR *buffer, ULONG size, AES &aes)
 		do
 		{
 			// encode inplace
-			aes.EncodeBlock(output);
+			m_aes.EncodeBlock(output);
             			
 			ULONG *o = (ULONG*) (output);
 			ULONG *b = (ULONG*) (buffer + current);
@@ -221,53 +203,6 @@ NTSTATUS CFilterCipherCFB::Decode(UCHAR *buffer, ULONG size, AES &aes)
 	return STATUS_SUCCESS;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-#pragma LOCKEDCODE
-
-NTSTATUS CFilterCipherCFB::Encode(UCHAR *buffer, ULONG size)
-{
-	ASSERT(buffer);
-	ASSERT(size);
-
-	if(m_keySize == 32)
-	{
-		return Encode(buffer, size, RijndealCoder<AES_256>());
-	}
-	else if(m_keySize == 16)
-	{
-		return Encode(buffer, size, RijndealCoder<AES_128>());
-	}
-
-	ASSERT(m_keySize == 24);
-
-	return Encode(buffer, size, RijndealCoder<AES_192>());
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-#pragma LOCKEDCODE
-
-NTSTATUS CFilterCipherCFB::Decode(UCHAR *buffer, ULONG size)
-{
-	ASSERT(buffer);
-	ASSERT(size);
-
-	if(m_keySize == 32)
-	{
-		return Decode(buffer, size, RijndealCoder<AES_256>());
-	}
-	else if(m_keySize == 16)
-	{
-		return Decode(buffer, size, RijndealCoder<AES_128>());
-	}
-
-	ASSERT(m_keySize == 24);
-
-	return Decode(buffer, size, RijndealCoder<AES_192>());
-}
-
-#endif //FILFILE_USE_CFB
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -24,6 +24,8 @@ public:
 
 	enum c_constants { c_blockSize = 16 }; // in bytes
 
+	CFilterCipherCFB()
+	{ }
 	explicit CFilterCipherCFB(FILFILE_CRYPT_CONTEXT const* crypt)	
 	{ Init(crypt); }
 	~CFilterCipherCFB()	
@@ -43,14 +45,9 @@ public:
 
 private:
 
-	template<typename AES>
-	NTSTATUS			Encode(UCHAR *buffer, ULONG size, AES &aes);
-	template<typename AES>
-	NTSTATUS			Decode(UCHAR *buffer, ULONG size, AES &aes);
 
    						// DATA
-	UCHAR const*		m_key;
-	ULONG				m_keySize;
+	RijndealCoder<AES_ANY>	m_aes;				// expanded at Init
 
 	LONGLONG			m_nonce;
 	LONGLONG			m_offset;
@@ -62,19 +59,25 @@ inline
 NTSTATUS CFilterCipherCFB::Init(FILFILE_CRYPT_CONTEXT const* crypt)
 { 
 	ASSERT(crypt);
-
-	m_key	  = crypt->Key.m_key;
-	m_keySize = crypt->Key.m_size;
+	ASSERT(crypt->Key.m_size);
 
 	m_nonce   = crypt->Nonce.QuadPart;
 	m_offset  = crypt->Offset.QuadPart;
 
+	// Expand the key once, requests then only set their offset
+	if(!m_aes.Init(crypt->Key.m_key, crypt->Key.m_size, false))
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
 	return STATUS_SUCCESS;
 }
 
 inline
 void CFilterCipherCFB::Close()
 {
+	m_aes.Close();
+
 	RtlZeroMemory(this, sizeof(*this));
 }
 
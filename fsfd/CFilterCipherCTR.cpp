@@ -11,7 +11,6 @@
 
 #include "CFilterBase.h"
 
-#ifdef FILFILE_USE_CTR
 #include "CFilterCipherCTR.h"
 
 // force template instances
@@ -19,6 +18,7 @@
  template class RijndealCoder<AES_128>;
  template class RijndealCoder<AES_192>;
  template class RijndealCoder<AES_256>;
+ template class RijndealCoder<AES_ANY>;
 #endif
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -69,20 +69,14 @@ void CFilterCipherCTR::Xor(UCHAR *buffer, UCHAR const* xor, ULONG size)
 
 #pragma LOCKEDCODE
 
-template<typename AES>
-NTSTATUS CFilterCipherCTR::Code(UCHAR *buffer, ULONG size, AES &aes)
+NTSTATUS CFilterCipherCTR::Encode(UCHAR *buffer, ULONG size)
 {
 	ASSERT(buffer);
 	ASSERT(size);
 
-	ASSERT(m_key);
-	ASSERT(m_keySize == aes.c_keySize);
-
 	ULONG current = 0;
 	UCHAR stream[c_blockSize];
 
-	aes.Init(m_key, false);
-
 	while(current < size)
 	{
 		// build CTR block (Nonce | Offset)
@@ -90,7 +84,7 @@ NTSTATUS CFilterCipherCTR::Code(UCHAR *buffer, ULONG size, AES &aes)
 		*((LONGLONG*) stream + 1) = m_offset;
 
 		// encrypt inplace
-		aes.EncodeBlock(stream);
+		m_aes.EncodeBlock(stream);
 
 		ULONG remaining = size - current;
 
@@ -109,30 +103,6 @@ NTSTATUS CFilterCipherCTR::Code(UCHAR *buffer, ULONG size, AES &aes)
 	return STATUS_SUCCESS;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-#pragma LOCKEDCODE
-
-NTSTATUS CFilterCipherCTR::Encode(UCHAR *buffer, ULONG size)
-{
-	ASSERT(buffer);
-	ASSERT(size);
-
-	if(m_keySize == 32)
-	{
-		return Code(buffer, size, RijndealCoder<AES_256>());
-	}
-	else if(m_keySize == 16)
-	{
-		return Code(buffer, size, RijndealCoder<AES_128>());
-	}
-
-	ASSERT(m_keySize == 24);
-
-	return Code(buffer, size, RijndealCoder<AES_192>());
-}
-
-#endif //FILFILE_USE_CTR
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
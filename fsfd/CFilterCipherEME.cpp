@@ -9,7 +9,6 @@
 
 #include "CFilterBase.h"
 
-#ifdef FILFILE_USE_EME
 #include "CFilterCipherEME.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -54,7 +53,7 @@ NTSTATUS CFilterCipherEME::Init(FILFILE_CRYPT_CONTEXT const* crypt)
 			err = kPGPError_FeatureNotAvailable;
 
 			// Dispatch on cipher mode used for this key (FEK)
-			if(FILFILE_CIPHER_MODE_EME_2 == HIWORD(m_cipher))
+			if(FILFILE_CIPHER_MODE_EME_2 == (HIWORD(m_cipher) & FILFILE_CIPHER_MODE_MASK))
 			{
 				err = PGPNewEME2Context(m_aes, &m_eme2);
 
@@ -67,7 +66,7 @@ NTSTATUS CFilterCipherEME::Init(FILFILE_CRYPT_CONTEXT const* crypt)
 			}
 			else
 			{
-				ASSERT(FILFILE_CIPHER_MODE_EME == HIWORD(m_cipher));
+				ASSERT(FILFILE_CIPHER_MODE_EME == (HIWORD(m_cipher) & FILFILE_CIPHER_MODE_MASK));
 
 				// Caution: Will return OutOfMemory if provided size for FixedMgr is too small
 				err = PGPNewEMEContext(m_aes, &m_eme);
@@ -255,7 +254,6 @@ NTSTATUS CFilterCipherEME::Decode(UCHAR *buffer, ULONG size)
 	return IsPGPError(err) ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
 }
 
-#endif //FILFILE_USE_EME
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -83,7 +83,7 @@ private:
 inline
 bool CFilterCipherEME::UseEME2()
 {
-	return (FILFILE_CIPHER_MODE_EME_2 == HIWORD(m_cipher));
+	return (FILFILE_CIPHER_MODE_EME_2 == (HIWORD(m_cipher) & FILFILE_CIPHER_MODE_MASK));
 }
 
 inline 
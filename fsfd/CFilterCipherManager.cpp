@@ -162,9 +162,15 @@ NTSTATUS CFilterCipherManager::ReadHeader(FILE_OBJECT *file, ULONG flags)
 		m_readWrite.Length			= CFilterHeader::c_check;
 		m_readWrite.Major			= IRP_MJ_READ;
 
+		m_extension->Volume.m_statistics.Add(FILFILE_STAT_HEADER_PROBES);
+
+		LONGLONG const stage = CFilterStatistics::StageStart();
+
 		ASSERT(m_bufferSize >= m_readWrite.Length);
 		status = CFilterBase::ReadWrite(m_extension->Lower, file, &m_readWrite);
 
+		m_extension->Volume.m_statistics.AddStage(FILFILE_STAT_STAGE_HEADER, stage);
+
 		if(NT_SUCCESS(status))
 		{
 			status = STATUS_UNSUCCESSFUL;
@@ -318,7 +324,8 @@ NTSTATUS CFilterCipherManager::WriteHeader(FILE_OBJECT *file, CFilterHeader *hea
 
 			// Set header block params
 			block->Magic		= FILF_POOL_TAG;
-			block->Version		= 1;
+			// Minor version tells older readers about data units larger than a sector
+			block->Version		= (CFilterContext::CipherUnit(header->m_key.m_cipher) > CFilterBase::c_sectorSize) ? 2 : 1;
 	       	// Copy cipher attributes from key
 			block->Cipher		= header->m_key.m_cipher;
 			block->BlockSize	= header->m_blockSize;
@@ -351,6 +358,205 @@ NTSTATUS CFilterCipherManager::WriteHeader(FILE_OBJECT *file, CFilterHeader *hea
 
 #pragma PAGEDCODE
 
+NTSTATUS CFilterCipherManager::RewrapHeader(FILE_OBJECT *file, CFilterHeader *header)
+{
+	ASSERT(file);
+	ASSERT(header);
+
+	PAGED_CODE();
+
+	ASSERT(header->m_payloadSize);
+	ASSERT(header->m_blockSize >= header->m_payloadSize);
+	ASSERT(0 == (header->m_blockSize % CFilterHeader::c_align));
+	ASSERT(header->m_key.m_size);
+	ASSERT(header->m_key.m_cipher);
+
+	ASSERT(m_extension);
+
+	// Unlike WriteHeader(), only the FileKey and Payload related parts of the present Header block 
+	// are rewritten. Everything else, in particular the Nonce and the random fill, stays untouched. 
+	// The new image is first written into the second half of the block, which holds random fill,
+	// and only then over the present one. If the latter is torn, RecognizeHeader() finds the copy.
+
+	NTSTATUS status = ReadHeader(file);
+
+	if(NT_ERROR(status))
+	{
+		DBGPRINT(("RewrapHeader -ERROR: ReadHeader() failed [0x%08x]\n", status));
+
+		return status;
+	}
+
+	FILFILE_HEADER_BLOCK *const block = (FILFILE_HEADER_BLOCK*) m_buffer;
+
+	// The file layout must not change
+	if((block->BlockSize != header->m_blockSize) || (block->Nonce.QuadPart != header->m_nonce.QuadPart))
+	{
+		DBGPRINT(("RewrapHeader -ERROR: Header layout differs, BlockSize[0x%x,0x%x]\n", block->BlockSize, header->m_blockSize));
+
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	ASSERT(m_bufferSize >= block->BlockSize);
+	ASSERT(block->BlockSize > sizeof(FILFILE_HEADER_BLOCK) + header->m_payloadSize);
+
+	// Compute range to be rewritten, covering both the old and new Payload
+	ULONG length = sizeof(FILFILE_HEADER_BLOCK) + max(block->PayloadSize, header->m_payloadSize);
+
+	length = (length + (CFilterBase::c_sectorSize - 1)) & ~(CFilterBase::c_sectorSize - 1);
+
+	ULONG const shadow = block->BlockSize / 2;
+
+	// Copy must neither overlap the present image nor exceed the block
+	if(length > shadow)
+	{
+		DBGPRINT(("RewrapHeader: no room for copy, rewrite[0x%x] Block[0x%x]\n", length, block->BlockSize));
+
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	// Shrinking Payload, fill gap with random data as WriteHeader() does
+	if(block->PayloadSize > header->m_payloadSize)
+	{
+		m_extension->Volume.m_context->Randomize((UCHAR*) block + sizeof(FILFILE_HEADER_BLOCK) + header->m_payloadSize, block->PayloadSize - header->m_payloadSize);
+	}
+
+	// Minor version tells older readers about data units larger than a sector
+	block->Version		= (CFilterContext::CipherUnit(header->m_key.m_cipher) > CFilterBase::c_sectorSize) ? 2 : 1;
+	// Copy cipher attributes from key
+	block->Cipher		= header->m_key.m_cipher;
+	block->PayloadSize	= header->m_payloadSize;
+	block->PayloadCrc	= CFilterBase::Crc32(header->m_payload, header->m_payloadSize);
+	block->Deepness		= header->m_deepness;
+
+	// Copy Header Payload
+	RtlCopyMemory((UCHAR*) block + sizeof(FILFILE_HEADER_BLOCK), header->m_payload, header->m_payloadSize);
+	// Copy encrypted FileKey, copy always full 256 bits
+	RtlCopyMemory((UCHAR*) &block->FileKey, header->m_key.m_key, sizeof(block->FileKey));
+
+	ULONG const crc = block->PayloadCrc;
+
+	DBGPRINT(("RewrapHeader: Sizes(blk,pay)[0x%x, 0x%x] rewrite[0x%x] copy[0x%x]\n", block->BlockSize, block->PayloadSize, length, shadow));
+
+	// First the copy, make it durable before touching the present image
+	m_readWrite.Offset.QuadPart	= shadow;
+	m_readWrite.Length			= length;
+	m_readWrite.Major			= IRP_MJ_WRITE;
+
+	status = CFilterBase::ReadWrite(m_extension->Lower, file, &m_readWrite);
+
+	if(NT_SUCCESS(status))
+	{
+		status = CFilterBase::FlushFile(m_extension->Lower, file);
+	}
+
+	if(NT_SUCCESS(status))
+	{
+		// Then swap
+		m_readWrite.Offset.QuadPart = 0;
+
+		status = CFilterBase::ReadWrite(m_extension->Lower, file, &m_readWrite);
+
+		if(NT_SUCCESS(status))
+		{
+			status = CFilterBase::FlushFile(m_extension->Lower, file);
+		}
+	}
+
+	if(NT_SUCCESS(status))
+	{
+		RtlZeroMemory(m_buffer, CFilterBase::c_sectorSize);
+
+		m_readWrite.Offset.QuadPart = 0;
+		m_readWrite.Length			= CFilterBase::c_sectorSize;
+		m_readWrite.Major			= IRP_MJ_READ;
+
+		// Read back first sector to verify what has been written
+		status = CFilterBase::ReadWrite(m_extension->Lower, file, &m_readWrite);
+
+		if(NT_SUCCESS(status))
+		{
+			if((FILF_POOL_TAG != block->Magic) || 
+			   (crc != block->PayloadCrc) ||
+			   (sizeof(block->FileKey) != RtlCompareMemory(block->FileKey, header->m_key.m_key, sizeof(block->FileKey))))
+			{
+				DBGPRINT(("RewrapHeader -ERROR: verification failed\n"));
+
+				status = STATUS_FILE_CORRUPT_ERROR;
+			}
+		}
+	}
+
+	if(NT_SUCCESS(status))
+	{
+		// Replace the copy with random fill again, the present image is complete now
+		m_extension->Volume.m_context->Randomize(m_buffer, length);
+
+		m_readWrite.Offset.QuadPart = shadow;
+		m_readWrite.Length			= length;
+		m_readWrite.Major			= IRP_MJ_WRITE;
+
+		if(NT_ERROR(CFilterBase::ReadWrite(m_extension->Lower, file, &m_readWrite)))
+		{
+			// Harmless, the copy equals the present image
+			DBGPRINT(("RewrapHeader -WARN: copy not wiped\n"));
+		}
+	}
+
+	m_readWrite.Offset.QuadPart = 0;
+
+	if(NT_ERROR(status))
+	{
+		DBGPRINT(("RewrapHeader -ERROR: HEADER rewrite failed [0x%08x]\n", status));
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+bool CFilterCipherManager::RecoverHeader()
+{
+	PAGED_CODE();
+
+	FILFILE_HEADER_BLOCK *const block = (FILFILE_HEADER_BLOCK*) m_buffer;
+
+	// Copy left behind by an interrupted RewrapHeader() in the second half of the block?
+	ULONG const shadow = block->BlockSize / 2;
+
+	if(!shadow || (block->BlockSize > m_bufferSize) || (shadow % CFilterBase::c_sectorSize))
+	{
+		return false;
+	}
+
+	FILFILE_HEADER_BLOCK const*const copy = (FILFILE_HEADER_BLOCK*) (m_buffer + shadow);
+
+	if((FILF_POOL_TAG != copy->Magic) ||
+	   (copy->BlockSize != block->BlockSize) ||
+	   (copy->Nonce.QuadPart != block->Nonce.QuadPart) ||
+	   (sizeof(FILFILE_HEADER_BLOCK) + copy->PayloadSize > shadow))
+	{
+		return false;
+	}
+
+	if(copy->PayloadCrc != CFilterBase::Crc32((UCHAR const*) copy + sizeof(FILFILE_HEADER_BLOCK), copy->PayloadSize))
+	{
+		return false;
+	}
+
+	DBGPRINT(("RecoverHeader: using copy, Payload[0x%x] Crc[0x%08x]\n", copy->PayloadSize, copy->PayloadCrc));
+
+	RtlMoveMemory(m_buffer, copy, sizeof(FILFILE_HEADER_BLOCK) + copy->PayloadSize);
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
 NTSTATUS CFilterCipherManager::RecognizeHeader(FILE_OBJECT *file, CFilterHeader *header, ULONG flags,FILFILE_TRACK_CONTEXT *track)
 {
 	ASSERT(file);
@@ -426,6 +632,14 @@ NTSTATUS CFilterCipherManager::RecognizeHeader(FILE_OBJECT *file, CFilterHeader
 						}
 					}
 
+					// Valid Header, but its cipher mode cannot be coded here
+					if(NT_SUCCESS(status) && keySize && !CFilterContext::IsCipherModeSupported(HIWORD(block->Cipher)))
+					{
+						DBGPRINT(("RecognizeHeader -ERROR: unsupported cipher mode [0x%x]\n", HIWORD(block->Cipher)));
+
+						status = STATUS_NOT_SUPPORTED;
+					}
+
 					if(NT_SUCCESS(status))
 					{
 						DBGPRINT(("RecognizeHeader: valid Header, Sizes(blk,pay)[0x%x, 0x%x] Crc[0x%08x] Nonce[0x%I64x] Deepness[0x%x]\n", block->BlockSize, block->PayloadSize, crc, block->Nonce, block->Deepness));
@@ -489,7 +703,13 @@ NTSTATUS CFilterCipherManager::RecognizeHeader(FILE_OBJECT *file, CFilterHeader
 			status = STATUS_UNSUCCESSFUL;
 
 			// compute CRC of Header payload
-			ULONG const crc = CFilterBase::Crc32(m_buffer + sizeof(FILFILE_HEADER_BLOCK), block->PayloadSize);
+			ULONG crc = CFilterBase::Crc32(m_buffer + sizeof(FILFILE_HEADER_BLOCK), block->PayloadSize);
+
+			// Torn by an interrupted rewrap?
+			if((crc != block->PayloadCrc) && RecoverHeader())
+			{
+				crc = CFilterBase::Crc32(m_buffer + sizeof(FILFILE_HEADER_BLOCK), block->PayloadSize);
+			}
 
 			if(crc == block->PayloadCrc)							
 			{
@@ -530,6 +750,14 @@ NTSTATUS CFilterCipherManager::RecognizeHeader(FILE_OBJECT *file, CFilterHeader
 					}
 				}
 
+				// Valid Header, but its cipher mode cannot be coded here
+				if(NT_SUCCESS(status) && keySize && !CFilterContext::IsCipherModeSupported(HIWORD(block->Cipher)))
+				{
+					DBGPRINT(("RecognizeHeader -ERROR: unsupported cipher mode [0x%x]\n", HIWORD(block->Cipher)));
+
+					status = STATUS_NOT_SUPPORTED;
+				}
+
 				if(NT_SUCCESS(status))
 				{
 					DBGPRINT(("RecognizeHeader: valid Header, Sizes(blk,pay)[0x%x, 0x%x] Crc[0x%08x] Nonce[0x%I64x] Deepness[0x%x]\n", block->BlockSize, block->PayloadSize, crc, block->Nonce, block->Deepness));
@@ -618,7 +846,11 @@ NTSTATUS CFilterCipherManager::UpdateTail(FILE_OBJECT *file, CFilterContextLink
 		return STATUS_UNSUCCESSFUL;
 	}
 
-	NTSTATUS status = Init(CFilterBase::c_sectorSize);
+	// Recode the last data unit as a whole. The Header keeps units aligned natively
+	ULONG const unit = CFilterContext::CipherUnit(link->m_fileKey.m_cipher);
+	ASSERT(0 == (CFilterHeader::c_align % unit));
+
+	NTSTATUS status = Init(unit);
 
 	if(NT_SUCCESS(status))
 	{
@@ -631,19 +863,18 @@ NTSTATUS CFilterCipherManager::UpdateTail(FILE_OBJECT *file, CFilterContextLink
 		m_fileSize.QuadPart -= filler;
 		
 		m_readWrite.Offset	 = m_fileSize;
-		m_readWrite.Length	 = CFilterBase::c_sectorSize;
 		m_readWrite.Major	 = IRP_MJ_READ;
 
-		// ensure sector alignment
-		if(m_readWrite.Offset.LowPart & (CFilterBase::c_sectorSize - 1))
+		// ensure unit alignment
+		if(m_readWrite.Offset.LowPart & (unit - 1))
 		{
-			// round down to sector boundary
-			m_readWrite.Offset.LowPart &= -CFilterBase::c_sectorSize;
+			// round down to unit boundary
+			m_readWrite.Offset.LowPart &= -(LONG) unit;
 		}
 		else
 		{
-			ASSERT(m_readWrite.Offset.QuadPart >= CFilterBase::c_sectorSize);
-			m_readWrite.Offset.QuadPart -= CFilterBase::c_sectorSize;
+			ASSERT(m_readWrite.Offset.QuadPart >= unit);
+			m_readWrite.Offset.QuadPart -= unit;
 		}
 
 		FILFILE_CRYPT_CONTEXT crypt;
@@ -653,16 +884,19 @@ NTSTATUS CFilterCipherManager::UpdateTail(FILE_OBJECT *file, CFilterContextLink
 		crypt.Offset.QuadPart  = m_readWrite.Offset.QuadPart - link->m_headerBlockSize;
 		crypt.Key			   = link->m_fileKey;
 
-		// compute valid bytes in last sector
-		ULONG valid = m_fileSize.LowPart & (CFilterBase::c_sectorSize - 1);
+		// compute valid bytes in last unit
+		ULONG valid = m_fileSize.LowPart & (unit - 1);
 
 		if(!valid)
 		{
-			valid = CFilterBase::c_sectorSize;
+			valid = unit;
 		}
 
-		// Check whether Tail isn't a full block of Padding. If so, no need to read it
-		if(padding < CFilterContext::c_blockSize)
+		// Write back whole sectors
+		m_readWrite.Length = (valid + (CFilterBase::c_sectorSize - 1)) & ~(CFilterBase::c_sectorSize - 1);
+
+		// Check whether the unit isn't a full block of Padding only. If so, no need to read it
+		if(valid > padding)
 		{
 			status = CFilterBase::ReadWrite(m_extension->Lower, file, &m_readWrite);
 
@@ -688,7 +922,7 @@ NTSTATUS CFilterCipherManager::UpdateTail(FILE_OBJECT *file, CFilterContextLink
 
 			m_readWrite.Major = IRP_MJ_WRITE;
 
-			// Write sector back
+			// Write unit back
 			status = CFilterBase::ReadWrite(m_extension->Lower, file, &m_readWrite);
 
 			if(NT_ERROR(status))
@@ -698,7 +932,7 @@ NTSTATUS CFilterCipherManager::UpdateTail(FILE_OBJECT *file, CFilterContextLink
 		}
 		else
 		{
-			DBGPRINT(("UpdateTail: couldn't read last sector [0x%08x]\n", status));
+			DBGPRINT(("UpdateTail: couldn't read last unit [0x%08x]\n", status));
 		}
 
 		// be paranoid
@@ -870,7 +1104,7 @@ NTSTATUS CFilterCipherManager::ProcessFile(FILE_OBJECT *file, FILFILE_TRACK_CONT
 	ASSERT(!write || (write && write->Header.m_blockSize));
 
 	// Ensure that Tail always fits in our buffer
-	C_ASSERT(CFilterBase::c_sectorSize >= CFilterContext::c_tail);
+	C_ASSERT((ULONG) CFilterBase::c_sectorSize >= (ULONG) CFilterContext::c_tail);
 
 	// Init buffers with enough room for maximum buffer plus additional sector
 	NTSTATUS status = Init(MM_MAXIMUM_DISK_IO_SIZE + CFilterBase::c_sectorSize);
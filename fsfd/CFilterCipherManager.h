@@ -38,6 +38,7 @@ public:
 
 	NTSTATUS					RecognizeHeader(FILE_OBJECT *file, CFilterHeader *header = 0, ULONG flags = 0,FILFILE_TRACK_CONTEXT *track=NULL);
 	NTSTATUS					WriteHeader(FILE_OBJECT *file, CFilterHeader* header);
+	NTSTATUS					RewrapHeader(FILE_OBJECT *file, CFilterHeader* header);
 
 	NTSTATUS					ProcessFile(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *current, FILFILE_TRACK_CONTEXT *future);
 	NTSTATUS					UpdateTail(FILE_OBJECT *file, CFilterContextLink *link, LARGE_INTEGER *fileSize = 0);
@@ -53,6 +54,7 @@ private:
 	NTSTATUS					ProcessFileEqualDown(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *read, FILFILE_TRACK_CONTEXT *write, LONG distance);
 
 	NTSTATUS					ReadHeader(FILE_OBJECT *file, ULONG flags = 0);
+	bool						RecoverHeader();
 	NTSTATUS					AutoConfigPost(FILE_OBJECT *file);
 
 								// DATA
@@ -0,0 +1,195 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterCipherXTS.cpp: implementation of the CFilterCipherXTS class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define DRIVER_USE_NTIFS	// use the NTIFS header
+#include "driver.h"
+
+#include "CFilterBase.h"
+
+#include "CFilterCipherXTS.h"
+#include "CFilterContext.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+NTSTATUS CFilterCipherXTS::Init(FILFILE_CRYPT_CONTEXT const* crypt)
+{
+	ASSERT(crypt);
+	ASSERT(crypt->Key.m_cipher);
+	ASSERT(0 == (crypt->Offset.QuadPart % c_blockSize));
+
+	// Clear everything
+	m_mgr	 = 0;
+	m_xts	 = 0;
+
+	m_nonce  = crypt->Nonce.QuadPart;
+	m_offset = crypt->Offset.QuadPart;
+
+	ULONG const keySize  = crypt->Key.m_size;
+	ULONG const unitSize = CFilterContext::CipherUnit(crypt->Key.m_cipher);
+
+	ASSERT(0 == (unitSize % c_blockSize));
+
+	if(!keySize || (keySize > c_keySizeMax))
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	// Allocate memory from c_memoryPool data area
+	PGPError err = PGPNewFixedSizeMemoryMgr(m_memoryPool, c_memoryNeeded, &m_mgr);
+
+	if(IsntPGPError(err))
+	{
+		PGPCipherAlgorithm const alg =  (keySize == 16) ? kPGPCipherAlgorithm_AES128
+									  : (keySize == 24) ? kPGPCipherAlgorithm_AES192
+									  : kPGPCipherAlgorithm_AES256;
+
+		PGPSymmetricCipherContextRef aes = 0;
+
+		err = PGPNewSymmetricCipherContext(m_mgr, alg, &aes);
+
+		if(IsntPGPError(err))
+		{
+			// Data key followed by tweak key
+			UCHAR keys[2 * c_keySizeMax + 16];
+
+			err = DeriveKeys(aes, crypt->Key.m_key, keySize, keys);
+
+			if(IsntPGPError(err))
+			{
+				err = PGPNewXTSContext(aes, unitSize, &m_xts);
+
+				// AES now belongs to XTS, unless parameters were rejected
+				if(err != kPGPError_BadParams)
+				{
+					aes = 0;
+				}
+
+				if(IsntPGPError(err))
+				{
+					err = PGPInitXTS(m_xts, keys);
+				}
+			}
+
+			RtlZeroMemory(keys, sizeof(keys));
+
+			if(aes)
+			{
+				PGPFreeSymmetricCipherContext(aes);
+			}
+
+			if(IsntPGPError(err))
+			{
+				return STATUS_SUCCESS;
+			}
+		}
+	}
+
+	return STATUS_UNSUCCESSFUL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+PGPError CFilterCipherXTS::DeriveKeys(PGPSymmetricCipherContextRef aes, UCHAR const* key, ULONG keySize, UCHAR *keys)
+{
+	ASSERT(aes);
+	ASSERT(key);
+	ASSERT(keySize);
+	ASSERT(keys);
+
+	RtlCopyMemory(keys, key, keySize);
+
+	PGPError err = PGPInitSymmetricCipher(aes, key);
+
+	if(IsntPGPError(err))
+	{
+		UCHAR block[16];
+
+		// Tweak key := E(FileKey, "XTS" | counter), as many blocks as needed
+		for(ULONG index = 0; (index * sizeof(block)) < keySize; ++index)
+		{
+			RtlZeroMemory(block, sizeof(block));
+
+			block[0]  = 'X';
+			block[1]  = 'T';
+			block[2]  = 'S';
+			block[15] = (UCHAR) (index + 1);
+
+			err = PGPSymmetricCipherEncrypt(aes, block, keys + keySize + index * sizeof(block));
+
+			if(IsPGPError(err))
+			{
+				break;
+			}
+		}
+
+		RtlZeroMemory(block, sizeof(block));
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+void CFilterCipherXTS::Close()
+{
+	if(m_xts)
+	{
+		PGPFreeXTSContext(m_xts);
+	}
+
+	if(m_mgr)
+	{
+		PGPFreeMemoryMgr(m_mgr);
+	}
+
+	RtlZeroMemory(this, sizeof(*this));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+NTSTATUS CFilterCipherXTS::Encode(UCHAR *buffer, ULONG size)
+{
+	ASSERT(buffer);
+	ASSERT(size);
+
+	ASSERT(0 == (size % c_blockSize));
+	ASSERT(m_xts);
+
+	PGPError const err = PGPXTSEncryptAt(m_xts, buffer, size, buffer, m_offset, m_nonce);
+
+	return IsPGPError(err) ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+NTSTATUS CFilterCipherXTS::Decode(UCHAR *buffer, ULONG size)
+{
+	ASSERT(buffer);
+	ASSERT(size);
+
+	ASSERT(0 == (size % c_blockSize));
+	ASSERT(m_xts);
+
+	PGPError const err = PGPXTSDecryptAt(m_xts, buffer, size, buffer, m_offset, m_nonce);
+
+	return IsPGPError(err) ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
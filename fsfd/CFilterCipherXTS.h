@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterCipherXTS.h: interface for the CFilterCipherXTS class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilterCipherXTS_H__8F3A61D2_4C7B_4E19_A05D_93B2E6C1F744__INCLUDED_)
+#define AFX_CFilterCipherXTS_H__8F3A61D2_4C7B_4E19_A05D_93B2E6C1F744__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+extern "C"
+{
+	// suppress warnings on #define offsetof in ddk
+	#ifdef offsetof
+	#undef offsetof
+	#endif
+
+	#include "pgpErrors.h"
+	#include "pgpMemoryMgr.h"
+	#include "pgpSymmetricCipher.h"
+	#include "pgpXTS.h"
+}
+
+class CFilterCipherXTS
+{
+	// XTS needs a data and a tweak key, but the Header holds a single FileKey. So the
+	// tweak key is derived by encrypting constant blocks with the FileKey.
+	//
+	// The data unit is taken from the key and may be larger than c_blockSize, as XTS
+	// codes any sector of a data unit on its own.
+
+public:
+
+	enum c_constants
+	{
+		c_blockSize		= 512,				// bytes, I/O granularity and smallest data unit
+
+		c_poolRegion	= 1597,				// bytes, region of the flat allocator, a Fibonacci number. Holds
+											// both AES contexts and the XTS context
+		#ifdef _AMD64_						// region descriptor ahead of it, pointer and padding are wider on x64
+		 c_poolDescriptor = 12 + 12,
+		#else
+		 c_poolDescriptor = 12,
+		#endif
+
+		c_memoryNeeded	= c_poolRegion + c_poolDescriptor,
+
+		c_keySizeMax	= 32,				// bytes, per key
+	};
+
+	CFilterCipherXTS()
+	{ }
+	~CFilterCipherXTS()
+	{ Close(); }
+
+	NTSTATUS						Init(FILFILE_CRYPT_CONTEXT const* crypt);
+	void							Close();
+
+	NTSTATUS						Encode(UCHAR *buffer, ULONG size);
+	NTSTATUS						Decode(UCHAR *buffer, ULONG size);
+
+	void							SetOffset(LARGE_INTEGER *offset);
+
+private:
+
+	PGPError						DeriveKeys(PGPSymmetricCipherContextRef aes, UCHAR const* key, ULONG keySize, UCHAR *keys);
+
+   									// DATA
+	LONGLONG						m_nonce;
+	LONGLONG						m_offset;			// bytes
+
+	PGPMemoryMgrRef					m_mgr;
+	PGPXTSContextRef				m_xts;
+
+	UCHAR							m_memoryPool[c_memoryNeeded];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+void CFilterCipherXTS::SetOffset(LARGE_INTEGER *offset)
+{
+	ASSERT(offset);
+	ASSERT(0 == (offset->QuadPart % c_blockSize));
+
+	m_offset = offset->QuadPart;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilterCipherXTS_H__8F3A61D2_4C7B_4E19_A05D_93B2E6C1F744__INCLUDED_)
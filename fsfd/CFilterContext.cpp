@@ -30,7 +30,7 @@ NTSTATUS CFilterContext::Init()
 {
 	PAGED_CODE();
 
-	m_nonce.QuadPart  = 0;
+	m_nonce			  = 0;
 	m_macCrc		  = 0;
 
 	NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
@@ -42,30 +42,20 @@ NTSTATUS CFilterContext::Init()
 		// init lookaside list used for small (fast) allocations
 		ExInitializeNPagedLookasideList(m_lookAside, 0,0,0, c_lookAsideSize, FILF_POOL_TAG, 0);
 
-		status = ExInitializeResourceLite(&m_filesResource);
+		// Initialize various objects
+		m_tracker.Init();
+		m_headers.Init();
 
-		if(NT_SUCCESS(status))
-		{
-			status = ExInitializeResourceLite(&m_directoriesResource);
+		status = m_sizes.Init();
+		
+		m_randomizerLow.Init(false);
+		m_randomizerHigh.Init(true);
 
-			if(NT_SUCCESS(status))
-			{
-				// Initialize various objects
-				m_files.Init();
-				m_directories.Init();
-				m_tracker.Init();
-				m_headers.Init();
-				
-				m_randomizerLow.Init(false);
-				m_randomizerHigh.Init(true);
-
-				m_blackList.Init();
-				m_appList.Init();
-			}
-		}
-	}
+		m_fileKeys.Init(this, &m_randomizerHigh);
 
-	ExInitializeFastMutex(&m_nonceLock);
+		m_blackList.Init();
+		m_appList.Init();
+	}
 
 	return status;
 }
@@ -133,24 +123,19 @@ void CFilterContext::Close()
 	m_appList.Close();
 	m_blackList.Close();
 
+	// Stop refilling before the randomizer goes away
+	m_fileKeys.Close();
+
 	m_randomizerLow.Close();
 	m_randomizerHigh.Close();
 
 	m_tracker.Close();
 
-	// free File Tracker
-	ExAcquireResourceExclusiveLite(&m_filesResource, true);
-	m_files.Close();
-	ExDeleteResourceLite(&m_filesResource);
-
-	// free Directory Tracker
-	ExAcquireResourceExclusiveLite(&m_directoriesResource, true);
-	m_directories.Close();
-	ExDeleteResourceLite(&m_directoriesResource);
-
-	m_nonce.QuadPart = 0;
+	m_nonce = 0;
 
 	m_headers.Close();
+
+	m_sizes.Close();
 		
 	if(m_lookAside)
 	{
@@ -192,44 +177,25 @@ NTSTATUS CFilterContext::GenerateNonce(LARGE_INTEGER *nonce)
 		temp[7] = m_macCrc;
 	}
 
-	ExAcquireFastMutex(&m_nonceLock);
-	
-	// if already used, just increment last one used
-	if((ULONGLONG) candidate.QuadPart <= (ULONGLONG) m_nonce.QuadPart)
+	// Publish the new Nonce without a lock. Concurrent creators that lose the race
+	// simply retry, so every Nonce handed out is still strictly greater than the last
+	for(;;)
 	{
-		candidate.QuadPart = m_nonce.QuadPart + 1;
-	}
-
-	// Save last Nonce
-	*nonce = m_nonce = candidate;
-
-	ExReleaseFastMutex(&m_nonceLock);
+		LONGLONG last = m_nonce;
+		LONGLONG next = candidate.QuadPart;
 
-	#if DBG
-	{
-		// check new Nonce against active ones
-		FsRtlEnterFileSystem();
-		ExAcquireResourceSharedLite(&m_filesResource, true);
-
-		for(ULONG index = 0; index < m_files.Size(); ++index)
+		// if already used, just increment last one used
+		if((ULONGLONG) next <= (ULONGLONG) last)
 		{
-			CFilterFile *const filterFile = m_files.Get(index);
-			ASSERT(filterFile);
-
-			if(candidate.QuadPart == filterFile->m_link.m_nonce.QuadPart)
-			{
-				DBGPRINT(("GenerateNonce -WARN: Nonce[0x%I64x] already used\n", candidate));
-
-				// should never come here ...
-				ASSERT(false);
-				break;
-			}
+			next = last + 1;
 		}
 
-		ExReleaseResourceLite(&m_filesResource);
-		FsRtlExitFileSystem();
+		if(last == InterlockedCompareExchange64(&m_nonce, next, last))
+		{
+			nonce->QuadPart = next;
+			break;
+		}
 	}
-	#endif
 
 	return STATUS_SUCCESS;
 }
@@ -263,21 +229,40 @@ bool CFilterContext::EncodeFileKey(CFilterKey const *entityKey, CFilterKey *file
 		return false;
 	}
 
+	EncodeFileKey(&aes, fileKey, dec);
+
+	// be paranoid
+	RtlZeroMemory(key, sizeof(key));
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterContext::EncodeFileKey(RijndealCoder<AES_256> *aes, CFilterKey *fileKey, bool dec)
+{
+	ASSERT(aes);
+	ASSERT(fileKey);
+
+	PAGED_CODE();
+
 	// encrypt/decrypt two halfes (128 bit each) using the cipher in a CBC-like fashion
 	if(dec)
 	{
 		// decrypt 2nd half
-		aes.DecodeBlock(fileKey->m_key + aes.c_blockSize);
+		aes->DecodeBlock(fileKey->m_key + aes->c_blockSize);
 	}
 	else
 	{
 		// encrypt 1st half
-		aes.EncodeBlock(fileKey->m_key);
+		aes->EncodeBlock(fileKey->m_key);
 	}
 
 	// XOR 1st (encrypted) half with 2nd (plain) half
 	ULONG *s = (ULONG*) (fileKey->m_key);
-	ULONG *t = (ULONG*) (fileKey->m_key + aes.c_blockSize);
+	ULONG *t = (ULONG*) (fileKey->m_key + aes->c_blockSize);
 
 	*t++ ^= *s++;
 	*t++ ^= *s++;
@@ -287,18 +272,13 @@ bool CFilterContext::EncodeFileKey(CFilterKey const *entityKey, CFilterKey *file
 	if(dec)
 	{
 		// decrypt 1st half
-		aes.DecodeBlock(fileKey->m_key);
+		aes->DecodeBlock(fileKey->m_key);
 	}
 	else
 	{
 		// encrypt 2nd half
-		aes.EncodeBlock(fileKey->m_key + aes.c_blockSize);
+		aes->EncodeBlock(fileKey->m_key + aes->c_blockSize);
 	}
-
-	// be paranoid
-	RtlZeroMemory(key, sizeof(key));
-
-	return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -328,243 +308,29 @@ ULONG CFilterContext::AddPaddingFiller(UCHAR *buffer, ULONG size)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#pragma PAGEDCODE
+#pragma LOCKEDCODE
 
-NTSTATUS CFilterContext::Purge(ULONG entityIdentifier, ULONG flags)
+template<typename t_cipher>
+NTSTATUS CFilterContext::Code(UCHAR *buffer, ULONG size, FILFILE_CRYPT_CONTEXT *crypt, bool encode)
 {
-	PAGED_CODE();
-
-	ASSERT(entityIdentifier != ~0u);
-	ASSERT(flags & (ENTITY_DISCARD | ENTITY_PURGE));
+	ASSERT(buffer);
+	ASSERT(crypt);
+	ASSERT(size);
 
-	NTSTATUS status = STATUS_SUCCESS;
+	t_cipher cipher;
 
-	DBGPRINT(("Purge: Dirs[%d] Files[%d] EntityIdentifier[0x%x] Flags[0x%x]\n", m_directories.Size(), 
-																				m_files.Size(), 
-																				entityIdentifier,
-																				flags));
-	FsRtlEnterFileSystem();
+	NTSTATUS status = cipher.Init(crypt);
 
-	// Discard tracked FOs?
-	if(flags & ENTITY_DISCARD)
+	if(NT_SUCCESS(status))
 	{
-		if(m_directories.Size())
-		{
-			// Directories:
-			ExAcquireResourceExclusiveLite(&m_directoriesResource, true);
-
-			for(ULONG pos = 0; pos < m_directories.Size(); ++pos)
-			{
-				CFilterDirectory *const filterDirectory = m_directories.Get(pos);
-				ASSERT(filterDirectory);
-
-				if(!entityIdentifier || (entityIdentifier == filterDirectory->m_entityIdentifier))
-				{
-					DBGPRINT(("Purge: Discard directory FO[0x%p]\n", filterDirectory->m_file));
-
-					m_directories.Remove(0, pos);
-				}
-			}
-
-			ExReleaseResourceLite(&m_directoriesResource);
-		}
-
-		if(m_files.Size())
-		{
-			// Files:
-			ExAcquireResourceExclusiveLite(&m_filesResource, true);
-
-			for(ULONG pos = 0; pos < m_files.Size(); ++pos)
-			{
-				CFilterFile *const filterFile = m_files.Get(pos);
-				ASSERT(filterFile);
-
-				if(filterFile)
-				{
-					if(!entityIdentifier || (entityIdentifier == filterFile->m_link.m_entityIdentifier))
-					{
-						DBGPRINT(("Purge: Discard file FO[0x%p]\n", filterFile->Tracked()));
-
-						m_files.Remove(pos);
-					}
-				}
-			}
-
-			ExReleaseResourceLite(&m_filesResource);
-		}
-
-		FsRtlExitFileSystem();
-
-		return STATUS_SUCCESS;
+		status = (encode) ? cipher.Encode(buffer, size) : cipher.Decode(buffer, size);
 	}
-
-	// Typical purge:
-
-	ASSERT(flags & ENTITY_PURGE);
-
-	// Directories:
-	if(m_directories.Size())
-	{
-		ExAcquireResourceExclusiveLite(&m_directoriesResource, true);
-
-		for(ULONG index = 0; index < m_directories.Size(); ++index)
-		{
-			CFilterDirectory *const filterDirectory = m_directories.Get(index);
-			ASSERT(filterDirectory);
-
-			if(filterDirectory->m_entityIdentifier == entityIdentifier)
-			{
-				DBGPRINT(("Purge: active DIRECTORY Reference, FO[0x%p]\n", filterDirectory->m_file));
-
-				// Invalidate identifier
-				filterDirectory->m_entityIdentifier = ~0u;
-			}
-		}
-
-		ExReleaseResourceLite(&m_directoriesResource);
-	}
-
-	// Files:
-	if(m_files.Size())
+	else
 	{
-		// Phase 1: Take snapshot of currently tracked FOs that
-		// match given (every, if no specified) Entity identifier
-		ExAcquireSharedWaitForExclusive(&m_filesResource, true);
-		
-		FILE_OBJECT **snap	  = 0;
-		ULONG const snapCount = m_files.Size();
-
-		if(snapCount)
-		{
-			status = STATUS_INSUFFICIENT_RESOURCES;
-
-			snap = (FILE_OBJECT**) ExAllocatePool(PagedPool, snapCount * sizeof(FILE_OBJECT*));
-
-			if(snap)
-			{
-				RtlZeroMemory(snap, snapCount * sizeof(FILE_OBJECT*));
-
-				status = STATUS_SUCCESS;
-
-				// Copy tracked FO into snapshot array
-				for(ULONG index = 0; index < snapCount; ++index)
-				{
-					CFilterFile *const filterFile = m_files.Get(index);
-
-					if(filterFile && filterFile->Tracked())
-					{
-						FILE_OBJECT *const file = filterFile->Tracked();
-
-						ASSERT(!CFilterBase::IsStackBased(file));
-	
-						// Skip doomed ones
-						if(filterFile->m_link.m_entityIdentifier != ~0u)
-						{
-							if(!entityIdentifier || (entityIdentifier == filterFile->m_link.m_entityIdentifier))
-							{
-								if(CFilterBase::IsCached(file))
-								{
-									// Copy
-									snap[index] = file;
-								}
-							}
-						}
-					}
-				}
-
-				ExReleaseResourceLite(&m_filesResource);
-				// Let exclusive waiters proceed first
-				ExAcquireSharedWaitForExclusive(&m_filesResource, true);
-
-				// Phase 2: Purge FOs from our snapshot, but only those which are still tracked
-				for(ULONG index = 0; index < snapCount; ++index)
-				{
-					FILE_OBJECT *const file = snap[index];
-
-					// Valid?
-					if(file && file->FsContext)
-					{
-						// Still tracked?
-						if(m_files.Check(file))
-						{
-							// Pin FO
-							ObReferenceObject(file);
-
-							// Do not block the close operation that could be triggered 
-							ExReleaseResourceLite(&m_filesResource);
-
-							DBGPRINT(("Purge: FO[0x%p] FCB[0x%p] at [%d] Flush/Purge\n", file, file->FsContext, index));
-
-							// Flush'n'Purge without pinning
-							if(NT_ERROR(CFilterBase::FlushAndPurgeCache(file, true, false)))
-							{
-								DBGPRINT(("Purge -WARN: FO[0x%p] purging has failed\n", file));
-
-								// Inform caller about
-								status = STATUS_OBJECT_NAME_COLLISION;
-							}
-
-							// Unpin FO
-							ObDereferenceObject(file);
-
-							ExAcquireSharedWaitForExclusive(&m_filesResource, true);
-						}
-					}
-				}
-			}
-		}
-
-		ExReleaseResourceLite(&m_filesResource);
-
-		if(snap)
-		{
-			ExFreePool(snap);
-		}
-
-		if(m_files.Size())
-		{
-			ExAcquireResourceExclusiveLite(&m_filesResource, true);
-
-			DBGPRINT(("Purge: active files [%d]\n", m_files.Size()));
-
-			// Phase 3: Mark remaing FOs as doomed
-			for(ULONG index = 0; index < m_files.Size(); ++index)
-			{
-				CFilterFile *const filterFile = m_files.Get(index);
-
-				if(filterFile)
-				{
-					if(!entityIdentifier || (entityIdentifier == filterFile->m_link.m_entityIdentifier))
-					{
-						// Zero out sensitive data
-						filterFile->m_link.m_fileKey.Clear();
-						filterFile->m_link.m_nonce.QuadPart = 0;
-
-						// Tag Entity identifier as doomed
-						filterFile->m_link.m_entityIdentifier = ~0u;
-						
-						if(!filterFile->m_refCount)
-						{
-							FILE_OBJECT *const file = filterFile->Tracked();
-							
-							if(!file || !CFilterBase::IsCached(file))
-							{
-								DBGPRINT(("Purge: FO[0x%p] FCB[0x%p] Orphaned, remove\n", file, filterFile->m_fcb));
-							
-								m_files.Remove(index);
-								index--;
-							}						
-						}
-					}
-				}
-			}
-
-			ExReleaseResourceLite(&m_filesResource);
-		}
+		// Hmm, really bad...
+		ASSERT(false);
 	}
 
-	FsRtlExitFileSystem();
-
 	return status;
 }
 
@@ -577,42 +343,47 @@ NTSTATUS CFilterContext::Encode(UCHAR *buffer, ULONG size, FILFILE_CRYPT_CONTEXT
 	ASSERT(buffer);
 	ASSERT(crypt);
 	ASSERT(size);
+
+	// Stream's own cipher, expanded once?
+	if(crypt->Cipher)
+	{
+		return crypt->Cipher->Encode(buffer, size, &crypt->Offset);
+	}
     
 	ASSERT(crypt->Nonce.QuadPart);
 	ASSERT(crypt->Key.m_cipher);
 	ASSERT(crypt->Key.m_size);
-				  
-	NTSTATUS status = STATUS_SUCCESS;
-	
-#ifdef FILFILE_USE_CTR
-	// CTR
-	DBGPRINT(("Encode(CTR) Size[0x%x] Offset[0x%I64x] Key[0x%x] Nonce[0x%I64x]\n", size, crypt->Offset, *((ULONG*) crypt->Key.m_key), crypt->Nonce));
-
-	CFilterCipherCTR cipher(crypt);
-#elif defined(FILFILE_USE_CFB)
-	// CFB
-	DBGPRINT(("Encode(CFB) Size[0x%x] Offset[0x%I64x] Key[0x%x] Nonce[0x%I64x]\n", size, crypt->Offset, *((ULONG*) crypt->Key.m_key), crypt->Nonce));
 
-	CFilterCipherCFB cipher(crypt);
-#elif defined(FILFILE_USE_EME)
-	// EME
-	DBGPRINT(("Encode(EME) Size[0x%x] Offset[0x%I64x] Key[0x%x] Nonce[0x%I64x]\n", size, crypt->Offset, *((ULONG*) crypt->Key.m_key), crypt->Nonce));
+	ULONG const mode = CipherMode(crypt->Key.m_cipher);
 
-	CFilterCipherEME cipher;
-	status = cipher.Init(crypt);
-#endif
+	DBGPRINT(("Encode(%u) Size[0x%x] Offset[0x%I64x] Key[0x%x] Nonce[0x%I64x]\n", mode, size, crypt->Offset, *((ULONG*) crypt->Key.m_key), crypt->Nonce));
 
-	if(NT_SUCCESS(status))
-	{
-		status = cipher.Encode(buffer, size);
-	}
-	else
+	// Dispatch on cipher mode used for this key
+	switch(mode)
 	{
-		// Hmm, really bad...
-		ASSERT(false);
+		case FILFILE_CIPHER_MODE_CTR:
+			return Code<CFilterCipherCTR>(buffer, size, crypt, true);
+
+		case FILFILE_CIPHER_MODE_CFB:
+			ASSERT(IsCipherModeSupported(mode));
+			return Code<CFilterCipherCFB>(buffer, size, crypt, true);
+
+		case FILFILE_CIPHER_MODE_EME:
+		case FILFILE_CIPHER_MODE_EME_2:
+			ASSERT(IsCipherModeSupported(mode));
+			return Code<CFilterCipherEME>(buffer, size, crypt, true);
+
+		case FILFILE_CIPHER_MODE_XTS:
+			ASSERT(IsCipherModeSupported(mode));
+			return Code<CFilterCipherXTS>(buffer, size, crypt, true);
+
+		default:
+			break;
 	}
 
-	return status;
+	DBGPRINT(("Encode -ERROR: unknown cipher mode[0x%x]\n", mode));
+
+	return STATUS_NOT_SUPPORTED;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -624,42 +395,46 @@ NTSTATUS CFilterContext::Decode(UCHAR *buffer, ULONG size, FILFILE_CRYPT_CONTEXT
 	ASSERT(buffer);
 	ASSERT(crypt);
 	ASSERT(size);
+
+	// Stream's own cipher, expanded once?
+	if(crypt->Cipher)
+	{
+		return crypt->Cipher->Decode(buffer, size, &crypt->Offset);
+	}
     
 	ASSERT(crypt->Nonce.QuadPart);
 	ASSERT(crypt->Key.m_cipher);
 	ASSERT(crypt->Key.m_size);
 
-	NTSTATUS status = STATUS_SUCCESS;
-	
-#ifdef FILFILE_USE_CTR
-	// CTR
-	DBGPRINT(("Decode(CTR) Size[0x%x] Offset[0x%I64x] Key[0x%x] Nonce[0x%I64x]\n", size, crypt->Offset, *((ULONG*) crypt->Key.m_key), crypt->Nonce));
+	ULONG const mode = CipherMode(crypt->Key.m_cipher);
 
-	CFilterCipherCTR cipher(crypt);
-#elif defined (FILFILE_USE_CFB)
-	// CFB
-	DBGPRINT(("Decode(CFB) Size[0x%x] Offset[0x%I64x] Key[0x%x] Nonce[0x%I64x]\n", size, crypt->Offset, *((ULONG*) crypt->Key.m_key), crypt->Nonce));
+	DBGPRINT(("Decode(%u) Size[0x%x] Offset[0x%I64x] Key[0x%x] Nonce[0x%I64x]\n", mode, size, crypt->Offset, *((ULONG*) crypt->Key.m_key), crypt->Nonce));
 
-	CFilterCipherCFB cipher(crypt);
-#elif defined(FILFILE_USE_EME)
-	// EME
-	DBGPRINT(("Decode(EME) Size[0x%x] Offset[0x%I64x] Key[0x%x] Nonce[0x%I64x]\n", size, crypt->Offset, *((ULONG*) crypt->Key.m_key), crypt->Nonce));
+	switch(mode)
+	{
+		case FILFILE_CIPHER_MODE_CTR:
+			return Code<CFilterCipherCTR>(buffer, size, crypt, false);
 
-	CFilterCipherEME cipher;
-	status = cipher.Init(crypt);
-#endif
+		case FILFILE_CIPHER_MODE_CFB:
+			ASSERT(IsCipherModeSupported(mode));
+			return Code<CFilterCipherCFB>(buffer, size, crypt, false);
 
-	if(NT_SUCCESS(status))
-	{
-		status = cipher.Decode(buffer, size);
-	}
-	else
-	{
-		// Hmmm, really bad...
-		ASSERT(false);
+		case FILFILE_CIPHER_MODE_EME:
+		case FILFILE_CIPHER_MODE_EME_2:
+			ASSERT(IsCipherModeSupported(mode));
+			return Code<CFilterCipherEME>(buffer, size, crypt, false);
+
+		case FILFILE_CIPHER_MODE_XTS:
+			ASSERT(IsCipherModeSupported(mode));
+			return Code<CFilterCipherXTS>(buffer, size, crypt, false);
+
+		default:
+			break;
 	}
 
-	return status;
+	DBGPRINT(("Decode -ERROR: unknown cipher mode[0x%x]\n", mode));
+
+	return STATUS_NOT_SUPPORTED;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -20,17 +20,17 @@
 #include "CFilterDirectory.h"
 #include "CFilterHeader.h"
 #include "CFilterTracker.h"
+#include "CFilterSizeCache.h"
 #include "CFilterRandomizer.h"
+#include "CFilterKeyPool.h"
 #include "CFilterAppList.h"
 #include "CFilterBlackList.h"
 
-#ifdef FILFILE_USE_CTR
 #include "CFilterCipherCTR.h"
-#elif defined(FILFILE_USE_CFB)
 #include "CFilterCipherCFB.h"
-#elif defined(FILFILE_USE_EME)
 #include "CFilterCipherEME.h"
-#endif
+#include "CFilterCipherXTS.h"
+#include "CFilterCipher.h"
 
 class CFilterPath;
 
@@ -44,7 +44,10 @@ public:
 
 	enum c_constants
 	{
-		// The block size depends on the cipher block mode used:
+		// The file layout (block size, tail and padding) depends on the cipher block mode
+		// built in. It is also the default mode, others can be selected per key at runtime
+		// as far as the layout carries them, see IsCipherModeSupported. The EME layout
+		// carries all of them, the CTR one only CTR:
 		#ifdef FILFILE_USE_CTR
 		 c_cipherMode	= FILFILE_CIPHER_MODE_CTR,
 		 c_blockSize	= CFilterCipherCTR::c_blockSize,
@@ -61,6 +64,7 @@ public:
 		
 		c_lookAsideSize		= 256 - 4, // bytes
 		c_ignoresIncrement  = 8,
+		c_unitBase			= 512,		// data unit of old keys, CFilterBase::c_sectorSize
 	};
 
 	NTSTATUS					Init();
@@ -78,30 +82,33 @@ public:
 	NTSTATUS					Randomize(UCHAR *target, ULONG size);
 	
 	NTSTATUS					GenerateNonce(LARGE_INTEGER *nonce);
-	NTSTATUS					GenerateFileKey(CFilterKey *fileKey);
-	NTSTATUS					Purge(ULONG entityIdentifier, ULONG flags);
+	NTSTATUS					GenerateFileKey(CFilterKey const* entityKey, CFilterKey *fileKey, CFilterKey *wrapped, LARGE_INTEGER *nonce);
         
 								// STATIC
 	static NTSTATUS				Encode(UCHAR *buffer, ULONG size, FILFILE_CRYPT_CONTEXT *crypt);
 	static NTSTATUS				Decode(UCHAR *buffer, ULONG size, FILFILE_CRYPT_CONTEXT *crypt);
 	static bool					EncodeFileKey(CFilterKey const *entityKey, CFilterKey *fileKey, bool dec);
+	static void					EncodeFileKey(RijndealCoder<AES_256> *aes, CFilterKey *fileKey, bool dec);
 	
 	static ULONG				ComputePadding(ULONG size);
 	static ULONG				ComputeFiller(ULONG  size);
 	static ULONG				GetPadding(UCHAR const* buffer, ULONG size);
 	static ULONG				AddPadding(UCHAR *buffer, ULONG size);
 
+	static ULONG				CipherMode(ULONG cipher);
+	static ULONG				CipherMode(FILFILE_CRYPT_CONTEXT const* crypt);
+	static ULONG				CipherUnit(ULONG cipher);
+	static bool					IsCipherModeSupported(ULONG mode);
+
 	ULONG						AddPaddingFiller(UCHAR* buffer, ULONG size);
 	
 private:
-								// DATA
-	NPAGED_LOOKASIDE_LIST*		m_lookAside;
 
-	CFilterFileCont				m_files;			// Tracked file streams, sorted by FCB
-	ERESOURCE					m_filesResource;
+	template<typename t_cipher>
+	static NTSTATUS				Code(UCHAR *buffer, ULONG size, FILFILE_CRYPT_CONTEXT *crypt, bool encode);
 
-	CFilterDirectoryCont		m_directories;		// Tracked directories, sorted by FO
-	ERESOURCE					m_directoriesResource;
+								// DATA
+	NPAGED_LOOKASIDE_LIST*		m_lookAside;
 
 	CFilterTracker				m_tracker;			// State info for particular FOs, sorted by FO
 
@@ -110,13 +117,16 @@ private:
 	CFilterBlackListDisp		m_blackList;		
 	CFilterAppList				m_appList;
 
-	LARGE_INTEGER				m_nonce;			// Next Nonce value to be used
-	FAST_MUTEX					m_nonceLock;
+	LONGLONG volatile			m_nonce;			// Last Nonce value used, updated lock-free
+
+	CFilterKeyPool				m_fileKeys;			// FileKeys prepared off the create path
 
 public:
 
 	CFilterRandomizer			m_randomizerHigh;	// Used for FileKeys - will call into Usermode for random data
 	CFilterRandomizer			m_randomizerLow;	// Used for Header padding, Filler and wiping - no Usermode calls at all
+
+	CFilterSizeCache			m_sizes;			// Header block sizes deviating from their Entity, for directory listings
 	
 	UCHAR						m_macCrc;			// simple check sum over MAC address, if any
 };
@@ -158,14 +168,17 @@ NTSTATUS CFilterContext::Randomize(UCHAR *target, ULONG size)
 }
 
 inline
-NTSTATUS CFilterContext::GenerateFileKey(CFilterKey *fileKey)
+NTSTATUS CFilterContext::GenerateFileKey(CFilterKey const* entityKey, CFilterKey *fileKey, CFilterKey *wrapped, LARGE_INTEGER *nonce)
 {
+	ASSERT(entityKey);
 	ASSERT(fileKey);
 	ASSERT(fileKey->m_size);
 	ASSERT(sizeof(fileKey->m_key) >= fileKey->m_size);
+	ASSERT(wrapped);
+	ASSERT(nonce);
 
-	// request HIGH quality random
-	return m_randomizerHigh.Get(fileKey->m_key, fileKey->m_size);
+	// request HIGH quality random and a Nonce, prepared ahead and wrapped with the EntityKey if possible
+	return m_fileKeys.Get(entityKey, fileKey, wrapped, nonce);
 }
 
 inline
@@ -233,5 +246,80 @@ ULONG CFilterContext::AddPadding(UCHAR *buffer, ULONG size)
 	return  0;
 }
 
+inline
+ULONG CFilterContext::CipherMode(ULONG cipher)
+{
+	ULONG const mode = HIWORD(cipher) & FILFILE_CIPHER_MODE_MASK;
+
+	// Keys without mode information use the built in one
+	return (mode) ? mode : c_cipherMode;
+}
+
+inline
+ULONG CFilterContext::CipherMode(FILFILE_CRYPT_CONTEXT const* crypt)
+{
+	ASSERT(crypt);
+
+	return (crypt->Cipher) ? crypt->Cipher->Mode() : CipherMode(crypt->Key.m_cipher);
+}
+
+inline
+ULONG CFilterContext::CipherUnit(ULONG cipher)
+{
+	ULONG const unit = (HIWORD(cipher) >> FILFILE_CIPHER_UNIT_SHIFT) & FILFILE_CIPHER_UNIT_MASK;
+
+	// Data unit size in bytes, old keys and Headers use sectors
+	return c_unitBase << unit;
+}
+
+inline
+bool CFilterContext::IsCipherModeSupported(ULONG mode)
+{
+	// Mode word may carry the data unit, which only XTS can code in parts
+	if(mode & ~((FILFILE_CIPHER_UNIT_MASK << FILFILE_CIPHER_UNIT_SHIFT) | FILFILE_CIPHER_MODE_MASK))
+	{
+		return false;
+	}
+
+	switch(mode >> FILFILE_CIPHER_UNIT_SHIFT)
+	{
+		case FILFILE_CIPHER_UNIT_512:
+			break;
+
+		case FILFILE_CIPHER_UNIT_4096:
+			if(FILFILE_CIPHER_MODE_XTS == (mode & FILFILE_CIPHER_MODE_MASK))
+			{
+				break;
+			}
+			return false;
+
+		default:
+			return false;
+	}
+
+	switch(mode & FILFILE_CIPHER_MODE_MASK)
+	{
+		case FILFILE_CIPHER_MODE_CTR:
+			// Stream mode, fits any layout
+			return true;
+
+		case FILFILE_CIPHER_MODE_CFB:
+			// Needs whole cipher blocks, which only a padded layout guarantees
+			return c_tail && !(c_blockSize % CFilterCipherCFB::c_blockSize);
+
+		case FILFILE_CIPHER_MODE_EME:
+		case FILFILE_CIPHER_MODE_EME_2:
+			return c_tail && !(c_blockSize % CFilterCipherEME::c_blockSize);
+
+		case FILFILE_CIPHER_MODE_XTS:
+			return c_tail && !(c_blockSize % CFilterCipherXTS::c_blockSize);
+
+		default:
+			break;
+	}
+
+	return false;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #endif // !defined(AFX_CFilterContext__282CD2A0_AD3A_4F79_96F8_376CE0B39421__INCLUDED_)
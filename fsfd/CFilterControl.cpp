@@ -142,6 +142,22 @@ NTSTATUS CFilterControl::Init(DRIVER_OBJECT *driver, UNICODE_STRING *regPath, DE
 		{
 			DBGPRINT(("IE Cache is handled transparently\n"));
 		}
+
+		// Configured to time decision stages?
+		CFilterBase::QueryRegistryLong(ctrlExtension->RegistryPath, L"ProfileDecisions", &CFilterStatistics::s_profile);
+
+		if(CFilterStatistics::s_profile)
+		{
+			DBGPRINT(("Decision stages are profiled\n"));
+		}
+
+		// Configured to read ahead on redirectors?
+		CFilterBase::QueryRegistryLong(ctrlExtension->RegistryPath, L"ReadAhead", &CFilterReadAhead::s_enabled);
+
+		if(CFilterReadAhead::s_enabled)
+		{
+			DBGPRINT(("Non-cached redirector reads are read ahead\n"));
+		}
 		 
 		// Init Engine
 		status = CFilterEngine::Init(driver, control, ctrlExtension->RegistryPath);
@@ -155,11 +171,14 @@ NTSTATUS CFilterControl::Init(DRIVER_OBJECT *driver, UNICODE_STRING *regPath, DE
 			ctrlExtension->Callback.Init(ctrlExtension);
 
 			// Init WiperOnDelete handler
-			ctrlExtension->Wiper.Init(&ctrlExtension->Context.m_randomizerLow);
+			ctrlExtension->Wiper.Init(&ctrlExtension->Context.m_randomizerLow, ctrlExtension->RegistryPath);
 	
 			// Init Header cache
 			ctrlExtension->HeaderCache.Init(ctrlExtension->RegistryPath);
 
+			// Init driver wide statistics
+			ctrlExtension->Statistics.Init(0);
+
 			// Register CDO for shutdown notifications
 			IoRegisterShutdownNotification(control);
 
@@ -311,6 +330,8 @@ NTSTATUS CFilterControl::Close(DRIVER_OBJECT *driver)
 	ctrlExtension->Callback.Close();
 	// Shutdown Header cache
 	ctrlExtension->HeaderCache.Close();
+	// Shutdown statistics
+	ctrlExtension->Statistics.Close();
 
 	LARGE_INTEGER delay;
 	delay.QuadPart = RELATIVE(MILLISECONDS(200)); 
@@ -351,6 +372,9 @@ NTSTATUS CFilterControl::Close(DRIVER_OBJECT *driver)
 		IoDeleteDevice(volExtension->Common.Device);
 	};
 
+	// Entities of absent volumes
+	ctrlExtension->Entities.Close();
+
 	ctrlExtension->Context.Close();
 	
 	ExReleaseResourceLite(&ctrlExtension->Lock);
@@ -545,7 +569,9 @@ NTSTATUS CFilterControl::AddVolumeDevice(DEVICE_OBJECT *device)
 					break;
 				}
 
-				// remove from control object, transfer ownership
+				// remove from control object, the Header reference moves along, the path was copied
+				entity->Close();
+
 				ctrlExtension->Entities.RemoveRaw(index, false);
 
 				index--;
@@ -599,6 +625,7 @@ NTSTATUS CFilterControl::RemoveVolumeDevice(DEVICE_OBJECT *device)
 	ASSERT(volExtension->Common.Type == FILFILE_FILTER_VOLUME);
 	
 	ExAcquireResourceExclusiveLite(&volExtension->Volume.m_entitiesResource, true);
+	volExtension->Volume.m_decisions.Invalidate();
 
 	DBGPRINT(("RemoveVolumeDevice: volumeIdentifier[0x%02x]\n", volExtension->Volume.m_nextIdentifier >> 24));
 
@@ -630,6 +657,9 @@ NTSTATUS CFilterControl::RemoveVolumeDevice(DEVICE_OBJECT *device)
 			if(NT_SUCCESS(status))
 			{
 				// Note: there is no need to adjust references back to Entities because we are already detached.
+				// The Header reference moves along, the path was copied
+				entity->Close();
+
 				volExtension->Volume.m_entities.RemoveRaw(index, false);
 
 				index--;
@@ -1139,6 +1169,22 @@ NTSTATUS CFilterControl::Dispatch(DEVICE_OBJECT *device, IRP *irp)
 
 				status = Wiper(control);
 				break;
+
+			case IOCTL_FILFILE_STATISTICS:		// STATISTICS
+
+				DBGPRINT(("Control: IOCTL_FILFILE_STATISTICS\n"));
+
+				status = STATUS_INVALID_PARAMETER;
+
+				if(irp->MdlAddress)
+				{
+					UCHAR* userBuffer = (UCHAR*) MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority);
+
+					statusInfo = stack->Parameters.DeviceIoControl.OutputBufferLength;
+
+					status = Statistics(control, userBuffer, &statusInfo);
+				}
+				break;
 				//case 
 
 			default:
@@ -1393,6 +1439,11 @@ NTSTATUS CFilterControl::EnumEntities(FILFILE_CONTROL *control, UCHAR *userBuffe
 
 	ASSERT(userBufferSize);
 
+	if(control->Flags & FILFILE_CONTROL_PAGED)
+	{
+		return EnumEntitiesPaged(control, userBuffer, userBufferSize);
+	}
+
 	FILFILE_CONTROL_EXTENSION *const ctrlExtension = Extension();
 	ASSERT(ctrlExtension);
 
@@ -1546,6 +1597,194 @@ NTSTATUS CFilterControl::EnumEntities(FILFILE_CONTROL *control, UCHAR *userBuffe
 
 #pragma PAGEDCODE
 
+NTSTATUS CFilterControl::EnumEntitiesPaged(FILFILE_CONTROL *control, UCHAR *userBuffer, ULONG *userBufferSize)
+{
+	ASSERT(control);
+	ASSERT(userBuffer);
+	ASSERT(userBufferSize);
+
+	PAGED_CODE();
+
+	if(*userBufferSize < sizeof(FILFILE_ENUM_PAGE))
+	{
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	FILFILE_CONTROL_EXTENSION *const ctrlExtension = Extension();
+	ASSERT(ctrlExtension);
+
+	CFilterHeaderCont &headers = ctrlExtension->Context.Headers();
+
+	NTSTATUS status = STATUS_SUCCESS;
+	LUID luid		= {0,0};
+
+	bool const neg		= (control->Flags & FILFILE_CONTROL_ACTIVE) ? true : false;
+	bool const terminal = IsTerminalServices();
+
+	if(terminal)
+	{
+		status = CFilterBase::GetLuid(&luid);
+
+		if(NT_ERROR(status))
+		{
+			return status;
+		}
+	}
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceSharedLite(&ctrlExtension->Lock, true);
+
+	headers.LockShared();
+
+	__try
+	{
+		RtlZeroMemory(userBuffer, *userBufferSize);
+
+		FILFILE_ENUM_PAGE *const page = (FILFILE_ENUM_PAGE*) userBuffer;
+
+		// Taken before walking, so changes made meanwhile void the returned Cursor
+		page->Generation = CFilterEntityCont::Generation();
+
+		ULONG skip = (ULONG) control->Value1;
+
+		if((ULONG) control->Value2 != page->Generation)
+		{
+			if(skip)
+			{
+				// Cursor is stale, start over
+				page->Flags |= FILFILE_ENUM_RESTARTED;
+
+				skip = 0;
+			}
+		}
+		else if(!skip && control->Value2)
+		{
+			// Caller is up to date
+			page->Flags |= FILFILE_ENUM_UNCHANGED;
+		}
+
+		ULONG current = sizeof(FILFILE_ENUM_PAGE);
+
+		if( !(page->Flags & FILFILE_ENUM_UNCHANGED))
+		{
+			page->Cursor = skip;
+
+			if(!neg)
+			{
+				// Passive regular Entities, owned by CDO
+				status = EnumEntitiesPage(&ctrlExtension->Entities, (terminal) ? &luid : 0, &skip, userBuffer, *userBufferSize, &current);
+			}
+
+			// active Entities, owned by Volumes
+			for(LIST_ENTRY *entry = ctrlExtension->Volumes.Flink; entry != &ctrlExtension->Volumes; entry = entry->Flink)
+			{
+				if(STATUS_SUCCESS != status)
+				{
+					break;
+				}
+
+				FILFILE_VOLUME_EXTENSION *const volExtension = CONTAINING_RECORD(entry, FILFILE_VOLUME_EXTENSION, Link);          
+				ASSERT(volExtension);
+
+				ERESOURCE *const resource = (neg) ? &volExtension->Volume.m_negativesResource : &volExtension->Volume.m_entitiesResource;
+
+				ExAcquireResourceSharedLite(resource, true);
+
+				status = EnumEntitiesPage((neg) ? &volExtension->Volume.m_negatives : &volExtension->Volume.m_entities,
+										  (terminal) ? &luid : 0,
+										  &skip,
+										  userBuffer,
+										  *userBufferSize,
+										  &current);
+
+				ExReleaseResourceLite(resource);
+			}
+
+			if(STATUS_BUFFER_OVERFLOW == status)
+			{
+				// Page is full, not even a single path fit?
+				status = (page->Count) ? STATUS_SUCCESS : STATUS_BUFFER_TOO_SMALL;
+
+				page->Cursor += page->Count;
+			}
+			else
+			{
+				// Enumeration complete
+				page->Cursor = 0;
+			}
+		}
+
+		*userBufferSize = current;
+	}
+	__except(EXCEPTION_EXECUTE_HANDLER)
+	{
+		status = STATUS_INVALID_USER_BUFFER;
+	}
+
+	headers.Unlock();
+
+	ExReleaseResourceLite(&ctrlExtension->Lock);
+	FsRtlExitFileSystem();
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterControl::EnumEntitiesPage(CFilterEntityCont *entities, LUID const* luid, ULONG *skip, UCHAR *buffer, ULONG bufferSize, ULONG *current)
+{
+	ASSERT(entities);
+	ASSERT(skip);
+	ASSERT(buffer);
+	ASSERT(current);
+
+	PAGED_CODE();
+
+	ASSERT(*current <= bufferSize);
+
+	FILFILE_ENUM_PAGE *const page = (FILFILE_ENUM_PAGE*) buffer;
+
+	ULONG const flags = CFilterPath::PATH_PREFIX | CFilterPath::PATH_VOLUME | CFilterPath::PATH_FILE | CFilterPath::PATH_DEEPNESS;
+	ULONG const count = entities->Size();
+
+	for(ULONG pos = 0; pos < count; ++pos)
+	{
+		CFilterEntity *const entity = entities->GetFromPosition(pos);
+		ASSERT(entity);
+
+		if(luid && (~0u == entity->m_luids.Check(luid)))
+		{
+			continue;
+		}
+
+		// Returned on previous pages?
+		if(*skip)
+		{
+			(*skip)--;
+			continue;
+		}
+
+		ULONG const written = entity->Write((LPWSTR) (buffer + *current), bufferSize - *current, flags);
+
+		if(!written)
+		{
+			return STATUS_BUFFER_OVERFLOW;
+		}
+
+		*current += written;
+
+		page->Count++;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
 NTSTATUS CFilterControl::RemoveEntities(ULONG flags)
 {
 	PAGED_CODE();
@@ -1599,10 +1838,8 @@ NTSTATUS CFilterControl::RemoveEntities(ULONG flags)
 
 		if(ctrlExtension->Entities.Size())
 		{
-			ULONG const count = ctrlExtension->Entities.Size();
-
-			// remove CDO Entities
-			for(ULONG pos = 0; pos < count; ++pos)
+			// remove CDO Entities, backwards as RemoveRaw closes the gap
+			for(LONG pos = ctrlExtension->Entities.Size() - 1; pos >= 0; --pos)
 			{
 				CFilterEntity *entity = ctrlExtension->Entities.GetFromPosition(pos);
 				ASSERT(entity);
@@ -1694,6 +1931,16 @@ NTSTATUS CFilterControl::Wiper(FILFILE_CONTROL *control)
 			// Set/overwrite pattern vector, if any
 			ctrlExtension->Wiper.Prepare(0, patterns, patternsSize);
 
+			// Wipe deleted files in background ?
+			if(control->Flags & FILFILE_CONTROL_BACKGROUND)
+			{
+				ctrlExtension->Wiper.WorkerStart();
+			}
+			else
+			{
+				ctrlExtension->Wiper.WorkerStop();
+			}
+
 			// Activate WOD
 			InterlockedOr(&CFilterEngine::s_state, FILFILE_WIPE_ON_DELETE);
 		}
@@ -1701,6 +1948,9 @@ NTSTATUS CFilterControl::Wiper(FILFILE_CONTROL *control)
 		{
 			// Deactivate WOD
 			InterlockedAnd(&CFilterEngine::s_state, ~FILFILE_WIPE_ON_DELETE);
+
+			// Finish deferred files
+			ctrlExtension->Wiper.WorkerStop();
 		}
 	}
 	else
@@ -1765,6 +2015,80 @@ NTSTATUS CFilterControl::Wiper(FILFILE_CONTROL *control)
 
 #pragma PAGEDCODE
 
+NTSTATUS CFilterControl::Statistics(FILFILE_CONTROL *control, UCHAR *userBuffer, ULONG *userBufferSize)
+{
+	ASSERT(control);
+	ASSERT(userBufferSize);
+
+	PAGED_CODE();
+
+	if(!userBuffer)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	FILFILE_CONTROL_EXTENSION *const ctrlExtension = Extension();
+	ASSERT(ctrlExtension);
+
+	// Snapshot and reset?
+	bool const reset = (control->Flags & FILFILE_CONTROL_REM) ? true : false;
+
+	FILFILE_STATISTICS *const target = (FILFILE_STATISTICS*) userBuffer;
+	ULONG const count				 = *userBufferSize / sizeof(FILFILE_STATISTICS);
+
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG current   = 0;
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceSharedLite(&ctrlExtension->Lock, true);
+
+	// Driver wide counters first, then one entry for each Volume
+	if(count < 1 + (ULONG) ctrlExtension->VolumesCount)
+	{
+		status = STATUS_BUFFER_TOO_SMALL;
+	}
+	else
+	{
+		__try
+		{
+			RtlZeroMemory(userBuffer, count * sizeof(FILFILE_STATISTICS));
+
+			if(NT_SUCCESS(ctrlExtension->Statistics.Snapshot(target + current, reset)))
+			{
+				current++;
+			}
+
+			for(LIST_ENTRY *entry = ctrlExtension->Volumes.Flink; entry != &ctrlExtension->Volumes; entry = entry->Flink)
+			{
+				FILFILE_VOLUME_EXTENSION *const volExtension = CONTAINING_RECORD(entry, FILFILE_VOLUME_EXTENSION, Link);          
+				ASSERT(volExtension);
+
+				ASSERT(current < count);
+
+				if(NT_SUCCESS(volExtension->Volume.m_statistics.Snapshot(target + current, reset)))
+				{
+					current++;
+				}
+			}
+		}
+		__except(EXCEPTION_EXECUTE_HANDLER)
+		{
+			status = STATUS_INVALID_USER_BUFFER;
+		}
+	}
+
+	ExReleaseResourceLite(&ctrlExtension->Lock);
+	FsRtlExitFileSystem();
+
+	*userBufferSize = current * sizeof(FILFILE_STATISTICS);
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
 NTSTATUS CFilterControl::OpenFile(FILFILE_CONTROL *control, UCHAR *userBuffer, ULONG *userBufferSize)
 {
 	ASSERT(control);
@@ -1879,6 +2203,13 @@ NTSTATUS CFilterControl::OpenFile(FILFILE_CONTROL *control, UCHAR *userBuffer, U
 
 		if(NT_SUCCESS(status))
 		{
+			// AutoConfig file created or about to be deleted below us, so void cached lookups
+			if(control->Flags & FILFILE_CONTROL_AUTOCONF)
+			{
+				volExtension->Volume.m_autoConfigs.Invalidate();
+				volExtension->Volume.m_decisions.Invalidate();
+			}
+
 			__try
 			{
 				RtlZeroMemory(userBuffer, sizeof(FILFILE_CONTROL_OUT));
@@ -2052,6 +2383,19 @@ NTSTATUS CFilterControl::ManageEntity(FILFILE_CONTROL *control)
 			return STATUS_INVALID_PARAMETER;
 		}
 
+		// Cipher mode chosen by caller, if any
+		if(control->Value2)
+		{
+			if(!CFilterContext::IsCipherModeSupported((ULONG) control->Value2))
+			{
+				DBGPRINT(("ManageEntity -ERROR: cipher mode[0x%I64x] not supported\n", control->Value2));
+
+				return STATUS_NOT_SUPPORTED;
+			}
+
+			cipher = (ULONG) control->Value2 << 16;
+		}
+
 		if(control->CryptoSize)
 		{
 			switch(control->CryptoSize)
@@ -2282,6 +2626,8 @@ NTSTATUS CFilterControl::GetHeader(FILFILE_CONTROL *control, UCHAR *userBuffer,
 		// Query cache, by reference
 		if(NT_SUCCESS(ctrlExtension->HeaderCache.Query(path, control->PathLength, &header)))
 		{
+			ctrlExtension->Statistics.Add(FILFILE_STAT_CACHE_HITS);
+
 			alreadyCached = true;
 
 			// Positive match?
@@ -2295,6 +2641,11 @@ NTSTATUS CFilterControl::GetHeader(FILFILE_CONTROL *control, UCHAR *userBuffer,
 
 	if(!alreadyCached)
 	{
+		if(control->PathOffset)
+		{
+			ctrlExtension->Statistics.Add(FILFILE_STAT_CACHE_MISSES);
+		}
+
 		// Verify input parameters
 		if(!control->Value1 || !(control->Flags & FILFILE_CONTROL_HANDLE))
 		{
@@ -2556,6 +2907,10 @@ NTSTATUS CFilterControl::SetHeader(FILFILE_CONTROL *control)
 
 				// write Header, otherwise delete it
 				status = manager.AutoConfigWrite(file, &header);
+
+				// Written below our create and set information paths, so void cached lookups here
+				volExtension->Volume.m_autoConfigs.Invalidate();
+				volExtension->Volume.m_decisions.Invalidate();
 			}
 			else
 			{
@@ -2876,6 +3231,19 @@ NTSTATUS CFilterControl::ManageEncryption(FILFILE_CONTROL *control)
 	// Cipher algo and mode used for encryption
 	ULONG cipher = FILFILE_CIPHER_MODE_DEFAULT;
 
+	// Cipher mode chosen by caller, if any. Only used for new encryptions
+	if(control->Value2)
+	{
+		if(!CFilterContext::IsCipherModeSupported((ULONG) control->Value2))
+		{
+			DBGPRINT(("ManageEncryption -ERROR: cipher mode[0x%I64x] not supported\n", control->Value2));
+
+			return STATUS_NOT_SUPPORTED;
+		}
+
+		cipher = (ULONG) control->Value2 << 16;
+	}
+
 	switch(control->CryptoSize)
 	{
 		case 128 / 8:
@@ -3162,3 +3530,261 @@ NTSTATUS CFilterControl::Blacklist(FILFILE_CONTROL *control, UCHAR *userBuffer,
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CSimFixture.h"
+
+/*
+ * Paged Entity enumeration over 100 volumes of 1000 Entities each, one of them not mounted so that
+ * its Entities stay with the CDO. Pages of several sizes return every Entity exactly once and end with
+ * a zero Cursor. Polling with the current Generation reports no change and no paths, an older one gets
+ * a fresh first page. Buffers too small for the page header or a single path are refused.
+ *
+ * Between two pages an Entity is added to a volume, one is removed from the CDO and the LUIDs of a
+ * third change, as concurrent requests would. The next page restarts and the enumeration completes
+ * over the changed set. Page count and the longest time a page took are shown per page size.
+ */
+struct TestEnum
+{
+	UCHAR*		m_seen;			// per Entity number
+	ULONG		m_seenCount;
+	ULONG		m_found;
+
+	ULONG		m_pages;
+	ULONG		m_restarts;
+	double		m_worst;		// ns a page took
+};
+
+static void TestReset(TestEnum *test)
+{
+	RtlZeroMemory(test->m_seen, test->m_seenCount);
+
+	test->m_found	 = 0;
+	test->m_pages	 = 0;
+	test->m_restarts = 0;
+	test->m_worst	 = 0;
+}
+
+static NTSTATUS TestPage(ULONG *cursor, ULONG *generation, UCHAR *buffer, ULONG bufferSize, TestEnum *test, bool *duplicate)
+{
+	FILFILE_CONTROL control;
+	RtlZeroMemory(&control, sizeof(control));
+
+	control.Flags  = FILFILE_CONTROL_PAGED;
+	control.Value1 = *cursor;
+	control.Value2 = *generation;
+
+	double const start = CSimFixture::Now();
+
+	NTSTATUS const status = CSimFixture::Control(IOCTL_FILFILE_ENUM_ENTITIES, &control, sizeof(control), buffer, bufferSize, &bufferSize);
+
+	if(NT_ERROR(status))
+	{
+		return status;
+	}
+
+	double const ns = CSimFixture::Now() - start;
+
+	test->m_worst = (ns > test->m_worst) ? ns : test->m_worst;
+	test->m_pages++;
+
+	FILFILE_ENUM_PAGE const* page = (FILFILE_ENUM_PAGE const*) buffer;
+
+	if(page->Flags & FILFILE_ENUM_RESTARTED)
+	{
+		RtlZeroMemory(test->m_seen, test->m_seenCount);
+
+		test->m_found = 0;
+		test->m_restarts++;
+	}
+
+	ULONG curr = sizeof(FILFILE_ENUM_PAGE);
+
+	for(ULONG index = 0; index < page->Count; ++index)
+	{
+		LPCWSTR const path = (LPCWSTR) (buffer + curr);
+		ULONG const length = (ULONG) wcslen(path);
+		ULONG const number = CSimFixture::EntityNumber(path, length);
+
+		if((number >= test->m_seenCount) || test->m_seen[number])
+		{
+			*duplicate = true;
+		}
+		else
+		{
+			test->m_seen[number] = 1;
+			test->m_found++;
+		}
+
+		curr += (length + 1) * sizeof(WCHAR);
+	}
+
+	if(curr != bufferSize)
+	{
+		*duplicate = true;
+	}
+
+	*cursor		= page->Cursor;
+	*generation = page->Generation;
+
+	return status;
+}
+
+int main(void)
+{
+	enum { c_volumes = 100, c_perVolume = 1000, c_entities = c_volumes * c_perVolume, c_added = c_entities + 7, c_removed = c_entities - 5 };
+
+	int failed = 0;
+
+	CSimFixture::Init();
+
+	// The last volume is never mounted, the others take their Entities from the CDO
+	for(ULONG volume = 1; volume <= c_volumes; ++volume)
+	{
+		for(ULONG pos = 0; pos < c_perVolume; ++pos)
+		{
+			if(NT_ERROR(CSimFixture::AddEntity(volume, (volume - 1) * c_perVolume + pos)))
+			{
+				printf("ERROR ON ADD [%u %u]\n", volume, pos);
+				failed++;
+			}
+		}
+
+		if((volume < c_volumes) && !CSimFixture::AddVolume(volume))
+		{
+			printf("ERROR ON VOLUME [%u]\n", volume);
+			failed++;
+		}
+	}
+
+	UCHAR *const buffer = (UCHAR*) malloc(1 << 20);
+
+	TestEnum test;
+	RtlZeroMemory(&test, sizeof(test));
+
+	test.m_seenCount = c_added + 1;
+	test.m_seen		 = (UCHAR*) calloc(test.m_seenCount, 1);
+
+	// Too small for the header, or for a single path
+	ULONG cursor = 0, generation = 0;
+	bool duplicate = false;
+
+	if((STATUS_BUFFER_TOO_SMALL != TestPage(&cursor, &generation, buffer, sizeof(FILFILE_ENUM_PAGE) - 1, &test, &duplicate)) ||
+	   (STATUS_BUFFER_TOO_SMALL != TestPage(&cursor, &generation, buffer, sizeof(FILFILE_ENUM_PAGE) + 16, &test, &duplicate)))
+	{
+		printf("ERROR ON TOO SMALL\n");
+		failed++;
+	}
+
+	ULONG const pageSizes[] = { 4096, 65536, 1 << 20 };
+
+	printf("page[bytes]  pages  worst page[ms]\n");
+
+	for(ULONG index = 0; index < sizeof(pageSizes) / sizeof(pageSizes[0]); ++index)
+	{
+		TestReset(&test);
+
+		cursor = generation = 0;
+		duplicate = false;
+
+		do
+		{
+			if(NT_ERROR(TestPage(&cursor, &generation, buffer, pageSizes[index], &test, &duplicate)))
+			{
+				printf("ERROR ON PAGE [%u %u]\n", pageSizes[index], test.m_pages);
+				failed++;
+				break;
+			}
+		}
+		while(cursor);
+
+		if(duplicate || test.m_restarts || (test.m_found != c_entities) || (test.m_pages < c_entities * 64 / pageSizes[index]))
+		{
+			printf("ERROR ON ENUM [%u %u %u]\n", pageSizes[index], test.m_found, test.m_pages);
+			failed++;
+		}
+
+		printf("%11u  %5u  %14.2f\n", pageSizes[index], test.m_pages, test.m_worst / 1e6);
+	}
+
+	// Up to date, then outdated
+	ULONG const current = generation;
+	cursor = 0;
+
+	if(NT_ERROR(TestPage(&cursor, &generation, buffer, 4096, &test, &duplicate)) ||
+	   (FILFILE_ENUM_UNCHANGED != ((FILFILE_ENUM_PAGE*) buffer)->Flags) || ((FILFILE_ENUM_PAGE*) buffer)->Count || cursor)
+	{
+		printf("ERROR ON UNCHANGED\n");
+		failed++;
+	}
+
+	CFilterEntityCont::Changed();
+
+	cursor	   = 0;
+	generation = current;
+
+	TestReset(&test);
+
+	if(NT_ERROR(TestPage(&cursor, &generation, buffer, 4096, &test, &duplicate)) ||
+	   ((FILFILE_ENUM_PAGE*) buffer)->Flags || !((FILFILE_ENUM_PAGE*) buffer)->Count || !cursor || (generation == current))
+	{
+		printf("ERROR ON OUTDATED\n");
+		failed++;
+	}
+
+	// Changes between pages restart the enumeration, which then covers the changed set
+	TestReset(&test);
+
+	cursor = generation = 0;
+	duplicate = false;
+
+	for(ULONG change = 0; ; ++change)
+	{
+		if(NT_ERROR(TestPage(&cursor, &generation, buffer, 65536, &test, &duplicate)))
+		{
+			printf("ERROR ON CHANGED PAGE [%u]\n", test.m_pages);
+			failed++;
+			break;
+		}
+
+		if(!cursor)
+		{
+			break;
+		}
+
+		if(change == 10)
+		{
+			CSimFixture::AddEntity(50, c_added);
+		}
+		else if(change == 20)
+		{
+			CSimFixture::RemoveEntity(c_volumes, c_removed);
+		}
+		else if(change == 30)
+		{
+			// Session LUIDs changed
+			CFilterEntityCont::Changed();
+		}
+	}
+
+	if(duplicate || (test.m_restarts != 3) || (test.m_found != c_entities) || !test.m_seen[c_added] || test.m_seen[c_removed])
+	{
+		printf("ERROR ON CHANGED [%u %u]\n", test.m_restarts, test.m_found);
+		failed++;
+	}
+
+	free(test.m_seen);
+	free(buffer);
+
+	failed += CSimFixture::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
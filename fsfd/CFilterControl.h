@@ -22,7 +22,6 @@ struct FILFILE_TRACK_CONTEXT;
 
 class CFilterControl
 {
-
 public:
 
 	static NTSTATUS						Init(DRIVER_OBJECT* driver, UNICODE_STRING* registryPath, DEVICE_OBJECT* control);
@@ -69,10 +68,13 @@ private:
 	static NTSTATUS						ManageEntity(FILFILE_CONTROL *control);
 	static NTSTATUS						EnumEntitiesBool(FILFILE_CONTROL *control);
 	static NTSTATUS						EnumEntities(FILFILE_CONTROL *control, UCHAR *userBuffer = 0, ULONG *userBufferSize = 0);
+	static NTSTATUS						EnumEntitiesPaged(FILFILE_CONTROL *control, UCHAR *userBuffer, ULONG *userBufferSize);
+	static NTSTATUS						EnumEntitiesPage(CFilterEntityCont *entities, LUID const* luid, ULONG *skip, UCHAR *buffer, ULONG bufferSize, ULONG *current);
 	static NTSTATUS						RemoveEntities(ULONG flags = ENTITY_REGULAR);
 	
 	static NTSTATUS						OpenFile(FILFILE_CONTROL *control, UCHAR *userBuffer, ULONG *userBufferSize);
 	static NTSTATUS						Wiper(FILFILE_CONTROL *control);
+	static NTSTATUS						Statistics(FILFILE_CONTROL *control, UCHAR *userBuffer, ULONG *userBufferSize);
 	static NTSTATUS						ManageEncryption(FILFILE_CONTROL *control);
 
 	static NTSTATUS						GetHeader(FILFILE_CONTROL *control, UCHAR* header, ULONG *headerSize);
@@ -0,0 +1,261 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterDecisionCache.cpp: implementation of the CFilterDecisionCache class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define DRIVER_USE_NTIFS	// use the NTIFS header
+#include "driver.h"
+
+#include "IoControl.h"
+#include "CFilterBase.h"
+#include "CFilterDecisionCache.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterDecisionCache::Init()
+{
+	PAGED_CODE();
+
+	RtlZeroMemory(this, sizeof(*this));
+
+	// translate seconds to ticks
+	m_timeout = CFilterBase::GetTicksFromSeconds(c_timeout);
+
+	return ExInitializeResourceLite(&m_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterDecisionCache::Close()
+{
+	PAGED_CODE();
+
+	Clear();
+
+	FsRtlEnterFileSystem();
+	ExDeleteResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterDecisionCache::Clear()
+{
+	PAGED_CODE();
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceExclusiveLite(&m_lock, true);
+
+	for(ULONG bucket = 0; bucket < c_buckets; ++bucket)
+	{
+		for(ULONG way = 0; way < c_ways; ++way)
+		{
+			CFilterDecisionCacheEntry *const entry = &m_entries[bucket][way];
+
+			if(entry->m_path)
+			{
+				ExFreePool(entry->m_path);
+			}
+
+			RtlZeroMemory(entry, sizeof(*entry));
+		}
+
+		m_next[bucket] = 0;
+	}
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+bool CFilterDecisionCache::Check(LPCWSTR path, ULONG pathLength, ULONG autoConfigs)
+{
+	ASSERT(path);
+	ASSERT(pathLength);
+
+	PAGED_CODE();
+
+	ULONG const hash = CFilterBase::Hash(path, pathLength);
+
+	LARGE_INTEGER tick;
+	KeQueryTickCount(&tick);
+
+	bool found = false;
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceSharedLite(&m_lock, true);
+
+	CFilterDecisionCacheEntry const* entry = m_entries[hash % c_buckets];
+
+	for(ULONG way = 0; way < c_ways; ++way, ++entry)
+	{
+		if((entry->m_hash == hash) && (entry->m_pathLength == pathLength))
+		{
+			if(IsValid(entry, autoConfigs, tick.LowPart))
+			{
+				// Hash collisions must never let a tracked directory pass
+				if(!_wcsnicmp(entry->m_path, path, pathLength / sizeof(WCHAR)))
+				{
+					found = true;
+					break;
+				}
+			}
+		}
+	}
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+
+	return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterDecisionCache::Add(LPCWSTR path, ULONG pathLength, ULONG generation, ULONG autoConfigs)
+{
+	ASSERT(path);
+	ASSERT(pathLength);
+
+	PAGED_CODE();
+
+	// Entities changed while the decision was made?
+	if(generation != Generation())
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	LPWSTR const copy = (LPWSTR) ExAllocatePool(PagedPool, pathLength);
+
+	if(!copy)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlCopyMemory(copy, path, pathLength);
+
+	ULONG const hash   = CFilterBase::Hash(path, pathLength);
+	ULONG const bucket = hash % c_buckets;
+
+	LARGE_INTEGER tick;
+	KeQueryTickCount(&tick);
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceExclusiveLite(&m_lock, true);
+
+	// Take first unused, stale or expired entry of bucket
+	ULONG pos = ~0u;
+
+	for(ULONG way = 0; way < c_ways; ++way)
+	{
+		if(!IsValid(&m_entries[bucket][way], autoConfigs, tick.LowPart))
+		{
+			pos = way;
+			break;
+		}
+	}
+
+	if(pos == ~0u)
+	{
+		pos = m_next[bucket];
+
+		m_next[bucket] = (pos + 1) % c_ways;
+	}
+
+	CFilterDecisionCacheEntry *const entry = &m_entries[bucket][pos];
+
+	if(entry->m_path)
+	{
+		ExFreePool(entry->m_path);
+	}
+
+	// An AutoConfig generation changed meanwhile voids the entry on first Check
+	entry->m_hash		 = hash;
+	entry->m_generation	 = generation;
+	entry->m_autoConfigs = autoConfigs;
+	entry->m_tick		 = tick.LowPart;
+	entry->m_path		 = copy;
+	entry->m_pathLength  = pathLength;
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+bool CFilterDecisionCache::Eligible(IRP *irp, ULONG lowerType)
+{
+	ASSERT(irp);
+
+	PAGED_CODE();
+
+	// Redirectors may rewrite paths (DFS) and change files on the server unnoticed
+	if( !(lowerType & FILFILE_DEVICE_VOLUME))
+	{
+		return false;
+	}
+
+	IO_STACK_LOCATION const*const stack = IoGetCurrentIrpStackLocation(irp);
+	ASSERT(stack);
+
+	FILE_OBJECT const*const file = stack->FileObject;
+
+	// Absolute names only
+	if(!file || file->RelatedFileObject || !file->FileName.Buffer || (file->FileName.Length < sizeof(WCHAR)))
+	{
+		return false;
+	}
+
+	if(file->FileName.Buffer[0] != L'\\')
+	{
+		return false;
+	}
+
+	if(stack->Flags & (SL_OPEN_TARGET_DIRECTORY | SL_OPEN_PAGING_FILE))
+	{
+		return false;
+	}
+
+	ULONG const options = stack->Parameters.Create.Options;
+
+	// Plain open of an explicit directory
+	if((FILE_OPEN != (options >> 24)) || !(options & FILE_DIRECTORY_FILE))
+	{
+		return false;
+	}
+
+	if(options & (FILE_OPEN_BY_FILE_ID | FILE_CREATE_TREE_CONNECTION | FILE_OPEN_FOR_FREE_SPACE_QUERY))
+	{
+		return false;
+	}
+
+	// Streams are always looked at
+	for(ULONG index = 0; index < file->FileName.Length / sizeof(WCHAR); ++index)
+	{
+		if(file->FileName.Buffer[index] == L':')
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterDecisionCache.h: interface for the CFilterDecisionCache class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilterDecisionCache_H__2B9D6E14_7A3C_4F08_9E51_C4A0B7D3F26E__INCLUDED_)
+#define AFX_CFilterDecisionCache_H__2B9D6E14_7A3C_4F08_9E51_C4A0B7D3F26E__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilterDecisionCache
+{
+	// Remembers directories on local volumes that were found outside of any Entity and without AutoConfig
+	// file, keyed by the raw name of their open request. Later opens of such directories are passed down
+	// without normalizing, matching or probing anything. Files are never remembered, as encrypted ones are
+	// recognized by their Header wherever they are. Entries are voided by any change of Entities or the
+	// AutoConfig generation of the volume, and expire after c_timeout seconds.
+
+	enum c_constants
+	{
+		c_buckets			= 64,		// selected by hash
+		c_ways				= 8,		// entries per bucket
+		c_timeout			= 600,		// seconds
+	};
+
+public:
+
+	NTSTATUS				Init();
+	void					Close();
+	void					Clear();
+
+	bool					Check(LPCWSTR path, ULONG pathLength, ULONG autoConfigs);
+	NTSTATUS				Add(LPCWSTR path, ULONG pathLength, ULONG generation, ULONG autoConfigs);
+
+	ULONG					Generation() const;
+	void					Invalidate();
+
+	static bool				Eligible(IRP *irp, ULONG lowerType);
+
+private:
+
+	struct CFilterDecisionCacheEntry
+	{
+		ULONG				m_hash;
+		ULONG				m_generation;
+		ULONG				m_autoConfigs;	// AutoConfig cache generation
+		ULONG				m_tick;			// at insertion
+		LPWSTR				m_path;
+		ULONG				m_pathLength;	// in bytes
+	};
+
+	bool					IsValid(CFilterDecisionCacheEntry const* entry, ULONG autoConfigs, ULONG tick) const;
+
+							// DATA
+	CFilterDecisionCacheEntry	m_entries[c_buckets][c_ways];
+	ULONG					m_next[c_buckets];	// replaced next, if none is free
+	ULONG					m_timeout;			// ticks
+
+	LONG volatile			m_generation;
+
+	ERESOURCE				m_lock;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+ULONG CFilterDecisionCache::Generation() const
+{
+	return (ULONG) m_generation;
+}
+
+inline
+void CFilterDecisionCache::Invalidate()
+{
+	// Stale entries are purged lazily
+	InterlockedIncrement((LONG*) &m_generation);
+}
+
+inline
+bool CFilterDecisionCache::IsValid(CFilterDecisionCacheEntry const* entry, ULONG autoConfigs, ULONG tick) const
+{
+	ASSERT(entry);
+
+	if(!entry->m_path || (entry->m_generation != (ULONG) m_generation) || (entry->m_autoConfigs != autoConfigs))
+	{
+		return false;
+	}
+
+	return (tick - entry->m_tick) <= m_timeout;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilterDecisionCache_H__2B9D6E14_7A3C_4F08_9E51_C4A0B7D3F26E__INCLUDED_)
@@ -255,6 +255,69 @@ NTSTATUS CFilterDirectoryCont::Remove(FILE_OBJECT *file, ULONG pos)
 
 #pragma PAGEDCODE
 
+ULONG CFilterDirectoryCont::Compact()
+{
+	PAGED_CODE();
+
+	ASSERT(m_size <= m_capacity);
+
+	ULONG kept = 0;
+
+	// Close holes left by Discard, keeping the sort order
+	for(ULONG pos = 0; pos < m_size; ++pos)
+	{
+		if(m_directories[pos].m_file)
+		{
+			if(kept < pos)
+			{
+				m_directories[kept] = m_directories[pos];
+			}
+
+			kept++;
+		}
+	}
+
+	ULONG const removed = m_size - kept;
+
+	if(removed)
+	{
+		RtlZeroMemory(m_directories + kept, removed * sizeof(CFilterDirectory));
+
+		m_size = kept;
+
+		if(m_capacity - m_size >= c_incrementCount * 2)
+		{
+			ULONG const capacity = (m_size / c_incrementCount + 1) * c_incrementCount;
+
+			CFilterDirectory* directories = (CFilterDirectory*) ExAllocatePool(NonPagedPool, capacity * sizeof(CFilterDirectory));
+
+			if(directories)
+			{
+				RtlZeroMemory(directories, capacity * sizeof(CFilterDirectory));
+
+				m_capacity = capacity;
+
+				if(m_size)
+				{
+					RtlCopyMemory(directories, m_directories, m_size * sizeof(CFilterDirectory));
+				}
+
+				ExFreePool(m_directories);
+
+				m_directories = directories;
+			}
+		}
+
+		DBGPRINT(("DirectoryCont::Compact: removed[%d] new sizes[%d,%d]\n", removed, m_size, m_capacity));
+	}
+
+	return removed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
 bool CFilterDirectoryCont::SearchSpecial(ULONG hash, ULONG *pos)
 {
 	ASSERT(pos);
@@ -29,6 +29,7 @@ public:
 
 	ULONG					m_tid;					// thread id at last open
 	ULONG					m_hash;					// hash of the name
+	ULONG					m_directoryHash;		// hash of volume and full path, see CFilterSizeCache
 	ULONG					m_tick;					// tick at last open
 };
 
@@ -53,6 +54,8 @@ public:
 
 	NTSTATUS				Add(CFilterDirectory *directory);
 	NTSTATUS				Remove(FILE_OBJECT *file, ULONG pos = ~0u);
+	void					Discard(ULONG pos);
+	ULONG					Compact();
 
 private:
 							// DATA
@@ -74,6 +77,16 @@ CFilterDirectory* CFilterDirectoryCont::Get(ULONG pos) const
 	return m_directories + pos;
 }
 
+inline
+void CFilterDirectoryCont::Discard(ULONG pos)
+{
+	ASSERT(pos < m_size);
+	ASSERT(m_directories);
+
+	// Leave a hole, Compact removes all of them in one go
+	RtlZeroMemory(m_directories + pos, sizeof(CFilterDirectory));
+}
+
 inline
 ULONG CFilterDirectoryCont::Size() const
 {
@@ -147,7 +147,7 @@ void CFilterEngine::FileSystemRegister(DEVICE_OBJECT *device, BOOLEAN active)
 
 	#if DBG
 	{
-		LPSTR const action = (active) ? "Register  " : "UnRegister";
+		LPCSTR const action = (active) ? "Register  " : "UnRegister";
 
 		if(FILE_DEVICE_DISK_FILE_SYSTEM == device->DeviceType)
 		{
@@ -549,9 +549,22 @@ NTSTATUS CFilterEngine::DispatchCreate(DEVICE_OBJECT *device, IRP *irp)
 		}
 	}
 
+	IO_STACK_LOCATION *const stack = IoGetCurrentIrpStackLocation(irp);
+	ASSERT(stack);
+
+	// Might create an AutoConfig file?
+	bool const autoConfig = (FILE_OPEN != (stack->Parameters.Create.Options >> 24)) && 
+							stack->FileObject &&
+							CFilterAutoConfigCache::Match(stack->FileObject->FileName.Buffer, stack->FileObject->FileName.Length);
+
 	// Create path inactive OR lower type NO file system ? 
 	if(((s_state & FILFILE_STATE_CREATE) != FILFILE_STATE_CREATE) || !(extension->LowerType & (FILFILE_DEVICE_VOLUME | FILFILE_DEVICE_REDIRECTOR)))
 	{
+		if(autoConfig)
+		{
+			return PassAutoConfig(extension, irp);
+		}
+
 		IoSkipCurrentIrpStackLocation(irp);
 
 		return IoCallDriver(extension->Lower, irp);
@@ -567,6 +580,21 @@ NTSTATUS CFilterEngine::DispatchCreate(DEVICE_OBJECT *device, IRP *irp)
 		return status;
 	}
 
+	// Directory known to be outside of any Entity and without AutoConfig file?
+	bool const decision = CFilterDecisionCache::Eligible(irp, extension->LowerType);
+
+	if(decision && extension->Volume.m_decisions.Check(stack->FileObject->FileName.Buffer, 
+													   stack->FileObject->FileName.Length, 
+													   extension->Volume.m_autoConfigs.Generation()))
+	{
+		extension->Volume.m_statistics.Add(FILFILE_STAT_CREATE_SKIPPED);
+		extension->Volume.m_statistics.Add(FILFILE_STAT_DECISION_HITS);
+
+		IoSkipCurrentIrpStackLocation(irp);
+
+		return IoCallDriver(extension->Lower, irp);
+	}
+
 	// Allocate from lookaside list to minimize our stack usage
 	C_ASSERT(CFilterContext::c_lookAsideSize >= sizeof(FILFILE_TRACK_CONTEXT));
 	FILFILE_TRACK_CONTEXT *const track = (FILFILE_TRACK_CONTEXT*) extension->Volume.m_context->AllocateLookaside();
@@ -583,19 +611,37 @@ NTSTATUS CFilterEngine::DispatchCreate(DEVICE_OBJECT *device, IRP *irp)
 
 	RtlZeroMemory(track, sizeof(FILFILE_TRACK_CONTEXT));
 
+	if(decision)
+	{
+		// Sample before any decision is made, later changes void it
+		track->Decision			   = extension->Volume.m_decisions.Generation();
+		track->DecisionAutoConfigs = extension->Volume.m_autoConfigs.Generation();
+	}
+
+	LONGLONG stage = CFilterStatistics::StageStart();
+
 	// Pre-Create processing
 	status = extension->Volume.PreCreate(irp, track);//ҪǼļ·ͶȡĿ¼µļͷϢļͷtrack->header
 
+	extension->Volume.m_statistics.AddStage(FILFILE_STAT_STAGE_PRECREATE, stage);
+
 	// Something to do ?
 	if(NT_ERROR(status) || (TRACK_NO == track->State))
 	{
 		bool btrack= (track->State==TRACK_SHARE_DIRTORY);
 
+		extension->Volume.m_statistics.Add(FILFILE_STAT_CREATE_SKIPPED);
+
 		track->Entity.Close();
 		track->Header.Close();
 
 		extension->Volume.m_context->FreeLookaside(track);
 
+		if(autoConfig)
+		{
+			return PassAutoConfig(extension, irp);
+		}
+
 		//if(btrack)
 	//	{
 			//irp->IoStatus.Status=STATUS_ACCESS_DENIED;
@@ -664,17 +710,144 @@ NTSTATUS CFilterEngine::DispatchCreate(DEVICE_OBJECT *device, IRP *irp)
 		}
 	}
 	
+	if(autoConfig)
+	{
+		extension->Volume.m_autoConfigs.Invalidate();
+	}
+
 	// Copy parameters to next location
 	IoCopyCurrentIrpStackLocationToNext(irp);
 
 	// Let the call proceed
 	status = CFilterBase::SimpleSend(extension->Lower, irp);
+
+	if(autoConfig)
+	{
+		// Lookups that overlapped with the create are void now
+		extension->Volume.m_autoConfigs.Invalidate();
+	}
 	
 	if(STATUS_SUCCESS == status)
 	{
+		stage = CFilterStatistics::StageStart();
+
 		status=extension->Volume.PostCreate(irp, track);
+
+		extension->Volume.m_statistics.AddStage(FILFILE_STAT_STAGE_POSTCREATE, stage);
+	}
+
+	// Needs the key of an unknown Header?
+	if(track->State & TRACK_PENDED)
+	{
+		return CreatePend(extension, irp, track);
+	}
+
+	return CreateComplete(extension, irp, track, status);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct CFilterEngine::CREATE_CONTEXT
+{
+	// Create pended while its key is requested
+	CFilterKeyWaiter			Waiter;
+	FILFILE_VOLUME_EXTENSION*	Extension;
+	IRP*						Irp;
+	FILFILE_TRACK_CONTEXT*		Track;
+	LONGLONG					Start;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterEngine::CreatePend(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, FILFILE_TRACK_CONTEXT *track)
+{
+	ASSERT(extension);
+	ASSERT(irp);
+	ASSERT(track);
+
+	PAGED_CODE();
+
+	LONGLONG const start = KeQueryInterruptTime();
+
+	// Waiter is touched under the cancel spin lock
+	CREATE_CONTEXT *const pended = (CREATE_CONTEXT*) ExAllocatePool(NonPagedPool, sizeof(CREATE_CONTEXT));
+
+	if(!pended)
+	{
+		// Then wait right here
+		NTSTATUS status = CFilterControl::Callback().FireKey(FILFILE_CONTROL_NULL, track, irp);
+
+		status = extension->Volume.PostCreateResume(irp, track, status, start);
+
+		return CreateComplete(extension, irp, track, status);
+	}
+
+	RtlZeroMemory(pended, sizeof(CREATE_CONTEXT));
+
+	pended->Extension	 = extension;
+	pended->Irp			 = irp;
+	pended->Track		 = track;
+	pended->Start		 = start;
+	pended->Waiter.m_irp = irp;
+
+	ExInitializeWorkItem(&pended->Waiter.m_item, CreateResume, pended);
+
+	// May be completed before we return
+	IoMarkIrpPending(irp);
+
+	NTSTATUS const status = CFilterControl::Callback().PendKey(FILFILE_CONTROL_NULL, track, &pended->Waiter);
+
+	if(STATUS_PENDING != status)
+	{
+		// Decided at once
+		pended->Waiter.m_status = status;
+
+		CreateResume(pended);
 	}
 
+	return STATUS_PENDING;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterEngine::CreateResume(void *context)
+{
+	PAGED_CODE();
+
+	CREATE_CONTEXT *const pended = (CREATE_CONTEXT*) context;
+	ASSERT(pended);
+
+	FILFILE_VOLUME_EXTENSION *const extension = pended->Extension;
+	IRP *const irp							  = pended->Irp;
+	FILFILE_TRACK_CONTEXT *const track		  = pended->Track;
+
+	NTSTATUS status = CFilterControl::Callback().TakeKey(&pended->Waiter, track);
+
+	status = extension->Volume.PostCreateResume(irp, track, status, pended->Start);
+
+	ExFreePool(pended);
+
+	CreateComplete(extension, irp, track, status);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterEngine::CreateComplete(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, FILFILE_TRACK_CONTEXT *track, NTSTATUS status)
+{
+	ASSERT(extension);
+	ASSERT(irp);
+	ASSERT(track);
+
+	PAGED_CODE();
+
+	extension->Volume.m_statistics.Add((track->State & TRACK_YES) ? FILFILE_STAT_CREATE_TRACKED : FILFILE_STAT_CREATE_SKIPPED);
+
 	track->Header.Close();
 	track->Entity.Close();
 	track->EntityKey.Clear();
@@ -1556,39 +1729,53 @@ NTSTATUS CFilterEngine::CompletionReadNonAligned(DEVICE_OBJECT *device, IRP *irp
 		if(target)
 		{
 			// decode buffer inplace
-			CFilterContext::Decode(source, (ULONG) irp->IoStatus.Information, crypt);
-
-			IO_STACK_LOCATION const*const stack = IoGetCurrentIrpStackLocation(irp);
-			ASSERT(stack);
+			NTSTATUS const status = CFilterContext::Decode(source, (ULONG) irp->IoStatus.Information, crypt);
 
-			source += stack->Parameters.Read.ByteOffset.LowPart & (CFilterBase::c_sectorSize - 1);
-			
-			// copy decrypted data into user's buffer
-			ASSERT(irp->IoStatus.Information > crypt->Value);
-			ULONG valid = (ULONG) irp->IoStatus.Information - crypt->Value;
+			((FILFILE_VOLUME_EXTENSION*) device->DeviceExtension)->Volume.m_statistics.AddBytes(CFilterContext::CipherMode(crypt), (ULONG) irp->IoStatus.Information, false);
 
-			if(valid > stack->Parameters.Read.Length)
+			if(NT_ERROR(status))
 			{
-				valid = stack->Parameters.Read.Length;
+				DBGPRINT(("CompletionReadNonAligned -ERROR: Decode() failed [0x%08x]\n", status));
+
+				// Intermediate buffer is freed below, the UserBuffer stays untouched
+				irp->IoStatus.Status	  = status;
+				irp->IoStatus.Information = 0;
 			}
+			else
+			{
+				IO_STACK_LOCATION const*const stack = IoGetCurrentIrpStackLocation(irp);
+				ASSERT(stack);
 
-			RtlCopyMemory(target, source, valid);
+				ASSERT(crypt->Cipher);
+				source += stack->Parameters.Read.ByteOffset.LowPart & (crypt->Cipher->Unit() - 1);
+				
+				// copy decrypted data into user's buffer
+				ASSERT(irp->IoStatus.Information > crypt->Value);
+				ULONG valid = (ULONG) irp->IoStatus.Information - crypt->Value;
 
-			if( !(irp->Flags & IRP_PAGING_IO))
-			{
-				irp->IoStatus.Information = valid;
+				if(valid > stack->Parameters.Read.Length)
+				{
+					valid = stack->Parameters.Read.Length;
+				}
 
-				FILE_OBJECT *const file = stack->FileObject;
+				RtlCopyMemory(target, source, valid);
 
-				// synchronous IO ?
-				if(file->Flags & FO_SYNCHRONOUS_IO)
+				if( !(irp->Flags & IRP_PAGING_IO))
 				{
-					// adjust current byte offset
-					file->CurrentByteOffset.QuadPart = stack->Parameters.Read.ByteOffset.QuadPart + irp->IoStatus.Information;
+					irp->IoStatus.Information = valid;
+
+					FILE_OBJECT *const file = stack->FileObject;
+
+					// synchronous IO ?
+					if(file->Flags & FO_SYNCHRONOUS_IO)
+					{
+						// adjust current byte offset
+						file->CurrentByteOffset.QuadPart = stack->Parameters.Read.ByteOffset.QuadPart + irp->IoStatus.Information;
 
-					ASSERT(((FSRTL_COMMON_FCB_HEADER*) file->FsContext)->FileSize.QuadPart > file->CurrentByteOffset.QuadPart);
+						ASSERT(((FSRTL_COMMON_FCB_HEADER*) file->FsContext)->FileSize.QuadPart > file->CurrentByteOffset.QuadPart);
 
-					DBGPRINT(("CompletionReadNonAligned: adjusted Curr[0x%I64x]\n", file->CurrentByteOffset));
+						DBGPRINT(("CompletionReadNonAligned: adjusted Curr[0x%I64x]\n", file->CurrentByteOffset));
+					}
 				}
 			}
 		}
@@ -1613,6 +1800,11 @@ NTSTATUS CFilterEngine::CompletionReadNonAligned(DEVICE_OBJECT *device, IRP *irp
 	FILFILE_VOLUME_EXTENSION *const extension = (FILFILE_VOLUME_EXTENSION*) device->DeviceExtension;
 	ASSERT(extension);
 
+	if(crypt->Cipher)
+	{
+		crypt->Cipher->Release();
+	}
+
 	// be paranoid
 	RtlZeroMemory(crypt, sizeof(FILFILE_CRYPT_CONTEXT));
 
@@ -1686,8 +1878,13 @@ NTSTATUS CFilterEngine::ReadNonAligned(FILFILE_VOLUME_EXTENSION* extension, IRP
 			{
 				status = STATUS_INSUFFICIENT_RESOURCES;
 
-				// Compute how much to read additionally around given request. That is, before and/or after.
-				ULONG const deltaOffset = (ULONG) targetOffset & (CFilterBase::c_sectorSize - 1);
+				// Compute how much to read additionally around given request. That is, before and/or after. Extend
+				// it to whole data units, so that each is decoded at once. The Header keeps units aligned natively.
+				ASSERT(crypt->Cipher);
+				ULONG const unit = crypt->Cipher->Unit();
+				ASSERT(0 == (CFilterHeader::c_align % unit));
+
+				ULONG const deltaOffset = (ULONG) targetOffset & (unit - 1);
 
 				if(deltaOffset)
 				{
@@ -1699,7 +1896,7 @@ NTSTATUS CFilterEngine::ReadNonAligned(FILFILE_VOLUME_EXTENSION* extension, IRP
 					targetSize   += deltaOffset;
 				}
 
-				ULONG deltaSize = (-targetSize) & (CFilterBase::c_sectorSize - 1);
+				ULONG deltaSize = (-targetSize) & (unit - 1);
 
 				targetSize += deltaSize;
 
@@ -1720,7 +1917,7 @@ NTSTATUS CFilterEngine::ReadNonAligned(FILFILE_VOLUME_EXTENSION* extension, IRP
 				ASSERT(crypt->Value < (ULONG) targetSize);
 
 				ASSERT(0 == (targetSize   % CFilterContext::c_blockSize));
-				ASSERT(0 == (targetOffset % CFilterBase::c_sectorSize));
+				ASSERT(0 == (targetOffset % unit));
 								
 				// save original UserBuffer
 				readWrite->RequestUserBuffer = irp->UserBuffer;
@@ -1732,6 +1929,8 @@ NTSTATUS CFilterEngine::ReadNonAligned(FILFILE_VOLUME_EXTENSION* extension, IRP
 
 				if(irp->UserBuffer)
 				{
+					extension->Volume.m_statistics.Add(FILFILE_STAT_BOUNCE_BUFFERS);
+
 					irp->MdlAddress = IoAllocateMdl(irp->UserBuffer, targetSize, false, false, 0);
 
 					if(irp->MdlAddress)
@@ -1806,13 +2005,25 @@ NTSTATUS CFilterEngine::CompletionRead(DEVICE_OBJECT *device, IRP *irp, void *co
 			if(buffer)
 			{
 				// decode buffer
-				CFilterContext::Decode(buffer, bufferSize, crypt);
+				NTSTATUS const status = CFilterContext::Decode(buffer, bufferSize, crypt);
+
+				((FILFILE_VOLUME_EXTENSION*) device->DeviceExtension)->Volume.m_statistics.AddBytes(CFilterContext::CipherMode(crypt), bufferSize, false);
 
 				// substract Tail bytes, if any
 				ASSERT(irp->IoStatus.Information >= crypt->Value);
 				irp->IoStatus.Information -= crypt->Value;
 
-				if( !(irp->Flags & IRP_PAGING_IO))
+				if(NT_ERROR(status))
+				{
+					DBGPRINT(("CompletionRead -ERROR: Decode() failed [0x%08x]\n", status));
+
+					// Never hand out data that is still encrypted
+					RtlZeroMemory(buffer, bufferSize);
+
+					irp->IoStatus.Status	  = status;
+					irp->IoStatus.Information = 0;
+				}
+				else if( !(irp->Flags & IRP_PAGING_IO))
 				{
 					FILE_OBJECT *const file = stack->FileObject;
 					ASSERT(file);
@@ -1836,6 +2047,11 @@ NTSTATUS CFilterEngine::CompletionRead(DEVICE_OBJECT *device, IRP *irp, void *co
 		DBGPRINT(("CompletionRead -ERROR: request failed [0x%08x]\n", irp->IoStatus.Status));
 	}
 
+	if(crypt->Cipher)
+	{
+		crypt->Cipher->Release();
+	}
+
 	// be paranoid
 	RtlZeroMemory(crypt, sizeof(FILFILE_CRYPT_CONTEXT));
 
@@ -2045,6 +2261,8 @@ NTSTATUS CFilterEngine::ReadMdl(FILFILE_VOLUME_EXTENSION *const extension, IRP *
 
 		if(buffer)
 		{
+			extension->Volume.m_statistics.Add(FILFILE_STAT_BOUNCE_BUFFERS);
+
 			// Create dedicated MDLMDL
 			irp->MdlAddress = IoAllocateMdl(buffer, bufferSize, false, false, 0);
 			
@@ -2160,7 +2378,10 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 
 	CFilterContextLink link;
 	RtlZeroMemory(&link, sizeof(link));
-	int const state = extension->Volume.CheckFileCooked(file, &link);
+
+	CFilterCipher *cipher = 0;
+
+	int const state = extension->Volume.CheckFileCooked(file, &link, &cipher);
 
 
 	FILFILE_CONTROL_EXTENSION* externtion=(FILFILE_CONTROL_EXTENSION*)CFilterControl::Extension();
@@ -2179,8 +2400,10 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 	{
 		if(stack->MinorFunction & (IRP_MN_MDL | IRP_MN_COMPLETE))
 		{
-			// be paranoid
-			link.m_fileKey.Clear();
+			if(cipher)
+			{
+				cipher->Release();
+			}
 		
 			// Usually this request comes from SRV trying to access the cached data directly
 			NTSTATUS const status = ReadMdl(extension, irp, &link);
@@ -2205,13 +2428,21 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 		}
 	}
 
+	LONGLONG const stage = CFilterStatistics::StageStart();
+
+	ULONG const tracker = (bypass) ? 0 : extension->Volume.m_context->Tracker().Check(file);
+
+	extension->Volume.m_statistics.AddStage(FILFILE_STAT_STAGE_TRACKER, stage);
+
 	// Bypass request?Ź
-	if(bypass || (extension->Volume.m_context->Tracker().Check(file) & FILFILE_TRACKER_BYPASS))
+	if(bypass || (tracker & FILFILE_TRACKER_BYPASS))
 	{
 		DBGPRINT(("DispatchRead: FO[0x%p] File is bypassed\n", file));
 		
-		// be paranoid
-		link.m_fileKey.Clear();
+		if(cipher)
+		{
+			cipher->Release();
+		}
 			
 		if(irp->Flags & IRP_NOCACHE)
 		{
@@ -2232,8 +2463,10 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 	{
 		DBGPRINT(("DispatchRead: FO[0x%p] is doomed, cancel\n", file));
 
-		// be paranoid
-		link.m_fileKey.Clear();
+		if(cipher)
+		{
+			cipher->Release();
+		}
 
 		irp->IoStatus.Status	  = STATUS_FILE_CLOSED;
 		irp->IoStatus.Information = 0;
@@ -2243,13 +2476,14 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 		return STATUS_FILE_CLOSED;
 	}
 	
+	ASSERT(cipher);
+
 	if(stack->MinorFunction & (IRP_MN_MDL | IRP_MN_COMPLETE))
 	{
 		// Local MDL request, have lower driver handle it
 		DBGPRINT(("DispatchRead: FO[0x%p] local MDL[%d] request\n", file, stack->MinorFunction));
 	
-		// be paranoid
-		link.m_fileKey.Clear();
+		cipher->Release();
 
 		IoSkipCurrentIrpStackLocation(irp);
 
@@ -2293,8 +2527,7 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 	{
 		DBGPRINT(("DispatchRead: start beyond EOF, complete\n"));
 
-		// be paranoid
-		link.m_fileKey.Clear();
+		cipher->Release();
 
 		FsRtlExitFileSystem();
         
@@ -2338,8 +2571,7 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 //ڵVDL,ûжȡļβдЧݳ,ͲһĶȡ
 			DBGPRINT(("DispatchRead: beyond VDL[0x%I64x], handled\n", vdl));
 
-			// be paranoid
-			link.m_fileKey.Clear();
+			cipher->Release();
 
 			FsRtlExitFileSystem();
     
@@ -2373,6 +2605,30 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 			return STATUS_SUCCESS;
 		}
 
+		// Sequential top level request on redirector, served from decrypted window?
+		if(CFilterReadAhead::s_enabled && (extension->LowerType & FILFILE_DEVICE_REDIRECTOR) && !(irp->Flags & IRP_PAGING_IO) && !IoGetTopLevelIrp())
+		{
+			NTSTATUS const status = extension->Volume.ReadAhead(irp, &link, cipher, vdl);
+
+			if(STATUS_MORE_PROCESSING_REQUIRED != status)
+			{
+				cipher->Release();
+
+				FsRtlExitFileSystem();
+
+				if(NT_ERROR(status))
+				{
+					irp->IoStatus.Information = 0;
+				}
+
+				irp->IoStatus.Status = status;
+
+				IoCompleteRequest(irp, IO_DISK_INCREMENT);
+
+				return status;
+			}
+		}
+
 		C_ASSERT(CFilterContext::c_lookAsideSize >= sizeof(FILFILE_CRYPT_CONTEXT));
 		FILFILE_CRYPT_CONTEXT *const crypt = (FILFILE_CRYPT_CONTEXT*) extension->Volume.m_context->AllocateLookaside();
 //һܽṹ
@@ -2383,7 +2639,10 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 			// copy crypt parameters by value
 			crypt->Offset	= stack->Parameters.Read.ByteOffset;//ļıȡĴС
 			crypt->Nonce	= link.m_nonce;
-			crypt->Key		= link.m_fileKey;//key
+
+			// FileKey stays with the stream, the context holds a reference on its cipher
+			cipher->Reference();
+			crypt->Cipher	= cipher;
 
 			IO_STACK_LOCATION *const next = IoGetNextIrpStackLocation(irp);
 			ASSERT(next);
@@ -2392,7 +2651,8 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 			next->Parameters.Read.ByteOffset.QuadPart = targetOffset;
 
 		#if FILFILE_USE_PADDING
-			// Check Offset and Size for non-alignment
+			// Check Offset and Size for non-alignment. Sectors within larger data units go down directly,
+			// as XTS codes them on their own
 			if(((ULONG) targetOffset | targetSize) & (CFilterBase::c_sectorSize - 1))
 			{
 				// Handle it
@@ -2400,8 +2660,10 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 
 				if(NT_ERROR(status))
 				{
+					crypt->Cipher->Release();
+					cipher->Release();
+
 					// be paranoid
-					link.m_fileKey.Clear();
 					RtlZeroMemory(crypt, sizeof(FILFILE_CRYPT_CONTEXT));
 
 					FsRtlExitFileSystem();
@@ -2469,8 +2731,7 @@ NTSTATUS CFilterEngine::DispatchRead(DEVICE_OBJECT *device, IRP *irp)
 		}
 	}
 
-	// be paranoid
-	link.m_fileKey.Clear();
+	cipher->Release();
 
 	FsRtlExitFileSystem();
 
@@ -2817,11 +3078,12 @@ NTSTATUS CFilterEngine::WritePrepare(FILFILE_VOLUME_EXTENSION *extension, IRP *i
 
 #pragma PAGEDCODE
 
-NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFilterContextLink *link)
+NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFilterContextLink *link, CFilterCipher *cipher)
 {
 	ASSERT(extension);
 	ASSERT(irp);
 	ASSERT(link);
+	ASSERT(cipher);
 
 	PAGED_CODE();
 
@@ -2853,8 +3115,12 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 		DBGPRINT(("WriteNonAligned: FO[0x%p] Size[0x%x] Offset[0x%I64x]\n", stack->FileObject, targetSize, targetOffset));
 	}
 
-	// Compute how much to read around given request prior to process the actual write.
-	LONG deltaOffset = (ULONG) targetOffset & (CFilterBase::c_sectorSize - 1);
+	// Compute how much to read around given request prior to process the actual write. Extend it to whole
+	// data units, so that each is coded at once. The Header keeps units aligned natively.
+	LONG const unit = cipher->Unit();
+	ASSERT(0 == (CFilterHeader::c_align % unit));
+
+	LONG deltaOffset = (ULONG) targetOffset & (unit - 1);
 
 	if(deltaOffset)
 	{
@@ -2863,7 +3129,7 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 		targetSize   += deltaOffset;
 	}
 
-	LONG const deltaSize = (-targetSize) & (CFilterBase::c_sectorSize - 1);
+	LONG const deltaSize = (-targetSize) & (unit - 1);
 
 	if(deltaSize)
 	{
@@ -2871,8 +3137,8 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 	}
 
 	ASSERT(deltaOffset || deltaSize);
-	ASSERT(0 == (targetOffset % CFilterBase::c_sectorSize));
-	ASSERT(0 == (targetSize   % CFilterBase::c_sectorSize));
+	ASSERT(0 == (targetOffset % unit));
+	ASSERT(0 == (targetSize   % unit));
 	
 	// Allocate intermediate buffer
 	LONG   const bufferSize = targetSize + CFilterContext::c_tail;
@@ -2883,6 +3149,9 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 		return STATUS_INSUFFICIENT_RESOURCES;
 	}
 
+	extension->Volume.m_statistics.Add(FILFILE_STAT_BOUNCE_BUFFERS);
+	extension->Volume.m_statistics.Add(FILFILE_STAT_NONALIGNED_RMW);
+
 	// ReadWrite
 	FILFILE_READ_WRITE readWrite;
 	RtlZeroMemory(&readWrite, sizeof(readWrite));
@@ -2899,7 +3168,7 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 	MmBuildMdlForNonPagedPool(readWrite.Mdl);
 
 	readWrite.Buffer = buffer;
-	readWrite.Length = CFilterBase::c_sectorSize;
+	readWrite.Length = unit;
 	readWrite.Flags  = IRP_NOCACHE | IRP_PAGING_IO | IRP_SYNCHRONOUS_PAGING_IO;
 	readWrite.Major  = IRP_MJ_READ;
 	readWrite.Wait   = true;
@@ -2908,12 +3177,12 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 	FILFILE_CRYPT_CONTEXT crypt;
 	RtlZeroMemory(&crypt, sizeof(crypt));
     
-	crypt.Nonce = link->m_nonce;
-	crypt.Key	= link->m_fileKey;
+	crypt.Nonce  = link->m_nonce;
+	crypt.Cipher = cipher;
 
 	NTSTATUS status = STATUS_SUCCESS;
 
-	// Read LHS sector, if any
+	// Read LHS unit, if any
 	if(deltaOffset)
 	{
 		crypt.Offset.QuadPart	  = targetOffset;
@@ -2925,8 +3194,8 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 
 		if(NT_SUCCESS(status))
 		{
-			// Decrypt LHS sector
-			CFilterContext::Decode(buffer, CFilterBase::c_sectorSize, &crypt);
+			// Decrypt LHS unit
+			status = CFilterContext::Decode(buffer, unit, &crypt);
 		}
 	}
 
@@ -2941,18 +3210,18 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 			ASSERT(stack->Parameters.Write.ByteOffset.QuadPart > next->Parameters.Write.ByteOffset.QuadPart);
 			deltaOffset += (ULONG) (stack->Parameters.Write.ByteOffset.QuadPart - next->Parameters.Write.ByteOffset.QuadPart);
 		}
-		else if(deltaSize && ((targetSize > CFilterBase::c_sectorSize) || !deltaOffset))
+		else if(deltaSize && ((targetSize > unit) || !deltaOffset))
 		{
-			// Read RHS sector, if not already done
-			ASSERT(targetSize >= CFilterBase::c_sectorSize);
-			LONG const rhs = targetSize - CFilterBase::c_sectorSize;
+			// Read RHS unit, if not already done
+			ASSERT(targetSize >= unit);
+			LONG const rhs = targetSize - unit;
 
 			crypt.Offset.QuadPart	  = targetOffset + rhs;
 			readWrite.Offset.QuadPart = crypt.Offset.QuadPart + link->m_headerBlockSize;
 			readWrite.Buffer		  = buffer + rhs;
 			
 			MmPrepareMdlForReuse(readWrite.Mdl);
-			MmInitializeMdl(readWrite.Mdl, readWrite.Buffer, CFilterBase::c_sectorSize);
+			MmInitializeMdl(readWrite.Mdl, readWrite.Buffer, unit);
 			MmBuildMdlForNonPagedPool(readWrite.Mdl);
 
 			DBGPRINT(("WriteNonAligned: FO[0x%p] fetch RHS at [0x%I64x]\n", stack->FileObject, readWrite.Offset));
@@ -2961,8 +3230,8 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 
 			if(NT_SUCCESS(status))
 			{
-				// Decrypt RHS sector
-				CFilterContext::Decode(readWrite.Buffer, CFilterBase::c_sectorSize, &crypt);
+				// Decrypt RHS unit
+				status = CFilterContext::Decode(readWrite.Buffer, unit, &crypt);
 			}
 		}
 
@@ -3031,19 +3300,33 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 
 					// Encode intermediate buffer
 					ASSERT(0 == (targetSize % CFilterContext::c_blockSize));
-					CFilterContext::Encode(buffer, targetSize, &crypt);
-
-					// Save original request parameters
-					readWriteCtx->RequestUserBufferMdl = 0;
-					readWriteCtx->RequestUserBuffer    = irp->UserBuffer;
-										
-					// Change request parameters
-					irp->UserBuffer = buffer;
-					irp->MdlAddress = readWrite.Mdl;
-					
-					IoSetCompletionRoutine(irp, CompletionWrite, readWriteCtx, true, true, true);					
+					status = CFilterContext::Encode(buffer, targetSize, &crypt);
+
+					if(NT_SUCCESS(status))
+					{
+						extension->Volume.m_statistics.AddBytes(CFilterContext::CipherMode(&crypt), targetSize, true);
+
+						// Save original request parameters
+						readWriteCtx->RequestUserBufferMdl = 0;
+						readWriteCtx->RequestUserBuffer    = irp->UserBuffer;
+											
+						// Change request parameters
+						irp->UserBuffer = buffer;
+						irp->MdlAddress = readWrite.Mdl;
+						
+						// Keep read-ahead off until the server has it
+						extension->Volume.ReadAheadWriteStart();
 
-					DBGPRINT(("WriteNonAligned: FO[0x%p] writing Size[0x%x] Offset[0x%I64x]\n", next->FileObject, next->Parameters.Write.Length, next->Parameters.Write.ByteOffset));
+						IoSetCompletionRoutine(irp, CompletionWrite, readWriteCtx, true, true, true);					
+
+						DBGPRINT(("WriteNonAligned: FO[0x%p] writing Size[0x%x] Offset[0x%I64x]\n", next->FileObject, next->Parameters.Write.Length, next->Parameters.Write.ByteOffset));
+					}
+					else
+					{
+						DBGPRINT(("WriteNonAligned -ERROR: Encode() failed [0x%08x]\n", status));
+
+						extension->Volume.m_context->FreeLookaside(readWriteCtx);
+					}
 				}
 			}
 		}
@@ -3056,6 +3339,9 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 	{
 		IoFreeMdl(readWrite.Mdl);
 
+		// may hold user's data in the clear
+		RtlZeroMemory(buffer, bufferSize);
+
 		ExFreePool(buffer);
 	}
 
@@ -3067,17 +3353,18 @@ NTSTATUS CFilterEngine::WriteNonAligned(FILFILE_VOLUME_EXTENSION *extension, IRP
 
 #pragma LOCKEDCODE
 
-NTSTATUS CFilterEngine::Write(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFilterContextLink *link)
+NTSTATUS CFilterEngine::Write(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFilterContextLink *link, CFilterCipher *cipher)
 {
 	ASSERT(extension);
 	ASSERT(irp);
 	ASSERT(link);
+	ASSERT(cipher);
 
 #if FILFILE_USE_PADDING
 	if(link->m_flags & TRACK_ALIGNMENT)
 	{
 		// handle non-aligned write request
-		return WriteNonAligned(extension, irp, link);
+		return WriteNonAligned(extension, irp, link, cipher);
 	}
 #endif
 
@@ -3116,6 +3403,8 @@ NTSTATUS CFilterEngine::Write(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFi
 
 		if(readWrite->Buffer)
 		{
+			extension->Volume.m_statistics.Add(FILFILE_STAT_BOUNCE_BUFFERS);
+
 			// zero out unused bytes, if any
 			if(readWrite->BufferSize > targetSize)
 			{
@@ -3134,7 +3423,7 @@ NTSTATUS CFilterEngine::Write(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFi
 				// set crypt parameters, by value
 				crypt.Offset = next->Parameters.Write.ByteOffset;
 				crypt.Nonce  = link->m_nonce;
-				crypt.Key    = link->m_fileKey;
+				crypt.Cipher = cipher;
 
 				// skip our Header, adjust offset
 				next->Parameters.Write.ByteOffset.QuadPart += link->m_headerBlockSize;
@@ -3194,7 +3483,12 @@ NTSTATUS CFilterEngine::Write(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFi
 					#endif
 
 					// encode inplace
-					CFilterContext::Encode(readWrite->Buffer, targetSize, &crypt);
+					status = CFilterContext::Encode(readWrite->Buffer, targetSize, &crypt);
+				}
+
+				if(NT_SUCCESS(status))
+				{
+					extension->Volume.m_statistics.AddBytes(CFilterContext::CipherMode(&crypt), targetSize, true);
 
 					// save original request parameters
 					readWrite->RequestUserBuffer    = irp->UserBuffer;
@@ -3206,8 +3500,18 @@ NTSTATUS CFilterEngine::Write(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFi
 
 					DBGPRINT(("Write: FO[0x%p] FCB[0x%p] Size[0x%x] Offset[0x%I64x]\n", next->FileObject, next->FileObject->FsContext, next->Parameters.Write.Length, next->Parameters.Write.ByteOffset));
 
+					if(extension->LowerType & FILFILE_DEVICE_REDIRECTOR)
+					{
+						// Keep read-ahead off until the server has it
+						extension->Volume.ReadAheadWriteStart();
+					}
+
 					IoSetCompletionRoutine(irp, CompletionWrite, readWrite, true, true, true);
 				}
+				else
+				{
+					DBGPRINT(("Write -ERROR: FO[0x%p] failed [0x%08x]\n", next->FileObject, status));
+				}
 
   				// be paranoid
 				RtlZeroMemory(&crypt, sizeof(crypt));
@@ -3222,6 +3526,9 @@ NTSTATUS CFilterEngine::Write(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFi
 			}
 			if(readWrite->Buffer)
 			{
+				// may hold user's data in the clear
+				RtlZeroMemory(readWrite->Buffer, readWrite->BufferSize);
+
 				ExFreePool(readWrite->Buffer);
 			}
 
@@ -3526,6 +3833,8 @@ NTSTATUS CFilterEngine::WriteMdl(FILFILE_VOLUME_EXTENSION *const extension, IRP
 
 		if(buffer)
 		{
+			extension->Volume.m_statistics.Add(FILFILE_STAT_BOUNCE_BUFFERS);
+
 			mdl = IoAllocateMdl(buffer, bufferSize, false, false, 0);
 			
 			if(mdl)
@@ -3658,6 +3967,11 @@ NTSTATUS CFilterEngine::CompletionWrite(DEVICE_OBJECT *device, IRP *irp, void *c
 	ASSERT(extension);
 
 	extension->Volume.m_context->FreeLookaside(readWrite);
+
+	if(extension->LowerType & FILFILE_DEVICE_REDIRECTOR)
+	{
+		extension->Volume.ReadAheadWriteEnd();
+	}
 		
     if(irp->PendingReturned)
 	{
@@ -3877,7 +4191,9 @@ NTSTATUS CFilterEngine::DispatchWrite(DEVICE_OBJECT *device, IRP *irp)
 	CFilterContextLink link;
 	RtlZeroMemory(&link, sizeof(link));
 
-	int const state = extension->Volume.CheckFileCooked(file, &link);//ļcookedǷ
+	CFilterCipher *cipher = 0;
+
+	int const state = extension->Volume.CheckFileCooked(file, &link, &cipher);//ļcookedǷ
 
 	if(!state)
 	{
@@ -3886,6 +4202,12 @@ NTSTATUS CFilterEngine::DispatchWrite(DEVICE_OBJECT *device, IRP *irp)
 
 		return IoCallDriver(extension->Lower, irp);
 	}
+
+	if(extension->LowerType & FILFILE_DEVICE_REDIRECTOR)
+	{
+		// Decrypted data read ahead is stale now
+		extension->Volume.InvalidateReadAhead(file);
+	}
 	
 	bool bypass = false;
 
@@ -3895,8 +4217,10 @@ NTSTATUS CFilterEngine::DispatchWrite(DEVICE_OBJECT *device, IRP *irp)
 		if(stack->MinorFunction & (IRP_MN_MDL | IRP_MN_COMPLETE))
 		{
 			//FO_REMOTE_ORIGINֱӷʻ,Բ
-			// be paranoid
-			link.m_fileKey.Clear();
+			if(cipher)
+			{
+				cipher->Release();
+			}
 		
 			// Usually this request comes from SRV trying to access the cached data directly
 			NTSTATUS const status = WriteMdl(extension, irp, &link);
@@ -3921,13 +4245,21 @@ NTSTATUS CFilterEngine::DispatchWrite(DEVICE_OBJECT *device, IRP *irp)
 		}
 	}
 
+	LONGLONG const stage = CFilterStatistics::StageStart();
+
+	ULONG const tracker = (bypass) ? 0 : extension->Volume.m_context->Tracker().Check(file);
+
+	extension->Volume.m_statistics.AddStage(FILFILE_STAT_STAGE_TRACKER, stage);
+
 	// Bypass request?
-	if(bypass || (extension->Volume.m_context->Tracker().Check(file) & FILFILE_TRACKER_BYPASS))
+	if(bypass || (tracker & FILFILE_TRACKER_BYPASS))
 	{
 		DBGPRINT(("DispatchWrite: FO[0x%p] File is bypassed\n", file));
 
-		// be paranoid
-		link.m_fileKey.Clear();
+		if(cipher)
+		{
+			cipher->Release();
+		}
 
 		if(irp->Flags & IRP_NOCACHE)
 		{
@@ -3948,8 +4280,10 @@ NTSTATUS CFilterEngine::DispatchWrite(DEVICE_OBJECT *device, IRP *irp)
 	{
 		DBGPRINT(("DispatchWrite: FO[0x%p] is doomed, cancel\n", file));
 
-		// be paranoid
-		link.m_fileKey.Clear();
+		if(cipher)
+		{
+			cipher->Release();
+		}
 
 		irp->IoStatus.Status	  = STATUS_FILE_CLOSED;
 		irp->IoStatus.Information = 0;
@@ -3959,13 +4293,14 @@ NTSTATUS CFilterEngine::DispatchWrite(DEVICE_OBJECT *device, IRP *irp)
 		return STATUS_FILE_CLOSED;
 	}
 	
+	ASSERT(cipher);
+
 	if(stack->MinorFunction & (IRP_MN_MDL | IRP_MN_COMPLETE))
 	{
 		// Usually this request comes from SRV trying to access the cached data directly
 		DBGPRINT(("DispatchWrite: FO[0x%p] local MDL[%d] request\n", file, stack->MinorFunction));
 
-		// be paranoid
-		link.m_fileKey.Clear();
+		cipher->Release();
 
 		IoSkipCurrentIrpStackLocation(irp);
 	
@@ -3979,8 +4314,7 @@ NTSTATUS CFilterEngine::DispatchWrite(DEVICE_OBJECT *device, IRP *irp)
 
 	if(NT_ERROR(status))
 	{
-		// be paranoid
-		link.m_fileKey.Clear();
+		cipher->Release();
 
 		FsRtlExitFileSystem();
 
@@ -4084,12 +4418,11 @@ NTSTATUS CFilterEngine::DispatchWrite(DEVICE_OBJECT *device, IRP *irp)
 		if(NT_SUCCESS(status) && !complete)
 		{
 			// Perform the actual encoding
-			status = Write(extension, irp, &link);
+			status = Write(extension, irp, &link, cipher);
 		}
 	}
 
-	// be paranoid
-	link.m_fileKey.Clear();
+	cipher->Release();
 
 	FsRtlExitFileSystem();
 
@@ -4171,19 +4504,22 @@ NTSTATUS CFilterEngine::DispatchQueryInformation(DEVICE_OBJECT *device, IRP *irp
         return IoCallDriver(extension->Lower, irp);
 	}
 
-	CFilterContextLink link;
-	RtlZeroMemory(&link, sizeof(link));
+	CFilterStream *stream = 0;
 	
 	// of interest ?
-	if(!extension->Volume.CheckFileCooked(stack->FileObject, &link))
+	if(!extension->Volume.ReferenceStream(stack->FileObject, &stream))
 	{
 		IoSkipCurrentIrpStackLocation(irp);
 
         return IoCallDriver(extension->Lower, irp);
 	}
 
-	// be paranoid
-	link.m_fileKey.Clear();
+	ASSERT(stream);
+
+	// Take what is needed in place, without copying the FileKey
+	ULONG const headerBlockSize = stream->m_link.m_headerBlockSize;
+
+	stream->Release();
 
 	IoCopyCurrentIrpStackLocationToNext(irp);
 
@@ -4206,7 +4542,7 @@ NTSTATUS CFilterEngine::DispatchQueryInformation(DEVICE_OBJECT *device, IRP *irp
 				for(;;)
 				{
 					// Header sizes of each stream are equal
-					ULONG metaSize = link.m_headerBlockSize;
+					ULONG metaSize = headerBlockSize;
 
 					// Substract Tail, if there is one
 					if(info->StreamSize.QuadPart > metaSize)
@@ -4286,7 +4622,7 @@ NTSTATUS CFilterEngine::DispatchQueryInformation(DEVICE_OBJECT *device, IRP *irp
 				}
 			}
 	        
-			ULONG metaSize = link.m_headerBlockSize;
+			ULONG metaSize = headerBlockSize;
 
 			if(fileSize)
 			{
@@ -4373,6 +4709,47 @@ NTSTATUS CFilterEngine::CompletionSetInformation(DEVICE_OBJECT *device, IRP *irp
 
 #pragma PAGEDCODE
 
+NTSTATUS CFilterEngine::PassAutoConfig(FILFILE_VOLUME_EXTENSION *extension, IRP *irp)
+{
+	ASSERT(extension);
+	ASSERT(irp);
+
+	PAGED_CODE();
+
+	// Request may create an AutoConfig file, so void cached lookups now and once it has completed
+	extension->Volume.m_autoConfigs.Invalidate();
+
+	IoCopyCurrentIrpStackLocationToNext(irp);
+	IoSetCompletionRoutine(irp, CompletionAutoConfig, &extension->Volume.m_autoConfigs, true, true, true);
+
+	return IoCallDriver(extension->Lower, irp);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+NTSTATUS CFilterEngine::CompletionAutoConfig(DEVICE_OBJECT *device, IRP *irp, void *context)
+{
+	UNREFERENCED_PARAMETER(device);
+	ASSERT(irp);
+	ASSERT(context);
+
+	// Might run at DISPATCH_LEVEL
+	((CFilterAutoConfigCache*) context)->Invalidate();
+
+    if(irp->PendingReturned)
+	{
+        IoMarkIrpPending(irp);
+    }
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
 NTSTATUS CFilterEngine::Rename(FILFILE_VOLUME_EXTENSION *extension, IRP *irp)
 {
 	ASSERT(extension);
@@ -4871,11 +5248,44 @@ NTSTATUS CFilterEngine::DispatchSetInformation(DEVICE_OBJECT *device, IRP *irp)
 	{
 		// Remove file's Header from cache
 		CFilterControl::Extension()->HeaderCache.Remove(extension, stack->FileObject);
+
+		// and its Header block size, if it deviated
+		CFilterControl::Extension()->Context.m_sizes.Remove(extension, stack->FileObject);
+	}
+
+	bool autoConfig = false;
+
+	if((FileRenameInformation == infoType) || (FileLinkInformation == infoType))
+	{
+		// Both share the same layout
+		FILE_RENAME_INFORMATION const* info = (FILE_RENAME_INFORMATION const*) irp->AssociatedIrp.SystemBuffer;
+
+		// Target is an AutoConfig file?
+		if(info && (stack->Parameters.SetFile.Length >= sizeof(FILE_RENAME_INFORMATION)))
+		{
+			autoConfig = CFilterAutoConfigCache::Match(info->FileName, info->FileNameLength);
+
+			// A replaced target may have had a deviating Header block size
+			CFilterControl::Extension()->Context.m_sizes.Remove(info->FileName, info->FileNameLength);
+		}
+
+		// Moved directories take their AutoConfig files along
+		if(!autoConfig && (FileRenameInformation == infoType) && (extension->LowerType & FILFILE_DEVICE_VOLUME))
+		{
+			ULONG const attribs = CFilterBase::GetAttributes(extension->Lower, stack->FileObject);
+
+			autoConfig = (attribs != INVALID_FILE_ATTRIBUTES) && (attribs & FILE_ATTRIBUTE_DIRECTORY);
+		}
 	}
 
 	// inactive ? 
 	if( !(s_state & FILFILE_STATE_FILE))
 	{
+		if(autoConfig)
+		{
+			return PassAutoConfig(extension, irp);
+		}
+
 		IoSkipCurrentIrpStackLocation(irp);
 
 		return IoCallDriver(extension->Lower, irp);
@@ -4888,11 +5298,21 @@ NTSTATUS CFilterEngine::DispatchSetInformation(DEVICE_OBJECT *device, IRP *irp)
 	{
 		DBGPRINT(("DispatchSetInformation: FO[0x%p] remote request, ignore\n", stack->FileObject));
 
+		if(autoConfig)
+		{
+			return PassAutoConfig(extension, irp);
+		}
+
 		IoSkipCurrentIrpStackLocation(irp);
 
 		return IoCallDriver(extension->Lower, irp);
 	}
 
+	if(autoConfig && (FileLinkInformation == infoType))
+	{
+		return PassAutoConfig(extension, irp);
+	}
+
 	// Delete operation?
 	if(FileDispositionInformation == infoType)
 	{
@@ -4917,6 +5337,11 @@ NTSTATUS CFilterEngine::DispatchSetInformation(DEVICE_OBJECT *device, IRP *irp)
 			return STATUS_NOT_SAME_DEVICE;
 		}
 
+		if(autoConfig)
+		{
+			return PassAutoConfig(extension, irp);
+		}
+
 		// As we do not really need our stack location here, let the next driver use ours. This also avoids
 		// a BSOD (IO_NO_MORE_STACK_LOCATIONS) occuring with a Symantec AV update using an esoteric layering
 		IoSkipCurrentIrpStackLocation(irp);
@@ -4967,6 +5392,12 @@ NTSTATUS CFilterEngine::DispatchSetInformation(DEVICE_OBJECT *device, IRP *irp)
 		DBGPRINT(("DispatchSetInformation: FO[0x%p] is doomed, handle\n", stack->FileObject));
 	}
 
+	if(extension->LowerType & FILFILE_DEVICE_REDIRECTOR)
+	{
+		// Decrypted data read ahead may be beyond new EOF
+		extension->Volume.InvalidateReadAhead(stack->FileObject);
+	}
+
 	FsRtlEnterFileSystem();
 
 	IoCopyCurrentIrpStackLocationToNext(irp);
@@ -5123,8 +5554,13 @@ NTSTATUS CFilterEngine::DispatchCleanup(DEVICE_OBJECT *device, IRP *irp)
 			{
 				DBGPRINT(("DispatchCleanup: FO[0x%p] Wipe on delete\n", file));
 
-				// Wipe only files on local volumes
-				CFilterControl::Extension()->Wiper.WipeFile(file);
+				CFilterWiper &wiper = CFilterControl::Extension()->Wiper;
+
+				// Wipe only files on local volumes, in background if possible
+				if(NT_ERROR(wiper.Defer(extension, file)))
+				{
+					wiper.WipeFile(file);
+				}
 			}
 		}
 	}
@@ -5233,7 +5669,7 @@ NTSTATUS CFilterEngine::DispatchClose(DEVICE_OBJECT *device, IRP *irp)
 
 #pragma PAGEDCODE
 
-NTSTATUS CFilterEngine::DirectoryQuerySizes(void *entry, ULONG entryType, ULONG headerSize)
+NTSTATUS CFilterEngine::DirectoryQuerySizes(void *entry, ULONG entryType, ULONG headerSize, CFilterSizeCache::CFilterSizeSnapshot const* sizes)
 {
 	ASSERT(entry);
 	ASSERT(entryType);
@@ -5243,6 +5679,8 @@ NTSTATUS CFilterEngine::DirectoryQuerySizes(void *entry, ULONG entryType, ULONG
 
 	LARGE_INTEGER *eof   = 0;
 	LARGE_INTEGER *alloc = 0;
+	LPCWSTR fileName	 = 0;
+	ULONG fileNameLength = 0;
 
 	switch(entryType)
 	{
@@ -5250,40 +5688,50 @@ NTSTATUS CFilterEngine::DirectoryQuerySizes(void *entry, ULONG entryType, ULONG
 		{
 			FILE_BOTH_DIR_INFORMATION *const dirInfo = (FILE_BOTH_DIR_INFORMATION*) entry;
 
-			eof   = &dirInfo->EndOfFile;
-			alloc = &dirInfo->AllocationSize;
+			eof			   = &dirInfo->EndOfFile;
+			alloc		   = &dirInfo->AllocationSize;
+			fileName	   = dirInfo->FileName;
+			fileNameLength = dirInfo->FileNameLength;
 			break;
 		}
 		case FileDirectoryInformation:
 		{
 			FILE_DIRECTORY_INFORMATION *const dirInfo = (FILE_DIRECTORY_INFORMATION*) entry;
 
-			eof   = &dirInfo->EndOfFile;
-			alloc = &dirInfo->AllocationSize;
+			eof			   = &dirInfo->EndOfFile;
+			alloc		   = &dirInfo->AllocationSize;
+			fileName	   = dirInfo->FileName;
+			fileNameLength = dirInfo->FileNameLength;
 			break;
 		}
 		case FileFullDirectoryInformation:
 		{
 			FILE_FULL_DIR_INFORMATION *const dirInfo = (FILE_FULL_DIR_INFORMATION*) entry;
 
-			eof   = &dirInfo->EndOfFile;
-			alloc = &dirInfo->AllocationSize;
+			eof			   = &dirInfo->EndOfFile;
+			alloc		   = &dirInfo->AllocationSize;
+			fileName	   = dirInfo->FileName;
+			fileNameLength = dirInfo->FileNameLength;
 			break;
 		}
 		case FileIdBothDirectoryInformation:
 		{
 			FILE_ID_BOTH_DIR_INFORMATION *const dirInfo = (_FILE_ID_BOTH_DIR_INFORMATION*) entry;
 
-			eof   = &dirInfo->EndOfFile;
-			alloc = &dirInfo->AllocationSize;
+			eof			   = &dirInfo->EndOfFile;
+			alloc		   = &dirInfo->AllocationSize;
+			fileName	   = dirInfo->FileName;
+			fileNameLength = dirInfo->FileNameLength;
 			break;
 		}
 		case FileIdFullDirectoryInformation:
 		{
 			FILE_ID_FULL_DIR_INFORMATION *const dirInfo = (FILE_ID_FULL_DIR_INFORMATION*) entry;
 
-			eof   = &dirInfo->EndOfFile;
-			alloc = &dirInfo->AllocationSize;
+			eof			   = &dirInfo->EndOfFile;
+			alloc		   = &dirInfo->AllocationSize;
+			fileName	   = dirInfo->FileName;
+			fileNameLength = dirInfo->FileNameLength;
 			break;
 		}
 		default:
@@ -5291,6 +5739,12 @@ NTSTATUS CFilterEngine::DirectoryQuerySizes(void *entry, ULONG entryType, ULONG
 			break;
 	}
 
+	// Header block size of this very file, if it differs from the Entity's one
+	if(sizes && fileName)
+	{
+		headerSize = sizes->Get(fileName, fileNameLength, headerSize);
+	}
+
 	ULONG metaSize = headerSize;
 
 	if(eof)
@@ -5452,7 +5906,7 @@ ULONG CFilterEngine::DirectoryQueryNames(UCHAR *buffer, ULONG bufferSize, void *
 
 #pragma PAGEDCODE
 
-NTSTATUS CFilterEngine::DirectoryQuery(IRP *irp, ULONG headerSize)
+NTSTATUS CFilterEngine::DirectoryQuery(IRP *irp, ULONG headerSize, CFilterSizeCache::CFilterSizeSnapshot const* sizes)
 {
 	ASSERT(irp);
 
@@ -5461,16 +5915,16 @@ NTSTATUS CFilterEngine::DirectoryQuery(IRP *irp, ULONG headerSize)
 	ASSERT(irp->UserBuffer);
 
 	// a couple of compile time checks to ensure 1) NextEntryOffset is the very first value, and
-	C_ASSERT(0 == offsetof(FILE_DIRECTORY_INFORMATION,	 NextEntryOffset));
-	C_ASSERT(0 == offsetof(FILE_FULL_DIR_INFORMATION,	 NextEntryOffset));
-	C_ASSERT(0 == offsetof(FILE_BOTH_DIR_INFORMATION,	 NextEntryOffset));
-	C_ASSERT(0 == offsetof(FILE_ID_BOTH_DIR_INFORMATION, NextEntryOffset));
-	C_ASSERT(0 == offsetof(FILE_ID_FULL_DIR_INFORMATION, NextEntryOffset));
+	C_ASSERT(0 == FIELD_OFFSET(FILE_DIRECTORY_INFORMATION,	 NextEntryOffset));
+	C_ASSERT(0 == FIELD_OFFSET(FILE_FULL_DIR_INFORMATION,	 NextEntryOffset));
+	C_ASSERT(0 == FIELD_OFFSET(FILE_BOTH_DIR_INFORMATION,	 NextEntryOffset));
+	C_ASSERT(0 == FIELD_OFFSET(FILE_ID_BOTH_DIR_INFORMATION, NextEntryOffset));
+	C_ASSERT(0 == FIELD_OFFSET(FILE_ID_FULL_DIR_INFORMATION, NextEntryOffset));
 	// 2) FileAttributes value is always at same offset in all structs handled.
-	C_ASSERT(offsetof(FILE_DIRECTORY_INFORMATION, FileAttributes) == offsetof(FILE_FULL_DIR_INFORMATION,    FileAttributes));
-	C_ASSERT(offsetof(FILE_DIRECTORY_INFORMATION, FileAttributes) == offsetof(FILE_BOTH_DIR_INFORMATION,    FileAttributes));
-	C_ASSERT(offsetof(FILE_DIRECTORY_INFORMATION, FileAttributes) == offsetof(FILE_ID_BOTH_DIR_INFORMATION, FileAttributes));
-	C_ASSERT(offsetof(FILE_DIRECTORY_INFORMATION, FileAttributes) == offsetof(FILE_ID_FULL_DIR_INFORMATION, FileAttributes));
+	C_ASSERT(FIELD_OFFSET(FILE_DIRECTORY_INFORMATION, FileAttributes) == FIELD_OFFSET(FILE_FULL_DIR_INFORMATION,    FileAttributes));
+	C_ASSERT(FIELD_OFFSET(FILE_DIRECTORY_INFORMATION, FileAttributes) == FIELD_OFFSET(FILE_BOTH_DIR_INFORMATION,    FileAttributes));
+	C_ASSERT(FIELD_OFFSET(FILE_DIRECTORY_INFORMATION, FileAttributes) == FIELD_OFFSET(FILE_ID_BOTH_DIR_INFORMATION, FileAttributes));
+	C_ASSERT(FIELD_OFFSET(FILE_DIRECTORY_INFORMATION, FileAttributes) == FIELD_OFFSET(FILE_ID_FULL_DIR_INFORMATION, FileAttributes));
 	
 	ULONG const infoClass = IoGetCurrentIrpStackLocation(irp)->Parameters.QueryDirectory.FileInformationClass;
 	ULONG *info			  = (ULONG*) irp->UserBuffer;
@@ -5506,10 +5960,10 @@ NTSTATUS CFilterEngine::DirectoryQuery(IRP *irp, ULONG headerSize)
 		ASSERT(info < (ULONG*) (buffer + bufferSize));
 
 		// Ensure FileAttributes' offset is a multiple of 4.
-		C_ASSERT(0 == (offsetof(FILE_DIRECTORY_INFORMATION, FileAttributes) % sizeof(ULONG)));
+		C_ASSERT(0 == (FIELD_OFFSET(FILE_DIRECTORY_INFORMATION, FileAttributes) % sizeof(ULONG)));
 
 		// Skip directory entries
-		if( !(*(info + offsetof(FILE_DIRECTORY_INFORMATION, FileAttributes) / sizeof(ULONG)) & FILE_ATTRIBUTE_DIRECTORY))
+		if( !(*(info + FIELD_OFFSET(FILE_DIRECTORY_INFORMATION, FileAttributes) / sizeof(ULONG)) & FILE_ATTRIBUTE_DIRECTORY))
 		{
 			// Remove only once
 			if(!autoConfigSize)
@@ -5528,13 +5982,16 @@ NTSTATUS CFilterEngine::DirectoryQuery(IRP *irp, ULONG headerSize)
 
 						break;
 					}
+
+					// Next entry took its place, which may be a directory
+					continue;
 				}
 			}
 
 			if(headerSize)
 			{
 				// Adjust contained file sizes accordingly, if any
-				DirectoryQuerySizes(info, infoClass, headerSize);
+				DirectoryQuerySizes(info, infoClass, headerSize, sizes);
 			}
 		}
 
@@ -5642,8 +6099,17 @@ NTSTATUS CFilterEngine::DispatchDirectoryControl(DEVICE_OBJECT *device, IRP *irp
 
 	NTSTATUS status = CFilterBase::SimpleSend(extension->Lower, irp);	
 
+	CFilterSizeCache::CFilterSizeSnapshot sizes;
+	RtlZeroMemory(&sizes, sizeof(sizes));
+
 	if(NT_SUCCESS(status))
 	{
+		if(directory.m_entityIdentifier)
+		{
+			// Files of this directory with deviating Header block sizes, if any
+			extension->Volume.m_context->m_sizes.Snapshot(directory.m_directoryHash, &sizes);
+		}
+
 		__try
 		{
 			// valid Entity?
@@ -5658,7 +6124,7 @@ NTSTATUS CFilterEngine::DispatchDirectoryControl(DEVICE_OBJECT *device, IRP *irp
 					ASSERT(entity.m_headerBlocksize);
 
 					// search returned buffer for interesting entries and handle these accordingly
-					DirectoryQuery(irp, entity.m_headerBlocksize);
+					DirectoryQuery(irp, entity.m_headerBlocksize, &sizes);
 				}
 			}
 			else
@@ -5676,6 +6142,8 @@ NTSTATUS CFilterEngine::DispatchDirectoryControl(DEVICE_OBJECT *device, IRP *irp
 		}
 	}
 
+	sizes.Close();
+
 	IoCompleteRequest(irp, IO_NO_INCREMENT);
 
 	return status;
@@ -5863,6 +6331,15 @@ void  CFilterEngine::SfLoadDynamicFunctions ()
 	RtlInitUnicodeString( &functionName, L"RtlGetVersion" );
 	g_SfDynamicFunctions.GetVersion = (PSF_GET_VERSION)MmGetSystemRoutineAddress( &functionName );
 
+	RtlInitUnicodeString( &functionName, L"FsRtlInsertPerStreamContext" );
+	g_SfDynamicFunctions.InsertPerStreamContext = (PSF_INSERT_PER_STREAM_CONTEXT)MmGetSystemRoutineAddress( &functionName );
+
+	RtlInitUnicodeString( &functionName, L"FsRtlLookupPerStreamContextInternal" );
+	g_SfDynamicFunctions.LookupPerStreamContext = (PSF_LOOKUP_PER_STREAM_CONTEXT)MmGetSystemRoutineAddress( &functionName );
+
+	RtlInitUnicodeString( &functionName, L"FsRtlRemovePerStreamContext" );
+	g_SfDynamicFunctions.RemovePerStreamContext = (PSF_REMOVE_PER_STREAM_CONTEXT)MmGetSystemRoutineAddress( &functionName );
+
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -68,6 +68,29 @@ NTSTATUS
 					  IN OUT PRTL_OSVERSIONINFOW VersionInformation
 					  );
 
+typedef
+NTSTATUS
+( *PSF_INSERT_PER_STREAM_CONTEXT ) ( 
+									IN PFSRTL_ADVANCED_FCB_HEADER PerStreamContext,
+									IN PFSRTL_PER_STREAM_CONTEXT Ptr
+									);
+
+typedef
+PFSRTL_PER_STREAM_CONTEXT
+( *PSF_LOOKUP_PER_STREAM_CONTEXT ) ( 
+									IN PFSRTL_ADVANCED_FCB_HEADER StreamContext,
+									IN PVOID OwnerId OPTIONAL,
+									IN PVOID InstanceId OPTIONAL
+									);
+
+typedef
+PFSRTL_PER_STREAM_CONTEXT
+( *PSF_REMOVE_PER_STREAM_CONTEXT ) ( 
+									IN PFSRTL_ADVANCED_FCB_HEADER StreamContext,
+									IN PVOID OwnerId OPTIONAL,
+									IN PVOID InstanceId OPTIONAL
+									);
+
 typedef struct _SF_DYNAMIC_FUNCTION_POINTERS {
 
 	//
@@ -82,6 +105,9 @@ typedef struct _SF_DYNAMIC_FUNCTION_POINTERS {
 	PSF_GET_DISK_DEVICE_OBJECT GetDiskDeviceObject;
 	PSF_GET_ATTACHED_DEVICE_REFERENCE GetAttachedDeviceReference;
 	PSF_GET_VERSION GetVersion;
+	PSF_INSERT_PER_STREAM_CONTEXT InsertPerStreamContext;
+	PSF_LOOKUP_PER_STREAM_CONTEXT LookupPerStreamContext;
+	PSF_REMOVE_PER_STREAM_CONTEXT RemovePerStreamContext;
 
 } SF_DYNAMIC_FUNCTION_POINTERS, *PSF_DYNAMIC_FUNCTION_POINTERS;
 
@@ -101,6 +127,8 @@ class CFilterEngine
 		ULONG	BufferSize;
 	};
 
+	struct CREATE_CONTEXT;
+
 public:
 
 	static NTSTATUS					Init(DRIVER_OBJECT* driverObject, DEVICE_OBJECT* control, LPCWSTR regPath = 0);
@@ -123,6 +151,7 @@ public:
 	static NTSTATUS					LogonTermination(LUID *luid = 0);
 	static void                     SfLoadDynamicFunctions ();
 	static NTSTATUS                 SfEnumerateFileSystemVolumes(IN DEVICE_OBJECT *device);
+	static NTSTATUS					DirectoryQuery(IRP *irp, ULONG headerSize, CFilterSizeCache::CFilterSizeSnapshot const* sizes = 0);
 
 	static LONG						s_state;	// controls states the driver operates in
 
@@ -130,13 +159,13 @@ private:
 		
 #if FILFILE_USE_PADDING
 	static NTSTATUS					ReadNonAligned(FILFILE_VOLUME_EXTENSION* extension, IRP *irp, LONGLONG vdl, FILFILE_CRYPT_CONTEXT *crypt);
-	static NTSTATUS					WriteNonAligned(FILFILE_VOLUME_EXTENSION* extension, IRP* irp, CFilterContextLink *link);
+	static NTSTATUS					WriteNonAligned(FILFILE_VOLUME_EXTENSION* extension, IRP* irp, CFilterContextLink *link, CFilterCipher *cipher);
 #endif
 
 	static NTSTATUS					ReadMdl(FILFILE_VOLUME_EXTENSION *const extension, IRP *irp, CFilterContextLink *link);
 	static NTSTATUS					ReadBypass(FILFILE_VOLUME_EXTENSION *const extension, IRP *irp, CFilterContextLink *link);
 
-	static NTSTATUS					Write(FILFILE_VOLUME_EXTENSION* extension, IRP* irp, CFilterContextLink *link);
+	static NTSTATUS					Write(FILFILE_VOLUME_EXTENSION* extension, IRP* irp, CFilterContextLink *link, CFilterCipher *cipher);
 	static NTSTATUS					WriteMdl(FILFILE_VOLUME_EXTENSION *const extension, IRP *irp, CFilterContextLink *link);
 	static NTSTATUS					WriteBypass(FILFILE_VOLUME_EXTENSION *const extension, IRP *irp, CFilterContextLink *link);
 	static NTSTATUS					WritePrepare(FILFILE_VOLUME_EXTENSION* extension, IRP* irp, CFilterContextLink *link);
@@ -148,6 +177,7 @@ private:
 	static NTSTATUS					CompletionReadNonAligned(DEVICE_OBJECT *device, IRP *irp, void *context);
 	static NTSTATUS					CompletionReadCached(DEVICE_OBJECT *device, IRP *irp, void *context);
 	static NTSTATUS					CompletionSetInformation(DEVICE_OBJECT *device, IRP *irp, void *context);
+	static NTSTATUS					CompletionAutoConfig(DEVICE_OBJECT *device, IRP *irp, void *context);
 	static NTSTATUS					CompletionWrite(DEVICE_OBJECT* device, IRP* irp, void* context);
 #if DBG
 	 static NTSTATUS				CompletionWriteCached(DEVICE_OBJECT* device, IRP* irp, void *context);
@@ -157,15 +187,19 @@ private:
 
 	static NTSTATUS					Delete(FILFILE_VOLUME_EXTENSION *extension, IRP *irp);
 	static NTSTATUS					Delete(FILFILE_VOLUME_EXTENSION *extension, FILFILE_TRACK_CONTEXT *track);
+	static NTSTATUS					PassAutoConfig(FILFILE_VOLUME_EXTENSION *extension, IRP *irp);
 
-	static NTSTATUS					DirectoryQuery(IRP *irp, ULONG headerSize);
-	static NTSTATUS					DirectoryQuerySizes(void *entry, ULONG entryType, ULONG headerSize);
+	static NTSTATUS					DirectoryQuerySizes(void *entry, ULONG entryType, ULONG headerSize, CFilterSizeCache::CFilterSizeSnapshot const* sizes = 0);
 	static ULONG					DirectoryQueryNames(UCHAR *buffer, ULONG bufferSize, void *entry, ULONG entryType);
 
 	static NTSTATUS					FsMountVolume(DEVICE_OBJECT *device, IRP *irp);
 	static NTSTATUS					FsLoadFileSystem(DEVICE_OBJECT *device, IRP *irp);
 	static NTSTATUS					FsUserRequest(DEVICE_OBJECT *device, IRP *irp);
 
+	static NTSTATUS					CreatePend(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, FILFILE_TRACK_CONTEXT *track);
+	static void						CreateResume(void *context);
+	static NTSTATUS					CreateComplete(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, FILFILE_TRACK_CONTEXT *track, NTSTATUS status);
+
 	static bool						EstimateCaching(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, FILE_OBJECT *file, CFilterContextLink *link);
 	static bool						SkipCreate(DEVICE_OBJECT *device, IRP *irp);
 };
@@ -13,6 +13,10 @@
 #include "CFilterControl.h"
 #include "CFilterEntity.h"
 
+// STATICS //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LONG volatile CFilterEntityCont::s_generation = 0;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #pragma PAGEDCODE
@@ -33,6 +37,11 @@ void CFilterEntityCont::Close()
 		m_entities[index].Close();
 	}
 
+	if(m_size)
+	{
+		Changed();
+	}
+
 	m_size = 0;
 
 	if(m_entities)
@@ -268,8 +277,8 @@ NTSTATUS CFilterEntityCont::AddRaw(CFilterEntity *entity)
 		// Copy Entity attribs
 		added->m_identifier = entity->m_identifier;
 
-		// Regular?
-		if(entity->m_identifier)
+		// Regular, or one on its way back to the CDO?
+		if(entity->m_identifier || entity->m_headerIdentifier)
 		{
 			added->m_headerIdentifier = entity->m_headerIdentifier;
 			added->m_headerBlocksize  = entity->m_headerBlocksize;
@@ -283,6 +292,8 @@ NTSTATUS CFilterEntityCont::AddRaw(CFilterEntity *entity)
 
 		Arrange();
 
+		Changed();
+
 		DBGPRINT(("EntityCont::AddRaw() new sizes[%d,%d]\n", m_size, m_capacity));
 	}
 
@@ -362,6 +373,8 @@ NTSTATUS CFilterEntityCont::RemoveRaw(ULONG pos, bool release)
 		
 	m_size--;
 
+	Changed();
+
 	// Close gap, if any
 	if(pos < m_size)
 	{
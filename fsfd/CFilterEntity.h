@@ -62,9 +62,15 @@ public:
 	CFilterEntity*			GetFromPosition(ULONG pos) const;
 	CFilterEntity*			GetFromIdentifier(ULONG identifier, ULONG *pos = 0) const;
 
+								// STATIC
+	static ULONG			Generation();
+	static void				Changed();
+
 private:
 	void					Arrange();
 
+	static LONG volatile	s_generation;	// changed with any Entity of any container
+
 							// DATA
 	CFilterEntity*			m_entities;
 	ULONG					m_size;
@@ -99,5 +105,18 @@ CFilterEntity* CFilterEntityCont::GetFromPosition(ULONG pos) const
 	return m_entities + pos;
 }
 
+inline
+ULONG CFilterEntityCont::Generation()
+{
+	return (ULONG) s_generation;
+}
+
+inline
+void CFilterEntityCont::Changed()
+{
+	// Voids cursors of paged enumerations
+	InterlockedIncrement((LONG*) &s_generation);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #endif // AFX_CFILTERENTITY_H__79614BBC_7357_4922_9A59_CA05B3CF7200__INCLUDED_
\ No newline at end of file
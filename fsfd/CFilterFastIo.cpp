@@ -190,18 +190,21 @@ BOOLEAN CFilterFastIo::Read(FILE_OBJECT*	file,
 			ASSERT(offset);
 			ASSERT(ioStatus);
 
-			CFilterContextLink link;
-			RtlZeroMemory(&link, sizeof(link));
+			CFilterStream *stream = 0;
 
-			int const state = extension->Volume.CheckFileCooked(file, &link);
+			int const state = extension->Volume.ReferenceStream(file, &stream);
 
 			if(!state)
 			{
 				return fastIoDispatch->FastIoRead(file, offset, length, wait, lock, buffer, ioStatus, lower);
 			}
 
-			// be paranoid
-			link.m_fileKey.Clear();
+			ASSERT(stream);
+
+			// Take what is needed in place, without copying the FileKey
+			ULONG const headerBlockSize = stream->m_link.m_headerBlockSize;
+
+			stream->Release();
 
 			if(file->Flags & FO_REMOTE_ORIGIN)
 			{
@@ -236,7 +239,7 @@ BOOLEAN CFilterFastIo::Read(FILE_OBJECT*	file,
 				return false;
 			}
 
-			LONGLONG const cookedFileSize = fcb->FileSize.QuadPart - (link.m_headerBlockSize + CFilterContext::c_tail);
+			LONGLONG const cookedFileSize = fcb->FileSize.QuadPart - (headerBlockSize + CFilterContext::c_tail);
 
  			ExReleaseResourceLite(fcb->Resource);
 			FsRtlExitFileSystem();
@@ -307,10 +310,9 @@ BOOLEAN CFilterFastIo::Write(FILE_OBJECT*		file,
 				ASSERT(offset);
 				ASSERT(ioStatus);
 
-				CFilterContextLink link;
-				RtlZeroMemory(&link, sizeof(link));
+				CFilterStream *stream = 0;
 
-				int const state = extension->Volume.CheckFileCooked(file, &link);
+				int const state = extension->Volume.ReferenceStream(file, &stream);
 
 				// file of interest ?
 				if(!state)
@@ -318,8 +320,12 @@ BOOLEAN CFilterFastIo::Write(FILE_OBJECT*		file,
 					return fastIoDispatch->FastIoWrite(file, offset, length, wait, lock, buffer, ioStatus, lower);
 				}
 
-				// be paranoid
-				link.m_fileKey.Clear();
+				ASSERT(stream);
+
+				// Take what is needed in place, without copying the FileKey
+				ULONG const headerBlockSize = stream->m_link.m_headerBlockSize;
+
+				stream->Release();
 
 				if(file->Flags & FO_REMOTE_ORIGIN)
 				{
@@ -354,7 +360,7 @@ BOOLEAN CFilterFastIo::Write(FILE_OBJECT*		file,
 					return false;
 				}
 				
-				LONGLONG const requestSize = offset->QuadPart + length + link.m_headerBlockSize + CFilterContext::c_tail;
+				LONGLONG const requestSize = offset->QuadPart + length + headerBlockSize + CFilterContext::c_tail;
 
 				bool const extendVDL = (requestSize > fcb->ValidDataLength.QuadPart);
 				bool const extendEOF = (requestSize > fcb->FileSize.QuadPart);
@@ -443,18 +449,18 @@ BOOLEAN CFilterFastIo::QueryStandard(FILE_OBJECT*				file,
 				ASSERT(file);
 				ASSERT(info);
 
-				CFilterContextLink link;
-				RtlZeroMemory(&link, sizeof(link));
+				CFilterStream *stream = 0;
 
-				if(extension->Volume.CheckFileCooked(file, &link))
+				if(extension->Volume.ReferenceStream(file, &stream))
 				{
-					// be paranoid
-					link.m_fileKey.Clear();
+					ASSERT(stream);
+
+					ULONG metaSize = stream->m_link.m_headerBlockSize;
+
+					stream->Release();
 
 					if( !(extension->Volume.m_context->Tracker().Check(file) & FILFILE_TRACKER_BYPASS))
 					{
-						ULONG metaSize = link.m_headerBlockSize;
-
 						// Only substract Tail if there is one
 						if(info->EndOfFile.QuadPart > metaSize)
 						{
@@ -520,18 +526,18 @@ BOOLEAN CFilterFastIo::QueryNetworkOpenInfo(FILE_OBJECT*				   file,
 
 				if( !(file->Flags & FO_REMOTE_ORIGIN))
 				{
-					CFilterContextLink link;
-					RtlZeroMemory(&link, sizeof(link));
+					CFilterStream *stream = 0;
 
-					if(extension->Volume.CheckFileCooked(file, &link))
+					if(extension->Volume.ReferenceStream(file, &stream))
 					{
-						// be paranoid
-						link.m_fileKey.Clear();
+						ASSERT(stream);
+
+						ULONG metaSize = stream->m_link.m_headerBlockSize;
+
+						stream->Release();
 
 						if( !(extension->Volume.m_context->Tracker().Check(file) & FILFILE_TRACKER_BYPASS))
 						{
-							ULONG metaSize = link.m_headerBlockSize;
-
 							// only substract Tail if there is one					
 							if(info->EndOfFile.QuadPart > metaSize)
 							{
@@ -10,12 +10,79 @@
 #include "driver.h"
 
 #include "CFilterBase.h"
+#include "CFilterEngine.h"
 #include "CFilterFile.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #pragma PAGEDCODE
 
+CFilterStream* CFilterStream::Create()
+{
+	PAGED_CODE();
+
+	CFilterStream *const stream = (CFilterStream*) ExAllocatePool(NonPagedPool, sizeof(CFilterStream));
+
+	if(stream)
+	{
+		RtlZeroMemory(stream, sizeof(CFilterStream));
+
+		// Reference of the tracker
+		stream->m_refCount = 1;
+		stream->m_tracked  = true;
+	}
+
+	return stream;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+void CFilterStream::Release()
+{
+	ASSERT(m_refCount > 0);
+
+	if(!InterlockedDecrement(&m_refCount))
+	{
+		ASSERT(!m_tracked);
+
+		m_link.m_fileKey.Clear();
+
+		if(m_cipher)
+		{
+			m_cipher->Release();
+		}
+
+		if(m_readAhead)
+		{
+			m_readAhead->Close();
+		}
+
+		ExFreePool(this);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+VOID CFilterStream::FreeCallback(PVOID context)
+{
+	ASSERT(context);
+
+	// The FSD tears down the FCB, drop its reference
+	CFilterStream *const stream = CONTAINING_RECORD(context, CFilterStream, m_context);
+
+	stream->Release();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
 NTSTATUS CFilterFile::Track(FILE_OBJECT *file)
 {
 	ASSERT(file);
@@ -100,7 +167,22 @@ NTSTATUS CFilterFile::Update(CFilterFile const* other)
 	m_hash		 = other->m_hash;
 	m_threadId	 = other->m_threadId;
 	m_tick		 = other->m_tick;
-	m_link		 = other->m_link;
+
+	ASSERT(m_stream && other->m_stream);
+	m_stream->m_link = other->m_stream->m_link;
+
+	// Cipher goes with the FileKey, requests in flight keep the old one
+	if(other->m_stream->m_cipher)
+	{
+		other->m_stream->m_cipher->Reference();
+	}
+
+	if(m_stream->m_cipher)
+	{
+		m_stream->m_cipher->Release();
+	}
+
+	m_stream->m_cipher = other->m_stream->m_cipher;
 
 	return STATUS_SUCCESS;
 }
@@ -230,6 +312,113 @@ bool CFilterFile::OnClose(FILE_OBJECT* file)
 	return false;
 }
 
+#pragma LOCKEDCODE
+
+bool CFilterFile::CanAttach(FILE_OBJECT const* file)
+{
+	ASSERT(file);
+
+	// Not available on W2K
+	if(!g_SfDynamicFunctions.InsertPerStreamContext || 
+	   !g_SfDynamicFunctions.LookupPerStreamContext || 
+	   !g_SfDynamicFunctions.RemovePerStreamContext)
+	{
+		return false;
+	}
+
+	return FsRtlSupportsPerStreamContexts(file) ? true : false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterFile::Attach(FILE_OBJECT *file, void *owner)
+{
+	ASSERT(file);
+	ASSERT(owner);
+
+	PAGED_CODE();
+
+	ASSERT(m_stream);
+	ASSERT(m_stream->m_tracked);
+
+	// Otherwise the tracker is searched
+	if(!CanAttach(file))
+	{
+		return STATUS_SUCCESS;
+	}
+
+	FSRTL_ADVANCED_FCB_HEADER *const fcb = FsRtlGetPerStreamContextPointer(file);
+	ASSERT(fcb);
+
+	for(;;)
+	{
+		FSRTL_PER_STREAM_CONTEXT *const attached = g_SfDynamicFunctions.LookupPerStreamContext(fcb, owner, 0);
+
+		if(!attached)
+		{
+			break;
+		}
+
+		if(attached == &m_stream->m_context)
+		{
+			return STATUS_SUCCESS;
+		}
+
+		// Left over from an earlier tracking of this FCB
+		FSRTL_PER_STREAM_CONTEXT *const removed = g_SfDynamicFunctions.RemovePerStreamContext(fcb, owner, 0);
+		ASSERT(removed == attached);
+
+		if(!removed)
+		{
+			break;
+		}
+
+		CONTAINING_RECORD(removed, CFilterStream, m_context)->Release();
+	}
+
+	FsRtlInitPerStreamContext(&m_stream->m_context, owner, 0, CFilterStream::FreeCallback);
+
+	// Reference of the FCB
+	m_stream->Reference();
+
+	NTSTATUS const status = g_SfDynamicFunctions.InsertPerStreamContext(fcb, &m_stream->m_context);
+
+	if(NT_ERROR(status))
+	{
+		m_stream->Release();
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+CFilterStream* CFilterFile::Attached(FILE_OBJECT const* file, void *owner)
+{
+	ASSERT(file);
+	ASSERT(owner);
+
+	ASSERT(CanAttach(file));
+
+	FSRTL_PER_STREAM_CONTEXT *const attached = g_SfDynamicFunctions.LookupPerStreamContext(FsRtlGetPerStreamContextPointer(file), owner, 0);
+
+	if(attached)
+	{
+		CFilterStream *const stream = CONTAINING_RECORD(attached, CFilterStream, m_context);
+
+		if(stream->m_tracked)
+		{
+			return stream;
+		}
+	}
+
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -243,6 +432,12 @@ NTSTATUS CFilterFileCont::Init()
 	m_files	   = 0;
 	m_size	   = 0;
 	m_capacity = 0;
+	m_holes	   = 0;
+
+	for(ULONG index = 0; index < c_entities; ++index)
+	{
+		InitializeListHead(m_entities + index);
+	}
 
 	// translate seconds to ticks
 	m_timeout = CFilterBase::GetTicksFromSeconds(c_timeout);
@@ -279,6 +474,14 @@ void CFilterFileCont::Close()
 
 	m_size	   = 0;
 	m_capacity = 0;
+	m_holes	   = 0;
+
+	for(ULONG index = 0; index < c_entities; ++index)
+	{
+		ASSERT(IsListEmpty(m_entities + index));
+
+		InitializeListHead(m_entities + index);
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -330,10 +533,13 @@ NTSTATUS CFilterFileCont::Add(CFilterFile *filterFile, ULONG pos)
 
 	m_size++;
 
+	Identify(pos, m_files[pos].m_stream->m_link.m_entityIdentifier);
+
 	// We took ownership
 	filterFile->m_files		= 0;
 	filterFile->m_size		= 0;
 	filterFile->m_capacity  = 0;
+	filterFile->m_stream	= 0;
 
 	return STATUS_SUCCESS;
 }
@@ -400,26 +606,162 @@ NTSTATUS CFilterFileCont::Remove(ULONG pos)
 
 #pragma PAGEDCODE
 
-bool CFilterFileCont::CheckIdentifier(ULONG identifier, ULONG *pos) const
+ULONG CFilterFileCont::Compact()
 {
-	ASSERT(identifier && (identifier != ~0u));
-
 	PAGED_CODE();
 
-	for(ULONG index = 0; index < m_size; ++index)
+	ASSERT(m_size <= m_capacity);
+
+	if(!m_holes)
+	{
+		return 0;
+	}
+
+	ASSERT(m_firstHole < m_size);
+
+	ULONG kept = m_firstHole;
+
+	// Close holes left by Discard, keeping the sort order. Entries in front of the first one stay
+	for(ULONG pos = m_firstHole + 1; pos < m_size; )
 	{
-		if(m_files[index].m_link.m_entityIdentifier == identifier)
+		if(!m_files[pos].m_fcb)
+		{
+			pos++;
+			continue;
+		}
+
+		// Move runs of entries at once
+		ULONG end = pos + 1;
+
+		while((end < m_size) && m_files[end].m_fcb)
+		{
+			end++;
+		}
+
+		RtlMoveMemory(m_files + kept, m_files + pos, (end - pos) * sizeof(CFilterFile));
+
+		kept += end - pos;
+		pos	  = end;
+	}
+
+	m_holes = 0;
+
+	ULONG const removed = m_size - kept;
+
+	if(removed)
+	{
+		RtlZeroMemory(m_files + kept, removed * sizeof(CFilterFile));
+
+		m_size = kept;
+
+		// Exceeded threshold of unused space?
+		if((m_capacity - m_size) > (c_incrementCount * 4))
 		{
-			if(pos)
+			ULONG const capacity = (m_size / c_incrementCount + 1) * c_incrementCount;
+
+			CFilterFile *const files = (CFilterFile*) ExAllocatePool(NonPagedPool, capacity * sizeof(CFilterFile));
+
+			if(files)
 			{
-				*pos = index;
+				RtlZeroMemory(files, capacity * sizeof(CFilterFile));
+
+				m_capacity = capacity;
+
+				if(m_size)
+				{
+					RtlCopyMemory(files, m_files, m_size * sizeof(CFilterFile));
+				}
+
+				ExFreePool(m_files);
+
+				m_files = files;
 			}
+		}
+	}
 
-			return true;
+	return removed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+bool CFilterFileCont::CheckIdentifier(ULONG identifier, ULONG *pos) const
+{
+	ASSERT(identifier && (identifier != ~0u));
+
+	PAGED_CODE();
+
+	CFilterStream *const stream = Next(identifier);
+
+	if(!stream)
+	{
+		return false;
+	}
+
+	if(pos)
+	{
+		*pos = Slot(stream);
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterFileCont::Identify(ULONG pos, ULONG identifier)
+{
+	ASSERT(pos < m_size);
+	ASSERT(m_files[pos].m_fcb);
+
+	PAGED_CODE();
+
+	CFilterStream *const stream = m_files[pos].m_stream;
+	ASSERT(stream);
+
+	if(stream->m_entity.Flink)
+	{
+		RemoveEntryList(&stream->m_entity);
+		stream->m_entity.Flink = 0;
+	}
+
+	stream->m_link.m_entityIdentifier = identifier;
+	stream->m_fcb					  = m_files[pos].m_fcb;
+
+	// Doomed ones are never looked up
+	if(identifier != ~0u)
+	{
+		InsertTailList(Entities(identifier), &stream->m_entity);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+CFilterStream* CFilterFileCont::Next(ULONG identifier, CFilterStream *stream) const
+{
+	PAGED_CODE();
+
+	LIST_ENTRY *const head = Entities(identifier);
+
+	LIST_ENTRY *entry = (stream) ? stream->m_entity.Flink : head->Flink;
+	ASSERT(entry);
+
+	// Others may share the list
+	for(; entry != head; entry = entry->Flink)
+	{
+		CFilterStream *const found = CONTAINING_RECORD(entry, CFilterStream, m_entity);
+
+		if(found->m_link.m_entityIdentifier == identifier)
+		{
+			return found;
 		}
 	}
 
-	return false;
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -498,6 +840,27 @@ bool CFilterFileCont::Check(FILE_OBJECT *file, ULONG *pos) const
 	}
 	#endif
 
+	ULONG found = 0;
+
+	bool const exists = Search(file->FsContext, &found);
+
+	if(pos)
+	{
+		*pos = found;
+	}
+
+	return exists;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+bool CFilterFileCont::Search(void const* fcb, ULONG *pos) const
+{
+	ASSERT(fcb);
+	ASSERT(pos);
+
 	ULONG left  = 0;
 	ULONG right = m_size;
 
@@ -506,20 +869,31 @@ bool CFilterFileCont::Check(FILE_OBJECT *file, ULONG *pos) const
 	{
 		ULONG const middle = left + (right - left) / 2;
 
-		if(file->FsContext == m_files[middle].m_fcb)
+		// Step over holes left by Discard
+		ULONG probe = middle;
+
+		while((probe < right) && !m_files[probe].m_fcb)
 		{
-			if(pos)
-			{
-				*pos = middle;
-			}
+			probe++;
+		}
+
+		if(probe == right)
+		{
+			right = middle;
+			continue;
+		}
+
+		if(fcb == m_files[probe].m_fcb)
+		{
+			*pos = probe;
 
 			return true;
 		}
 
-		if(file->FsContext > m_files[middle].m_fcb)
+		if(fcb > m_files[probe].m_fcb)
 		{
 			// search right side
-			left = middle + 1;
+			left = probe + 1;
 		}
 		else
 		{
@@ -528,10 +902,7 @@ bool CFilterFileCont::Check(FILE_OBJECT *file, ULONG *pos) const
 		}
 	}
 
-	if(pos)
-	{
-		*pos = left;
-	}
+	*pos = left;
 
 	return false;
 }
@@ -540,3 +911,537 @@ bool CFilterFileCont::Check(FILE_OBJECT *file, ULONG *pos) const
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "CSimFixture.h"
+
+/*
+ * Lifetime of the stream context: the tracker and the FCB attachment hold one reference each, I/O paths
+ * a temporary one. Whichever lets go last frees it. Once the tracker has let go, the FileKey is wiped and
+ * lookups through the FCB no longer find it, a stale attachment is replaced by the next tracking of the
+ * FCB. FSDs without filter contexts leave the tracker as the only owner.
+ *
+ * The cipher of the FileKey codes as a private expansion of it does, for every mode and key size the
+ * layout takes. Requests keep the cipher they referenced while Update and Close replace or drop it. The
+ * cost per 4K request of both ways is printed per mode.
+ *
+ * The stress test then looks up and references streams and their ciphers on several threads, coding
+ * through them, while another one closes, retracks, purges and tears down their FCBs. As in the driver,
+ * lookups and changes of one FCB are serialized by the tracker lock, a pthread rwlock here, and the
+ * references are used after it has been dropped.
+ */
+enum
+{
+	c_testBlock	  = 512,
+	c_testFcbs	  = 4,
+	c_testReaders = 4,
+	c_testRounds  = 5000,
+	c_testRequest = 4096,
+	c_testCodes	  = 2000,
+};
+
+static int s_testOwner;
+
+static bool TestTrack(CFilterFile *filterFile, FILE_OBJECT *file, ULONG seed)
+{
+	return CSimFixture::Track(filterFile, file, 1 + seed % 7, seed) && NT_SUCCESS(filterFile->Attach(file, &s_testOwner));
+}
+
+static bool TestWiped(CFilterStream const* stream)
+{
+	for(ULONG pos = 0; pos < sizeof(stream->m_link.m_fileKey.m_key); ++pos)
+	{
+		if(stream->m_link.m_fileKey.m_key[pos])
+		{
+			return false;
+		}
+	}
+
+	return !stream->m_tracked && !stream->m_link.m_nonce.QuadPart && !stream->m_cipher;
+}
+
+// Codes through the cipher and through a private copy of its key, both must agree and round trip
+static int TestCipherMode(ULONG mode, ULONG sym, ULONG keySize)
+{
+	UCHAR key[32];
+	CSimFixture::Pattern(key, sizeof(key), mode + keySize);
+
+	FILFILE_CRYPT_CONTEXT crypt;
+	RtlZeroMemory(&crypt, sizeof(crypt));
+
+	crypt.Nonce.QuadPart = 0x1234567 + mode;
+	crypt.Key.Init(sym | (mode << 16), key, keySize);
+
+	CFilterCipher *const cipher = CFilterCipher::Create(&crypt.Key, &crypt.Nonce);
+
+	UCHAR *const plain	 = (UCHAR*) malloc(c_testRequest);
+	UCHAR *const privy	 = (UCHAR*) malloc(c_testRequest);
+	UCHAR *const through = (UCHAR*) malloc(c_testRequest);
+
+	CSimFixture::Pattern(plain, c_testRequest, mode);
+
+	int failed = 0;
+
+	for(LONGLONG offset = 0; offset < 4 * c_testRequest; offset += c_testRequest)
+	{
+		memcpy(privy, plain, c_testRequest);
+		memcpy(through, plain, c_testRequest);
+
+		crypt.Offset.QuadPart = offset;
+		CFilterContext::Encode(privy, c_testRequest, &crypt);
+
+		LARGE_INTEGER at;
+		at.QuadPart = offset;
+
+		cipher->Encode(through, c_testRequest, &at);
+
+		bool const same = !memcmp(privy, through, c_testRequest);
+
+		cipher->Decode(through, c_testRequest, &at);
+
+		if(!same || memcmp(through, plain, c_testRequest) || !memcmp(privy, plain, c_testRequest))
+		{
+			printf("ERROR ON CIPHER mode[%u] key[%u] offset[0x%llx]\n", mode, keySize, offset);
+			failed++;
+			break;
+		}
+	}
+
+	// Cost per request of the I/O paths before and now
+	double start = CSimFixture::Now();
+
+	for(ULONG index = 0; index < c_testCodes; ++index)
+	{
+		crypt.Offset.QuadPart = (LONGLONG) index * c_testRequest;
+		CFilterContext::Decode(privy, c_testRequest, &crypt);
+	}
+
+	double const before = (CSimFixture::Now() - start) / 1e3;
+
+	start = CSimFixture::Now();
+
+	for(ULONG index = 0; index < c_testCodes; ++index)
+	{
+		LARGE_INTEGER at;
+		at.QuadPart = (LONGLONG) index * c_testRequest;
+
+		cipher->Decode(through, c_testRequest, &at);
+	}
+
+	double const now = (CSimFixture::Now() - start) / 1e3;
+
+	printf("%4u  %3u  %16.2f  %14.2f\n", mode, keySize * 8, before / c_testCodes, now / c_testCodes);
+
+	crypt.Key.Clear();
+	cipher->Release();
+
+	free(through);
+	free(privy);
+	free(plain);
+
+	return failed;
+}
+
+static int TestCipher()
+{
+	int failed = 0;
+
+	printf("mode  key  private[us/4K]  cipher[us/4K]\n");
+
+	ULONG const modes[] = { FILFILE_CIPHER_MODE_CTR, FILFILE_CIPHER_MODE_CFB, FILFILE_CIPHER_MODE_EME, FILFILE_CIPHER_MODE_EME_2, FILFILE_CIPHER_MODE_XTS };
+
+	for(ULONG index = 0; index < sizeof(modes) / sizeof(modes[0]); ++index)
+	{
+		if(!CFilterContext::IsCipherModeSupported(modes[index]))
+		{
+			continue;
+		}
+
+		failed += TestCipherMode(modes[index], FILFILE_CIPHER_SYM_AES128, 16);
+		failed += TestCipherMode(modes[index], FILFILE_CIPHER_SYM_AES256, 32);
+	}
+
+	return failed;
+}
+
+struct TestStress
+{
+	FSRTL_ADVANCED_FCB_HEADER	m_fcbs[c_testFcbs];
+	FILE_OBJECT					m_files[c_testFcbs];
+	CFilterFile					m_trackers[c_testFcbs];
+	pthread_rwlock_t			m_locks[c_testFcbs];
+
+	LONG volatile				m_done;
+	LONG volatile				m_hits;
+	LONG volatile				m_errors;
+};
+
+static void* TestReader(void *context)
+{
+	TestStress *const stress = (TestStress*) context;
+
+	unsigned int seed = (unsigned int) (ULONG_PTR) &seed;
+
+	while(!stress->m_done)
+	{
+		ULONG const index = (ULONG) rand_r(&seed) % c_testFcbs;
+
+		pthread_rwlock_rdlock(stress->m_locks + index);
+
+		CFilterStream *const stream = CFilterFile::Attached(stress->m_files + index, &s_testOwner);
+		CFilterCipher *cipher		= 0;
+
+		if(stream)
+		{
+			stream->Reference();
+
+			cipher = stream->m_cipher;
+
+			if(cipher)
+			{
+				cipher->Reference();
+			}
+		}
+
+		pthread_rwlock_unlock(stress->m_locks + index);
+
+		if(stream)
+		{
+			// In place, without the lock
+			if((stream->m_refCount < 1) || (stream->m_link.m_headerBlockSize != CFilterHeader::c_align))
+			{
+				InterlockedIncrement(&stress->m_errors);
+			}
+
+			InterlockedIncrement(&stress->m_hits);
+
+			stream->Release();
+		}
+
+		if(cipher)
+		{
+			// Shared with the other readers, whoever finds it busy codes privately
+			UCHAR buffer[c_testBlock];
+			CSimFixture::Pattern(buffer, sizeof(buffer), index);
+
+			LARGE_INTEGER offset;
+			offset.QuadPart = (LONGLONG) (rand_r(&seed) % 64) * c_testBlock;
+
+			cipher->Encode(buffer, sizeof(buffer), &offset);
+			cipher->Decode(buffer, sizeof(buffer), &offset);
+
+			UCHAR expected[c_testBlock];
+			CSimFixture::Pattern(expected, sizeof(expected), index);
+
+			if(memcmp(buffer, expected, sizeof(buffer)))
+			{
+				InterlockedIncrement(&stress->m_errors);
+			}
+
+			cipher->Release();
+		}
+	}
+
+	return 0;
+}
+
+static int TestStressRun()
+{
+	TestStress *const stress = (TestStress*) calloc(1, sizeof(TestStress));
+
+	int failed = 0;
+
+	for(ULONG index = 0; index < c_testFcbs; ++index)
+	{
+		CSimFixture::Fcb(stress->m_fcbs + index);
+		stress->m_files[index].FsContext = stress->m_fcbs + index;
+
+		pthread_rwlock_init(stress->m_locks + index, 0);
+
+		if(!TestTrack(stress->m_trackers + index, stress->m_files + index, index))
+		{
+			failed++;
+		}
+	}
+
+	pthread_t readers[c_testReaders];
+
+	for(ULONG reader = 0; reader < c_testReaders; ++reader)
+	{
+		pthread_create(readers + reader, 0, TestReader, stress);
+	}
+
+	unsigned int seed = 1;
+
+	for(ULONG round = 0; round < c_testRounds; ++round)
+	{
+		ULONG const random = (ULONG) rand_r(&seed);
+		ULONG const index  = random % c_testFcbs;
+
+		CFilterFile *const tracker = stress->m_trackers + index;
+
+		pthread_rwlock_wrlock(stress->m_locks + index);
+
+		switch((random >> 8) % 3)
+		{
+		case 0:
+			// Last close, the FCB is tracked again by the next create
+			tracker->Close();
+
+			if(!TestTrack(tracker, stress->m_files + index, round))
+			{
+				failed++;
+			}
+			break;
+
+		case 1:
+			// Purge dooms it in place
+			tracker->m_stream->m_link.m_fileKey.Clear();
+			tracker->m_stream->m_link.m_nonce.QuadPart = 0;
+			tracker->m_stream->m_link.m_entityIdentifier = ~0u;
+
+			if(tracker->m_stream->m_cipher)
+			{
+				tracker->m_stream->m_cipher->Release();
+				tracker->m_stream->m_cipher = 0;
+			}
+			break;
+
+		default:
+			// FSD tears down the FCB, a new one is tracked by the next create
+			FsRtlTeardownPerStreamContexts(stress->m_fcbs + index);
+
+			if(NT_ERROR(tracker->Attach(stress->m_files + index, &s_testOwner)))
+			{
+				failed++;
+			}
+			break;
+		}
+
+		pthread_rwlock_unlock(stress->m_locks + index);
+
+		if(!(round % 64))
+		{
+			sched_yield();
+		}
+	}
+
+	InterlockedExchange(&stress->m_done, 1);
+
+	for(ULONG reader = 0; reader < c_testReaders; ++reader)
+	{
+		pthread_join(readers[reader], 0);
+	}
+
+	for(ULONG index = 0; index < c_testFcbs; ++index)
+	{
+		stress->m_trackers[index].Close();
+		FsRtlTeardownPerStreamContexts(stress->m_fcbs + index);
+
+		pthread_rwlock_destroy(stress->m_locks + index);
+	}
+
+	if(stress->m_errors || !stress->m_hits)
+	{
+		printf("stress: %d of %d references broken\n", stress->m_errors, stress->m_hits);
+		failed++;
+	}
+
+	free(stress);
+
+	return failed;
+}
+
+int main(void)
+{
+	CSimFixture::Init();
+
+	int failed = 0;
+
+	LONG const outstanding = CSimKernel::Statistics().Outstanding;
+
+	FSRTL_ADVANCED_FCB_HEADER fcb;
+	CSimFixture::Fcb(&fcb);
+
+	FILE_OBJECT file;
+	RtlZeroMemory(&file, sizeof(file));
+	file.FsContext = &fcb;
+
+	// Tracker and FCB hold one reference each, attaching twice takes no second one
+	CFilterFile tracker;
+
+	if(!TestTrack(&tracker, &file, 1) || (2 != tracker.m_stream->m_refCount) ||
+	   (CFilterFile::Attached(&file, &s_testOwner) != tracker.m_stream) ||
+	   NT_ERROR(tracker.Attach(&file, &s_testOwner)) || (2 != tracker.m_stream->m_refCount))
+	{
+		printf("ERROR ON ATTACH\n");
+		failed++;
+	}
+
+	// Other owners see nothing
+	int other = 0;
+
+	if(CFilterFile::Attached(&file, &other))
+	{
+		printf("ERROR ON OWNER\n");
+		failed++;
+	}
+
+	// Tracker lets go: wiped, no longer found, freed with the FCB
+	CFilterStream *stream = tracker.m_stream;
+	tracker.Close();
+
+	if(!TestWiped(stream) || (1 != stream->m_refCount) || CFilterFile::Attached(&file, &s_testOwner))
+	{
+		printf("ERROR ON UNTRACK\n");
+		failed++;
+	}
+
+	FsRtlTeardownPerStreamContexts(&fcb);
+
+	if(outstanding != CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON TEARDOWN\n");
+		failed++;
+	}
+
+	// A reference of an I/O path outlives tracker and FCB
+	CSimFixture::Fcb(&fcb);
+	TestTrack(&tracker, &file, 2);
+
+	stream = CFilterFile::Attached(&file, &s_testOwner);
+
+	if(stream)
+	{
+		stream->Reference();
+
+		tracker.Close();
+		FsRtlTeardownPerStreamContexts(&fcb);
+
+		if((1 != stream->m_refCount) || (CFilterHeader::c_align != stream->m_link.m_headerBlockSize) || !TestWiped(stream))
+		{
+			printf("ERROR ON REFERENCE\n");
+			failed++;
+		}
+
+		stream->Release();
+	}
+
+	if(!stream || (outstanding != CSimKernel::Statistics().Outstanding))
+	{
+		printf("ERROR ON RELEASE\n");
+		failed++;
+	}
+
+	// The next tracking of the FCB replaces a stale attachment, only its FO array and cipher remain
+	CSimFixture::Fcb(&fcb);
+	TestTrack(&tracker, &file, 3);
+	tracker.Close();
+
+	LONG const stale = CSimKernel::Statistics().Outstanding;
+
+	CFilterFile next;
+
+	if(!TestTrack(&next, &file, 4) || (CFilterFile::Attached(&file, &s_testOwner) != next.m_stream) ||
+	   (2 != next.m_stream->m_refCount) || (stale + 2 != CSimKernel::Statistics().Outstanding))
+	{
+		printf("ERROR ON REPLACE\n");
+		failed++;
+	}
+
+	// Torn down while tracked, the tracker keeps it
+	FsRtlTeardownPerStreamContexts(&fcb);
+
+	if((1 != next.m_stream->m_refCount) || !next.m_stream->m_tracked || CFilterFile::Attached(&file, &s_testOwner))
+	{
+		printf("ERROR ON EARLY TEARDOWN\n");
+		failed++;
+	}
+
+	next.Close();
+
+	// Without filter contexts the tracker is the only owner
+	CSimFixture::Fcb(&fcb, false);
+
+	if(CFilterFile::CanAttach(&file) || !TestTrack(&tracker, &file, 5) || (1 != tracker.m_stream->m_refCount))
+	{
+		printf("ERROR ON NO CONTEXTS\n");
+		failed++;
+	}
+
+	tracker.Close();
+
+	if(outstanding != CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimKernel::Statistics().Outstanding - outstanding);
+		failed++;
+	}
+
+	// A request keeps the cipher it referenced, Update hands the stream the new FileKey's one
+	CSimFixture::Fcb(&fcb);
+	TestTrack(&tracker, &file, 6);
+
+	CFilterCipher *const held = tracker.m_stream->m_cipher;
+	held->Reference();
+
+	CFilterFile reopened;
+	TestTrack(&reopened, &file, 7);
+
+	if(NT_ERROR(tracker.Update(&reopened)) || (tracker.m_stream->m_cipher != reopened.m_stream->m_cipher) || (tracker.m_stream->m_cipher == held))
+	{
+		printf("ERROR ON UPDATE\n");
+		failed++;
+	}
+
+	reopened.Close();
+	tracker.Close();
+	FsRtlTeardownPerStreamContexts(&fcb);
+
+	UCHAR buffer[c_testBlock];
+	CSimFixture::Pattern(buffer, sizeof(buffer), 0);
+
+	LARGE_INTEGER offset;
+	offset.QuadPart = 0;
+
+	if(!NT_SUCCESS(held->Encode(buffer, sizeof(buffer), &offset)) || !NT_SUCCESS(held->Decode(buffer, sizeof(buffer), &offset)))
+	{
+		printf("ERROR ON HELD CIPHER\n");
+		failed++;
+	}
+
+	held->Release();
+
+	if(outstanding != CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON CIPHER LEAK [%d]\n", CSimKernel::Statistics().Outstanding - outstanding);
+		failed++;
+	}
+
+	failed += TestCipher();
+
+	// Concurrent I/O, close, purge and teardown
+	if(TestStressRun())
+	{
+		printf("ERROR ON STRESS\n");
+		failed++;
+	}
+
+	if(outstanding != CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON STRESS LEAK [%d]\n", CSimKernel::Statistics().Outstanding - outstanding);
+		failed++;
+	}
+
+	failed += CSimFixture::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
@@ -13,6 +13,9 @@
 #pragma once
 #endif // _MSC_VER > 1000
 
+#include "CFilterCipher.h"
+#include "CFilterReadAhead.h"
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct CFilterContextLink 
@@ -28,6 +31,38 @@ struct CFilterContextLink
 
 ////////////////////////////////
 
+struct CFilterStream
+{
+	// Refcounted holder of the link of a tracked data stream. It is owned by the CFilterFile tracking the
+	// FCB and, if the FSD supports filter contexts, also attached to the FCB, so that I/O paths find it
+	// without searching the tracker. FileKey and Nonce may only be read under the tracker lock, the other
+	// values may be used in place by holders of a reference. I/O paths do not copy the FileKey, they take
+	// a reference on its cipher under the same lock. While tracked, it is also linked into the Entity index
+	// of its tracker's container, under that lock too.
+
+	static CFilterStream*		Create();
+
+	void						Reference();
+	void						Release();
+
+	static VOID					FreeCallback(PVOID context);
+
+								// DATA
+	FSRTL_PER_STREAM_CONTEXT	m_context;			// FCB attachment, must be first
+	LONG volatile				m_refCount;
+	bool						m_tracked;			// cleared when the tracker lets go
+
+	CFilterContextLink			m_link;
+	CFilterCipher*				m_cipher;			// of m_link's FileKey, replaced along with it
+
+	CFilterReadAhead*			m_readAhead;		// created on first non-cached read, if enabled
+
+	LIST_ENTRY					m_entity;			// in the Entity index, if linked
+	FSRTL_COMMON_FCB_HEADER*	m_fcb;				// of the tracker, to find its slot from the index
+};
+
+////////////////////////////////
+
 class CFilterFile 
 {
 	enum c_constants			{ c_incrementCount = 4 };
@@ -43,6 +78,11 @@ public:
 	NTSTATUS					Update(CFilterFile const* other);
 	NTSTATUS					Track(FILE_OBJECT *file);
 	FILE_OBJECT*				Tracked();
+
+	NTSTATUS					Attach(FILE_OBJECT *file, void *owner);
+
+	static bool					CanAttach(FILE_OBJECT const* file);
+	static CFilterStream*		Attached(FILE_OBJECT const* file, void *owner);
 	
 								// DATA
 	FSRTL_COMMON_FCB_HEADER*	m_fcb;
@@ -57,17 +97,29 @@ public:
 	HANDLE						m_threadId;			// thread id at last open
 	ULONG						m_tick;				// tick at last open
     
-	CFilterContextLink			m_link;
+	CFilterStream*				m_stream;
 };
 
 /////////////////////////////////////////////////////////////////////
 
+inline
+void CFilterStream::Reference()
+{
+	ASSERT(m_refCount > 0);
+
+	InterlockedIncrement(&m_refCount);
+}
+
+/////////////////////////////////////////////////////////////////////
+
 inline
 NTSTATUS CFilterFile::Init()
 {
 	RtlZeroMemory(this, sizeof(*this));
 
-	return STATUS_SUCCESS;
+	m_stream = CFilterStream::Create();
+
+	return (m_stream) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
 }
 
 inline
@@ -78,6 +130,36 @@ void CFilterFile::Close()
 		ExFreePool(m_files);
 		m_files = 0;
 	}
+
+	if(m_stream)
+	{
+		if(m_stream->m_entity.Flink)
+		{
+			RemoveEntryList(&m_stream->m_entity);
+			m_stream->m_entity.Flink = 0;
+		}
+
+		// A copy still attached to the FCB is ignored from now on and goes with it
+		m_stream->m_tracked = false;
+		m_stream->m_link.m_fileKey.Clear();
+		m_stream->m_link.m_nonce.QuadPart = 0;
+
+		if(m_stream->m_cipher)
+		{
+			// Requests in flight keep theirs
+			m_stream->m_cipher->Release();
+			m_stream->m_cipher = 0;
+		}
+
+		if(m_stream->m_readAhead)
+		{
+			// Wipe decrypted data now, not with the FCB
+			m_stream->m_readAhead->Invalidate();
+		}
+
+		m_stream->Release();
+		m_stream = 0;
+	}
 }
 
 inline
@@ -100,8 +182,13 @@ FILE_OBJECT* CFilterFile::Tracked()
 
 class CFilterFileCont
 {
+	// Tracked streams sorted by FCB. Their Entity identifiers are indexed as well, in lists of streams
+	// hashed by identifier, so that Entity wide operations visit only the streams of that Entity. Doomed
+	// streams are not indexed. Identifiers of tracked streams are changed with Identify only.
+
 	enum c_constants			{	c_incrementCount = 16,
 									c_timeout		 = 30,	// seconds
+									c_entities		 = 32,	// index lists, power of two
 								};
 public:
 
@@ -115,16 +202,32 @@ public:
 	NTSTATUS					Add(CFilterFile *file, ULONG pos);
 	NTSTATUS					Update(CFilterFile const* file, ULONG pos);
 	NTSTATUS					Remove(ULONG pos);
+	void						Discard(ULONG pos);
+	ULONG						Compact();
+
+	void						Identify(ULONG pos, ULONG identifier);
+
+								// Tracked streams of an Entity, and where their trackers are
+	CFilterStream*				Next(ULONG identifier, CFilterStream *stream = 0) const;
+	ULONG						Slot(CFilterStream const* stream) const;
 
 	CFilterFile*				Get(ULONG pos) const;
 	ULONG						Size() const;
 
 private:
 
+	bool						Search(void const* fcb, ULONG *pos) const;
+
+	LIST_ENTRY*					Entities(ULONG identifier) const;
+
 	CFilterFile*				m_files;
 	ULONG						m_size;
 	ULONG						m_capacity;
 	ULONG						m_timeout;		// ticks
+	ULONG						m_holes;		// left by Discard
+	ULONG						m_firstHole;
+
+	LIST_ENTRY					m_entities[c_entities];
 };
 
 /////////////////////////////////////////////////////////////////////
@@ -155,6 +258,23 @@ ULONG CFilterFileCont::Size() const
 	return m_size;
 }
 
+inline
+void CFilterFileCont::Discard(ULONG pos)
+{
+	ASSERT(pos < m_size);
+	ASSERT(m_files);
+
+	// Leave a hole, Compact removes all of them in one go
+	m_files[pos].Close();
+
+	RtlZeroMemory(m_files + pos, sizeof(CFilterFile));
+
+	if(!m_holes++ || (pos < m_firstHole))
+	{
+		m_firstHole = pos;
+	}
+}
+
 inline
 NTSTATUS CFilterFileCont::Update(CFilterFile const* file, ULONG pos)
 {
@@ -162,7 +282,36 @@ NTSTATUS CFilterFileCont::Update(CFilterFile const* file, ULONG pos)
 	ASSERT(pos < m_size);
 	ASSERT(m_files);
 
-	return m_files[pos].Update(file);
+	NTSTATUS const status = m_files[pos].Update(file);
+
+	// The link was overwritten
+	Identify(pos, m_files[pos].m_stream->m_link.m_entityIdentifier);
+
+	return status;
+}
+
+inline
+LIST_ENTRY* CFilterFileCont::Entities(ULONG identifier) const
+{
+	return (LIST_ENTRY*) (m_entities + (identifier & (c_entities - 1)));
+}
+
+inline
+ULONG CFilterFileCont::Slot(CFilterStream const* stream) const
+{
+	ASSERT(stream);
+	ASSERT(stream->m_entity.Flink);
+
+	ULONG pos = ~0u;
+
+	if(!Search(stream->m_fcb, &pos))
+	{
+		ASSERT(false);
+
+		return ~0u;
+	}
+
+	return pos;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
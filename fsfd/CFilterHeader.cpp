@@ -117,8 +117,8 @@ bool CFilterHeader::Equal(CFilterHeader const *header) const
 			{
 				if(!RtlEqualMemory(m_payload, header->m_payload, m_payloadSize))
 				{
-					// crc collision, just want to know
-					ASSERT(false);	
+					// crc collision, the container's index expects them
+					DBGPRINT(("Header::Equal() crc collision[0x%x]\n", m_payloadCrc));
 
 					return false;
 				}
@@ -142,10 +142,12 @@ NTSTATUS CFilterHeaderCont::Init()
 	PAGED_CODE();
 
 	m_headers	= 0;
+	m_slots		= 0;
+	m_buckets	= 0;
 	m_size		= 0;
+	m_used		= 0;
 	m_capacity	= 0;
-
-	m_nextIdentifier = c_identifierType;
+	m_free		= 0;
 
 	return ExInitializeResourceLite(&m_resource);
 }
@@ -162,7 +164,8 @@ void CFilterHeaderCont::Close()
 	{
 		ExAcquireResourceExclusiveLite(&m_resource, true);
 
-		for(ULONG pos = 0; pos < m_size; ++pos)
+		// unused slots are zeroed
+		for(ULONG pos = 0; pos < m_used; ++pos)
 		{
 			m_headers[pos].Close();
 		}
@@ -170,11 +173,19 @@ void CFilterHeaderCont::Close()
 		ExFreePool(m_headers);
 		m_headers = 0;
 
+		ExFreePool(m_slots);
+		m_slots = 0;
+
+		ExFreePool(m_buckets);
+		m_buckets = 0;
+
 		ExReleaseResourceLite(&m_resource);
 	}
 	
 	m_size		= 0;
+	m_used		= 0;
 	m_capacity	= 0;
+	m_free		= 0;
 
 	ExDeleteResourceLite(&m_resource);
 }
@@ -183,6 +194,91 @@ void CFilterHeaderCont::Close()
 
 #pragma PAGEDCODE
 
+NTSTATUS CFilterHeaderCont::Grow()
+{
+	PAGED_CODE();
+
+	ASSERT(m_used == m_capacity);
+
+	ULONG const capacity = (m_capacity) ? 2 * m_capacity : c_incrementCount;
+
+	if(capacity > c_slotsMax)
+	{
+		DBGPRINT(("HeaderCont::Grow() -ERROR: out of slots\n"));
+
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	CFilterHeader	  *const headers = (CFilterHeader*) ExAllocatePool(NonPagedPool, capacity * sizeof(CFilterHeader));
+	CFilterHeaderSlot *const slots	 = (CFilterHeaderSlot*) ExAllocatePool(PagedPool, capacity * sizeof(CFilterHeaderSlot));
+	ULONG			  *const buckets = (ULONG*) ExAllocatePool(PagedPool, capacity * sizeof(ULONG));
+
+	if(!headers || !slots || !buckets)
+	{
+		if(headers)
+		{
+			ExFreePool(headers);
+		}
+		if(slots)
+		{
+			ExFreePool(slots);
+		}
+		if(buckets)
+		{
+			ExFreePool(buckets);
+		}
+
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlZeroMemory(headers, capacity * sizeof(CFilterHeader));
+	RtlZeroMemory(slots,   capacity * sizeof(CFilterHeaderSlot));
+	RtlZeroMemory(buckets, capacity * sizeof(ULONG));
+
+	if(m_used)
+	{
+		ASSERT(m_headers);
+		ASSERT(m_slots);
+		ASSERT(m_buckets);
+
+		RtlCopyMemory(headers, m_headers, m_used * sizeof(CFilterHeader));
+		RtlZeroMemory(m_headers, m_used * sizeof(CFilterHeader));
+
+		RtlCopyMemory(slots, m_slots, m_used * sizeof(CFilterHeaderSlot));
+	}
+
+	if(m_headers)
+	{
+		ExFreePool(m_headers);
+		ExFreePool(m_slots);
+		ExFreePool(m_buckets);
+	}
+
+	m_headers  = headers;
+	m_slots	   = slots;
+	m_buckets  = buckets;
+	m_capacity = capacity;
+
+	// Rebuild index, all slots are in use
+	for(ULONG pos = 0; pos < m_used; ++pos)
+	{
+		ASSERT(m_headers[pos].m_identifier);
+
+		ULONG *const bucket = Bucket(m_headers[pos].m_payloadCrc);
+
+		m_slots[pos].m_next = *bucket;
+		*bucket = pos + 1;
+	}
+
+	DBGPRINT(("HeaderCont::Grow() new sizes[%d,%d]\n", m_size, m_capacity));
+
+	return STATUS_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
 CFilterHeader* CFilterHeaderCont::Search(CFilterHeader const *header)
 {
 	ASSERT(header);
@@ -192,16 +288,23 @@ CFilterHeader* CFilterHeaderCont::Search(CFilterHeader const *header)
 	ASSERT(header->m_payloadSize);
 	ASSERT(header->m_payloadCrc);
 
-	ASSERT(m_size <= m_capacity);
+	ASSERT(m_size <= m_used);
+	ASSERT(m_used <= m_capacity);
 
-	for(ULONG index = 0; index < m_size; ++index)
+	if(!m_size)
 	{
-		ASSERT(m_headers);
+		return 0;
+	}
+
+	for(ULONG next = *Bucket(header->m_payloadCrc); next; next = m_slots[next - 1].m_next)
+	{
+		CFilterHeader *const candidate = m_headers + (next - 1);
 
-		if(m_headers[index].Equal(header))
+		// Crc filters, compare only on match
+		if((candidate->m_payloadCrc == header->m_payloadCrc) && candidate->Equal(header))
 		{
 			// finish
-			return m_headers + index;
+			return candidate;
 		}
 	}
 
@@ -219,33 +322,20 @@ CFilterHeader* CFilterHeaderCont::Get(ULONG identifier)
 
 	PAGED_CODE();
 
-	ASSERT(m_size <= m_capacity);
+	ULONG const pos = identifier & c_slotMask;
 
-	ULONG pos = identifier & 0x00ffffff;
-
-	// 1. try direct index
-	if(pos < m_size)
+	if(pos < m_used)
 	{
 		ASSERT(m_headers);
 
+		// Stale identifiers do not match the slot's generation
 		if(m_headers[pos].m_identifier == identifier)
 		{
-			return m_headers + pos;
-		}
-	}
-
-	// 2. search in array
-	for(pos = 0; pos < m_size; ++pos)
-	{
-		ASSERT(m_headers);
-		ASSERT(m_headers[pos].m_payload);
-		ASSERT((m_headers[pos].m_identifier & 0xff000000) == c_identifierType);
+			ASSERT(m_headers[pos].m_payload);
 
-		if(m_headers[pos].m_identifier == identifier)
-		{
 			return m_headers + pos;
 		}
-	}	
+	}
 
 	return 0;
 }
@@ -287,61 +377,37 @@ NTSTATUS CFilterHeaderCont::Add(CFilterHeader *header, LUID const* luid)
 		return STATUS_ALERTED;
 	}
 
-	// advance buffer ?
-	if(m_size == m_capacity)
+	// Reuse free slot or advance buffer ?
+	if(!m_free && (m_used == m_capacity))
 	{
-		ULONG const capacity = m_capacity + c_incrementCount;
-
-		CFilterHeader* headers = (CFilterHeader*) ExAllocatePool(NonPagedPool, 
-																 capacity * sizeof(CFilterHeader));
+		NTSTATUS const status = Grow();
 
-		if(!headers)
+		if(NT_ERROR(status))
 		{
-			return STATUS_INSUFFICIENT_RESOURCES;
+			return status;
 		}
-
-		RtlZeroMemory(headers, capacity * sizeof(CFilterHeader));
-
-		m_capacity = capacity;
-
-		if(m_size)
-		{
-			ASSERT(m_headers);
-				
-			RtlCopyMemory(headers, m_headers, m_size * sizeof(CFilterHeader));
-			RtlZeroMemory(m_headers, m_size * sizeof(CFilterHeader));
-
-			ExFreePool(m_headers);
-		}
-
-		m_headers = headers;
 	}
 
-	ASSERT(m_size < m_capacity);
+	ULONG const pos = (m_free) ? m_free - 1 : m_used;
 
-	// generate next Header identifier
-	header->m_identifier = m_nextIdentifier++;
+	ASSERT(pos < m_capacity);
+	ASSERT(!m_headers[pos].m_identifier);
 
-	// overflow ?
-	if((m_nextIdentifier & 0x00ffffff) == 0x00ffffff)
-	{
-		//
-		// TODO: search for unused Header identifiers
-		//
-
-		ASSERT(false);
-	}
+	// generate Header identifier from slot
+	header->m_identifier = c_identifierType | 
+						   ((m_slots[pos].m_generation << 16) & c_generationMask) | 
+						   pos;
 
 	NTSTATUS status = STATUS_SUCCESS;
 
 	header->m_refCount = 1;
 
 	// transfer buffer ownership to list member
-	m_headers[m_size] = *header;
+	m_headers[pos] = *header;
 
 	if(luid)
 	{
-		status = m_headers[m_size].m_luids.Add(luid);
+		status = m_headers[pos].m_luids.Add(luid);
 	}
 
 	if(NT_SUCCESS(status))
@@ -351,6 +417,20 @@ NTSTATUS CFilterHeaderCont::Add(CFilterHeader *header, LUID const* luid)
 		header->m_payloadSize	= 0;
 		header->m_payloadCrc	= 0;
 
+		if(m_free)
+		{
+			m_free = m_slots[pos].m_next;
+		}
+		else
+		{
+			m_used++;
+		}
+
+		ULONG *const bucket = Bucket(m_headers[pos].m_payloadCrc);
+
+		m_slots[pos].m_next = *bucket;
+		*bucket = pos + 1;
+
 		m_size++;
 
 		DBGPRINT(("HeaderCont::Add() new sizes[%d,%d]\n", m_size, 
@@ -358,7 +438,7 @@ NTSTATUS CFilterHeaderCont::Add(CFilterHeader *header, LUID const* luid)
 	}
 	else
 	{
-		RtlZeroMemory(m_headers + m_size, sizeof(CFilterHeader));
+		RtlZeroMemory(m_headers + pos, sizeof(CFilterHeader));
 	}
 
 	return status;
@@ -374,45 +454,17 @@ NTSTATUS CFilterHeaderCont::Release(ULONG identifier)
 
 	PAGED_CODE();
 
-	ASSERT(m_size <= m_capacity);
-	
 	FsRtlEnterFileSystem();
 	ExAcquireResourceExclusiveLite(&m_resource, true);
 
-	CFilterHeader *released = 0;
-
-	ULONG pos = identifier & 0x00ffffff;
-
-	// 1. try direct index
-	if(pos < m_size)
-	{
-		if(m_headers[pos].m_identifier == identifier)
-		{
-			released = m_headers + pos;
-		}
-	}
-
-	if(!released)
-	{
-		// 2. search in array
-		for(pos = 0; pos < m_size; ++pos)
-		{
-			ASSERT(m_headers);
-			ASSERT(m_headers[pos].m_payload);
-			
-			if(m_headers[pos].m_identifier == identifier)
-			{
-				released = m_headers + pos;
-				break;
-			}
-		}
-	}
-
 	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
 
+	CFilterHeader *const released = Get(identifier);
+
 	if(released)
 	{
-		ASSERT(pos < m_size);
+		ULONG const pos = (ULONG) (released - m_headers);
+		ULONG const crc = released->m_payloadCrc;
 
 		status = STATUS_SUCCESS;
 
@@ -423,17 +475,26 @@ NTSTATUS CFilterHeaderCont::Release(ULONG identifier)
 
 		if(!refCount)
 		{
-			m_size--;
+			// Unlink from index
+			ULONG *link = Bucket(crc);
 
-			// Close gap, if any
-			if(pos < m_size)
+			while(*link != pos + 1)
 			{
-				RtlMoveMemory(m_headers + pos,
-							  m_headers + pos + 1,
-							  (m_size - pos) * sizeof(CFilterHeader));
+				ASSERT(*link);
+
+				link = &m_slots[*link - 1].m_next;
 			}
 
-			RtlZeroMemory(m_headers + m_size, sizeof(CFilterHeader));
+			*link = m_slots[pos].m_next;
+
+			// Put slot on free chain, invalidating its identifier
+			m_slots[pos].m_generation++;
+			m_slots[pos].m_next = m_free;
+
+			m_free = pos + 1;
+
+			ASSERT(m_size);
+			m_size--;
 
 			DBGPRINT(("HeaderCont::Release() pos[%d], new sizes[%d,%d]\n", pos, 
 																		   m_size, 
@@ -511,8 +572,6 @@ NTSTATUS CFilterHeaderCont::RemoveLuid(LUID const* luid, ULONG identifier)
 
 	PAGED_CODE();
 
-	ASSERT(m_size <= m_capacity);
-
 	// Remove LUID from particular Header?
 	if(identifier)
 	{
@@ -529,11 +588,15 @@ NTSTATUS CFilterHeaderCont::RemoveLuid(LUID const* luid, ULONG identifier)
 	}
 
 	// Remove given LUID from each Header
-	for(ULONG pos = 0; pos < m_size; ++pos)
+	for(ULONG pos = 0; pos < m_used; ++pos)
 	{
 		ASSERT(m_headers);
 
-		m_headers[pos].m_luids.Remove(luid);
+		// skip free slots
+		if(m_headers[pos].m_identifier)
+		{
+			m_headers[pos].m_luids.Remove(luid);
+		}
 	}
 
 	return STATUS_SUCCESS;
@@ -572,3 +635,321 @@ NTSTATUS CFilterHeaderCont::CheckLuid(LUID const* luid, ULONG identifier)
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Interning by content: identical payloads share one identifier and slot, different ones never do,
+ * even if their crcs collide. Identifiers stay valid while their Header lives, across growth, and
+ * never resolve again once released. A random sequence is checked against a plain reference model.
+ */
+static void TestHeader(CFilterHeader *header, ULONG seed, ULONG collide = 0)
+{
+	UCHAR payload[64];
+
+	for(ULONG pos = 0; pos < sizeof(payload); ++pos)
+	{
+		payload[pos] = (UCHAR) (seed * 7 + pos + (seed >> (pos % 24)));
+	}
+
+	// Sizes differ too
+	header->Init(payload, sizeof(payload) - (seed % 5));
+
+	if(collide)
+	{
+		header->m_payloadCrc = collide;
+	}
+}
+
+static ULONG TestAdd(CFilterHeaderCont *cont, ULONG seed, ULONG collide = 0, NTSTATUS *status = 0)
+{
+	CFilterHeader header;
+	TestHeader(&header, seed, collide);
+
+	cont->LockExclusive();
+	NTSTATUS const added = cont->Add(&header);
+	cont->Unlock();
+
+	if(status)
+	{
+		*status = added;
+	}
+
+	ULONG const identifier = NT_SUCCESS(added) ? header.m_identifier : 0;
+
+	// Payload was taken on a new Header only
+	header.m_identifier = 0;
+	header.Close();
+
+	return identifier;
+}
+
+static ULONG TestMatch(CFilterHeaderCont *cont, ULONG seed, ULONG collide = 0)
+{
+	CFilterHeader header;
+	TestHeader(&header, seed, collide);
+
+	cont->LockShared();
+	ULONG const identifier = cont->Match(&header);
+	cont->Unlock();
+
+	header.Close();
+
+	return identifier;
+}
+
+static bool TestGet(CFilterHeaderCont *cont, ULONG identifier, ULONG seed, ULONG collide = 0)
+{
+	CFilterHeader header;
+	TestHeader(&header, seed, collide);
+
+	cont->LockShared();
+	CFilterHeader *const found = cont->Get(identifier);
+	bool const equal = found && (found->m_identifier == identifier) && found->Equal(&header);
+	cont->Unlock();
+
+	header.Close();
+
+	return equal;
+}
+
+static double TestTime(CFilterHeaderCont *cont, ULONG count, ULONG rounds)
+{
+	CFilterHeader *const headers = (CFilterHeader*) ExAllocatePool(PagedPool, count * sizeof(CFilterHeader));
+
+	for(ULONG pos = 0; pos < count; ++pos)
+	{
+		TestHeader(headers + pos, 100000 + pos);
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	ULONG matched = 0;
+
+	cont->LockShared();
+
+	for(ULONG round = 0; round < rounds; ++round)
+	{
+		for(ULONG pos = 0; pos < count; ++pos)
+		{
+			matched += (0 != cont->Match(headers + pos));
+		}
+	}
+
+	cont->Unlock();
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for(ULONG pos = 0; pos < count; ++pos)
+	{
+		headers[pos].Close();
+	}
+
+	ExFreePool(headers);
+
+	double const ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	return (matched != count * rounds) ? 0 : ns / ((double) rounds * count);
+}
+
+int main(void)
+{
+	enum { c_seeds = 600, c_steps = 20000 };
+
+	CSimKernel::Init();
+
+	CFilterHeaderCont cont;
+	cont.Init();
+
+	int failed = 0;
+
+	// Same payload, same identifier
+	NTSTATUS status = STATUS_SUCCESS;
+
+	ULONG const first = TestAdd(&cont, 1, 0, &status);
+
+	if(!first || (STATUS_SUCCESS != status) || (first != TestAdd(&cont, 1, 0, &status)) || (STATUS_ALERTED != status) ||
+	   (1 != cont.Size()) || (first != TestMatch(&cont, 1)) || TestMatch(&cont, 2))
+	{
+		printf("ERROR ON INTERN\n");
+		failed++;
+	}
+
+	// Different payloads with colliding crcs stay apart
+	ULONG colliding[8];
+
+	for(ULONG pos = 0; pos < 8; ++pos)
+	{
+		colliding[pos] = TestAdd(&cont, 10 + pos, 0x1234);
+	}
+
+	for(ULONG pos = 0; pos < 8; ++pos)
+	{
+		if(!colliding[pos] || (colliding[pos] != TestMatch(&cont, 10 + pos, 0x1234)) || !TestGet(&cont, colliding[pos], 10 + pos, 0x1234) ||
+		   ((pos > 0) && (colliding[pos] == colliding[pos - 1])))
+		{
+			printf("ERROR ON COLLISION [%u]\n", pos);
+			failed++;
+		}
+	}
+
+	// Identifiers survive the growth above, released ones never resolve again
+	if(!TestGet(&cont, first, 1))
+	{
+		printf("ERROR ON GROW\n");
+		failed++;
+	}
+
+	cont.Release(first);
+
+	if(!TestGet(&cont, first, 1) || (9 != cont.Size()))
+	{
+		printf("ERROR ON REFCOUNT\n");
+		failed++;
+	}
+
+	cont.Release(first);
+
+	ULONG const reused = TestAdd(&cont, 3);
+
+	if(TestMatch(&cont, 1) || TestGet(&cont, first, 1) || TestGet(&cont, first, 3) ||
+	   ((reused & CFilterHeaderCont::c_slotMask) != (first & CFilterHeaderCont::c_slotMask)) || (reused == first) ||
+	   (STATUS_OBJECT_NAME_NOT_FOUND != cont.Release(first)))
+	{
+		printf("ERROR ON STALE\n");
+		failed++;
+	}
+
+	// Releasing a colliding one keeps the others of its bucket
+	cont.Release(colliding[3]);
+
+	for(ULONG pos = 0; pos < 8; ++pos)
+	{
+		if((3 != pos) != (colliding[pos] == TestMatch(&cont, 10 + pos, 0x1234)))
+		{
+			printf("ERROR ON UNLINK [%u]\n", pos);
+			failed++;
+		}
+	}
+
+	cont.Release(reused);
+
+	for(ULONG pos = 0; pos < 8; ++pos)
+	{
+		if(3 != pos)
+		{
+			cont.Release(colliding[pos]);
+		}
+	}
+
+	if(cont.Size())
+	{
+		printf("ERROR ON EMPTY [%u]\n", cont.Size());
+		failed++;
+	}
+
+	// Random sequence against a reference of identifier and reference count by seed
+	ULONG identifiers[c_seeds];
+	ULONG references[c_seeds];
+
+	RtlZeroMemory(identifiers, sizeof(identifiers));
+	RtlZeroMemory(references, sizeof(references));
+
+	ULONG random = 12345;
+	ULONG live   = 0;
+
+	for(ULONG step = 0; step < c_steps; ++step)
+	{
+		random = random * 1103515245 + 12345;
+
+		ULONG const seed	= (random >> 8) % c_seeds;
+		ULONG const collide = (seed % 3) ? 0 : 0x4000 + seed % 7;
+
+		if((random >> 28) < 9)
+		{
+			ULONG const identifier = TestAdd(&cont, seed, collide);
+
+			if(!identifier || (references[seed] && (identifier != identifiers[seed])))
+			{
+				printf("ERROR ON ADD step[%u] seed[%u]\n", step, seed);
+				failed++;
+				break;
+			}
+
+			live += !references[seed]++;
+
+			identifiers[seed] = identifier;
+		}
+		else if(references[seed])
+		{
+			if(NT_ERROR(cont.Release(identifiers[seed])))
+			{
+				printf("ERROR ON RELEASE step[%u] seed[%u]\n", step, seed);
+				failed++;
+				break;
+			}
+
+			live -= !--references[seed];
+		}
+
+		if(TestMatch(&cont, seed, collide) != (references[seed] ? identifiers[seed] : 0))
+		{
+			printf("ERROR ON MATCH step[%u] seed[%u]\n", step, seed);
+			failed++;
+			break;
+		}
+
+		if(live != cont.Size())
+		{
+			printf("ERROR ON SIZE step[%u] [%u,%u]\n", step, live, cont.Size());
+			failed++;
+			break;
+		}
+	}
+
+	for(ULONG seed = 0; seed < c_seeds; ++seed)
+	{
+		if(references[seed] && !TestGet(&cont, identifiers[seed], seed, (seed % 3) ? 0 : 0x4000 + seed % 7))
+		{
+			printf("ERROR ON FINAL seed[%u]\n", seed);
+			failed++;
+		}
+	}
+
+	cont.Close();
+
+	printf("%u steps, %u live Headers at the end\n", (ULONG) c_steps, live);
+
+	// Lookup cost does not depend on the number of Headers
+	for(ULONG count = 64; count <= 16384; count *= 16)
+	{
+		cont.Init();
+
+		for(ULONG pos = 0; pos < count; ++pos)
+		{
+			TestAdd(&cont, 100000 + pos);
+		}
+
+		printf("Match() %u Headers %.0f ns\n", count, TestTime(&cont, count, 16384 / count * 8));
+
+		cont.Close();
+	}
+
+	if(CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimKernel::Statistics().Outstanding);
+		failed++;
+	}
+
+	CSimKernel::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
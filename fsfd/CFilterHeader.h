@@ -90,12 +90,25 @@ LONG CFilterHeader::Release()
 
 class CFilterHeaderCont
 {
+	// Headers are interned by content: identical payloads are stored once and reference counted.
+	// A hash index on the payload crc finds them, a single compare confirms. Identifiers encode
+	// the slot and its generation, so Get() is a direct index even after removals.
+
 	friend class CFilterContext;
 
+	struct CFilterHeaderSlot
+	{
+		ULONG					m_next;				// next slot + 1 in bucket or free chain, 0 := end
+		ULONG					m_generation;		// advanced on each reuse
+	};
+
 public:
 
 	enum c_constants			{	c_incrementCount = 8,
 									c_identifierType = 0xfe000000,	// highest 8 bit of Header identifier
+									c_slotMask		 = 0x0000ffff,	// lowest 16 bit: slot
+									c_slotsMax		 = c_slotMask + 1,
+									c_generationMask = 0x00ff0000,	// next 8 bit: generation of slot
 								};
 	
 	NTSTATUS					Init();
@@ -119,17 +132,33 @@ public:
 	NTSTATUS					CheckLuid(LUID const* luid, ULONG identifier);
 	
 private:
+
+	NTSTATUS					Grow();
+	ULONG*						Bucket(ULONG crc);
+
 								// DATA
-	CFilterHeader*				m_headers;
-	ULONG						m_size;
-	ULONG						m_capacity;
-	ULONG						m_nextIdentifier;
+	CFilterHeader*				m_headers;			// by slot, unused ones are zeroed
+	CFilterHeaderSlot*			m_slots;
+	ULONG*						m_buckets;			// first slot + 1 by crc, m_capacity entries
+	ULONG						m_size;				// live Headers
+	ULONG						m_used;				// slots ever handed out
+	ULONG						m_capacity;			// power of two
+	ULONG						m_free;				// first free slot + 1
 
 	ERESOURCE					m_resource;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+inline
+ULONG* CFilterHeaderCont::Bucket(ULONG crc)
+{
+	ASSERT(m_buckets);
+	ASSERT(m_capacity);
+
+	return m_buckets + (crc & (m_capacity - 1));
+}
+
 inline
 ULONG CFilterHeaderCont::Size()
 {
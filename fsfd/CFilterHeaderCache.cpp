@@ -797,19 +797,19 @@ NTSTATUS CFilterHeaderCache::Remove(FILFILE_VOLUME_EXTENSION *extension, FILE_OB
 
 			if(type & FILFILE_DEVICE_REDIRECTOR_CIFS)
 			{
-				lower.Buffer		= L"\\Device\\LanmanRedirector";
+				lower.Buffer		= (LPWSTR) L"\\Device\\LanmanRedirector";
 				lower.Length		= 24 * sizeof(WCHAR);
 				lower.MaximumLength = lower.Length + sizeof(WCHAR);
 			}
 			else if(type & FILFILE_DEVICE_REDIRECTOR_WEBDAV)
 			{
-				lower.Buffer		= L"\\Device\\WebDavRedirector";
+				lower.Buffer		= (LPWSTR) L"\\Device\\WebDavRedirector";
 				lower.Length		= 24 * sizeof(WCHAR);
 				lower.MaximumLength = lower.Length + sizeof(WCHAR);
 			}
 			else if(type & FILFILE_DEVICE_REDIRECTOR_NETWARE)
 			{
-				lower.Buffer		= L"\\Device\\NetWareRedirector";
+				lower.Buffer		= (LPWSTR) L"\\Device\\NetWareRedirector";
 				lower.Length		= 25 * sizeof(WCHAR);
 				lower.MaximumLength = lower.Length + sizeof(WCHAR);
 			}
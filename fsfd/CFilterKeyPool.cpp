@@ -0,0 +1,923 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterKeyPool.cpp: implementation of the CFilterKeyPool class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define DRIVER_USE_NTIFS	// use the NTIFS header
+#include "driver.h"
+
+#include "CFilterBase.h"
+#include "CFilterContext.h"
+#include "CFilterKeyPool.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterKeyPool::Init(CFilterContext *context, CFilterRandomizer *randomizer)
+{
+	ASSERT(context);
+	ASSERT(randomizer);
+
+	PAGED_CODE();
+
+	RtlZeroMemory(this, sizeof(*this));
+
+	m_context	 = context;
+	m_randomizer = randomizer;
+
+	for(ULONG index = 0; index < c_buckets; ++index)
+	{
+		ExInitializeFastMutex(&m_buckets[index].m_lock);
+	}
+
+	ExInitializeFastMutex(&m_lock);
+
+	KeInitializeEvent(&m_workerStop, NotificationEvent, false);
+	KeInitializeEvent(&m_workerRefill, SynchronizationEvent, false);
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterKeyPool::Close()
+{
+	PAGED_CODE();
+
+	WorkerStop();
+
+	for(ULONG index = 0; index < c_buckets; ++index)
+	{
+		Bucket *const bucket = m_buckets + index;
+
+		ExAcquireFastMutex(&bucket->m_lock);
+
+		// be paranoid
+		RtlZeroMemory(bucket->m_entries, sizeof(bucket->m_entries));
+		bucket->m_count = 0;
+
+		ExReleaseFastMutex(&bucket->m_lock);
+	}
+
+	ExAcquireFastMutex(&m_lock);
+
+	m_cipher.Close();
+	m_entityKey.Clear();
+
+	m_keySize = 0;
+	m_wrap	  = 0;
+
+	ExReleaseFastMutex(&m_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+CFilterKeyPool::Bucket* CFilterKeyPool::Current()
+{
+	PAGED_CODE();
+
+	// We may be moved to another processor any time, which costs only a shared bucket
+	return m_buckets + (KeGetCurrentProcessorNumber() % c_buckets);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+ULONG CFilterKeyPool::Count()
+{
+	PAGED_CODE();
+
+	Bucket *const bucket = Current();
+
+	ExAcquireFastMutex(&bucket->m_lock);
+	ULONG const count = bucket->m_count;
+	ExReleaseFastMutex(&bucket->m_lock);
+
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterKeyPool::Get(CFilterKey const* entityKey, CFilterKey *fileKey, CFilterKey *wrapped, LARGE_INTEGER *nonce)
+{
+	ASSERT(entityKey);
+	ASSERT(entityKey->m_size);
+	ASSERT(fileKey);
+	ASSERT(fileKey->m_size);
+	ASSERT(fileKey->m_size <= c_keySize);
+	ASSERT(wrapped);
+	ASSERT(nonce);
+
+	PAGED_CODE();
+
+	Entry entry;
+	bool found = false;
+
+	Bucket *const bucket = Current();
+
+	ExAcquireFastMutex(&bucket->m_lock);
+
+	if(bucket->m_count)
+	{
+		bucket->m_count--;
+
+		entry = bucket->m_entries[bucket->m_count];
+
+		// Never hand out the same pair twice
+		RtlZeroMemory(bucket->m_entries + bucket->m_count, sizeof(Entry));
+
+		found = true;
+	}
+
+	bool const refill = (bucket->m_count < c_refill);
+
+	ExReleaseFastMutex(&bucket->m_lock);
+
+	if(refill)
+	{
+		if(NT_SUCCESS(WorkerStart()))
+		{
+			KeSetEvent(&m_workerRefill, IO_NO_INCREMENT, false);
+		}
+	}
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	RtlZeroMemory(fileKey->m_key, sizeof(fileKey->m_key));
+
+	if(found)
+	{
+		RtlCopyMemory(fileKey->m_key, entry.m_key, fileKey->m_size);
+
+		*nonce = entry.m_nonce;
+	}
+	else
+	{
+		DBGPRINT(("CFilterKeyPool::Get: pool is empty, use randomizer\n"));
+
+		status = m_randomizer->Get(fileKey->m_key, fileKey->m_size);
+
+		m_context->GenerateNonce(nonce);
+	}
+
+	if(NT_SUCCESS(status))
+	{
+		bool wrap = true;
+
+		if(found && entry.m_wrap)
+		{
+			ExAcquireFastMutex(&m_lock);
+
+			// Wrapped ahead with the same EntityKey and for keys of this size?
+			if((entry.m_wrap == m_wrap) && (fileKey->m_size == m_keySize))
+			{
+				wrapped->m_cipher = fileKey->m_cipher;
+				wrapped->m_size	  = fileKey->m_size;
+
+				RtlCopyMemory(wrapped->m_key, entry.m_wrapped, c_keySize);
+
+				wrap = false;
+			}
+
+			ExReleaseFastMutex(&m_lock);
+		}
+
+		if(wrap)
+		{
+			Wrap(entityKey, fileKey, wrapped);
+		}
+	}
+
+	// be paranoid
+	RtlZeroMemory(&entry, sizeof(entry));
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterKeyPool::Wrap(CFilterKey const* entityKey, CFilterKey *fileKey, CFilterKey *wrapped)
+{
+	ASSERT(entityKey);
+	ASSERT(fileKey);
+	ASSERT(wrapped);
+
+	PAGED_CODE();
+
+	*wrapped = *fileKey;
+
+	ExAcquireFastMutex(&m_lock);
+
+	bool const changed = !m_wrap || (entityKey->m_size != m_entityKey.m_size) || !RtlEqualMemory(entityKey->m_key, m_entityKey.m_key, entityKey->m_size);
+
+	if(changed)
+	{
+		// Keep the EntityKey expanded, the worker wraps further keys with it
+		UCHAR key[32];
+		RtlZeroMemory(key, sizeof(key));
+
+		ASSERT(sizeof(key) >= entityKey->m_size);
+		RtlCopyMemory(key, entityKey->m_key, entityKey->m_size);
+
+		m_cipher.Close();
+
+		if(m_cipher.Init(key, false))
+		{
+			m_entityKey = *entityKey;
+		}
+		else
+		{
+			ASSERT(false);
+
+			m_entityKey.Clear();
+		}
+
+		// be paranoid
+		RtlZeroMemory(key, sizeof(key));
+	}
+
+	if(changed || (fileKey->m_size != m_keySize))
+	{
+		// Keys wrapped so far don't fit anymore, zero is none
+		m_keySize = fileKey->m_size;
+		m_wrap	  = m_entityKey.m_size ? (m_wrap % 0xffffffff) + 1 : 0;
+	}
+
+	if(m_wrap)
+	{
+		CFilterContext::EncodeFileKey(&m_cipher, wrapped, false);
+	}
+	else
+	{
+		CFilterContext::EncodeFileKey(entityKey, wrapped, false);
+	}
+
+	ExReleaseFastMutex(&m_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterKeyPool::Refill()
+{
+	PAGED_CODE();
+
+	ASSERT(m_context);
+	ASSERT(m_randomizer);
+
+	Entry entry;
+	RtlZeroMemory(&entry, sizeof(entry));
+
+	bool failed = false;
+
+	for(ULONG index = 0; (index < c_buckets) && !failed; ++index)
+	{
+		Bucket *const bucket = m_buckets + index;
+
+		for(;;)
+		{
+			ExAcquireFastMutex(&bucket->m_lock);
+			bool const full = (bucket->m_count >= c_keys);
+			ExReleaseFastMutex(&bucket->m_lock);
+
+			if(full)
+			{
+				break;
+			}
+
+			// May wait for UserMode, so don't hold any lock
+			if(NT_ERROR(m_randomizer->Get(entry.m_key, sizeof(entry.m_key))))
+			{
+				failed = true;
+				break;
+			}
+
+			// Taken now, still unique when used later
+			m_context->GenerateNonce(&entry.m_nonce);
+
+			entry.m_wrap = 0;
+
+			ExAcquireFastMutex(&m_lock);
+
+			if(m_wrap)
+			{
+				// As the last create asked for, the rest of smaller keys is zero
+				RtlZeroMemory(entry.m_key + m_keySize, c_keySize - m_keySize);
+
+				CFilterKey key;
+				key.m_cipher = m_entityKey.m_cipher;
+				key.m_size	 = m_keySize;
+
+				RtlCopyMemory(key.m_key, entry.m_key, c_keySize);
+
+				CFilterContext::EncodeFileKey(&m_cipher, &key, false);
+
+				RtlCopyMemory(entry.m_wrapped, key.m_key, c_keySize);
+				entry.m_wrap = m_wrap;
+
+				key.Clear();
+			}
+
+			ExReleaseFastMutex(&m_lock);
+
+			ExAcquireFastMutex(&bucket->m_lock);
+
+			if(bucket->m_count < c_keys)
+			{
+				bucket->m_entries[bucket->m_count] = entry;
+				bucket->m_count++;
+			}
+
+			ExReleaseFastMutex(&bucket->m_lock);
+		}
+	}
+
+	// be paranoid
+	RtlZeroMemory(&entry, sizeof(entry));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterKeyPool::WorkerStart()
+{
+	PAGED_CODE();
+
+	// Already running or being started?
+	if(InterlockedCompareExchange(&m_workerActive, 1, 0))
+	{
+		return STATUS_SUCCESS;
+	}
+
+	// A worker that has gone idle leaves its object behind
+	ExAcquireFastMutex(&m_lock);
+	void *const previous = m_worker;
+	m_worker = 0;
+	ExReleaseFastMutex(&m_lock);
+
+	if(previous)
+	{
+		ObDereferenceObject(previous);
+	}
+
+	KeClearEvent(&m_workerStop);
+
+	OBJECT_ATTRIBUTES oa;
+	InitializeObjectAttributes(&oa, 0, OBJ_KERNEL_HANDLE, 0,0);
+
+	HANDLE handle = 0;
+
+	NTSTATUS status = PsCreateSystemThread(&handle, THREAD_ALL_ACCESS, &oa, 0,0, Worker, this);
+
+	if(NT_SUCCESS(status))
+	{
+		void *thread = 0;
+
+		// Keep the object, not the handle, so that the worker never has to close anything on its way out
+		status = ObReferenceObjectByHandle(handle, THREAD_ALL_ACCESS, 0, KernelMode, &thread, 0);
+
+		ZwClose(handle);
+
+		if(NT_SUCCESS(status))
+		{
+			ASSERT(thread);
+
+			ExAcquireFastMutex(&m_lock);
+			m_worker = thread;
+			ExReleaseFastMutex(&m_lock);
+
+			return status;
+		}
+	}
+
+	DBGPRINT(("CFilterKeyPool::WorkerStart -ERROR: failed with [0x%x]\n", status));
+
+	InterlockedExchange(&m_workerActive, 0);
+
+	return status;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterKeyPool::WorkerStop()
+{
+	PAGED_CODE();
+
+	ExAcquireFastMutex(&m_lock);
+	void *const thread = m_worker;
+	m_worker = 0;
+	ExReleaseFastMutex(&m_lock);
+
+	if(thread)
+	{
+		// Trigger stop, if not gone idle already
+		KeSetEvent(&m_workerStop, EVENT_INCREMENT, true);
+
+		KeWaitForSingleObject(thread, Executive, KernelMode, false, 0);
+
+		ObDereferenceObject(thread);
+	}
+
+	return STATUS_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterKeyPool::Worker(void *context)
+{
+	PAGED_CODE();
+
+	// Keys are needed only later on, so lower our priority
+	KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY - 1);
+
+	CFilterKeyPool *const me = (CFilterKeyPool*) context;
+	ASSERT(me);
+
+	LARGE_INTEGER timeout;
+	timeout.QuadPart = RELATIVE(SECONDS(c_idle));
+
+	void* events[2] = { &me->m_workerStop, &me->m_workerRefill };
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	for(;;)
+	{
+		// Two objects fit into the thread's own wait blocks
+		status = KeWaitForMultipleObjects(2,
+										  events,
+										  WaitAny,
+										  Executive,
+										  KernelMode,
+										  false,
+										  &timeout,
+										  0);
+
+		if(STATUS_WAIT_1 != status)
+		{
+			// Stopped, failed or idle
+			DBGPRINT(("CFilterKeyPool::Worker: Exiting[0x%x]\n", status));
+			break;
+		}
+
+		DBGPRINT(("CFilterKeyPool::Worker: Refill\n"));
+
+		me->Refill();
+	}
+
+	// Our object is released by the next start or by the stop
+	InterlockedExchange(&me->m_workerActive, 0);
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "CFilterControl.h"
+#include "CSimFixture.h"
+
+/*
+ * System threads run in the stand-in, so the worker refills whenever the test lets the kernel run. An
+ * empty pool falls back to the randomizer and starts the worker, which fills the buckets of all
+ * processors. Each processor takes from its own. Keys come wrapped with the EntityKey asked for, equal
+ * to what EncodeFileKey gives, also after the EntityKey or the key size has changed. Keys and Nonces of
+ * many refills are all distinct, and the worker exits when idle and is started again.
+ *
+ * Nonces are generated from up to 16 threads on a clock that does not move, so all of them race on the
+ * compare-exchange. Each thread sees strictly growing Nonces, together they form one gapless range.
+ * This is timed against the former lock, a pthread mutex. The create benchmark takes a FileKey and a
+ * Nonce per create, from the randomizer as before and from the pool. No daemon is connected, so the
+ * randomizer of the driver gathers entropy itself, which stands in for the round trip to UserMode.
+ */
+static int TestCompare(void const* left, void const* right)
+{
+	return memcmp(left, right, 32);
+}
+
+static int TestCompareNonce(void const* left, void const* right)
+{
+	ULONGLONG const l = *(ULONGLONG const*) left;
+	ULONGLONG const r = *(ULONGLONG const*) right;
+
+	return (l < r) ? -1 : (l > r);
+}
+
+struct TestNonces
+{
+	CFilterContext*		m_context;
+	LONGLONG*			m_nonces;
+	ULONG				m_count;
+	pthread_mutex_t*	m_lock;			// former locked variant, if set
+	LONGLONG*			m_last;
+	bool				m_ordered;
+};
+
+static void* TestNonceWorker(void *context)
+{
+	TestNonces *const test = (TestNonces*) context;
+
+	test->m_ordered = true;
+
+	for(ULONG pos = 0; pos < test->m_count; ++pos)
+	{
+		LARGE_INTEGER nonce;
+
+		if(test->m_lock)
+		{
+			KeQuerySystemTime(&nonce);
+
+			pthread_mutex_lock(test->m_lock);
+
+			if((ULONGLONG) nonce.QuadPart <= (ULONGLONG) *test->m_last)
+			{
+				nonce.QuadPart = *test->m_last + 1;
+			}
+
+			*test->m_last = nonce.QuadPart;
+
+			pthread_mutex_unlock(test->m_lock);
+		}
+		else
+		{
+			test->m_context->GenerateNonce(&nonce);
+		}
+
+		test->m_nonces[pos] = nonce.QuadPart;
+
+		if(pos && ((ULONGLONG) nonce.QuadPart <= (ULONGLONG) test->m_nonces[pos - 1]))
+		{
+			test->m_ordered = false;
+		}
+	}
+
+	return 0;
+}
+
+static double TestNonceRun(CFilterContext *context, ULONG threadCount, ULONG count, bool locked, bool *unique)
+{
+	TestNonces *const tests = (TestNonces*) calloc(threadCount, sizeof(TestNonces));
+	pthread_t *const threads = (pthread_t*) calloc(threadCount, sizeof(pthread_t));
+	LONGLONG *const nonces = (LONGLONG*) malloc(threadCount * count * sizeof(LONGLONG));
+
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	LONGLONG last = 0;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for(ULONG index = 0; index < threadCount; ++index)
+	{
+		tests[index].m_context	= context;
+		tests[index].m_nonces	= nonces + index * count;
+		tests[index].m_count	= count;
+		tests[index].m_lock		= locked ? &lock : 0;
+		tests[index].m_last		= &last;
+
+		pthread_create(threads + index, 0, TestNonceWorker, tests + index);
+	}
+
+	*unique = true;
+
+	for(ULONG index = 0; index < threadCount; ++index)
+	{
+		pthread_join(threads[index], 0);
+
+		*unique &= tests[index].m_ordered;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	// One gapless range
+	qsort(nonces, threadCount * count, sizeof(LONGLONG), TestCompareNonce);
+
+	for(ULONG pos = 1; pos < threadCount * count; ++pos)
+	{
+		if(nonces[pos] != nonces[pos - 1] + 1)
+		{
+			*unique = false;
+			break;
+		}
+	}
+
+	free(nonces);
+	free(threads);
+	free(tests);
+
+	return (threadCount * count * 1e3) / ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec));
+}
+
+// Keys and Nonces of each Get, checked against EncodeFileKey
+static int TestGet(CFilterKeyPool *pool, CFilterKey const* entityKey, ULONG size, ULONG count, UCHAR (*keys)[32], LONGLONG *nonces)
+{
+	int failed = 0;
+
+	for(ULONG pos = 0; pos < count; ++pos)
+	{
+		CFilterKey key, wrapped, expected;
+		RtlZeroMemory(&key, sizeof(key));
+
+		key.m_cipher = entityKey->m_cipher;
+		key.m_size	 = size;
+
+		LARGE_INTEGER nonce;
+
+		if(NT_ERROR(pool->Get(entityKey, &key, &wrapped, &nonce)))
+		{
+			failed++;
+			continue;
+		}
+
+		expected = key;
+		CFilterContext::EncodeFileKey(entityKey, &expected, false);
+
+		UCHAR const zero[32] = { 0 };
+
+		if(memcmp(&wrapped, &expected, sizeof(expected)) || memcmp(key.m_key + size, zero, 32 - size) || !memcmp(key.m_key, zero, size))
+		{
+			failed++;
+		}
+
+		RtlCopyMemory(keys[pos], key.m_key, 32);
+		nonces[pos] = nonce.QuadPart;
+
+		// Refills between creates
+		CSimKernel::Run();
+	}
+
+	return failed;
+}
+
+static bool TestDistinct(UCHAR (*keys)[32], LONGLONG *nonces, ULONG count)
+{
+	qsort(keys, count, 32, TestCompare);
+	qsort(nonces, count, sizeof(LONGLONG), TestCompareNonce);
+
+	for(ULONG pos = 1; pos < count; ++pos)
+	{
+		if(!memcmp(keys[pos - 1], keys[pos], 32) || (nonces[pos - 1] == nonces[pos]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(void)
+{
+	enum { c_keys = 16, c_unique = 20000, c_nonces = 1 << 17, c_creates = 100000 };
+
+	// The worker and the nonce threads run for real
+	CSimKernel::s_threads = true;
+
+	FILFILE_CONTROL_EXTENSION *const extension = CSimFixture::Init();
+
+	int failed = 0;
+
+	// Nonces, only the MAC checksum and the last one are used
+	CFilterContext *const context = &extension->Context;
+	CFilterRandomizer *const randomizer = &context->m_randomizerHigh;
+
+	LARGE_INTEGER first, second, third;
+	context->GenerateNonce(&first);
+	context->GenerateNonce(&second);
+
+	CSimKernel::Advance(10000000);
+	context->GenerateNonce(&third);
+
+	if((second.QuadPart != first.QuadPart + 1) || ((ULONGLONG) (third.QuadPart - first.QuadPart) != 10000000) ||
+	   (((UCHAR*) &third.QuadPart)[7] != ((UCHAR*) &first.QuadPart)[7]))
+	{
+		printf("ERROR ON NONCE\n");
+		failed++;
+	}
+
+	CFilterKeyPool pool;
+	pool.Init(context, randomizer);
+
+	UCHAR const entityBytes[2][32] = { { 1, 2, 3, 4, 5, 6, 7, 8, 9 }, { 9, 8, 7, 6, 5, 4, 3, 2, 1 } };
+
+	CFilterKey entityKey, otherKey;
+	entityKey.Init(FILFILE_CIPHER_SYM_AES256, entityBytes[0], 32);
+	otherKey.Init(FILFILE_CIPHER_SYM_AES128, entityBytes[1], 16);
+
+	UCHAR (*const keys)[32] = (UCHAR(*)[32]) malloc(c_unique * 32);
+	LONGLONG *const nonces  = (LONGLONG*) malloc(c_unique * sizeof(LONGLONG));
+
+	// Empty, so from the randomizer, the worker then fills the buckets of all processors
+	if(pool.Count())
+	{
+		printf("ERROR ON EMPTY\n");
+		failed++;
+	}
+
+	CFilterKey key, wrapped;
+	RtlZeroMemory(&key, sizeof(key));
+	key.m_cipher = entityKey.m_cipher;
+	key.m_size	 = 32;
+
+	LARGE_INTEGER nonce;
+
+	if(NT_ERROR(pool.Get(&entityKey, &key, &wrapped, &nonce)) || pool.Count())
+	{
+		printf("ERROR ON EMPTY GET\n");
+		failed++;
+	}
+
+	CSimKernel::Run();
+
+	for(ULONG processor = 0; processor < 8; ++processor)
+	{
+		CSimKernel::SetProcessor(processor);
+
+		if(pool.Count() != c_keys)
+		{
+			printf("ERROR ON REFILL [%u]\n", processor);
+			failed++;
+		}
+	}
+
+	// Each processor takes from its own bucket, wrapped ahead with the EntityKey of the Get above
+	CSimKernel::SetProcessor(1);
+
+	if(TestGet(&pool, &entityKey, 32, 3, keys, nonces) || (pool.Count() != c_keys - 3))
+	{
+		printf("ERROR ON BUCKET\n");
+		failed++;
+	}
+
+	CSimKernel::SetProcessor(2);
+
+	if(pool.Count() != c_keys)
+	{
+		printf("ERROR ON BUCKET OTHER\n");
+		failed++;
+	}
+
+	// Changed EntityKey and key size, the first keys get wrapped on the spot
+	if(TestGet(&pool, &otherKey, 16, c_keys * 2, keys, nonces))
+	{
+		printf("ERROR ON WRAP\n");
+		failed++;
+	}
+
+	if(TestGet(&pool, &entityKey, 32, c_keys * 2, keys, nonces))
+	{
+		printf("ERROR ON WRAP BACK\n");
+		failed++;
+	}
+
+	// Distinct over many refills, spread over processors
+	for(ULONG pos = 0; pos < c_unique; pos += 100)
+	{
+		CSimKernel::SetProcessor((pos / 100) & 7);
+
+		failed += TestGet(&pool, &entityKey, 32, 100, keys + pos, nonces + pos);
+	}
+
+	if(!TestDistinct(keys, nonces, c_unique))
+	{
+		printf("ERROR ON UNIQUE\n");
+		failed++;
+	}
+
+	// Gone idle, started again on demand
+	CSimKernel::SetProcessor(0);
+	CSimKernel::Advance(SECONDS(61));
+	CSimKernel::Run();
+
+	if(TestGet(&pool, &entityKey, 32, c_keys / 2 + 1, keys, nonces) || (pool.Count() != c_keys))
+	{
+		printf("ERROR ON IDLE\n");
+		failed++;
+	}
+
+	pool.Close();
+
+	for(ULONG processor = 0; processor < 8; ++processor)
+	{
+		CSimKernel::SetProcessor(processor);
+
+		if(pool.Count())
+		{
+			printf("ERROR ON CLOSE [%u]\n", processor);
+			failed++;
+		}
+	}
+
+	CSimKernel::SetProcessor(0);
+
+	free(nonces);
+	free(keys);
+
+	ULONG const threadCounts[] = { 1, 2, 4, 16 };
+
+	printf("threads  cas[M/s]  mutex[M/s]\n");
+
+	for(ULONG pos = 0; pos < sizeof(threadCounts) / sizeof(threadCounts[0]); ++pos)
+	{
+		bool unique = false, uniqueLocked = false;
+
+		double const cas	= TestNonceRun(context, threadCounts[pos], c_nonces / threadCounts[pos], false, &unique);
+		double const locked = TestNonceRun(context, threadCounts[pos], c_nonces / threadCounts[pos], true, &uniqueLocked);
+
+		if(!unique || !uniqueLocked)
+		{
+			printf("ERROR ON NONCE UNIQUE [%u]\n", threadCounts[pos]);
+			failed++;
+		}
+
+		printf("%7u  %8.2f  %10.2f\n", threadCounts[pos], cas, locked);
+	}
+
+	printf("%ld processors\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	// Encrypted FileKey and Nonce per create, before and with the pool
+	pool.Init(context, randomizer);
+
+	printf("create   mean[ns]  worst[ns]\n");
+
+	for(ULONG pass = 0; pass < 2; ++pass)
+	{
+		double total = 0, worst = 0;
+
+		for(ULONG pos = 0; pos < c_creates; ++pos)
+		{
+			if(pass)
+			{
+				CSimKernel::Run();
+			}
+
+			RtlZeroMemory(&key, sizeof(key));
+			key.m_cipher = entityKey.m_cipher;
+			key.m_size	 = 32;
+
+			double const start = CSimFixture::Now();
+
+			NTSTATUS status = STATUS_SUCCESS;
+
+			if(pass)
+			{
+				status = pool.Get(&entityKey, &key, &wrapped, &nonce);
+			}
+			else
+			{
+				status = randomizer->Get(key.m_key, key.m_size);
+				context->GenerateNonce(&nonce);
+
+				wrapped = key;
+				CFilterContext::EncodeFileKey(&entityKey, &wrapped, false);
+			}
+
+			double const elapsed = CSimFixture::Now() - start;
+
+			total += elapsed;
+			worst  = (elapsed > worst) ? elapsed : worst;
+
+			if(NT_ERROR(status))
+			{
+				printf("ERROR ON CREATE [%u]\n", pos);
+				failed++;
+				break;
+			}
+		}
+
+		printf("%-7s  %8.1f  %9.1f\n", pass ? "pool" : "direct", total / c_creates, worst);
+	}
+
+	pool.Close();
+
+	failed += CSimFixture::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
@@ -0,0 +1,99 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterKeyPool.h: interface for the CFilterKeyPool class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilterKeyPool_H__4E7C2A91_B05D_4F63_8A1E_D93F6B27C5A8__INCLUDED_)
+#define AFX_CFilterKeyPool_H__4E7C2A91_B05D_4F63_8A1E_D93F6B27C5A8__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "CFilterKey.h"
+#include "CFilterRandomizer.h"
+#include "RijndaelCoder.h"
+
+class CFilterContext;
+
+////////////////////////////////////
+
+class CFilterKeyPool
+{
+	// FileKeys drawn ahead of time from the high quality randomizer by a worker thread, each paired with
+	// its Nonce, so that creating an encrypted file neither waits for UserMode to deliver random data nor
+	// for the randomizer lock. Each processor takes from its own bucket. The worker also wraps the keys
+	// with the EntityKey last asked for, whose expanded cipher is kept, so that a create in the same Entity
+	// gets its FileKey encoded as well. Each pair is handed out once and wiped. If the bucket has run dry,
+	// the randomizer is used directly.
+
+	enum c_constants
+	{
+		c_buckets			= 4,		// per processor, further ones share
+		c_keys				= 16,		// per bucket
+		c_keySize			= 32,		// bytes, largest FileKey
+		c_refill			= c_keys / 2,
+		c_idle				= 60,		// seconds until worker exits
+	};
+
+	struct Entry
+	{
+		UCHAR				m_key[c_keySize];
+		UCHAR				m_wrapped[c_keySize];	// with the EntityKey of m_wrap
+		ULONG				m_wrap;					// generation of the cached EntityKey, zero if none
+		LARGE_INTEGER		m_nonce;
+	};
+
+	struct Bucket
+	{
+		FAST_MUTEX			m_lock;
+		ULONG				m_count;
+		Entry				m_entries[c_keys];
+	};
+
+public:
+
+	NTSTATUS				Init(CFilterContext *context, CFilterRandomizer *randomizer);
+	void					Close();
+
+	NTSTATUS				Get(CFilterKey const* entityKey, CFilterKey *fileKey, CFilterKey *wrapped, LARGE_INTEGER *nonce);
+
+	ULONG					Count();						// pairs ready on the current processor
+
+private:
+
+	Bucket*					Current();
+
+	void					Refill();
+	void					Wrap(CFilterKey const* entityKey, CFilterKey *fileKey, CFilterKey *wrapped);
+
+	NTSTATUS				WorkerStart();
+	NTSTATUS				WorkerStop();
+	static void NTAPI		Worker(void *context);
+
+							// DATA
+	Bucket					m_buckets[c_buckets];
+
+	CFilterContext*			m_context;
+	CFilterRandomizer*		m_randomizer;
+
+	FAST_MUTEX				m_lock;					// worker and cipher below
+
+	RijndealCoder<AES_256>	m_cipher;				// expanded EntityKey
+	CFilterKey				m_entityKey;
+	ULONG					m_keySize;				// of the FileKeys wrapped with it
+	ULONG					m_wrap;					// generation, changes with the EntityKey
+
+	void*					m_worker;				// referenced thread object
+	LONG volatile			m_workerActive;
+	KEVENT					m_workerStop;
+	KEVENT					m_workerRefill;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // !defined(AFX_CFilterKeyPool_H__4E7C2A91_B05D_4F63_8A1E_D93F6B27C5A8__INCLUDED_)
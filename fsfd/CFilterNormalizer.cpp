@@ -787,7 +787,7 @@ void CFilterNormalizer::Dump(IRP* irp, CFilterPath *path)
 				FILE_OBJECT *const file	= stack->FileObject;
 				ASSERT(file);
 
-				LPSTR type = "BOTH     ";
+				LPCSTR type = "BOTH     ";
 
 				if(stack->Parameters.Create.Options & FILE_DIRECTORY_FILE)
 				{
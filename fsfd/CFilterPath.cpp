@@ -1119,7 +1119,7 @@ ULONG CFilterPath::Write(LPWSTR buffer, ULONG bufferLength, ULONG flags) const
 
 #pragma PAGEDCODE
 
-NTSTATUS CFilterPath::GetAutoConfig(UNICODE_STRING *autoConfig, ULONG flags) const
+NTSTATUS CFilterPath::GetAutoConfig(UNICODE_STRING *autoConfig, ULONG flags, CFilterPathBuffer *storage) const
 {
 	ASSERT(autoConfig);
 
@@ -1132,6 +1132,25 @@ NTSTATUS CFilterPath::GetAutoConfig(UNICODE_STRING *autoConfig, ULONG flags) con
 		flags |= PATH_VOLUME;
 	}
 
+	// Caller provided storage?
+	if(storage)
+	{
+		ULONG written = 0;
+
+		LPWSTR const buffer = storage->Write(this, flags, &written);
+
+		if(!buffer)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		autoConfig->Length		  = (USHORT) written - sizeof(WCHAR);
+		autoConfig->MaximumLength = (USHORT) written;
+		autoConfig->Buffer		  = buffer;
+
+		return STATUS_SUCCESS;
+	}
+
 	ULONG const bufferSize = GetLength(flags);
 
 	LPWSTR buffer = (LPWSTR) ExAllocatePool(PagedPool, bufferSize);
@@ -1621,6 +1640,52 @@ bool CFilterPath::MatchSpecial(CFilterPath const* candidate) const
 	return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+LPWSTR CFilterPathBuffer::Write(CFilterPath const* path, ULONG flags, ULONG *length)
+{
+	ASSERT(path);
+
+	PAGED_CODE();
+
+	// Drop previous content, if any
+	Close();
+
+	ULONG const bufferSize = path->GetLength(flags);
+
+	m_buffer = m_inline;
+
+	if(bufferSize > sizeof(m_inline))
+	{
+		m_buffer = (LPWSTR) ExAllocatePool(PagedPool, bufferSize);
+
+		if(!m_buffer)
+		{
+			return 0;
+		}
+	}
+
+	RtlZeroMemory(m_buffer, bufferSize);
+
+	ULONG const written = path->Write(m_buffer, bufferSize, flags);
+
+	if(!written)
+	{
+		Close();
+
+		return 0;
+	}
+
+	if(length)
+	{
+		*length = written;
+	}
+
+	return m_buffer;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #if DBG
 
@@ -1642,3 +1707,285 @@ void CFilterPath::Print(ULONG flags)
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Paths with growing directory names are written into a CFilterPathBuffer with each combination of
+ * flags, and must match what CopyTo and Write produce, with the same length. Those up to the inline
+ * size stay off the pool, longer ones take exactly one allocation. GetAutoConfig gives the same string
+ * with and without caller storage. A buffer written again frees a previous pool copy.
+ *
+ * The benchmark renders the AutoConfig key of a simulated create, as AutoConfigCheck does, from paths
+ * of typical lengths. It counts pool allocations and bytes per create with and without the buffer.
+ */
+static bool TestInit(CFilterPath *path, ULONG nameLength, ULONG depth)
+{
+	WCHAR buffer[1024];
+	ULONG curr = 0;
+
+	LPCWSTR const volume = L"\\Device\\HarddiskVolume1";
+
+	for(; volume[curr]; ++curr)
+	{
+		buffer[curr] = volume[curr];
+	}
+
+	for(ULONG level = 0; level < depth; ++level)
+	{
+		buffer[curr++] = L'\\';
+
+		for(ULONG pos = 0; pos < nameLength; ++pos)
+		{
+			buffer[curr++] = (WCHAR) (L'a' + (level + pos) % 26);
+		}
+	}
+
+	LPCWSTR const file = L"\\Report.doc";
+
+	for(ULONG pos = 0; file[pos]; ++pos)
+	{
+		buffer[curr++] = file[pos];
+	}
+
+	return NT_SUCCESS(path->InitClient(buffer, curr * sizeof(WCHAR)));
+}
+
+static ULONG TestAllocations()
+{
+	return CSimKernel::Statistics().Allocations;
+}
+
+static double TestTime(CFilterPath *paths, ULONG pathCount, bool storage, ULONG *allocations, ULONGLONG *bytes)
+{
+	enum { c_rounds = 200 };
+
+	ULONG const allocationsBefore  = CSimKernel::Statistics().Allocations;
+	ULONGLONG const bytesBefore	   = CSimKernel::Statistics().AllocatedBytes;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for(ULONG round = 0; round < c_rounds; ++round)
+	{
+		for(ULONG pos = 0; pos < pathCount; ++pos)
+		{
+			UNICODE_STRING autoConfig = {0,0,0};
+
+			if(storage)
+			{
+				CFilterPathBuffer buffer;
+				buffer.Init();
+
+				paths[pos].GetAutoConfig(&autoConfig, 0, &buffer);
+
+				buffer.Close();
+			}
+			else
+			{
+				paths[pos].GetAutoConfig(&autoConfig, 0);
+
+				ExFreePool(autoConfig.Buffer);
+			}
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	*allocations = CSimKernel::Statistics().Allocations - allocationsBefore;
+	*bytes		 = CSimKernel::Statistics().AllocatedBytes - bytesBefore;
+
+	return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (c_rounds * pathCount);
+}
+
+int main(void)
+{
+	enum { c_names = 160, c_paths = 64 };
+
+	CSimKernel::Init();
+
+	int failed = 0;
+
+	ULONG const flagSets[] = { CFilterPath::PATH_VOLUME | CFilterPath::PATH_FILE,
+							   CFilterPath::PATH_FILE,
+							   CFilterPath::PATH_VOLUME | CFilterPath::PATH_DIRECTORY,
+							   CFilterPath::PATH_VOLUME | CFilterPath::PATH_DEEPNESS,
+							   CFilterPath::PATH_VOLUME | CFilterPath::PATH_AUTOCONFIG,
+							   CFilterPath::PATH_AUTOCONFIG };
+	ULONG inlined = 0;
+	ULONG pooled  = 0;
+
+	for(ULONG nameLength = 1; nameLength < c_names; ++nameLength)
+	{
+		CFilterPath path;
+
+		if(!TestInit(&path, nameLength, 1 + nameLength % 3))
+		{
+			printf("ERROR ON INIT [%u]\n", nameLength);
+			failed++;
+			continue;
+		}
+
+		for(ULONG index = 0; index < sizeof(flagSets) / sizeof(flagSets[0]); ++index)
+		{
+			ULONG const flags = flagSets[index];
+
+			ULONG expectedLength = 0;
+			LPWSTR const expected = path.CopyTo(flags, &expectedLength);
+
+			CFilterPathBuffer buffer;
+			buffer.Init();
+
+			ULONG const allocations = TestAllocations();
+
+			ULONG length = 0;
+			LPWSTR const written = buffer.Write(&path, flags, &length);
+
+			bool const inside = (path.GetLength(flags) <= sizeof(buffer.m_inline));
+
+			if(!expected || !written || (written != buffer.m_buffer) || (length != expectedLength) || (length > path.GetLength(flags)) ||
+			   memcmp(written, expected, length) || written[length / sizeof(WCHAR) - 1])
+			{
+				printf("ERROR ON WRITE [%u 0x%x]\n", nameLength, flags);
+				failed++;
+			}
+
+			if((inside != (written == buffer.m_inline)) || (TestAllocations() - allocations != (inside ? 0u : 1u)))
+			{
+				printf("ERROR ON STORAGE [%u 0x%x]\n", nameLength, flags);
+				failed++;
+			}
+
+			inlined += inside;
+			pooled	+= !inside;
+
+			buffer.Close();
+
+			if(buffer.m_buffer)
+			{
+				printf("ERROR ON CLOSE [%u 0x%x]\n", nameLength, flags);
+				failed++;
+			}
+
+			if(expected)
+			{
+				ExFreePool(expected);
+			}
+		}
+
+		// Same key with and without storage
+		UNICODE_STRING pool	  = {0,0,0};
+		UNICODE_STRING stored = {0,0,0};
+
+		CFilterPathBuffer buffer;
+		buffer.Init();
+
+		if(NT_ERROR(path.GetAutoConfig(&pool)) || NT_ERROR(path.GetAutoConfig(&stored, 0, &buffer)) ||
+		   (pool.Length != stored.Length) || (pool.MaximumLength != stored.MaximumLength) ||
+		   (stored.Buffer != buffer.m_buffer) || memcmp(pool.Buffer, stored.Buffer, pool.MaximumLength))
+		{
+			printf("ERROR ON AUTOCONFIG [%u]\n", nameLength);
+			failed++;
+		}
+
+		if(pool.Buffer)
+		{
+			ExFreePool(pool.Buffer);
+		}
+
+		buffer.Close();
+
+		path.Close();
+	}
+
+	// Reused: a short path after a long one drops the pool copy, closing twice is harmless
+	CFilterPath shortPath;
+	CFilterPath longPath;
+
+	TestInit(&shortPath, 8, 1);
+	TestInit(&longPath, 100, 3);
+
+	LONG const outstanding = CSimKernel::Statistics().Outstanding;
+
+	CFilterPathBuffer buffer;
+	buffer.Init();
+
+	if(!buffer.Write(&longPath, CFilterPath::PATH_VOLUME | CFilterPath::PATH_FILE) || (buffer.m_buffer == buffer.m_inline) ||
+	   (CSimKernel::Statistics().Outstanding != outstanding + 1) ||
+	   !buffer.Write(&shortPath, CFilterPath::PATH_VOLUME | CFilterPath::PATH_FILE) || (buffer.m_buffer != buffer.m_inline) ||
+	   (CSimKernel::Statistics().Outstanding != outstanding) ||
+	   !buffer.Write(&longPath, CFilterPath::PATH_FILE) || (CSimKernel::Statistics().Outstanding != outstanding + 1))
+	{
+		printf("ERROR ON REUSE\n");
+		failed++;
+	}
+
+	buffer.Close();
+	buffer.Close();
+
+	if(CSimKernel::Statistics().Outstanding != outstanding)
+	{
+		printf("ERROR ON REUSE CLOSE\n");
+		failed++;
+	}
+
+	shortPath.Close();
+	longPath.Close();
+
+	if(!inlined || !pooled)
+	{
+		printf("ERROR ON COVERAGE [%u %u]\n", inlined, pooled);
+		failed++;
+	}
+
+	// Typical lengths, all within the inline size
+	CFilterPath paths[c_paths];
+
+	for(ULONG pos = 0; pos < c_paths; ++pos)
+	{
+		TestInit(paths + pos, 4 + (pos * 7) % 12, 1 + pos % 5);
+	}
+
+	ULONG allocations	= 0;
+	ULONGLONG bytes		= 0;
+	ULONG stored		= 0;
+	ULONGLONG storedBytes = 0;
+
+	double const pool	= TestTime(paths, c_paths, false, &allocations, &bytes);
+	double const inside = TestTime(paths, c_paths, true, &stored, &storedBytes);
+
+	ULONG const creates = 200 * c_paths;
+
+	printf("AutoConfig key   allocs/create  bytes/create  ns/create\n");
+	printf("pool             %13.2f  %12.1f  %9.1f\n", (double) allocations / creates, (double) bytes / creates, pool);
+	printf("path buffer      %13.2f  %12.1f  %9.1f\n", (double) stored / creates, (double) storedBytes / creates, inside);
+
+	if((allocations != creates) || (stored >= allocations / 4))
+	{
+		printf("ERROR ON BENCHMARK [%u %u]\n", allocations, stored);
+		failed++;
+	}
+
+	for(ULONG pos = 0; pos < c_paths; ++pos)
+	{
+		paths[pos].Close();
+	}
+
+	if(CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimKernel::Statistics().Outstanding);
+		failed++;
+	}
+
+	CSimKernel::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
@@ -15,6 +15,8 @@
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+class CFilterPathBuffer;
+
 class CFilterPath
 {
 public:
@@ -43,7 +45,7 @@ public:
 	ULONG					GetType() const;
 	NTSTATUS				SetType(ULONG type);
 	ULONG					GetLength(ULONG flags) const;
-	NTSTATUS				GetAutoConfig(UNICODE_STRING *autoConfig, ULONG flags = 0) const;
+	NTSTATUS				GetAutoConfig(UNICODE_STRING *autoConfig, ULONG flags = 0, CFilterPathBuffer *storage = 0) const;
 
 	bool					Match(CFilterPath const* candidate, bool exact) const;
 	bool					MatchSpecial(CFilterPath const* candidate) const;
@@ -74,6 +76,29 @@ public:
 
 	ULONG					m_deepness;			// -1 := infinite, otherwise max depth difference that match
 };
+
+////////////////////////////////////
+
+class CFilterPathBuffer
+{
+	// Receives a written path. Short ones stay in the inline storage, so that keys built for lookups
+	// during creates do not go to the pool. Must not be copied, as the buffer may point into itself.
+
+public:
+
+	enum c_constants		{	c_inline = 128,		// chars
+							};
+
+	void					Init();
+	void					Close();
+
+	LPWSTR					Write(CFilterPath const* path, ULONG flags, ULONG *length = 0);
+
+							// DATA
+	LPWSTR					m_buffer;			// either m_inline or pool
+	WCHAR					m_inline[c_inline];
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 inline
@@ -82,5 +107,22 @@ ULONG CFilterPath::GetType() const
 	return m_flags & (TRACK_TYPE_FILE | TRACK_TYPE_DIRECTORY);
 }
 
+inline
+void CFilterPathBuffer::Init()
+{
+	m_buffer = 0;
+}
+
+inline
+void CFilterPathBuffer::Close()
+{
+	if(m_buffer && (m_buffer != m_inline))
+	{
+		ExFreePool(m_buffer);
+	}
+
+	m_buffer = 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #endif // AFX_CFILTERPATH_H__79614BBC_7357_4922_9A59_CA05B3CF7200__INCLUDED_
\ No newline at end of file
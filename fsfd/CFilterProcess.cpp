@@ -417,6 +417,12 @@ NTSTATUS CFilterProcess::Add(ULONG pid, UNICODE_STRING const* image)
 		}
 		//µĹ
 		m_entries = entries;
+
+		// Search() found no free slot, the first new one is
+		if(~0u == pos)
+		{
+			pos = m_size;
+		}
 	}
 
 	///ASSERT(pos <= m_size);
@@ -607,6 +613,64 @@ LPCWSTR	CFilterProcess::Find(ULONG pid, ULONG *imageLength)
 
 ///////////////////////////////////////////////////////////////////////////////
 
+#pragma PAGEDCODE
+
+ULONG CFilterProcess::GetAppList(ULONG pid, ULONG generation)
+{
+	ASSERT(pid);
+	ASSERT(generation);
+
+	PAGED_CODE();
+
+	// Lock must be held
+
+	ULONG pos = ~0u;
+
+	if(Search(pid, &pos))
+	{
+		ASSERT(m_entries);
+		ASSERT(pos < m_capacity);
+
+		ULONG const appList = (ULONG) m_entries[pos].m_appList;
+
+		// Classified against current AppList?
+		if((appList >> 8) == (generation & 0xffffff))
+		{
+			return appList & 0xff;
+		}
+	}
+
+	return FILFILE_APP_INVALID;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterProcess::SetAppList(ULONG pid, ULONG generation, ULONG type)
+{
+	ASSERT(pid);
+	ASSERT(generation);
+	ASSERT(type <= 0xff);
+
+	PAGED_CODE();
+
+	// Lock must be held, shared is sufficient
+
+	ULONG pos = ~0u;
+
+	if(Search(pid, &pos))
+	{
+		ASSERT(m_entries);
+		ASSERT(pos < m_capacity);
+
+		// Generation and Type are updated together
+		InterlockedExchange(&m_entries[pos].m_appList, (LONG) ((generation << 8) | type));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 #pragma PAGEDCODE
 bool  CFilterProcess::IsTrustProcess(IRP *irp)
 {
@@ -32,6 +32,7 @@ class CFilterProcess
 
 		LPWSTR		m_image;
 		ULONG		m_imageLength;
+		LONG		m_appList;		// Cached AppList classification: Generation << 8 | Type
 		CFilterContextLink* m_link;//Ž̵ǰ 
 	};
 
@@ -53,6 +54,8 @@ public:
 	bool                GetFilterLink(ULONG pid,CFilterContextLink* link);
 	NTSTATUS				Remove(ULONG pid);
 	LPCWSTR					Find(ULONG pid, ULONG *imageLength);
+	ULONG					GetAppList(ULONG pid, ULONG generation);
+	void					SetAppList(ULONG pid, ULONG generation, ULONG type);
 	bool					Match(IRP *irp, UNICODE_STRING *image);
 
 	static CFilterProcess*	s_instance;
@@ -296,7 +296,7 @@ NTSTATUS CFilterRandomizer::Permutate()
 	RtlCopyMemory(key + 16, m_random, c_blockSize);
 
 	RijndealCoder<AES_256> aes;
-	C_ASSERT(c_blockSize == aes.c_blockSize);
+	C_ASSERT((ULONG) c_blockSize == (ULONG) aes.c_blockSize);
 
 	aes.Init(key, false);
 
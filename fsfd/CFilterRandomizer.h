@@ -57,6 +57,11 @@ private:
 inline
 NTSTATUS CFilterRandomizer::Init(bool high)
 {
+	m_random = 0;
+	m_size	 = 0;
+	m_next	 = 0;
+	m_fired	 = false;
+
 	ExInitializeFastMutex(&m_lock);
 
 	m_high = high;
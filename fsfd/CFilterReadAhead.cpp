@@ -0,0 +1,695 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterReadAhead.cpp: implementation of the CFilterReadAhead class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define DRIVER_USE_NTIFS	// use the NTIFS header
+#include "driver.h"
+
+#include "IoControl.h"
+#include "CFilterBase.h"
+#include "CFilterContext.h"
+#include "CFilterReadAhead.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// STATICS ////
+
+ULONG CFilterReadAhead::s_enabled = 0;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+CFilterReadAhead* CFilterReadAhead::Create()
+{
+	PAGED_CODE();
+
+	CFilterReadAhead *const readAhead = (CFilterReadAhead*) ExAllocatePool(NonPagedPool, sizeof(CFilterReadAhead));
+
+	if(readAhead)
+	{
+		RtlZeroMemory(readAhead, sizeof(CFilterReadAhead));
+
+		readAhead->m_next	 = -1;
+		readAhead->m_timeout = CFilterBase::GetTicksFromSeconds(c_timeout);
+
+		ExInitializeFastMutex(&readAhead->m_lock);
+	}
+
+	return readAhead;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+void CFilterReadAhead::Close()
+{
+	ASSERT(!m_filling);
+
+	Invalidate();
+
+	ExFreePool(this);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+void CFilterReadAhead::Invalidate()
+{
+	ExAcquireFastMutex(&m_lock);
+
+	// Void fills in progress
+	InterlockedIncrement(&m_writes);
+
+	m_size = 0;
+
+	// Buffer is in use while filling, the fill frees it instead
+	if(m_buffer && !m_filling)
+	{
+		// be paranoid
+		RtlZeroMemory(m_buffer, c_window + CFilterContext::c_blockSize);
+
+		ExFreePool(m_buffer);
+		m_buffer = 0;
+	}
+
+	ExReleaseFastMutex(&m_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterReadAhead::Read(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFilterContextLink const* link, CFilterCipher *cipher, LONGLONG vdl)
+{
+	ASSERT(extension);
+	ASSERT(irp);
+	ASSERT(link);
+	ASSERT(cipher);
+
+	PAGED_CODE();
+
+	IO_STACK_LOCATION const*const stack = IoGetCurrentIrpStackLocation(irp);
+	ASSERT(stack);
+
+	LONGLONG const offset = stack->Parameters.Read.ByteOffset.QuadPart;
+	ULONG const length	  = stack->Parameters.Read.Length;
+
+	// cooked VDL without Header
+	LONGLONG const valid = vdl - link->m_headerBlockSize;
+
+	// Only requests wholly within valid data
+	if(!length || (length > c_requestMax) || (offset < 0) || (offset + length > valid))
+	{
+		return STATUS_MORE_PROCESSING_REQUIRED;
+	}
+
+	LARGE_INTEGER tick;
+	KeQueryTickCount(&tick);
+
+	ExAcquireFastMutex(&m_lock);
+
+	m_sequential = (offset == m_next) ? m_sequential + 1 : 0;
+	m_next		 = offset + length;
+
+	NTSTATUS status = Serve(irp, valid, tick.LowPart);
+
+	// Sample before checking for writes in flight, their completion bumps it
+	LONG const volumeWrites = extension->Volume.m_writes;
+	LONG const writes		= m_writes;
+
+	bool fill = false;
+
+	if((STATUS_MORE_PROCESSING_REQUIRED == status) && !m_filling && (m_sequential >= c_sequential) && !extension->Volume.m_writesPending)
+	{
+		m_filling = true;
+		m_size	  = 0;
+
+		fill = true;
+	}
+
+	ExReleaseFastMutex(&m_lock);
+
+	if(fill)
+	{
+		status = Fill(extension, irp, link, cipher, valid, writes, volumeWrites, tick.LowPart);
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterReadAhead::Fill(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFilterContextLink const* link, CFilterCipher *cipher, LONGLONG valid, LONG writes, LONG volumeWrites, ULONG tick)
+{
+	ASSERT(extension);
+	ASSERT(irp);
+	ASSERT(link);
+	ASSERT(cipher);
+	ASSERT(m_filling);
+
+	PAGED_CODE();
+
+	IO_STACK_LOCATION const*const stack = IoGetCurrentIrpStackLocation(irp);
+	ASSERT(stack);
+
+	// Window covers the request, as it is not larger than the alignment
+	C_ASSERT(c_window >= c_align + c_requestMax);
+
+	LONGLONG const offset = stack->Parameters.Read.ByteOffset.QuadPart & ~((LONGLONG) c_align - 1);
+	ULONG size			  = c_window;
+	ULONG padding		  = 0;
+
+	if(offset + size >= valid)
+	{
+		size = (ULONG) (valid - offset);
+
+		// also read Padding, ignore Filler
+		padding = CFilterContext::ComputePadding((ULONG) (valid + link->m_headerBlockSize));
+	}
+
+	ASSERT(size);
+	ASSERT(padding <= CFilterContext::c_blockSize);
+
+	NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
+
+	// Only we use the buffer while filling
+	if(!m_buffer)
+	{
+		m_buffer = (UCHAR*) ExAllocatePool(NonPagedPool, c_window + CFilterContext::c_blockSize);
+	}
+
+	if(m_buffer)
+	{
+		MDL *const mdl = IoAllocateMdl(m_buffer, size + padding, false, false, 0);
+
+		if(mdl)
+		{
+			MmBuildMdlForNonPagedPool(mdl);
+
+			FILFILE_READ_WRITE readWrite;
+
+			readWrite.Buffer		 = m_buffer;
+			readWrite.Mdl			 = mdl;
+			readWrite.Offset.QuadPart = offset + link->m_headerBlockSize;
+			readWrite.Length		 = size + padding;
+			readWrite.Flags			 = IRP_NOCACHE | IRP_PAGING_IO | IRP_SYNCHRONOUS_PAGING_IO;
+			readWrite.Major			 = IRP_MJ_READ;
+			readWrite.Wait			 = true;
+
+			ULONG information = 0;
+
+			status = CFilterBase::ReadWrite(extension->Lower, stack->FileObject, &readWrite, &information);
+
+			IoFreeMdl(mdl);
+
+			// Truncated meanwhile?
+			if(NT_SUCCESS(status) && (information != size + padding))
+			{
+				DBGPRINT(("ReadAhead: short read [0x%x] of [0x%x]\n", information, size + padding));
+
+				status = STATUS_END_OF_FILE;
+			}
+
+			if(NT_SUCCESS(status))
+			{
+				FILFILE_CRYPT_CONTEXT crypt;
+				RtlZeroMemory(&crypt, sizeof(crypt));
+
+				crypt.Offset.QuadPart = offset;
+				crypt.Cipher		  = cipher;
+
+				status = CFilterContext::Decode(m_buffer, size + padding, &crypt);
+
+				extension->Volume.m_statistics.AddBytes(CFilterContext::CipherMode(&crypt), size + padding, false);
+			}
+		}
+	}
+
+	ExAcquireFastMutex(&m_lock);
+
+	m_filling = false;
+
+	// Written or invalidated meanwhile, or writes still in flight?
+	if(NT_SUCCESS(status) && (writes == m_writes) && (volumeWrites == extension->Volume.m_writes) && !extension->Volume.m_writesPending)
+	{
+		DBGPRINT(("ReadAhead: Window[0x%I64x] Size[0x%x]\n", offset, size));
+
+		m_offset = offset;
+		m_size	 = size;
+		m_valid	 = valid;
+		m_tick	 = tick;
+
+		status = Serve(irp, valid, tick);
+	}
+	else
+	{
+		status = STATUS_MORE_PROCESSING_REQUIRED;
+
+		if(m_buffer)
+		{
+			// be paranoid
+			RtlZeroMemory(m_buffer, c_window + CFilterContext::c_blockSize);
+
+			ExFreePool(m_buffer);
+			m_buffer = 0;
+		}
+	}
+
+	ExReleaseFastMutex(&m_lock);
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterReadAhead::Serve(IRP *irp, LONGLONG valid, ULONG tick)
+{
+	ASSERT(irp);
+
+	PAGED_CODE();
+
+	// Caller holds our lock
+
+	IO_STACK_LOCATION const*const stack = IoGetCurrentIrpStackLocation(irp);
+	ASSERT(stack);
+
+	LONGLONG const offset = stack->Parameters.Read.ByteOffset.QuadPart;
+	ULONG const length	  = stack->Parameters.Read.Length;
+
+	if(!m_size || (valid != m_valid) || (tick - m_tick > m_timeout))
+	{
+		return STATUS_MORE_PROCESSING_REQUIRED;
+	}
+
+	if((offset < m_offset) || (offset + length > m_offset + m_size))
+	{
+		return STATUS_MORE_PROCESSING_REQUIRED;
+	}
+
+	ASSERT(m_buffer);
+
+	UCHAR *target = (UCHAR*) irp->UserBuffer;
+
+	if(irp->MdlAddress)
+	{
+		target = (UCHAR*) MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority);
+	}
+
+	if(!target)
+	{
+		return STATUS_MORE_PROCESSING_REQUIRED;
+	}
+
+	__try
+	{
+		if(!irp->MdlAddress && (UserMode == irp->RequestorMode))
+		{
+			ProbeForWrite(target, length, 1);
+		}
+
+		RtlCopyMemory(target, m_buffer + (ULONG) (offset - m_offset), length);
+	}
+	__except(EXCEPTION_EXECUTE_HANDLER)
+	{
+		DBGPRINT(("ReadAhead -ERROR: UserBuffer access failed\n"));
+
+		return STATUS_INVALID_USER_BUFFER;
+	}
+
+	irp->IoStatus.Information = length;
+
+	FILE_OBJECT *const file = stack->FileObject;
+	ASSERT(file);
+
+	if(file->Flags & FO_SYNCHRONOUS_IO)
+	{
+		file->CurrentByteOffset.QuadPart = offset + length;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CSimFileSystem.h"
+
+/*
+ * A stream on the redirector of CSimFileSystem, with a latency per transfer and a bandwidth, is read
+ * through the window as the read path does: requests it does not serve go down directly and are decoded
+ * there. Sequential readers are served from the window once it is filled, everything read matches what
+ * was encrypted. Invalidation as on a write of the stream, a write on the volume completing during a fill,
+ * one still in flight and the stream truncated during a fill all keep stale data from being served.
+ * Finally the simulated throughput of sequential readers is compared with and without the window, per
+ * request size.
+ */
+enum
+{
+	c_testHeader	= 1024,
+	c_testSize		= 4 * 1024 * 1024,
+	c_testLatency	= 2000,			// microseconds per transfer
+	c_testBandwidth	= 100,			// MB/s
+};
+
+struct TestStream
+{
+	FILFILE_VOLUME_EXTENSION*	m_extension;
+	CFilterReadAhead*			m_readAhead;
+	CFilterContextLink			m_link;
+	CFilterCipher*				m_cipher;
+	HANDLE						m_handle;
+	FILE_OBJECT*				m_file;
+	LONGLONG					m_vdl;
+	ULONG						m_served;
+};
+
+static LPCWSTR const s_testPath = L"\\Device\\LanmanRedirector\\sim\\share\\stream.bin";
+
+static UCHAR TestByte(LONGLONG offset, ULONG seed)
+{
+	return (UCHAR) ((offset >> 9) * 31 + offset + seed);
+}
+
+static void TestContent(TestStream *stream, UCHAR *buffer, LONGLONG offset, ULONG length, ULONG seed)
+{
+	for(ULONG pos = 0; pos < length; ++pos)
+	{
+		buffer[pos] = TestByte(offset + pos, seed);
+	}
+
+	FILFILE_CRYPT_CONTEXT crypt;
+	RtlZeroMemory(&crypt, sizeof(crypt));
+
+	crypt.Offset.QuadPart = offset;
+	crypt.Nonce			  = stream->m_link.m_nonce;
+	crypt.Key			  = stream->m_link.m_fileKey;
+
+	CFilterContext::Encode(buffer, length, &crypt);
+}
+
+// Another client on the share writes it as the driver does, behind the Header: data and a Padding block
+static void TestWrite(TestStream *stream, ULONG seed)
+{
+	HANDLE handle = 0;
+	CSimKernel::Open(s_testPath, FILE_WRITE_DATA, FILE_SHARE_VALID_FLAGS, FILE_OPEN, FILE_NO_INTERMEDIATE_BUFFERING, &handle);
+
+	ULONG const size = c_testSize + CFilterContext::c_blockSize;
+
+	UCHAR *const data = (UCHAR*) malloc(size);
+
+	TestContent(stream, data, 0, size, seed);
+
+	CSimKernel::ReadWrite(handle, IRP_MJ_WRITE, c_testHeader, data, size);
+
+	free(data);
+
+	ZwClose(handle);
+
+	stream->m_vdl = c_testHeader + c_testSize;
+}
+
+// As a completed non-cached write on the volume during the fill
+static void TestWriteDuring(void *context)
+{
+	TestStream *const stream = (TestStream*) context;
+
+	stream->m_extension->Volume.ReadAheadWriteStart();
+
+	TestWrite(stream, 2);
+
+	stream->m_extension->Volume.ReadAheadWriteEnd();
+}
+
+static void TestTruncateDuring(void *context)
+{
+	TestStream *const stream = (TestStream*) context;
+
+	HANDLE handle = 0;
+	CSimKernel::Open(s_testPath, FILE_WRITE_DATA, FILE_SHARE_VALID_FLAGS, FILE_OPEN, 0, &handle);
+
+	FILE_END_OF_FILE_INFORMATION eof;
+	eof.EndOfFile.QuadPart = stream->m_vdl - 32768;
+
+	CSimKernel::Information(handle, IRP_MJ_SET_INFORMATION, FileEndOfFileInformation, &eof, sizeof(eof));
+
+	ZwClose(handle);
+}
+
+// One request of a reader, as the read path handles it. Returns the number of bytes matching seed
+static ULONG TestRead(TestStream *stream, LONGLONG offset, ULONG length, ULONG seed, bool readAhead = true)
+{
+	UCHAR *const buffer = (UCHAR*) malloc(length);
+
+	IRP *const irp = IoAllocateIrp(2, false);
+	IoSetNextIrpStackLocation(irp);
+
+	IO_STACK_LOCATION *const stack = IoGetCurrentIrpStackLocation(irp);
+
+	stack->MajorFunction					= IRP_MJ_READ;
+	stack->FileObject						= stream->m_file;
+	stack->Parameters.Read.ByteOffset.QuadPart = offset;
+	stack->Parameters.Read.Length			= length;
+
+	irp->UserBuffer	   = buffer;
+	irp->RequestorMode = KernelMode;
+
+	NTSTATUS status = STATUS_MORE_PROCESSING_REQUIRED;
+
+	if(readAhead)
+	{
+		status = stream->m_readAhead->Read(stream->m_extension, irp, &stream->m_link, stream->m_cipher, stream->m_vdl);
+	}
+
+	if(STATUS_SUCCESS == status)
+	{
+		stream->m_served++;
+	}
+	else if(STATUS_MORE_PROCESSING_REQUIRED == status)
+	{
+		status = CSimKernel::Page(stream->m_file, IRP_MJ_READ, offset + c_testHeader, buffer, length);
+
+		FILFILE_CRYPT_CONTEXT crypt;
+		RtlZeroMemory(&crypt, sizeof(crypt));
+
+		crypt.Offset.QuadPart = offset;
+		crypt.Nonce			  = stream->m_link.m_nonce;
+		crypt.Key			  = stream->m_link.m_fileKey;
+
+		CFilterContext::Decode(buffer, length, &crypt);
+	}
+
+	ULONG matching = 0;
+
+	for(ULONG pos = 0; NT_SUCCESS(status) && (pos < length); ++pos)
+	{
+		matching += (buffer[pos] == TestByte(offset + pos, seed));
+	}
+
+	IoFreeIrp(irp);
+	free(buffer);
+
+	return matching;
+}
+
+// Sequential reader over length bytes, simulated MB/s
+static double TestThroughput(TestStream *stream, ULONG request, bool readAhead)
+{
+	stream->m_readAhead->Invalidate();
+
+	LONGLONG const start = CSimKernel::Now();
+
+	for(LONGLONG offset = 0; offset < c_testSize; offset += request)
+	{
+		TestRead(stream, offset, request, 1, readAhead);
+	}
+
+	return (double) c_testSize * 10 / (CSimKernel::Now() - start);
+}
+
+int main(void)
+{
+	CSimKernel::Init();
+	CSimFileSystem::Init();
+	CSimFileSystem::AddRedirector();
+
+	int failed = 0;
+
+	TestStream stream;
+	RtlZeroMemory(&stream, sizeof(stream));
+
+	UCHAR key[32];
+	memset(key, 0x5a, sizeof(key));
+
+	stream.m_link.m_headerBlockSize = c_testHeader;
+	stream.m_link.m_nonce.QuadPart	= 0x1234567;
+	stream.m_link.m_fileKey.Init(FILFILE_CIPHER_SYM_AES256 | (CFilterContext::c_cipherMode << 16), key, sizeof(key));
+
+	// Fills decode through it, requests going down through a private copy of the key
+	stream.m_cipher = CFilterCipher::Create(&stream.m_link.m_fileKey, &stream.m_link.m_nonce);
+
+	// Header as stored by the driver, the stream is opened only after
+	UCHAR header[c_testHeader];
+	RtlZeroMemory(header, sizeof(header));
+
+	CSimFileSystem::AddFile(L"\\\\sim\\share\\stream.bin", header, sizeof(header));
+
+	TestWrite(&stream, 1);
+
+	CSimKernel::Open(s_testPath, FILE_READ_DATA, FILE_SHARE_VALID_FLAGS, FILE_OPEN, FILE_NO_INTERMEDIATE_BUFFERING, &stream.m_handle);
+	ObReferenceObjectByHandle(stream.m_handle, 0, *IoFileObjectType, KernelMode, (void**) &stream.m_file, 0);
+
+	stream.m_extension = (FILFILE_VOLUME_EXTENSION*) calloc(1, sizeof(FILFILE_VOLUME_EXTENSION));
+	stream.m_extension->Lower = CSimKernel::RelatedDevice(stream.m_file);
+
+	stream.m_readAhead = CFilterReadAhead::Create();
+
+	CSimFileSystem::SetLatency(c_testLatency, c_testBandwidth);
+
+	// Two requests go down, the third fills the window and the rest of it is served
+	ULONG matching = 0;
+
+	for(LONGLONG offset = 0; offset < CFilterReadAhead::c_window; offset += 4096)
+	{
+		matching += TestRead(&stream, offset, 4096, 1);
+	}
+
+	if((CFilterReadAhead::c_window != matching) || (CFilterReadAhead::c_window / 4096 - CFilterReadAhead::c_sequential != stream.m_served))
+	{
+		printf("ERROR ON SEQUENTIAL [%u] served[%u]\n", matching, stream.m_served);
+		failed++;
+	}
+
+	// Requests beyond the window fill the next one
+	stream.m_served = 0;
+
+	if((65536 != TestRead(&stream, CFilterReadAhead::c_window, 65536, 1)) || (1 != stream.m_served))
+	{
+		printf("ERROR ON NEXT WINDOW\n");
+		failed++;
+	}
+
+	// A write of the stream voids the window, the next request within it sees the new data
+	TestWrite(&stream, 2);
+	stream.m_readAhead->Invalidate();
+
+	if(4096 != TestRead(&stream, CFilterReadAhead::c_window + 65536, 4096, 2))
+	{
+		printf("ERROR ON INVALIDATE\n");
+		failed++;
+	}
+
+	// A write completing on the volume while the window is filled drops it, the request goes down
+	TestWrite(&stream, 1);
+	stream.m_readAhead->Invalidate();
+
+	TestRead(&stream, 0, 4096, 1);
+	TestRead(&stream, 4096, 4096, 1);
+
+	CSimFileSystem::SetHook(IRP_MJ_READ, TestWriteDuring, &stream);
+
+	stream.m_served = 0;
+	matching		= TestRead(&stream, 8192, 4096, 2);
+	matching	   += TestRead(&stream, 12288, 4096, 2);
+
+	if((8192 != matching) || (1 != stream.m_served))
+	{
+		printf("ERROR ON WRITE DURING FILL [%u] served[%u]\n", matching, stream.m_served);
+		failed++;
+	}
+
+	// No fill at all while a write is in flight
+	stream.m_readAhead->Invalidate();
+	stream.m_extension->Volume.ReadAheadWriteStart();
+
+	stream.m_served = 0;
+
+	for(LONGLONG offset = 0; offset < 8 * 4096; offset += 4096)
+	{
+		TestRead(&stream, offset, 4096, 2);
+	}
+
+	stream.m_extension->Volume.ReadAheadWriteEnd();
+
+	if(stream.m_served)
+	{
+		printf("ERROR ON WRITE PENDING [%u]\n", stream.m_served);
+		failed++;
+	}
+
+	// Truncated by another client during the fill: the short read publishes nothing
+	stream.m_readAhead->Invalidate();
+
+	TestRead(&stream, c_testSize - 4 * 4096, 4096, 2);
+	TestRead(&stream, c_testSize - 3 * 4096, 4096, 2);
+
+	CSimFileSystem::SetHook(IRP_MJ_READ, TestTruncateDuring, &stream);
+
+	stream.m_served = 0;
+
+	TestRead(&stream, c_testSize - 2 * 4096, 4096, 2);
+
+	if(stream.m_served)
+	{
+		printf("ERROR ON TRUNCATE\n");
+		failed++;
+	}
+
+	TestWrite(&stream, 1);
+
+	// Throughput of sequential readers, the server costing latency per transfer plus bandwidth
+	printf("request  direct[MB/s]  read-ahead[MB/s]  (%uus per transfer, %u MB/s)\n", c_testLatency, c_testBandwidth);
+
+	for(ULONG request = 4096; request <= CFilterReadAhead::c_requestMax; request *= 2)
+	{
+		double const direct = TestThroughput(&stream, request, false);
+		double const window = TestThroughput(&stream, request, true);
+
+		printf("%7u  %12.1f  %16.1f\n", request, direct, window);
+
+		if(window < direct)
+		{
+			printf("ERROR ON THROUGHPUT [%u]\n", request);
+			failed++;
+		}
+	}
+
+	stream.m_readAhead->Close();
+	stream.m_cipher->Release();
+
+	free(stream.m_extension);
+
+	ObDereferenceObject(stream.m_file);
+	ZwClose(stream.m_handle);
+
+	CSimKernel::Run();
+
+	if(CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimKernel::Statistics().Outstanding);
+		failed++;
+	}
+
+	CSimFileSystem::Close();
+	CSimKernel::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
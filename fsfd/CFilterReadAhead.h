@@ -0,0 +1,75 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterReadAhead.h: interface for the CFilterReadAhead class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilterReadAhead_H__8C3E5B27_41D9_4A6F_B2E0_7F19C6D4A853__INCLUDED_)
+#define AFX_CFilterReadAhead_H__8C3E5B27_41D9_4A6F_B2E0_7F19C6D4A853__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct CFilterContextLink;
+class CFilterCipher;
+struct FILFILE_VOLUME_EXTENSION;
+
+////////////////////////////////////
+
+class CFilterReadAhead
+{
+	// Decrypted window of a stream read non-cached on a redirector. Once some requests have followed each
+	// other, a larger aligned range is read and decrypted in one go, and the next requests are copied from
+	// it instead of going to the server one by one. Writes and size changes void the window, as do changes
+	// of the VDL and its age, since other clients may write to the file meanwhile. No window is filled while
+	// non-cached writes on the volume are in flight, and fills overlapping one are dropped at publish time.
+
+public:
+
+	enum c_constants
+	{
+		c_sequential		= 2,			// requests in a row before reading ahead
+		c_align				= 64 * 1024,	// window start, multiple of any data unit
+		c_window			= 4 * c_align,	// bytes
+		c_requestMax		= c_align,		// larger requests go down directly
+		c_timeout			= 1,			// seconds a window is used
+	};
+
+	static CFilterReadAhead*	Create();
+	void						Close();
+
+	NTSTATUS					Read(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFilterContextLink const* link, CFilterCipher *cipher, LONGLONG vdl);
+	void						Invalidate();
+
+								// STATIC
+	static ULONG				s_enabled;
+
+private:
+
+	NTSTATUS					Fill(FILFILE_VOLUME_EXTENSION *extension, IRP *irp, CFilterContextLink const* link, CFilterCipher *cipher, LONGLONG valid, LONG writes, LONG volumeWrites, ULONG tick);
+	NTSTATUS					Serve(IRP *irp, LONGLONG valid, ULONG tick);
+
+								// DATA
+	UCHAR*						m_buffer;			// NonPaged, c_window plus Padding
+	LONGLONG					m_offset;			// of window, without Header
+	ULONG						m_size;				// decrypted bytes, 0 := empty
+	LONGLONG					m_valid;			// cooked VDL at fill
+	ULONG						m_tick;				// at fill
+	ULONG						m_timeout;			// ticks
+
+	LONGLONG					m_next;				// offset expected from a sequential reader
+	ULONG						m_sequential;		// requests in a row
+	bool						m_filling;
+
+	LONG						m_writes;			// voids fills in progress
+
+	FAST_MUTEX					m_lock;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // !defined(AFX_CFilterReadAhead_H__8C3E5B27_41D9_4A6F_B2E0_7F19C6D4A853__INCLUDED_)
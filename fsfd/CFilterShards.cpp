@@ -0,0 +1,1287 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterShards.cpp: implementation of the CFilterShards class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define DRIVER_USE_NTIFS	// use the NTIFS header
+#include "driver.h"
+
+#include "IoControl.h"
+#include "CFilterBase.h"
+#include "CFilterShards.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+C_ASSERT(!(sizeof(CFilterShard) % SYSTEM_CACHE_ALIGNMENT_SIZE));
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterShards::Init()
+{
+	PAGED_CODE();
+
+	// Allocations of a page or more are page aligned, so every shard starts on its own cache line
+	m_shards = (CFilterShard*) ExAllocatePool(NonPagedPool, ROUND_TO_PAGES(c_shards * sizeof(CFilterShard)));
+
+	if(!m_shards)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlZeroMemory(m_shards, c_shards * sizeof(CFilterShard));
+
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG initialized = 0;
+
+	for(; initialized < c_shards; ++initialized)
+	{
+		CFilterShard *const shard = m_shards + initialized;
+
+		status = ExInitializeResourceLite(&shard->m_filesResource);
+
+		if(NT_ERROR(status))
+		{
+			break;
+		}
+
+		status = ExInitializeResourceLite(&shard->m_directoriesResource);
+
+		if(NT_ERROR(status))
+		{
+			ExDeleteResourceLite(&shard->m_filesResource);
+			break;
+		}
+
+		shard->m_files.Init();
+		shard->m_directories.Init();
+	}
+
+	if(NT_ERROR(status))
+	{
+		// Unwind initialized ones
+		for(ULONG index = 0; index < initialized; ++index)
+		{
+			ExDeleteResourceLite(&m_shards[index].m_directoriesResource);
+			ExDeleteResourceLite(&m_shards[index].m_filesResource);
+		}
+
+		ExFreePool(m_shards);
+		m_shards = 0;
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterShards::Close()
+{
+	PAGED_CODE();
+
+	if(!m_shards)
+	{
+		return;
+	}
+
+	FsRtlEnterFileSystem();
+
+	for(ULONG index = 0; index < c_shards; ++index)
+	{
+		CFilterShard *const shard = m_shards + index;
+
+		// free File Tracker
+		ExAcquireResourceExclusiveLite(&shard->m_filesResource, true);
+		shard->m_files.Close();
+		ExReleaseResourceLite(&shard->m_filesResource);
+		ExDeleteResourceLite(&shard->m_filesResource);
+
+		// free Directory Tracker
+		ExAcquireResourceExclusiveLite(&shard->m_directoriesResource, true);
+		shard->m_directories.Close();
+		ExReleaseResourceLite(&shard->m_directoriesResource);
+		ExDeleteResourceLite(&shard->m_directoriesResource);
+	}
+
+	FsRtlExitFileSystem();
+
+	ExFreePool(m_shards);
+	m_shards = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+ULONG CFilterShards::Files() const
+{
+	PAGED_CODE();
+
+	ULONG count = 0;
+
+	// Without locks, just a hint
+	for(ULONG index = 0; index < c_shards; ++index)
+	{
+		count += m_shards[index].m_files.Size();
+	}
+
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+ULONG CFilterShards::Directories() const
+{
+	PAGED_CODE();
+
+	ULONG count = 0;
+
+	// Without locks, just a hint
+	for(ULONG index = 0; index < c_shards; ++index)
+	{
+		count += m_shards[index].m_directories.Size();
+	}
+
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+bool CFilterShards::CheckIdentifier(ULONG entityIdentifier)
+{
+	PAGED_CODE();
+
+	bool found = false;
+
+	FsRtlEnterFileSystem();
+
+	for(ULONG index = 0; !found && (index < c_shards); ++index)
+	{
+		CFilterShard *const shard = m_shards + index;
+
+		if(shard->m_files.Size())
+		{
+			ExAcquireResourceSharedLite(&shard->m_filesResource, true);
+
+			found = shard->m_files.CheckIdentifier(entityIdentifier);
+
+			ExReleaseResourceLite(&shard->m_filesResource);
+		}
+	}
+
+	FsRtlExitFileSystem();
+
+	return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+bool CFilterShards::CheckSpecial(FILE_OBJECT *file, ULONG hash, ULONG *headerIdentifier)
+{
+	ASSERT(file);
+	ASSERT(headerIdentifier);
+
+	PAGED_CODE();
+
+	bool found = false;
+
+	FsRtlEnterFileSystem();
+
+	// Escaped files were tracked under another FCB, so look everywhere
+	for(ULONG index = 0; !found && (index < c_shards); ++index)
+	{
+		CFilterShard *const shard = m_shards + index;
+
+		if(shard->m_files.Size())
+		{
+			ExAcquireResourceSharedLite(&shard->m_filesResource, true);
+
+			ULONG pos = ~0u;
+
+			if(shard->m_files.CheckSpecial(file, &pos, hash))
+			{
+				CFilterFile *const filterFile = shard->m_files.Get(pos);
+				ASSERT(filterFile);
+
+				*headerIdentifier = filterFile->m_stream->m_link.m_headerIdentifier;
+
+				found = true;
+			}
+
+			ExReleaseResourceLite(&shard->m_filesResource);
+		}
+	}
+
+	FsRtlExitFileSystem();
+
+	return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+bool CFilterShards::SearchSpecial(ULONG hash, CFilterDirectory *directory)
+{
+	ASSERT(directory);
+
+	PAGED_CODE();
+
+	bool found = false;
+
+	FsRtlEnterFileSystem();
+
+	for(ULONG index = 0; !found && (index < c_shards); ++index)
+	{
+		CFilterShard *const shard = m_shards + index;
+
+		if(shard->m_directories.Size())
+		{
+			ExAcquireResourceSharedLite(&shard->m_directoriesResource, true);
+
+			ULONG pos = ~0u;
+
+			if(shard->m_directories.SearchSpecial(hash, &pos))
+			{
+				*directory = *shard->m_directories.Get(pos);
+
+				found = true;
+			}
+
+			ExReleaseResourceLite(&shard->m_directoriesResource);
+		}
+	}
+
+	FsRtlExitFileSystem();
+
+	return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterShards::UpdateEntity(ULONG currIdentifier, ULONG newIdentifier)
+{
+	PAGED_CODE();
+
+	FsRtlEnterFileSystem();
+
+	for(ULONG index = 0; index < c_shards; ++index)
+	{
+		CFilterShard *const shard = m_shards + index;
+
+		// update all DIRECTORIES that reference this Entity
+		if(shard->m_directories.Size())
+		{
+			ExAcquireResourceExclusiveLite(&shard->m_directoriesResource, true);
+
+			ULONG const count = shard->m_directories.Size();
+
+			for(ULONG pos = 0; pos < count; ++pos)
+			{
+				CFilterDirectory *const filterDirectory = shard->m_directories.Get(pos);
+				ASSERT(filterDirectory);
+
+				if(filterDirectory->m_entityIdentifier == currIdentifier)
+				{
+					filterDirectory->m_entityIdentifier = newIdentifier;
+				}
+			}
+
+			ExReleaseResourceLite(&shard->m_directoriesResource);
+		}
+
+		// update all FILES that reference this Entity, found through the index
+		if(shard->m_files.Size() && (currIdentifier != newIdentifier))
+		{
+			ExAcquireResourceExclusiveLite(&shard->m_filesResource, true);
+
+			for(CFilterStream *stream = shard->m_files.Next(currIdentifier); stream; )
+			{
+				CFilterStream *const next = shard->m_files.Next(currIdentifier, stream);
+
+				shard->m_files.Identify(shard->m_files.Slot(stream), newIdentifier);
+
+				stream = next;
+			}
+
+			ExReleaseResourceLite(&shard->m_filesResource);
+		}
+	}
+
+	FsRtlExitFileSystem();
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterShards::Purge(ULONG const* identifiers, ULONG count, ULONG flags)
+{
+	ASSERT(identifiers);
+	ASSERT(count);
+
+	PAGED_CODE();
+
+	ASSERT(flags & (ENTITY_DISCARD | ENTITY_PURGE));
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	// Zero selects every one, so there is nothing to look up
+	bool every = false;
+
+	for(ULONG index = 0; index < count; ++index)
+	{
+		if(!identifiers[index])
+		{
+			every = true;
+			break;
+		}
+	}
+
+	DBGPRINT(("Purge: Dirs[%d] Files[%d] EntityIdentifier[0x%x] Count[%d] Flags[0x%x]\n", Directories(),
+																						  Files(),
+																						  identifiers[0],
+																						  count,
+																						  flags));
+	FsRtlEnterFileSystem();
+
+	for(ULONG index = 0; index < c_shards; ++index)
+	{
+		CFilterShard *const shard = m_shards + index;
+
+		// Discard tracked FOs?
+		if(flags & ENTITY_DISCARD)
+		{
+			if(shard->m_directories.Size())
+			{
+				// Directories:
+				ExAcquireResourceExclusiveLite(&shard->m_directoriesResource, true);
+
+				for(ULONG pos = 0; pos < shard->m_directories.Size(); ++pos)
+				{
+					CFilterDirectory *const filterDirectory = shard->m_directories.Get(pos);
+					ASSERT(filterDirectory);
+
+					if(Match(identifiers, count, filterDirectory->m_entityIdentifier))
+					{
+						DBGPRINT(("Purge: Discard directory FO[0x%p]\n", filterDirectory->m_file));
+
+						shard->m_directories.Discard(pos);
+					}
+				}
+
+				// Remove all at once
+				shard->m_directories.Compact();
+
+				ExReleaseResourceLite(&shard->m_directoriesResource);
+			}
+
+			if(shard->m_files.Size())
+			{
+				// Files:
+				ExAcquireResourceExclusiveLite(&shard->m_filesResource, true);
+
+				if(every)
+				{
+					for(ULONG pos = 0; pos < shard->m_files.Size(); ++pos)
+					{
+						CFilterFile *const filterFile = shard->m_files.Get(pos);
+						ASSERT(filterFile);
+
+						if(filterFile)
+						{
+							DBGPRINT(("Purge: Discard file FO[0x%p]\n", filterFile->Tracked()));
+
+							shard->m_files.Discard(pos);
+						}
+					}
+				}
+				else
+				{
+					// Visit the files of the Entities only
+					for(ULONG index = 0; index < count; ++index)
+					{
+						for(CFilterStream *stream = shard->m_files.Next(identifiers[index]); stream; )
+						{
+							CFilterStream *const next = shard->m_files.Next(identifiers[index], stream);
+
+							DBGPRINT(("Purge: Discard file FCB[0x%p]\n", stream->m_fcb));
+
+							shard->m_files.Discard(shard->m_files.Slot(stream));
+
+							stream = next;
+						}
+					}
+				}
+
+				// Remove all at once
+				shard->m_files.Compact();
+
+				ExReleaseResourceLite(&shard->m_filesResource);
+			}
+
+			continue;
+		}
+
+		// Typical purge:
+
+		ASSERT(flags & ENTITY_PURGE);
+
+		// Directories:
+		if(shard->m_directories.Size())
+		{
+			ExAcquireResourceExclusiveLite(&shard->m_directoriesResource, true);
+
+			for(ULONG pos = 0; pos < shard->m_directories.Size(); ++pos)
+			{
+				CFilterDirectory *const filterDirectory = shard->m_directories.Get(pos);
+				ASSERT(filterDirectory);
+
+				if(Match(identifiers, count, filterDirectory->m_entityIdentifier))
+				{
+					DBGPRINT(("Purge: active DIRECTORY Reference, FO[0x%p]\n", filterDirectory->m_file));
+
+					// Invalidate identifier
+					filterDirectory->m_entityIdentifier = ~0u;
+				}
+			}
+
+			ExReleaseResourceLite(&shard->m_directoriesResource);
+		}
+
+		// Files:
+		if(shard->m_files.Size())
+		{
+			NTSTATUS const purged = PurgeFiles(shard, identifiers, count, every);
+
+			// Keep first failure
+			if(NT_SUCCESS(status))
+			{
+				status = purged;
+			}
+		}
+	}
+
+	FsRtlExitFileSystem();
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterShards::PurgeFiles(CFilterShard *shard, ULONG const* identifiers, ULONG count, bool every)
+{
+	ASSERT(shard);
+	ASSERT(identifiers);
+
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	// Phase 1: Take snapshot of currently tracked FOs that
+	// match given (every, if no specified) Entity identifier
+	ExAcquireSharedWaitForExclusive(&shard->m_filesResource, true);
+
+	FILE_OBJECT **snap = 0;
+	ULONG snapCount	   = 0;
+
+	if(every)
+	{
+		snapCount = shard->m_files.Size();
+	}
+	else
+	{
+		for(ULONG index = 0; index < count; ++index)
+		{
+			for(CFilterStream *stream = shard->m_files.Next(identifiers[index]); stream; stream = shard->m_files.Next(identifiers[index], stream))
+			{
+				snapCount++;
+			}
+		}
+	}
+
+	if(snapCount)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+
+		snap = (FILE_OBJECT**) ExAllocatePool(PagedPool, snapCount * sizeof(FILE_OBJECT*));
+
+		if(snap)
+		{
+			RtlZeroMemory(snap, snapCount * sizeof(FILE_OBJECT*));
+
+			status = STATUS_SUCCESS;
+
+			// Copy tracked FO into snapshot array
+			if(every)
+			{
+				for(ULONG index = 0; index < snapCount; ++index)
+				{
+					snap[index] = Cached(shard->m_files.Get(index));
+				}
+			}
+			else
+			{
+				ULONG taken = 0;
+
+				for(ULONG index = 0; index < count; ++index)
+				{
+					for(CFilterStream *stream = shard->m_files.Next(identifiers[index]); stream; stream = shard->m_files.Next(identifiers[index], stream))
+					{
+						ASSERT(taken < snapCount);
+
+						snap[taken++] = Cached(shard->m_files.Get(shard->m_files.Slot(stream)));
+					}
+				}
+			}
+
+			ExReleaseResourceLite(&shard->m_filesResource);
+			// Let exclusive waiters proceed first
+			ExAcquireSharedWaitForExclusive(&shard->m_filesResource, true);
+
+			// Phase 2: Purge FOs from our snapshot, but only those which are still tracked
+			for(ULONG index = 0; index < snapCount; ++index)
+			{
+				FILE_OBJECT *const file = snap[index];
+
+				// Valid?
+				if(file && file->FsContext)
+				{
+					// Still tracked?
+					if(shard->m_files.Check(file))
+					{
+						// Pin FO
+						ObReferenceObject(file);
+
+						// Do not block the close operation that could be triggered
+						ExReleaseResourceLite(&shard->m_filesResource);
+
+						DBGPRINT(("Purge: FO[0x%p] FCB[0x%p] at [%d] Flush/Purge\n", file, file->FsContext, index));
+
+						// Flush'n'Purge without pinning
+						if(NT_ERROR(CFilterBase::FlushAndPurgeCache(file, true, false)))
+						{
+							DBGPRINT(("Purge -WARN: FO[0x%p] purging has failed\n", file));
+
+							// Inform caller about
+							status = STATUS_OBJECT_NAME_COLLISION;
+						}
+
+						// Unpin FO
+						ObDereferenceObject(file);
+
+						ExAcquireSharedWaitForExclusive(&shard->m_filesResource, true);
+					}
+				}
+			}
+		}
+	}
+
+	ExReleaseResourceLite(&shard->m_filesResource);
+
+	if(snap)
+	{
+		ExFreePool(snap);
+	}
+
+	if(shard->m_files.Size())
+	{
+		ExAcquireResourceExclusiveLite(&shard->m_filesResource, true);
+
+		DBGPRINT(("Purge: active files [%d]\n", shard->m_files.Size()));
+
+		// Phase 3: Mark remaing FOs as doomed
+		if(every)
+		{
+			for(ULONG index = 0; index < shard->m_files.Size(); ++index)
+			{
+				Doom(shard, index);
+			}
+		}
+		else
+		{
+			for(ULONG index = 0; index < count; ++index)
+			{
+				for(CFilterStream *stream = shard->m_files.Next(identifiers[index]); stream; )
+				{
+					CFilterStream *const next = shard->m_files.Next(identifiers[index], stream);
+
+					// Leaves the index
+					Doom(shard, shard->m_files.Slot(stream));
+
+					stream = next;
+				}
+			}
+		}
+
+		// Remove orphaned ones at once, rather than moving the array per entry
+		shard->m_files.Compact();
+
+		ExReleaseResourceLite(&shard->m_filesResource);
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+FILE_OBJECT* CFilterShards::Cached(CFilterFile *filterFile)
+{
+	PAGED_CODE();
+
+	if(filterFile && filterFile->Tracked())
+	{
+		FILE_OBJECT *const file = filterFile->Tracked();
+
+		ASSERT(!CFilterBase::IsStackBased(file));
+
+		// Skip doomed ones
+		if(filterFile->m_stream->m_link.m_entityIdentifier != ~0u)
+		{
+			if(CFilterBase::IsCached(file))
+			{
+				return file;
+			}
+		}
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterShards::Doom(CFilterShard *shard, ULONG pos)
+{
+	ASSERT(shard);
+
+	PAGED_CODE();
+
+	CFilterFile *const filterFile = shard->m_files.Get(pos);
+
+	if(filterFile)
+	{
+		// Zero out sensitive data
+		filterFile->m_stream->m_link.m_fileKey.Clear();
+		filterFile->m_stream->m_link.m_nonce.QuadPart = 0;
+
+		if(filterFile->m_stream->m_cipher)
+		{
+			// Wiped once requests in flight are done
+			filterFile->m_stream->m_cipher->Release();
+			filterFile->m_stream->m_cipher = 0;
+		}
+
+		// Tag Entity identifier as doomed
+		shard->m_files.Identify(pos, ~0u);
+
+		if(!filterFile->m_refCount)
+		{
+			FILE_OBJECT *const file = filterFile->Tracked();
+
+			if(!file || !CFilterBase::IsCached(file))
+			{
+				DBGPRINT(("Purge: FO[0x%p] FCB[0x%p] Orphaned, remove\n", file, filterFile->m_fcb));
+
+				shard->m_files.Discard(pos);
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "CSimFixture.h"
+
+/*
+ * Shards are cache aligned and FCBs spread evenly over them, whatever the allocation granularity. All
+ * FOs of one FCB meet in the same shard. Files and directories of several Entities are tracked over
+ * all shards, and Entity wide operations find, rename, discard and purge them in every shard.
+ *
+ * The benchmark looks up tracked FOs from 1 to 64 threads on 1 to 16 volumes, a quarter of them under
+ * an exclusive lock as creates and closes do. It compares a lock per shard with a single lock for all
+ * volumes, as before. The kernel stand-in runs its ERESOURCEs on one thread, so a pthread rwlock takes
+ * the place of each.
+ *
+ * Discarding an Entity leaves the remaining files of each shard in FCB order, also where its files sit
+ * next to each other, and files of another Entity that shares its index list stay. The purge benchmark
+ * tracks 100k files and discards the ones of one Entity, from a single file to every second one. It
+ * visits them through the Entity index with holes compacted per shard, and as before scans every file
+ * and removes one at a time.
+ */
+static FILE_OBJECT* TestFile(void *fcb)
+{
+	FILE_OBJECT *const file = (FILE_OBJECT*) ExAllocatePool(NonPagedPool, sizeof(FILE_OBJECT));
+	RtlZeroMemory(file, sizeof(FILE_OBJECT));
+
+	file->FsContext = fcb;
+
+	return file;
+}
+
+static bool TestTrack(CFilterShards *shards, FILE_OBJECT *file, ULONG entityIdentifier)
+{
+	CFilterShard *const shard = shards->File(file);
+
+	ULONG pos = ~0u;
+
+	if(shard->m_files.Check(file, &pos))
+	{
+		return NT_SUCCESS(shard->m_files.Get(pos)->Track(file));
+	}
+
+	CFilterFile filterFile;
+
+	bool const added = CSimFixture::Track(&filterFile, file, entityIdentifier, 0) && NT_SUCCESS(shard->m_files.Add(&filterFile, pos));
+
+	filterFile.Close();
+
+	return added;
+}
+
+static bool TestTrackDirectory(CFilterShards *shards, FILE_OBJECT *file, ULONG entityIdentifier)
+{
+	CFilterDirectory directory;
+	RtlZeroMemory(&directory, sizeof(directory));
+
+	directory.m_file			 = file;
+	directory.m_entityIdentifier = entityIdentifier;
+
+	return NT_SUCCESS(shards->Directory(file)->m_directories.Add(&directory));
+}
+
+static ULONG TestCount(CFilterShards *shards, ULONG entityIdentifier)
+{
+	ULONG count = 0;
+
+	for(ULONG index = 0; index < CFilterShards::c_shards; ++index)
+	{
+		CFilterShard *const shard = shards->Get(index);
+
+		for(ULONG pos = 0; pos < shard->m_files.Size(); ++pos)
+		{
+			count += (shard->m_files.Get(pos)->m_stream->m_link.m_entityIdentifier == entityIdentifier);
+		}
+
+		for(ULONG pos = 0; pos < shard->m_directories.Size(); ++pos)
+		{
+			count += (shard->m_directories.Get(pos)->m_entityIdentifier == entityIdentifier);
+		}
+	}
+
+	return count;
+}
+
+static bool TestSpread(ULONG stride)
+{
+	enum { c_keys = 4096 };
+
+	ULONG counts[CFilterShards::c_shards] = { 0 };
+
+	CFilterShards shards;
+	shards.Init();
+
+	FILE_OBJECT file;
+	RtlZeroMemory(&file, sizeof(file));
+
+	// FCBs laid out back to back at given granularity
+	for(ULONG pos = 0; pos < c_keys; ++pos)
+	{
+		file.FsContext = (void*) (ULONG_PTR) (0x7f3a0000 + pos * stride);
+
+		counts[shards.File(&file) - shards.Get(0)]++;
+	}
+
+	shards.Close();
+
+	ULONG const mean = c_keys / CFilterShards::c_shards;
+
+	for(ULONG index = 0; index < CFilterShards::c_shards; ++index)
+	{
+		if((counts[index] < mean / 2) || (counts[index] > mean * 2))
+		{
+			printf("stride %u: shard %u holds %u of %u\n", stride, index, counts[index], c_keys);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct TestBench
+{
+	CFilterShards*		m_volumes;
+	FILE_OBJECT***		m_files;		// per volume
+	ULONG				m_volumeCount;
+	ULONG				m_fileCount;
+
+	pthread_rwlock_t*	m_locks;		// per shard of each volume, or a single one
+	bool				m_sharded;
+
+	ULONG				m_operations;	// per thread
+	unsigned int		m_seed;
+	ULONG				m_found;
+};
+
+static void* TestWorker(void *context)
+{
+	TestBench *const bench = (TestBench*) context;
+
+	unsigned int seed = bench->m_seed;
+	ULONG found = 0;
+
+	for(ULONG operation = 0; operation < bench->m_operations; ++operation)
+	{
+		ULONG const random = (ULONG) rand_r(&seed);
+
+		ULONG const volume = random % bench->m_volumeCount;
+		FILE_OBJECT *const file = bench->m_files[volume][(random >> 6) % bench->m_fileCount];
+
+		CFilterShard *const shard = bench->m_volumes[volume].File(file);
+
+		pthread_rwlock_t *const lock = bench->m_sharded ? bench->m_locks + volume * CFilterShards::c_shards + (shard - bench->m_volumes[volume].Get(0))
+														: bench->m_locks;
+		ULONG pos = ~0u;
+
+		if(!((random >> 20) & 3))
+		{
+			// Create or close
+			pthread_rwlock_wrlock(lock);
+
+			if(shard->m_files.Check(file, &pos))
+			{
+				shard->m_files.Get(pos)->m_tick++;
+				found++;
+			}
+		}
+		else
+		{
+			pthread_rwlock_rdlock(lock);
+
+			found += shard->m_files.Check(file, &pos);
+		}
+
+		pthread_rwlock_unlock(lock);
+	}
+
+	bench->m_found = found;
+
+	return 0;
+}
+
+static double TestTime(CFilterShards *volumes, FILE_OBJECT ***files, ULONG volumeCount, ULONG fileCount, ULONG threadCount, bool sharded)
+{
+	enum { c_operations = 1 << 18 };
+
+	ULONG const lockCount = sharded ? volumeCount * CFilterShards::c_shards : 1;
+
+	pthread_rwlock_t *const locks = (pthread_rwlock_t*) malloc(lockCount * sizeof(pthread_rwlock_t));
+
+	for(ULONG index = 0; index < lockCount; ++index)
+	{
+		pthread_rwlock_init(locks + index, 0);
+	}
+
+	TestBench *const benches = (TestBench*) calloc(threadCount, sizeof(TestBench));
+	pthread_t *const threads = (pthread_t*) calloc(threadCount, sizeof(pthread_t));
+
+	double const start = CSimFixture::Now();
+
+	for(ULONG index = 0; index < threadCount; ++index)
+	{
+		TestBench *const bench = benches + index;
+
+		bench->m_volumes	 = volumes;
+		bench->m_files		 = files;
+		bench->m_volumeCount = volumeCount;
+		bench->m_fileCount	 = fileCount;
+		bench->m_locks		 = locks;
+		bench->m_sharded	 = sharded;
+		bench->m_operations	 = c_operations / threadCount;
+		bench->m_seed		 = 17 + index;
+
+		pthread_create(threads + index, 0, TestWorker, bench);
+	}
+
+	ULONG found = 0;
+
+	for(ULONG index = 0; index < threadCount; ++index)
+	{
+		pthread_join(threads[index], 0);
+
+		found += benches[index].m_found;
+	}
+
+	double const ns = CSimFixture::Now() - start;
+
+	for(ULONG index = 0; index < lockCount; ++index)
+	{
+		pthread_rwlock_destroy(locks + index);
+	}
+
+	free(threads);
+	free(benches);
+	free(locks);
+
+	// Every FO is tracked
+	return (found != (c_operations / threadCount) * threadCount) ? 0 : (found * 1e3) / ns;
+}
+
+static bool TestSorted(CFilterShards *shards)
+{
+	for(ULONG index = 0; index < CFilterShards::c_shards; ++index)
+	{
+		CFilterShard *const shard = shards->Get(index);
+
+		for(ULONG pos = 1; pos < shard->m_files.Size(); ++pos)
+		{
+			if((ULONG_PTR) shard->m_files.Get(pos - 1)->m_fcb >= (ULONG_PTR) shard->m_files.Get(pos)->m_fcb)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static double TestPurgeTime(FILE_OBJECT *files, ULONG fileCount, ULONG every, bool batched)
+{
+	CFilterShards shards;
+	shards.Init();
+
+	// FCBs ascend, so each file is appended to its shard
+	for(ULONG pos = 0; pos < fileCount; ++pos)
+	{
+		RtlZeroMemory(files + pos, sizeof(FILE_OBJECT));
+		files[pos].FsContext = (void*) (ULONG_PTR) (0x10000000 + pos * 0x1a0);
+
+		TestTrack(&shards, files + pos, (pos % every) ? 2 : 1);
+	}
+
+	double const start = CSimFixture::Now();
+
+	if(batched)
+	{
+		shards.Purge(1, ENTITY_DISCARD);
+	}
+	else
+	{
+		for(ULONG index = 0; index < CFilterShards::c_shards; ++index)
+		{
+			CFilterFileCont *const tracked = &shards.Get(index)->m_files;
+
+			for(ULONG pos = 0; pos < tracked->Size(); )
+			{
+				if(1 == tracked->Get(pos)->m_stream->m_link.m_entityIdentifier)
+				{
+					tracked->Remove(pos);
+				}
+				else
+				{
+					pos++;
+				}
+			}
+		}
+	}
+
+	double const ms = (CSimFixture::Now() - start) / 1e6;
+
+	bool const valid = (shards.Files() == fileCount - (fileCount + every - 1) / every) && !TestCount(&shards, 1) && TestSorted(&shards);
+
+	shards.Close();
+
+	return valid ? ms : -1;
+}
+
+int main(void)
+{
+	enum { c_files = 512, c_volumes = 16, c_purgeFiles = 100000 };
+
+	CSimFixture::Init();
+
+	int failed = 0;
+
+	CFilterShards shards;
+
+	if(NT_ERROR(shards.Init()) || shards.Files() || shards.Directories())
+	{
+		printf("ERROR ON INIT\n");
+		failed++;
+	}
+
+	// Each shard on its own cache lines
+	for(ULONG index = 0; index < CFilterShards::c_shards; ++index)
+	{
+		if((ULONG_PTR) shards.Get(index) % SYSTEM_CACHE_ALIGNMENT_SIZE)
+		{
+			printf("ERROR ON ALIGNMENT [%u]\n", index);
+			failed++;
+		}
+	}
+
+	// Small pool blocks, FCB sized ones and whole pages
+	ULONG const strides[] = { 8, 16, 64, 0x1a0, 0x400, 0x1000, 0x10000 };
+
+	for(ULONG pos = 0; pos < sizeof(strides) / sizeof(strides[0]); ++pos)
+	{
+		if(!TestSpread(strides[pos]))
+		{
+			printf("ERROR ON SPREAD [0x%x]\n", strides[pos]);
+			failed++;
+		}
+	}
+
+	// Files of Entities 1 to 3, a second FO on every fourth FCB
+	void *fcbs[c_files];
+	FILE_OBJECT *files[c_files];
+	FILE_OBJECT *others[c_files] = { 0 };
+	FILE_OBJECT *directories[c_files / 4];
+
+	ULONG used = 0;
+
+	for(ULONG pos = 0; pos < c_files; ++pos)
+	{
+		fcbs[pos]  = ExAllocatePool(NonPagedPool, 0x1a0);
+		files[pos] = TestFile(fcbs[pos]);
+
+		if(!TestTrack(&shards, files[pos], 1 + pos % 3))
+		{
+			printf("ERROR ON TRACK [%u]\n", pos);
+			failed++;
+		}
+
+		if(!(pos % 4))
+		{
+			others[pos] = TestFile(fcbs[pos]);
+
+			if((shards.File(others[pos]) != shards.File(files[pos])) || !TestTrack(&shards, others[pos], 1 + pos % 3))
+			{
+				printf("ERROR ON SAME FCB [%u]\n", pos);
+				failed++;
+			}
+
+			directories[pos / 4] = TestFile(0);
+
+			if(!TestTrackDirectory(&shards, directories[pos / 4], 1 + pos % 3))
+			{
+				printf("ERROR ON TRACK DIRECTORY [%u]\n", pos);
+				failed++;
+			}
+		}
+	}
+
+	for(ULONG index = 0; index < CFilterShards::c_shards; ++index)
+	{
+		used += (0 != shards.Get(index)->m_files.Size());
+	}
+
+	if((c_files != shards.Files()) || (c_files / 4 != shards.Directories()) || (used != CFilterShards::c_shards))
+	{
+		printf("ERROR ON COUNT [%u %u %u]\n", shards.Files(), shards.Directories(), used);
+		failed++;
+	}
+
+	// Every FO is found in its shard, only there, FOs of one FCB share the entry
+	for(ULONG pos = 0; pos < c_files; ++pos)
+	{
+		CFilterShard *const shard = shards.File(files[pos]);
+
+		ULONG found = ~0u;
+
+		if(!shard->m_files.Check(files[pos], &found) || (shard->m_files.Get(found)->m_size != (others[pos] ? 2u : 1u)))
+		{
+			printf("ERROR ON CHECK [%u]\n", pos);
+			failed++;
+		}
+
+		for(ULONG index = 0; index < CFilterShards::c_shards; ++index)
+		{
+			if((shards.Get(index) != shard) && shards.Get(index)->m_files.Check(files[pos]))
+			{
+				printf("ERROR ON CHECK ELSEWHERE [%u]\n", pos);
+				failed++;
+			}
+		}
+	}
+
+	// Entity wide operations visit every shard
+	ULONG const twos = TestCount(&shards, 2);
+
+	if(!shards.CheckIdentifier(2) || shards.CheckIdentifier(4) || NT_ERROR(shards.UpdateEntity(2, 4)) ||
+	   shards.CheckIdentifier(2) || !shards.CheckIdentifier(4) || TestCount(&shards, 2) || (twos != TestCount(&shards, 4)))
+	{
+		printf("ERROR ON UPDATE\n");
+		failed++;
+	}
+
+	ULONG const ones = TestCount(&shards, 1);
+
+	if(NT_ERROR(shards.Purge(1, ENTITY_DISCARD)) || TestCount(&shards, 1) || shards.CheckIdentifier(1) ||
+	   (shards.Files() + shards.Directories() + ones != c_files + c_files / 4) || !TestSorted(&shards))
+	{
+		printf("ERROR ON DISCARD\n");
+		failed++;
+	}
+
+	// Not cached, so purging drops files and detaches directories
+	ULONG const identifiers[] = { 3, 4 };
+
+	if(NT_ERROR(shards.Purge(identifiers, 2, ENTITY_PURGE)) || shards.Files() || (TestCount(&shards, ~0u) != shards.Directories()) ||
+	   !shards.Directories())
+	{
+		printf("ERROR ON PURGE [%u %u]\n", shards.Files(), shards.Directories());
+		failed++;
+	}
+
+	// Files of the purged Entity back to back, in the middle and at both ends of each shard. The other
+	// Entity shares its index list
+	for(ULONG pos = 0; pos < c_files; ++pos)
+	{
+		RtlZeroMemory(files[pos], sizeof(FILE_OBJECT));
+		files[pos]->FsContext = (void*) (ULONG_PTR) (0x20000000 + pos * 0x1a0);
+
+		TestTrack(&shards, files[pos], ((pos < 64) || ((pos >= 200) && (pos < 300)) || (pos >= c_files - 64)) ? 5 : 37);
+	}
+
+	if(NT_ERROR(shards.Purge(5, ENTITY_DISCARD)) || TestCount(&shards, 5) || (TestCount(&shards, 37) != c_files - 228) ||
+	   (shards.Files() != c_files - 228) || !TestSorted(&shards))
+	{
+		printf("ERROR ON DISCARD ADJACENT [%u]\n", shards.Files());
+		failed++;
+	}
+
+	shards.Close();
+
+	// One Entity among 100k tracked files, purged in one pass and one file at a time
+	FILE_OBJECT *const purgeFiles = (FILE_OBJECT*) ExAllocatePool(NonPagedPool, c_purgeFiles * sizeof(FILE_OBJECT));
+
+	ULONG const everies[] = { 100000, 100, 10, 2 };
+
+	printf("tracked  purged  batched[ms]  each[ms]\n");
+
+	for(ULONG pos = 0; pos < sizeof(everies) / sizeof(everies[0]); ++pos)
+	{
+		double const batched = TestPurgeTime(purgeFiles, c_purgeFiles, everies[pos], true);
+		double const each	 = TestPurgeTime(purgeFiles, c_purgeFiles, everies[pos], false);
+
+		if((batched < 0) || (each < 0))
+		{
+			printf("ERROR ON PURGE BENCHMARK [%u]\n", everies[pos]);
+			failed++;
+		}
+
+		printf("%7u %7u  %11.2f  %8.2f\n", c_purgeFiles, (c_purgeFiles + everies[pos] - 1) / everies[pos], batched, each);
+	}
+
+	ExFreePool(purgeFiles);
+
+	// Lock per shard versus one for all volumes
+	CFilterShards *const volumes = (CFilterShards*) ExAllocatePool(NonPagedPool, c_volumes * sizeof(CFilterShards));
+	FILE_OBJECT ***const tracked = (FILE_OBJECT***) ExAllocatePool(NonPagedPool, c_volumes * sizeof(FILE_OBJECT**));
+
+	for(ULONG volume = 0; volume < c_volumes; ++volume)
+	{
+		volumes[volume].Init();
+
+		tracked[volume] = (FILE_OBJECT**) ExAllocatePool(NonPagedPool, c_files * sizeof(FILE_OBJECT*));
+
+		for(ULONG pos = 0; pos < c_files; ++pos)
+		{
+			tracked[volume][pos] = TestFile(ExAllocatePool(NonPagedPool, 0x1a0));
+
+			TestTrack(volumes + volume, tracked[volume][pos], 1);
+		}
+	}
+
+	ULONG const threadCounts[] = { 1, 4, 16, 64 };
+	ULONG const volumeCounts[] = { 1, 4, 16 };
+
+	printf("volumes threads  sharded[Mops/s]  global[Mops/s]\n");
+
+	for(ULONG volumePos = 0; volumePos < sizeof(volumeCounts) / sizeof(volumeCounts[0]); ++volumePos)
+	{
+		for(ULONG threadPos = 0; threadPos < sizeof(threadCounts) / sizeof(threadCounts[0]); ++threadPos)
+		{
+			double const sharded = TestTime(volumes, tracked, volumeCounts[volumePos], c_files, threadCounts[threadPos], true);
+			double const global	 = TestTime(volumes, tracked, volumeCounts[volumePos], c_files, threadCounts[threadPos], false);
+
+			if(!sharded || !global)
+			{
+				printf("ERROR ON BENCHMARK [%u %u]\n", volumeCounts[volumePos], threadCounts[threadPos]);
+				failed++;
+			}
+
+			printf("%7u %7u  %15.2f  %14.2f\n", volumeCounts[volumePos], threadCounts[threadPos], sharded, global);
+		}
+	}
+
+	printf("%ld processors\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	for(ULONG volume = 0; volume < c_volumes; ++volume)
+	{
+		for(ULONG pos = 0; pos < c_files; ++pos)
+		{
+			ExFreePool(tracked[volume][pos]->FsContext);
+			ExFreePool(tracked[volume][pos]);
+		}
+
+		ExFreePool(tracked[volume]);
+		volumes[volume].Close();
+	}
+
+	ExFreePool(tracked);
+	ExFreePool(volumes);
+
+	for(ULONG pos = 0; pos < c_files; ++pos)
+	{
+		ExFreePool(files[pos]);
+		ExFreePool(fcbs[pos]);
+
+		if(others[pos])
+		{
+			ExFreePool(others[pos]);
+		}
+	}
+
+	for(ULONG pos = 0; pos < c_files / 4; ++pos)
+	{
+		ExFreePool(directories[pos]);
+	}
+
+	failed += CSimFixture::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
@@ -0,0 +1,144 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterShards.h: interface for the CFilterShards class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilterShards_H__6D1A93C7_3E58_4B2F_A0C4_85F7E2B19D63__INCLUDED_)
+#define AFX_CFilterShards_H__6D1A93C7_3E58_4B2F_A0C4_85F7E2B19D63__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "CFilterFile.h"
+#include "CFilterDirectory.h"
+
+////////////////////////////////////
+
+struct DECLSPEC_CACHEALIGN CFilterShard
+{
+	CFilterFileCont				m_files;			// Tracked file streams, sorted by FCB
+	ERESOURCE					m_filesResource;
+
+	CFilterDirectoryCont		m_directories;		// Tracked directories, sorted by FO
+	ERESOURCE					m_directoriesResource;
+};
+
+////////////////////////////////////
+
+class CFilterShards
+{
+	// Tracked files and directories of one volume. Files are distributed over the shards by their FCB,
+	// directories by their FO, so that unrelated creates, reads and closes do not contend for the same
+	// lock. Operations on Entities, which have no single FCB, visit every shard in turn and find the files
+	// of the Entity there through the index of CFilterFileCont.
+
+public:
+
+	enum c_constants
+	{
+		c_shards					= 16,		// power of two
+	};
+
+	NTSTATUS					Init();
+	void						Close();
+
+	CFilterShard*				File(FILE_OBJECT const* file) const;
+	CFilterShard*				Directory(FILE_OBJECT const* directory) const;
+	CFilterShard*				Get(ULONG index) const;
+
+	ULONG						Files() const;
+	ULONG						Directories() const;
+
+	bool						CheckIdentifier(ULONG entityIdentifier);
+	bool						CheckSpecial(FILE_OBJECT *file, ULONG hash, ULONG *headerIdentifier);
+	bool						SearchSpecial(ULONG hash, CFilterDirectory *directory);
+
+	NTSTATUS					UpdateEntity(ULONG currIdentifier, ULONG newIdentifier);
+	NTSTATUS					Purge(ULONG entityIdentifier, ULONG flags);
+	NTSTATUS					Purge(ULONG const* identifiers, ULONG count, ULONG flags);
+
+private:
+
+	NTSTATUS					PurgeFiles(CFilterShard *shard, ULONG const* identifiers, ULONG count, bool every);
+	void						Doom(CFilterShard *shard, ULONG pos);
+
+	static FILE_OBJECT*			Cached(CFilterFile *filterFile);
+
+	static ULONG				Index(void const* key);
+	static bool					Match(ULONG const* identifiers, ULONG count, ULONG entityIdentifier);
+
+								// DATA
+	CFilterShard*				m_shards;			// NonPaged, c_shards entries
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+ULONG CFilterShards::Index(void const* key)
+{
+	// Pool blocks are at least 8 byte aligned, so mix in the higher bits
+	ULONG const value = (ULONG)((ULONG_PTR) key >> 3);
+
+	return ((value * 0x9e3779b1) >> 24) & (c_shards - 1);
+}
+
+inline
+bool CFilterShards::Match(ULONG const* identifiers, ULONG count, ULONG entityIdentifier)
+{
+	ASSERT(identifiers);
+
+	for(ULONG index = 0; index < count; ++index)
+	{
+		// Zero selects every one
+		if(!identifiers[index] || (identifiers[index] == entityIdentifier))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+inline
+NTSTATUS CFilterShards::Purge(ULONG entityIdentifier, ULONG flags)
+{
+	ASSERT(entityIdentifier != ~0u);
+
+	return Purge(&entityIdentifier, 1, flags);
+}
+
+inline
+CFilterShard* CFilterShards::File(FILE_OBJECT const* file) const
+{
+	ASSERT(file);
+	ASSERT(m_shards);
+
+	return m_shards + Index(file->FsContext);
+}
+
+inline
+CFilterShard* CFilterShards::Directory(FILE_OBJECT const* directory) const
+{
+	ASSERT(m_shards);
+
+	return m_shards + Index(directory);
+}
+
+inline
+CFilterShard* CFilterShards::Get(ULONG index) const
+{
+	ASSERT(index < c_shards);
+	ASSERT(m_shards);
+
+	return m_shards + index;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilterShards_H__6D1A93C7_3E58_4B2F_A0C4_85F7E2B19D63__INCLUDED_)
@@ -0,0 +1,1129 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterSizeCache.cpp: implementation of the CFilterSizeCache class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define DRIVER_USE_NTIFS	// use the NTIFS header
+#include "driver.h"
+
+#include "CFilterBase.h"
+#include "CFilterPath.h"
+#include "CFilterSizeCache.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+ULONG CFilterSizeCache::CFilterSizeSnapshot::Get(LPCWSTR name, ULONG nameLength, ULONG blockSize) const
+{
+	ASSERT(name);
+
+	PAGED_CODE();
+
+	if(m_count && nameLength)
+	{
+		ASSERT(m_files);
+
+		ULONG const pos = SearchFile(m_files, m_count, CFilterBase::Hash(name, nameLength), name, nameLength);
+
+		if(pos != ~0u)
+		{
+			ASSERT(pos < m_count);
+
+			blockSize = m_files[pos].m_blockSize;
+		}
+	}
+
+	return blockSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterSizeCache::CFilterSizeSnapshot::Close()
+{
+	PAGED_CODE();
+
+	// Names follow the files in the same block
+	if(m_files)
+	{
+		ExFreePool(m_files);
+	}
+
+	m_files = 0;
+	m_count = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterSizeCache::Init()
+{
+	PAGED_CODE();
+
+	RtlZeroMemory(this, sizeof(*this));
+
+	// translate seconds to ticks
+	m_timeout = CFilterBase::GetTicksFromSeconds(c_timeout);
+
+	return ExInitializeResourceLite(&m_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterSizeCache::Close()
+{
+	PAGED_CODE();
+
+	Clear();
+
+	FsRtlEnterFileSystem();
+	ExDeleteResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterSizeCache::Clear()
+{
+	PAGED_CODE();
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceExclusiveLite(&m_lock, true);
+
+	for(ULONG index = 0; index < c_directories; ++index)
+	{
+		CFilterSizeCacheDirectory *const directory = m_directories + index;
+
+		if(directory->m_files)
+		{
+			FreeFiles(directory);
+
+			ExFreePool(directory->m_files);
+		}
+
+		RtlZeroMemory(directory, sizeof(*directory));
+	}
+
+	m_count = 0;
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+ULONG CFilterSizeCache::DirectoryHash(CFilterPath const* path, bool directory)
+{
+	ASSERT(path);
+
+	PAGED_CODE();
+
+	ULONG hash = 0;
+
+	ULONG const volumeLength = path->m_volumeLength / sizeof(WCHAR);
+
+	for(ULONG index = 0; index < volumeLength; ++index)
+	{
+		hash = CFilterBase::HashChar(hash, path->m_volume[index]);
+	}
+
+	ULONG directoryLength = path->m_directoryLength / sizeof(WCHAR);
+
+	if(path->m_directory && directoryLength)
+	{
+		// Ignore trailing backslash, except on root
+		if((directoryLength > 1) && (path->m_directory[directoryLength - 1] == L'\\'))
+		{
+			directoryLength--;
+		}
+
+		for(ULONG index = 0; index < directoryLength; ++index)
+		{
+			hash = CFilterBase::HashChar(hash, path->m_directory[index]);
+		}
+	}
+	else
+	{
+		hash = CFilterBase::HashChar(hash, L'\\');
+
+		directoryLength = 1;
+	}
+
+	// Directory opens may come with their last component split off
+	if(directory && path->m_file && path->m_fileLength)
+	{
+		if(directoryLength > 1)
+		{
+			hash = CFilterBase::HashChar(hash, L'\\');
+		}
+
+		ULONG const fileLength = path->m_fileLength / sizeof(WCHAR);
+
+		for(ULONG index = 0; index < fileLength; ++index)
+		{
+			hash = CFilterBase::HashChar(hash, path->m_file[index]);
+		}
+	}
+
+	// Zero marks unused groups
+	return (hash) ? hash : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+ULONG CFilterSizeCache::SearchFile(CFilterSizeCacheFile const* files, ULONG count, ULONG hash, LPCWSTR name, ULONG nameLength, ULONG *insert)
+{
+	ASSERT(name);
+
+	PAGED_CODE();
+
+	ULONG start = 0;
+	ULONG end   = count;
+
+	// Sorted by hash, binary search for first candidate
+	while(start < end)
+	{
+		ULONG const middle = start + ((end - start) >> 1);
+
+		ASSERT(files);
+
+		if(files[middle].m_hash < hash)
+		{
+			start = middle + 1;
+		}
+		else
+		{
+			end = middle;
+		}
+	}
+
+	if(insert)
+	{
+		*insert = start;
+	}
+
+	for(; (start < count) && (files[start].m_hash == hash); ++start)
+	{
+		ASSERT(files[start].m_name);
+
+		// Hashes collide, names do not
+		if((files[start].m_nameLength == nameLength) && !_wcsnicmp(files[start].m_name, name, nameLength / sizeof(WCHAR)))
+		{
+			return start;
+		}
+	}
+
+	return ~0u;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+bool CFilterSizeCache::RemoveFile(CFilterSizeCacheDirectory *directory, ULONG hash, LPCWSTR name, ULONG nameLength)
+{
+	ASSERT(directory);
+	ASSERT(name);
+
+	PAGED_CODE();
+
+	// Lock must be held exclusively
+
+	ULONG const pos = SearchFile(directory->m_files, directory->m_count, hash, name, nameLength);
+
+	if(pos == ~0u)
+	{
+		return false;
+	}
+
+	ASSERT(pos < directory->m_count);
+
+	ExFreePool(directory->m_files[pos].m_name);
+
+	directory->m_count--;
+
+	RtlMoveMemory(directory->m_files + pos,
+				  directory->m_files + pos + 1,
+				  (directory->m_count - pos) * sizeof(CFilterSizeCacheFile));
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterSizeCache::FreeFiles(CFilterSizeCacheDirectory *directory)
+{
+	ASSERT(directory);
+
+	PAGED_CODE();
+
+	for(ULONG index = 0; index < directory->m_count; ++index)
+	{
+		ASSERT(directory->m_files[index].m_name);
+
+		ExFreePool(directory->m_files[index].m_name);
+	}
+
+	directory->m_count = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+CFilterSizeCache::CFilterSizeCacheDirectory* CFilterSizeCache::Search(ULONG hash, ULONG tick)
+{
+	ASSERT(hash);
+
+	PAGED_CODE();
+
+	for(ULONG index = 0; index < c_directories; ++index)
+	{
+		CFilterSizeCacheDirectory *const directory = m_directories + index;
+
+		if(directory->m_hash == hash)
+		{
+			// Expired? A newer group may follow
+			if(tick - directory->m_tick > m_timeout)
+			{
+				continue;
+			}
+
+			return directory;
+		}
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterSizeCache::Update(CFilterPath const* path, ULONG blockSize, ULONG entityBlockSize)
+{
+	ASSERT(path);
+	ASSERT(blockSize);
+
+	PAGED_CODE();
+
+	// Listings show the default stream only
+	if(!path->m_file || !path->m_fileLength || (path->m_flags & TRACK_ALTERNATE_STREAM))
+	{
+		return STATUS_SUCCESS;
+	}
+
+	// Files using their Entity's Header are handled by the default path
+	bool const differs = !entityBlockSize || (blockSize != entityBlockSize);
+
+	if(!differs && !m_count)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	ULONG const directoryHash = DirectoryHash(path, false);
+	ULONG const hash		  = CFilterBase::Hash(path->m_file, path->m_fileLength);
+
+	LARGE_INTEGER tick;
+	KeQueryTickCount(&tick);
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceExclusiveLite(&m_lock, true);
+
+	CFilterSizeCacheDirectory *directory = Search(directoryHash, tick.LowPart);
+
+	if(!differs)
+	{
+		if(directory)
+		{
+			RemoveFile(directory, hash, path->m_file, path->m_fileLength);
+		}
+
+		ExReleaseResourceLite(&m_lock);
+		FsRtlExitFileSystem();
+
+		return STATUS_SUCCESS;
+	}
+
+	if(!directory)
+	{
+		// Use unused, expired or else the oldest group
+		ULONG oldest = 0;
+
+		for(ULONG index = 0; index < c_directories; ++index)
+		{
+			CFilterSizeCacheDirectory *const candidate = m_directories + index;
+
+			if(!candidate->m_hash || (tick.LowPart - candidate->m_tick > m_timeout))
+			{
+				oldest = index;
+				break;
+			}
+
+			if(tick.LowPart - candidate->m_tick > tick.LowPart - m_directories[oldest].m_tick)
+			{
+				oldest = index;
+			}
+		}
+
+		directory = m_directories + oldest;
+
+		if(!directory->m_hash)
+		{
+			m_count++;
+		}
+
+		FreeFiles(directory);
+
+		directory->m_hash = directoryHash;
+	}
+
+	directory->m_tick = tick.LowPart;
+
+	ULONG insert = 0;
+	ULONG const pos = SearchFile(directory->m_files, directory->m_count, hash, path->m_file, path->m_fileLength, &insert);
+
+	if(pos != ~0u)
+	{
+		directory->m_files[pos].m_blockSize = blockSize;
+	}
+	else
+	{
+		// Full? Start over rather than tracking age per file
+		if(directory->m_count >= c_files)
+		{
+			FreeFiles(directory);
+
+			insert = 0;
+		}
+
+		LPWSTR const name = (LPWSTR) ExAllocatePool(PagedPool, path->m_fileLength);
+
+		if(name)
+		{
+			RtlCopyMemory(name, path->m_file, path->m_fileLength);
+		}
+		else
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		if(NT_SUCCESS(status) && (directory->m_count == directory->m_capacity))
+		{
+			ULONG const capacity = directory->m_capacity + c_increment;
+
+			CFilterSizeCacheFile *const files = (CFilterSizeCacheFile*) ExAllocatePool(PagedPool, capacity * sizeof(CFilterSizeCacheFile));
+
+			if(files)
+			{
+				if(directory->m_files)
+				{
+					RtlCopyMemory(files, directory->m_files, directory->m_count * sizeof(CFilterSizeCacheFile));
+
+					ExFreePool(directory->m_files);
+				}
+
+				directory->m_files	  = files;
+				directory->m_capacity = capacity;
+			}
+			else
+			{
+				status = STATUS_INSUFFICIENT_RESOURCES;
+			}
+		}
+
+		if(NT_SUCCESS(status))
+		{
+			ASSERT(directory->m_count < directory->m_capacity);
+			ASSERT(insert <= directory->m_count);
+
+			RtlMoveMemory(directory->m_files + insert + 1,
+						  directory->m_files + insert,
+						  (directory->m_count - insert) * sizeof(CFilterSizeCacheFile));
+
+			CFilterSizeCacheFile *const file = directory->m_files + insert;
+
+			file->m_hash	   = hash;
+			file->m_nameLength = path->m_fileLength;
+			file->m_blockSize  = blockSize;
+			file->m_name	   = name;
+
+			directory->m_count++;
+		}
+		else if(name)
+		{
+			ExFreePool(name);
+		}
+	}
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterSizeCache::Snapshot(ULONG directoryHash, CFilterSizeSnapshot *snapshot)
+{
+	ASSERT(snapshot);
+
+	PAGED_CODE();
+
+	snapshot->m_files = 0;
+	snapshot->m_count = 0;
+
+	if(!m_count || !directoryHash)
+	{
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	LARGE_INTEGER tick;
+	KeQueryTickCount(&tick);
+
+	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceSharedLite(&m_lock, true);
+
+	CFilterSizeCacheDirectory const*const directory = Search(directoryHash, tick.LowPart);
+
+	if(directory && directory->m_count)
+	{
+		ULONG size = directory->m_count * sizeof(CFilterSizeCacheFile);
+
+		for(ULONG index = 0; index < directory->m_count; ++index)
+		{
+			size += directory->m_files[index].m_nameLength;
+		}
+
+		// Copy, so that no lock is held while touching the user buffer. Names follow the files
+		snapshot->m_files = (CFilterSizeCacheFile*) ExAllocatePool(PagedPool, size);
+
+		if(snapshot->m_files)
+		{
+			RtlCopyMemory(snapshot->m_files, directory->m_files, directory->m_count * sizeof(CFilterSizeCacheFile));
+
+			UCHAR *name = (UCHAR*) (snapshot->m_files + directory->m_count);
+
+			for(ULONG index = 0; index < directory->m_count; ++index)
+			{
+				CFilterSizeCacheFile *const file = snapshot->m_files + index;
+
+				RtlCopyMemory(name, file->m_name, file->m_nameLength);
+
+				file->m_name = (LPWSTR) name;
+				name		+= file->m_nameLength;
+			}
+
+			snapshot->m_count = directory->m_count;
+
+			status = STATUS_SUCCESS;
+		}
+		else
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+		}
+	}
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterSizeCache::Remove(FILFILE_VOLUME_EXTENSION *extension, FILE_OBJECT *file)
+{
+	ASSERT(extension);
+	ASSERT(file);
+
+	PAGED_CODE();
+
+	if(!m_count)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	FILE_NAME_INFORMATION *fileNameInfo = 0;
+	NTSTATUS status = CFilterBase::QueryFileNameInfo(extension->Lower, file, &fileNameInfo);
+
+	if(NT_SUCCESS(status))
+	{
+		ASSERT(fileNameInfo);
+
+		CFilterPath path;
+
+		// Parsed as tracked files have theirs
+		status = path.Init(fileNameInfo->FileName, 
+						   fileNameInfo->FileNameLength, 
+						   extension->LowerType,
+						   &extension->LowerName);
+
+		if(NT_SUCCESS(status))
+		{
+			// Split off the last component, be it a file or directory
+			status = path.SetType(TRACK_TYPE_FILE);
+
+			if(NT_SUCCESS(status))
+			{
+				status = Remove(&path);
+			}
+
+			path.Close();
+		}
+
+		ExFreePool(fileNameInfo);
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterSizeCache::Remove(CFilterPath const* path)
+{
+	ASSERT(path);
+
+	PAGED_CODE();
+
+	if(!m_count || !path->m_file || !path->m_fileLength)
+	{
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	ULONG const directoryHash = DirectoryHash(path, false);
+	ULONG const groupHash	  = DirectoryHash(path, true);
+	ULONG const hash		  = CFilterBase::Hash(path->m_file, path->m_fileLength);
+
+	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceExclusiveLite(&m_lock, true);
+
+	for(ULONG index = 0; index < c_directories; ++index)
+	{
+		CFilterSizeCacheDirectory *const directory = m_directories + index;
+
+		if(!directory->m_hash)
+		{
+			continue;
+		}
+
+		// The file itself
+		if(directory->m_hash == directoryHash)
+		{
+			if(RemoveFile(directory, hash, path->m_file, path->m_fileLength))
+			{
+				status = STATUS_SUCCESS;
+			}
+		}
+		// or a directory, whose files are now elsewhere
+		else if(directory->m_hash == groupHash)
+		{
+			FreeFiles(directory);
+
+			if(directory->m_files)
+			{
+				ExFreePool(directory->m_files);
+			}
+
+			RtlZeroMemory(directory, sizeof(*directory));
+
+			ASSERT(m_count);
+			m_count--;
+
+			status = STATUS_SUCCESS;
+		}
+	}
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterSizeCache::Remove(LPCWSTR name, ULONG nameLength)
+{
+	ASSERT(name);
+
+	PAGED_CODE();
+
+	// Last component only, as targets come in any form
+	ULONG start = nameLength / sizeof(WCHAR);
+
+	while(start && (name[start - 1] != L'\\'))
+	{
+		start--;
+	}
+
+	name	   += start;
+	nameLength -= start * sizeof(WCHAR);
+
+	if(!m_count || !nameLength)
+	{
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	ULONG const hash = CFilterBase::Hash(name, nameLength);
+
+	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceExclusiveLite(&m_lock, true);
+
+	// Directory unknown, so from any group
+	for(ULONG index = 0; index < c_directories; ++index)
+	{
+		CFilterSizeCacheDirectory *const directory = m_directories + index;
+
+		if(directory->m_hash && RemoveFile(directory, hash, name, nameLength))
+		{
+			status = STATUS_SUCCESS;
+		}
+	}
+
+	ExReleaseResourceLite(&m_lock);
+	FsRtlExitFileSystem();
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "IoControl.h"
+#include "CFilterContext.h"
+#include "CFilterEngine.h"
+#include "CSimFileSystem.h"
+
+/*
+ * Random listings of each FILE_*_DIR_INFORMATION class are built from a small set of names, in varying
+ * case, with directories, at most one AutoConfig file and sizes around the Header block size. After
+ * DirectoryQuery, the AutoConfig file is gone, entries are still chained within the returned size, and
+ * each file reports its size less the Header block size from the cache, or the Entity's, and the Tail.
+ *
+ * Renames, links and deletes: removing by the FILE_OBJECT of a file on CSimFileSystem drops it from its
+ * directory's group, that of a directory drops its group. Removing a target name drops it from every group.
+ */
+enum
+{
+	c_testRounds	= 20000,
+	c_testEntries	= 32,
+	c_testHeader	= 1024,		// Entity's Header block size
+	c_testDeviating	= 4096,
+};
+
+static LPCWSTR const s_testNames[] = { L"a.txt", L"A.TXT", L"b.doc", L"report 2010.xls", L"c", L"longer name of a file.bin", L"d.txt" };
+
+// Names whose Header deviates, in the cached directory
+static LPCWSTR const s_testCached[] = { L"a.txt", L"c", L"d.txt" };
+
+struct TestLayout
+{
+	ULONG	m_size;			// without name
+	ULONG	m_eof;
+	ULONG	m_alloc;
+	ULONG	m_attributes;
+	ULONG	m_nameLength;
+	ULONG	m_name;
+};
+
+#define TEST_LAYOUT(type) { sizeof(type) - sizeof(WCHAR), FIELD_OFFSET(type, EndOfFile), FIELD_OFFSET(type, AllocationSize), FIELD_OFFSET(type, FileAttributes), FIELD_OFFSET(type, FileNameLength), FIELD_OFFSET(type, FileName) }
+
+static ULONG const s_testClasses[] = { FileDirectoryInformation, FileFullDirectoryInformation, FileBothDirectoryInformation, FileIdBothDirectoryInformation, FileIdFullDirectoryInformation };
+
+static TestLayout const s_testLayouts[] = { TEST_LAYOUT(FILE_DIRECTORY_INFORMATION), TEST_LAYOUT(FILE_FULL_DIR_INFORMATION), TEST_LAYOUT(FILE_BOTH_DIR_INFORMATION), TEST_LAYOUT(FILE_ID_BOTH_DIR_INFORMATION), TEST_LAYOUT(FILE_ID_FULL_DIR_INFORMATION) };
+
+struct TestEntry
+{
+	LPCWSTR		m_name;
+	ULONG		m_attributes;
+	LONGLONG	m_eof;
+	LONGLONG	m_alloc;
+};
+
+static void TestPath(CFilterPath *path, LPWSTR directory, LPCWSTR file)
+{
+	RtlZeroMemory(path, sizeof(*path));
+
+	path->m_volume			= (LPWSTR) L"\\Device\\HarddiskVolume1";
+	path->m_volumeLength	= (USHORT) (wcslen(path->m_volume) * sizeof(WCHAR));
+	path->m_directory		= directory;
+	path->m_directoryLength	= (USHORT) (wcslen(directory) * sizeof(WCHAR));
+	path->m_file			= (LPWSTR) file;
+	path->m_fileLength		= (USHORT) (wcslen(file) * sizeof(WCHAR));
+}
+
+static LONGLONG TestSize(ULONG random)
+{
+	LONGLONG const sizes[] = { 0, 1, c_testHeader - 1, c_testHeader, c_testHeader + 1, c_testDeviating, c_testDeviating + CFilterContext::c_tail, 1 << 20 };
+
+	return sizes[random % (sizeof(sizes) / sizeof(sizes[0]))] + ((random >> 8) & 7);
+}
+
+// Expected size of a file as listed, as DirectoryQuerySizes computes it
+static LONGLONG TestExpected(LONGLONG size, LONGLONG eof, ULONG blockSize)
+{
+	ULONG metaSize = blockSize;
+
+	if(eof > blockSize)
+	{
+		metaSize += CFilterContext::c_tail;
+	}
+
+	return (size >= metaSize) ? size - metaSize : size;
+}
+
+static bool TestCached(LPCWSTR name)
+{
+	for(ULONG index = 0; index < sizeof(s_testCached) / sizeof(s_testCached[0]); ++index)
+	{
+		if((wcslen(name) == wcslen(s_testCached[index])) && !_wcsnicmp(name, s_testCached[index], wcslen(name)))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int TestListing(CFilterSizeCache::CFilterSizeSnapshot const* sizes, ULONG *random)
+{
+	UCHAR buffer[c_testEntries * 256];
+	RtlZeroMemory(buffer, sizeof(buffer));
+
+	*random = *random * 1103515245 + 12345;
+
+	ULONG const type			 = (*random >> 8) % (sizeof(s_testClasses) / sizeof(s_testClasses[0]));
+	TestLayout const*const layout = s_testLayouts + type;
+
+	TestEntry entries[c_testEntries];
+
+	ULONG const count	   = 1 + (*random >> 16) % c_testEntries;
+	ULONG const autoConfig = (*random >> 4) & 1 ? (*random >> 24) % count : ~0u;
+	ULONG offset		   = 0;
+	ULONG last			   = 0;
+
+	for(ULONG index = 0; index < count; ++index)
+	{
+		*random = *random * 1103515245 + 12345;
+
+		TestEntry *const entry = entries + index;
+
+		entry->m_name		= s_testNames[(*random >> 8) % (sizeof(s_testNames) / sizeof(s_testNames[0]))];
+		entry->m_attributes = ((*random >> 28) == 0) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+		entry->m_eof		= TestSize(*random >> 12);
+		entry->m_alloc		= (*random & 1) ? entry->m_eof : (entry->m_eof + 4095) & ~4095;
+
+		if(index == autoConfig)
+		{
+			entry->m_name		= g_filFileAutoConfigName;
+			entry->m_attributes = FILE_ATTRIBUTE_NORMAL;
+		}
+		// A directory of that name stays
+		else if(!((*random >> 20) & 31))
+		{
+			entry->m_name		= g_filFileAutoConfigName;
+			entry->m_attributes = FILE_ATTRIBUTE_DIRECTORY;
+		}
+
+		UCHAR *const info	   = buffer + offset;
+		ULONG const nameLength = (ULONG) wcslen(entry->m_name) * sizeof(WCHAR);
+
+		*(ULONG*) (info + layout->m_attributes)				= entry->m_attributes;
+		*(ULONG*) (info + layout->m_nameLength)				= nameLength;
+		((LARGE_INTEGER*) (info + layout->m_eof))->QuadPart	  = entry->m_eof;
+		((LARGE_INTEGER*) (info + layout->m_alloc))->QuadPart = entry->m_alloc;
+
+		RtlCopyMemory(info + layout->m_name, entry->m_name, nameLength);
+
+		last = offset;
+
+		ULONG const next = (layout->m_size + nameLength + 7) & ~7;
+
+		*(ULONG*) info = (index + 1 < count) ? next : 0;
+
+		offset += next;
+	}
+
+	IRP *const irp = IoAllocateIrp(1, false);
+	IoSetNextIrpStackLocation(irp);
+
+	IO_STACK_LOCATION *const stack = IoGetCurrentIrpStackLocation(irp);
+
+	stack->MajorFunction										= IRP_MJ_DIRECTORY_CONTROL;
+	stack->Parameters.QueryDirectory.FileInformationClass		= (FILE_INFORMATION_CLASS) s_testClasses[type];
+	stack->Parameters.QueryDirectory.Length						= sizeof(buffer);
+
+	irp->UserBuffer			  = buffer;
+	irp->IoStatus.Information = last + layout->m_size + *(ULONG*) (buffer + last + layout->m_nameLength);
+
+	CFilterEngine::DirectoryQuery(irp, c_testHeader, sizes);
+
+	ULONG const information = (ULONG) irp->IoStatus.Information;
+
+	IoFreeIrp(irp);
+
+	// Walk the result along the input
+	ULONG position = 0;
+	ULONG size	   = 0;
+
+	for(ULONG index = 0; index < count; ++index)
+	{
+		TestEntry const*const entry = entries + index;
+
+		if(index == autoConfig)
+		{
+			continue;
+		}
+
+		if(!information || (position >= information))
+		{
+			printf("ERROR ON LISTING: type[%u] entry[%u] beyond [%u]\n", s_testClasses[type], index, information);
+			return 1;
+		}
+
+		UCHAR const*const info = buffer + position;
+		ULONG const nameLength = *(ULONG const*) (info + layout->m_nameLength);
+
+		if((nameLength != wcslen(entry->m_name) * sizeof(WCHAR)) || memcmp(info + layout->m_name, entry->m_name, nameLength))
+		{
+			printf("ERROR ON LISTING: type[%u] entry[%u] name\n", s_testClasses[type], index);
+			return 1;
+		}
+
+		LONGLONG expectedEof   = entry->m_eof;
+		LONGLONG expectedAlloc = entry->m_alloc;
+
+		if(!(entry->m_attributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			ULONG const blockSize = TestCached(entry->m_name) ? c_testDeviating : c_testHeader;
+
+			expectedEof	  = TestExpected(entry->m_eof, entry->m_eof, blockSize);
+			expectedAlloc = TestExpected(entry->m_alloc, entry->m_eof, blockSize);
+		}
+
+		if((((LARGE_INTEGER const*) (info + layout->m_eof))->QuadPart != expectedEof) ||
+		   (((LARGE_INTEGER const*) (info + layout->m_alloc))->QuadPart != expectedAlloc))
+		{
+			printf("ERROR ON LISTING: type[%u] entry[%u] size[%lld,%lld] expected[%lld,%lld]\n", s_testClasses[type], index, 
+				   ((LARGE_INTEGER const*) (info + layout->m_eof))->QuadPart, ((LARGE_INTEGER const*) (info + layout->m_alloc))->QuadPart,
+				   expectedEof, expectedAlloc);
+			return 1;
+		}
+
+		ULONG const next = *(ULONG const*) info;
+
+		size = position + layout->m_size + nameLength;
+
+		if(!next)
+		{
+			position = ~0u;
+			break;
+		}
+
+		position += next;
+	}
+
+	// All consumed, and the size covers the last entry, up to its alignment if the AutoConfig file followed
+	bool const empty = (count == 1) && (autoConfig == 0);
+
+	if((!empty && (position != ~0u)) || (information < size) || (information > ((size + 7) & ~7)))
+	{
+		printf("ERROR ON LISTING: type[%u] size[%u] expected[%u]\n", s_testClasses[type], information, size);
+		return 1;
+	}
+
+	return 0;
+}
+
+static NTSTATUS TestRemove(CFilterSizeCache *cache, FILFILE_VOLUME_EXTENSION *extension, LPCWSTR name)
+{
+	WCHAR path[64] = L"\\Device\\HarddiskVolume1";
+	wcscat(path, name);
+
+	HANDLE handle = 0;
+	CSimKernel::Open(path, FILE_READ_ATTRIBUTES, FILE_SHARE_VALID_FLAGS, FILE_OPEN, 0, &handle);
+
+	FILE_OBJECT *file = 0;
+	ObReferenceObjectByHandle(handle, 0, *IoFileObjectType, KernelMode, (void**) &file, 0);
+
+	extension->Lower = CSimKernel::RelatedDevice(file);
+
+	NTSTATUS const status = cache->Remove(extension, file);
+
+	ObDereferenceObject(file);
+	ZwClose(handle);
+
+	return status;
+}
+
+int main(void)
+{
+	CSimKernel::Init();
+
+	int failed = 0;
+
+	CFilterSizeCache cache;
+	cache.Init();
+
+	WCHAR directory[] = L"\\dir";
+	WCHAR other[]	  = L"\\other";
+
+	CFilterPath path;
+
+	for(ULONG index = 0; index < sizeof(s_testCached) / sizeof(s_testCached[0]); ++index)
+	{
+		TestPath(&path, directory, s_testCached[index]);
+		cache.Update(&path, c_testDeviating, c_testHeader);
+
+		TestPath(&path, other, s_testCached[index]);
+		cache.Update(&path, c_testDeviating, c_testHeader);
+	}
+
+	// Listings
+	TestPath(&path, directory, L"");
+
+	CFilterSizeCache::CFilterSizeSnapshot sizes;
+
+	if(!NT_SUCCESS(cache.Snapshot(CFilterSizeCache::DirectoryHash(&path, false), &sizes)) || (sizes.m_count != 3))
+	{
+		printf("ERROR ON SNAPSHOT\n");
+		failed++;
+	}
+
+	ULONG random = 12345;
+
+	for(ULONG round = 0; round < c_testRounds; ++round)
+	{
+		if(TestListing(&sizes, &random))
+		{
+			failed++;
+			break;
+		}
+	}
+
+	sizes.Close();
+
+	// Renamed or deleted file, by its FILE_OBJECT as DispatchSetInformation has it
+	CSimFileSystem::Init();
+	CSimFileSystem::AddDirectory(L"\\dir");
+	CSimFileSystem::AddDirectory(L"\\other");
+	CSimFileSystem::AddFile(L"\\dir\\a.txt", "a", 1);
+
+	FILFILE_VOLUME_EXTENSION extension;
+	RtlZeroMemory(&extension, sizeof(extension));
+
+	RtlInitUnicodeString(&extension.LowerName, CSimFileSystem::Volume());
+	extension.LowerType = FILFILE_DEVICE_VOLUME;
+
+	if(!NT_SUCCESS(TestRemove(&cache, &extension, L"\\dir\\a.txt")) || NT_SUCCESS(TestRemove(&cache, &extension, L"\\dir\\a.txt")))
+	{
+		printf("ERROR ON REMOVE FILE\n");
+		failed++;
+	}
+
+	TestPath(&path, directory, L"");
+	cache.Snapshot(CFilterSizeCache::DirectoryHash(&path, false), &sizes);
+
+	if((sizes.m_count != 2) || (sizes.Get(L"A.TXT", 5 * sizeof(WCHAR), c_testHeader) != c_testHeader) || (sizes.Get(L"c", sizeof(WCHAR), c_testHeader) != c_testDeviating))
+	{
+		printf("ERROR ON REMOVE FILE [%u]\n", sizes.m_count);
+		failed++;
+	}
+
+	sizes.Close();
+
+	// Replaced target, named as in FILE_RENAME_INFORMATION
+	LPCWSTR const target = L"\\??\\C:\\anywhere\\d.txt";
+
+	if(!NT_SUCCESS(cache.Remove(target, (ULONG) wcslen(target) * sizeof(WCHAR))))
+	{
+		printf("ERROR ON REMOVE NAME\n");
+		failed++;
+	}
+
+	TestPath(&path, other, L"");
+	cache.Snapshot(CFilterSizeCache::DirectoryHash(&path, false), &sizes);
+
+	if((sizes.m_count != 2) || (sizes.Get(L"d.txt", 5 * sizeof(WCHAR), c_testHeader) != c_testHeader))
+	{
+		printf("ERROR ON REMOVE NAME [%u]\n", sizes.m_count);
+		failed++;
+	}
+
+	sizes.Close();
+
+	// Moved directory takes its group along
+	if(!NT_SUCCESS(TestRemove(&cache, &extension, L"\\other")))
+	{
+		printf("ERROR ON REMOVE DIRECTORY\n");
+		failed++;
+	}
+
+	TestPath(&path, other, L"");
+
+	if(NT_SUCCESS(cache.Snapshot(CFilterSizeCache::DirectoryHash(&path, false), &sizes)))
+	{
+		printf("ERROR ON REMOVE DIRECTORY\n");
+		failed++;
+	}
+
+	sizes.Close();
+
+	cache.Close();
+
+	CSimKernel::Run();
+
+	if(CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimKernel::Statistics().Outstanding);
+		failed++;
+	}
+
+	CSimFileSystem::Close();
+	CSimKernel::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterSizeCache.h: interface for the CFilterSizeCache class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilterSizeCache_H__4C0E7B2D_91A6_4F53_B8E4_2D6F05A9C371__INCLUDED_)
+#define AFX_CFilterSizeCache_H__4C0E7B2D_91A6_4F53_B8E4_2D6F05A9C371__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilterPath;
+struct FILFILE_VOLUME_EXTENSION;
+
+class CFilterSizeCache
+{
+	// Remembers the Header block size of files whose Header differs from their Entity's one, grouped by
+	// directory. Populated whenever a file is tracked, consulted when directory listings are rewritten,
+	// so that such files report their exact size without reading any Header. Files are matched by
+	// their full name, the hash only orders them. Renames, links and deletes remove the names involved,
+	// groups also expire after c_timeout seconds without update.
+
+	enum c_constants
+	{
+		c_increment		= 8,
+		c_directories	= 64,		// max directory groups
+		c_files			= 512,		// max files per group
+		c_timeout		= 600,		// seconds
+	};
+
+public:
+
+	struct CFilterSizeCacheFile
+	{
+		ULONG					m_hash;			// of file name, sort key
+		ULONG					m_nameLength;	// in bytes
+		ULONG					m_blockSize;
+		LPWSTR					m_name;			// Paged, owned by group or snapshot
+	};
+
+	struct CFilterSizeSnapshot
+	{
+		ULONG					Get(LPCWSTR name, ULONG nameLength, ULONG blockSize) const;
+		void					Close();
+
+		CFilterSizeCacheFile*	m_files;
+		ULONG					m_count;
+	};
+
+	NTSTATUS					Init();
+	void						Close();
+	void						Clear();
+
+	NTSTATUS					Update(CFilterPath const* path, ULONG blockSize, ULONG entityBlockSize);
+	NTSTATUS					Snapshot(ULONG directoryHash, CFilterSizeSnapshot *snapshot);
+
+	NTSTATUS					Remove(FILFILE_VOLUME_EXTENSION *extension, FILE_OBJECT *file);
+	NTSTATUS					Remove(CFilterPath const* path);
+	NTSTATUS					Remove(LPCWSTR name, ULONG nameLength);
+
+	static ULONG				DirectoryHash(CFilterPath const* path, bool directory);
+
+private:
+
+	struct CFilterSizeCacheDirectory
+	{
+		ULONG					m_hash;			// of volume and directory path
+		ULONG					m_tick;			// at last update
+		CFilterSizeCacheFile*	m_files;
+		ULONG					m_count;
+		ULONG					m_capacity;
+	};
+
+	CFilterSizeCacheDirectory*	Search(ULONG hash, ULONG tick);
+	static ULONG				SearchFile(CFilterSizeCacheFile const* files, ULONG count, ULONG hash, LPCWSTR name, ULONG nameLength, ULONG *insert = 0);
+	static bool					RemoveFile(CFilterSizeCacheDirectory *directory, ULONG hash, LPCWSTR name, ULONG nameLength);
+	static void					FreeFiles(CFilterSizeCacheDirectory *directory);
+
+								// DATA
+	CFilterSizeCacheDirectory	m_directories[c_directories];
+	ULONG						m_count;
+	ULONG						m_timeout;		// ticks
+
+	ERESOURCE					m_lock;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CFilterSizeCache_H__4C0E7B2D_91A6_4F53_B8E4_2D6F05A9C371__INCLUDED_)
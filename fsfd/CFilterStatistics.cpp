@@ -0,0 +1,451 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterStatistics.cpp: implementation of the CFilterStatistics class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define DRIVER_USE_NTIFS	// use the NTIFS header
+#include "driver.h"
+
+#include "CFilterBase.h"
+#include "CFilterStatistics.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+C_ASSERT(sizeof(FILFILE_STATISTICS) == 2 * sizeof(ULONG) + FILFILE_STAT_COUNT * sizeof(ULONGLONG) +
+									   2 * FILFILE_STAT_MODES * sizeof(ULONGLONG) +
+									   FILFILE_STAT_HISTOGRAM * sizeof(ULONGLONG) +
+									   2 * FILFILE_STAT_STAGES * sizeof(ULONGLONG) +
+									   FILFILE_STAT_STAGES * FILFILE_STAT_LATENCY * sizeof(ULONGLONG));
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// statics
+ULONG		CFilterStatistics::s_profile	= 0;
+LONGLONG	CFilterStatistics::s_frequency	= 0;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterStatistics::Init(ULONG identifier)
+{
+	PAGED_CODE();
+
+	RtlZeroMemory(this, sizeof(*this));
+
+	ExInitializeFastMutex(&m_lock);
+
+	m_identifier = identifier;
+
+	if(!s_frequency)
+	{
+		LARGE_INTEGER frequency;
+		KeQueryPerformanceCounter(&frequency);
+
+		s_frequency = frequency.QuadPart;
+	}
+	m_slotsCount = (ULONG) KeNumberProcessors;
+
+	if(!m_slotsCount)
+	{
+		m_slotsCount = 1;
+	}
+
+	// Round up to whole cache lines
+	m_slotSize = (c_values * sizeof(LARGE_INTEGER) + (c_cacheLine - 1)) & ~(c_cacheLine - 1);
+
+	m_baseline = (ULONGLONG*) ExAllocatePool(PagedPool, c_values * sizeof(ULONGLONG));
+
+	if(!m_baseline)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlZeroMemory(m_baseline, c_values * sizeof(ULONGLONG));
+
+	// Updated at DISPATCH_LEVEL too, so keep them resident. Add one line for alignment.
+	UCHAR *const slots = (UCHAR*) ExAllocatePool(NonPagedPool, m_slotsCount * m_slotSize + c_cacheLine);
+
+	if(!slots)
+	{
+		ExFreePool(m_baseline);
+		m_baseline = 0;
+
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlZeroMemory(slots, m_slotsCount * m_slotSize + c_cacheLine);
+
+	// Save original pointer in front of aligned blocks
+	UCHAR *const aligned = (UCHAR*) (((ULONG_PTR) slots + c_cacheLine) & ~((ULONG_PTR) c_cacheLine - 1));
+	ASSERT(aligned - slots >= sizeof(void*));
+
+	*((UCHAR**) aligned - 1) = slots;
+
+	m_slots = aligned;
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterStatistics::Close()
+{
+	PAGED_CODE();
+
+	ExAcquireFastMutex(&m_lock);
+
+	if(m_slots)
+	{
+		UCHAR *const slots = *((UCHAR**) m_slots - 1);
+		ASSERT(slots);
+
+		m_slots = 0;
+
+		ExFreePool(slots);
+	}
+
+	if(m_baseline)
+	{
+		ExFreePool(m_baseline);
+		m_baseline = 0;
+	}
+
+	ExReleaseFastMutex(&m_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+void CFilterStatistics::AddKeyWait(LONGLONG start)
+{
+	if(!m_slots)
+	{
+		return;
+	}
+
+	// Interrupt time is in 100ns units
+	LONGLONG const elapsed = (KeQueryInterruptTime() - start) / 10000;
+
+	ULONG const millis = (elapsed > 0) ? ((elapsed < MAXLONG) ? (ULONG) elapsed : MAXLONG) : 0;
+
+	// Bucket N counts waits below 2^N milliseconds, last one takes the rest
+	ULONG bucket = 0;
+
+	while((bucket < FILFILE_STAT_HISTOGRAM - 1) && (millis >= (1u << bucket)))
+	{
+		bucket++;
+	}
+
+	LARGE_INTEGER *const slot = Slot();
+
+	ExInterlockedAddLargeStatistic(slot + FILFILE_STAT_KEY_WAIT, millis);
+	ExInterlockedAddLargeStatistic(slot + FILFILE_STAT_COUNT + 2 * FILFILE_STAT_MODES + bucket, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+void CFilterStatistics::AddStage(ULONG stage, LONGLONG start)
+{
+	ASSERT(stage < FILFILE_STAT_STAGES);
+
+	// Profiling disabled when stage was entered?
+	if(!start || !m_slots || !s_frequency)
+	{
+		return;
+	}
+
+	LONGLONG const elapsed = ((KeQueryPerformanceCounter(0).QuadPart - start) * 1000000) / s_frequency;
+
+	ULONG const micros = (elapsed > 0) ? ((elapsed < MAXLONG) ? (ULONG) elapsed : MAXLONG) : 0;
+
+	// Bucket N counts stages below 4^N microseconds, last one takes the rest
+	ULONG bucket = 0;
+
+	while((bucket < FILFILE_STAT_LATENCY - 1) && (micros >= (1u << (2 * bucket))))
+	{
+		bucket++;
+	}
+
+	LARGE_INTEGER *const slot = Slot() + c_stages;
+
+	ExInterlockedAddLargeStatistic(slot + stage, 1);
+	ExInterlockedAddLargeStatistic(slot + FILFILE_STAT_STAGES + stage, micros);
+	ExInterlockedAddLargeStatistic(slot + 2 * FILFILE_STAT_STAGES + stage * FILFILE_STAT_LATENCY + bucket, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterStatistics::Snapshot(FILFILE_STATISTICS *target, bool reset)
+{
+	ASSERT(target);
+
+	PAGED_CODE();
+
+	ULONGLONG values[c_values];
+	RtlZeroMemory(values, sizeof(values));
+
+	ExAcquireFastMutex(&m_lock);
+
+	if(!m_slots)
+	{
+		ExReleaseFastMutex(&m_lock);
+
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	for(ULONG slot = 0; slot < m_slotsCount; ++slot)
+	{
+		LARGE_INTEGER const* current = (LARGE_INTEGER const*) (m_slots + slot * m_slotSize);
+
+		for(ULONG index = 0; index < c_values; ++index)
+		{
+			// Torn reads on 32-bit are tolerated, counters are informational only
+			values[index] += current[index].QuadPart;
+		}
+	}
+
+	for(ULONG index = 0; index < c_values; ++index)
+	{
+		ULONGLONG const current = values[index];
+
+		values[index] -= m_baseline[index];
+
+		if(reset)
+		{
+			m_baseline[index] = current;
+		}
+	}
+
+	ExReleaseFastMutex(&m_lock);
+
+	target->Volume = m_identifier;
+	target->Mode   = CFilterContext::c_cipherMode;
+
+	// Counters follow the header in the same order
+	RtlCopyMemory(target->Counter, values, sizeof(values));
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Counters add up over all processor blocks, land in the right bucket and start over on reset
+ * without losing what is added afterwards. Then the cost of one update is timed.
+ */
+static bool TestSnapshot(CFilterStatistics *statistics, FILFILE_STATISTICS *target, bool reset = false)
+{
+	RtlZeroMemory(target, sizeof(*target));
+
+	return NT_SUCCESS(statistics->Snapshot(target, reset));
+}
+
+static bool TestZero(FILFILE_STATISTICS const* target)
+{
+	for(ULONG index = 0; index < FILFILE_STAT_COUNT; ++index)
+	{
+		if(target->Counter[index])
+		{
+			return false;
+		}
+	}
+
+	for(ULONG index = 0; index < FILFILE_STAT_MODES; ++index)
+	{
+		if(target->Encrypted[index] || target->Decrypted[index])
+		{
+			return false;
+		}
+	}
+
+	for(ULONG index = 0; index < FILFILE_STAT_HISTOGRAM; ++index)
+	{
+		if(target->KeyWait[index])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(void)
+{
+	CSimKernel::Init();
+
+	// More blocks than the processor updating them
+	KeNumberProcessors = 4;
+
+	CFilterStatistics statistics;
+
+	int failed = 0;
+
+	if(NT_ERROR(statistics.Init(7)))
+	{
+		printf("ERROR ON INIT\n");
+		return 1;
+	}
+
+	FILFILE_STATISTICS snapshot;
+
+	if(!TestSnapshot(&statistics, &snapshot) || (7 != snapshot.Volume) || !TestZero(&snapshot))
+	{
+		printf("ERROR ON EMPTY\n");
+		failed++;
+	}
+
+	statistics.Add(FILFILE_STAT_CREATE_TRACKED);
+	statistics.Add(FILFILE_STAT_CREATE_TRACKED);
+	statistics.Add(FILFILE_STAT_CREATE_TRACKED);
+	statistics.Add(FILFILE_STAT_BOUNCE_BUFFERS, 5);
+
+	statistics.AddBytes(FILFILE_CIPHER_MODE_XTS, 4096, true);
+	statistics.AddBytes(FILFILE_CIPHER_MODE_XTS, 512, true);
+	statistics.AddBytes(FILFILE_CIPHER_MODE_CTR, 512, false);
+	statistics.AddBytes(FILFILE_CIPHER_MODE_EME, 0, true);
+
+	// Waits of 5ms, none and 100s: below 2^3, below 2^0 and the last bucket
+	LONGLONG start = KeQueryInterruptTime();
+	CSimKernel::Advance(5 * 10000);
+	statistics.AddKeyWait(start);
+
+	statistics.AddKeyWait(KeQueryInterruptTime());
+
+	start = KeQueryInterruptTime();
+	CSimKernel::Advance(100000LL * 10000);
+	statistics.AddKeyWait(start);
+
+	// Not profiled when entered
+	statistics.AddStage(FILFILE_STAT_STAGE_BLACKLIST, 0);
+	statistics.AddStage(FILFILE_STAT_STAGE_HEADER, KeQueryPerformanceCounter(0).QuadPart);
+
+	if(!TestSnapshot(&statistics, &snapshot) ||
+	   (3 != snapshot.Counter[FILFILE_STAT_CREATE_TRACKED]) ||
+	   (5 != snapshot.Counter[FILFILE_STAT_BOUNCE_BUFFERS]) ||
+	   (4608 != snapshot.Encrypted[FILFILE_CIPHER_MODE_XTS]) ||
+	   (512 != snapshot.Decrypted[FILFILE_CIPHER_MODE_CTR]) ||
+	   snapshot.Encrypted[FILFILE_CIPHER_MODE_EME] || snapshot.Decrypted[FILFILE_CIPHER_MODE_XTS])
+	{
+		printf("ERROR ON COUNTERS\n");
+		failed++;
+	}
+
+	if((100005 != snapshot.Counter[FILFILE_STAT_KEY_WAIT]) ||
+	   (1 != snapshot.KeyWait[0]) || (1 != snapshot.KeyWait[3]) || (1 != snapshot.KeyWait[FILFILE_STAT_HISTOGRAM - 1]))
+	{
+		printf("ERROR ON HISTOGRAM\n");
+		failed++;
+	}
+
+	ULONGLONG latency = 0;
+
+	for(ULONG bucket = 0; bucket < FILFILE_STAT_LATENCY; ++bucket)
+	{
+		latency += snapshot.StageLatency[FILFILE_STAT_STAGE_HEADER][bucket];
+	}
+
+	if(snapshot.StageCalls[FILFILE_STAT_STAGE_BLACKLIST] || (1 != snapshot.StageCalls[FILFILE_STAT_STAGE_HEADER]) || (1 != latency))
+	{
+		printf("ERROR ON STAGES\n");
+		failed++;
+	}
+
+	// Reset returns the values up to now, later ones count from zero
+	if(!TestSnapshot(&statistics, &snapshot, true) || (3 != snapshot.Counter[FILFILE_STAT_CREATE_TRACKED]))
+	{
+		printf("ERROR ON RESET\n");
+		failed++;
+	}
+
+	if(!TestSnapshot(&statistics, &snapshot) || !TestZero(&snapshot) || snapshot.StageCalls[FILFILE_STAT_STAGE_HEADER])
+	{
+		printf("ERROR ON RESET ZERO\n");
+		failed++;
+	}
+
+	statistics.Add(FILFILE_STAT_CREATE_TRACKED);
+	statistics.AddBytes(FILFILE_CIPHER_MODE_XTS, 512, true);
+
+	if(!TestSnapshot(&statistics, &snapshot) ||
+	   (1 != snapshot.Counter[FILFILE_STAT_CREATE_TRACKED]) || (512 != snapshot.Encrypted[FILFILE_CIPHER_MODE_XTS]))
+	{
+		printf("ERROR ON RESET COUNT\n");
+		failed++;
+	}
+
+	// Cost of one update on the I/O path, and of a snapshot
+	enum { c_updates = 10000000, c_snapshots = 100000 };
+
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	for(ULONG pos = 0; pos < c_updates; ++pos)
+	{
+		statistics.AddBytes(FILFILE_CIPHER_MODE_EME, 4096, pos & 1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double const update = ((end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec)) / c_updates;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	for(ULONG pos = 0; pos < c_snapshots; ++pos)
+	{
+		statistics.Snapshot(&snapshot);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double const copy = ((end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec)) / c_snapshots;
+
+	if((4096ULL * c_updates / 2 != snapshot.Encrypted[FILFILE_CIPHER_MODE_EME]) ||
+	   (4096ULL * c_updates / 2 != snapshot.Decrypted[FILFILE_CIPHER_MODE_EME]))
+	{
+		printf("ERROR ON BYTES\n");
+		failed++;
+	}
+
+	printf("AddBytes() %.1f ns, Snapshot() %.0f ns\n", update, copy);
+
+	statistics.Close();
+
+	// Closed ones ignore updates
+	statistics.Add(FILFILE_STAT_CREATE_TRACKED);
+
+	if(STATUS_DEVICE_NOT_READY != statistics.Snapshot(&snapshot))
+	{
+		printf("ERROR ON CLOSE\n");
+		failed++;
+	}
+
+	if(CSimKernel::Statistics().Outstanding)
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimKernel::Statistics().Outstanding);
+		failed++;
+	}
+
+	CSimKernel::Close();
+
+	printf("%d failed\n", failed);
+
+	return failed;	/* normal exit on zero */
+}
+
+#endif /* UNITTEST */
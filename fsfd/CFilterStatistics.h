@@ -0,0 +1,119 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CFilterStatistics.h: interface for the CFilterStatistics class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CFilterStatistics_H__C4D2A9E1_5B73_4F08_8E6A_2D91B0F47A3C__INCLUDED_)
+#define AFX_CFilterStatistics_H__C4D2A9E1_5B73_4F08_8E6A_2D91B0F47A3C__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "IoControl.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CFilterStatistics
+{
+	// Counters are kept per processor, each block on its own cache lines. Updates
+	// are interlocked on the local block only, so hot paths never share a line.
+	// Snapshots sum up all blocks, a reset just moves the baseline.
+	// Decision stages are timed only if s_profile is set, StageStart() returns 0 otherwise.
+
+	enum c_constants
+	{
+		c_stages	= FILFILE_STAT_COUNT + 2 * FILFILE_STAT_MODES + FILFILE_STAT_HISTOGRAM,
+		c_values	= c_stages + 2 * FILFILE_STAT_STAGES + FILFILE_STAT_STAGES * FILFILE_STAT_LATENCY,
+		c_cacheLine	= 64,
+	};
+
+public:
+
+	NTSTATUS				Init(ULONG identifier);
+	void					Close();
+
+	void					Add(ULONG counter, ULONG value = 1);
+	void					AddBytes(ULONG mode, ULONG size, bool encrypted);
+	void					AddKeyWait(LONGLONG start);
+
+	static LONGLONG			StageStart();
+	void					AddStage(ULONG stage, LONGLONG start);
+
+	NTSTATUS				Snapshot(FILFILE_STATISTICS *target, bool reset = false);
+
+	static ULONG			s_profile;		// time decision stages
+
+private:
+
+	LARGE_INTEGER*			Slot();
+
+							// DATA
+	UCHAR*					m_slots;		// one block of c_values counters per processor
+	ULONG					m_slotSize;
+	ULONG					m_slotsCount;
+
+	ULONGLONG*				m_baseline;		// values at last reset
+	FAST_MUTEX				m_lock;			// Sync for Snapshot and baseline
+
+	ULONG					m_identifier;	// Volume identifier, 0 := driver wide
+
+	static LONGLONG			s_frequency;	// of performance counter
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+LARGE_INTEGER* CFilterStatistics::Slot()
+{
+	ASSERT(m_slots);
+	ASSERT(m_slotsCount);
+
+	// Processors might be added at runtime
+	ULONG const processor = KeGetCurrentProcessorNumber() % m_slotsCount;
+
+	return (LARGE_INTEGER*) (m_slots + processor * m_slotSize);
+}
+
+inline
+void CFilterStatistics::Add(ULONG counter, ULONG value)
+{
+	ASSERT(counter < FILFILE_STAT_COUNT);
+
+	if(m_slots)
+	{
+		ExInterlockedAddLargeStatistic(Slot() + counter, value);
+	}
+}
+
+inline
+void CFilterStatistics::AddBytes(ULONG mode, ULONG size, bool encrypted)
+{
+	ASSERT(mode < FILFILE_STAT_MODES);
+
+	if(m_slots && size)
+	{
+		ULONG const index = FILFILE_STAT_COUNT + (encrypted ? 0 : FILFILE_STAT_MODES) + (mode % FILFILE_STAT_MODES);
+
+		ExInterlockedAddLargeStatistic(Slot() + index, size);
+	}
+}
+
+inline
+LONGLONG CFilterStatistics::StageStart()
+{
+	if(!s_profile)
+	{
+		return 0;
+	}
+
+	return KeQueryPerformanceCounter(0).QuadPart;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // !defined(AFX_CFilterStatistics_H__C4D2A9E1_5B73_4F08_8E6A_2D91B0F47A3C__INCLUDED_)
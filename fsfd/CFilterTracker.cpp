@@ -124,7 +124,7 @@ NTSTATUS CFilterTracker::Add(FILE_OBJECT *file, ULONG state)
 					  (m_size - pos) * sizeof(CFilterTrackerEntry));
 	}
 	
-	m_entries[pos].CFilterTrackerEntry::CFilterTrackerEntry(file, state);
+	m_entries[pos] = CFilterTrackerEntry(file, state);
 
 	m_size++;
 
@@ -36,6 +36,8 @@ NTSTATUS CFilterVolume::Init(FILFILE_VOLUME_EXTENSION *extension, ULONG volumeId
 
 	m_extension		 = extension;
 	m_nextIdentifier = volumeIdentifier << 24;
+	m_writes		 = 0;
+	m_writesPending	 = 0;
 
 	m_context = &CFilterControl::Extension()->Context;
 
@@ -49,6 +51,24 @@ NTSTATUS CFilterVolume::Init(FILFILE_VOLUME_EXTENSION *extension, ULONG volumeId
 		status = ExInitializeResourceLite(&m_negativesResource);
 	}
 
+	if(NT_SUCCESS(status))
+	{
+		status = m_autoConfigs.Init();
+	}
+
+	if(NT_SUCCESS(status))
+	{
+		status = m_decisions.Init();
+	}
+
+	if(NT_SUCCESS(status))
+	{
+		status = m_shards.Init();
+	}
+
+	// Not fatal, counters are simply not maintained then
+	m_statistics.Init(volumeIdentifier);
+
 	ASSERT(NT_SUCCESS(status));
 
 	return status;
@@ -72,6 +92,11 @@ NTSTATUS CFilterVolume::Close()
 	m_negatives.Close();
 	ExDeleteResourceLite(&m_negativesResource);
 
+	m_shards.Close();
+	m_decisions.Close();
+	m_autoConfigs.Close();
+	m_statistics.Close();
+
 	m_context		 = 0;
 	m_extension		 = 0;
 	m_nextIdentifier = 0;
@@ -378,6 +403,8 @@ NTSTATUS CFilterVolume::UpdateEntity(ULONG identifier, CFilterPath *path)
 	// Rename existing file Entity
 	FsRtlEnterFileSystem();
 	ExAcquireResourceExclusiveLite(&m_entitiesResource, true);
+	m_decisions.Invalidate();
+	CFilterEntityCont::Changed();
 
 	CFilterEntity *const entity = m_entities.GetFromIdentifier(identifier);
 
@@ -417,49 +444,8 @@ NTSTATUS CFilterVolume::UpdateEntity(ULONG currIdentifier, ULONG newIdentifier)
 
 	DBGPRINT(("UpdateEntity: exchange[0x%08x] with[0x%08x]\n", currIdentifier, newIdentifier));
 
-	// update all DIRECTORIES that reference this Entity
-	if(m_context->m_directories.Size())
-	{
-		ExAcquireResourceExclusiveLite(&m_context->m_directoriesResource, true);
-
-		ULONG const count = m_context->m_directories.Size();
-		
-		for(ULONG index = 0; index < count; ++index)
-		{
-			CFilterDirectory *const filterDirectory = m_context->m_directories.Get(index);
-			ASSERT(filterDirectory);
-
-			if(filterDirectory->m_entityIdentifier == currIdentifier)
-			{
-				filterDirectory->m_entityIdentifier = newIdentifier;
-			}
-		}
-
-		ExReleaseResourceLite(&m_context->m_directoriesResource);
-	}
-
-	// update all FILES that reference this Entity
-	if(m_context->m_files.Size())
-	{
-		ExAcquireResourceExclusiveLite(&m_context->m_filesResource, true);
-
-		ULONG const count = m_context->m_files.Size();
-		
-		for(ULONG index = 0; index < count; ++index)
-		{
-			CFilterFile *const filterFile = m_context->m_files.Get(index);
-			ASSERT(filterFile);
-
-			if(filterFile->m_link.m_entityIdentifier == currIdentifier)
-			{
-				filterFile->m_link.m_entityIdentifier = newIdentifier;
-			}
-		}
-
-		ExReleaseResourceLite(&m_context->m_filesResource);
-	}
-
-	return STATUS_SUCCESS;
+	// update all DIRECTORIES and FILES that reference this Entity
+	return m_shards.UpdateEntity(currIdentifier, newIdentifier);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -508,7 +494,7 @@ NTSTATUS CFilterVolume::PurgeEntities(ULONG flags, LUID const* luid)
 		return STATUS_INSUFFICIENT_RESOURCES;
 	}
 
-	RtlZeroMemory(identifiers, count * sizeof(ULONG));
+	ULONG selected = 0;
 
 	for(ULONG pos = 0; pos < count; ++pos)
 	{
@@ -530,18 +516,15 @@ NTSTATUS CFilterVolume::PurgeEntities(ULONG flags, LUID const* luid)
 
 		ASSERT(entity->m_identifier);
 
-		identifiers[pos] = entity->m_identifier;
+		identifiers[selected++] = entity->m_identifier;
 	}
 
 	ExReleaseResourceLite(&m_entitiesResource);
 
-	// Purge without holding the lock
-	for(ULONG pos = 0; pos < count; ++pos)
+	// Purge all in a single pass over the tracked objects, without holding the lock
+	if(selected)
 	{
-		if(identifiers[pos])
-		{
-			m_context->Purge(identifiers[pos], ENTITY_PURGE);
-		}
+		m_shards.Purge(identifiers, selected, ENTITY_PURGE);
 	}
 
 	ExFreePool(identifiers);
@@ -577,6 +560,7 @@ NTSTATUS CFilterVolume::RemoveEntities(ULONG flags, LUID const* luid)
 		if(m_negatives.Size())
 		{
 			ExAcquireResourceExclusiveLite(&m_negativesResource, true);
+			m_decisions.Invalidate();
 
 			for(LONG pos = m_negatives.Size() - 1; pos >= 0; --pos)
 			{
@@ -616,6 +600,7 @@ NTSTATUS CFilterVolume::RemoveEntities(ULONG flags, LUID const* luid)
 
 			// Remove Entities
 			ExAcquireResourceExclusiveLite(&m_entitiesResource, true);
+			m_decisions.Invalidate();
 
 			for(LONG pos = m_entities.Size() - 1; pos >= 0; --pos)
 			{
@@ -648,6 +633,7 @@ NTSTATUS CFilterVolume::RemoveEntity(ULONG identifier, ULONG type, ULONG flags,
 
 	FsRtlEnterFileSystem();
 	ExAcquireResourceExclusiveLite(&m_entitiesResource, true);
+	m_decisions.Invalidate();
 
 //	LPWSTR notify	   = 0;
 //	ULONG notifyLength = 0;
@@ -755,6 +741,7 @@ NTSTATUS CFilterVolume::RemoveEntity(FILE_OBJECT *file, ULONG flags)
 
 			FsRtlEnterFileSystem();
 			ExAcquireResourceExclusiveLite(&m_entitiesResource, true);
+			m_decisions.Invalidate();
 
 			// Remove active Entity, if any
 			status = RemoveEntity(&path, (terminal) ? &luid : 0, ~0u, flags | ENTITY_PURGE);
@@ -814,6 +801,9 @@ NTSTATUS CFilterVolume::RemoveEntity(CFilterPath const* path, LUID const* luid,
 		{
 			// Returns STATUS_ALERTED when last LUID was removed
 			status = matched->m_luids.Remove(luid);
+
+			// Visible to fewer sessions now
+			CFilterEntityCont::Changed();
 		}
 
 		if(STATUS_ALERTED == status)
@@ -834,7 +824,7 @@ NTSTATUS CFilterVolume::RemoveEntity(CFilterPath const* path, LUID const* luid,
 				ASSERT(matched->m_identifier);
 
 				// Process directories/files related to this Entity
-				status = m_context->Purge(matched->m_identifier, flags);
+				status = m_shards.Purge(matched->m_identifier, flags);
 			}
 
 			if(remove)
@@ -917,6 +907,8 @@ NTSTATUS CFilterVolume::AddEntity(FILFILE_TRACK_CONTEXT *track, ULONG flags)
 					if(NT_SUCCESS(status))
 					{
 						status = entity->m_luids.Add(&track->Luid);
+
+						CFilterEntityCont::Changed();
 					}
 				}
 			}
@@ -1103,6 +1095,7 @@ NTSTATUS CFilterVolume::ManageEntity(FILFILE_TRACK_CONTEXT *track, ULONG flags)
 		{
 			// Negative Entities
 			ExAcquireResourceExclusiveLite(&m_negativesResource, true);
+			m_decisions.Invalidate();
 
 			if(flags & FILFILE_CONTROL_REM)
 			{
@@ -1130,6 +1123,7 @@ NTSTATUS CFilterVolume::ManageEntity(FILFILE_TRACK_CONTEXT *track, ULONG flags)
 		{
 			// Regular Entities
 			ExAcquireResourceExclusiveLite(&m_entitiesResource, true);
+			m_decisions.Invalidate();
 
 			if(flags & FILFILE_CONTROL_REM)
 			{
@@ -1184,18 +1178,20 @@ int CFilterVolume::CheckDirectoryCooked(FILE_OBJECT *file, CFilterDirectory *dir
 
 	int found = 0; 
 
-	if(file && m_context->m_directories.Size())
+	CFilterShard *const shard = (file) ? m_shards.Directory(file) : 0;
+
+	if(shard && shard->m_directories.Size())
 	{
 		FsRtlEnterFileSystem();
-		ExAcquireSharedStarveExclusive(&m_context->m_directoriesResource, true);
+		ExAcquireSharedStarveExclusive(&shard->m_directoriesResource, true);
 
 		ULONG pos = ~0u;
 
-		if(m_context->m_directories.Search(file, &pos))
+		if(shard->m_directories.Search(file, &pos))
 		{
 			ASSERT(pos != ~0u);
 
-			CFilterDirectory *const filterDirectory = m_context->m_directories.Get(pos);
+			CFilterDirectory *const filterDirectory = shard->m_directories.Get(pos);
 			ASSERT(filterDirectory);
 
 			if(directory)
@@ -1215,7 +1211,7 @@ int CFilterVolume::CheckDirectoryCooked(FILE_OBJECT *file, CFilterDirectory *dir
 			}
 		}
 
-		ExReleaseResourceLite(&m_context->m_directoriesResource);
+		ExReleaseResourceLite(&shard->m_directoriesResource);
 		FsRtlExitFileSystem();
 	}
 
@@ -1242,6 +1238,7 @@ NTSTATUS CFilterVolume::RemoteFileChange(FILE_OBJECT *file, FILFILE_TRACK_CONTEX
 
 	// Try to purge corresponding single file Entity, if such exists
 	ExAcquireResourceExclusiveLite(&m_entitiesResource, true);
+	m_decisions.Invalidate();
 
 	NTSTATUS status = RemoveEntity(&track->Entity, 0, ~0u, ENTITY_PURGE | ENTITY_ANYWAY);
 
@@ -1261,17 +1258,19 @@ NTSTATUS CFilterVolume::RemoteFileChange(FILE_OBJECT *file, FILFILE_TRACK_CONTEX
 	{
 		if(file->FsContext)
 		{
-			if(m_context->m_files.Size())
+			CFilterShard *const shard = m_shards.File(file);
+
+			if(shard->m_files.Size())
 			{
-				ExAcquireResourceExclusiveLite(&m_context->m_filesResource, true);
+				ExAcquireResourceExclusiveLite(&shard->m_filesResource, true);
 
 				ULONG pos = ~0u;
 
-				if(m_context->m_files.Check(file, &pos))
+				if(shard->m_files.Check(file, &pos))
 				{
 					ASSERT(pos != ~0u);
 
-					CFilterFile *const filterFile = m_context->m_files.Get(pos);
+					CFilterFile *const filterFile = shard->m_files.Get(pos);
 					ASSERT(filterFile);
 
 					ASSERT(file->FsContext == filterFile->m_fcb);
@@ -1281,11 +1280,11 @@ NTSTATUS CFilterVolume::RemoteFileChange(FILE_OBJECT *file, FILFILE_TRACK_CONTEX
 					{
 						DBGPRINT(("RemoteFileChange: FO[0x%p] Remove file\n", file));
 					
-						m_context->m_files.Remove(pos);
+						shard->m_files.Remove(pos);
 					}
 				}
 
-				ExReleaseResourceLite(&m_context->m_filesResource);
+				ExReleaseResourceLite(&shard->m_filesResource);
 			}
 		}
 	}
@@ -1302,40 +1301,86 @@ NTSTATUS CFilterVolume::RemoteFileChange(FILE_OBJECT *file, FILFILE_TRACK_CONTEX
 
 #pragma LOCKEDCODE
 
-int CFilterVolume::CheckFileCooked(FILE_OBJECT *file, CFilterContextLink *link)
+CFilterStream* CFilterVolume::LookupStream(CFilterShard *shard, FILE_OBJECT *file)
 {
+	ASSERT(shard);
+	ASSERT(file);
+	ASSERT(file->FsContext);
+
+	// Tracked streams are always attached where the FSD supports it
+	if(CFilterFile::CanAttach(file))
+	{
+		return CFilterFile::Attached(file, this);
+	}
+
+	ULONG pos = ~0u;
+
+	if(shard->m_files.Check(file, &pos))
+	{
+		ASSERT(pos != ~0u);
+
+		CFilterFile *const filterFile = shard->m_files.Get(pos);
+		ASSERT(filterFile);
+
+		ASSERT(file->FsContext == filterFile->m_fcb);
+		ASSERT(filterFile->m_stream);
+
+		return filterFile->m_stream;
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+int CFilterVolume::CheckFileCooked(FILE_OBJECT *file, CFilterContextLink *link, CFilterCipher **cipher)
+{
+	ASSERT(link || !cipher);
+
 	int found = 0; 
 
+	if(cipher)
+	{
+		*cipher = 0;
+	}
+
 	if(file && file->FsContext)
 	{
-		ASSERT(m_context);
+		CFilterShard *const shard = m_shards.File(file);
 
-		if(m_context->m_files.Size())
+		if(shard->m_files.Size())
 		{
 			FsRtlEnterFileSystem();
-			ExAcquireSharedStarveExclusive(&m_context->m_filesResource, true);
+			ExAcquireSharedStarveExclusive(&shard->m_filesResource, true);
 
-			ULONG pos = ~0u;
+			CFilterStream *const stream = LookupStream(shard, file);
 
-			if(m_context->m_files.Check(file, &pos))
+			if(stream)
 			{
-				ASSERT(pos != ~0u);
-
-				CFilterFile *const filterFile = m_context->m_files.Get(pos);
-				ASSERT(filterFile);
+				if(cipher)
+				{
+					// copy content but the FileKey, I/O codes through the stream's cipher instead
+					RtlCopyMemory(link, &stream->m_link, FIELD_OFFSET(CFilterContextLink, m_fileKey));
 
-				ASSERT(file->FsContext == filterFile->m_fcb);
+					if(stream->m_cipher)
+					{
+						stream->m_cipher->Reference();
 
-				if(link)
+						*cipher = stream->m_cipher;
+					}
+				}
+				else if(link)
 				{
 					// copy content
-					*link = filterFile->m_link;
+					*link = stream->m_link;
 				}
 
 				found = 1;
 
 				// corresponding Entity no longer active ?
-				if(~0u == filterFile->m_link.m_entityIdentifier)//жǷ񼤻û-1
+				if((~0u == stream->m_link.m_entityIdentifier) || (cipher && !*cipher))
 				{
 					DBGPRINT(("CheckFileCooked -INFO: doomed Entity detected\n"));
 
@@ -1343,7 +1388,48 @@ int CFilterVolume::CheckFileCooked(FILE_OBJECT *file, CFilterContextLink *link)
 				}
 			}
 
-			ExReleaseResourceLite(&m_context->m_filesResource);
+			ExReleaseResourceLite(&shard->m_filesResource);
+			FsRtlExitFileSystem();
+		}
+	}
+
+	return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+int CFilterVolume::ReferenceStream(FILE_OBJECT *file, CFilterStream **stream)
+{
+	ASSERT(stream);
+
+	*stream = 0;
+
+	int found = 0; 
+
+	if(file && file->FsContext)
+	{
+		CFilterShard *const shard = m_shards.File(file);
+
+		if(shard->m_files.Size())
+		{
+			FsRtlEnterFileSystem();
+			ExAcquireSharedStarveExclusive(&shard->m_filesResource, true);
+
+			CFilterStream *const candidate = LookupStream(shard, file);
+
+			if(candidate)
+			{
+				// The tracker cannot let go while we hold its lock
+				candidate->Reference();
+
+				*stream = candidate;
+
+				found = (~0u == candidate->m_link.m_entityIdentifier) ? -1 : 1;
+			}
+
+			ExReleaseResourceLite(&shard->m_filesResource);
 			FsRtlExitFileSystem();
 		}
 	}
@@ -1353,6 +1439,88 @@ int CFilterVolume::CheckFileCooked(FILE_OBJECT *file, CFilterContextLink *link)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#pragma PAGEDCODE
+
+NTSTATUS CFilterVolume::ReadAhead(IRP *irp, CFilterContextLink const* link, CFilterCipher *cipher, LONGLONG vdl)
+{
+	ASSERT(irp);
+	ASSERT(link);
+	ASSERT(cipher);
+
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_MORE_PROCESSING_REQUIRED;
+
+	CFilterStream *stream = 0;
+
+	if(ReferenceStream(IoGetCurrentIrpStackLocation(irp)->FileObject, &stream) > 0)
+	{
+		ASSERT(stream);
+
+		CFilterReadAhead *readAhead = stream->m_readAhead;
+
+		if(!readAhead)
+		{
+			CFilterReadAhead *const created = CFilterReadAhead::Create();
+
+			if(created)
+			{
+				// Another reader may have been faster
+				readAhead = (CFilterReadAhead*) InterlockedCompareExchangePointer((void**) &stream->m_readAhead, created, 0);
+
+				if(readAhead)
+				{
+					created->Close();
+				}
+				else
+				{
+					readAhead = created;
+				}
+			}
+		}
+
+		if(readAhead)
+		{
+			status = readAhead->Read(m_extension, irp, link, cipher, vdl);
+
+			if(STATUS_SUCCESS == status)
+			{
+				m_statistics.Add(FILFILE_STAT_READAHEAD_HITS);
+			}
+		}
+	}
+
+	if(stream)
+	{
+		stream->Release();
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+void CFilterVolume::InvalidateReadAhead(FILE_OBJECT *file)
+{
+	CFilterStream *stream = 0;
+
+	ReferenceStream(file, &stream);
+
+	if(stream)
+	{
+		if(stream->m_readAhead)
+		{
+			stream->m_readAhead->Invalidate();
+		}
+
+		stream->Release();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 #pragma LOCKEDCODE
 
 NTSTATUS CFilterVolume::UpdateLink(FILE_OBJECT *file, ULONG flags, bool clear)
@@ -1364,38 +1532,31 @@ NTSTATUS CFilterVolume::UpdateLink(FILE_OBJECT *file, ULONG flags, bool clear)
 
 	if(file && file->FsContext)
 	{
-		ASSERT(m_context);
+		CFilterShard *const shard = m_shards.File(file);
 
 		FsRtlEnterFileSystem();
-		ExAcquireResourceSharedLite(&m_context->m_filesResource, true);
+		ExAcquireResourceSharedLite(&shard->m_filesResource, true);
 
-		ULONG pos = ~0u;
+		CFilterStream *const stream = LookupStream(shard, file);
 
-		if(m_context->m_files.Check(file, &pos))
+		if(stream)
 		{
-			ASSERT(pos != ~0u);
-
-			CFilterFile *const filterFile = m_context->m_files.Get(pos);
-			ASSERT(filterFile);
-
-			ASSERT(file->FsContext == filterFile->m_fcb);
-
 			// Use interlocked functions to modify embedded flags value to avoid an
 			// exclusive lock on covering structure, it is NetShare's hottest lock.
 
 			if(clear)
 			{	
-				InterlockedAnd((LONG*) &filterFile->m_link.m_flags, flags);
+				InterlockedAnd((LONG*) &stream->m_link.m_flags, flags);
 			}
 			else
 			{
-				InterlockedOr((LONG*) &filterFile->m_link.m_flags, flags);
+				InterlockedOr((LONG*) &stream->m_link.m_flags, flags);
 			}
 
 			status = STATUS_SUCCESS;
 		}
 
-		ExReleaseResourceLite(&m_context->m_filesResource);
+		ExReleaseResourceLite(&shard->m_filesResource);
 		FsRtlExitFileSystem();
 	}
 	
@@ -1501,6 +1662,9 @@ NTSTATUS CFilterVolume::InitNewFile(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *tr
 	CFilterHeader local;
 	RtlZeroMemory(&local, sizeof(local));
 
+	CFilterKey wrapped;
+	RtlZeroMemory(&wrapped, sizeof(wrapped));
+
 	NTSTATUS status = STATUS_SUCCESS;
 
 	bool generate = true;
@@ -1568,41 +1732,52 @@ NTSTATUS CFilterVolume::InitNewFile(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *tr
 	{
 		if(generate)
 		{
-			// generate new FileKey with EntityKey's attribs
+			// generate new FileKey with EntityKey's attribs, its encrypted form and a new Nonce
 			local.m_key.m_cipher = track->EntityKey.m_cipher;
 			local.m_key.m_size   = track->EntityKey.m_size;
 			    		
-			status = m_context->GenerateFileKey(&local.m_key);
-
-			// generate new Nonce
-			m_context->GenerateNonce(&local.m_nonce);
+			status = m_context->GenerateFileKey(&track->EntityKey, &local.m_key, &wrapped, &local.m_nonce);
 
 			DBGPRINT(("InitNewFile: new Key[0x%x] and Nonce[0x%I64x]\n", *((ULONG*) local.m_key.m_key), local.m_nonce));
 
 			#if DBG
 			{
-				// check new FileKey against active ones to ensure its uniqueness
-				ExAcquireResourceSharedLite(&m_context->m_filesResource, true);
-
-				for(ULONG index = 0; index < m_context->m_files.Size(); ++index)
+				// check new FileKey and Nonce against active ones to ensure their uniqueness
+				for(ULONG shardIndex = 0; shardIndex < CFilterShards::c_shards; ++shardIndex)
 				{
-					CFilterFile *const filterFile = m_context->m_files.Get(index);
-					ASSERT(filterFile);
+					CFilterShard *const shard = m_shards.Get(shardIndex);
+
+					ExAcquireResourceSharedLite(&shard->m_filesResource, true);
 
-					if(filterFile->m_link.m_fileKey.m_size == local.m_key.m_size)
+					for(ULONG index = 0; index < shard->m_files.Size(); ++index)
 					{
-						if(RtlEqualMemory(local.m_key.m_key, filterFile->m_link.m_fileKey.m_key, local.m_key.m_size))
+						CFilterFile *const filterFile = shard->m_files.Get(index);
+						ASSERT(filterFile);
+
+						if(filterFile->m_stream->m_link.m_fileKey.m_size == local.m_key.m_size)
 						{
-							DBGPRINT(("InitNewFile -WARN: FileKey already used\n"));
+							if(RtlEqualMemory(local.m_key.m_key, filterFile->m_stream->m_link.m_fileKey.m_key, local.m_key.m_size))
+							{
+								DBGPRINT(("InitNewFile -WARN: FileKey already used\n"));
+
+								// should never come here ...
+								ASSERT(false);
+								break;
+							}
+						}
+
+						if(local.m_nonce.QuadPart == filterFile->m_stream->m_link.m_nonce.QuadPart)
+						{
+							DBGPRINT(("InitNewFile -WARN: Nonce[0x%I64x] already used\n", local.m_nonce));
 
 							// should never come here ...
 							ASSERT(false);
 							break;
 						}
 					}
-				}
 
-				ExReleaseResourceLite(&m_context->m_filesResource);
+					ExReleaseResourceLite(&shard->m_filesResource);
+				}
 			}
 			#endif
 		}
@@ -1622,8 +1797,16 @@ NTSTATUS CFilterVolume::InitNewFile(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *tr
 			ASSERT(track->EntityKey.m_size);
 			ASSERT(track->EntityKey.m_cipher);
 
-			// Encrypt FileKey using EntityKey 
-			m_context->EncodeFileKey(&track->EntityKey, &local.m_key, false);
+			if(generate)
+			{
+				// Already encrypted using EntityKey
+				local.m_key = wrapped;
+			}
+			else
+			{
+				// Encrypt FileKey using EntityKey 
+				m_context->EncodeFileKey(&track->EntityKey, &local.m_key, false);
+			}
 
 			// Add Header to file
 			status = CFilterCipherManager(m_extension).WriteHeader(file, &local);
@@ -1641,6 +1824,7 @@ NTSTATUS CFilterVolume::InitNewFile(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *tr
 	// Be paranoid
 	local.m_key.Clear();
 	link.m_fileKey.Clear();
+	wrapped.Clear();
 	
 	FsRtlExitFileSystem();
 
@@ -1719,27 +1903,29 @@ NTSTATUS CFilterVolume::OnDirectoryClose(FILE_OBJECT *directory)
 
 	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
 
-	if(m_context->m_directories.Size())
+	CFilterShard *const shard = m_shards.Directory(directory);
+
+	if(shard->m_directories.Size())
 	{
 		FsRtlEnterFileSystem();
-		ExAcquireResourceExclusiveLite(&m_context->m_directoriesResource, true);
+		ExAcquireResourceExclusiveLite(&shard->m_directoriesResource, true);
 
 		ULONG pos = ~0u;
 
 		// tracked directory ?
-		if(m_context->m_directories.Search(directory, &pos))
+		if(shard->m_directories.Search(directory, &pos))
 		{
 			ASSERT(pos != ~0u);
 
 			DBGPRINT(("OnDirectoryClose: FO[0x%p] Flags[0x%x]\n", directory, directory->Flags));
 	
 			ASSERT(pos != ~0u);
-			m_context->m_directories.Remove(0, pos);
+			shard->m_directories.Remove(0, pos);
 
 			status = STATUS_SUCCESS;
 		}
 
-		ExReleaseResourceLite(&m_context->m_directoriesResource);
+		ExReleaseResourceLite(&shard->m_directoriesResource);
 		FsRtlExitFileSystem();
 	}
 
@@ -1804,31 +1990,46 @@ NTSTATUS CFilterVolume::OnFileCreate(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *t
 		}
 	}
 
+	CFilterShard *const shard = m_shards.File(file);
+
 	ULONG const hash = track->Entity.Hash(CFilterPath::PATH_FILE);
 	ULONG pos   = ~0u;
 	bool create = true;
 
-	ExAcquireResourceExclusiveLite(&m_context->m_filesResource, true);
+	ExAcquireResourceExclusiveLite(&shard->m_filesResource, true);
 
 	for(ULONG step = 0; step < 2; ++step)
 	{
 		// File already tracked?
-		if(m_context->m_files.Check(file, &pos))
+		if(shard->m_files.Check(file, &pos))
 		{
-			CFilterFile *const filterFile = m_context->m_files.Get(pos);
+			CFilterFile *const filterFile = shard->m_files.Get(pos);
 			ASSERT(filterFile);
 
 			ASSERT(file->FsContext == filterFile->m_fcb);
 	
-			if(filterFile->m_link.m_entityIdentifier != ~0u)
+			if(filterFile->m_stream->m_link.m_entityIdentifier != ~0u)
 			{
+				// The FCB may have been torn down and reused meanwhile
+				status = filterFile->Attach(file, this);
+
+				if(NT_ERROR(status))
+				{
+					DBGPRINT(("OnFileCreate -ERROR: FO[0x%p] attach failed[0x%08x]\n", file, status));
+
+					ExReleaseResourceLite(&shard->m_filesResource);
+					FsRtlExitFileSystem();
+
+					return status;
+				}
+
 				// So just increment refCount
 				filterFile->OnCreate(file, hash);
 
 				DBGPRINT(("OnFileCreate: PID:TID[0x%x:0x%x] Hash[0x%x]\n", PsGetCurrentProcessId(), filterFile->m_threadId, hash));
 				DBGPRINT(("OnFileCreate: FO[0x%p] FCB[0x%p] new RefCount[%d]\n", file, file->FsContext, filterFile->m_refCount));
 
-				ExReleaseResourceLite(&m_context->m_filesResource);
+				ExReleaseResourceLite(&shard->m_filesResource);
 				FsRtlExitFileSystem();
 
 				return STATUS_SUCCESS;
@@ -1858,7 +2059,7 @@ NTSTATUS CFilterVolume::OnFileCreate(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *t
 			// is denying access in the hope that things are more *relaxed* pretty soon.
 			DBGPRINT(("OnFileCreate: FO[0x%p] Flush/Purge failed, deny access\n", file));
 		
-			ExReleaseResourceLite(&m_context->m_filesResource);
+			ExReleaseResourceLite(&shard->m_filesResource);
 			FsRtlExitFileSystem();
 
 			return STATUS_SHARING_VIOLATION;
@@ -1867,14 +2068,14 @@ NTSTATUS CFilterVolume::OnFileCreate(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *t
 		DBGPRINT(("OnFileCreate: FO[0x%p] is cached, try Flush/Purge\n", file));
 
 		// Do not hold locks while waiting
-		ExReleaseResourceLite(&m_context->m_filesResource);
+		ExReleaseResourceLite(&shard->m_filesResource);
 
 		// The cache is polluted with unknown data, try to flush/purge. Do this in a loop 
 		// to give remote nodes time to react on Oplock breaks - max wait time is ~5 sec.
 
 		CFilterBase::TearDownCache(file, 50, 100);
 
-		ExAcquireResourceExclusiveLite(&m_context->m_filesResource, true);
+		ExAcquireResourceExclusiveLite(&shard->m_filesResource, true);
 	}
 
 	ASSERT(pos != ~0u);
@@ -1883,12 +2084,22 @@ NTSTATUS CFilterVolume::OnFileCreate(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *t
 	ASSERT(track->Header.m_blockSize);
 
 	CFilterFile filterFile;
-	filterFile.Init();
+	status = filterFile.Init();
+
+	if(NT_ERROR(status))
+	{
+		ExReleaseResourceLite(&shard->m_filesResource);
+		FsRtlExitFileSystem();
+
+		return status;
+	}
 
-	filterFile.m_link.m_entityIdentifier = track->Entity.m_identifier;
-	filterFile.m_link.m_headerIdentifier = track->Entity.m_headerIdentifier;
-	filterFile.m_link.m_nonce			 = track->Header.m_nonce;
-	filterFile.m_link.m_headerBlockSize	 = track->Header.m_blockSize;
+	CFilterContextLink *const link = &filterFile.m_stream->m_link;
+
+	link->m_entityIdentifier = track->Entity.m_identifier;
+	link->m_headerIdentifier = track->Entity.m_headerIdentifier;
+	link->m_nonce			 = track->Header.m_nonce;
+	link->m_headerBlockSize	 = track->Header.m_blockSize;
 	
 	// Is FileKey encrypted?
 	if( !(track->State & TRACK_HAVE_KEY))
@@ -1900,21 +2111,35 @@ NTSTATUS CFilterVolume::OnFileCreate(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *t
 	}
 
 	// Copy FileKey
-	filterFile.m_link.m_fileKey = track->Header.m_key;
+	link->m_fileKey = track->Header.m_key;
+
+	// I/O codes through it, the cipher is expanded on first use
+	filterFile.m_stream->m_cipher = CFilterCipher::Create(&link->m_fileKey, &link->m_nonce);
 
-	status = filterFile.OnCreate(file, hash);
+	status = (filterFile.m_stream->m_cipher) ? filterFile.OnCreate(file, hash) : STATUS_INSUFFICIENT_RESOURCES;
 
 	if(NT_SUCCESS(status))
 	{
 		if(create)
 		{
-			// Add to tracking List
-			status = m_context->m_files.Add(&filterFile, pos);
+			// Attach first, as lookups rely on it
+			status = filterFile.Attach(file, this);
+
+			if(NT_SUCCESS(status))
+			{
+				// Add to tracking List
+				status = shard->m_files.Add(&filterFile, pos);
+			}
 		}
 		else
 		{
 			// Update tracked object
-			status = m_context->m_files.Update(&filterFile, pos);
+			status = shard->m_files.Update(&filterFile, pos);
+
+			if(NT_SUCCESS(status))
+			{
+				status = shard->m_files.Get(pos)->Attach(file, this);
+			}
 		}
 
 		if(NT_SUCCESS(status))
@@ -1924,19 +2149,40 @@ NTSTATUS CFilterVolume::OnFileCreate(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *t
 			DBGPRINT(("OnFileCreate: %s FO[0x%p] FCB[0x%p] Key[0x%x], Nonce[0x%I64x]\n", create ? "Added new" : "Updated existing",
 																						 file, 
 																						 file->FsContext, 
-																						 *((ULONG*) filterFile.m_link.m_fileKey.m_key), 
-																						 filterFile.m_link.m_nonce));
+																						 *((ULONG*) link->m_fileKey.m_key), 
+																						 link->m_nonce));
 		}
-
-		filterFile.Close();
 	}
 
-	// Be paranoid
-	filterFile.m_link.m_fileKey.Clear();
+	// Drops the local copy, if not taken over
+	filterFile.Close();
 
-	ExReleaseResourceLite(&m_context->m_filesResource);
+	ExReleaseResourceLite(&shard->m_filesResource);
 	FsRtlExitFileSystem();
 
+	if(NT_SUCCESS(status))
+	{
+		ULONG entityBlockSize = track->Entity.m_headerBlocksize;
+
+		if(!entityBlockSize && track->Entity.m_headerIdentifier)
+		{
+			CFilterHeaderCont &headers = m_context->Headers();
+			headers.LockShared();
+
+			CFilterHeader const *header = headers.Get(track->Entity.m_headerIdentifier);
+
+			if(header)
+			{
+				entityBlockSize = header->m_blockSize;
+			}
+
+			headers.Unlock();
+		}
+
+		// Remember Header block sizes deviating from the Entity's one for directory listings
+		m_context->m_sizes.Update(&track->Entity, track->Header.m_blockSize, entityBlockSize);
+	}
+
 	return status;
 }
 
@@ -1954,31 +2200,33 @@ NTSTATUS CFilterVolume::OnFileCleanup(FILE_OBJECT *file)
 
 	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
 
-	if(file->FsContext && m_context->m_files.Size())
+	CFilterShard *const shard = (file->FsContext) ? m_shards.File(file) : 0;
+
+	if(shard && shard->m_files.Size())
 	{
 		FsRtlEnterFileSystem();
-		ExAcquireResourceSharedLite(&m_context->m_filesResource, true);
+		ExAcquireResourceSharedLite(&shard->m_filesResource, true);
 
 		ULONG pos = ~0u;
 
 		// tracked file ?
-		if(m_context->m_files.Check(file, &pos))
+		if(shard->m_files.Check(file, &pos))
 		{
 			status = STATUS_SUCCESS;
 
 			ASSERT(pos != ~0u);
-			CFilterFile* const filterFile = m_context->m_files.Get(pos);
+			CFilterFile* const filterFile = shard->m_files.Get(pos);
 			ASSERT(filterFile);
 
 			// doomed FO (w/o active Entity) ?
-			if((~0u == filterFile->m_link.m_entityIdentifier) || !filterFile->m_link.m_entityIdentifier)
+			if((~0u == filterFile->m_stream->m_link.m_entityIdentifier) || !filterFile->m_stream->m_link.m_entityIdentifier)
 			{
 				// inform caller
 				status = STATUS_ALERTED;
 			}
 		}
 
-		ExReleaseResourceLite(&m_context->m_filesResource);
+		ExReleaseResourceLite(&shard->m_filesResource);
 		FsRtlExitFileSystem();
 	}
 
@@ -2006,18 +2254,20 @@ NTSTATUS CFilterVolume::OnFileClose(FILE_OBJECT *file, bool discard)
 
 	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
 
-	if(file->FsContext && m_context->m_files.Size())
+	CFilterShard *const shard = (file->FsContext) ? m_shards.File(file) : 0;
+
+	if(shard && shard->m_files.Size())
 	{
 		FsRtlEnterFileSystem();
-		ExAcquireResourceExclusiveLite(&m_context->m_filesResource, true);
+		ExAcquireResourceExclusiveLite(&shard->m_filesResource, true);
 
 		ULONG entityIdentifier = 0;
 		ULONG pos = ~0u;
 
-		if(m_context->m_files.Check(file, &pos))
+		if(shard->m_files.Check(file, &pos))
 		{
 			ASSERT(pos != ~0u);
-			CFilterFile *const filterFile = m_context->m_files.Get(pos);
+			CFilterFile *const filterFile = shard->m_files.Get(pos);
 			ASSERT(filterFile);
 			ASSERT(filterFile->m_fcb == file->FsContext);
 
@@ -2049,7 +2299,7 @@ NTSTATUS CFilterVolume::OnFileClose(FILE_OBJECT *file, bool discard)
 			if(remove)
 			{
 				// Save Entity identifier
-				entityIdentifier = filterFile->m_link.m_entityIdentifier;
+				entityIdentifier = filterFile->m_stream->m_link.m_entityIdentifier;
 
 				// Only if not doomed
 				if(entityIdentifier == ~0u)
@@ -2057,28 +2307,23 @@ NTSTATUS CFilterVolume::OnFileClose(FILE_OBJECT *file, bool discard)
 					entityIdentifier = 0;
 				}
 
-				m_context->m_files.Remove(pos);
+				shard->m_files.Remove(pos);
 
 				status = STATUS_SUCCESS;
 			}
 		}
 
-		if(entityIdentifier)
-		{
-			ExConvertExclusiveToSharedLite(&m_context->m_filesResource);
+		ExReleaseResourceLite(&shard->m_filesResource);
+		FsRtlExitFileSystem();
 
-			// Check whether this file Entity is still referenced
-			if(m_context->m_files.CheckIdentifier(entityIdentifier))
-			{
-				DBGPRINT(("OnFileClose:	FO[0x%p] Entity[0x%x] still referenced\n", file, entityIdentifier));
+		// Check whether this file Entity is still referenced, by FCBs of any shard
+		if(entityIdentifier && m_shards.CheckIdentifier(entityIdentifier))
+		{
+			DBGPRINT(("OnFileClose:	FO[0x%p] Entity[0x%x] still referenced\n", file, entityIdentifier));
 
-				// Do not remove it then
-				entityIdentifier = 0;
-			}
+			// Do not remove it then
+			entityIdentifier = 0;
 		}
-
-		ExReleaseResourceLite(&m_context->m_filesResource);
-		FsRtlExitFileSystem();
 		
 		// If last FO was closed, check for orphaned single file Entity to be removed
 		if(entityIdentifier)
@@ -2228,8 +2473,10 @@ NTSTATUS CFilterVolume::ManageEncryption(FILE_OBJECT *file, FILFILE_TRACK_CONTEX
 									{
 										ASSERT(flags == FILFILE_CONTROL_ADD);
 
+										NTSTATUS const recognized = manager.RecognizeHeader(stream);
+
 										// stream must NOT have Header, don't propagate error
-										if(NT_ERROR(manager.RecognizeHeader(stream)))
+										if(NT_ERROR(recognized) && (STATUS_NOT_SUPPORTED != recognized))
 										{
 											// process this data stream
 											status = ManageEncryptionFile(stream, present, future, flags);
@@ -2312,6 +2559,13 @@ NTSTATUS CFilterVolume::ManageEncryptionFile(FILE_OBJECT *file, FILFILE_TRACK_CO
 
 	CFilterCipherManager manager(m_extension);
 
+	// New FileKey, encrypted using the EntityKey
+	CFilterKey wrapped;
+	RtlZeroMemory(&wrapped, sizeof(wrapped));
+
+	// Header layout unchanged, so patch FileKey and Payload only
+	bool rewrap = false;
+
 	// Since we work inplace, save Entity keys
 	CFilterKey presentKey;
 	presentKey.Clear();
@@ -2387,6 +2641,11 @@ NTSTATUS CFilterVolume::ManageEncryptionFile(FILE_OBJECT *file, FILFILE_TRACK_CO
 				present->Header.m_key.m_size = keySize;
 				future->Header.m_key.m_size  = keySize;
 			}
+			else
+			{
+				// File data stays where it is
+				rewrap = true;
+			}
 		}
 	}
 	else if(flags & FILFILE_CONTROL_ADD)
@@ -2404,10 +2663,8 @@ NTSTATUS CFilterVolume::ManageEncryptionFile(FILE_OBJECT *file, FILFILE_TRACK_CO
 		future->Header.m_key.m_cipher = future->EntityKey.m_cipher;
 		future->Header.m_key.m_size   = future->EntityKey.m_size;
 
-		status = m_context->GenerateFileKey(&future->Header.m_key);
-
-		// Generate new Nonce value
-		m_context->GenerateNonce(&future->Header.m_nonce);
+		// Along with its encrypted form and a new Nonce value
+		status = m_context->GenerateFileKey(&future->EntityKey, &future->Header.m_key, &wrapped, &future->Header.m_nonce);
 
 		if(NT_SUCCESS(status))
 		{
@@ -2430,12 +2687,35 @@ NTSTATUS CFilterVolume::ManageEncryptionFile(FILE_OBJECT *file, FILFILE_TRACK_CO
 			ASSERT(future->Header.m_key.m_size);
 			ASSERT(future->Header.m_key.m_cipher);
 
-			// Encrypt the FileKey using the EntityKey
-			m_context->EncodeFileKey(&future->EntityKey, &future->Header.m_key, false);
+			if(wrapped.m_size)
+			{
+				// New FileKey, already encrypted
+				future->Header.m_key = wrapped;
+			}
+			else
+			{
+				// Encrypt the FileKey using the EntityKey
+				m_context->EncodeFileKey(&future->EntityKey, &future->Header.m_key, false);
+			}
 		}
 
-		// Write new Header
-		status = manager.WriteHeader(file, &future->Header);
+		if(rewrap)
+		{
+			// Rewrite changed Header parts only
+			status = manager.RewrapHeader(file, &future->Header);
+
+			if(STATUS_BUFFER_TOO_SMALL == status)
+			{
+				// Payload too large for a copy within the block
+				rewrap = false;
+			}
+		}
+
+		if(!rewrap)
+		{
+			// Write new Header
+			status = manager.WriteHeader(file, &future->Header);
+		}
 	}
 
 	// Restore Entity keys
@@ -2450,6 +2730,8 @@ NTSTATUS CFilterVolume::ManageEncryptionFile(FILE_OBJECT *file, FILFILE_TRACK_CO
 		futureKey.Clear();
 	}
 
+	wrapped.Clear();
+
 	FsRtlExitFileSystem();
 
 	return status;
@@ -2877,6 +3159,17 @@ NTSTATUS CFilterVolume::AutoConfigVerify(IRP *irp, FILFILE_TRACK_CONTEXT *track,
 					track->State = TRACK_NO;
 				}
 			}
+			else if(!created && !flags && (STATUS_OBJECT_NAME_NOT_FOUND == status) && !(track->State & TRACK_SHARE_DIRTORY))
+			{
+				// Outside of any Entity and without AutoConfig file, so let next opens pass directly
+				if(CFilterDecisionCache::Eligible(irp, m_extension->LowerType))
+				{
+					FILE_OBJECT const*const file = IoGetCurrentIrpStackLocation(irp)->FileObject;
+					ASSERT(file);
+
+					m_decisions.Add(file->FileName.Buffer, file->FileName.Length, track->Decision, track->DecisionAutoConfigs);
+				}
+			}
 		}
 
 		// To be removed?
@@ -2927,18 +3220,75 @@ NTSTATUS CFilterVolume::AutoConfigCheck(IRP *irp, FILFILE_TRACK_CONTEXT *track,
 		DBGPRINT(("AutoConfigCheck: FO[0x%p] Kernel mode request, but SL_OPEN_TARGET_DIRECTORY\n", IoGetCurrentIrpStackLocation(irp)->FileObject));
 	}
 
+	bool const remote = (m_extension->LowerType & FILFILE_DEVICE_REDIRECTOR) ? true : false;
+
+	if(remote)
+	{
+		// Ignore relative opens on Redirectors to handle WXP's DFS roots correctly
+		related = 0;
+	}
+
+	// Path of AutoConfig file, or of its directory on relative opens. Used as cache key.
+	UNICODE_STRING autoConfig = {0,0,0};
+	ULONG autoConfigFlags	  = (remote) ? CFilterAutoConfigCache::AUTOCONFIG_REMOTE : 0;
+
+	// Usually short enough to avoid the pool
+	CFilterPathBuffer autoConfigBuffer;
+	autoConfigBuffer.Init();
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	if(related)
+	{
+		ULONG length = 0;
+
+		// Not fatal, cache is bypassed then
+		autoConfig.Buffer = autoConfigBuffer.Write(&track->Entity, CFilterPath::PATH_VOLUME | CFilterPath::PATH_FILE, &length);
+		autoConfig.Length = (USHORT) length;
+
+		autoConfigFlags |= CFilterAutoConfigCache::AUTOCONFIG_RELATED;
+	}
+	else
+	{
+		ULONG flags = 0;
+
+		// Creative Directory open?
+		if((irp->RequestorMode == KernelMode & (stack->Parameters.Create.Options & FILE_DIRECTORY_FILE)) || (stack->Parameters.Create.Options & FILE_DIRECTORY_FILE) && (FILE_CREATE == (stack->Parameters.Create.Options >> 24)))
+		{
+			DBGPRINT(("AutoConfigCheck: FO[0x%p] Check parent directory\n", IoGetCurrentIrpStackLocation(irp)->FileObject));
+
+			flags = CFilterPath::PATH_DIRECTORY;
+		}
+
+		// Create path with AutoConfig file
+		status = track->Entity.GetAutoConfig(&autoConfig, flags, &autoConfigBuffer);
+	}
+
+	// Sample before the open, so that concurrent AutoConfig creations are not missed
+	ULONG const generation = m_autoConfigs.Generation();
+
+	// Already known to have none?
+	if(autoConfig.Buffer && autoConfig.Length && !(track->State & TRACK_SHARE_DIRTORY))
+	{
+		if(m_autoConfigs.Check(autoConfig.Buffer, autoConfig.Length, autoConfigFlags))
+		{
+			m_statistics.Add(FILFILE_STAT_AUTOCONFIG_AVOIDED);
+
+			autoConfigBuffer.Close();
+
+			return STATUS_OBJECT_NAME_NOT_FOUND;
+		}
+	}
+
 	// use temporary stream file object to avoid side effects
 	FILE_OBJECT *fileStream = 0;
 
 	__try
 	{
-		if(m_extension->LowerType & FILFILE_DEVICE_REDIRECTOR)
+		if(remote)
 		{
 			// On redirectors, create intermediate FO directly on device below - otherwise MUP will barf (BSOD) on close
 			fileStream = IoCreateStreamFileObjectLite(0, m_extension->Lower);
-
-			// Ignore relative opens on Redirectors to handle WXP's DFS roots correctly
-			related = 0;
 		}
 		else
 		{
@@ -2952,13 +3302,13 @@ NTSTATUS CFilterVolume::AutoConfigCheck(IRP *irp, FILFILE_TRACK_CONTEXT *track,
 
 	if(!fileStream)
 	{
+		autoConfigBuffer.Close();
+
 		return STATUS_INSUFFICIENT_RESOURCES;
 	}
 
 	fileStream->Flags |= FO_SYNCHRONOUS_IO;
 
-	NTSTATUS status = STATUS_SUCCESS;
-
 	if(related)
 	{
 		fileStream->RelatedFileObject = related;
@@ -2977,20 +3327,22 @@ NTSTATUS CFilterVolume::AutoConfigCheck(IRP *irp, FILFILE_TRACK_CONTEXT *track,
 			status = STATUS_SUCCESS;
 		}
 	}
-	else
+	else if(NT_SUCCESS(status))
 	{
-		ULONG flags = 0;
+		status = STATUS_INSUFFICIENT_RESOURCES;
 
-		// Creative Directory open?
-		if((irp->RequestorMode == KernelMode & (stack->Parameters.Create.Options & FILE_DIRECTORY_FILE)) || (stack->Parameters.Create.Options & FILE_DIRECTORY_FILE) && (FILE_CREATE == (stack->Parameters.Create.Options >> 24)))
+		// The lower FS owns this one, keep ours as key
+		fileStream->FileName.Buffer = (LPWSTR) ExAllocatePool(PagedPool, autoConfig.MaximumLength);
+
+		if(fileStream->FileName.Buffer)
 		{
-			DBGPRINT(("AutoConfigCheck: FO[0x%p] Check parent directory\n", IoGetCurrentIrpStackLocation(irp)->FileObject));
+			fileStream->FileName.Length		   = autoConfig.Length;
+			fileStream->FileName.MaximumLength = autoConfig.MaximumLength;
 
-			flags = CFilterPath::PATH_DIRECTORY;
-		}
+			RtlCopyMemory(fileStream->FileName.Buffer, autoConfig.Buffer, autoConfig.MaximumLength);
 
-		// Create path with AutoConfig file
-		status = track->Entity.GetAutoConfig(&fileStream->FileName, flags);
+			status = STATUS_SUCCESS;
+		}
 	}
 
 	if(NT_SUCCESS(status))
@@ -3014,6 +3366,8 @@ NTSTATUS CFilterVolume::AutoConfigCheck(IRP *irp, FILFILE_TRACK_CONTEXT *track,
 		next->Flags		 = 0;
 		next->FileObject = fileStream;
 
+		m_statistics.Add(FILFILE_STAT_AUTOCONFIG_OPENS);
+
 		// open file, if exists
 		status = CFilterBase::SimpleSend(m_extension->Lower, irp);
 
@@ -3029,6 +3383,14 @@ NTSTATUS CFilterVolume::AutoConfigCheck(IRP *irp, FILFILE_TRACK_CONTEXT *track,
 		{
 			DBGPRINT(("AutoConfigCheck -INFO: STATUS_REPARSE returned\n"));
 		}
+		else if(STATUS_OBJECT_NAME_NOT_FOUND == status)
+		{
+			if(autoConfig.Buffer && autoConfig.Length)
+			{
+				// Remember missing one
+				m_autoConfigs.Add(autoConfig.Buffer, autoConfig.Length, autoConfigFlags, generation);
+			}
+		}
 
 		if(stack->Parameters.Create.SecurityContext)
 		{
@@ -3082,6 +3444,8 @@ NTSTATUS CFilterVolume::AutoConfigCheck(IRP *irp, FILFILE_TRACK_CONTEXT *track,
 
 	ObDereferenceObject(fileStream);
 
+	autoConfigBuffer.Close();
+
 	return status;
 }
 
@@ -3208,6 +3572,7 @@ NTSTATUS CFilterVolume::CreateEntity(FILFILE_TRACK_CONTEXT *track, ULONG flags)
 
 	FsRtlEnterFileSystem();
 	ExAcquireResourceExclusiveLite(&m_entitiesResource, true);
+	m_decisions.Invalidate();
 
 	NTSTATUS status = AddEntity(track, flags);
 
@@ -3368,10 +3733,25 @@ NTSTATUS CFilterVolume::PostCreateEntity(IRP *irp, FILFILE_TRACK_CONTEXT *track,
 		// Invalidate header identifier as it is different from matched Entity
 		track->Entity.m_headerIdentifier = 0;
 
+		// Files are resumed once the key is there instead of holding this thread, see CFilterEngine::CreatePend
+		if(flags & TRACK_TYPE_FILE)
+		{
+			track->State = TRACK_PENDED;
+
+			FsRtlExitFileSystem();
+
+			return STATUS_PENDING;
+		}
+
 		ULONG const ctrlFlags = (flags & TRACK_TYPE_DIRECTORY) ? FILFILE_CONTROL_DIRECTORY : FILFILE_CONTROL_NULL;
 
-		// Retrieve Key from UserMode with spinning
-		status = CFilterControl::Callback().FireKey(ctrlFlags, track);
+		LONGLONG const start = KeQueryInterruptTime();
+
+		// Retrieve Key from UserMode, joining an outstanding request for the same Header
+		status = CFilterControl::Callback().FireKey(ctrlFlags, track, irp);
+
+		m_statistics.Add(NT_SUCCESS(status) ? FILFILE_STAT_KEY_REQUESTS : FILFILE_STAT_KEY_FAILED);
+		m_statistics.AddKeyWait(start);
 
 		if(NT_SUCCESS(status))
 		{
@@ -3519,8 +3899,12 @@ NTSTATUS CFilterVolume::PreCreate(IRP *irp, FILFILE_TRACK_CONTEXT *track)
 					FsRtlEnterFileSystem();
 					ExAcquireSharedStarveExclusive(&m_entitiesResource, true);
 
+					LONGLONG const stage = CFilterStatistics::StageStart();
+
 					ULONG const pos = m_entities.Check(&track->Entity);
 
+					m_statistics.AddStage(FILFILE_STAT_STAGE_ENTITY, stage);
+
 					if(pos != ~0u)
 					{
 						track->State = TRACK_YES;
@@ -3763,9 +4147,13 @@ NTSTATUS CFilterVolume::PostCreate(IRP *irp, FILFILE_TRACK_CONTEXT *track)
 		FsRtlEnterFileSystem();
 		ExAcquireSharedStarveExclusive(&m_entitiesResource, true);
 
+		LONGLONG const stage = CFilterStatistics::StageStart();
+
 		// check against active Entities
 		ULONG const pos = m_entities.Check(&track->Entity);
 
+		m_statistics.AddStage(FILFILE_STAT_STAGE_ENTITY, stage);
+
 		if(pos != ~0u)
 		{
 			track->State |= TRACK_YES;
@@ -3816,59 +4204,83 @@ NTSTATUS CFilterVolume::PostCreate(IRP *irp, FILFILE_TRACK_CONTEXT *track)
 	// request canceled ?
 	if(track->State & TRACK_CANCEL)
 	{
-		// Rollback?
-		if(FILE_CREATED == irp->IoStatus.Information)
-		{
-			DBGPRINT(("PostCreate: delete newly created file\n"));
+		status = PostCreateCancel(irp, track);
+	}
+
+	return status;
+}
 
-			FILE_DISPOSITION_INFORMATION dispInfo = {true};
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-			CFilterBase::SetFileInfo(m_extension->Lower, 
-									 stack->FileObject, 
-									 FileDispositionInformation, 
-									 &dispInfo, 
-									 sizeof(dispInfo));
-		}
+#pragma PAGEDCODE
 
-		// Check whether FO comes from MUP. If so, never call IoCancelFileOpen() 
-		// on it as it will BSOD. This has been fixed in Vista and later.
+NTSTATUS CFilterVolume::PostCreateCancel(IRP *irp, FILFILE_TRACK_CONTEXT *track)
+{
+	ASSERT(irp);
+	ASSERT(track);
+	ASSERT(track->State & TRACK_CANCEL);
 
-		if((m_extension->LowerType & FILFILE_DEVICE_VOLUME) || (ver & (FILFILE_SYSTEM_WINVISTA | FILFILE_SYSTEM_WIN7)))
+	PAGED_CODE();
+
+	ASSERT(m_extension);
+
+	IO_STACK_LOCATION const*const stack = IoGetCurrentIrpStackLocation(irp);
+	ASSERT(stack);
+
+	ULONG const ver = CFilterControl::Extension()->SystemVersion;
+
+	// Rollback?
+	if(FILE_CREATED == irp->IoStatus.Information)
+	{
+		DBGPRINT(("PostCreate: delete newly created file\n"));
+
+		FILE_DISPOSITION_INFORMATION dispInfo = {true};
+
+		CFilterBase::SetFileInfo(m_extension->Lower, 
+								 stack->FileObject, 
+								 FileDispositionInformation, 
+								 &dispInfo, 
+								 sizeof(dispInfo));
+	}
+
+	// Check whether FO comes from MUP. If so, never call IoCancelFileOpen() 
+	// on it as it will BSOD. This has been fixed in Vista and later.
+
+	if((m_extension->LowerType & FILFILE_DEVICE_VOLUME) || (ver & (FILFILE_SYSTEM_WINVISTA | FILFILE_SYSTEM_WIN7)))
+	{
+		IoCancelFileOpen(m_extension->Lower, stack->FileObject);
+	}
+	else
+	{
+		DEVICE_OBJECT *target = CFilterBase::GetDeviceObject(stack->FileObject);
+		ASSERT(target);
+		ASSERT(target->DriverObject);
+
+		// FO related to MUP?  [\FileSystem\MUP]
+		if(0x1e == target->DriverObject->DriverName.Length)
 		{
-			IoCancelFileOpen(m_extension->Lower, stack->FileObject);
+			// Manually cleanup to avoid a dangling FO
+			CFilterBase::SendCleanupClose(target, stack->FileObject, true);
 		}
 		else
 		{
-			DEVICE_OBJECT *target = CFilterBase::GetDeviceObject(stack->FileObject);
-			ASSERT(target);
-			ASSERT(target->DriverObject);
-
-			// FO related to MUP?  [\FileSystem\MUP]
-			if(0x1e == target->DriverObject->DriverName.Length)
-			{
-				// Manually cleanup to avoid a dangling FO
-				CFilterBase::SendCleanupClose(target, stack->FileObject, true);
-			}
-			else
-			{
-				IoCancelFileOpen(m_extension->Lower, stack->FileObject);
-			}
+			IoCancelFileOpen(m_extension->Lower, stack->FileObject);
 		}
+	}
 
-		// Defaults to Access Denied
-		status = STATUS_ACCESS_DENIED;
+	// Defaults to Access Denied
+	NTSTATUS status = STATUS_ACCESS_DENIED;
 
-		if(track->State & TRACK_APP_LIST)
-		{
-			// Use more specific error
-			status = STATUS_SHARING_VIOLATION;
-		}
+	if(track->State & TRACK_APP_LIST)
+	{
+		// Use more specific error
+		status = STATUS_SHARING_VIOLATION;
+	}
 
-		irp->IoStatus.Status	  = status;
-		irp->IoStatus.Information = 0;
+	irp->IoStatus.Status	  = status;
+	irp->IoStatus.Information = 0;
 
-		DBGPRINT(("PostCreate: FO[0x%p] cancel with [0x%x]\n", stack->FileObject, irp->IoStatus.Status));
-	}
+	DBGPRINT(("PostCreate: FO[0x%p] cancel with [0x%x]\n", stack->FileObject, irp->IoStatus.Status));
 
 	return status;
 }
@@ -3877,84 +4289,134 @@ NTSTATUS CFilterVolume::PostCreate(IRP *irp, FILFILE_TRACK_CONTEXT *track)
 
 #pragma PAGEDCODE
 
-NTSTATUS CFilterVolume::PostCreateEscape(IRP *irp, FILFILE_TRACK_CONTEXT *track, ULONG flags)
+NTSTATUS CFilterVolume::PostCreateResume(IRP *irp, FILFILE_TRACK_CONTEXT *track, NTSTATUS status, LONGLONG start)
 {
 	ASSERT(irp);
 	ASSERT(track);
-	ASSERT(flags & (TRACK_TYPE_DIRECTORY | TRACK_TYPE_FILE));
+	ASSERT(TRACK_PENDED == track->State);
 
 	PAGED_CODE();
 
-	ULONG depth	= 0;
-	ULONG pos	= ~0u;
+	// Continues where PostCreateEntity has pended the create of an opened file
+	m_statistics.Add(NT_SUCCESS(status) ? FILFILE_STAT_KEY_REQUESTS : FILFILE_STAT_KEY_FAILED);
+	m_statistics.AddKeyWait(start);
+
+	FsRtlEnterFileSystem();
+
+	if(NT_SUCCESS(status))
+	{
+		track->State = TRACK_YES;
 
-	if(flags & TRACK_TYPE_DIRECTORY)
+		CreateEntity(track, TRACK_TYPE_FILE);
+	}
+	else
 	{
-		if(!m_context->m_directories.Size())
+		track->State = TRACK_CANCEL | TRACK_AUTO_CONFIG;
+	}
+
+	FsRtlExitFileSystem();
+
+	status = STATUS_SUCCESS;
+
+	// As PostCreateFile does
+	if(track->State & TRACK_YES)
+	{
+		FILE_OBJECT *const file = IoGetCurrentIrpStackLocation(irp)->FileObject;
+		ASSERT(file);
+
+		// add FO to List
+		if(NT_ERROR(OnFileCreate(file, track, FILE_OPENED)))
 		{
-			return STATUS_SUCCESS;
+			track->State = TRACK_CANCEL;
 		}
+	}
 
-		// Hash last component only
-		ULONG const hash = track->Entity.Hash(CFilterPath::PATH_DIRECTORY | CFilterPath::PATH_TAIL);
+	if(track->State & TRACK_CANCEL)
+	{
+		status = PostCreateCancel(irp, track);
+	}
 
-		FsRtlEnterFileSystem();
-		ExAcquireResourceSharedLite(&m_context->m_directoriesResource, true);
+	return status;
+}
 
-		// Is exactly same ThreadId, Hash, and within defined time interval as recorded?
-		if(m_context->m_directories.SearchSpecial(hash, &pos))
-		{
-			DBGPRINT(("PostCreateEscape: FO[0x%p] escaped directory detected, catch\n", IoGetCurrentIrpStackLocation(irp)->FileObject));
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
 
-			CFilterDirectory *const directoryFile = m_context->m_directories.Get(pos);
-			ASSERT(directoryFile);
+NTSTATUS CFilterVolume::PostCreateEscape(IRP *irp, FILFILE_TRACK_CONTEXT *track, ULONG flags)
+{
+	ASSERT(irp);
+	ASSERT(track);
+	ASSERT(flags & (TRACK_TYPE_DIRECTORY | TRACK_TYPE_FILE));
 
-			ASSERT(directoryFile->m_entityIdentifier && (directoryFile->m_entityIdentifier != ~0u));
-			track->Entity.m_identifier = directoryFile->m_entityIdentifier;
+	PAGED_CODE();
 
-			depth = directoryFile->m_depth;
-		}
+	FILE_OBJECT *const file = IoGetCurrentIrpStackLocation(irp)->FileObject;
+	ASSERT(file);
 
-		ExReleaseResourceLite(&m_context->m_directoriesResource);
-		FsRtlExitFileSystem();
-	}
-	else
+	// Hash last component only for directories
+	ULONG const hash = (flags & TRACK_TYPE_DIRECTORY) ? track->Entity.Hash(CFilterPath::PATH_DIRECTORY | CFilterPath::PATH_TAIL)
+													  : track->Entity.Hash(CFilterPath::PATH_FILE);
+	CFilterDirectory directory;
+	ULONG headerIdentifier = 0;
+
+	bool found = false;
+
+	FILFILE_CONTROL_EXTENSION *const ctrlExtension = CFilterControl::Extension();
+	ASSERT(ctrlExtension);
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceSharedLite(&ctrlExtension->Lock, true);
+
+	// Escapes may cross Volumes, so look at all of them
+	for(LIST_ENTRY *entry = ctrlExtension->Volumes.Flink; !found && (entry != &ctrlExtension->Volumes); entry = entry->Flink)
 	{
-		ASSERT(flags & TRACK_TYPE_FILE);
+		FILFILE_VOLUME_EXTENSION *const volExtension = CONTAINING_RECORD(entry, FILFILE_VOLUME_EXTENSION, Link);
+		ASSERT(volExtension);
 
-		if(!m_context->m_files.Size())
+		// Is exactly same ThreadId, Hash, and within defined time interval as recorded?
+		if(flags & TRACK_TYPE_DIRECTORY)
 		{
-			return STATUS_SUCCESS;
+			if(volExtension->Volume.m_shards.Directories())
+			{
+				found = volExtension->Volume.m_shards.SearchSpecial(hash, &directory);
+			}
 		}
-		
-		FILE_OBJECT *const file = IoGetCurrentIrpStackLocation(irp)->FileObject;
-		ASSERT(file);
+		else if(volExtension->Volume.m_shards.Files())
+		{
+			found = volExtension->Volume.m_shards.CheckSpecial(file, hash, &headerIdentifier);
+		}
+	}
 
-		ULONG const hash = track->Entity.Hash(CFilterPath::PATH_FILE);
+	ExReleaseResourceLite(&ctrlExtension->Lock);
+	FsRtlExitFileSystem();
 
-		FsRtlEnterFileSystem();
-		ExAcquireResourceSharedLite(&m_context->m_filesResource, true);
+	ULONG depth = 0;
 
-		// Is exactly same ThreadId, Hash, and within defined time interval as recorded?
-		if(m_context->m_files.CheckSpecial(file, &pos, hash))
+	if(found)
+	{
+		if(flags & TRACK_TYPE_DIRECTORY)
 		{
-			DBGPRINT(("PostCreateEscape: FO[0x%p] escaped file detected, catch\n", file));
+			DBGPRINT(("PostCreateEscape: FO[0x%p] escaped directory detected, catch\n", file));
 
-			CFilterFile *const filterFile = m_context->m_files.Get(pos);
-			ASSERT(filterFile);
+			ASSERT(directory.m_entityIdentifier && (directory.m_entityIdentifier != ~0u));
+			track->Entity.m_identifier = directory.m_entityIdentifier;
 
-			ASSERT(filterFile->m_link.m_headerIdentifier);
-			track->Entity.m_headerIdentifier = filterFile->m_link.m_headerIdentifier;
+			depth = directory.m_depth;
 		}
+		else
+		{
+			DBGPRINT(("PostCreateEscape: FO[0x%p] escaped file detected, catch\n", file));
 
-		ExReleaseResourceLite(&m_context->m_filesResource);
-		FsRtlExitFileSystem();
+			ASSERT(headerIdentifier);
+			track->Entity.m_headerIdentifier = headerIdentifier;
+		}
 	}
 
 	NTSTATUS status	= STATUS_SUCCESS;
 
 	// Escaped?
-	if(pos != ~0u)
+	if(found)
 	{
 		track->State = TRACK_NO;
 
@@ -4229,16 +4691,19 @@ NTSTATUS CFilterVolume::PostCreateDirectory(IRP *irp, FILFILE_TRACK_CONTEXT *tra
 		directory.m_headerIdentifier = track->Entity.m_headerIdentifier;
 		directory.m_depth			 = track->Entity.m_directoryDepth;
 		directory.m_hash			 = track->Entity.Hash(CFilterPath::PATH_DIRECTORY | CFilterPath::PATH_TAIL); // Hash last component only
+		directory.m_directoryHash	 = CFilterSizeCache::DirectoryHash(&track->Entity, true);
 		directory.m_tid				 = (ULONG)(ULONG_PTR) PsGetCurrentThreadId();
 		directory.m_tick		     = tick.LowPart;
 
+		CFilterShard *const shard = m_shards.Directory(directory.m_file);
+
 		FsRtlEnterFileSystem();
-		ExAcquireResourceExclusiveLite(&m_context->m_directoriesResource, true);
+		ExAcquireResourceExclusiveLite(&shard->m_directoriesResource, true);
 		
 		// add directory to List
-		status = m_context->m_directories.Add(&directory);
+		status = shard->m_directories.Add(&directory);
 
-		ExReleaseResourceLite(&m_context->m_directoriesResource);
+		ExReleaseResourceLite(&shard->m_directoriesResource);
 		FsRtlExitFileSystem();
 	}
 
@@ -4449,7 +4914,12 @@ NTSTATUS CFilterVolume::PostCreateAuthenticate(IRP *irp, FILFILE_TRACK_CONTEXT *
 
 			ULONG const ctrlFlags = (flags & TRACK_TYPE_DIRECTORY) ? FILFILE_CONTROL_DIRECTORY : FILFILE_CONTROL_NULL;
 
-			status = CFilterControl::Callback().FireKey(ctrlFlags, track);
+			LONGLONG const start = KeQueryInterruptTime();
+
+			status = CFilterControl::Callback().FireKey(ctrlFlags, track, irp);
+
+			m_statistics.Add(NT_SUCCESS(status) ? FILFILE_STAT_KEY_REQUESTS : FILFILE_STAT_KEY_FAILED);
+			m_statistics.AddKeyWait(start);
 
 			// Retrieve Key from UserMode
 			if(NT_SUCCESS(status))
@@ -4648,6 +5118,17 @@ NTSTATUS CFilterVolume::PostCreateFileOpened(IRP *irp, FILFILE_TRACK_CONTEXT *tr
 	// check for valid Header 
 	NTSTATUS status = FileCheck(irp, track);
 
+	// Encrypted with a cipher mode we cannot code?
+	if(STATUS_NOT_SUPPORTED == status)
+	{
+		DBGPRINT(("PostCreateFileOpened: FO[0x%p] unsupported cipher mode, cancel\n", file));
+
+		// Passing it through would expose cipher text and store plain text
+		track->State = TRACK_CANCEL;
+
+		return STATUS_SUCCESS;
+	}
+
 	if(NT_ERROR(status))
 	{
 		// Invalid header. Check for deferred Header injection scenarios
@@ -4668,8 +5149,14 @@ NTSTATUS CFilterVolume::PostCreateFileOpened(IRP *irp, FILFILE_TRACK_CONTEXT *tr
 			return STATUS_SUCCESS;
 		}
 
+		LONGLONG stage = CFilterStatistics::StageStart();
+
+		bool const black = m_context->m_blackList.Check(&track->Entity, &track->Luid);
+
+		m_statistics.AddStage(FILFILE_STAT_STAGE_BLACKLIST, stage);
+
 		// Black-listed?
-		if(m_context->m_blackList.Check(&track->Entity, &track->Luid))
+		if(black)
 		{
 			DBGPRINT(("PostCreateFileOpened: FO[0x%p] matched Blacklist, ignore\n", file));
 
@@ -4693,6 +5180,8 @@ NTSTATUS CFilterVolume::PostCreateFileOpened(IRP *irp, FILFILE_TRACK_CONTEXT *tr
 			return STATUS_SUCCESS;
 		}
 
+		stage = CFilterStatistics::StageStart();
+
 		// Check AppList state
 		appList = m_context->AppList().Check(irp, 
 											 FILFILE_APP_WHITE | FILFILE_APP_BLACK, 
@@ -4700,6 +5189,8 @@ NTSTATUS CFilterVolume::PostCreateFileOpened(IRP *irp, FILFILE_TRACK_CONTEXT *tr
 											 CFilterControl::IsTerminalServices() ? &track->Luid 
 																				  : 0);
 
+		m_statistics.AddStage(FILFILE_STAT_STAGE_APPLIST, stage);
+
 		// Opened by White listed process that is not black-listed?
 		if((appList & FILFILE_APP_WHITE) != FILFILE_APP_WHITE)
 		{
@@ -4836,8 +5327,14 @@ NTSTATUS CFilterVolume::PostCreateFileCreated(IRP *irp, FILFILE_TRACK_CONTEXT *t
 
 	if(track->State & (TRACK_AUTO_CONFIG | TRACK_YES))
 	{
+		LONGLONG const stage = CFilterStatistics::StageStart();
+
+		bool const black = m_context->m_blackList.Check(&track->Entity, &track->Luid);
+
+		m_statistics.AddStage(FILFILE_STAT_STAGE_BLACKLIST, stage);
+
 		// Check against Blacklist
-		if(m_context->m_blackList.Check(&track->Entity, &track->Luid))
+		if(black)
 		{
 			DBGPRINT(("PostCreateFileCreated: FO[0x%p] matched Blacklist, ignore\n", file));
 
@@ -4850,9 +5347,13 @@ NTSTATUS CFilterVolume::PostCreateFileCreated(IRP *irp, FILFILE_TRACK_CONTEXT *t
 		AutoConfigVerify(irp, track, TRACK_TYPE_FILE);
 	}
 
+	LONGLONG const stage = CFilterStatistics::StageStart();
+
 	// Check whether we match on an AppList entry
 	ULONG const appList = m_context->AppList().Check(irp, FILFILE_APP_BLACK | FILFILE_APP_WHITE);
 
+	m_statistics.AddStage(FILFILE_STAT_STAGE_APPLIST, stage);
+
 	if(appList & FILFILE_APP_BLACK)
 	{
 		DBGPRINT(("PostCreateFileCreated: FO[0x%p] matched App BLACK, ignore\n", file));
@@ -16,6 +16,10 @@
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "CFilterContext.h"
+#include "CFilterStatistics.h"
+#include "CFilterAutoConfigCache.h"
+#include "CFilterDecisionCache.h"
+#include "CFilterShards.h"
 
 struct FILFILE_VOLUME_EXTENSION;
 struct FILFILE_HEADER_BLOCK;
@@ -37,7 +41,8 @@ public:
 	NTSTATUS					ManageEncryption(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *present, FILFILE_TRACK_CONTEXT *future, ULONG flags);
 
 	int							CheckDirectoryCooked(FILE_OBJECT *file, CFilterDirectory *directory = 0);
-	int							CheckFileCooked(FILE_OBJECT *file, CFilterContextLink *link = 0);
+	int							CheckFileCooked(FILE_OBJECT *file, CFilterContextLink *link = 0, CFilterCipher **cipher = 0);
+	int							ReferenceStream(FILE_OBJECT *file, CFilterStream **stream);
 	NTSTATUS					LonelyEntity(FILE_OBJECT *file, ULONG type, ULONG identifier = 0);
     		
 	NTSTATUS					OnFileCreate(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *track, ULONG dispo);
@@ -47,9 +52,15 @@ public:
 
 	NTSTATUS					PreCreate(IRP  *irp, FILFILE_TRACK_CONTEXT *track);
 	NTSTATUS					PostCreate(IRP *irp, FILFILE_TRACK_CONTEXT *track);
+	NTSTATUS					PostCreateResume(IRP *irp, FILFILE_TRACK_CONTEXT *track, NTSTATUS status, LONGLONG start);
 		
 	NTSTATUS					UpdateLink(FILE_OBJECT *file, ULONG flags, bool clear = false);
 
+	NTSTATUS					ReadAhead(IRP *irp, CFilterContextLink const* link, CFilterCipher *cipher, LONGLONG vdl);
+	void						InvalidateReadAhead(FILE_OBJECT *file);
+	void						ReadAheadWriteStart();
+	void						ReadAheadWriteEnd();
+
 	NTSTATUS					UpdateEntity(ULONG identifier, CFilterPath *path);
 	NTSTATUS					RemoveEntity(ULONG identifier, ULONG type, ULONG flags = ENTITY_PURGE, LUID const* luid = 0);
 	NTSTATUS					RemoveEntity(FILE_OBJECT *file, ULONG flags = ENTITY_NULL);
@@ -66,6 +77,7 @@ private:
 	NTSTATUS					PostCreateAuthenticate(IRP *irp, FILFILE_TRACK_CONTEXT *track, ULONG headerIdentifier, ULONG flags);
 	NTSTATUS					PostCreateEntity(IRP *irp, FILFILE_TRACK_CONTEXT *track, ULONG flags);
 	NTSTATUS					PostCreateEscape(IRP *irp, FILFILE_TRACK_CONTEXT *track, ULONG flags);
+	NTSTATUS					PostCreateCancel(IRP *irp, FILFILE_TRACK_CONTEXT *track);
 
 	NTSTATUS					PostCreateFile(IRP *irp, FILFILE_TRACK_CONTEXT *track);
 	NTSTATUS					PostCreateFileOpened(IRP  *irp, FILFILE_TRACK_CONTEXT *track);
@@ -87,6 +99,7 @@ private:
 	NTSTATUS					InitNewDirectory(CFilterEntity const* entity, ULONG deepness,FILFILE_TRACK_CONTEXT *track=NULL);
 	
 	NTSTATUS					RemoteFileChange(FILE_OBJECT *file, FILFILE_TRACK_CONTEXT *track);
+	CFilterStream*				LookupStream(CFilterShard *shard, FILE_OBJECT *file);
 	NTSTATUS					ConsolidateEntities(ULONG *identifier);
 	ULONG						GenerateEntityIdentifier();
 
@@ -99,6 +112,13 @@ public:
 								
 	FILFILE_VOLUME_EXTENSION*	m_extension;
 	CFilterContext*				m_context;
+	CFilterStatistics			m_statistics;
+	CFilterAutoConfigCache		m_autoConfigs;		// directories without AutoConfig file
+	CFilterDecisionCache		m_decisions;		// directory opens with nothing to do
+	CFilterShards				m_shards;			// tracked files and directories
+
+	LONG						m_writes;			// non-cached writes started or completed, voids read-ahead fills
+	LONG						m_writesPending;	// non-cached writes in flight, no read-ahead meanwhile
 
 private:
 
@@ -129,5 +149,27 @@ ULONG CFilterVolume::GenerateEntityIdentifier()
 	return m_nextIdentifier++;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+void CFilterVolume::ReadAheadWriteStart()
+{
+	// Callable at DISPATCH_LEVEL
+	InterlockedIncrement(&m_writesPending);
+	InterlockedIncrement(&m_writes);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline
+void CFilterVolume::ReadAheadWriteEnd()
+{
+	ASSERT(m_writesPending > 0);
+
+	// Callable at DISPATCH_LEVEL, fills started while in flight may have read old data
+	InterlockedIncrement(&m_writes);
+	InterlockedDecrement(&m_writesPending);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #endif // !defined(AFX_CFilterVolume_H__51B15847_87CB_4E09_9F51_061696E8901B__INCLUDED_)
@@ -12,18 +12,41 @@
 #include "CFilterBase.h"
 #include "CFilterControl.h"
 #include "CWipePattern.h"
+#include "RijndaelCoder.h"
 
 #include "IoControl.h"
 #include "CFilterWiper.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+struct CFilterWiper::CFilterWiperBuffer
+{
+	UCHAR*						Buffer;
+	MDL*						Mdl;
+	IO_STATUS_BLOCK				IoStatus;
+	KEVENT						Done;			// signaled if idle
+};
+
+struct CFilterWiper::CFilterWiperPass
+{
+	CFilterWiperBuffer			Buffers[c_buffers];
+	FILE_ALLOCATED_RANGE_BUFFER	Ranges[c_ranges];
+
+	RijndealCoder<AES_128>		Aes;			// keystream for random patterns, keyed once per wipe
+	UCHAR						Counter[16];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 #pragma PAGEDCODE
 
 void CFilterWiper::Close()
 {
 	PAGED_CODE();
 
+	// Finish deferred files, if any
+	WorkerStop();
+
 	if(m_cancel)
 	{
 		ObDereferenceObject(m_cancel);
@@ -109,10 +132,8 @@ NTSTATUS CFilterWiper::Prepare(ULONG flags, int *patterns, int patternsSize, HAN
 
 #pragma PAGEDCODE
 
-bool CFilterWiper::WipeStep(LARGE_INTEGER const* offset)
+bool CFilterWiper::WipeStep(LONGLONG previous, LONGLONG current)
 {
-	ASSERT(offset);
-
 	PAGED_CODE();
 
 	if(m_cancel)
@@ -128,17 +149,15 @@ bool CFilterWiper::WipeStep(LARGE_INTEGER const* offset)
 	
 	if(m_progress)
 	{
-		// ensure the progress value is a multiple of the used IO size
-		C_ASSERT(FILFILE_WIPE_PROGRESS_STEP > MM_MAXIMUM_DISK_IO_SIZE);
-		C_ASSERT(0 == (FILFILE_WIPE_PROGRESS_STEP % MM_MAXIMUM_DISK_IO_SIZE));
+		// Steps crossed since last call, skipped holes included
+		LONG const steps = (LONG) ((current / FILFILE_WIPE_PROGRESS_STEP) - (previous / FILFILE_WIPE_PROGRESS_STEP));
 
-		// offset multiple of progress step value ?
-		if(0 == (offset->LowPart & (FILFILE_WIPE_PROGRESS_STEP - 1)))
+		if(steps > 0)
 		{
-			DBGPRINT(("WipeStep: progress notification at [0x%I64x]\n", *offset));
+			DBGPRINT(("WipeStep: progress notification at [0x%I64x]\n", current));
 
-			// trigger progress step
-			KeReleaseSemaphore(m_progress, SEMAPHORE_INCREMENT, 1, false);	
+			// trigger progress step(s)
+			KeReleaseSemaphore(m_progress, SEMAPHORE_INCREMENT, steps, false);	
 		}
 	}
 	
@@ -406,97 +425,1042 @@ NTSTATUS CFilterWiper::WipeData(FILE_OBJECT *file, DEVICE_OBJECT *lower)
 	// Get file size
 	NTSTATUS status = CFilterBase::GetFileSize(lower, file, &eof);
 
-	if(NT_SUCCESS(status) && eof.QuadPart)
+	if(NT_ERROR(status) || !eof.QuadPart)
 	{
-		// Align on sector boundary
-		eof.LowPart = (eof.LowPart + (CFilterBase::c_sectorSize - 1)) & ~((CFilterBase::c_sectorSize - 1));
+		return status;
+	}
 
-		FILFILE_READ_WRITE write;
-		RtlZeroMemory(&write, sizeof(write));
-		
-		write.Buffer = (UCHAR*) ExAllocatePool(NonPagedPool, MM_MAXIMUM_DISK_IO_SIZE);
+	// Align on sector boundary
+	eof.QuadPart = (eof.QuadPart + (CFilterBase::c_sectorSize - 1)) & ~((LONGLONG) CFilterBase::c_sectorSize - 1);
+
+	// Holes of sparse files need not be written, they are not backed by any clusters
+	ULONG const attributes = CFilterBase::GetAttributes(lower, file);
+	bool  const sparse	   = (attributes != INVALID_FILE_ATTRIBUTES) && (attributes & FILE_ATTRIBUTE_SPARSE_FILE);
+
+	CFilterWiperPass *const pass = (CFilterWiperPass*) ExAllocatePool(NonPagedPool, sizeof(CFilterWiperPass));
+
+	if(!pass)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlZeroMemory(pass, sizeof(CFilterWiperPass));
+
+	status = STATUS_SUCCESS;
+
+	ULONG index = 0;
+
+	for(index = 0; index < c_buffers; ++index)
+	{
+		CFilterWiperBuffer *const buffer = &pass->Buffers[index];
+
+		KeInitializeEvent(&buffer->Done, NotificationEvent, true);
+
+		buffer->Buffer = (UCHAR*) ExAllocatePool(NonPagedPool, c_bufferSize);
+
+		if(buffer->Buffer)
+		{
+			buffer->Mdl = IoAllocateMdl(buffer->Buffer, c_bufferSize, false, false, 0);
+		}
+
+		if(!buffer->Mdl)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			break;
+		}
+
+		MmBuildMdlForNonPagedPool(buffer->Mdl);
+	}
+
+	if(NT_SUCCESS(status))
+	{
+		// Random patterns use an AES-CTR keystream, seeded once per wipe
+		UCHAR seed[RijndealCoder<AES_128>::c_keySize + sizeof(pass->Counter)];
 
-		if(write.Buffer)
+		status = m_random->Get(seed, sizeof(seed));
+
+		if(NT_SUCCESS(status))
 		{
-			write.Mdl = IoAllocateMdl(write.Buffer, MM_MAXIMUM_DISK_IO_SIZE, false, false, 0);
+			RtlCopyMemory(pass->Counter, seed + RijndealCoder<AES_128>::c_keySize, sizeof(pass->Counter));
 
-			if(write.Mdl)
+			if(!pass->Aes.Init(seed, false))
 			{
-				MmBuildMdlForNonPagedPool(write.Mdl);
+				status = STATUS_UNSUCCESSFUL;
+			}
+		}
 
-				write.Flags = IRP_NOCACHE | IRP_PAGING_IO | IRP_SYNCHRONOUS_PAGING_IO;
-				write.Major = IRP_MJ_WRITE;
-				write.Wait  = true;
-				
-				LONG index = 0;
+		RtlZeroMemory(seed, sizeof(seed));
+	}
 
-				// Wipe whole file in using each pattern
-				do
-				{
-					DBGPRINT(("WipeData: wiping FO[0x%p] Size[0x%I64x] with Pattern[0x%x]\n", file, eof, m_patterns[index]));
+	if(NT_SUCCESS(status))
+	{
+		index = 0;
 
-					// Value pattern ?
-					if(m_patterns[index] >= 0)
-					{
-						// Fill buffer with selected pattern
-						CWipePattern::Fill(m_patterns[index], write.Buffer, MM_MAXIMUM_DISK_IO_SIZE);
-					}
+		// Wipe whole file in using each pattern
+		do
+		{
+			DBGPRINT(("WipeData: wiping FO[0x%p] Size[0x%I64x] Sparse[%d] with Pattern[0x%x]\n", file, eof, sparse, m_patterns[index]));
 
-					write.Offset.QuadPart = 0;
+			status = WipePass(file, lower, pass, m_patterns[index], eof.QuadPart, sparse);
 
-					while(write.Offset.QuadPart < eof.QuadPart)
-					{
-						write.Length = (ULONG) (eof.QuadPart - write.Offset.QuadPart);
+			if(NT_ERROR(status))
+			{
+				break;
+			}
 
-						if(!write.Length || (write.Length > MM_MAXIMUM_DISK_IO_SIZE))
-						{
-							write.Length = MM_MAXIMUM_DISK_IO_SIZE;
-						}
+			index++;
+		}
+		while(index < (ULONG) m_patternsCount);
+	}
 
-						// Random pattern ?
-						if(m_patterns[index] < 0)
-						{
-							// Fill buffer with random data
-							m_random->Get(write.Buffer, write.Length);			
-						}
-						
-						status = CFilterBase::ReadWrite(lower, file, &write);
+	pass->Aes.Close();
 
-						if(NT_ERROR(status))
-						{
-							DBGPRINT(("WipeData -ERROR: write failed [0x%08x]\n", status));
-							break;
-						}
+	for(index = 0; index < c_buffers; ++index)
+	{
+		CFilterWiperBuffer *const buffer = &pass->Buffers[index];
 
-						write.Offset.QuadPart += write.Length;
+		if(buffer->Mdl)
+		{
+			IoFreeMdl(buffer->Mdl);
+		}
 
-						// Perform progress step notifications and check for cancelation
-						if(WipeStep(&write.Offset))
-						{
-							status = STATUS_CANCELLED;
-							break;
-						}
+		if(buffer->Buffer)
+		{
+			ExFreePool(buffer->Buffer);
+		}
+	}
+
+	RtlZeroMemory(pass, sizeof(CFilterWiperPass));
+
+	ExFreePool(pass);
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterWiper::WipePass(FILE_OBJECT *file, DEVICE_OBJECT *lower, CFilterWiperPass *pass, int pattern, LONGLONG eof, bool sparse)
+{
+	ASSERT(file);
+	ASSERT(lower);
+	ASSERT(pass);
+	ASSERT(eof > 0);
+
+	PAGED_CODE();
+
+	ULONG slot = 0;
+
+	// Value pattern ?
+	if(pattern >= 0)
+	{
+		// Fill buffers with selected pattern, once per pass
+		for(slot = 0; slot < c_buffers; ++slot)
+		{
+			CWipePattern::Fill(pattern, pass->Buffers[slot].Buffer, c_bufferSize);
+		}
+	}
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	LONGLONG offset	  = 0;
+	LONGLONG rangeEnd = sparse ? 0 : eof;	// end of current allocated range
+
+	ULONG rangesCount = 0;
+	ULONG rangesIndex = 0;
+
+	slot = 0;
+
+	while(offset < eof)
+	{
+		if(offset >= rangeEnd)
+		{
+			ASSERT(sparse);
+
+			// Fetch next allocated ranges, if needed
+			if(rangesIndex >= rangesCount)
+			{
+				rangesCount = c_ranges;
+				rangesIndex = 0;
+
+				if(NT_ERROR(QueryRanges(lower, file, offset, eof - offset, pass->Ranges, &rangesCount)))
+				{
+					// Treat remainder as allocated
+					pass->Ranges[0].FileOffset.QuadPart = offset;
+					pass->Ranges[0].Length.QuadPart		= eof - offset;
+
+					rangesCount = 1;
+				}
+				else if(rangesCount)
+				{
+					FILE_ALLOCATED_RANGE_BUFFER const* last = &pass->Ranges[rangesCount - 1];
+
+					// Guard against ranges we have already passed
+					if(last->FileOffset.QuadPart + last->Length.QuadPart <= offset)
+					{
+						rangesCount = 0;
 					}
-										
-					if(NT_ERROR(status))
+				}
+
+				// No more clusters ?
+				if(!rangesCount)
+				{
+					if(WipeStep(offset, eof))
 					{
-						break;
+						status = STATUS_CANCELLED;
 					}
 
-					index++;
+					break;
+				}
+			}
+
+			FILE_ALLOCATED_RANGE_BUFFER const* range = &pass->Ranges[rangesIndex++];
+
+			LONGLONG start = range->FileOffset.QuadPart & ~((LONGLONG) CFilterBase::c_sectorSize - 1);
+			LONGLONG end   = (range->FileOffset.QuadPart + range->Length.QuadPart + (CFilterBase::c_sectorSize - 1)) & ~((LONGLONG) CFilterBase::c_sectorSize - 1);
+
+			if(start < offset)
+			{
+				start = offset;
+			}
+			if(end > eof)
+			{
+				end = eof;
+			}
+
+			if(start > offset)
+			{
+				// Skip hole, but keep progress in line
+				if(WipeStep(offset, start))
+				{
+					status = STATUS_CANCELLED;
+					break;
 				}
-				while(index < m_patternsCount);
 
-				IoFreeMdl(write.Mdl);
+				offset = start;
+			}
+
+			rangeEnd = end;
+
+			continue;
+		}
+
+		CFilterWiperBuffer *const buffer = &pass->Buffers[slot];
+
+		slot = (slot + 1) % c_buffers;
+
+		// Wait until previous write on this buffer has completed
+		KeWaitForSingleObject(&buffer->Done, Executive, KernelMode, false, 0);
+
+		if(NT_ERROR(buffer->IoStatus.Status))
+		{
+			status = buffer->IoStatus.Status;
+
+			DBGPRINT(("WipePass -ERROR: write failed [0x%08x]\n", status));
+			break;
+		}
+
+		ULONG length = c_bufferSize;
+
+		if(rangeEnd - offset < c_bufferSize)
+		{
+			length = (ULONG) (rangeEnd - offset);
+		}
+
+		// Random pattern ?
+		if(pattern < 0)
+		{
+			ASSERT(0 == (length % sizeof(pass->Counter)));
+
+			// Fill buffer with keystream, low half of Counter is incremented
+			for(ULONG pos = 0; pos < length; pos += sizeof(pass->Counter))
+			{
+				RtlCopyMemory(buffer->Buffer + pos, pass->Counter, sizeof(pass->Counter));
+
+				pass->Aes.EncodeBlock(buffer->Buffer + pos);
+
+				(*(ULONGLONG*) pass->Counter)++;
 			}
+		}
+
+		status = Write(lower, file, buffer, offset, length);
+
+		if(NT_ERROR(status))
+		{
+			DBGPRINT(("WipePass -ERROR: write failed [0x%08x]\n", status));
+			break;
+		}
+
+		LONGLONG const previous = offset;
+
+		offset += length;
+
+		// Perform progress step notifications and check for cancelation
+		if(WipeStep(previous, offset))
+		{
+			status = STATUS_CANCELLED;
+			break;
+		}
+	}
+
+	// Drain outstanding writes
+	for(slot = 0; slot < c_buffers; ++slot)
+	{
+		CFilterWiperBuffer *const buffer = &pass->Buffers[slot];
+
+		KeWaitForSingleObject(&buffer->Done, Executive, KernelMode, false, 0);
+
+		if(NT_SUCCESS(status) && NT_ERROR(buffer->IoStatus.Status))
+		{
+			status = buffer->IoStatus.Status;
+
+			DBGPRINT(("WipePass -ERROR: write failed [0x%08x]\n", status));
+		}
+
+		buffer->IoStatus.Status		 = STATUS_SUCCESS;
+		buffer->IoStatus.Information = 0;
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterWiper::Write(DEVICE_OBJECT *lower, FILE_OBJECT *file, CFilterWiperBuffer *buffer, LONGLONG offset, ULONG length)
+{
+	ASSERT(lower);
+	ASSERT(file);
+	ASSERT(buffer);
+	ASSERT(length);
+
+	PAGED_CODE();
+
+	IRP *const irp = IoAllocateIrp(lower->StackSize, false);
+
+	if(!irp)
+	{
+		DBGPRINT(("Write -ERROR: IoAllocateIrp() failed\n"));
+
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	irp->UserIosb			 = &buffer->IoStatus;
+	irp->UserBuffer			 = buffer->Buffer;
+	irp->MdlAddress			 = buffer->Mdl;
+	irp->Flags				 = IRP_NOCACHE | IRP_PAGING_IO;
+	irp->RequestorMode		 = KernelMode;
+	irp->Tail.Overlay.Thread = PsGetCurrentThread();
+
+	IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+	ASSERT(stack);
+
+	stack->MajorFunction = IRP_MJ_WRITE;
+	stack->MinorFunction = IRP_MN_NORMAL;
+	stack->DeviceObject	 = lower;
+	stack->FileObject	 = file;
+
+	stack->Parameters.Write.Length				= length;
+	stack->Parameters.Write.Key					= 0;
+	stack->Parameters.Write.ByteOffset.QuadPart = offset;
+
+	// Busy until completion
+	KeClearEvent(&buffer->Done);
+
+	IoSetCompletionRoutine(irp, WriteCompletion, buffer, true, true, true);
+
+	// Completion carries the result, the caller waits on the buffer
+	IoCallDriver(lower, irp);
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma LOCKEDCODE
+
+NTSTATUS CFilterWiper::WriteCompletion(DEVICE_OBJECT *device, IRP *irp, void *context)
+{
+	ASSERT(irp);
+	ASSERT(context);
+
+	UNREFERENCED_PARAMETER(device);
+
+	CFilterWiperBuffer *const buffer = (CFilterWiperBuffer*) context;
+
+	buffer->IoStatus = irp->IoStatus;
+
+	IoFreeIrp(irp);
+
+	KeSetEvent(&buffer->Done, IO_NO_INCREMENT, false);
+
+	return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterWiper::QueryRanges(DEVICE_OBJECT *lower, FILE_OBJECT *file, LONGLONG offset, LONGLONG length, FILE_ALLOCATED_RANGE_BUFFER *ranges, ULONG *rangesCount)
+{
+	ASSERT(lower);
+	ASSERT(file);
+	ASSERT(ranges);
+	ASSERT(rangesCount);
+	ASSERT(*rangesCount);
+
+	PAGED_CODE();
+
+	FILE_ALLOCATED_RANGE_BUFFER query;
+	query.FileOffset.QuadPart = offset;
+	query.Length.QuadPart	  = length;
+
+	NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
+
+	IRP *const irp = IoAllocateIrp(lower->StackSize, false);
+
+	if(irp)
+	{
+		IO_STATUS_BLOCK ioStatus = {0,0};
+
+		irp->UserIosb			 = &ioStatus;
+		irp->UserBuffer			 = ranges;
+		irp->RequestorMode		 = KernelMode;
+		irp->Tail.Overlay.Thread = PsGetCurrentThread();
+		irp->Flags				 = IRP_SYNCHRONOUS_API;
+
+		IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+		ASSERT(stack);
+
+		stack->MajorFunction = IRP_MJ_FILE_SYSTEM_CONTROL;
+		stack->MinorFunction = IRP_MN_USER_FS_REQUEST;
+		stack->DeviceObject	 = lower;
+		stack->FileObject	 = file;
+
+		// METHOD_NEITHER
+		stack->Parameters.FileSystemControl.FsControlCode	   = FSCTL_QUERY_ALLOCATED_RANGES;
+		stack->Parameters.FileSystemControl.Type3InputBuffer   = &query;
+		stack->Parameters.FileSystemControl.InputBufferLength  = sizeof(query);
+		stack->Parameters.FileSystemControl.OutputBufferLength = *rangesCount * sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+
+		status = CFilterBase::SimpleSend(lower, irp);
+
+		// More ranges than fit are fetched on the next call
+		if(NT_SUCCESS(status) || (STATUS_BUFFER_OVERFLOW == status))
+		{
+			*rangesCount = (ULONG) (irp->IoStatus.Information / sizeof(FILE_ALLOCATED_RANGE_BUFFER));
 
-			ExFreePool(write.Buffer);
+			status = STATUS_SUCCESS;
+		}
+		else
+		{
+			DBGPRINT(("QueryRanges -ERROR: FSCTL_QUERY_ALLOCATED_RANGES failed [0x%08x]\n", status));
 		}
+
+		IoFreeIrp(irp);
+	}
+	else
+	{
+		DBGPRINT(("QueryRanges -ERROR: IoAllocateIrp() failed\n"));
 	}
 
 	return status;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterWiper::Defer(FILFILE_VOLUME_EXTENSION *extension, FILE_OBJECT *file)
+{
+	ASSERT(extension);
+	ASSERT(file);
+
+	PAGED_CODE();
+
+	// Background wiping enabled, and can the queue be persisted ?
+	if(!m_worker || !m_registryPath)
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	// The disposition can be revoked, a pending DeleteOnClose cannot
+	if(!file->DeletePending || (file->Flags & FO_DELETE_ON_CLOSE))
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	if(InterlockedIncrement(&m_queueCount) > c_queueMax)
+	{
+		InterlockedDecrement(&m_queueCount);
+
+		DBGPRINT(("Defer: queue full, wipe synchronously\n"));
+
+		return STATUS_QUOTA_EXCEEDED;
+	}
+
+	FILE_NAME_INFORMATION *fileNameInfo = 0;
+
+	// Retrieve full file path from file system
+	NTSTATUS status = CFilterBase::QueryFileNameInfo(extension->Lower, file, &fileNameInfo);
+
+	if(NT_SUCCESS(status))
+	{
+		ASSERT(fileNameInfo);
+
+		status = STATUS_INSUFFICIENT_RESOURCES;
+
+		// Leave room for the generic name, it may be longer than the original one
+		ULONG const pathSize = extension->LowerName.Length + fileNameInfo->FileNameLength + c_nameLength * sizeof(WCHAR);
+
+		// Queued under spin lock, so keep it resident
+		CFilterWiperItem *const item = (CFilterWiperItem*) ExAllocatePool(NonPagedPool, sizeof(CFilterWiperItem) + pathSize + sizeof(WCHAR));
+
+		if(item)
+		{
+			RtlZeroMemory(item, sizeof(CFilterWiperItem) + pathSize + sizeof(WCHAR));
+
+			item->Path.Buffer		 = (LPWSTR) (item + 1);
+			item->Path.Length		 = (USHORT) (extension->LowerName.Length + fileNameInfo->FileNameLength);
+			item->Path.MaximumLength = (USHORT) (pathSize + sizeof(WCHAR));
+
+			RtlCopyMemory(item->Path.Buffer, extension->LowerName.Buffer, extension->LowerName.Length);
+			RtlCopyMemory((UCHAR*) item->Path.Buffer + extension->LowerName.Length, fileNameInfo->FileName, fileNameInfo->FileNameLength);
+
+			// Let the file survive until it is wiped
+			FILE_DISPOSITION_INFORMATION dispInfo = {false};
+
+			status = CFilterBase::SetFileInfo(extension->Lower, file, FileDispositionInformation, &dispInfo, sizeof(dispInfo));
+
+			if(NT_SUCCESS(status))
+			{
+				// Free the original name and record the generic one
+				status = Hide(extension->Lower, file, &item->Path);
+
+				if(NT_SUCCESS(status))
+				{
+					DBGPRINT(("Defer: FO[0x%p] queued[%wZ]\n", file, &item->Path));
+
+					item->Volume = extension->Common.Device;
+					ObReferenceObject(item->Volume);
+
+					ExInterlockedInsertTailList(&m_queue, &item->Link, &m_queueLock);
+
+					KeReleaseSemaphore(&m_queued, SEMAPHORE_INCREMENT, 1, false);
+
+					extension->Volume.m_statistics.Add(FILFILE_STAT_WIPE_DEFERRED);
+				}
+				else
+				{
+					DBGPRINT(("Defer -ERROR: hiding file failed [0x%08x]\n", status));
+
+					// Restore the delete, so the caller wipes synchronously
+					dispInfo.DeleteFile = true;
+
+					CFilterBase::SetFileInfo(extension->Lower, file, FileDispositionInformation, &dispInfo, sizeof(dispInfo));
+				}
+			}
+			else
+			{
+				DBGPRINT(("Defer -ERROR: revoking disposition failed [0x%08x]\n", status));
+			}
+
+			if(NT_ERROR(status))
+			{
+				ExFreePool(item);
+			}
+		}
+
+		ExFreePool(fileNameInfo);
+	}
+
+	if(NT_ERROR(status))
+	{
+		InterlockedDecrement(&m_queueCount);
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterWiper::Hide(DEVICE_OBJECT *lower, FILE_OBJECT *file, UNICODE_STRING *path)
+{
+	ASSERT(lower);
+	ASSERT(file);
+	ASSERT(path);
+	ASSERT(path->MaximumLength >= path->Length + c_nameLength * sizeof(WCHAR));
+
+	PAGED_CODE();
+
+	// Directory part, up to and including the last backslash
+	USHORT directory = path->Length;
+
+	while(directory && (path->Buffer[directory / sizeof(WCHAR) - 1] != L'\\'))
+	{
+		directory -= sizeof(WCHAR);
+	}
+
+	if(!directory)
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	LPCWSTR const hex = L"0123456789abcdef";
+
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+
+	for(ULONG tries = 0; tries < 16; ++tries)
+	{
+		ULONG number = 0;
+
+		// Unpredictable, so the name tells nothing about the file
+		status = m_random->Get((UCHAR*) &number, sizeof(number));
+
+		if(NT_ERROR(status))
+		{
+			break;
+		}
+
+		// Build "~wipeXXXXXXXX" in place of the original name
+		LPWSTR const name = path->Buffer + directory / sizeof(WCHAR);
+
+		RtlCopyMemory(name, L"~wipe", 5 * sizeof(WCHAR));
+
+		for(ULONG index = 0; index < 8; ++index)
+		{
+			name[5 + index] = hex[(number >> (28 - 4 * index)) & 0xf];
+		}
+
+		name[c_nameLength] = UNICODE_NULL;
+
+		path->Length = (USHORT) (directory + c_nameLength * sizeof(WCHAR));
+
+		// Record it first, so a crash after the rename cannot lose the file
+		status = Persist(path, true);
+
+		if(NT_ERROR(status))
+		{
+			break;
+		}
+
+		status = CFilterBase::SimpleRename(lower, file, name, c_nameLength * sizeof(WCHAR), false);
+
+		if(NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		Persist(path, false);
+
+		if((STATUS_OBJECT_NAME_COLLISION != status) && (STATUS_OBJECT_NAME_EXISTS != status))
+		{
+			break;
+		}
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterWiper::OpenQueue(HANDLE *key)
+{
+	ASSERT(key);
+
+	PAGED_CODE();
+
+	if(!m_registryPath)
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	ULONG const pathLength = (ULONG) wcslen(m_registryPath) * sizeof(WCHAR);
+	ULONG const pathSize   = pathLength + sizeof(L"\\WipeQueue");
+
+	LPWSTR const path = (LPWSTR) ExAllocatePool(PagedPool, pathSize);
+
+	if(!path)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	RtlCopyMemory(path, m_registryPath, pathLength);
+	RtlCopyMemory((UCHAR*) path + pathLength, L"\\WipeQueue", sizeof(L"\\WipeQueue"));
+
+	UNICODE_STRING name;
+	RtlInitUnicodeString(&name, path);
+
+	OBJECT_ATTRIBUTES keyAttribs;
+	InitializeObjectAttributes(&keyAttribs, &name, OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, 0,0);
+
+	NTSTATUS status = ZwCreateKey(key, KEY_QUERY_VALUE | KEY_SET_VALUE, &keyAttribs, 0,0, REG_OPTION_NON_VOLATILE, 0);
+
+	if(NT_ERROR(status))
+	{
+		DBGPRINT(("OpenQueue -ERROR: ZwCreateKey() failed [0x%08x]\n", status));
+	}
+
+	ExFreePool(path);
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterWiper::Persist(UNICODE_STRING *path, bool add)
+{
+	ASSERT(path);
+
+	PAGED_CODE();
+
+	HANDLE key = 0;
+
+	NTSTATUS status = OpenQueue(&key);
+
+	if(NT_SUCCESS(status))
+	{
+		// The path is the value name, its data is unused
+		if(add)
+		{
+			ULONG const data = 0;
+
+			status = ZwSetValueKey(key, path, 0, REG_DWORD, (void*) &data, sizeof(data));
+		}
+		else
+		{
+			status = ZwDeleteValueKey(key, path);
+		}
+
+		if(NT_SUCCESS(status))
+		{
+			// Must be on disk before the file is touched
+			status = ZwFlushKey(key);
+		}
+
+		if(NT_ERROR(status))
+		{
+			DBGPRINT(("Persist -ERROR: Add[%d] Path[%wZ] failed [0x%08x]\n", add, path, status));
+		}
+
+		ZwClose(key);
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterWiper::Recover()
+{
+	PAGED_CODE();
+
+	HANDLE key = 0;
+
+	if(NT_ERROR(OpenQueue(&key)))
+	{
+		return;
+	}
+
+	ULONG const bufferSize = sizeof(KEY_VALUE_BASIC_INFORMATION) + MAXUSHORT;
+	KEY_VALUE_BASIC_INFORMATION *const info = (KEY_VALUE_BASIC_INFORMATION*) ExAllocatePool(PagedPool, bufferSize);
+
+	if(info)
+	{
+		for(ULONG index = 0; ; ++index)
+		{
+			ULONG length = 0;
+
+			NTSTATUS status = ZwEnumerateValueKey(key, index, KeyValueBasicInformation, info, bufferSize, &length);
+
+			if(STATUS_NO_MORE_ENTRIES == status)
+			{
+				break;
+			}
+
+			if(NT_ERROR(status))
+			{
+				break;
+			}
+
+			// Skip truncated and bogus names
+			if(!NT_SUCCESS(status) || !info->NameLength || (info->NameLength > MAXUSHORT - sizeof(WCHAR)))
+			{
+				continue;
+			}
+
+			// Left over from a crash or unload, the worker retries it
+			CFilterWiperItem *const item = (CFilterWiperItem*) ExAllocatePool(NonPagedPool, sizeof(CFilterWiperItem) + info->NameLength + sizeof(WCHAR));
+
+			if(!item)
+			{
+				break;
+			}
+
+			RtlZeroMemory(item, sizeof(CFilterWiperItem) + info->NameLength + sizeof(WCHAR));
+
+			item->Path.Buffer		 = (LPWSTR) (item + 1);
+			item->Path.Length		 = (USHORT) info->NameLength;
+			item->Path.MaximumLength = (USHORT) (info->NameLength + sizeof(WCHAR));
+
+			RtlCopyMemory(item->Path.Buffer, info->Name, info->NameLength);
+
+			// Its volume must be attached, otherwise our cleanup would defer it again
+			if(NT_ERROR(CFilterControl::GetVolumeDevice(&item->Path, &item->Volume)))
+			{
+				DBGPRINT(("Recover: volume not found[%wZ], kept\n", &item->Path));
+
+				ExFreePool(item);
+				continue;
+			}
+
+			ASSERT(item->Volume);
+
+			DBGPRINT(("Recover: queued[%wZ]\n", &item->Path));
+
+			InterlockedIncrement(&m_queueCount);
+
+			ExInterlockedInsertTailList(&m_queue, &item->Link, &m_queueLock);
+
+			KeReleaseSemaphore(&m_queued, SEMAPHORE_INCREMENT, 1, false);
+		}
+
+		ExFreePool(info);
+	}
+
+	ZwClose(key);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterWiper::WipeDeferred(CFilterWiperItem *item)
+{
+	ASSERT(item);
+
+	PAGED_CODE();
+
+	ASSERT(item->Volume);
+	FILFILE_VOLUME_EXTENSION *const extension = (FILFILE_VOLUME_EXTENSION*) item->Volume->DeviceExtension;
+	ASSERT(extension);
+
+	OBJECT_ATTRIBUTES oa;
+	InitializeObjectAttributes(&oa, &item->Path, OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, 0,0);
+
+	IO_STATUS_BLOCK	ioStatus = {0,0};
+	HANDLE fileHandle		 = 0;
+
+	ULONG const access = STANDARD_RIGHTS_WRITE | FILE_WRITE_DATA | FILE_WRITE_ATTRIBUTES | DELETE | SYNCHRONIZE;
+
+	NTSTATUS status = IoCreateFileSpecifyDeviceObjectHint(&fileHandle,
+														  access,
+														  &oa,
+														  &ioStatus,
+														  0,
+														  0,
+														  FILE_SHARE_VALID_FLAGS,
+														  FILE_OPEN, 
+														  FILE_NON_DIRECTORY_FILE | FILE_NO_INTERMEDIATE_BUFFERING | FILE_SYNCHRONOUS_IO_NONALERT,
+														  0,
+														  0,
+														  CreateFileTypeNone,
+														  0,
+														  IO_IGNORE_SHARE_ACCESS_CHECK,
+														  extension->Lower);
+	if(NT_SUCCESS(status))
+	{
+		FILE_OBJECT *file = 0;
+
+		status = ObReferenceObjectByHandle(fileHandle, access, *IoFileObjectType, KernelMode, (void**) &file, 0);
+
+		if(NT_SUCCESS(status))
+		{
+			ASSERT(file);
+
+			status = WipeFile(file);
+
+			if(NT_SUCCESS(status))
+			{
+				// Complete the original delete
+				FILE_DISPOSITION_INFORMATION dispInfo = {true};
+			
+				status = CFilterBase::SetFileInfo(extension->Lower, file, FileDispositionInformation, &dispInfo, sizeof(dispInfo));
+			}
+
+			ObDereferenceObject(file);
+		}
+
+		ZwClose(fileHandle);
+	}
+	else if((STATUS_OBJECT_NAME_NOT_FOUND == status) || (STATUS_OBJECT_PATH_NOT_FOUND == status))
+	{
+		// Gone already, e.g. recorded just before a crash but never renamed
+		status = STATUS_SUCCESS;
+	}
+
+	if(NT_SUCCESS(status))
+	{
+		Persist(&item->Path, false);
+	}
+	else
+	{
+		// Keep it recorded, it is retried on next start
+		DBGPRINT(("WipeDeferred -ERROR: Path[%wZ] failed [0x%08x], kept\n", &item->Path, status));
+
+		extension->Volume.m_statistics.Add(FILFILE_STAT_WIPE_FAILED);
+	}
+
+	ObDereferenceObject(item->Volume);
+
+	ExFreePool(item);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterWiper::WorkerStart()
+{
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	if(!m_worker)
+	{
+		// Queue what was left over, before the worker removes entries
+		Recover();
+
+		OBJECT_ATTRIBUTES oa;
+		InitializeObjectAttributes(&oa, 0, OBJ_KERNEL_HANDLE, 0,0);
+
+		status = PsCreateSystemThread(&m_worker, THREAD_ALL_ACCESS, &oa, 0,0, Worker, this);
+
+		if(NT_ERROR(status))
+		{
+			DBGPRINT(("WorkerStart -ERROR: PsCreateSystemThread() failed with [0x%x]\n", status));
+		}
+		else
+		{
+			ASSERT(m_worker);
+		}
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+NTSTATUS CFilterWiper::WorkerStop()
+{
+	PAGED_CODE();
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	if(m_worker)
+	{
+		void *thread = 0;
+
+		// Use W2k compatible way to wait for worker
+		status = ObReferenceObjectByHandle(m_worker, 
+										   THREAD_ALL_ACCESS,
+										   0, 
+										   KernelMode, 
+										   &thread,
+										   0);
+		if(NT_SUCCESS(status))
+		{
+			ASSERT(thread);
+
+			// Trigger stop
+			KeSetEvent(&m_workerStop, EVENT_INCREMENT, true);
+
+			KeWaitForSingleObject(thread, Executive, KernelMode, false, 0);
+
+			ObDereferenceObject(thread);
+		}
+
+		KeClearEvent(&m_workerStop);
+	}
+
+	// Finish what is left in here
+	for(;;)
+	{
+		LIST_ENTRY *const entry = ExInterlockedRemoveHeadList(&m_queue, &m_queueLock);
+
+		if(!entry)
+		{
+			break;
+		}
+
+		InterlockedDecrement(&m_queueCount);
+
+		WipeDeferred(CONTAINING_RECORD(entry, CFilterWiperItem, Link));
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma PAGEDCODE
+
+void CFilterWiper::Worker(void *context)
+{
+	PAGED_CODE();
+
+	// Wiping is background work, so lower our priority
+	KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY - 1);
+
+	CFilterWiper *const me = (CFilterWiper*) context;
+	ASSERT(me);
+
+	void *objects[2] = {&me->m_workerStop, &me->m_queued};
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	for(;;)
+	{
+		status = KeWaitForMultipleObjects(2, objects, WaitAny, Executive, KernelMode, false, 0,0);
+
+		if((STATUS_WAIT_1 != status) || NT_ERROR(status))
+		{
+			DBGPRINT(("Worker: Stopping\n"));
+			break;
+		}
+
+		LIST_ENTRY *const entry = ExInterlockedRemoveHeadList(&me->m_queue, &me->m_queueLock);
+
+		// Already drained by WorkerStop ?
+		if(entry)
+		{
+			InterlockedDecrement(&me->m_queueCount);
+
+			me->WipeDeferred(CONTAINING_RECORD(entry, CFilterWiperItem, Link));
+		}
+	}
+
+	HANDLE const worker = me->m_worker;
+	me->m_worker = 0;
+
+	ASSERT(worker);
+	ZwClose(worker);
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -15,24 +15,63 @@
 
 #include "CFilterRandomizer.h"
 
+struct FILFILE_VOLUME_EXTENSION;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 class CFilterWiper  
 {
+	enum c_constants
+	{
+		c_buffers		= 3,							// writes in flight
+		c_bufferSize	= MM_MAXIMUM_DISK_IO_SIZE,
+		c_ranges		= 32,							// allocated ranges fetched at once
+		c_queueMax		= 256,							// deferred files, then wipe synchronously
+		c_nameLength	= 13,							// generic name of deferred files, "~wipeXXXXXXXX"
+	};
+
+	struct CFilterWiperBuffer;
+	struct CFilterWiperPass;
+
+	struct CFilterWiperItem
+	{
+		LIST_ENTRY			Link;
+		DEVICE_OBJECT*		Volume;			// referenced
+		UNICODE_STRING		Path;			// full path on lower device with generic name, follows this struct
+	};
 
 public:
 	
-	NTSTATUS				Init(CFilterRandomizer *random);
+	NTSTATUS				Init(CFilterRandomizer *random, LPCWSTR regPath = 0);
 	void					Close();
 
 	NTSTATUS				Prepare(ULONG flags, int *patterns = 0, int patternsCount = 0, HANDLE cancel = 0, HANDLE progress = 0);
 	NTSTATUS				WipeFile(FILE_OBJECT *file);
 
+							// WipeOnDelete in background
+	NTSTATUS				Defer(FILFILE_VOLUME_EXTENSION *extension, FILE_OBJECT *file);
+	NTSTATUS				WorkerStart();
+	NTSTATUS				WorkerStop();
+
 private:
 	
-	bool					WipeStep(LARGE_INTEGER const* offset);	
+	bool					WipeStep(LONGLONG previous, LONGLONG current);	
 	NTSTATUS				WipeData(FILE_OBJECT *file, DEVICE_OBJECT *lower);
+	NTSTATUS				WipePass(FILE_OBJECT *file, DEVICE_OBJECT *lower, CFilterWiperPass *pass, int pattern, LONGLONG eof, bool sparse);
 	NTSTATUS				WipePost(FILE_OBJECT *file, DEVICE_OBJECT *lower);
+	void					WipeDeferred(CFilterWiperItem *item);
+
+							// Deferred files are recorded in the registry until wiped
+	NTSTATUS				Hide(DEVICE_OBJECT *lower, FILE_OBJECT *file, UNICODE_STRING *path);
+	NTSTATUS				OpenQueue(HANDLE *key);
+	NTSTATUS				Persist(UNICODE_STRING *path, bool add);
+	void					Recover();
+
+	NTSTATUS				Write(DEVICE_OBJECT *lower, FILE_OBJECT *file, CFilterWiperBuffer *buffer, LONGLONG offset, ULONG length);
+	NTSTATUS				QueryRanges(DEVICE_OBJECT *lower, FILE_OBJECT *file, LONGLONG offset, LONGLONG length, FILE_ALLOCATED_RANGE_BUFFER *ranges, ULONG *rangesCount);
+
+	static NTSTATUS			WriteCompletion(DEVICE_OBJECT *device, IRP *irp, void *context);
+	static void NTAPI		Worker(void *context);
 							
 							// DATA
 	CFilterRandomizer*		m_random;
@@ -45,18 +84,34 @@ private:
 
 	char					m_patternsCount;
 	int						m_patterns[50];
+
+	LPCWSTR					m_registryPath;		// Parameters, not owned
+
+	LIST_ENTRY				m_queue;			// deferred files
+	LONG					m_queueCount;
+	KSPIN_LOCK				m_queueLock;
+	KSEMAPHORE				m_queued;
+
+	HANDLE					m_worker;
+	KEVENT					m_workerStop;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 inline
-NTSTATUS CFilterWiper::Init(CFilterRandomizer *random)
+NTSTATUS CFilterWiper::Init(CFilterRandomizer *random, LPCWSTR regPath)
 {
 	ASSERT(random);
 
 	RtlZeroMemory(this, sizeof(*this));
 
-	m_random = random;
+	m_random	   = random;
+	m_registryPath = regPath;
+
+	InitializeListHead(&m_queue);
+	KeInitializeSpinLock(&m_queueLock);
+	KeInitializeSemaphore(&m_queued, 0, MAXLONG);
+	KeInitializeEvent(&m_workerStop, NotificationEvent, false);
 
 	return STATUS_SUCCESS;
 }
@@ -59,7 +59,7 @@ extern "C" {
 
 // MACROS ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-extern char* g_debugHeader;
+extern char const* g_debugHeader;
 
 #if DBG
 #define DBGPRINT_N(format) DbgPrint format;
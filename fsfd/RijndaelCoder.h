@@ -72,6 +72,20 @@ struct AES_256
 	};
 };
 
+struct AES_ANY						// key size given at Init
+{
+	enum c_constants
+	{
+		c_keyCount		= 0,
+
+		#ifdef _AMD64_
+		 c_memoryNeeded	= 624 + 10,	// same for all key sizes
+		#else
+		 c_memoryNeeded	= 624,
+		#endif
+	};
+};
+
 ////////////////////////////////////////
 
 template<typename t_traits>
@@ -93,6 +107,7 @@ public:
 	{ Close(); }
 
 	bool							Init(unsigned char const *key, bool);
+	bool							Init(unsigned char const *key, unsigned long keySize, bool);
 	void							Close();
 
 	bool							EncodeBlock(unsigned char *block);	// works inplace
@@ -111,18 +126,31 @@ private:
 
 template<typename t_traits>
 inline
-bool RijndealCoder<t_traits>::Init(unsigned char const *key, bool)
+bool RijndealCoder<t_traits>::Init(unsigned char const *key, bool dec)
+{
+	ASSERT(c_keySize);
+
+	return Init(key, c_keySize, dec);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<typename t_traits>
+inline
+bool RijndealCoder<t_traits>::Init(unsigned char const *key, unsigned long keySize, bool)
 {
 	ASSERT(key);
+	ASSERT(!c_keySize || (keySize == c_keySize));
+	ASSERT((keySize == 16) || (keySize == 24) || (keySize == 32));
 
 	// Allocate memory from c_memoryPool data area
 	PGPError err = PGPNewFixedSizeMemoryMgr(m_memoryPool, c_memoryNeeded, &m_mgr);
 
 	if(IsntPGPError(err))
 	{
-		PGPCipherAlgorithm const alg =	(c_keySize == 16) ? kPGPCipherAlgorithm_AES128 :
-										(c_keySize == 24) ? kPGPCipherAlgorithm_AES192 :
-															kPGPCipherAlgorithm_AES256;
+		PGPCipherAlgorithm const alg =	(keySize == 16) ? kPGPCipherAlgorithm_AES128 :
+										(keySize == 24) ? kPGPCipherAlgorithm_AES192 :
+														  kPGPCipherAlgorithm_AES256;
 
 		err = PGPNewSymmetricCipherContext(m_mgr, alg, &m_aes);
 
@@ -17,7 +17,7 @@
 // GLOBALS /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #if DBG
- char* g_debugHeader = "FilFile: ";
+ char const* g_debugHeader = "FilFile: ";
 #endif
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
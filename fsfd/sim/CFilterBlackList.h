@@ -0,0 +1,2 @@
+// The driver includes this header as CFilterBlackList.h, which only resolves on case insensitive file systems
+#include "../CFilterBlacklist.h"
@@ -0,0 +1,2218 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CSimFileSystem.cpp: implementation of the CSimFileSystem class and the cache manager calls it stands in for.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdlib.h>
+
+#include "driver.h"
+#include "CSimFileSystem.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum c_simPages
+{
+	c_pageValid		= 0x1,
+	c_pageDirty		= 0x2,
+};
+
+struct CSimFileSystem::Fcb
+{
+	FSRTL_ADVANCED_FCB_HEADER	Header;				// first, FsContext points here
+	ERESOURCE					Resource;
+	ERESOURCE					PagingIoResource;
+	FAST_MUTEX					Mutex;
+	SECTION_OBJECT_POINTERS		Section;
+	SHARE_ACCESS				Share;
+
+	Fcb*						Next;
+	WCHAR						Name[c_pathLength];	// from the volume root
+	ULONG						NameLength;			// characters
+	ULONG						Attributes;
+	LONGLONG					Id;
+	LARGE_INTEGER				CreationTime;
+	LARGE_INTEGER				LastAccessTime;
+	LARGE_INTEGER				LastWriteTime;
+	LARGE_INTEGER				ChangeTime;
+
+	UCHAR*						Data;				// as stored on the volume
+	UCHAR*						Cache;				// same layout, valid where Pages says so
+	UCHAR*						Pages;
+	ULONG						Capacity;
+	FILE_OBJECT*				CacheFile;			// paging I/O goes there
+
+	ULONG						OpenCount;
+	ULONG						UncleanCount;
+	bool						Directory;
+	bool						DeletePending;
+	bool						Deleted;
+};
+
+struct CSimFileSystem::Ccb
+{
+	ACCESS_MASK					Access;
+	bool						DeleteOnClose;
+	bool						Remote;				// opened through the redirector
+	bool						Queried;			// directory enumeration started
+	ULONG						Index;				// next child to return
+	WCHAR						Pattern[64];
+	ULONG						PatternLength;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// STATICS ////
+
+DRIVER_OBJECT*				CSimFileSystem::s_driver	= 0;
+DEVICE_OBJECT*				CSimFileSystem::s_control	= 0;
+DEVICE_OBJECT*				CSimFileSystem::s_disk		= 0;
+DEVICE_OBJECT*				CSimFileSystem::s_volume	= 0;
+DEVICE_OBJECT*				CSimFileSystem::s_redirector = 0;
+
+ULONG						CSimFileSystem::s_latency	= 0;
+ULONG						CSimFileSystem::s_bandwidth	= 0;
+
+UCHAR						CSimFileSystem::s_hookMajor	= 0;
+void						(*CSimFileSystem::s_hook)(void*) = 0;
+void*						CSimFileSystem::s_hookContext = 0;
+
+CSimFileSystem::Fcb*		CSimFileSystem::s_files		= 0;
+LONGLONG					CSimFileSystem::s_fileId	= 0;
+
+static WCHAR const			s_diskName[] = L"\\Device\\HarddiskVolume1";
+static WCHAR const			s_redirectorName[] = L"\\Device\\LanmanRedirector";
+static WCHAR const			s_shareName[] = L"\\sim\\share";		// as seen below the redirector
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static LONGLONG RoundUp(LONGLONG value, ULONG alignment)
+{
+	return (value + alignment - 1) & ~((LONGLONG) alignment - 1);
+}
+
+static ULONG Parent(LPCWSTR path, ULONG length)
+{
+	ULONG pos = length;
+
+	while(pos && (path[pos - 1] != L'\\'))
+	{
+		pos--;
+	}
+
+	// The root is the parent of its entries
+	return (pos > 1) ? pos - 1 : 1;
+}
+
+static void* Buffer(IRP *irp)
+{
+	return irp->MdlAddress ? MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority) : irp->UserBuffer;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CSimFileSystem::Init(LPCWSTR dosDevice)
+{
+	s_files		 = 0;
+	s_fileId	 = 0;
+	s_volume	 = 0;
+	s_redirector = 0;
+	s_latency	 = 0;
+	s_bandwidth	 = 0;
+	s_hook		 = 0;
+
+	s_driver = CSimKernel::CreateDriver(L"\\FileSystem\\SimFs");
+
+	for(ULONG major = 0; major <= IRP_MJ_MAXIMUM_FUNCTION; ++major)
+	{
+		s_driver->MajorFunction[major] = Dispatch;
+	}
+
+	s_control = CSimKernel::CreateDevice(s_driver, L"\\SimFs", 0, FILE_DEVICE_DISK_FILE_SYSTEM, 0);
+	s_control->Flags &= ~DO_DEVICE_INITIALIZING;
+
+	DRIVER_OBJECT *const disk = CSimKernel::CreateDriver(L"\\Driver\\SimDisk");
+
+	s_disk = CSimKernel::CreateDevice(disk, s_diskName, 0, FILE_DEVICE_DISK, 0);
+	s_disk->Flags &= ~DO_DEVICE_INITIALIZING;
+
+	if(dosDevice)
+	{
+		UNICODE_STRING link, target;
+		RtlInitUnicodeString(&link, dosDevice);
+		RtlInitUnicodeString(&target, s_diskName);
+
+		IoCreateSymbolicLink(&link, &target);
+	}
+
+	NewFcb(L"\\", 1, true);
+
+	CSimKernel::RegisterFileSystem(s_control);
+}
+
+void CSimFileSystem::Close()
+{
+	while(s_files)
+	{
+		Fcb *const fcb = s_files;
+		s_files		   = fcb->Next;
+
+		free(fcb->Data);
+		free(fcb->Cache);
+		free(fcb->Pages);
+
+		CSimKernel::Free(fcb);
+	}
+}
+
+void CSimFileSystem::AddRedirector()
+{
+	if(s_redirector)
+	{
+		return;
+	}
+
+	DRIVER_OBJECT *const driver = CSimKernel::CreateDriver(L"\\FileSystem\\SimRdr");
+
+	for(ULONG major = 0; major <= IRP_MJ_MAXIMUM_FUNCTION; ++major)
+	{
+		driver->MajorFunction[major] = Dispatch;
+	}
+
+	// A network file system has no volumes, creates go to the device the name points at
+	s_redirector = CSimKernel::CreateDevice(driver, s_redirectorName, 0, FILE_DEVICE_NETWORK_FILE_SYSTEM, 0);
+	s_redirector->Flags &= ~DO_DEVICE_INITIALIZING;
+
+	// Vista and later send UNC opens through Mup
+	UNICODE_STRING link, target;
+	RtlInitUnicodeString(&link, L"\\Device\\Mup");
+	RtlInitUnicodeString(&target, s_redirectorName);
+
+	IoCreateSymbolicLink(&link, &target);
+
+	CSimKernel::RegisterFileSystem(s_redirector);
+}
+
+void CSimFileSystem::SetLatency(ULONG request, ULONG bandwidth)
+{
+	s_latency	= request * 10;
+	s_bandwidth = bandwidth;
+}
+
+void CSimFileSystem::SetHook(UCHAR major, void (*hook)(void*), void *context)
+{
+	s_hookMajor	  = major;
+	s_hook		  = hook;
+	s_hookContext = context;
+}
+
+LPCWSTR CSimFileSystem::Volume()
+{
+	return s_diskName;
+}
+
+LPCWSTR CSimFileSystem::Redirector()
+{
+	return s_redirectorName;
+}
+
+LPCWSTR CSimFileSystem::Local(LPCWSTR path)
+{
+	ASSERT(path);
+
+	// \\sim\share\dir is \dir on the volume
+	if((path[0] == L'\\') && (path[1] == L'\\'))
+	{
+		ULONG const length = (ULONG) wcslen(s_shareName);
+
+		if(!_wcsnicmp(path + 1, s_shareName, length))
+		{
+			return path[length + 1] ? path + length + 1 : L"\\";
+		}
+	}
+
+	return path;
+}
+
+void CSimFileSystem::Store(UCHAR major, ULONG length)
+{
+	// Once, and not for what the hook sends down itself
+	if(s_hook && (major == s_hookMajor))
+	{
+		void (*const hook)(void*) = s_hook;
+		s_hook = 0;
+
+		hook(s_hookContext);
+	}
+
+	LONGLONG delay = s_latency;
+
+	if(s_bandwidth)
+	{
+		delay += (LONGLONG) length * 10 / s_bandwidth;
+	}
+
+	CSimKernel::Advance(delay);
+}
+
+NTSTATUS CSimFileSystem::AddDirectory(LPCWSTR path)
+{
+	ASSERT(path);
+
+	path = Local(path);
+
+	ULONG const length = (ULONG) wcslen(path);
+
+	if((path[0] != L'\\') || (length >= c_pathLength))
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	if(Find(path, length))
+	{
+		return STATUS_SUCCESS;
+	}
+
+	WCHAR parent[c_pathLength];
+	ULONG const parentLength = Parent(path, length);
+
+	memcpy(parent, path, parentLength * sizeof(WCHAR));
+	parent[parentLength] = UNICODE_NULL;
+
+	NTSTATUS const status = AddDirectory(parent);
+
+	if(NT_SUCCESS(status))
+	{
+		NewFcb(path, length, true);
+	}
+
+	return status;
+}
+
+NTSTATUS CSimFileSystem::AddFile(LPCWSTR path, void const* data, ULONG size)
+{
+	ASSERT(path);
+
+	path = Local(path);
+
+	ULONG const length = (ULONG) wcslen(path);
+
+	if((path[0] != L'\\') || (length <= 1) || (length >= c_pathLength))
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	WCHAR parent[c_pathLength];
+	ULONG const parentLength = Parent(path, length);
+
+	memcpy(parent, path, parentLength * sizeof(WCHAR));
+	parent[parentLength] = UNICODE_NULL;
+
+	NTSTATUS const status = AddDirectory(parent);
+
+	if(NT_ERROR(status))
+	{
+		return status;
+	}
+
+	Fcb *fcb = Find(path, length);
+
+	if(!fcb)
+	{
+		fcb = NewFcb(path, length, false);
+	}
+	else if(fcb->Directory || fcb->OpenCount)
+	{
+		return STATUS_ACCESS_DENIED;
+	}
+
+	SetSize(fcb, 0);
+	SetSize(fcb, size);
+
+	if(size)
+	{
+		memcpy(fcb->Data, data, size);
+	}
+
+	fcb->Header.ValidDataLength.QuadPart = size;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS CSimFileSystem::QueryFile(LPCWSTR path, LONGLONG *size, UCHAR const** data)
+{
+	ASSERT(path);
+	ASSERT(size);
+
+	path = Local(path);
+
+	Fcb *const fcb = Find(path, (ULONG) wcslen(path));
+
+	if(!fcb || fcb->Directory)
+	{
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	*size = fcb->Header.FileSize.QuadPart;
+
+	if(data)
+	{
+		*data = fcb->Data;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CSimFileSystem::Fcb* CSimFileSystem::Find(LPCWSTR path, ULONG length)
+{
+	for(Fcb *fcb = s_files; fcb; fcb = fcb->Next)
+	{
+		if((fcb->NameLength == length) && !_wcsnicmp(fcb->Name, path, length))
+		{
+			return fcb;
+		}
+	}
+
+	return 0;
+}
+
+CSimFileSystem::Fcb* CSimFileSystem::NewFcb(LPCWSTR path, ULONG length, bool directory)
+{
+	ASSERT(path);
+	ASSERT(length && (length < c_pathLength));
+
+	Fcb *const fcb = (Fcb*) CSimKernel::Allocate(sizeof(Fcb), false);
+
+	fcb->Header.NodeTypeCode	 = 0x0702;
+	fcb->Header.NodeByteSize	 = sizeof(Fcb);
+	fcb->Header.IsFastIoPossible = FastIoIsNotPossible;
+	fcb->Header.Flags2			 = FSRTL_FLAG2_SUPPORTS_FILTER_CONTEXTS;
+	fcb->Header.Resource		 = &fcb->Resource;
+	fcb->Header.PagingIoResource = &fcb->PagingIoResource;
+	fcb->Header.FastMutex		 = &fcb->Mutex;
+
+	InitializeListHead(&fcb->Header.FilterContexts);
+
+	ExInitializeResourceLite(&fcb->Resource);
+	ExInitializeResourceLite(&fcb->PagingIoResource);
+	ExInitializeFastMutex(&fcb->Mutex);
+
+	memcpy(fcb->Name, path, length * sizeof(WCHAR));
+
+	fcb->NameLength = length;
+	fcb->Directory	= directory;
+	fcb->Attributes = directory ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE;
+	fcb->Id			= ++s_fileId;
+
+	KeQuerySystemTime(&fcb->CreationTime);
+
+	fcb->LastAccessTime = fcb->CreationTime;
+	fcb->LastWriteTime	= fcb->CreationTime;
+	fcb->ChangeTime		= fcb->CreationTime;
+
+	// Keep creation order, enumerations follow it
+	Fcb **last = &s_files;
+
+	while(*last)
+	{
+		last = &(*last)->Next;
+	}
+
+	*last = fcb;
+
+	return fcb;
+}
+
+void CSimFileSystem::DeleteFcb(Fcb *fcb)
+{
+	ASSERT(fcb);
+	ASSERT(!fcb->OpenCount);
+	ASSERT(!fcb->CacheFile);
+
+	Fcb **link = &s_files;
+
+	while(*link && (*link != fcb))
+	{
+		link = &(*link)->Next;
+	}
+
+	if(*link)
+	{
+		*link = fcb->Next;
+	}
+
+	free(fcb->Data);
+	free(fcb->Cache);
+	free(fcb->Pages);
+
+	CSimKernel::Free(fcb);
+}
+
+bool CSimFileSystem::HasChildren(Fcb *fcb)
+{
+	ASSERT(fcb);
+
+	for(Fcb *child = s_files; child; child = child->Next)
+	{
+		if((child != fcb) && !child->Deleted && (Parent(child->Name, child->NameLength) == fcb->NameLength) &&
+		   !_wcsnicmp(child->Name, fcb->Name, fcb->NameLength))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool CSimFileSystem::Reserve(Fcb *fcb, LONGLONG size)
+{
+	ASSERT(fcb);
+
+	if(size <= fcb->Capacity)
+	{
+		return true;
+	}
+
+	// Volume is small, as memory
+	if(size > 0x40000000)
+	{
+		return false;
+	}
+
+	ULONG const capacity = (ULONG) RoundUp(max(size, (LONGLONG) 2 * fcb->Capacity), PAGE_SIZE);
+	ULONG const pages	 = capacity / PAGE_SIZE;
+
+	UCHAR *const data  = (UCHAR*) realloc(fcb->Data, capacity);
+	UCHAR *const cache = (UCHAR*) realloc(fcb->Cache, capacity);
+
+	if(!data || !cache)
+	{
+		abort();
+	}
+
+	UCHAR *const flags = (UCHAR*) realloc(fcb->Pages, pages);
+
+	if(!flags)
+	{
+		abort();
+	}
+
+	memset(data + fcb->Capacity, 0, capacity - fcb->Capacity);
+	memset(cache + fcb->Capacity, 0, capacity - fcb->Capacity);
+	memset(flags + fcb->Capacity / PAGE_SIZE, 0, pages - fcb->Capacity / PAGE_SIZE);
+
+	fcb->Data	  = data;
+	fcb->Cache	  = cache;
+	fcb->Pages	  = flags;
+	fcb->Capacity = capacity;
+
+	return true;
+}
+
+void CSimFileSystem::SetSize(Fcb *fcb, LONGLONG size)
+{
+	ASSERT(fcb);
+	ASSERT(size >= 0);
+
+	LONGLONG const current = fcb->Header.FileSize.QuadPart;
+
+	if(size < current)
+	{
+		// Whole pages beyond go, the last one keeps its head
+		LONGLONG const page = RoundUp(size, PAGE_SIZE);
+
+		if(page < fcb->Capacity)
+		{
+			CachePurge(fcb, page, (ULONG) (fcb->Capacity - page));
+		}
+
+		memset(fcb->Data + size, 0, (size_t) (fcb->Capacity - size));
+		memset(fcb->Cache + size, 0, (size_t) (page - size));
+
+		if(fcb->Header.ValidDataLength.QuadPart > size)
+		{
+			fcb->Header.ValidDataLength.QuadPart = size;
+		}
+	}
+	else if(!Reserve(fcb, size))
+	{
+		return;
+	}
+
+	fcb->Header.FileSize.QuadPart		= size;
+	fcb->Header.AllocationSize.QuadPart = RoundUp(size, c_clusterSize);
+}
+
+// CACHE ////
+
+void CSimFileSystem::CacheInit(Fcb *fcb, FILE_OBJECT *file)
+{
+	ASSERT(fcb);
+	ASSERT(file);
+
+	if(!file->PrivateCacheMap)
+	{
+		file->PrivateCacheMap = fcb;
+	}
+
+	if(!fcb->CacheFile)
+	{
+		fcb->CacheFile = file;
+		ObReferenceObject(file);
+
+		fcb->Section.SharedCacheMap = fcb;
+	}
+}
+
+void CSimFileSystem::CacheRelease(Fcb *fcb)
+{
+	ASSERT(fcb);
+
+	FILE_OBJECT *const file = fcb->CacheFile;
+
+	if(file)
+	{
+		fcb->CacheFile				= 0;
+		fcb->Section.SharedCacheMap = 0;
+
+		// As the cache manager, let go of it some time later
+		CSimKernel::DeferDereference(file);
+	}
+}
+
+NTSTATUS CSimFileSystem::CacheFill(Fcb *fcb, ULONG page)
+{
+	ASSERT(fcb);
+	ASSERT(fcb->CacheFile);
+
+	LONGLONG const offset = (LONGLONG) page * PAGE_SIZE;
+
+	memset(fcb->Cache + offset, 0, PAGE_SIZE);
+
+	if(offset < fcb->Header.FileSize.QuadPart)
+	{
+		NTSTATUS const status = CSimKernel::Page(fcb->CacheFile, IRP_MJ_READ, offset, fcb->Cache + offset, PAGE_SIZE);
+
+		if(NT_ERROR(status) && (STATUS_END_OF_FILE != status))
+		{
+			return status;
+		}
+	}
+
+	fcb->Pages[page] = c_pageValid;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS CSimFileSystem::CacheFlush(Fcb *fcb, LONGLONG offset, ULONG length)
+{
+	ASSERT(fcb);
+
+	ULONG const first = (ULONG) (offset / PAGE_SIZE);
+	ULONG const last  = length ? (ULONG) (RoundUp(offset + length, PAGE_SIZE) / PAGE_SIZE) : fcb->Capacity / PAGE_SIZE;
+
+	for(ULONG page = first; (page < last) && (page < fcb->Capacity / PAGE_SIZE); ++page)
+	{
+		if(fcb->Pages[page] & c_pageDirty)
+		{
+			ASSERT(fcb->CacheFile);
+
+			LONGLONG const pageOffset = (LONGLONG) page * PAGE_SIZE;
+
+			NTSTATUS const status = CSimKernel::Page(fcb->CacheFile, IRP_MJ_WRITE, pageOffset, fcb->Cache + pageOffset, PAGE_SIZE);
+
+			if(NT_ERROR(status))
+			{
+				return status;
+			}
+
+			fcb->Pages[page] &= ~c_pageDirty;
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+void CSimFileSystem::CachePurge(Fcb *fcb, LONGLONG offset, ULONG length)
+{
+	ASSERT(fcb);
+
+	ULONG const first = (ULONG) (offset / PAGE_SIZE);
+	ULONG const last  = length ? (ULONG) (RoundUp(offset + length, PAGE_SIZE) / PAGE_SIZE) : fcb->Capacity / PAGE_SIZE;
+
+	for(ULONG page = first; (page < last) && (page < fcb->Capacity / PAGE_SIZE); ++page)
+	{
+		fcb->Pages[page] = 0;
+	}
+}
+
+NTSTATUS CSimFileSystem::CacheZero(Fcb *fcb, LONGLONG start, LONGLONG end)
+{
+	ASSERT(fcb);
+	ASSERT(fcb->CacheFile);
+
+	if(!Reserve(fcb, end))
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	for(LONGLONG offset = start; offset < end; )
+	{
+		ULONG const page = (ULONG) (offset / PAGE_SIZE);
+		LONGLONG const next = min(end, (LONGLONG) (page + 1) * PAGE_SIZE);
+
+		if(!(fcb->Pages[page] & c_pageValid))
+		{
+			NTSTATUS const status = CacheFill(fcb, page);
+
+			if(NT_ERROR(status))
+			{
+				return status;
+			}
+		}
+
+		memset(fcb->Cache + offset, 0, (size_t) (next - offset));
+
+		fcb->Pages[page] |= c_pageDirty;
+
+		offset = next;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+CSimFileSystem::Fcb* CSimFileSystem::FromSection(SECTION_OBJECT_POINTERS *section)
+{
+	for(Fcb *fcb = s_files; fcb; fcb = fcb->Next)
+	{
+		if(&fcb->Section == section)
+		{
+			return fcb;
+		}
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+NTSTATUS CSimFileSystem::Complete(IRP *irp, NTSTATUS status, ULONG_PTR information)
+{
+	ASSERT(irp);
+
+	irp->IoStatus.Status	  = status;
+	irp->IoStatus.Information = information;
+
+	IoCompleteRequest(irp, IO_DISK_INCREMENT);
+
+	return status;
+}
+
+NTSTATUS CSimFileSystem::Dispatch(DEVICE_OBJECT *device, IRP *irp)
+{
+	ASSERT(device);
+	ASSERT(irp);
+
+	IO_STACK_LOCATION *const stack = IoGetCurrentIrpStackLocation(irp);
+	ULONG_PTR information		   = 0;
+
+	if(device == s_control)
+	{
+		switch(stack->MajorFunction)
+		{
+			case IRP_MJ_FILE_SYSTEM_CONTROL:
+				if(IRP_MN_MOUNT_VOLUME == stack->MinorFunction)
+				{
+					return Mount(device, irp);
+				}
+				break;
+
+			case IRP_MJ_CREATE:
+				return Complete(irp, STATUS_SUCCESS, FILE_OPENED);
+
+			case IRP_MJ_CLEANUP:
+			case IRP_MJ_CLOSE:
+				return Complete(irp, STATUS_SUCCESS);
+
+			default:
+				break;
+		}
+
+		return Complete(irp, STATUS_INVALID_DEVICE_REQUEST);
+	}
+
+	ASSERT((device == s_volume) || (device == s_redirector));
+
+	NTSTATUS status = STATUS_INVALID_DEVICE_REQUEST;
+
+	switch(stack->MajorFunction)
+	{
+		case IRP_MJ_CREATE:
+			status = Create(irp, stack);
+			information = irp->IoStatus.Information;
+			break;
+
+		case IRP_MJ_CLEANUP:
+			status = Cleanup(stack);
+			break;
+
+		case IRP_MJ_CLOSE:
+			status = CloseFile(stack);
+			break;
+
+		case IRP_MJ_READ:
+			status = Read(irp, stack, &information);
+			break;
+
+		case IRP_MJ_WRITE:
+			status = Write(irp, stack, &information);
+			break;
+
+		case IRP_MJ_QUERY_INFORMATION:
+			status = QueryInformation(irp, stack, &information);
+			break;
+
+		case IRP_MJ_SET_INFORMATION:
+			status = SetInformation(irp, stack);
+			break;
+
+		case IRP_MJ_DIRECTORY_CONTROL:
+			if(IRP_MN_QUERY_DIRECTORY == stack->MinorFunction)
+			{
+				status = QueryDirectory(irp, stack, &information);
+			}
+			break;
+
+		case IRP_MJ_FLUSH_BUFFERS:
+			if(stack->FileObject->FsContext)
+			{
+				status = CacheFlush((Fcb*) stack->FileObject->FsContext, 0, 0);
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	return Complete(irp, status, information);
+}
+
+NTSTATUS CSimFileSystem::Mount(DEVICE_OBJECT *device, IRP *irp)
+{
+	UNREFERENCED_PARAMETER(device);
+
+	IO_STACK_LOCATION *const stack = IoGetCurrentIrpStackLocation(irp);
+
+	VPB *const vpb			  = stack->Parameters.MountVolume.Vpb;
+	DEVICE_OBJECT *const real = vpb ? vpb->RealDevice : 0;
+
+	// A single volume of our own disk
+	if(s_volume || (real != s_disk))
+	{
+		return Complete(irp, STATUS_UNRECOGNIZED_VOLUME);
+	}
+
+	s_volume = CSimKernel::CreateDevice(s_driver, 0, 0, FILE_DEVICE_DISK_FILE_SYSTEM, 0);
+
+	s_volume->StackSize	 = real->StackSize + 1;
+	s_volume->Vpb		 = vpb;
+	s_volume->Flags		&= ~DO_DEVICE_INITIALIZING;
+
+	vpb->DeviceObject	   = s_volume;
+	vpb->SerialNumber	   = 0x51a1f5;
+	vpb->VolumeLabelLength = 3 * sizeof(WCHAR);
+
+	memcpy(vpb->VolumeLabel, L"SIM", vpb->VolumeLabelLength);
+
+	return Complete(irp, STATUS_SUCCESS);
+}
+
+NTSTATUS CSimFileSystem::Create(IRP *irp, IO_STACK_LOCATION *stack)
+{
+	ASSERT(irp);
+	ASSERT(stack);
+
+	irp->IoStatus.Information = 0;
+
+	FILE_OBJECT *const file = stack->FileObject;
+	ASSERT(file);
+
+	WCHAR path[c_pathLength];
+	ULONG length = 0;
+
+	if(file->RelatedFileObject && file->RelatedFileObject->FsContext)
+	{
+		Fcb *const related = (Fcb*) file->RelatedFileObject->FsContext;
+
+		memcpy(path, related->Name, related->NameLength * sizeof(WCHAR));
+		length = related->NameLength;
+
+		if(file->FileName.Length && (length > 1))
+		{
+			path[length++] = L'\\';
+		}
+	}
+
+	if(length + file->FileName.Length / sizeof(WCHAR) >= c_pathLength)
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	memcpy(path + length, file->FileName.Buffer, file->FileName.Length);
+	length += file->FileName.Length / sizeof(WCHAR);
+
+	bool const remote = (stack->DeviceObject == s_redirector);
+
+	// Names on the redirector start with the share, which is the root of the volume
+	if(remote && !file->RelatedFileObject)
+	{
+		if(!length)
+		{
+			irp->IoStatus.Information = FILE_OPENED;
+
+			return STATUS_SUCCESS;
+		}
+
+		ULONG const shareLength = (ULONG) wcslen(s_shareName);
+
+		if((length < shareLength) || _wcsnicmp(path, s_shareName, shareLength) || ((length > shareLength) && (path[shareLength] != L'\\')))
+		{
+			return STATUS_BAD_NETWORK_NAME;
+		}
+
+		length -= shareLength;
+		memmove(path, path + shareLength, length * sizeof(WCHAR));
+	}
+
+	bool const volumeOpen = !length;
+
+	// Volume opens land on the root directory
+	if(volumeOpen)
+	{
+		path[length++] = L'\\';
+	}
+
+	if(path[0] != L'\\')
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	while((length > 1) && (path[length - 1] == L'\\'))
+	{
+		length--;
+	}
+
+	path[length] = UNICODE_NULL;
+
+	for(ULONG pos = 0; pos < length; ++pos)
+	{
+		switch(path[pos])
+		{
+			case L'*': case L'?': case L'<': case L'>': case L'"': case L'|':
+				return STATUS_OBJECT_NAME_INVALID;
+
+			case L':':
+			{
+				// Only the default stream is there
+				UNICODE_STRING stream = { (USHORT) ((length - pos) * sizeof(WCHAR)), 0, path + pos };
+				UNICODE_STRING data;
+				RtlInitUnicodeString(&data, L"::$DATA");
+
+				if(!RtlEqualUnicodeString(&stream, &data, true))
+				{
+					return STATUS_OBJECT_NAME_NOT_FOUND;
+				}
+
+				length = pos;
+				path[length] = UNICODE_NULL;
+			}
+			break;
+
+			default:
+				break;
+		}
+	}
+
+	ULONG const options		= stack->Parameters.Create.Options & 0x00ffffff;
+	ULONG disposition		= stack->Parameters.Create.Options >> 24;
+	ACCESS_MASK const access = stack->Parameters.Create.SecurityContext ? stack->Parameters.Create.SecurityContext->DesiredAccess : 0;
+	ULONG const share		= stack->Parameters.Create.ShareAccess;
+
+	ULONG_PTR information = 0;
+	Fcb *parent			  = (length > 1) ? Find(path, Parent(path, length)) : 0;
+
+	if((length > 1) && (!parent || !parent->Directory || parent->DeletePending))
+	{
+		return STATUS_OBJECT_PATH_NOT_FOUND;
+	}
+
+	Fcb *fcb = Find(path, length);
+
+	if(stack->Flags & SL_OPEN_TARGET_DIRECTORY)
+	{
+		// Rename targets, the directory is opened instead
+		if(!parent)
+		{
+			return STATUS_OBJECT_NAME_INVALID;
+		}
+
+		information = fcb ? FILE_EXISTS : FILE_DOES_NOT_EXIST;
+		fcb			= parent;
+		disposition = FILE_OPEN;
+	}
+
+	if(fcb)
+	{
+		if(fcb->DeletePending)
+		{
+			return STATUS_DELETE_PENDING;
+		}
+
+		if((options & FILE_DIRECTORY_FILE) && !fcb->Directory)
+		{
+			return STATUS_NOT_A_DIRECTORY;
+		}
+
+		if((options & FILE_NON_DIRECTORY_FILE) && fcb->Directory)
+		{
+			return STATUS_FILE_IS_A_DIRECTORY;
+		}
+
+		switch(disposition)
+		{
+			case FILE_CREATE:
+				return STATUS_OBJECT_NAME_COLLISION;
+
+			case FILE_OPEN:
+			case FILE_OPEN_IF:
+				if(!information)
+				{
+					information = FILE_OPENED;
+				}
+				break;
+
+			case FILE_OVERWRITE:
+			case FILE_OVERWRITE_IF:
+			case FILE_SUPERSEDE:
+				if(fcb->Directory)
+				{
+					return STATUS_INVALID_PARAMETER;
+				}
+
+				information = (FILE_SUPERSEDE == disposition) ? FILE_SUPERSEDED : FILE_OVERWRITTEN;
+				break;
+
+			default:
+				return STATUS_INVALID_PARAMETER;
+		}
+
+		NTSTATUS const status = IoCheckShareAccess(access, share, file, &fcb->Share, true);
+
+		if(NT_ERROR(status))
+		{
+			return status;
+		}
+
+		if((FILE_OVERWRITTEN == information) || (FILE_SUPERSEDED == information))
+		{
+			SetSize(fcb, 0);
+
+			fcb->Attributes = stack->Parameters.Create.FileAttributes | FILE_ATTRIBUTE_ARCHIVE;
+			fcb->Attributes &= ~FILE_ATTRIBUTE_NORMAL;
+
+			KeQuerySystemTime(&fcb->LastWriteTime);
+		}
+	}
+	else
+	{
+		if((FILE_OPEN == disposition) || (FILE_OVERWRITE == disposition))
+		{
+			return STATUS_OBJECT_NAME_NOT_FOUND;
+		}
+
+		if(length <= 1)
+		{
+			return STATUS_OBJECT_NAME_INVALID;
+		}
+
+		fcb = NewFcb(path, length, (options & FILE_DIRECTORY_FILE) != 0);
+
+		if(!fcb->Directory)
+		{
+			fcb->Attributes = (stack->Parameters.Create.FileAttributes | FILE_ATTRIBUTE_ARCHIVE) & ~FILE_ATTRIBUTE_NORMAL;
+		}
+
+		IoSetShareAccess(access, share, file, &fcb->Share);
+
+		information = FILE_CREATED;
+	}
+
+	Ccb *const ccb = (Ccb*) CSimKernel::Allocate(sizeof(Ccb), false);
+
+	ccb->Access		   = access;
+	ccb->DeleteOnClose = (options & FILE_DELETE_ON_CLOSE) != 0;
+	ccb->Remote		   = remote;
+
+	file->FsContext			   = &fcb->Header;
+	file->FsContext2		   = ccb;
+	file->SectionObjectPointer = &fcb->Section;
+
+	if(!(options & FILE_NO_INTERMEDIATE_BUFFERING))
+	{
+		file->Flags |= FO_CACHE_SUPPORTED;
+	}
+
+	if(volumeOpen)
+	{
+		file->Flags |= FO_VOLUME_OPEN;
+	}
+
+	fcb->OpenCount++;
+	fcb->UncleanCount++;
+
+	irp->IoStatus.Information = information;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS CSimFileSystem::Cleanup(IO_STACK_LOCATION *stack)
+{
+	FILE_OBJECT *const file = stack->FileObject;
+	ASSERT(file);
+
+	Fcb *const fcb = (Fcb*) file->FsContext;
+	Ccb *const ccb = (Ccb*) file->FsContext2;
+
+	if(!fcb)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	ASSERT(ccb);
+	ASSERT(fcb->UncleanCount);
+
+	IoRemoveShareAccess(file, &fcb->Share);
+
+	if(ccb->DeleteOnClose)
+	{
+		fcb->DeletePending = true;
+	}
+
+	file->PrivateCacheMap = 0;
+	file->Flags			 |= FO_CLEANUP_COMPLETE;
+
+	if(!--fcb->UncleanCount)
+	{
+		if(fcb->DeletePending && (fcb->NameLength > 1))
+		{
+			CachePurge(fcb, 0, 0);
+			CacheRelease(fcb);
+
+			// Gone from the namespace, the FCB lives until the last close
+			fcb->Deleted	= true;
+			fcb->NameLength = 0;
+		}
+		else
+		{
+			CacheFlush(fcb, 0, 0);
+			CachePurge(fcb, 0, 0);
+			CacheRelease(fcb);
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS CSimFileSystem::CloseFile(IO_STACK_LOCATION *stack)
+{
+	FILE_OBJECT *const file = stack->FileObject;
+	ASSERT(file);
+
+	Fcb *const fcb = (Fcb*) file->FsContext;
+
+	if(!fcb)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	CSimKernel::Free(file->FsContext2);
+	file->FsContext2 = 0;
+
+	ASSERT(fcb->OpenCount);
+
+	if(!--fcb->OpenCount)
+	{
+		// FCB goes, and so do the contexts of filters
+		FsRtlTeardownPerStreamContexts(&fcb->Header);
+
+		if(fcb->Deleted)
+		{
+			DeleteFcb(fcb);
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS CSimFileSystem::Read(IRP *irp, IO_STACK_LOCATION *stack, ULONG_PTR *information)
+{
+	FILE_OBJECT *const file = stack->FileObject;
+	Fcb *const fcb			= (Fcb*) file->FsContext;
+
+	if(!fcb || fcb->Directory)
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	ULONG const length	  = stack->Parameters.Read.Length;
+	LONGLONG const offset = stack->Parameters.Read.ByteOffset.QuadPart;
+
+	if(!length)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	UCHAR *const buffer = (UCHAR*) Buffer(irp);
+
+	if(!buffer || (offset < 0))
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	bool const paging = (irp->Flags & IRP_PAGING_IO) != 0;
+	bool const remote = ((Ccb*) file->FsContext2)->Remote;
+	ULONG size		  = 0;
+
+	// From the stored data, the hook may change the file first
+	if(paging || (irp->Flags & IRP_NOCACHE))
+	{
+		Store(IRP_MJ_READ, length);
+	}
+
+	LONGLONG const fileSize = fcb->Header.FileSize.QuadPart;
+
+	if(offset >= fileSize)
+	{
+		return STATUS_END_OF_FILE;
+	}
+
+	if(paging || (irp->Flags & IRP_NOCACHE))
+	{
+		if(!paging)
+		{
+			if(((offset | length) & (c_sectorSize - 1)) && !remote)
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+
+			// Dirty data of the cache goes first
+			CacheFlush(fcb, offset, length);
+		}
+
+		// The server sends what is there, the disk whole sectors
+		size = (ULONG) min((LONGLONG) length, (remote ? fileSize : RoundUp(fileSize, c_sectorSize)) - offset);
+
+		if(!Reserve(fcb, offset + size))
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		memcpy(buffer, fcb->Data + offset, size);
+
+		// Beyond VDL the volume returns zeros, whatever is stored
+		LONGLONG const vdl = fcb->Header.ValidDataLength.QuadPart;
+
+		if(offset + size > vdl)
+		{
+			LONGLONG const zero = max(offset, vdl);
+
+			memset(buffer + (zero - offset), 0, (size_t) (offset + size - zero));
+		}
+	}
+	else
+	{
+		size = (ULONG) min((LONGLONG) length, fileSize - offset);
+
+		CacheInit(fcb, file);
+
+		for(ULONG page = (ULONG) (offset / PAGE_SIZE); (LONGLONG) page * PAGE_SIZE < offset + size; ++page)
+		{
+			if(!(fcb->Pages[page] & c_pageValid))
+			{
+				NTSTATUS const status = CacheFill(fcb, page);
+
+				if(NT_ERROR(status))
+				{
+					return status;
+				}
+			}
+		}
+
+		memcpy(buffer, fcb->Cache + offset, size);
+	}
+
+	if(!paging)
+	{
+		// Whole sectors are transferred, but callers only learn about the bytes up to EOF
+		size = (ULONG) min((LONGLONG) size, fileSize - offset);
+
+		if(file->Flags & FO_SYNCHRONOUS_IO)
+		{
+			file->CurrentByteOffset.QuadPart = offset + size;
+		}
+	}
+
+	*information = size;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS CSimFileSystem::Write(IRP *irp, IO_STACK_LOCATION *stack, ULONG_PTR *information)
+{
+	FILE_OBJECT *const file = stack->FileObject;
+	Fcb *const fcb			= (Fcb*) file->FsContext;
+
+	if(!fcb || fcb->Directory)
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	ULONG const length	  = stack->Parameters.Write.Length;
+	LONGLONG const offset = stack->Parameters.Write.ByteOffset.QuadPart;
+
+	if(!length)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	UCHAR const*const buffer = (UCHAR const*) Buffer(irp);
+
+	if(!buffer || (offset < 0))
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	bool const paging = (irp->Flags & IRP_PAGING_IO) != 0;
+	bool const remote = ((Ccb*) file->FsContext2)->Remote;
+	ULONG size		  = length;
+
+	// To the stored data, the hook may change the file first
+	if(paging || (irp->Flags & IRP_NOCACHE))
+	{
+		Store(IRP_MJ_WRITE, length);
+	}
+
+	LONGLONG const fileSize = fcb->Header.FileSize.QuadPart;
+	LONGLONG const end		= offset + length;
+
+	if(paging)
+	{
+		// Never extends, the tail of the last sector is written anyway
+		LONGLONG const limit = remote ? fileSize : RoundUp(fileSize, c_sectorSize);
+
+		if(offset >= limit)
+		{
+			*information = 0;
+
+			return STATUS_SUCCESS;
+		}
+
+		size = (ULONG) min((LONGLONG) length, limit - offset);
+
+		if(!Reserve(fcb, offset + size))
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		memcpy(fcb->Data + offset, buffer, size);
+
+		LONGLONG const valid = min(offset + size, fileSize);
+
+		if(valid > fcb->Header.ValidDataLength.QuadPart)
+		{
+			fcb->Header.ValidDataLength.QuadPart = valid;
+		}
+	}
+	else if(irp->Flags & IRP_NOCACHE)
+	{
+		if(((offset | length) & (c_sectorSize - 1)) && !remote)
+		{
+			return STATUS_INVALID_PARAMETER;
+		}
+
+		// Keep the cache coherent
+		CacheFlush(fcb, offset, length);
+		CachePurge(fcb, offset, length);
+
+		if(end > fileSize)
+		{
+			if(!Reserve(fcb, end))
+			{
+				return STATUS_INSUFFICIENT_RESOURCES;
+			}
+
+			SetSize(fcb, end);
+		}
+
+		memcpy(fcb->Data + offset, buffer, length);
+
+		if(end > fcb->Header.ValidDataLength.QuadPart)
+		{
+			fcb->Header.ValidDataLength.QuadPart = end;
+		}
+	}
+	else
+	{
+		if(end > fileSize)
+		{
+			if(!Reserve(fcb, end))
+			{
+				return STATUS_INSUFFICIENT_RESOURCES;
+			}
+
+			SetSize(fcb, end);
+		}
+
+		CacheInit(fcb, file);
+
+		LONGLONG const vdl = fcb->Header.ValidDataLength.QuadPart;
+
+		if(offset > vdl)
+		{
+			NTSTATUS const status = CacheZero(fcb, vdl, offset);
+
+			if(NT_ERROR(status))
+			{
+				return status;
+			}
+		}
+
+		for(ULONG page = (ULONG) (offset / PAGE_SIZE); (LONGLONG) page * PAGE_SIZE < end; ++page)
+		{
+			LONGLONG const pageOffset = (LONGLONG) page * PAGE_SIZE;
+
+			if(!(fcb->Pages[page] & c_pageValid))
+			{
+				// Partially written pages need what is there already
+				if(((offset > pageOffset) || (end < pageOffset + PAGE_SIZE)) && (pageOffset < fileSize))
+				{
+					NTSTATUS const status = CacheFill(fcb, page);
+
+					if(NT_ERROR(status))
+					{
+						return status;
+					}
+				}
+				else
+				{
+					memset(fcb->Cache + pageOffset, 0, PAGE_SIZE);
+				}
+			}
+
+			fcb->Pages[page] = c_pageValid | c_pageDirty;
+		}
+
+		memcpy(fcb->Cache + offset, buffer, length);
+
+		if(end > fcb->Header.ValidDataLength.QuadPart)
+		{
+			fcb->Header.ValidDataLength.QuadPart = end;
+		}
+
+		if((file->Flags & FO_WRITE_THROUGH) || (stack->Flags & SL_WRITE_THROUGH))
+		{
+			NTSTATUS const status = CacheFlush(fcb, offset, length);
+
+			if(NT_ERROR(status))
+			{
+				return status;
+			}
+		}
+	}
+
+	if(!paging)
+	{
+		KeQuerySystemTime(&fcb->LastWriteTime);
+
+		file->Flags |= FO_FILE_MODIFIED;
+
+		if(file->Flags & FO_SYNCHRONOUS_IO)
+		{
+			file->CurrentByteOffset.QuadPart = offset + size;
+		}
+	}
+
+	*information = size;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS CSimFileSystem::QueryInformation(IRP *irp, IO_STACK_LOCATION *stack, ULONG_PTR *information)
+{
+	FILE_OBJECT *const file = stack->FileObject;
+	Fcb *const fcb			= (Fcb*) file->FsContext;
+	Ccb *const ccb			= (Ccb*) file->FsContext2;
+
+	if(!fcb)
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	void *const buffer = irp->AssociatedIrp.SystemBuffer;
+	ULONG const length = stack->Parameters.QueryFile.Length;
+
+	FILE_BASIC_INFORMATION basic;
+	basic.CreationTime	 = fcb->CreationTime;
+	basic.LastAccessTime = fcb->LastAccessTime;
+	basic.LastWriteTime	 = fcb->LastWriteTime;
+	basic.ChangeTime	 = fcb->ChangeTime;
+	basic.FileAttributes = fcb->Attributes;
+
+	FILE_STANDARD_INFORMATION standard;
+	standard.AllocationSize = fcb->Header.AllocationSize;
+	standard.EndOfFile		= fcb->Header.FileSize;
+	standard.NumberOfLinks	= 1;
+	standard.DeletePending	= fcb->DeletePending;
+	standard.Directory		= fcb->Directory;
+
+	// The redirector names files with the share
+	WCHAR nameBuffer[c_pathLength + 16];
+	ULONG nameSize = fcb->NameLength * sizeof(WCHAR);
+
+	if(ccb && ccb->Remote)
+	{
+		wcscpy(nameBuffer, s_shareName);
+		ULONG const shareSize = (ULONG) wcslen(s_shareName) * sizeof(WCHAR);
+
+		if(fcb->NameLength > 1)
+		{
+			memcpy((UCHAR*) nameBuffer + shareSize, fcb->Name, nameSize);
+			nameSize += shareSize;
+		}
+		else
+		{
+			nameSize = shareSize;
+		}
+	}
+	else
+	{
+		memcpy(nameBuffer, fcb->Name, nameSize);
+	}
+
+	switch(stack->Parameters.QueryFile.FileInformationClass)
+	{
+		case FileBasicInformation:
+			if(length < sizeof(FILE_BASIC_INFORMATION))
+			{
+				return STATUS_INFO_LENGTH_MISMATCH;
+			}
+
+			*(FILE_BASIC_INFORMATION*) buffer = basic;
+			*information = sizeof(FILE_BASIC_INFORMATION);
+			break;
+
+		case FileStandardInformation:
+			if(length < sizeof(FILE_STANDARD_INFORMATION))
+			{
+				return STATUS_INFO_LENGTH_MISMATCH;
+			}
+
+			*(FILE_STANDARD_INFORMATION*) buffer = standard;
+			*information = sizeof(FILE_STANDARD_INFORMATION);
+			break;
+
+		case FileInternalInformation:
+			if(length < sizeof(FILE_INTERNAL_INFORMATION))
+			{
+				return STATUS_INFO_LENGTH_MISMATCH;
+			}
+
+			((FILE_INTERNAL_INFORMATION*) buffer)->IndexNumber.QuadPart = fcb->Id;
+			*information = sizeof(FILE_INTERNAL_INFORMATION);
+			break;
+
+		case FilePositionInformation:
+			if(length < sizeof(FILE_POSITION_INFORMATION))
+			{
+				return STATUS_INFO_LENGTH_MISMATCH;
+			}
+
+			((FILE_POSITION_INFORMATION*) buffer)->CurrentByteOffset = file->CurrentByteOffset;
+			*information = sizeof(FILE_POSITION_INFORMATION);
+			break;
+
+		case FileNetworkOpenInformation:
+		{
+			if(length < sizeof(FILE_NETWORK_OPEN_INFORMATION))
+			{
+				return STATUS_INFO_LENGTH_MISMATCH;
+			}
+
+			FILE_NETWORK_OPEN_INFORMATION *const info = (FILE_NETWORK_OPEN_INFORMATION*) buffer;
+
+			info->CreationTime	 = basic.CreationTime;
+			info->LastAccessTime = basic.LastAccessTime;
+			info->LastWriteTime	 = basic.LastWriteTime;
+			info->ChangeTime	 = basic.ChangeTime;
+			info->AllocationSize = standard.AllocationSize;
+			info->EndOfFile		 = standard.EndOfFile;
+			info->FileAttributes = basic.FileAttributes;
+
+			*information = sizeof(FILE_NETWORK_OPEN_INFORMATION);
+		}
+		break;
+
+		case FileNameInformation:
+		case FileAllInformation:
+		{
+			FILE_NAME_INFORMATION *name = (FILE_NAME_INFORMATION*) buffer;
+			ULONG fixed					= FIELD_OFFSET(FILE_NAME_INFORMATION, FileName);
+
+			if(FileAllInformation == stack->Parameters.QueryFile.FileInformationClass)
+			{
+				fixed = FIELD_OFFSET(FILE_ALL_INFORMATION, NameInformation.FileName);
+
+				if(length < fixed)
+				{
+					return STATUS_INFO_LENGTH_MISMATCH;
+				}
+
+				FILE_ALL_INFORMATION *const all = (FILE_ALL_INFORMATION*) buffer;
+				memset(all, 0, fixed);
+
+				all->BasicInformation					= basic;
+				all->StandardInformation				= standard;
+				all->InternalInformation.IndexNumber.QuadPart = fcb->Id;
+				all->AccessInformation.AccessFlags		= ccb ? ccb->Access : 0;
+				all->PositionInformation.CurrentByteOffset = file->CurrentByteOffset;
+
+				name = &all->NameInformation;
+			}
+			else if(length < fixed)
+			{
+				return STATUS_INFO_LENGTH_MISMATCH;
+			}
+
+			// Partial names come with an overflow
+			ULONG const copy = min(nameSize, length - fixed);
+
+			name->FileNameLength = nameSize;
+			memcpy(name->FileName, nameBuffer, copy);
+
+			*information = fixed + copy;
+
+			if(copy < nameSize)
+			{
+				return STATUS_BUFFER_OVERFLOW;
+			}
+		}
+		break;
+
+		case FileStreamInformation:
+		{
+			if(fcb->Directory)
+			{
+				*information = 0;
+				break;
+			}
+
+			ULONG const streamSize = 7 * sizeof(WCHAR);
+			ULONG const size	   = FIELD_OFFSET(FILE_STREAM_INFORMATION, StreamName) + streamSize;
+
+			if(length < size)
+			{
+				return STATUS_BUFFER_OVERFLOW;
+			}
+
+			FILE_STREAM_INFORMATION *const info = (FILE_STREAM_INFORMATION*) buffer;
+
+			info->NextEntryOffset	   = 0;
+			info->StreamNameLength	   = streamSize;
+			info->StreamSize		   = fcb->Header.FileSize;
+			info->StreamAllocationSize = fcb->Header.AllocationSize;
+
+			memcpy(info->StreamName, L"::$DATA", streamSize);
+
+			*information = size;
+		}
+		break;
+
+		default:
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS CSimFileSystem::SetInformation(IRP *irp, IO_STACK_LOCATION *stack)
+{
+	FILE_OBJECT *const file = stack->FileObject;
+	Fcb *const fcb			= (Fcb*) file->FsContext;
+
+	if(!fcb)
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	void *const buffer = irp->AssociatedIrp.SystemBuffer;
+
+	if(!buffer)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	switch(stack->Parameters.SetFile.FileInformationClass)
+	{
+		case FileEndOfFileInformation:
+		{
+			if(fcb->Directory)
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+
+			LONGLONG const size = ((FILE_END_OF_FILE_INFORMATION*) buffer)->EndOfFile.QuadPart;
+
+			if(size < 0)
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+
+			// From the cache manager, only advances VDL
+			if(stack->Parameters.SetFile.AdvanceOnly)
+			{
+				if((size > fcb->Header.ValidDataLength.QuadPart) && (size <= fcb->Header.FileSize.QuadPart))
+				{
+					fcb->Header.ValidDataLength.QuadPart = size;
+				}
+
+				break;
+			}
+
+			if(!Reserve(fcb, size))
+			{
+				return STATUS_INSUFFICIENT_RESOURCES;
+			}
+
+			SetSize(fcb, size);
+		}
+		break;
+
+		case FileAllocationInformation:
+		{
+			LONGLONG const size = ((FILE_ALLOCATION_INFORMATION*) buffer)->AllocationSize.QuadPart;
+
+			if(fcb->Directory || (size < 0))
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+
+			if(size < fcb->Header.FileSize.QuadPart)
+			{
+				SetSize(fcb, size);
+			}
+
+			fcb->Header.AllocationSize.QuadPart = RoundUp(max(size, fcb->Header.FileSize.QuadPart), c_clusterSize);
+		}
+		break;
+
+		case FileValidDataLengthInformation:
+		{
+			LONGLONG const size = ((LARGE_INTEGER*) buffer)->QuadPart;
+
+			if(fcb->Directory || (size < fcb->Header.ValidDataLength.QuadPart) || (size > fcb->Header.FileSize.QuadPart))
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+
+			fcb->Header.ValidDataLength.QuadPart = size;
+		}
+		break;
+
+		case FileDispositionInformation:
+		{
+			bool const remove = ((FILE_DISPOSITION_INFORMATION*) buffer)->DeleteFile != 0;
+
+			if(remove)
+			{
+				if(fcb->NameLength <= 1)
+				{
+					return STATUS_CANNOT_DELETE;
+				}
+
+				if(fcb->Directory && HasChildren(fcb))
+				{
+					return STATUS_DIRECTORY_NOT_EMPTY;
+				}
+			}
+
+			fcb->DeletePending  = remove;
+			file->DeletePending = remove;
+		}
+		break;
+
+		case FileBasicInformation:
+		{
+			FILE_BASIC_INFORMATION const*const basic = (FILE_BASIC_INFORMATION const*) buffer;
+
+			if(basic->CreationTime.QuadPart > 0)
+			{
+				fcb->CreationTime = basic->CreationTime;
+			}
+			if(basic->LastAccessTime.QuadPart > 0)
+			{
+				fcb->LastAccessTime = basic->LastAccessTime;
+			}
+			if(basic->LastWriteTime.QuadPart > 0)
+			{
+				fcb->LastWriteTime = basic->LastWriteTime;
+			}
+			if(basic->ChangeTime.QuadPart > 0)
+			{
+				fcb->ChangeTime = basic->ChangeTime;
+			}
+			if(basic->FileAttributes)
+			{
+				fcb->Attributes = (basic->FileAttributes & ~(FILE_ATTRIBUTE_NORMAL | FILE_ATTRIBUTE_DIRECTORY)) |
+								  (fcb->Attributes & FILE_ATTRIBUTE_DIRECTORY);
+			}
+		}
+		break;
+
+		case FilePositionInformation:
+			file->CurrentByteOffset = ((FILE_POSITION_INFORMATION*) buffer)->CurrentByteOffset;
+			break;
+
+		case FileRenameInformation:
+		{
+			FILE_RENAME_INFORMATION const*const rename = (FILE_RENAME_INFORMATION const*) buffer;
+
+			if((fcb->NameLength <= 1) || rename->RootDirectory)
+			{
+				return STATUS_INVALID_PARAMETER;
+			}
+
+			LPCWSTR name	 = rename->FileName;
+			ULONG nameLength = rename->FileNameLength / sizeof(WCHAR);
+
+			WCHAR target[c_pathLength];
+			ULONG targetLength = 0;
+
+			FILE_OBJECT *const directory = stack->Parameters.SetFile.FileObject;
+
+			// With the target's directory opened, only the last component counts
+			if(directory && (directory != file) && directory->FsContext)
+			{
+				ULONG last = nameLength;
+
+				while(last && (name[last - 1] != L'\\'))
+				{
+					last--;
+				}
+
+				name	   += last;
+				nameLength -= last;
+			}
+
+			// Plain names stay in the directory, or go to the one opened as target
+			if(!nameLength || (name[0] != L'\\'))
+			{
+				if(directory && (directory != file) && directory->FsContext)
+				{
+					Fcb *const parent = (Fcb*) directory->FsContext;
+
+					memcpy(target, parent->Name, parent->NameLength * sizeof(WCHAR));
+					targetLength = parent->NameLength;
+				}
+				else
+				{
+					targetLength = Parent(fcb->Name, fcb->NameLength);
+					memcpy(target, fcb->Name, targetLength * sizeof(WCHAR));
+				}
+
+				if(targetLength > 1)
+				{
+					target[targetLength++] = L'\\';
+				}
+			}
+
+			if(!nameLength || (targetLength + nameLength >= c_pathLength))
+			{
+				return STATUS_OBJECT_NAME_INVALID;
+			}
+
+			memcpy(target + targetLength, name, nameLength * sizeof(WCHAR));
+			targetLength += nameLength;
+			target[targetLength] = UNICODE_NULL;
+
+			Fcb *const parent = Find(target, Parent(target, targetLength));
+
+			if(!parent || !parent->Directory)
+			{
+				return STATUS_OBJECT_PATH_NOT_FOUND;
+			}
+
+			Fcb *const existing = Find(target, targetLength);
+
+			if(existing && (existing != fcb))
+			{
+				if(!stack->Parameters.SetFile.ReplaceIfExists)
+				{
+					return STATUS_OBJECT_NAME_COLLISION;
+				}
+
+				if(existing->OpenCount || existing->Directory)
+				{
+					return STATUS_ACCESS_DENIED;
+				}
+
+				DeleteFcb(existing);
+			}
+
+			// Entries below a directory move along
+			for(Fcb *child = s_files; child; child = child->Next)
+			{
+				if((child != fcb) && (child->NameLength > fcb->NameLength) && (child->Name[fcb->NameLength] == L'\\') &&
+				   !_wcsnicmp(child->Name, fcb->Name, fcb->NameLength))
+				{
+					ULONG const rest = child->NameLength - fcb->NameLength;
+
+					if(targetLength + rest >= c_pathLength)
+					{
+						return STATUS_OBJECT_NAME_INVALID;
+					}
+
+					memmove(child->Name + targetLength, child->Name + fcb->NameLength, rest * sizeof(WCHAR));
+					memcpy(child->Name, target, targetLength * sizeof(WCHAR));
+
+					child->NameLength = targetLength + rest;
+				}
+			}
+
+			memcpy(fcb->Name, target, (targetLength + 1) * sizeof(WCHAR));
+			fcb->NameLength = targetLength;
+		}
+		break;
+
+		default:
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS CSimFileSystem::QueryDirectory(IRP *irp, IO_STACK_LOCATION *stack, ULONG_PTR *information)
+{
+	FILE_OBJECT *const file = stack->FileObject;
+	Fcb *const fcb			= (Fcb*) file->FsContext;
+	Ccb *const ccb			= (Ccb*) file->FsContext2;
+
+	if(!fcb || !ccb || !fcb->Directory)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	FILE_INFORMATION_CLASS const type = stack->Parameters.QueryDirectory.FileInformationClass;
+	ULONG fixed = 0;
+
+	switch(type)
+	{
+		case FileNamesInformation:
+			fixed = FIELD_OFFSET(FILE_NAMES_INFORMATION, FileName);
+			break;
+
+		case FileDirectoryInformation:
+			fixed = FIELD_OFFSET(FILE_DIRECTORY_INFORMATION, FileName);
+			break;
+
+		case FileBothDirectoryInformation:
+			fixed = FIELD_OFFSET(FILE_BOTH_DIR_INFORMATION, FileName);
+			break;
+
+		default:
+			return STATUS_INVALID_PARAMETER;
+	}
+
+	UCHAR *const buffer = (UCHAR*) Buffer(irp);
+	ULONG const length	= stack->Parameters.QueryDirectory.Length;
+
+	if(!buffer)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	UNICODE_STRING const* pattern = stack->Parameters.QueryDirectory.FileName;
+
+	// The pattern of the first query sticks, as on NTFS
+	if(!ccb->Queried || ((stack->Flags & SL_RESTART_SCAN) && pattern && pattern->Length))
+	{
+		ccb->PatternLength = 1;
+		ccb->Pattern[0]	   = L'*';
+
+		if(pattern && pattern->Length && (pattern->Length < sizeof(ccb->Pattern)))
+		{
+			memcpy(ccb->Pattern, pattern->Buffer, pattern->Length);
+			ccb->PatternLength = pattern->Length / sizeof(WCHAR);
+		}
+	}
+
+	bool const first = !ccb->Queried;
+
+	ccb->Queried = true;
+
+	if(stack->Flags & SL_RESTART_SCAN)
+	{
+		ccb->Index = 0;
+	}
+
+	UNICODE_STRING expression = { (USHORT) (ccb->PatternLength * sizeof(WCHAR)), (USHORT) sizeof(ccb->Pattern), ccb->Pattern };
+
+	ULONG index	   = 0;
+	ULONG offset   = 0;
+	ULONG previous = 0;
+	bool written   = false;
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	for(Fcb *child = s_files; child; child = child->Next)
+	{
+		if((child == fcb) || child->Deleted || (Parent(child->Name, child->NameLength) != fcb->NameLength) ||
+		   _wcsnicmp(child->Name, fcb->Name, fcb->NameLength))
+		{
+			continue;
+		}
+
+		if(index++ < ccb->Index)
+		{
+			continue;
+		}
+
+		ULONG const nameStart = (fcb->NameLength > 1) ? fcb->NameLength + 1 : 1;
+
+		UNICODE_STRING name;
+		name.Buffer		   = child->Name + nameStart;
+		name.Length		   = (USHORT) ((child->NameLength - nameStart) * sizeof(WCHAR));
+		name.MaximumLength = name.Length;
+
+		if(!FsRtlIsNameInExpression(&expression, &name, true, 0))
+		{
+			ccb->Index = index;
+			continue;
+		}
+
+		ULONG const aligned = (ULONG) RoundUp(offset, 8);
+		ULONG const size	= fixed + name.Length;
+
+		if(aligned + size > length)
+		{
+			if(!written)
+			{
+				if(aligned + fixed > length)
+				{
+					return STATUS_BUFFER_TOO_SMALL;
+				}
+
+				status = STATUS_BUFFER_OVERFLOW;
+			}
+			else
+			{
+				break;
+			}
+		}
+
+		UCHAR *const entry = buffer + aligned;
+		ULONG const copy   = min((ULONG) name.Length, length - aligned - fixed);
+
+		memset(entry, 0, fixed);
+
+		if(written)
+		{
+			*(ULONG*) (buffer + previous) = aligned - previous;
+		}
+
+		// Those classes share their first members
+		if(FileNamesInformation == type)
+		{
+			FILE_NAMES_INFORMATION *const info = (FILE_NAMES_INFORMATION*) entry;
+
+			info->FileIndex		 = index;
+			info->FileNameLength = name.Length;
+		}
+		else
+		{
+			FILE_DIRECTORY_INFORMATION *const info = (FILE_DIRECTORY_INFORMATION*) entry;
+
+			info->FileIndex		 = index;
+			info->CreationTime	 = child->CreationTime;
+			info->LastAccessTime = child->LastAccessTime;
+			info->LastWriteTime	 = child->LastWriteTime;
+			info->ChangeTime	 = child->ChangeTime;
+			info->EndOfFile		 = child->Header.FileSize;
+			info->AllocationSize = child->Header.AllocationSize;
+			info->FileAttributes = child->Attributes;
+			info->FileNameLength = name.Length;
+		}
+
+		memcpy(entry + fixed, name.Buffer, copy);
+
+		previous   = aligned;
+		offset	   = aligned + fixed + copy;
+		written	   = true;
+		ccb->Index = index;
+
+		if((stack->Flags & SL_RETURN_SINGLE_ENTRY) || (STATUS_BUFFER_OVERFLOW == status))
+		{
+			break;
+		}
+	}
+
+	if(!written)
+	{
+		return first ? STATUS_NO_SUCH_FILE : STATUS_NO_MORE_FILES;
+	}
+
+	*information = offset;
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// CACHE MANAGER ////
+
+BOOLEAN CcIsFileCached(FILE_OBJECT *file)
+{
+	ASSERT(file);
+
+	return file->PrivateCacheMap != 0;
+}
+
+void CcFlushCache(SECTION_OBJECT_POINTERS *section, LARGE_INTEGER *offset, ULONG length, IO_STATUS_BLOCK *status)
+{
+	CSimFileSystem::Fcb *const fcb = CSimFileSystem::FromSection(section);
+
+	NTSTATUS result = STATUS_SUCCESS;
+
+	if(fcb)
+	{
+		// Without an offset, the whole stream
+		result = CSimFileSystem::CacheFlush(fcb, offset ? offset->QuadPart : 0, offset ? length : 0);
+	}
+
+	if(status)
+	{
+		status->Status		= result;
+		status->Information = 0;
+	}
+}
+
+BOOLEAN CcPurgeCacheSection(SECTION_OBJECT_POINTERS *section, LARGE_INTEGER *offset, ULONG length, BOOLEAN uninitialize)
+{
+	UNREFERENCED_PARAMETER(uninitialize);
+
+	CSimFileSystem::Fcb *const fcb = CSimFileSystem::FromSection(section);
+
+	if(fcb)
+	{
+		CSimFileSystem::CachePurge(fcb, offset ? offset->QuadPart : 0, offset ? length : 0);
+	}
+
+	return true;
+}
+
+void CcSetFileSizes(FILE_OBJECT *file, CC_FILE_SIZES *sizes)
+{
+	ASSERT(file);
+	ASSERT(sizes);
+
+	CSimFileSystem::Fcb *const fcb = CSimFileSystem::FromSection(file->SectionObjectPointer);
+
+	// Truncation drops the cached pages beyond
+	if(fcb && (sizes->FileSize.QuadPart < fcb->Capacity))
+	{
+		LONGLONG const page = RoundUp(sizes->FileSize.QuadPart, PAGE_SIZE);
+
+		if(page < fcb->Capacity)
+		{
+			CSimFileSystem::CachePurge(fcb, page, (ULONG) (fcb->Capacity - page));
+		}
+	}
+}
+
+LARGE_INTEGER* CcGetFileSizePointer(FILE_OBJECT *file)
+{
+	ASSERT(file);
+	ASSERT(file->FsContext);
+
+	return &((FSRTL_COMMON_FCB_HEADER*) file->FsContext)->FileSize;
+}
+
+void CcSetAdditionalCacheAttributes(FILE_OBJECT *file, BOOLEAN disableReadAhead, BOOLEAN disableWriteBehind)
+{
+	// No read ahead and no lazy writer to tell
+	UNREFERENCED_PARAMETER(file);
+	UNREFERENCED_PARAMETER(disableReadAhead);
+	UNREFERENCED_PARAMETER(disableWriteBehind);
+}
+
+BOOLEAN CcZeroData(FILE_OBJECT *file, LARGE_INTEGER *start, LARGE_INTEGER *end, BOOLEAN wait)
+{
+	UNREFERENCED_PARAMETER(wait);
+
+	ASSERT(file);
+	ASSERT(start);
+	ASSERT(end);
+
+	CSimFileSystem::Fcb *const fcb = CSimFileSystem::FromSection(file->SectionObjectPointer);
+
+	if(!fcb || (start->QuadPart >= end->QuadPart))
+	{
+		return true;
+	}
+
+	if(fcb->CacheFile)
+	{
+		return NT_SUCCESS(CSimFileSystem::CacheZero(fcb, start->QuadPart, end->QuadPart));
+	}
+
+	// Not cached, zeros are written as paging I/O on the given file
+	UCHAR zeros[CSimFileSystem::c_sectorSize];
+	memset(zeros, 0, sizeof(zeros));
+
+	for(LONGLONG offset = RoundUp(start->QuadPart, CSimFileSystem::c_sectorSize); offset + CSimFileSystem::c_sectorSize <= end->QuadPart; offset += CSimFileSystem::c_sectorSize)
+	{
+		if(NT_ERROR(CSimKernel::Page(file, IRP_MJ_WRITE, offset, zeros, sizeof(zeros))))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+BOOLEAN MmFlushImageSection(SECTION_OBJECT_POINTERS *section, ULONG type)
+{
+	// Images are never mapped
+	UNREFERENCED_PARAMETER(section);
+	UNREFERENCED_PARAMETER(type);
+
+	return true;
+}
+
+BOOLEAN MmForceSectionClosed(SECTION_OBJECT_POINTERS *section, BOOLEAN delete_)
+{
+	UNREFERENCED_PARAMETER(delete_);
+
+	CSimFileSystem::Fcb *const fcb = CSimFileSystem::FromSection(section);
+
+	if(fcb)
+	{
+		CSimFileSystem::CachePurge(fcb, 0, 0);
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
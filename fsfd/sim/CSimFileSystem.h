@@ -0,0 +1,119 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CSimFileSystem.h: interface for the CSimFileSystem class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CSimFileSystem_H__9B04E6D2_57A1_4C3F_8E2B_D14F60A7C935__INCLUDED_)
+#define AFX_CSimFileSystem_H__9B04E6D2_57A1_4C3F_8E2B_D14F60A7C935__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CSimFileSystem
+{
+	// Disk file system of the replay harness, in memory and modelled after NTFS as far as filters can tell:
+	// FCBs start with an advanced header that supports per-stream contexts, cached I/O goes through a page
+	// cache whose misses and flushes are paging I/O sent to the top of the volume stack, and non-cached I/O
+	// must be sector aligned. The cache of a stream is written back and dropped on its last cleanup, and the
+	// file object it was initialized with is dereferenced later, as the cache manager does. The file system
+	// takes no locks, there is only one thread anyway, so filters can take the FCB resources as they like.
+	// AddRedirector() shares the volume root as \\sim\share through a network file system that takes I/O
+	// of any alignment. Transfers to and from the stored data may cost simulated time, and a hook may run
+	// before the next one, which lets a request overlap another one below the filter.
+
+public:
+
+	enum c_constants
+	{
+		c_sectorSize		= 512,
+		c_clusterSize		= 4096,
+		c_pathLength		= 512,
+	};
+
+	static void					Init(LPCWSTR dosDevice = L"\\??\\C:");
+	static void					Close();
+
+	static void					AddRedirector();
+	static void					SetLatency(ULONG request, ULONG bandwidth);		// microseconds, MB/s
+	static void					SetHook(UCHAR major, void (*hook)(void*), void *context);
+
+								// Volume contents as stored, without going through the stack. Paths may
+								// also start with the share, \\sim\share\dir\file
+	static NTSTATUS				AddFile(LPCWSTR path, void const* data, ULONG size);
+	static NTSTATUS				AddDirectory(LPCWSTR path);
+	static NTSTATUS				QueryFile(LPCWSTR path, LONGLONG *size, UCHAR const** data = 0);
+
+	static LPCWSTR				Volume();
+	static LPCWSTR				Redirector();
+
+private:
+
+	struct Fcb;
+	struct Ccb;
+
+	static NTSTATUS				Dispatch(DEVICE_OBJECT *device, IRP *irp);
+	static NTSTATUS				Complete(IRP *irp, NTSTATUS status, ULONG_PTR information = 0);
+
+	static NTSTATUS				Mount(DEVICE_OBJECT *device, IRP *irp);
+	static NTSTATUS				Create(IRP *irp, IO_STACK_LOCATION *stack);
+	static NTSTATUS				Cleanup(IO_STACK_LOCATION *stack);
+	static NTSTATUS				CloseFile(IO_STACK_LOCATION *stack);
+	static NTSTATUS				Read(IRP *irp, IO_STACK_LOCATION *stack, ULONG_PTR *information);
+	static NTSTATUS				Write(IRP *irp, IO_STACK_LOCATION *stack, ULONG_PTR *information);
+	static NTSTATUS				QueryInformation(IRP *irp, IO_STACK_LOCATION *stack, ULONG_PTR *information);
+	static NTSTATUS				SetInformation(IRP *irp, IO_STACK_LOCATION *stack);
+	static NTSTATUS				QueryDirectory(IRP *irp, IO_STACK_LOCATION *stack, ULONG_PTR *information);
+
+	static LPCWSTR				Local(LPCWSTR path);
+	static void					Store(UCHAR major, ULONG length);
+
+	static Fcb*					Find(LPCWSTR path, ULONG length);
+	static Fcb*					NewFcb(LPCWSTR path, ULONG length, bool directory);
+	static void					DeleteFcb(Fcb *fcb);
+	static bool					HasChildren(Fcb *fcb);
+
+	static bool					Reserve(Fcb *fcb, LONGLONG size);
+	static void					SetSize(Fcb *fcb, LONGLONG size);
+	static void					CacheInit(Fcb *fcb, FILE_OBJECT *file);
+	static void					CacheRelease(Fcb *fcb);
+	static NTSTATUS				CacheFill(Fcb *fcb, ULONG page);
+	static NTSTATUS				CacheFlush(Fcb *fcb, LONGLONG offset, ULONG length);
+	static void					CachePurge(Fcb *fcb, LONGLONG offset, ULONG length);
+	static NTSTATUS				CacheZero(Fcb *fcb, LONGLONG start, LONGLONG end);
+
+	static Fcb*					FromSection(SECTION_OBJECT_POINTERS *section);
+
+	friend BOOLEAN				CcIsFileCached(FILE_OBJECT *file);
+	friend void					CcFlushCache(SECTION_OBJECT_POINTERS *section, LARGE_INTEGER *offset, ULONG length, IO_STATUS_BLOCK *status);
+	friend BOOLEAN				CcPurgeCacheSection(SECTION_OBJECT_POINTERS *section, LARGE_INTEGER *offset, ULONG length, BOOLEAN uninitialize);
+	friend void					CcSetFileSizes(FILE_OBJECT *file, CC_FILE_SIZES *sizes);
+	friend BOOLEAN				CcZeroData(FILE_OBJECT *file, LARGE_INTEGER *start, LARGE_INTEGER *end, BOOLEAN wait);
+	friend BOOLEAN				MmForceSectionClosed(SECTION_OBJECT_POINTERS *section, BOOLEAN delete_);
+
+								// DATA
+	static DRIVER_OBJECT*		s_driver;
+	static DEVICE_OBJECT*		s_control;
+	static DEVICE_OBJECT*		s_disk;
+	static DEVICE_OBJECT*		s_volume;
+	static DEVICE_OBJECT*		s_redirector;
+
+	static ULONG				s_latency;			// 100ns per transfer
+	static ULONG				s_bandwidth;		// MB/s, 0 := unlimited
+
+	static UCHAR				s_hookMajor;
+	static void					(*s_hook)(void*);
+	static void*				s_hookContext;
+
+	static Fcb*					s_files;			// all of the volume, the root first
+	static LONGLONG				s_fileId;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CSimFileSystem_H__9B04E6D2_57A1_4C3F_8E2B_D14F60A7C935__INCLUDED_)
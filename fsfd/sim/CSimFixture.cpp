@@ -0,0 +1,471 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CSimFixture.cpp: implementation of the CSimFixture class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <time.h>
+
+#include "driver.h"
+#include "IoControl.h"
+
+#include "CFilterBase.h"
+#include "CFilterControl.h"
+#include "CFilterFile.h"
+
+#include "CSimFixture.h"
+
+extern "C" NTSTATUS DriverEntry(DRIVER_OBJECT *driver, UNICODE_STRING *registry);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// STATICS ////
+
+HANDLE						CSimFixture::s_control		= 0;
+LONG						CSimFixture::s_outstanding	= 0;
+
+static LPCWSTR const		s_registry		= L"\\REGISTRY\\MACHINE\\SYSTEM\\CurrentControlSet\\Services\\XAzFileCrypt";
+
+// Payload and EntityKey of the Header all Entities share
+static UCHAR const			s_payload[16]	= { 0x5a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69 };
+static UCHAR const			s_entityKey[32]	= { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+FILFILE_CONTROL_EXTENSION* CSimFixture::Init()
+{
+	ASSERT(!s_control);
+
+	CSimKernel::Init();
+
+	s_outstanding = CSimKernel::Statistics().Outstanding;
+
+	DRIVER_OBJECT *const driver = CSimKernel::CreateDriver(L"\\Driver\\XAzFileCrypt");
+
+	UNICODE_STRING registry;
+	RtlInitUnicodeString(&registry, s_registry);
+
+	if(NT_ERROR(DriverEntry(driver, &registry)))
+	{
+		return 0;
+	}
+
+	if(NT_ERROR(CSimKernel::Open(L"\\FileSystem\\XAzFileCrypt", GENERIC_READ | GENERIC_WRITE, 0, FILE_OPEN, 0, &s_control)))
+	{
+		return 0;
+	}
+
+	return CFilterControl::Extension();
+}
+
+int CSimFixture::Close()
+{
+	int failed = 0;
+
+	if(s_control)
+	{
+		FILFILE_CONTROL_EXTENSION *const extension = CFilterControl::Extension();
+
+		// Drop all Entities first, volumes would hand theirs back to the CDO one by one
+		FILFILE_CONTROL control;
+		RtlZeroMemory(&control, sizeof(control));
+
+		control.Flags = FILFILE_CONTROL_SET | FILFILE_CONTROL_REM;
+
+		Control(IOCTL_FILFILE_ENTITY, &control, sizeof(control));
+
+		while(!IsListEmpty(&extension->Volumes))
+		{
+			RemoveVolume(CONTAINING_RECORD(extension->Volumes.Flink, FILFILE_VOLUME_EXTENSION, Link));
+		}
+
+		ZwClose(s_control);
+		s_control = 0;
+
+		CSimKernel::Run();
+
+		// As DriverUnload does
+		DRIVER_OBJECT *const driver = extension->Driver;
+
+		UNICODE_STRING deviceNameDos;
+		RtlInitUnicodeString(&deviceNameDos, CFilterControl::s_deviceNameDos);
+
+		IoDeleteSymbolicLink(&deviceNameDos);
+
+		CFilterControl::Close(driver);
+
+		ExFreePool(driver->FastIoDispatch);
+		driver->FastIoDispatch = 0;
+
+		CSimKernel::Run();
+	}
+
+	if(CSimKernel::Statistics().Outstanding != s_outstanding)
+	{
+		printf("ERROR ON LEAK [%d]\n", CSimKernel::Statistics().Outstanding - s_outstanding);
+		failed++;
+	}
+
+	CSimKernel::Close();
+
+	return failed;
+}
+
+NTSTATUS CSimFixture::Control(ULONG code, FILFILE_CONTROL *control, ULONG size, void *output, ULONG outputSize, ULONG *information)
+{
+	ASSERT(control);
+	ASSERT(size >= sizeof(FILFILE_CONTROL));
+
+	ASSERT(s_control);
+
+	control->Magic	 = FILFILE_CONTROL_MAGIC;
+	control->Version = FILFILE_CONTROL_VERSION;
+	control->Size	 = size;
+
+	ULONG_PTR transferred = 0;
+
+	NTSTATUS const status = CSimKernel::Control(s_control, code, control, size, output, outputSize, &transferred);
+
+	if(information)
+	{
+		*information = (ULONG) transferred;
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ULONG CSimFixture::Path(WCHAR *buffer, ULONG volume, ULONG number)
+{
+	ASSERT(buffer);
+	ASSERT(volume < 1000);
+
+	// Same length for all volumes, the driver matches device names as prefixes
+	char path[64];
+
+	int length = sprintf(path, "\\Device\\HarddiskVolume%03u", volume);
+
+	if(~0u != number)
+	{
+		length += sprintf(path + length, "\\data\\%u\\", number);
+	}
+
+	for(int pos = 0; pos <= length; ++pos)
+	{
+		buffer[pos] = (WCHAR) path[pos];
+	}
+
+	return (ULONG) length;
+}
+
+ULONG CSimFixture::EntityNumber(LPCWSTR path, ULONG length)
+{
+	ASSERT(path);
+
+	// Directory Entities end with a backslash for each level of deepness
+	while(length && (path[length - 1] == L'\\'))
+	{
+		length--;
+	}
+
+	ULONG start = length;
+
+	while(start && (path[start - 1] != L'\\'))
+	{
+		start--;
+	}
+
+	ULONG number = 0;
+
+	for(; (start < length) && (path[start] >= L'0') && (path[start] <= L'9'); ++start)
+	{
+		number = number * 10 + (path[start] - L'0');
+	}
+
+	return number;
+}
+
+FILFILE_VOLUME_EXTENSION* CSimFixture::FindVolume(LPCWSTR name, ULONG length)
+{
+	ASSERT(name);
+
+	FILFILE_CONTROL_EXTENSION *const extension = CFilterControl::Extension();
+	FILFILE_VOLUME_EXTENSION *found = 0;
+
+	FsRtlEnterFileSystem();
+	ExAcquireResourceSharedLite(&extension->Lock, true);
+
+	for(LIST_ENTRY *entry = extension->Volumes.Flink; entry != &extension->Volumes; entry = entry->Flink)
+	{
+		FILFILE_VOLUME_EXTENSION *const volume = CONTAINING_RECORD(entry, FILFILE_VOLUME_EXTENSION, Link);
+
+		if((volume->LowerName.Length == length * sizeof(WCHAR)) && !_wcsnicmp(volume->LowerName.Buffer, name, length))
+		{
+			found = volume;
+			break;
+		}
+	}
+
+	ExReleaseResourceLite(&extension->Lock);
+	FsRtlExitFileSystem();
+
+	return found;
+}
+
+FILFILE_VOLUME_EXTENSION* CSimFixture::AddVolume(ULONG number)
+{
+	FILFILE_CONTROL_EXTENSION *const extension = CFilterControl::Extension();
+
+	DEVICE_OBJECT *device = 0;
+
+	if(NT_ERROR(IoCreateDevice(extension->Driver, sizeof(FILFILE_VOLUME_EXTENSION), 0, FILE_DEVICE_DISK_FILE_SYSTEM, 0, false, &device)))
+	{
+		return 0;
+	}
+
+	FILFILE_VOLUME_EXTENSION *const volume = (FILFILE_VOLUME_EXTENSION*) device->DeviceExtension;
+	RtlZeroMemory(volume, sizeof(FILFILE_VOLUME_EXTENSION));
+
+	volume->Common.Type	  = FILFILE_FILTER_VOLUME;
+	volume->Common.Size	  = sizeof(FILFILE_VOLUME_EXTENSION);
+	volume->Common.Device = device;
+	volume->LowerType	  = FILFILE_DEVICE_VOLUME;
+
+	WCHAR name[64];
+	ULONG const length = Path(name, number, ~0u);
+
+	volume->LowerName.Buffer = (LPWSTR) ExAllocatePool(PagedPool, length * sizeof(WCHAR));
+
+	if(volume->LowerName.Buffer)
+	{
+		RtlCopyMemory(volume->LowerName.Buffer, name, length * sizeof(WCHAR));
+
+		volume->LowerName.Length		= (USHORT) (length * sizeof(WCHAR));
+		volume->LowerName.MaximumLength = (USHORT) (length * sizeof(WCHAR));
+
+		// Takes over the CDO Entities below its name
+		if(NT_SUCCESS(CFilterControl::AddVolumeDevice(device)))
+		{
+			device->Flags &= ~DO_DEVICE_INITIALIZING;
+
+			return volume;
+		}
+
+		ExFreePool(volume->LowerName.Buffer);
+	}
+
+	IoDeleteDevice(device);
+
+	return 0;
+}
+
+void CSimFixture::RemoveVolume(FILFILE_VOLUME_EXTENSION *volume)
+{
+	ASSERT(volume);
+
+	DEVICE_OBJECT *const device = volume->Common.Device;
+
+	CFilterControl::RemoveVolumeDevice(device);
+
+	ExFreePool(volume->LowerName.Buffer);
+
+	IoDeleteDevice(device);
+}
+
+NTSTATUS CSimFixture::AddEntity(ULONG volume, ULONG number)
+{
+	WCHAR path[64];
+
+	ULONG const nameLength = Path(path, volume, ~0u);
+	ULONG const pathSize   = (Path(path, volume, number) + 1) * sizeof(WCHAR);
+
+	if(FindVolume(path, nameLength))
+	{
+		// Mounted, as the daemon adds it
+		UCHAR buffer[sizeof(FILFILE_CONTROL) + sizeof(path) + sizeof(s_payload) + sizeof(s_entityKey)];
+		RtlZeroMemory(buffer, sizeof(buffer));
+
+		FILFILE_CONTROL *const control = (FILFILE_CONTROL*) buffer;
+
+		control->Flags		   = FILFILE_CONTROL_ADD;
+		control->PathOffset	   = sizeof(FILFILE_CONTROL);
+		control->PathLength	   = pathSize;
+		control->PayloadOffset = control->PathOffset + pathSize;
+		control->PayloadSize   = sizeof(s_payload);
+		control->CryptoOffset  = control->PayloadOffset + sizeof(s_payload);
+		control->CryptoSize	   = sizeof(s_entityKey);
+
+		RtlCopyMemory(buffer + control->PathOffset, path, pathSize);
+		RtlCopyMemory(buffer + control->PayloadOffset, s_payload, sizeof(s_payload));
+		RtlCopyMemory(buffer + control->CryptoOffset, s_entityKey, sizeof(s_entityKey));
+
+		return Control(IOCTL_FILFILE_ENTITY, control, control->CryptoOffset + control->CryptoSize);
+	}
+
+	// Not mounted, kept by the CDO as RemoveVolumeDevice leaves it
+	FILFILE_CONTROL_EXTENSION *const extension = CFilterControl::Extension();
+
+	CFilterEntity entity;
+	RtlZeroMemory(&entity, sizeof(entity));
+
+	CFilterHeader header;
+	NTSTATUS status = header.Init((UCHAR*) s_payload, sizeof(s_payload));
+
+	if(NT_SUCCESS(status))
+	{
+		ULONG const cipher = FILFILE_CIPHER_MODE_DEFAULT;
+
+		header.m_key.Init(cipher | FILFILE_CIPHER_SYM_AES256, s_entityKey, sizeof(s_entityKey));
+
+		status = entity.InitClient(path, pathSize, CFilterPath::PATH_DEEPNESS);
+	}
+
+	if(NT_SUCCESS(status))
+	{
+		entity.m_flags |= TRACK_CHECK_VOLUME | ((entity.m_file) ? TRACK_TYPE_FILE : TRACK_TYPE_DIRECTORY);
+
+		FsRtlEnterFileSystem();
+		ExAcquireResourceExclusiveLite(&extension->Lock, true);
+
+		CFilterHeaderCont &headers = extension->Context.Headers();
+
+		headers.LockExclusive();
+		status = headers.Add(&header);
+		headers.Unlock();
+
+		if(NT_SUCCESS(status))
+		{
+			entity.m_headerIdentifier = header.m_identifier;
+			entity.m_headerBlocksize  = header.m_blockSize;
+
+			status = extension->Entities.Add(&entity);
+
+			if(NT_ERROR(status))
+			{
+				headers.LockExclusive();
+				headers.Release(entity.m_headerIdentifier);
+				headers.Unlock();
+			}
+		}
+
+		ExReleaseResourceLite(&extension->Lock);
+		FsRtlExitFileSystem();
+	}
+
+	entity.Close();
+	header.Close();
+
+	return status;
+}
+
+NTSTATUS CSimFixture::RemoveEntity(ULONG volume, ULONG number)
+{
+	UCHAR buffer[sizeof(FILFILE_CONTROL) + 64 * sizeof(WCHAR)];
+	RtlZeroMemory(buffer, sizeof(buffer));
+
+	FILFILE_CONTROL *const control = (FILFILE_CONTROL*) buffer;
+
+	control->Flags		= FILFILE_CONTROL_REM;
+	control->PathOffset = sizeof(FILFILE_CONTROL);
+	control->PathLength = (Path((WCHAR*) (buffer + control->PathOffset), volume, number) + 1) * sizeof(WCHAR);
+
+	return Control(IOCTL_FILFILE_ENTITY, control, control->PathOffset + control->PathLength);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CSimFixture::Track(FILFILE_TRACK_CONTEXT *track, ULONG header)
+{
+	ASSERT(track);
+
+	RtlZeroMemory(track, sizeof(FILFILE_TRACK_CONTEXT));
+
+	UCHAR payload[64];
+
+	for(ULONG pos = 0; pos < sizeof(payload); ++pos)
+	{
+		payload[pos] = (UCHAR) (header * 13 + pos);
+	}
+
+	// The first two bytes tell Headers apart
+	payload[0] = (UCHAR) header;
+	payload[1] = (UCHAR) (header >> 8);
+
+	UNICODE_STRING device;
+	RtlInitUnicodeString(&device, L"\\Device\\HarddiskVolume001");
+
+	LPCWSTR const path = L"\\secret\\data.bin";
+
+	if(NT_ERROR(track->Header.Init(payload, sizeof(payload))))
+	{
+		return false;
+	}
+
+	return NT_SUCCESS(track->Entity.Init(path, (ULONG) wcslen(path) * sizeof(WCHAR), FILFILE_DEVICE_VOLUME, &device));
+}
+
+bool CSimFixture::Track(CFilterFile *filterFile, FILE_OBJECT *file, ULONG entityIdentifier, ULONG seed)
+{
+	ASSERT(filterFile);
+	ASSERT(file);
+
+	if(NT_ERROR(filterFile->Init()))
+	{
+		return false;
+	}
+
+	UCHAR key[16];
+
+	for(ULONG pos = 0; pos < sizeof(key); ++pos)
+	{
+		key[pos] = (UCHAR) (seed + pos + 1);
+	}
+
+	filterFile->m_fcb = (FSRTL_COMMON_FCB_HEADER*) file->FsContext;
+
+	CFilterContextLink *const link = &filterFile->m_stream->m_link;
+
+	link->m_entityIdentifier = entityIdentifier;
+	link->m_headerBlockSize	 = CFilterHeader::c_align;
+	link->m_nonce.QuadPart	 = seed + 1;
+	link->m_fileKey.Init(FILFILE_CIPHER_SYM_AES128 | (CFilterContext::c_cipherMode << 16), key, sizeof(key));
+
+	filterFile->m_stream->m_cipher = CFilterCipher::Create(&link->m_fileKey, &link->m_nonce);
+
+	return filterFile->m_stream->m_cipher && NT_SUCCESS(filterFile->Track(file));
+}
+
+void CSimFixture::Fcb(FSRTL_ADVANCED_FCB_HEADER *fcb, bool contexts)
+{
+	ASSERT(fcb);
+
+	RtlZeroMemory(fcb, sizeof(*fcb));
+
+	fcb->Flags2 = (contexts) ? FSRTL_FLAG2_SUPPORTS_FILTER_CONTEXTS : 0;
+	InitializeListHead(&fcb->FilterContexts);
+}
+
+void CSimFixture::Pattern(UCHAR *buffer, ULONG size, ULONG seed)
+{
+	ASSERT(buffer);
+
+	for(ULONG pos = 0; pos < size; ++pos)
+	{
+		buffer[pos] = (UCHAR) (pos * 7 + seed);
+	}
+}
+
+double CSimFixture::Now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,66 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CSimFixture.h: interface for the CSimFixture class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CSimFixture_H__4E8B1D37_A95C_4F62_B0D3_6C2A71E9F584__INCLUDED_)
+#define AFX_CSimFixture_H__4E8B1D37_A95C_4F62_B0D3_6C2A71E9F584__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct FILFILE_CONTROL;
+struct FILFILE_CONTROL_EXTENSION;
+struct FILFILE_VOLUME_EXTENSION;
+struct FILFILE_TRACK_CONTEXT;
+class CFilterFile;
+
+class CSimFixture
+{
+	// Common ground of the UNITTEST sections. Init loads the driver through DriverEntry, as the replay harness
+	// does, and opens its control device, so Context, randomizers, Headers and callback are set up as in the
+	// field. Volumes are devices of the driver that attach to nothing, named \Device\HarddiskVolume<number>.
+	// Entities of a mounted volume are added through the control device, as the daemon does. The CDO keeps
+	// the others and hands them over once their volume is added, as on a mount. All of them share one Header.
+	// Close removes what is left and checks that no allocation outlived it.
+
+public:
+
+	static FILFILE_CONTROL_EXTENSION*	Init();
+	static int							Close();		// failed checks
+
+	static NTSTATUS						Control(ULONG code, FILFILE_CONTROL *control, ULONG size, void *output = 0, ULONG outputSize = 0, ULONG *information = 0);
+
+	static FILFILE_VOLUME_EXTENSION*	AddVolume(ULONG number);
+	static void							RemoveVolume(FILFILE_VOLUME_EXTENSION *volume);
+
+	static NTSTATUS						AddEntity(ULONG volume, ULONG number);		// directory \data\<number>\ on it
+	static NTSTATUS						RemoveEntity(ULONG volume, ULONG number);
+	static ULONG						EntityNumber(LPCWSTR path, ULONG length);
+
+	static bool							Track(FILFILE_TRACK_CONTEXT *track, ULONG header);
+	static bool							Track(CFilterFile *filterFile, FILE_OBJECT *file, ULONG entityIdentifier, ULONG seed);
+	static void							Fcb(FSRTL_ADVANCED_FCB_HEADER *fcb, bool contexts = true);
+
+	static void							Pattern(UCHAR *buffer, ULONG size, ULONG seed);
+	static double						Now();			// wall clock, nanoseconds
+
+private:
+
+	static ULONG						Path(WCHAR *buffer, ULONG volume, ULONG number);
+	static FILFILE_VOLUME_EXTENSION*	FindVolume(LPCWSTR name, ULONG length);
+
+										// DATA
+	static HANDLE						s_control;
+	static LONG							s_outstanding;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CSimFixture_H__4E8B1D37_A95C_4F62_B0D3_6C2A71E9F584__INCLUDED_)
@@ -0,0 +1,4393 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CSimKernel.cpp: implementation of the CSimKernel class and the kernel calls it stands in for.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include <ucontext.h>
+
+#include "driver.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum c_simConstants
+{
+	c_magicObject		= 0x6a624f53,		// 'SObj'
+	c_magicBlock		= 0x6b6c4253,		// 'SBlk'
+	c_magicPacket		= 0x70724953,		// 'SIrp'
+	c_magicToken		= 0x6b6f5453,		// 'STok'
+
+	c_pathLength		= 512,
+	c_links				= 16,
+	c_keys				= 16,
+	c_values			= 32,
+	c_valueName			= 64,
+	c_valueSize			= 1024,
+	c_notifications		= 8,
+	c_fileSystems		= 8,
+	c_deferred			= 64,
+	c_lookasideDepth	= 32,
+	c_threads			= 16,
+	c_threadStack		= 256 * 1024,		// bytes
+};
+
+enum c_simObjects
+{
+	c_objectNone,
+	c_objectDriver,
+	c_objectDevice,
+	c_objectFile,
+	c_objectThread,
+	c_objectKey,
+	c_objectLink,
+	c_objectEvent,
+};
+
+enum c_simFileFlags
+{
+	c_fileOpened		= 0x1,				// create succeeded, close is due
+	c_fileFailed		= 0x2,				// create failed or was cancelled, never closed
+	c_fileCleaned		= 0x4,
+	c_fileIgnoreShare	= 0x8,				// IO_IGNORE_SHARE_ACCESS_CHECK
+};
+
+// Header in front of each kernel object
+struct alignas(16) SimObject
+{
+	ULONG				Magic;
+	ULONG				Type;
+	LONG				References;
+	LONG				Handles;
+	DEVICE_OBJECT*		Target;				// device hint of file objects
+	DEVICE_OBJECT*		Lower;				// device attached to
+	ULONG				Flags;
+	UNICODE_STRING		Name;
+	WCHAR				NameBuffer[CSimKernel::c_nameLength];
+};
+
+// Header in front of each allocation
+struct alignas(16) SimBlock
+{
+	void*				Base;				// as allocated, the block may be placed further in
+	SIZE_T				Size;
+	ULONG				Magic;
+	bool				Counted;
+};
+
+struct SimPacket
+{
+	ULONG				Magic;
+	bool				Owned;				// freed on completion, as the I/O manager does
+	void*				Output;				// caller's buffer of buffered requests
+	ULONG				OutputLength;
+	void*				SystemBuffer;		// freed on completion
+	IRP					Irp;
+};
+
+struct SimToken
+{
+	ULONG				Magic;
+	LUID				Luid;
+	CHAR				Source[TOKEN_SOURCE_LENGTH];
+};
+
+struct _KTHREAD
+{
+	DISPATCHER_HEADER	Header;
+	_EPROCESS*			Process;
+	ULONG				Id;
+};
+
+struct _EPROCESS
+{
+	ULONG				Id;
+	SimToken			Token;
+	_KTHREAD			Thread;				// the only one issuing requests
+};
+
+// System thread, run as a coroutine on the sim's thread
+struct SimThread
+{
+	_KTHREAD*			Object;				// referenced until terminated
+	PKSTART_ROUTINE		Routine;
+	void*				Context;
+	ucontext_t			Registers;
+	void*				Stack;
+	ULONG				Count;				// objects of the wait blocked in, if any
+	void**				Objects;
+	bool				All;
+	LONGLONG			Deadline;			// system time the wait times out, zero for never
+	bool				Started;
+	bool				Terminated;
+};
+
+struct _OBJECT_TYPE
+{
+	ULONG				Type;
+};
+
+struct SimHandle
+{
+	void*				Object;
+	ULONG				Type;
+};
+
+struct SimValue
+{
+	WCHAR				Name[c_valueName];
+	ULONG				Type;
+	ULONG				Size;
+	UCHAR				Data[c_valueSize];
+};
+
+struct SimKey
+{
+	WCHAR				Path[c_pathLength];
+	ULONG				Count;
+	SimValue			Values[c_values];
+};
+
+struct SimLink
+{
+	WCHAR				Link[CSimKernel::c_nameLength];
+	WCHAR				Target[CSimKernel::c_nameLength];
+};
+
+struct SimRoutine
+{
+	char const*			Name;
+	void*				Routine;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// STATICS ////
+
+ULONG							CSimKernel::s_verbose = 0;
+bool							CSimKernel::s_threads = false;
+
+static CSimKernel::Counters		s_counters;
+
+static LONGLONG					s_now;
+static LONGLONG					s_boot;
+
+static _EPROCESS				s_processes[CSimKernel::c_processes];
+static ULONG					s_processCount;
+static _EPROCESS*				s_current;
+
+static SimHandle				s_handles[CSimKernel::c_handles];
+static DRIVER_OBJECT*			s_drivers[CSimKernel::c_drivers];
+static DEVICE_OBJECT*			s_devices[CSimKernel::c_devices];
+static DEVICE_OBJECT*			s_fileSystems[c_fileSystems];
+static DEVICE_OBJECT*			s_shutdown[c_notifications];
+
+static void						(*s_fsNotify[c_notifications])(DEVICE_OBJECT*, BOOLEAN);
+static PCREATE_PROCESS_NOTIFY_ROUTINE s_processNotify[c_notifications];
+
+static SimKey					s_keys[c_keys];
+static SimLink					s_links[c_links];
+
+static ULONG					s_processor;
+
+static SimThread				s_systemThreads[c_threads];
+static SimThread*				s_running;
+static ucontext_t				s_scheduler;
+
+static LIST_ENTRY				s_work;
+static FILE_OBJECT*				s_deferred[c_deferred];
+static ULONG					s_deferredCount;
+static IRP*						s_topLevel;
+static KSPIN_LOCK				s_cancelLock;
+
+static _OBJECT_TYPE				s_fileType		= { c_objectFile };
+static _OBJECT_TYPE				s_threadType	= { c_objectThread };
+static _OBJECT_TYPE				s_eventType		= { c_objectEvent };
+static _OBJECT_TYPE				s_semaphoreType	= { c_objectNone };
+
+static POBJECT_TYPE				s_fileTypePointer		= &s_fileType;
+static POBJECT_TYPE				s_threadTypePointer		= &s_threadType;
+static POBJECT_TYPE				s_eventTypePointer		= &s_eventType;
+static POBJECT_TYPE				s_semaphoreTypePointer	= &s_semaphoreType;
+
+POBJECT_TYPE*					IoFileObjectType		= &s_fileTypePointer;
+POBJECT_TYPE*					PsThreadType			= &s_threadTypePointer;
+POBJECT_TYPE*					ExEventObjectType		= &s_eventTypePointer;
+POBJECT_TYPE*					ExSemaphoreObjectType	= &s_semaphoreTypePointer;
+
+CCHAR							KeNumberProcessors		= 1;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void Fail(char const* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+
+	fprintf(stderr, "sim: ");
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+
+	va_end(args);
+
+	abort();
+}
+
+static SimObject* Header(void const* object)
+{
+	if(!object)
+	{
+		return 0;
+	}
+
+	SimObject *const header = (SimObject*) object - 1;
+
+	return (header->Magic == c_magicObject) ? header : 0;
+}
+
+static void* CreateObject(ULONG type, SIZE_T size, LPCWSTR name, bool count)
+{
+	SimObject *const header = (SimObject*) CSimKernel::Allocate(sizeof(SimObject) + size, count);
+
+	header->Magic		= c_magicObject;
+	header->Type		= type;
+	header->References	= 1;
+
+	header->Name.Buffer			= header->NameBuffer;
+	header->Name.MaximumLength	= sizeof(header->NameBuffer);
+
+	if(name)
+	{
+		SIZE_T const length = wcslen(name);
+
+		if(length >= CSimKernel::c_nameLength)
+		{
+			Fail("object name too long");
+		}
+
+		memcpy(header->NameBuffer, name, length * sizeof(WCHAR));
+		header->Name.Length = (USHORT) (length * sizeof(WCHAR));
+	}
+
+	return header + 1;
+}
+
+static void DeleteObject(void *object)
+{
+	SimObject *const header = Header(object);
+	ASSERT(header);
+
+	header->Magic = 0;
+
+	CSimKernel::Free(header);
+}
+
+static bool IsPrefix(LPCWSTR prefix, ULONG prefixLength, LPCWSTR path)
+{
+	// Prefix of whole components, ignoring case
+	if(_wcsnicmp(prefix, path, prefixLength))
+	{
+		return false;
+	}
+
+	return !path[prefixLength] || (path[prefixLength] == L'\\');
+}
+
+static DEVICE_OBJECT* Top(DEVICE_OBJECT *device)
+{
+	while(device->AttachedDevice)
+	{
+		device = device->AttachedDevice;
+	}
+
+	return device;
+}
+
+static DEVICE_OBJECT* FindDevice(LPCWSTR path, LPCWSTR *remainder)
+{
+	DEVICE_OBJECT *found = 0;
+	ULONG foundLength	 = 0;
+
+	for(ULONG index = 0; index < CSimKernel::c_devices; ++index)
+	{
+		DEVICE_OBJECT *const device = s_devices[index];
+
+		if(device)
+		{
+			SimObject *const header = Header(device);
+			ULONG const length		= header->Name.Length / sizeof(WCHAR);
+
+			if(length && (length > foundLength) && IsPrefix(header->NameBuffer, length, path))
+			{
+				found		= device;
+				foundLength = length;
+			}
+		}
+	}
+
+	if(remainder)
+	{
+		*remainder = path + foundLength;
+	}
+
+	return found;
+}
+
+static bool Resolve(LPCWSTR path, WCHAR *resolved)
+{
+	if(wcslen(path) >= c_pathLength)
+	{
+		return false;
+	}
+
+	wcscpy(resolved, path);
+
+	// Links may point to links, but not endlessly
+	for(ULONG loop = 0; loop < 4; ++loop)
+	{
+		SimLink *link = 0;
+
+		for(ULONG index = 0; index < c_links; ++index)
+		{
+			ULONG const length = (ULONG) wcslen(s_links[index].Link);
+
+			if(length && IsPrefix(s_links[index].Link, length, resolved))
+			{
+				link = &s_links[index];
+				break;
+			}
+		}
+
+		if(!link)
+		{
+			break;
+		}
+
+		WCHAR buffer[c_pathLength];
+		LPCWSTR const rest = resolved + wcslen(link->Link);
+
+		if(wcslen(link->Target) + wcslen(rest) >= c_pathLength)
+		{
+			return false;
+		}
+
+		wcscpy(buffer, link->Target);
+		wcscat(buffer, rest);
+		wcscpy(resolved, buffer);
+	}
+
+	return true;
+}
+
+// HANDLES ////
+
+static HANDLE InsertHandle(void *object, ULONG type)
+{
+	for(ULONG index = 0; index < CSimKernel::c_handles; ++index)
+	{
+		if(!s_handles[index].Object)
+		{
+			s_handles[index].Object = object;
+			s_handles[index].Type	= type;
+
+			return (HANDLE) (ULONG_PTR) ((index + 1) * 4);
+		}
+	}
+
+	Fail("handle table full");
+
+	return 0;
+}
+
+static SimHandle* LookupHandle(HANDLE handle, ULONG type = c_objectNone)
+{
+	ULONG_PTR const value = (ULONG_PTR) handle;
+
+	if(!value || (value & 3) || (value / 4 > CSimKernel::c_handles))
+	{
+		return 0;
+	}
+
+	SimHandle *const entry = &s_handles[value / 4 - 1];
+
+	if(!entry->Object || (type && (entry->Type != type)))
+	{
+		return 0;
+	}
+
+	return entry;
+}
+
+// IRPS ////
+
+static SimPacket* Packet(IRP *irp)
+{
+	SimPacket *const packet = CONTAINING_RECORD(irp, SimPacket, Irp);
+	ASSERT(packet->Magic == c_magicPacket);
+
+	return packet;
+}
+
+static void InitIrp(IRP *irp, CCHAR stackSize)
+{
+	if((stackSize < 1) || (stackSize > CSimKernel::c_irpStackSize))
+	{
+		Fail("IRP stack size %d not supported", stackSize);
+	}
+
+	memset(irp, 0, sizeof(IRP));
+
+	irp->Type			 = 6;
+	irp->Size			 = sizeof(IRP);
+	irp->StackCount		 = stackSize;
+	irp->CurrentLocation = stackSize + 1;
+
+	irp->Tail.Overlay.CurrentStackLocation = &irp->Stack[(int) stackSize];
+	irp->Tail.Overlay.Thread			   = KeGetCurrentThread();
+
+	InitializeListHead(&irp->ThreadListEntry);
+}
+
+static IRP* NewIrp(CCHAR stackSize, bool owned, bool count)
+{
+	SimPacket *const packet = (SimPacket*) CSimKernel::Allocate(sizeof(SimPacket), count);
+
+	packet->Magic = c_magicPacket;
+	packet->Owned = owned;
+
+	InitIrp(&packet->Irp, stackSize);
+
+	if(count)
+	{
+		s_counters.Irps++;
+	}
+
+	return &packet->Irp;
+}
+
+static MDL* NewMdl(void *address, ULONG length, bool count)
+{
+	MDL *const mdl = (MDL*) CSimKernel::Allocate(sizeof(MDL), count);
+
+	MmInitializeMdl(mdl, address, length);
+
+	return mdl;
+}
+
+static void Finish(IRP *irp)
+{
+	// I/O manager side of the final completion
+	SimPacket *const packet = Packet(irp);
+
+	if(packet->Output && packet->SystemBuffer && !NT_ERROR(irp->IoStatus.Status))
+	{
+		memcpy(packet->Output, packet->SystemBuffer, min(irp->IoStatus.Information, (ULONG_PTR) packet->OutputLength));
+	}
+
+	if(irp->UserIosb)
+	{
+		*irp->UserIosb = irp->IoStatus;
+	}
+
+	if(irp->UserEvent)
+	{
+		KeSetEvent(irp->UserEvent, IO_NO_INCREMENT, false);
+	}
+
+	if(packet->Owned)
+	{
+		while(irp->MdlAddress)
+		{
+			MDL *const mdl	= irp->MdlAddress;
+			irp->MdlAddress = mdl->Next;
+
+			IoFreeMdl(mdl);
+		}
+
+		CSimKernel::Free(packet->SystemBuffer);
+
+		packet->Magic = 0;
+		CSimKernel::Free(packet);
+	}
+}
+
+static NTSTATUS Send(DEVICE_OBJECT *device, IRP *irp, IO_STATUS_BLOCK *ioStatus)
+{
+	KEVENT event;
+	KeInitializeEvent(&event, NotificationEvent, false);
+
+	ioStatus->Status	  = STATUS_PENDING;
+	ioStatus->Information = 0;
+
+	irp->UserIosb  = ioStatus;
+	irp->UserEvent = &event;
+
+	IoCallDriver(device, irp);
+
+	if(!event.Header.SignalState)
+	{
+		// Pended, completed by work items or system threads, maybe only once they time out
+		KeWaitForSingleObject(&event, Executive, KernelMode, false, 0);
+	}
+
+	return ioStatus->Status;
+}
+
+static IRP* BuildIrp(FILE_OBJECT *file, DEVICE_OBJECT *device, UCHAR major, KPROCESSOR_MODE mode)
+{
+	IRP *const irp = NewIrp(device->StackSize, true, false);
+
+	irp->RequestorMode					 = mode;
+	irp->Tail.Overlay.OriginalFileObject = file;
+
+	IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+
+	stack->MajorFunction = major;
+	stack->FileObject	 = file;
+
+	return irp;
+}
+
+// FILE OBJECTS ////
+
+static FILE_OBJECT* NewFile(DEVICE_OBJECT *device, VPB *vpb, bool count)
+{
+	FILE_OBJECT *const file = (FILE_OBJECT*) CreateObject(c_objectFile, sizeof(FILE_OBJECT), 0, count);
+
+	file->Type		   = 5;
+	file->Size		   = sizeof(FILE_OBJECT);
+	file->DeviceObject = device;
+	file->Vpb		   = vpb;
+
+	KeInitializeEvent(&file->Lock, SynchronizationEvent, false);
+	KeInitializeEvent(&file->Event, NotificationEvent, false);
+
+	return file;
+}
+
+static void CloseFile(FILE_OBJECT *file, DEVICE_OBJECT *device, UCHAR major)
+{
+	ASSERT((major == IRP_MJ_CLEANUP) || (major == IRP_MJ_CLOSE));
+
+	IRP *const irp = BuildIrp(file, device, major, KernelMode);
+	irp->Flags	   = IRP_CLOSE_OPERATION | IRP_SYNCHRONOUS_API;
+
+	IO_STATUS_BLOCK ioStatus;
+	Send(device, irp, &ioStatus);
+}
+
+static void DeleteFile(FILE_OBJECT *file)
+{
+	SimObject *const header = Header(file);
+	ASSERT(header);
+
+	if(!(header->Flags & c_fileFailed) && file->FsContext)
+	{
+		CloseFile(file, CSimKernel::RelatedDevice(file), IRP_MJ_CLOSE);
+	}
+
+	CSimKernel::Free(file->FileName.Buffer);
+
+	DeleteObject(file);
+}
+
+static NTSTATUS Mount(DEVICE_OBJECT *real)
+{
+	ASSERT(real->Vpb);
+
+	for(ULONG index = 0; index < c_fileSystems; ++index)
+	{
+		DEVICE_OBJECT *const control = s_fileSystems[index];
+
+		if(!control || (control->DeviceType != FILE_DEVICE_DISK_FILE_SYSTEM))
+		{
+			continue;
+		}
+
+		DEVICE_OBJECT *const top = Top(control);
+		IRP *const irp			 = NewIrp(top->StackSize, true, false);
+
+		IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+
+		stack->MajorFunction = IRP_MJ_FILE_SYSTEM_CONTROL;
+		stack->MinorFunction = IRP_MN_MOUNT_VOLUME;
+
+		stack->Parameters.MountVolume.Vpb		   = real->Vpb;
+		stack->Parameters.MountVolume.DeviceObject = real;
+
+		IO_STATUS_BLOCK ioStatus;
+
+		if(NT_SUCCESS(Send(top, irp, &ioStatus)) && real->Vpb->DeviceObject)
+		{
+			return STATUS_SUCCESS;
+		}
+	}
+
+	return STATUS_UNRECOGNIZED_VOLUME;
+}
+
+static NTSTATUS Create(LPCWSTR path,
+					   ACCESS_MASK access,
+					   ULONG attributes,
+					   ULONG share,
+					   ULONG disposition,
+					   ULONG options,
+					   bool caseInsensitive,
+					   ULONG flags,
+					   KPROCESSOR_MODE mode,
+					   DEVICE_OBJECT *hint,
+					   HANDLE *handle,
+					   IO_STATUS_BLOCK *ioStatus)
+{
+	ASSERT(path);
+	ASSERT(handle);
+	ASSERT(ioStatus);
+
+	*handle = 0;
+
+	ioStatus->Status	  = STATUS_OBJECT_PATH_NOT_FOUND;
+	ioStatus->Information = 0;
+
+	WCHAR resolved[c_pathLength];
+
+	if(!Resolve(path, resolved))
+	{
+		return ioStatus->Status = STATUS_OBJECT_NAME_INVALID;
+	}
+
+	LPCWSTR remainder	  = 0;
+	DEVICE_OBJECT *device = FindDevice(resolved, &remainder);
+
+	if(!device)
+	{
+		return ioStatus->Status;
+	}
+
+	if(device->Vpb && !device->Vpb->DeviceObject)
+	{
+		NTSTATUS const status = Mount(device);
+
+		if(NT_ERROR(status))
+		{
+			return ioStatus->Status = status;
+		}
+	}
+
+	FILE_OBJECT *const file = NewFile(device, device->Vpb, false);
+	SimObject *const header = Header(file);
+
+	header->Target = hint;
+
+	if(flags & IO_IGNORE_SHARE_ACCESS_CHECK)
+	{
+		header->Flags |= c_fileIgnoreShare;
+	}
+
+	// The I/O manager maps generic rights before file systems see them
+	if(access & (GENERIC_READ | GENERIC_ALL))
+	{
+		access |= FILE_GENERIC_READ;
+	}
+	if(access & (GENERIC_WRITE | GENERIC_ALL))
+	{
+		access |= FILE_GENERIC_WRITE;
+	}
+	if(access & GENERIC_ALL)
+	{
+		access |= DELETE | FILE_EXECUTE;
+	}
+
+	access &= ~(GENERIC_READ | GENERIC_WRITE | GENERIC_EXECUTE | GENERIC_ALL);
+
+	if(*remainder)
+	{
+		SIZE_T const length = wcslen(remainder) * sizeof(WCHAR);
+
+		file->FileName.Buffer		 = (WCHAR*) CSimKernel::Allocate(length + sizeof(WCHAR), false);
+		file->FileName.Length		 = (USHORT) length;
+		file->FileName.MaximumLength = (USHORT) (length + sizeof(WCHAR));
+
+		memcpy(file->FileName.Buffer, remainder, length);
+	}
+
+	if(options & (FILE_SYNCHRONOUS_IO_ALERT | FILE_SYNCHRONOUS_IO_NONALERT))
+	{
+		file->Flags |= FO_SYNCHRONOUS_IO;
+	}
+	if(options & FILE_NO_INTERMEDIATE_BUFFERING)
+	{
+		file->Flags |= FO_NO_INTERMEDIATE_BUFFERING;
+	}
+	if(options & FILE_WRITE_THROUGH)
+	{
+		file->Flags |= FO_WRITE_THROUGH;
+	}
+	if(options & FILE_SEQUENTIAL_ONLY)
+	{
+		file->Flags |= FO_SEQUENTIAL_ONLY;
+	}
+
+	ACCESS_STATE accessState;
+	memset(&accessState, 0, sizeof(accessState));
+
+	accessState.OriginalDesiredAccess  = access;
+	accessState.RemainingDesiredAccess = access;
+
+	SeCaptureSubjectContext(&accessState.SubjectSecurityContext);
+
+	IO_SECURITY_CONTEXT security;
+	memset(&security, 0, sizeof(security));
+
+	security.AccessState	   = &accessState;
+	security.DesiredAccess	   = access;
+	security.FullCreateOptions = options;
+
+	DEVICE_OBJECT *const related = CSimKernel::RelatedDevice(file);
+
+	IRP *const irp = BuildIrp(file, related, IRP_MJ_CREATE, mode);
+	irp->Flags	   = IRP_SYNCHRONOUS_API;
+
+	IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+
+	stack->Flags = caseInsensitive ? 0 : SL_CASE_SENSITIVE;
+
+	if(flags & IO_OPEN_TARGET_DIRECTORY)
+	{
+		stack->Flags |= SL_OPEN_TARGET_DIRECTORY;
+	}
+
+	stack->Parameters.Create.SecurityContext = &security;
+	stack->Parameters.Create.Options		 = (disposition << 24) | (options & 0x00ffffff);
+	stack->Parameters.Create.FileAttributes	 = (USHORT) attributes;
+	stack->Parameters.Create.ShareAccess	 = (USHORT) share;
+
+	NTSTATUS const status = Send(related, irp, ioStatus);
+
+	if(NT_ERROR(status) || (STATUS_REPARSE == status))
+	{
+		header->Flags |= c_fileFailed;
+
+		ObDereferenceObject(file);
+
+		return (STATUS_REPARSE == status) ? STATUS_NOT_SUPPORTED : status;
+	}
+
+	header->Flags  |= c_fileOpened;
+	header->Handles = 1;
+
+	*handle = InsertHandle(file, c_objectFile);
+
+	return status;
+}
+
+static FILE_OBJECT* LookupFile(HANDLE handle)
+{
+	SimHandle *const entry = LookupHandle(handle, c_objectFile);
+
+	if(!entry)
+	{
+		Fail("invalid file handle %p", handle);
+	}
+
+	return (FILE_OBJECT*) entry->Object;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CSimKernel::Init()
+{
+	memset(&s_counters, 0, sizeof(s_counters));
+	memset(s_processes, 0, sizeof(s_processes));
+	memset(s_handles, 0, sizeof(s_handles));
+	memset(s_drivers, 0, sizeof(s_drivers));
+	memset(s_devices, 0, sizeof(s_devices));
+	memset(s_fileSystems, 0, sizeof(s_fileSystems));
+	memset(s_shutdown, 0, sizeof(s_shutdown));
+	memset(s_fsNotify, 0, sizeof(s_fsNotify));
+	memset(s_processNotify, 0, sizeof(s_processNotify));
+	memset(s_keys, 0, sizeof(s_keys));
+	memset(s_links, 0, sizeof(s_links));
+
+	s_processCount	= 0;
+	s_deferredCount = 0;
+	s_topLevel		= 0;
+	s_processor		= 0;
+	s_running		= 0;
+
+	InitializeListHead(&s_work);
+
+	// 2010-01-01, booted a minute before
+	s_now  = 129067776000000000LL;
+	s_boot = s_now - SECONDS(60);
+
+	SetProcess(c_systemProcess);
+}
+
+void CSimKernel::Close()
+{
+	Run();
+
+	// Threads still blocked are dropped, they never return
+	for(ULONG index = 0; index < c_threads; ++index)
+	{
+		SimThread *const thread = s_systemThreads + index;
+
+		if(thread->Object)
+		{
+			free(thread->Stack);
+
+			ObDereferenceObject(thread->Object);
+		}
+	}
+
+	memset(s_systemThreads, 0, sizeof(s_systemThreads));
+}
+
+void CSimKernel::Advance(LONGLONG time)
+{
+	ASSERT(time >= 0);
+
+	s_now += time;
+}
+
+LONGLONG CSimKernel::Now()
+{
+	return s_now;
+}
+
+CSimKernel::Counters const& CSimKernel::Statistics()
+{
+	return s_counters;
+}
+
+void CSimKernel::Reset()
+{
+	LONG const outstanding = s_counters.Outstanding;
+
+	memset(&s_counters, 0, sizeof(s_counters));
+
+	s_counters.Outstanding = outstanding;
+}
+
+void CSimKernel::SetProcess(ULONG process, LUID const* luid)
+{
+	_EPROCESS *found = 0;
+
+	for(ULONG index = 0; index < s_processCount; ++index)
+	{
+		if(s_processes[index].Id == process)
+		{
+			found = &s_processes[index];
+			break;
+		}
+	}
+
+	if(!found)
+	{
+		if(s_processCount >= c_processes)
+		{
+			Fail("too many processes");
+		}
+
+		found = &s_processes[s_processCount++];
+
+		found->Id			 = process;
+		found->Token.Magic	 = c_magicToken;
+		found->Thread.Header.Type = 6;
+		found->Thread.Process = found;
+		found->Thread.Id	 = process + 4;
+
+		if(c_systemProcess == process)
+		{
+			// SYSTEM_LUID
+			found->Token.Luid.LowPart = 0x3e7;
+			memcpy(found->Token.Source, "*SYSTEM*", TOKEN_SOURCE_LENGTH);
+		}
+		else
+		{
+			found->Token.Luid.LowPart = 0x10000 + process;
+			memcpy(found->Token.Source, "User32  ", TOKEN_SOURCE_LENGTH);
+		}
+
+		s_current = found;
+
+		for(ULONG index = 0; index < c_notifications; ++index)
+		{
+			if(s_processNotify[index] && (c_systemProcess != process))
+			{
+				s_processNotify[index]((HANDLE) c_systemProcess, (HANDLE) (ULONG_PTR) process, true);
+			}
+		}
+	}
+
+	if(luid)
+	{
+		found->Token.Luid = *luid;
+	}
+
+	s_current = found;
+}
+
+ULONG CSimKernel::Process()
+{
+	return s_current->Id;
+}
+
+void CSimKernel::SetProcessor(ULONG processor)
+{
+	ASSERT(processor < 64);
+
+	s_processor = processor;
+
+	if(processor >= (ULONG) KeNumberProcessors)
+	{
+		KeNumberProcessors = (CCHAR) (processor + 1);
+	}
+}
+
+static SimKey* FindKey(LPCWSTR path, bool create)
+{
+	SimKey *empty = 0;
+
+	for(ULONG index = 0; index < c_keys; ++index)
+	{
+		SimKey *const key = &s_keys[index];
+
+		if(!key->Path[0])
+		{
+			if(!empty)
+			{
+				empty = key;
+			}
+		}
+		else if((wcslen(key->Path) == wcslen(path)) && !_wcsnicmp(key->Path, path, wcslen(path)))
+		{
+			return key;
+		}
+	}
+
+	if(create)
+	{
+		if(!empty || (wcslen(path) >= c_pathLength))
+		{
+			Fail("registry full");
+		}
+
+		memset(empty, 0, sizeof(SimKey));
+		wcscpy(empty->Path, path);
+
+		return empty;
+	}
+
+	return 0;
+}
+
+static SimValue* FindValue(SimKey *key, LPCWSTR name, ULONG nameLength)
+{
+	for(ULONG index = 0; index < key->Count; ++index)
+	{
+		SimValue *const value = &key->Values[index];
+
+		if((wcslen(value->Name) == nameLength) && !_wcsnicmp(value->Name, name, nameLength))
+		{
+			return value;
+		}
+	}
+
+	return 0;
+}
+
+static NTSTATUS SetValue(SimKey *key, LPCWSTR name, ULONG nameLength, ULONG type, void const* data, ULONG size)
+{
+	if((nameLength >= c_valueName) || (size > c_valueSize))
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	SimValue *value = FindValue(key, name, nameLength);
+
+	if(!value)
+	{
+		if(key->Count >= c_values)
+		{
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		value = &key->Values[key->Count++];
+
+		memset(value, 0, sizeof(SimValue));
+		memcpy(value->Name, name, nameLength * sizeof(WCHAR));
+	}
+
+	value->Type = type;
+	value->Size = size;
+
+	memcpy(value->Data, data, size);
+
+	return STATUS_SUCCESS;
+}
+
+void CSimKernel::SetRegistry(LPCWSTR key, LPCWSTR name, ULONG type, void const* data, ULONG size)
+{
+	ASSERT(key);
+	ASSERT(name);
+
+	if(NT_ERROR(SetValue(FindKey(key, true), name, (ULONG) wcslen(name), type, data, size)))
+	{
+		Fail("registry value too large");
+	}
+}
+
+DRIVER_OBJECT* CSimKernel::CreateDriver(LPCWSTR name)
+{
+	ASSERT(name);
+
+	for(ULONG index = 0; index < c_drivers; ++index)
+	{
+		if(!s_drivers[index])
+		{
+			DRIVER_OBJECT *const driver = (DRIVER_OBJECT*) CreateObject(c_objectDriver,
+																		 sizeof(DRIVER_OBJECT) + sizeof(DRIVER_EXTENSION),
+																		 name,
+																		 false);
+			driver->Type			= 4;
+			driver->Size			= sizeof(DRIVER_OBJECT);
+			driver->DriverName		= Header(driver)->Name;
+			driver->DriverExtension = (DRIVER_EXTENSION*) (driver + 1);
+
+			driver->DriverExtension->DriverObject = driver;
+
+			s_drivers[index] = driver;
+
+			return driver;
+		}
+	}
+
+	Fail("too many drivers");
+
+	return 0;
+}
+
+static NTSTATUS NewDevice(DRIVER_OBJECT *driver, LPCWSTR name, ULONG extensionSize, ULONG type, ULONG characteristics, bool count, DEVICE_OBJECT **device)
+{
+	ASSERT(driver);
+	ASSERT(device);
+
+	*device = 0;
+
+	if(name && (wcslen(name) >= CSimKernel::c_nameLength))
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	ULONG slot = CSimKernel::c_devices;
+
+	for(ULONG index = 0; index < CSimKernel::c_devices; ++index)
+	{
+		DEVICE_OBJECT *const existing = s_devices[index];
+
+		if(!existing)
+		{
+			if(slot == CSimKernel::c_devices)
+			{
+				slot = index;
+			}
+		}
+		else if(name)
+		{
+			SimObject *const header = Header(existing);
+
+			if((header->Name.Length == wcslen(name) * sizeof(WCHAR)) && !_wcsnicmp(header->NameBuffer, name, wcslen(name)))
+			{
+				return STATUS_OBJECT_NAME_COLLISION;
+			}
+		}
+	}
+
+	if(slot == CSimKernel::c_devices)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	SIZE_T const size = (sizeof(DEVICE_OBJECT) + 15) & ~15;
+
+	DEVICE_OBJECT *const created = (DEVICE_OBJECT*) CreateObject(c_objectDevice, size + extensionSize, name, count);
+
+	created->Type			 = 3;
+	created->Size			 = (USHORT) (size + extensionSize);
+	created->DriverObject	 = driver;
+	created->NextDevice		 = driver->DeviceObject;
+	created->Flags			 = DO_DEVICE_INITIALIZING;
+	created->Characteristics = characteristics;
+	created->DeviceType		 = type;
+	created->StackSize		 = 1;
+	created->SectorSize		 = 512;
+
+	if(extensionSize)
+	{
+		created->DeviceExtension = (char*) created + size;
+	}
+
+	if((FILE_DEVICE_DISK == type) || (FILE_DEVICE_CD_ROM_FILE_SYSTEM == type))
+	{
+		VPB *const vpb = (VPB*) CSimKernel::Allocate(sizeof(VPB), false);
+
+		vpb->Type		= 10;
+		vpb->Size		= sizeof(VPB);
+		vpb->RealDevice = created;
+
+		created->Vpb = vpb;
+	}
+
+	driver->DeviceObject = created;
+	s_devices[slot]		 = created;
+
+	*device = created;
+
+	return STATUS_SUCCESS;
+}
+
+DEVICE_OBJECT* CSimKernel::CreateDevice(DRIVER_OBJECT *driver, LPCWSTR name, ULONG extensionSize, ULONG type, ULONG characteristics)
+{
+	DEVICE_OBJECT *device = 0;
+
+	if(NT_ERROR(NewDevice(driver, name, extensionSize, type, characteristics, false, &device)))
+	{
+		Fail("cannot create device");
+	}
+
+	return device;
+}
+
+HANDLE CSimKernel::CreateEvent(EVENT_TYPE type)
+{
+	KEVENT *const event = (KEVENT*) CreateObject(c_objectEvent, sizeof(KEVENT), 0, false);
+
+	KeInitializeEvent(event, type, false);
+
+	return InsertHandle(event, c_objectEvent);
+}
+
+void CSimKernel::RegisterFileSystem(DEVICE_OBJECT *control)
+{
+	ASSERT(control);
+
+	for(ULONG index = 0; index < c_fileSystems; ++index)
+	{
+		if(!s_fileSystems[index])
+		{
+			s_fileSystems[index] = control;
+
+			for(ULONG notify = 0; notify < c_notifications; ++notify)
+			{
+				if(s_fsNotify[notify])
+				{
+					s_fsNotify[notify](control, true);
+				}
+			}
+
+			return;
+		}
+	}
+
+	Fail("too many file systems");
+}
+
+DEVICE_OBJECT* CSimKernel::RelatedDevice(FILE_OBJECT *file)
+{
+	ASSERT(file);
+
+	SimObject *const header = Header(file);
+
+	// Opened with a hint, requests go there and bypass the upper devices
+	if(header && header->Target)
+	{
+		return header->Target;
+	}
+
+	DEVICE_OBJECT *device = file->DeviceObject;
+	ASSERT(device);
+
+	if(file->Vpb && file->Vpb->DeviceObject)
+	{
+		device = file->Vpb->DeviceObject;
+	}
+	else if(!(file->Flags & FO_DIRECT_DEVICE_OPEN) && device->Vpb && device->Vpb->DeviceObject)
+	{
+		device = device->Vpb->DeviceObject;
+	}
+
+	return Top(device);
+}
+
+NTSTATUS CSimKernel::Open(LPCWSTR path, ACCESS_MASK access, ULONG share, ULONG disposition, ULONG options, HANDLE *handle, ULONG_PTR *information)
+{
+	IO_STATUS_BLOCK ioStatus;
+
+	NTSTATUS const status = Create(path,
+								   access,
+								   FILE_ATTRIBUTE_NORMAL,
+								   share,
+								   disposition,
+								   options,
+								   true,
+								   0,
+								   UserMode,
+								   0,
+								   handle,
+								   &ioStatus);
+	if(information)
+	{
+		*information = ioStatus.Information;
+	}
+
+	return status;
+}
+
+NTSTATUS CSimKernel::ReadWrite(HANDLE handle, UCHAR major, LONGLONG offset, void *buffer, ULONG length, ULONG_PTR *information)
+{
+	ASSERT((major == IRP_MJ_READ) || (major == IRP_MJ_WRITE));
+
+	FILE_OBJECT *const file		= LookupFile(handle);
+	DEVICE_OBJECT *const device = RelatedDevice(file);
+
+	IRP *const irp = BuildIrp(file, device, major, UserMode);
+
+	irp->UserBuffer = buffer;
+	irp->Flags		= IRP_SYNCHRONOUS_API | ((major == IRP_MJ_READ) ? IRP_READ_OPERATION : IRP_WRITE_OPERATION);
+
+	if(file->Flags & FO_NO_INTERMEDIATE_BUFFERING)
+	{
+		irp->Flags |= IRP_NOCACHE;
+	}
+
+	IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+
+	// Read and Write share their layout
+	stack->Parameters.Read.Length			  = length;
+	stack->Parameters.Read.ByteOffset.QuadPart = offset;
+
+	IO_STATUS_BLOCK ioStatus;
+	NTSTATUS const status = Send(device, irp, &ioStatus);
+
+	if(information)
+	{
+		*information = ioStatus.Information;
+	}
+
+	return status;
+}
+
+NTSTATUS CSimKernel::Information(HANDLE handle, UCHAR major, ULONG type, void *buffer, ULONG length)
+{
+	ASSERT((major == IRP_MJ_QUERY_INFORMATION) || (major == IRP_MJ_SET_INFORMATION));
+
+	FILE_OBJECT *const file		= LookupFile(handle);
+	DEVICE_OBJECT *const device = RelatedDevice(file);
+
+	bool const rename = (major == IRP_MJ_SET_INFORMATION) && ((FileRenameInformation == type) || (FileLinkInformation == type));
+
+	HANDLE target = 0;
+
+	// The I/O manager opens the directory of fully qualified targets first, through all devices
+	if(rename)
+	{
+		FILE_RENAME_INFORMATION const*const info = (FILE_RENAME_INFORMATION const*) buffer;
+
+		if(!info->RootDirectory && info->FileNameLength && (info->FileName[0] == L'\\'))
+		{
+			WCHAR path[c_pathLength];
+
+			if(info->FileNameLength >= sizeof(path))
+			{
+				return STATUS_OBJECT_NAME_INVALID;
+			}
+
+			memcpy(path, info->FileName, info->FileNameLength);
+			path[info->FileNameLength / sizeof(WCHAR)] = UNICODE_NULL;
+
+			IO_STATUS_BLOCK ioStatus;
+
+			NTSTATUS const status = Create(path,
+										   FILE_WRITE_DATA | SYNCHRONIZE,
+										   FILE_ATTRIBUTE_NORMAL,
+										   FILE_SHARE_READ | FILE_SHARE_WRITE,
+										   FILE_OPEN,
+										   FILE_OPEN_FOR_BACKUP_INTENT,
+										   true,
+										   IO_OPEN_TARGET_DIRECTORY,
+										   UserMode,
+										   0,
+										   &target,
+										   &ioStatus);
+			if(NT_ERROR(status))
+			{
+				return status;
+			}
+		}
+	}
+
+	IRP *const irp = BuildIrp(file, device, major, UserMode);
+
+	irp->AssociatedIrp.SystemBuffer = buffer;
+	irp->Flags						= IRP_SYNCHRONOUS_API;
+
+	IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+
+	if(major == IRP_MJ_QUERY_INFORMATION)
+	{
+		stack->Parameters.QueryFile.Length				 = length;
+		stack->Parameters.QueryFile.FileInformationClass = (FILE_INFORMATION_CLASS) type;
+	}
+	else
+	{
+		stack->Parameters.SetFile.Length			   = length;
+		stack->Parameters.SetFile.FileInformationClass = (FILE_INFORMATION_CLASS) type;
+
+		// and passes the flag and the target along
+		if(rename)
+		{
+			stack->Parameters.SetFile.ReplaceIfExists = ((FILE_RENAME_INFORMATION const*) buffer)->ReplaceIfExists;
+			stack->Parameters.SetFile.FileObject	  = target ? LookupFile(target) : 0;
+		}
+	}
+
+	IO_STATUS_BLOCK ioStatus;
+
+	NTSTATUS const status = Send(device, irp, &ioStatus);
+
+	if(target)
+	{
+		ZwClose(target);
+	}
+
+	return status;
+}
+
+NTSTATUS CSimKernel::Flush(HANDLE handle)
+{
+	FILE_OBJECT *const file		= LookupFile(handle);
+	DEVICE_OBJECT *const device = RelatedDevice(file);
+
+	IRP *const irp = BuildIrp(file, device, IRP_MJ_FLUSH_BUFFERS, UserMode);
+	irp->Flags	   = IRP_SYNCHRONOUS_API;
+
+	IO_STATUS_BLOCK ioStatus;
+
+	return Send(device, irp, &ioStatus);
+}
+
+NTSTATUS CSimKernel::Control(HANDLE handle, ULONG code, void *input, ULONG inputLength, void *output, ULONG outputLength, ULONG_PTR *information)
+{
+	FILE_OBJECT *const file		= LookupFile(handle);
+	DEVICE_OBJECT *const device = RelatedDevice(file);
+
+	IRP *const irp			= BuildIrp(file, device, IRP_MJ_DEVICE_CONTROL, UserMode);
+	SimPacket *const packet = Packet(irp);
+
+	irp->Flags = IRP_SYNCHRONOUS_API;
+
+	ULONG const method = code & 3;
+
+	if(METHOD_NEITHER == method)
+	{
+		irp->UserBuffer = output;
+
+		IoGetNextIrpStackLocation(irp)->Parameters.DeviceIoControl.Type3InputBuffer = input;
+	}
+	else
+	{
+		ULONG const size = (METHOD_BUFFERED == method) ? max(inputLength, outputLength) : inputLength;
+
+		if(size)
+		{
+			packet->SystemBuffer = Allocate(size, false);
+
+			if(input)
+			{
+				memcpy(packet->SystemBuffer, input, inputLength);
+			}
+
+			irp->AssociatedIrp.SystemBuffer = packet->SystemBuffer;
+		}
+
+		if(METHOD_BUFFERED == method)
+		{
+			packet->Output		 = output;
+			packet->OutputLength = outputLength;
+		}
+		else if(output && outputLength)
+		{
+			irp->MdlAddress = NewMdl(output, outputLength, false);
+		}
+	}
+
+	IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+
+	stack->Parameters.DeviceIoControl.IoControlCode		 = code;
+	stack->Parameters.DeviceIoControl.InputBufferLength	 = inputLength;
+	stack->Parameters.DeviceIoControl.OutputBufferLength = outputLength;
+
+	IO_STATUS_BLOCK ioStatus;
+	NTSTATUS const status = Send(device, irp, &ioStatus);
+
+	if(information)
+	{
+		*information = ioStatus.Information;
+	}
+
+	return status;
+}
+
+NTSTATUS CSimKernel::Page(FILE_OBJECT *file, UCHAR major, LONGLONG offset, void *buffer, ULONG length, ULONG_PTR *information)
+{
+	ASSERT(file);
+	ASSERT((major == IRP_MJ_READ) || (major == IRP_MJ_WRITE));
+
+	DEVICE_OBJECT *const device = RelatedDevice(file);
+
+	IRP *const irp = BuildIrp(file, device, major, KernelMode);
+
+	irp->MdlAddress = NewMdl(buffer, length, false);
+	irp->UserBuffer = buffer;
+	irp->Flags		= IRP_PAGING_IO | IRP_NOCACHE | IRP_SYNCHRONOUS_PAGING_IO;
+	irp->Flags	   |= (major == IRP_MJ_READ) ? IRP_READ_OPERATION : IRP_WRITE_OPERATION;
+
+	IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+
+	stack->Parameters.Read.Length			  = length;
+	stack->Parameters.Read.ByteOffset.QuadPart = offset;
+
+	IO_STATUS_BLOCK ioStatus;
+	NTSTATUS const status = Send(device, irp, &ioStatus);
+
+	if(information)
+	{
+		*information = ioStatus.Information;
+	}
+
+	return status;
+}
+
+void CSimKernel::DeferDereference(FILE_OBJECT *file)
+{
+	ASSERT(file);
+
+	if(s_deferredCount >= c_deferred)
+	{
+		Fail("too many deferred dereferences");
+	}
+
+	s_deferred[s_deferredCount++] = file;
+}
+
+void* CSimKernel::Allocate(SIZE_T size, bool count)
+{
+	// As the pool does, allocations of a page or more start on a page
+	bool const paged = (size >= PAGE_SIZE);
+
+	UCHAR *const base = (UCHAR*) (paged ? aligned_alloc(PAGE_SIZE, PAGE_SIZE + ROUND_TO_PAGES(size)) : malloc(sizeof(SimBlock) + size));
+
+	if(!base)
+	{
+		Fail("out of memory");
+	}
+
+	SimBlock *const block = (SimBlock*) (base + (paged ? PAGE_SIZE : sizeof(SimBlock))) - 1;
+
+	memset(block, 0, sizeof(SimBlock) + size);
+
+	block->Base	   = base;
+	block->Size	   = size;
+	block->Magic   = c_magicBlock;
+	block->Counted = count;
+
+	// Stress tests of the UNITTEST sections allocate and free from several threads
+	if(count)
+	{
+		__sync_add_and_fetch(&s_counters.Allocations, 1);
+		__sync_add_and_fetch(&s_counters.AllocatedBytes, size);
+		__sync_add_and_fetch(&s_counters.Outstanding, 1);
+	}
+
+	return block + 1;
+}
+
+void CSimKernel::Free(void *memory)
+{
+	if(!memory)
+	{
+		return;
+	}
+
+	SimBlock *const block = (SimBlock*) memory - 1;
+
+	if(block->Magic != c_magicBlock)
+	{
+		Fail("freeing %p, which was not allocated", memory);
+	}
+
+	if(block->Counted)
+	{
+		__sync_add_and_fetch(&s_counters.Frees, 1);
+		__sync_sub_and_fetch(&s_counters.Outstanding, 1);
+	}
+
+	block->Magic = 0;
+
+	free(block->Base);
+}
+
+// First signaled object, or count if the wait is not satisfied
+static ULONG Signaled(ULONG count, void *objects[], bool all)
+{
+	ULONG signaled = 0;
+	ULONG first	   = count;
+
+	for(ULONG index = 0; index < count; ++index)
+	{
+		if(((DISPATCHER_HEADER*) objects[index])->SignalState > 0)
+		{
+			signaled++;
+
+			if(first == count)
+			{
+				first = index;
+			}
+		}
+	}
+
+	if(all)
+	{
+		return (signaled == count) ? 0 : count;
+	}
+
+	return first;
+}
+
+static void ThreadStart()
+{
+	s_running->Routine(s_running->Context);
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+// Resumes one system thread that can go on, if any
+static bool ThreadResume()
+{
+	for(ULONG index = 0; index < c_threads; ++index)
+	{
+		SimThread *const thread = s_systemThreads + index;
+
+		if(!thread->Object)
+		{
+			continue;
+		}
+
+		if(thread->Started)
+		{
+			bool const expired = thread->Deadline && (thread->Deadline <= s_now);
+
+			if(!expired && (Signaled(thread->Count, thread->Objects, thread->All) == thread->Count))
+			{
+				continue;
+			}
+		}
+		else
+		{
+			thread->Started = true;
+
+			getcontext(&thread->Registers);
+
+			thread->Registers.uc_stack.ss_sp   = thread->Stack;
+			thread->Registers.uc_stack.ss_size = c_threadStack;
+			thread->Registers.uc_link		   = 0;
+
+			makecontext(&thread->Registers, ThreadStart, 0);
+		}
+
+		s_running = thread;
+		swapcontext(&s_scheduler, &thread->Registers);
+		s_running = 0;
+
+		if(thread->Terminated)
+		{
+			// Wake those who wait on it
+			thread->Object->Header.SignalState = 1;
+
+			free(thread->Stack);
+
+			ObDereferenceObject(thread->Object);
+
+			memset(thread, 0, sizeof(SimThread));
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+// Earliest time a blocked system thread times out, zero for none
+static LONGLONG ThreadDeadline()
+{
+	LONGLONG deadline = 0;
+
+	for(ULONG index = 0; index < c_threads; ++index)
+	{
+		SimThread *const thread = s_systemThreads + index;
+
+		if(thread->Object && thread->Deadline && (!deadline || (thread->Deadline < deadline)))
+		{
+			deadline = thread->Deadline;
+		}
+	}
+
+	return deadline;
+}
+
+void CSimKernel::Run()
+{
+	for(;;)
+	{
+		if(!IsListEmpty(&s_work))
+		{
+			WORK_QUEUE_ITEM *const item = CONTAINING_RECORD(RemoveHeadList(&s_work), WORK_QUEUE_ITEM, List);
+
+			item->WorkerRoutine(item->Parameter);
+		}
+		else if(s_deferredCount)
+		{
+			ObDereferenceObject(s_deferred[--s_deferredCount]);
+		}
+		else if(s_running || !ThreadResume())
+		{
+			// System threads are resumed from the sim's own only
+			break;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// MEMORY ////
+
+void* ExAllocatePoolWithTag(POOL_TYPE type, SIZE_T size, ULONG tag)
+{
+	UNREFERENCED_PARAMETER(type);
+	UNREFERENCED_PARAMETER(tag);
+
+	return CSimKernel::Allocate(size);
+}
+
+void ExFreePool(void *memory)
+{
+	ASSERT(memory);
+
+	CSimKernel::Free(memory);
+}
+
+void ExFreePoolWithTag(void *memory, ULONG tag)
+{
+	UNREFERENCED_PARAMETER(tag);
+
+	ExFreePool(memory);
+}
+
+void ExInitializeNPagedLookasideList(NPAGED_LOOKASIDE_LIST *list, void *allocate, void *free, ULONG flags, SIZE_T size, ULONG tag, USHORT depth)
+{
+	ASSERT(list);
+	ASSERT(!allocate && !free);
+
+	UNREFERENCED_PARAMETER(allocate);
+	UNREFERENCED_PARAMETER(free);
+	UNREFERENCED_PARAMETER(flags);
+
+	memset(list, 0, sizeof(NPAGED_LOOKASIDE_LIST));
+
+	list->Size	= (ULONG) size;
+	list->Tag	= tag;
+	list->Depth = depth ? depth : (USHORT) c_lookasideDepth;
+}
+
+void ExDeleteNPagedLookasideList(NPAGED_LOOKASIDE_LIST *list)
+{
+	ASSERT(list);
+
+	while(list->ListHead.Next)
+	{
+		SINGLE_LIST_ENTRY *const entry = list->ListHead.Next;
+		list->ListHead.Next = entry->Next;
+
+		CSimKernel::Free(entry);
+	}
+
+	list->Count = 0;
+}
+
+void* ExAllocateFromNPagedLookasideList(NPAGED_LOOKASIDE_LIST *list)
+{
+	ASSERT(list);
+
+	SINGLE_LIST_ENTRY *const entry = list->ListHead.Next;
+
+	if(entry)
+	{
+		list->ListHead.Next = entry->Next;
+		list->Count--;
+
+		s_counters.Lookaside++;
+
+		return entry;
+	}
+
+	return CSimKernel::Allocate(max(list->Size, (ULONG) sizeof(SINGLE_LIST_ENTRY)));
+}
+
+void ExFreeToNPagedLookasideList(NPAGED_LOOKASIDE_LIST *list, void *entry)
+{
+	ASSERT(list);
+	ASSERT(entry);
+
+	if(list->Count < list->Depth)
+	{
+		((SINGLE_LIST_ENTRY*) entry)->Next = list->ListHead.Next;
+		list->ListHead.Next = (SINGLE_LIST_ENTRY*) entry;
+		list->Count++;
+	}
+	else
+	{
+		CSimKernel::Free(entry);
+	}
+}
+
+SIZE_T RtlCompareMemory(void const* a, void const* b, SIZE_T size)
+{
+	SIZE_T equal = 0;
+
+	while((equal < size) && (((UCHAR const*) a)[equal] == ((UCHAR const*) b)[equal]))
+	{
+		equal++;
+	}
+
+	return equal;
+}
+
+// LISTS ////
+
+LIST_ENTRY* ExInterlockedInsertTailList(LIST_ENTRY *head, LIST_ENTRY *entry, KSPIN_LOCK *lock)
+{
+	UNREFERENCED_PARAMETER(lock);
+
+	LIST_ENTRY *const previous = IsListEmpty(head) ? 0 : head->Blink;
+
+	InsertTailList(head, entry);
+
+	return previous;
+}
+
+LIST_ENTRY* ExInterlockedRemoveHeadList(LIST_ENTRY *head, KSPIN_LOCK *lock)
+{
+	UNREFERENCED_PARAMETER(lock);
+
+	return IsListEmpty(head) ? 0 : RemoveHeadList(head);
+}
+
+// SYNCHRONIZATION ////
+
+void KeInitializeSpinLock(KSPIN_LOCK *lock)
+{
+	*lock = 0;
+}
+
+void KeAcquireSpinLock(KSPIN_LOCK *lock, KIRQL *irql)
+{
+	ASSERT(!*lock);
+
+	*lock = 1;
+	*irql = PASSIVE_LEVEL;
+}
+
+void KeReleaseSpinLock(KSPIN_LOCK *lock, KIRQL irql)
+{
+	UNREFERENCED_PARAMETER(irql);
+
+	ASSERT(*lock);
+
+	*lock = 0;
+}
+
+void ExInitializeFastMutex(FAST_MUTEX *mutex)
+{
+	mutex->Count = 1;
+	mutex->Owner = 0;
+}
+
+void ExAcquireFastMutex(FAST_MUTEX *mutex)
+{
+	if(mutex->Count != 1)
+	{
+		Fail("fast mutex %p acquired recursively", mutex);
+	}
+
+	mutex->Count = 0;
+	mutex->Owner = KeGetCurrentThread();
+
+	s_counters.LockAcquisitions++;
+}
+
+void ExReleaseFastMutex(FAST_MUTEX *mutex)
+{
+	ASSERT(!mutex->Count);
+
+	mutex->Count = 1;
+	mutex->Owner = 0;
+}
+
+NTSTATUS ExInitializeResourceLite(ERESOURCE *resource)
+{
+	memset(resource, 0, sizeof(ERESOURCE));
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS ExDeleteResourceLite(ERESOURCE *resource)
+{
+	ASSERT(!resource->Exclusive && !resource->Shared);
+
+	UNREFERENCED_PARAMETER(resource);
+
+	return STATUS_SUCCESS;
+}
+
+BOOLEAN ExAcquireResourceExclusiveLite(ERESOURCE *resource, BOOLEAN wait)
+{
+	// Single thread: shared owners are ourselves, converting would wait forever
+	if(resource->Shared)
+	{
+		if(!wait)
+		{
+			return false;
+		}
+
+		Fail("resource %p acquired exclusive while held shared", resource);
+	}
+
+	resource->Exclusive++;
+	resource->Owner = KeGetCurrentThread();
+
+	s_counters.LockAcquisitions++;
+
+	return true;
+}
+
+BOOLEAN ExAcquireResourceSharedLite(ERESOURCE *resource, BOOLEAN wait)
+{
+	UNREFERENCED_PARAMETER(wait);
+
+	// Shared acquisitions of the exclusive owner count as exclusive ones
+	if(resource->Exclusive)
+	{
+		resource->Exclusive++;
+	}
+	else
+	{
+		resource->Shared++;
+	}
+
+	s_counters.LockAcquisitions++;
+
+	return true;
+}
+
+BOOLEAN ExAcquireSharedStarveExclusive(ERESOURCE *resource, BOOLEAN wait)
+{
+	return ExAcquireResourceSharedLite(resource, wait);
+}
+
+BOOLEAN ExAcquireSharedWaitForExclusive(ERESOURCE *resource, BOOLEAN wait)
+{
+	return ExAcquireResourceSharedLite(resource, wait);
+}
+
+void ExReleaseResourceLite(ERESOURCE *resource)
+{
+	if(resource->Exclusive)
+	{
+		if(!--resource->Exclusive)
+		{
+			resource->Owner = 0;
+		}
+	}
+	else if(resource->Shared)
+	{
+		resource->Shared--;
+	}
+	else
+	{
+		Fail("resource %p released, but not held", resource);
+	}
+}
+
+BOOLEAN ExIsResourceAcquiredExclusiveLite(ERESOURCE *resource)
+{
+	return resource->Exclusive && (resource->Owner == KeGetCurrentThread());
+}
+
+ULONG ExIsResourceAcquiredSharedLite(ERESOURCE *resource)
+{
+	return resource->Exclusive + resource->Shared;
+}
+
+void KeInitializeEvent(KEVENT *event, EVENT_TYPE type, BOOLEAN state)
+{
+	event->Header.Type		  = (UCHAR) type;
+	event->Header.SignalState = state;
+}
+
+LONG KeSetEvent(KEVENT *event, LONG increment, BOOLEAN wait)
+{
+	UNREFERENCED_PARAMETER(increment);
+	UNREFERENCED_PARAMETER(wait);
+
+	LONG const previous = event->Header.SignalState;
+
+	event->Header.SignalState = 1;
+
+	return previous;
+}
+
+void KeClearEvent(KEVENT *event)
+{
+	event->Header.SignalState = 0;
+}
+
+LONG KeResetEvent(KEVENT *event)
+{
+	LONG const previous = event->Header.SignalState;
+
+	event->Header.SignalState = 0;
+
+	return previous;
+}
+
+LONG KeReadStateEvent(KEVENT *event)
+{
+	return event->Header.SignalState;
+}
+
+void KeInitializeSemaphore(KSEMAPHORE *semaphore, LONG count, LONG limit)
+{
+	semaphore->Header.Type		  = 5;
+	semaphore->Header.SignalState = count;
+	semaphore->Limit			  = limit;
+}
+
+LONG KeReleaseSemaphore(KSEMAPHORE *semaphore, LONG increment, LONG adjustment, BOOLEAN wait)
+{
+	UNREFERENCED_PARAMETER(increment);
+	UNREFERENCED_PARAMETER(wait);
+
+	LONG const previous = semaphore->Header.SignalState;
+
+	if(previous + adjustment > semaphore->Limit)
+	{
+		Fail("semaphore %p exceeds its limit", semaphore);
+	}
+
+	semaphore->Header.SignalState += adjustment;
+
+	return previous;
+}
+
+static void Consume(DISPATCHER_HEADER *header)
+{
+	switch(header->Type)
+	{
+		case SynchronizationEvent:
+			header->SignalState = 0;
+			break;
+
+		case 5:
+			header->SignalState--;
+			break;
+
+		default:
+			break;
+	}
+}
+
+// Consumes the objects of a satisfied wait, STATUS_PENDING if not satisfied
+static NTSTATUS Satisfy(ULONG count, void *objects[], bool all)
+{
+	ULONG const first = Signaled(count, objects, all);
+
+	if(first == count)
+	{
+		return STATUS_PENDING;
+	}
+
+	if(all)
+	{
+		for(ULONG index = 0; index < count; ++index)
+		{
+			Consume((DISPATCHER_HEADER*) objects[index]);
+		}
+
+		return STATUS_SUCCESS;
+	}
+
+	Consume((DISPATCHER_HEADER*) objects[first]);
+
+	return STATUS_WAIT_0 + first;
+}
+
+static LONGLONG Deadline(LARGE_INTEGER *timeout)
+{
+	ASSERT(timeout);
+
+	return (timeout->QuadPart < 0) ? (s_now - timeout->QuadPart) : timeout->QuadPart;
+}
+
+static NTSTATUS Wait(ULONG count, void *objects[], bool all, LARGE_INTEGER *timeout)
+{
+	s_counters.Waits++;
+
+	LONGLONG const deadline = timeout ? Deadline(timeout) : 0;
+
+	if(s_running)
+	{
+		// System thread, blocks until the sim's thread resumes it
+		SimThread *const thread = s_running;
+
+		for(;;)
+		{
+			NTSTATUS const status = Satisfy(count, objects, all);
+
+			if(STATUS_PENDING != status)
+			{
+				return status;
+			}
+
+			if(timeout && (deadline <= s_now))
+			{
+				return STATUS_TIMEOUT;
+			}
+
+			thread->Count	 = count;
+			thread->Objects	 = objects;
+			thread->All		 = all;
+			thread->Deadline = deadline;
+
+			swapcontext(&thread->Registers, &s_scheduler);
+
+			thread->Count	 = 0;
+			thread->Deadline = 0;
+		}
+	}
+
+	for(;;)
+	{
+		// Nothing else runs, but work items and system threads may signal
+		NTSTATUS status = Satisfy(count, objects, all);
+
+		if(STATUS_PENDING != status)
+		{
+			return status;
+		}
+
+		CSimKernel::Run();
+
+		status = Satisfy(count, objects, all);
+
+		if(STATUS_PENDING != status)
+		{
+			return status;
+		}
+
+		// A blocked system thread times out first
+		LONGLONG const next = ThreadDeadline();
+
+		if(next && (!timeout || (next < deadline)))
+		{
+			CSimKernel::Advance(next - s_now);
+			continue;
+		}
+
+		if(!timeout)
+		{
+			Fail("deadlock, waiting forever on %p", objects[0]);
+		}
+
+		if(deadline > s_now)
+		{
+			CSimKernel::Advance(deadline - s_now);
+		}
+
+		return STATUS_TIMEOUT;
+	}
+}
+
+NTSTATUS KeWaitForSingleObject(void *object, KWAIT_REASON reason, KPROCESSOR_MODE mode, BOOLEAN alertable, LARGE_INTEGER *timeout)
+{
+	UNREFERENCED_PARAMETER(reason);
+	UNREFERENCED_PARAMETER(mode);
+	UNREFERENCED_PARAMETER(alertable);
+
+	return Wait(1, &object, true, timeout);
+}
+
+NTSTATUS KeWaitForMultipleObjects(ULONG count, void *objects[], ULONG type, KWAIT_REASON reason, KPROCESSOR_MODE mode, BOOLEAN alertable, LARGE_INTEGER *timeout, void *waitBlocks)
+{
+	UNREFERENCED_PARAMETER(reason);
+	UNREFERENCED_PARAMETER(mode);
+	UNREFERENCED_PARAMETER(alertable);
+	UNREFERENCED_PARAMETER(waitBlocks);
+
+	return Wait(count, objects, (WaitAll == type), timeout);
+}
+
+NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE mode, BOOLEAN alertable, LARGE_INTEGER *interval)
+{
+	UNREFERENCED_PARAMETER(mode);
+	UNREFERENCED_PARAMETER(alertable);
+
+	ASSERT(interval);
+
+	if(interval->QuadPart < 0)
+	{
+		CSimKernel::Advance(-interval->QuadPart);
+	}
+
+	CSimKernel::Run();
+
+	return STATUS_SUCCESS;
+}
+
+// TIME, PROCESSORS, THREADS ////
+
+void KeQueryTickCount(LARGE_INTEGER *count)
+{
+	count->QuadPart = (s_now - s_boot) / CSimKernel::c_tickIncrement;
+}
+
+ULONG KeQueryTimeIncrement()
+{
+	return CSimKernel::c_tickIncrement;
+}
+
+void KeQuerySystemTime(LARGE_INTEGER *time)
+{
+	time->QuadPart = s_now;
+}
+
+ULONGLONG KeQueryInterruptTime()
+{
+	return s_now - s_boot;
+}
+
+LARGE_INTEGER KeQueryPerformanceCounter(LARGE_INTEGER *frequency)
+{
+	// Real time, the stage profile measures the code and not the virtual clock
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if(frequency)
+	{
+		frequency->QuadPart = 1000000000LL;
+	}
+
+	LARGE_INTEGER counter;
+	counter.QuadPart = (LONGLONG) now.tv_sec * 1000000000LL + now.tv_nsec;
+
+	return counter;
+}
+
+KIRQL KeGetCurrentIrql()
+{
+	return PASSIVE_LEVEL;
+}
+
+ULONG KeGetCurrentProcessorNumber()
+{
+	return s_processor;
+}
+
+PKTHREAD KeGetCurrentThread()
+{
+	return &s_current->Thread;
+}
+
+LONG KeSetPriorityThread(PKTHREAD thread, LONG priority)
+{
+	UNREFERENCED_PARAMETER(thread);
+	UNREFERENCED_PARAMETER(priority);
+
+	return 8;
+}
+
+PEPROCESS PsGetCurrentProcess()
+{
+	return s_current;
+}
+
+HANDLE PsGetCurrentProcessId()
+{
+	return (HANDLE) (ULONG_PTR) s_current->Id;
+}
+
+PETHREAD PsGetCurrentThread()
+{
+	return &s_current->Thread;
+}
+
+HANDLE PsGetCurrentThreadId()
+{
+	return (HANDLE) (ULONG_PTR) s_current->Thread.Id;
+}
+
+BOOLEAN PsGetVersion(ULONG *major, ULONG *minor, ULONG *build, UNICODE_STRING *csd)
+{
+	UNREFERENCED_PARAMETER(csd);
+
+	// Windows 7 SP1
+	if(major)
+	{
+		*major = 6;
+	}
+	if(minor)
+	{
+		*minor = 1;
+	}
+	if(build)
+	{
+		*build = 7601;
+	}
+
+	return false;
+}
+
+NTSTATUS RtlGetVersion(RTL_OSVERSIONINFOW *version)
+{
+	ASSERT(version);
+
+	ULONG const size = version->dwOSVersionInfoSize;
+
+	memset(version, 0, size);
+
+	version->dwOSVersionInfoSize = size;
+	version->dwMajorVersion		 = 6;
+	version->dwMinorVersion		 = 1;
+	version->dwBuildNumber		 = 7601;
+	version->dwPlatformId		 = 2;
+
+	if(size >= sizeof(RTL_OSVERSIONINFOEXW))
+	{
+		((RTL_OSVERSIONINFOEXW*) version)->wServicePackMajor = 1;
+		((RTL_OSVERSIONINFOEXW*) version)->wProductType		 = 1;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS PsCreateSystemThread(HANDLE *thread, ULONG access, OBJECT_ATTRIBUTES *attributes, HANDLE process, void *client, PKSTART_ROUTINE routine, void *context)
+{
+	UNREFERENCED_PARAMETER(access);
+	UNREFERENCED_PARAMETER(attributes);
+	UNREFERENCED_PARAMETER(process);
+	UNREFERENCED_PARAMETER(client);
+
+	ASSERT(thread);
+	ASSERT(routine);
+
+	_KTHREAD *const created = (_KTHREAD*) CreateObject(c_objectThread, sizeof(_KTHREAD), 0, false);
+
+	created->Header.Type	= 6;
+	created->Process		= &s_processes[0];
+
+	Header(created)->Handles = 1;
+
+	if(CSimKernel::s_threads)
+	{
+		SimThread *found = 0;
+
+		for(ULONG index = 0; index < c_threads; ++index)
+		{
+			if(!s_systemThreads[index].Object)
+			{
+				found = s_systemThreads + index;
+				break;
+			}
+		}
+
+		if(!found)
+		{
+			Fail("too many system threads");
+		}
+
+		// Starts on the next run of the sim's thread
+		ObReferenceObject(created);
+
+		found->Object	= created;
+		found->Routine	= routine;
+		found->Context	= context;
+		found->Stack	= malloc(c_threadStack);
+	}
+	else
+	{
+		// Never runs, and is already terminated for those who wait on it
+		created->Header.SignalState = 1;
+	}
+
+	*thread = InsertHandle(created, c_objectThread);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS PsTerminateSystemThread(NTSTATUS status)
+{
+	UNREFERENCED_PARAMETER(status);
+
+	if(!s_running)
+	{
+		Fail("not on a system thread");
+	}
+
+	SimThread *const thread = s_running;
+
+	thread->Terminated = true;
+
+	// Never comes back
+	swapcontext(&thread->Registers, &s_scheduler);
+
+	return STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS PsSetCreateProcessNotifyRoutine(PCREATE_PROCESS_NOTIFY_ROUTINE routine, BOOLEAN remove)
+{
+	for(ULONG index = 0; index < c_notifications; ++index)
+	{
+		if(remove)
+		{
+			if(s_processNotify[index] == routine)
+			{
+				s_processNotify[index] = 0;
+
+				return STATUS_SUCCESS;
+			}
+		}
+		else if(!s_processNotify[index])
+		{
+			s_processNotify[index] = routine;
+
+			return STATUS_SUCCESS;
+		}
+	}
+
+	return STATUS_INVALID_PARAMETER;
+}
+
+extern "C" NTSTATUS PsSetCreateProcessNotifyRoutineMustSuccess(PCREATE_PROCESS_NOTIFY_ROUTINE routine, BOOLEAN remove)
+{
+	return PsSetCreateProcessNotifyRoutine(routine, remove);
+}
+
+PACCESS_TOKEN PsReferencePrimaryToken(PEPROCESS process)
+{
+	ASSERT(process);
+
+	return &process->Token;
+}
+
+void PsDereferencePrimaryToken(PACCESS_TOKEN token)
+{
+	UNREFERENCED_PARAMETER(token);
+}
+
+void ExQueueWorkItem(WORK_QUEUE_ITEM *item, WORK_QUEUE_TYPE type)
+{
+	UNREFERENCED_PARAMETER(type);
+
+	ASSERT(item);
+	ASSERT(item->WorkerRoutine);
+
+	InsertTailList(&s_work, &item->List);
+}
+
+void IoGetStackLimits(ULONG_PTR *low, ULONG_PTR *high)
+{
+	void *address	= 0;
+	size_t size		= 0;
+
+	pthread_attr_t attributes;
+	pthread_getattr_np(pthread_self(), &attributes);
+	pthread_attr_getstack(&attributes, &address, &size);
+	pthread_attr_destroy(&attributes);
+
+	*low  = (ULONG_PTR) address;
+	*high = (ULONG_PTR) address + size;
+}
+
+ULONG_PTR IoGetRemainingStackSize()
+{
+	ULONG_PTR low = 0, high = 0;
+	IoGetStackLimits(&low, &high);
+
+	return (ULONG_PTR) &low - low;
+}
+
+IRP* IoGetTopLevelIrp()
+{
+	return s_topLevel;
+}
+
+void IoSetTopLevelIrp(IRP *irp)
+{
+	s_topLevel = irp;
+}
+
+BOOLEAN IoIs32bitProcess(IRP *irp)
+{
+	UNREFERENCED_PARAMETER(irp);
+
+	return false;
+}
+
+ULONG IoGetRequestorProcessId(IRP *irp)
+{
+	ASSERT(irp);
+
+	_KTHREAD *const thread = irp->Tail.Overlay.Thread;
+
+	return (thread && thread->Process) ? thread->Process->Id : 0;
+}
+
+// SECURITY ////
+
+void SeCaptureSubjectContext(SECURITY_SUBJECT_CONTEXT *context)
+{
+	memset(context, 0, sizeof(SECURITY_SUBJECT_CONTEXT));
+
+	context->PrimaryToken = &s_current->Token;
+}
+
+void SeReleaseSubjectContext(SECURITY_SUBJECT_CONTEXT *context)
+{
+	UNREFERENCED_PARAMETER(context);
+}
+
+void SeLockSubjectContext(SECURITY_SUBJECT_CONTEXT *context)
+{
+	UNREFERENCED_PARAMETER(context);
+}
+
+void SeUnlockSubjectContext(SECURITY_SUBJECT_CONTEXT *context)
+{
+	UNREFERENCED_PARAMETER(context);
+}
+
+static SimToken* Token(PACCESS_TOKEN token)
+{
+	SimToken *const simToken = (SimToken*) token;
+
+	if(!simToken || (simToken->Magic != c_magicToken))
+	{
+		Fail("invalid token %p", token);
+	}
+
+	return simToken;
+}
+
+NTSTATUS SeQueryAuthenticationIdToken(PACCESS_TOKEN token, LUID *luid)
+{
+	ASSERT(luid);
+
+	*luid = Token(token)->Luid;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS SeQueryInformationToken(PACCESS_TOKEN token, TOKEN_INFORMATION_CLASS type, void **information)
+{
+	ASSERT(information);
+
+	if(TokenSource != type)
+	{
+		return STATUS_NOT_IMPLEMENTED;
+	}
+
+	TOKEN_SOURCE *const source = (TOKEN_SOURCE*) CSimKernel::Allocate(sizeof(TOKEN_SOURCE));
+
+	memcpy(source->SourceName, Token(token)->Source, TOKEN_SOURCE_LENGTH);
+
+	*information = source;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS SeMarkLogonSessionForTerminationNotification(LUID *luid)
+{
+	UNREFERENCED_PARAMETER(luid);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS SeRegisterLogonSessionTerminatedRoutine(NTSTATUS (*routine)(LUID*))
+{
+	UNREFERENCED_PARAMETER(routine);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS SeUnregisterLogonSessionTerminatedRoutine(NTSTATUS (*routine)(LUID*))
+{
+	UNREFERENCED_PARAMETER(routine);
+
+	return STATUS_SUCCESS;
+}
+
+// OBJECTS ////
+
+void ObReferenceObject(void *object)
+{
+	SimObject *const header = Header(object);
+
+	if(header)
+	{
+		header->References++;
+	}
+}
+
+void ObDereferenceObject(void *object)
+{
+	SimObject *const header = Header(object);
+
+	if(!header)
+	{
+		return;
+	}
+
+	ASSERT(header->References > 0);
+
+	if(--header->References)
+	{
+		return;
+	}
+
+	// Devices and drivers go away explicitly
+	switch(header->Type)
+	{
+		case c_objectFile:
+			DeleteFile((FILE_OBJECT*) object);
+			break;
+
+		case c_objectThread:
+		case c_objectEvent:
+			DeleteObject(object);
+			break;
+
+		default:
+			break;
+	}
+}
+
+NTSTATUS ObReferenceObjectByHandle(HANDLE handle, ACCESS_MASK access, void *type, KPROCESSOR_MODE mode, void **object, void *information)
+{
+	UNREFERENCED_PARAMETER(access);
+	UNREFERENCED_PARAMETER(mode);
+	UNREFERENCED_PARAMETER(information);
+
+	ASSERT(object);
+
+	SimHandle *const entry = LookupHandle(handle);
+
+	if(!entry)
+	{
+		return STATUS_INVALID_HANDLE;
+	}
+
+	if(type && (((_OBJECT_TYPE*) type)->Type != entry->Type))
+	{
+		return STATUS_OBJECT_TYPE_MISMATCH;
+	}
+
+	ObReferenceObject(entry->Object);
+
+	*object = entry->Object;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS ObQueryNameString(void *object, OBJECT_NAME_INFORMATION *name, ULONG length, ULONG *returned)
+{
+	SimObject *const header = Header(object);
+
+	if(!header)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	UNICODE_STRING const* first	 = &header->Name;
+	UNICODE_STRING const* second = 0;
+
+	if(c_objectFile == header->Type)
+	{
+		FILE_OBJECT *const file = (FILE_OBJECT*) object;
+
+		DEVICE_OBJECT *const device = (file->Vpb) ? file->Vpb->RealDevice : file->DeviceObject;
+
+		first  = &Header(device)->Name;
+		second = &file->FileName;
+	}
+
+	ULONG const size   = first->Length + (second ? second->Length : 0);
+	ULONG const needed = sizeof(OBJECT_NAME_INFORMATION) + size + sizeof(WCHAR);
+
+	if(returned)
+	{
+		*returned = needed;
+	}
+
+	if(length < needed)
+	{
+		return STATUS_INFO_LENGTH_MISMATCH;
+	}
+
+	name->Name.Buffer		 = (WCHAR*) (name + 1);
+	name->Name.Length		 = (USHORT) size;
+	name->Name.MaximumLength = (USHORT) (size + sizeof(WCHAR));
+
+	memcpy(name->Name.Buffer, first->Buffer, first->Length);
+
+	if(second && second->Length)
+	{
+		memcpy((char*) name->Name.Buffer + first->Length, second->Buffer, second->Length);
+	}
+
+	name->Name.Buffer[size / sizeof(WCHAR)] = UNICODE_NULL;
+
+	return STATUS_SUCCESS;
+}
+
+// STRINGS ////
+
+void RtlInitUnicodeString(UNICODE_STRING *target, LPCWSTR source)
+{
+	ASSERT(target);
+
+	target->Buffer		  = (WCHAR*) source;
+	target->Length		  = source ? (USHORT) (wcslen(source) * sizeof(WCHAR)) : 0;
+	target->MaximumLength = source ? (USHORT) (target->Length + sizeof(WCHAR)) : 0;
+}
+
+void RtlCopyUnicodeString(UNICODE_STRING *target, UNICODE_STRING const* source)
+{
+	ASSERT(target);
+
+	if(!source)
+	{
+		target->Length = 0;
+		return;
+	}
+
+	USHORT const length = min(source->Length, target->MaximumLength);
+
+	memmove(target->Buffer, source->Buffer, length);
+	target->Length = length;
+
+	if(length + sizeof(WCHAR) <= target->MaximumLength)
+	{
+		target->Buffer[length / sizeof(WCHAR)] = UNICODE_NULL;
+	}
+}
+
+NTSTATUS RtlAppendUnicodeStringToString(UNICODE_STRING *target, UNICODE_STRING const* source)
+{
+	ASSERT(target);
+	ASSERT(source);
+
+	if(target->Length + source->Length > target->MaximumLength)
+	{
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	memmove((char*) target->Buffer + target->Length, source->Buffer, source->Length);
+	target->Length += source->Length;
+
+	if(target->Length + sizeof(WCHAR) <= target->MaximumLength)
+	{
+		target->Buffer[target->Length / sizeof(WCHAR)] = UNICODE_NULL;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS RtlAppendUnicodeToString(UNICODE_STRING *target, LPCWSTR source)
+{
+	UNICODE_STRING string;
+	RtlInitUnicodeString(&string, source);
+
+	return RtlAppendUnicodeStringToString(target, &string);
+}
+
+WCHAR RtlUpcaseUnicodeChar(WCHAR wc)
+{
+	if((wc >= L'a') && (wc <= L'z'))
+	{
+		return wc - (L'a' - L'A');
+	}
+
+	// Latin-1 supplement, without the division sign
+	if((wc >= 0xe0) && (wc <= 0xfe) && (wc != 0xf7))
+	{
+		return wc - 0x20;
+	}
+
+	return wc;
+}
+
+LONG RtlCompareUnicodeString(UNICODE_STRING const* a, UNICODE_STRING const* b, BOOLEAN caseInsensitive)
+{
+	ULONG const aLength = a->Length / sizeof(WCHAR);
+	ULONG const bLength = b->Length / sizeof(WCHAR);
+
+	for(ULONG index = 0; (index < aLength) && (index < bLength); ++index)
+	{
+		WCHAR ac = a->Buffer[index];
+		WCHAR bc = b->Buffer[index];
+
+		if(caseInsensitive)
+		{
+			ac = RtlUpcaseUnicodeChar(ac);
+			bc = RtlUpcaseUnicodeChar(bc);
+		}
+
+		if(ac != bc)
+		{
+			return (LONG) ac - (LONG) bc;
+		}
+	}
+
+	return (LONG) aLength - (LONG) bLength;
+}
+
+BOOLEAN RtlEqualUnicodeString(UNICODE_STRING const* a, UNICODE_STRING const* b, BOOLEAN caseInsensitive)
+{
+	return (a->Length == b->Length) && !RtlCompareUnicodeString(a, b, caseInsensitive);
+}
+
+NTSTATUS RtlVolumeDeviceToDosName(void *device, UNICODE_STRING *name)
+{
+	UNREFERENCED_PARAMETER(device);
+	UNREFERENCED_PARAMETER(name);
+
+	return STATUS_UNSUCCESSFUL;
+}
+
+BOOLEAN FsRtlDoesNameContainWildCards(UNICODE_STRING *name)
+{
+	for(ULONG index = 0; index < name->Length / sizeof(WCHAR); ++index)
+	{
+		switch(name->Buffer[index])
+		{
+			case L'*': case L'?': case L'<': case L'>': case L'"':
+				return true;
+
+			default:
+				break;
+		}
+	}
+
+	return false;
+}
+
+static bool Match(WCHAR const* expression, ULONG expressionLength, WCHAR const* name, ULONG nameLength, bool ignoreCase)
+{
+	while(expressionLength)
+	{
+		WCHAR const wc = *expression;
+
+		// DOS_STAR is taken as the plain one
+		if((wc == L'*') || (wc == L'<'))
+		{
+			for(ULONG skip = 0; skip <= nameLength; ++skip)
+			{
+				if(Match(expression + 1, expressionLength - 1, name + skip, nameLength - skip, ignoreCase))
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		if(!nameLength)
+		{
+			// DOS_QM and DOS_DOT also match the end
+			return ((wc == L'>') || (wc == L'"')) && Match(expression + 1, expressionLength - 1, name, 0, ignoreCase);
+		}
+
+		if(wc == L'"')
+		{
+			if(*name != L'.')
+			{
+				return false;
+			}
+		}
+		else if((wc != L'?') && (wc != L'>'))
+		{
+			WCHAR const nc = ignoreCase ? RtlUpcaseUnicodeChar(*name) : *name;
+
+			if((ignoreCase ? RtlUpcaseUnicodeChar(wc) : wc) != nc)
+			{
+				return false;
+			}
+		}
+
+		expression++;
+		expressionLength--;
+		name++;
+		nameLength--;
+	}
+
+	return !nameLength;
+}
+
+BOOLEAN FsRtlIsNameInExpression(UNICODE_STRING *expression, UNICODE_STRING *name, BOOLEAN ignoreCase, WCHAR *upcaseTable)
+{
+	UNREFERENCED_PARAMETER(upcaseTable);
+
+	return Match(expression->Buffer, expression->Length / sizeof(WCHAR), name->Buffer, name->Length / sizeof(WCHAR), ignoreCase);
+}
+
+// DEBUG ////
+
+static void Narrow(WCHAR const* source, ULONG length, char *target, ULONG targetSize)
+{
+	ULONG index = 0;
+
+	for(; source && (index < length) && source[index] && (index + 1 < targetSize); ++index)
+	{
+		target[index] = (source[index] < 0x80) ? (char) source[index] : '?';
+	}
+
+	target[index] = 0;
+}
+
+extern "C" ULONG DbgPrint(char const* format, ...)
+{
+	// Only with DBG builds, in the format of the kernel's: %ws and %wZ for wide strings, %I64 for 64 bits
+	if(!CSimKernel::s_verbose)
+	{
+		return 0;
+	}
+
+	va_list args;
+	va_start(args, format);
+
+	while(*format)
+	{
+		if(*format != '%')
+		{
+			fputc(*format++, stderr);
+			continue;
+		}
+
+		char spec[32];
+		ULONG length = 0;
+
+		spec[length++] = *format++;
+
+		while(*format && strchr("-+ #0123456789.", *format) && (length < sizeof(spec) - 4))
+		{
+			spec[length++] = *format++;
+		}
+
+		bool wide = false;
+		int size  = 0;
+
+		if(*format == 'w')
+		{
+			wide = true;
+			format++;
+		}
+		else if(!strncmp(format, "I64", 3))
+		{
+			size = 2;
+			format += 3;
+		}
+		else
+		{
+			// long is 32 bits there, I and z are pointer sized
+			while((*format == 'l') || (*format == 'h') || (*format == 'z') || (*format == 'I'))
+			{
+				size = ((*format == 'z') || (*format == 'I') || (size && (*format == 'l'))) ? 2 : size;
+				size = (*format == 'l') && !size ? 1 : size;
+				format++;
+			}
+		}
+
+		char const conversion = *format;
+
+		if(!conversion)
+		{
+			break;
+		}
+
+		format++;
+
+		char text[512];
+
+		switch(conversion)
+		{
+			case '%':
+				fputc('%', stderr);
+				continue;
+
+			case 's':
+			case 'S':
+				if(wide || (conversion == 'S'))
+				{
+					WCHAR const*const string = va_arg(args, WCHAR const*);
+
+					Narrow(string, ~0u, text, sizeof(text));
+				}
+				else
+				{
+					char const*const string = va_arg(args, char const*);
+
+					snprintf(text, sizeof(text), "%s", string ? string : "(null)");
+				}
+
+				spec[length++] = 's';
+				spec[length]   = 0;
+
+				fprintf(stderr, spec, text);
+				continue;
+
+			case 'Z':
+			{
+				UNICODE_STRING const*const string = va_arg(args, UNICODE_STRING const*);
+
+				Narrow(string ? string->Buffer : 0, string ? string->Length / sizeof(WCHAR) : 0, text, sizeof(text));
+
+				spec[length++] = 's';
+				spec[length]   = 0;
+
+				fprintf(stderr, spec, text);
+			}
+			continue;
+
+			case 'c':
+			case 'C':
+				fputc(va_arg(args, int), stderr);
+				continue;
+
+			case 'p':
+				spec[length++] = 'p';
+				spec[length]   = 0;
+
+				fprintf(stderr, spec, va_arg(args, void*));
+				continue;
+
+			default:
+				break;
+		}
+
+		// Integers, widened to 64 bits
+		spec[length++] = 'l';
+		spec[length++] = 'l';
+		spec[length++] = (conversion == 'X') || (conversion == 'x') || (conversion == 'u') || (conversion == 'o') || (conversion == 'd') ? conversion : 'd';
+		spec[length]   = 0;
+
+		bool const isSigned = (conversion == 'd') || (conversion == 'i');
+		long long value		= 0;
+
+		if(size >= 2)
+		{
+			value = va_arg(args, long long);
+		}
+		else
+		{
+			value = isSigned ? (long long) va_arg(args, int) : (long long) va_arg(args, unsigned int);
+		}
+
+		fprintf(stderr, spec, value);
+	}
+
+	va_end(args);
+
+	return 0;
+}
+
+size_t SimWcslen(wchar_t const* s)
+{
+	size_t length = 0;
+
+	while(s[length])
+	{
+		length++;
+	}
+
+	return length;
+}
+
+wchar_t* SimWcscpy(wchar_t *target, wchar_t const* source)
+{
+	memmove(target, source, (SimWcslen(source) + 1) * sizeof(wchar_t));
+
+	return target;
+}
+
+wchar_t* SimWcscat(wchar_t *target, wchar_t const* source)
+{
+	SimWcscpy(target + SimWcslen(target), source);
+
+	return target;
+}
+
+int SimWcsnicmp(wchar_t const* a, wchar_t const* b, size_t count)
+{
+	for(size_t index = 0; index < count; ++index)
+	{
+		WCHAR const ac = RtlUpcaseUnicodeChar(a[index]);
+		WCHAR const bc = RtlUpcaseUnicodeChar(b[index]);
+
+		if(ac != bc)
+		{
+			return (int) ac - (int) bc;
+		}
+
+		if(!ac)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
+
+// DEVICES AND IRPS ////
+
+NTSTATUS IoCreateDevice(DRIVER_OBJECT *driver, ULONG extensionSize, UNICODE_STRING *name, ULONG type, ULONG characteristics, BOOLEAN exclusive, DEVICE_OBJECT **device)
+{
+	UNREFERENCED_PARAMETER(exclusive);
+
+	WCHAR buffer[CSimKernel::c_nameLength];
+
+	if(name)
+	{
+		if(name->Length >= sizeof(buffer))
+		{
+			return STATUS_OBJECT_NAME_INVALID;
+		}
+
+		memcpy(buffer, name->Buffer, name->Length);
+		buffer[name->Length / sizeof(WCHAR)] = UNICODE_NULL;
+	}
+
+	return NewDevice(driver, name ? buffer : 0, extensionSize, type, characteristics, true, device);
+}
+
+void IoDeleteDevice(DEVICE_OBJECT *device)
+{
+	ASSERT(device);
+	ASSERT(!device->AttachedDevice);
+
+	DEVICE_OBJECT **link = &device->DriverObject->DeviceObject;
+
+	while(*link && (*link != device))
+	{
+		link = &(*link)->NextDevice;
+	}
+
+	if(*link)
+	{
+		*link = device->NextDevice;
+	}
+
+	for(ULONG index = 0; index < CSimKernel::c_devices; ++index)
+	{
+		if(s_devices[index] == device)
+		{
+			s_devices[index] = 0;
+		}
+	}
+
+	if(device->Vpb && (device->Vpb->RealDevice == device))
+	{
+		CSimKernel::Free(device->Vpb);
+	}
+
+	DeleteObject(device);
+}
+
+NTSTATUS IoAttachDeviceToDeviceStackSafe(DEVICE_OBJECT *source, DEVICE_OBJECT *target, DEVICE_OBJECT **attached)
+{
+	ASSERT(source);
+	ASSERT(target);
+	ASSERT(attached);
+
+	DEVICE_OBJECT *const top = Top(target);
+
+	// Visible to the source before requests can reach it
+	*attached = top;
+
+	source->StackSize = top->StackSize + 1;
+
+	if(source->StackSize > CSimKernel::c_irpStackSize)
+	{
+		Fail("device stack too deep");
+	}
+
+	Header(source)->Lower = top;
+	top->AttachedDevice	  = source;
+
+	return STATUS_SUCCESS;
+}
+
+DEVICE_OBJECT* IoAttachDeviceToDeviceStack(DEVICE_OBJECT *source, DEVICE_OBJECT *target)
+{
+	DEVICE_OBJECT *attached = 0;
+
+	IoAttachDeviceToDeviceStackSafe(source, target, &attached);
+
+	return attached;
+}
+
+void IoDetachDevice(DEVICE_OBJECT *target)
+{
+	ASSERT(target);
+
+	DEVICE_OBJECT *const attached = target->AttachedDevice;
+
+	if(attached)
+	{
+		Header(attached)->Lower = 0;
+		target->AttachedDevice	= 0;
+	}
+}
+
+DEVICE_OBJECT* IoGetAttachedDeviceReference(DEVICE_OBJECT *device)
+{
+	device = Top(device);
+	ObReferenceObject(device);
+
+	return device;
+}
+
+DEVICE_OBJECT* IoGetDeviceAttachmentBaseRef(DEVICE_OBJECT *device)
+{
+	while(Header(device)->Lower)
+	{
+		device = Header(device)->Lower;
+	}
+
+	ObReferenceObject(device);
+
+	return device;
+}
+
+DEVICE_OBJECT* IoGetLowerDeviceObject(DEVICE_OBJECT *device)
+{
+	DEVICE_OBJECT *const lower = Header(device)->Lower;
+
+	if(lower)
+	{
+		ObReferenceObject(lower);
+	}
+
+	return lower;
+}
+
+NTSTATUS IoGetDiskDeviceObject(DEVICE_OBJECT *device, DEVICE_OBJECT **disk)
+{
+	ASSERT(device);
+	ASSERT(disk);
+
+	for(ULONG index = 0; index < CSimKernel::c_devices; ++index)
+	{
+		DEVICE_OBJECT *const real = s_devices[index];
+
+		if(real && real->Vpb && (real->Vpb->DeviceObject == device))
+		{
+			ObReferenceObject(real);
+			*disk = real;
+
+			return STATUS_SUCCESS;
+		}
+	}
+
+	return STATUS_INVALID_PARAMETER;
+}
+
+NTSTATUS IoGetDeviceObjectPointer(UNICODE_STRING *name, ACCESS_MASK access, FILE_OBJECT **file, DEVICE_OBJECT **device)
+{
+	UNREFERENCED_PARAMETER(access);
+
+	ASSERT(name);
+
+	WCHAR path[c_pathLength];
+
+	if(name->Length >= sizeof(path))
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	memcpy(path, name->Buffer, name->Length);
+	path[name->Length / sizeof(WCHAR)] = UNICODE_NULL;
+
+	LPCWSTR remainder		   = 0;
+	DEVICE_OBJECT *const found = FindDevice(path, &remainder);
+
+	if(!found || *remainder)
+	{
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	FILE_OBJECT *const opened = NewFile(found, 0, true);
+	opened->Flags			  = FO_DIRECT_DEVICE_OPEN;
+
+	*file	= opened;
+	*device = Top(found);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS IoEnumerateDeviceObjectList(DRIVER_OBJECT *driver, DEVICE_OBJECT **list, ULONG size, ULONG *count)
+{
+	ASSERT(driver);
+	ASSERT(count);
+
+	ULONG devices = 0;
+
+	for(DEVICE_OBJECT *device = driver->DeviceObject; device; device = device->NextDevice)
+	{
+		devices++;
+	}
+
+	*count = devices;
+
+	if(!list || (size < devices * sizeof(DEVICE_OBJECT*)))
+	{
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	ULONG index = 0;
+
+	for(DEVICE_OBJECT *device = driver->DeviceObject; device; device = device->NextDevice)
+	{
+		ObReferenceObject(device);
+		list[index++] = device;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS IoRegisterFsRegistrationChange(DRIVER_OBJECT *driver, void (*routine)(DEVICE_OBJECT*, BOOLEAN))
+{
+	UNREFERENCED_PARAMETER(driver);
+
+	ASSERT(routine);
+
+	for(ULONG index = 0; index < c_notifications; ++index)
+	{
+		if(!s_fsNotify[index])
+		{
+			s_fsNotify[index] = routine;
+
+			// File systems already registered are reported right away
+			for(ULONG fs = 0; fs < c_fileSystems; ++fs)
+			{
+				if(s_fileSystems[fs])
+				{
+					routine(s_fileSystems[fs], true);
+				}
+			}
+
+			return STATUS_SUCCESS;
+		}
+	}
+
+	return STATUS_INSUFFICIENT_RESOURCES;
+}
+
+void IoUnregisterFsRegistrationChange(DRIVER_OBJECT *driver, void (*routine)(DEVICE_OBJECT*, BOOLEAN))
+{
+	UNREFERENCED_PARAMETER(driver);
+
+	for(ULONG index = 0; index < c_notifications; ++index)
+	{
+		if(s_fsNotify[index] == routine)
+		{
+			s_fsNotify[index] = 0;
+		}
+	}
+}
+
+NTSTATUS IoRegisterShutdownNotification(DEVICE_OBJECT *device)
+{
+	for(ULONG index = 0; index < c_notifications; ++index)
+	{
+		if(!s_shutdown[index])
+		{
+			s_shutdown[index] = device;
+
+			return STATUS_SUCCESS;
+		}
+	}
+
+	return STATUS_INSUFFICIENT_RESOURCES;
+}
+
+void IoUnregisterShutdownNotification(DEVICE_OBJECT *device)
+{
+	for(ULONG index = 0; index < c_notifications; ++index)
+	{
+		if(s_shutdown[index] == device)
+		{
+			s_shutdown[index] = 0;
+		}
+	}
+}
+
+static bool CopyName(UNICODE_STRING const* source, WCHAR *target, ULONG targetLength)
+{
+	if(!source || (source->Length >= targetLength * sizeof(WCHAR)))
+	{
+		return false;
+	}
+
+	memcpy(target, source->Buffer, source->Length);
+	target[source->Length / sizeof(WCHAR)] = UNICODE_NULL;
+
+	return true;
+}
+
+static SimLink* FindLink(UNICODE_STRING const* name)
+{
+	WCHAR buffer[CSimKernel::c_nameLength];
+
+	if(!CopyName(name, buffer, CSimKernel::c_nameLength))
+	{
+		return 0;
+	}
+
+	for(ULONG index = 0; index < c_links; ++index)
+	{
+		if(s_links[index].Link[0] && (wcslen(s_links[index].Link) == wcslen(buffer)) && !_wcsnicmp(s_links[index].Link, buffer, wcslen(buffer)))
+		{
+			return &s_links[index];
+		}
+	}
+
+	return 0;
+}
+
+NTSTATUS IoCreateSymbolicLink(UNICODE_STRING *link, UNICODE_STRING *target)
+{
+	if(FindLink(link))
+	{
+		return STATUS_OBJECT_NAME_COLLISION;
+	}
+
+	for(ULONG index = 0; index < c_links; ++index)
+	{
+		SimLink *const entry = &s_links[index];
+
+		if(!entry->Link[0])
+		{
+			if(!CopyName(link, entry->Link, CSimKernel::c_nameLength) || !CopyName(target, entry->Target, CSimKernel::c_nameLength))
+			{
+				memset(entry, 0, sizeof(SimLink));
+
+				return STATUS_OBJECT_NAME_INVALID;
+			}
+
+			return STATUS_SUCCESS;
+		}
+	}
+
+	return STATUS_INSUFFICIENT_RESOURCES;
+}
+
+NTSTATUS IoDeleteSymbolicLink(UNICODE_STRING *link)
+{
+	SimLink *const entry = FindLink(link);
+
+	if(!entry)
+	{
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	memset(entry, 0, sizeof(SimLink));
+
+	return STATUS_SUCCESS;
+}
+
+IRP* IoAllocateIrp(CCHAR stackSize, BOOLEAN quota)
+{
+	UNREFERENCED_PARAMETER(quota);
+
+	return NewIrp(stackSize, false, true);
+}
+
+void IoFreeIrp(IRP *irp)
+{
+	SimPacket *const packet = Packet(irp);
+	ASSERT(!packet->Owned);
+
+	packet->Magic = 0;
+
+	CSimKernel::Free(packet);
+}
+
+void IoReuseIrp(IRP *irp, NTSTATUS status)
+{
+	Packet(irp);
+
+	InitIrp(irp, irp->StackCount);
+
+	irp->IoStatus.Status = status;
+}
+
+IRP* IoBuildDeviceIoControlRequest(ULONG code, DEVICE_OBJECT *device, void *input, ULONG inputLength, void *output, ULONG outputLength, BOOLEAN internal, KEVENT *event, IO_STATUS_BLOCK *status)
+{
+	ASSERT(device);
+
+	// Freed by the I/O manager on completion, but built for the driver
+	IRP *const irp			= NewIrp(device->StackSize, true, true);
+	SimPacket *const packet = Packet(irp);
+
+	irp->UserIosb  = status;
+	irp->UserEvent = event;
+
+	ULONG const size = max(inputLength, outputLength);
+
+	if(size)
+	{
+		packet->SystemBuffer = CSimKernel::Allocate(size, false);
+
+		if(input)
+		{
+			memcpy(packet->SystemBuffer, input, inputLength);
+		}
+
+		irp->AssociatedIrp.SystemBuffer = packet->SystemBuffer;
+	}
+
+	packet->Output		 = output;
+	packet->OutputLength = outputLength;
+
+	IO_STACK_LOCATION *const stack = IoGetNextIrpStackLocation(irp);
+
+	stack->MajorFunction = internal ? IRP_MJ_INTERNAL_DEVICE_CONTROL : IRP_MJ_DEVICE_CONTROL;
+
+	stack->Parameters.DeviceIoControl.IoControlCode		 = code;
+	stack->Parameters.DeviceIoControl.InputBufferLength	 = inputLength;
+	stack->Parameters.DeviceIoControl.OutputBufferLength = outputLength;
+
+	return irp;
+}
+
+NTSTATUS IoCallDriver(DEVICE_OBJECT *device, IRP *irp)
+{
+	ASSERT(device);
+	ASSERT(irp);
+
+	IoSetNextIrpStackLocation(irp);
+
+	if(irp->CurrentLocation <= 0)
+	{
+		Fail("IRP %p has no stack location left", irp);
+	}
+
+	IO_STACK_LOCATION *const stack = IoGetCurrentIrpStackLocation(irp);
+	stack->DeviceObject = device;
+
+	if(CSimKernel::s_verbose > 1)
+	{
+		fprintf(stderr, "sim: IRP %p major %d minor %d to %ls\n", irp, stack->MajorFunction, stack->MinorFunction, Header(device)->NameBuffer);
+	}
+
+	PDRIVER_DISPATCH const dispatch = device->DriverObject->MajorFunction[stack->MajorFunction];
+
+	if(!dispatch)
+	{
+		irp->IoStatus.Status	  = STATUS_INVALID_DEVICE_REQUEST;
+		irp->IoStatus.Information = 0;
+
+		IoCompleteRequest(irp, IO_NO_INCREMENT);
+
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	return dispatch(device, irp);
+}
+
+void IoCompleteRequest(IRP *irp, CCHAR increment)
+{
+	UNREFERENCED_PARAMETER(increment);
+
+	ASSERT(irp);
+	ASSERT(irp->IoStatus.Status != STATUS_PENDING);
+
+	if(irp->CurrentLocation > irp->StackCount + 1)
+	{
+		Fail("IRP %p completed twice", irp);
+	}
+
+	// Completion routines run from the current location upwards, each on behalf of the device above it
+	IO_STACK_LOCATION *stack = IoGetCurrentIrpStackLocation(irp);
+
+	for(IoSkipCurrentIrpStackLocation(irp); irp->CurrentLocation <= irp->StackCount + 1; ++stack, IoSkipCurrentIrpStackLocation(irp))
+	{
+		irp->PendingReturned = stack->Control & SL_PENDING_RETURNED;
+
+		NTSTATUS const status				 = irp->IoStatus.Status;
+		PIO_COMPLETION_ROUTINE const routine = stack->CompletionRoutine;
+		void *const context					 = stack->Context;
+
+		bool const invoke = routine && ((NT_SUCCESS(status) && (stack->Control & SL_INVOKE_ON_SUCCESS)) ||
+										(!NT_SUCCESS(status) && (stack->Control & SL_INVOKE_ON_ERROR)) ||
+										(irp->Cancel && (stack->Control & SL_INVOKE_ON_CANCEL)));
+		stack->Control			 = 0;
+		stack->CompletionRoutine = 0;
+		stack->Context			 = 0;
+
+		if(invoke)
+		{
+			DEVICE_OBJECT *const device = (irp->CurrentLocation == irp->StackCount + 1) ? 0 : IoGetCurrentIrpStackLocation(irp)->DeviceObject;
+
+			if(STATUS_MORE_PROCESSING_REQUIRED == routine(device, irp, context))
+			{
+				return;
+			}
+		}
+		else if(irp->PendingReturned && (irp->CurrentLocation <= irp->StackCount))
+		{
+			IoMarkIrpPending(irp);
+		}
+	}
+
+	Finish(irp);
+}
+
+PDRIVER_CANCEL IoSetCancelRoutine(IRP *irp, PDRIVER_CANCEL routine)
+{
+	ASSERT(irp);
+
+	PDRIVER_CANCEL const previous = irp->CancelRoutine;
+	irp->CancelRoutine = routine;
+
+	return previous;
+}
+
+void IoAcquireCancelSpinLock(KIRQL *irql)
+{
+	KeAcquireSpinLock(&s_cancelLock, irql);
+}
+
+void IoReleaseCancelSpinLock(KIRQL irql)
+{
+	KeReleaseSpinLock(&s_cancelLock, irql);
+}
+
+BOOLEAN IoCancelIrp(IRP *irp)
+{
+	ASSERT(irp);
+
+	IoAcquireCancelSpinLock(&irp->CancelIrql);
+
+	irp->Cancel = true;
+
+	PDRIVER_CANCEL const routine = IoSetCancelRoutine(irp, 0);
+
+	if(!routine)
+	{
+		IoReleaseCancelSpinLock(irp->CancelIrql);
+
+		return false;
+	}
+
+	// Routine releases the cancel spin lock
+	IO_STACK_LOCATION *const stack = (irp->CurrentLocation <= irp->StackCount) ? IoGetCurrentIrpStackLocation(irp) : 0;
+
+	routine(stack ? stack->DeviceObject : 0, irp);
+
+	return true;
+}
+
+void IoCancelFileOpen(DEVICE_OBJECT *device, FILE_OBJECT *file)
+{
+	ASSERT(device);
+	ASSERT(file);
+
+	SimObject *const header = Header(file);
+	ASSERT(header);
+
+	CloseFile(file, device, IRP_MJ_CLEANUP);
+	CloseFile(file, device, IRP_MJ_CLOSE);
+
+	header->Flags |= c_fileFailed;
+}
+
+FILE_OBJECT* IoCreateStreamFileObjectLite(FILE_OBJECT *file, DEVICE_OBJECT *device)
+{
+	ASSERT(file || device);
+
+	DEVICE_OBJECT *const real = file ? file->DeviceObject : device;
+	VPB *const vpb			  = file ? file->Vpb : device->Vpb;
+
+	FILE_OBJECT *const stream = NewFile(real, vpb, true);
+	stream->Flags			  = FO_STREAM_FILE;
+
+	return stream;
+}
+
+static void ShareAccess(ACCESS_MASK access, ULONG share, FILE_OBJECT *file)
+{
+	file->ReadAccess   = (access & (FILE_EXECUTE | FILE_READ_DATA)) != 0;
+	file->WriteAccess  = (access & (FILE_WRITE_DATA | FILE_APPEND_DATA)) != 0;
+	file->DeleteAccess = (access & DELETE) != 0;
+
+	file->SharedRead   = (share & FILE_SHARE_READ) != 0;
+	file->SharedWrite  = (share & FILE_SHARE_WRITE) != 0;
+	file->SharedDelete = (share & FILE_SHARE_DELETE) != 0;
+}
+
+NTSTATUS IoCheckShareAccess(ACCESS_MASK access, ULONG share, FILE_OBJECT *file, SHARE_ACCESS *shareAccess, BOOLEAN update)
+{
+	ASSERT(file);
+	ASSERT(shareAccess);
+
+	ShareAccess(access, share, file);
+
+	if(!file->ReadAccess && !file->WriteAccess && !file->DeleteAccess)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	SimObject *const header = Header(file);
+
+	// Opens that ignore share access neither check nor count
+	if(header && (header->Flags & c_fileIgnoreShare))
+	{
+		return STATUS_SUCCESS;
+	}
+
+	ULONG const open = shareAccess->OpenCount;
+
+	if((file->ReadAccess   && (shareAccess->SharedRead < open))   ||
+	   (file->WriteAccess  && (shareAccess->SharedWrite < open))  ||
+	   (file->DeleteAccess && (shareAccess->SharedDelete < open)) ||
+	   (shareAccess->Readers  && !file->SharedRead)  ||
+	   (shareAccess->Writers  && !file->SharedWrite) ||
+	   (shareAccess->Deleters && !file->SharedDelete))
+	{
+		return STATUS_SHARING_VIOLATION;
+	}
+
+	if(update)
+	{
+		IoSetShareAccess(access, share, file, shareAccess);
+	}
+
+	return STATUS_SUCCESS;
+}
+
+void IoSetShareAccess(ACCESS_MASK access, ULONG share, FILE_OBJECT *file, SHARE_ACCESS *shareAccess)
+{
+	ASSERT(file);
+	ASSERT(shareAccess);
+
+	ShareAccess(access, share, file);
+
+	SimObject *const header = Header(file);
+
+	if((!file->ReadAccess && !file->WriteAccess && !file->DeleteAccess) || (header && (header->Flags & c_fileIgnoreShare)))
+	{
+		return;
+	}
+
+	shareAccess->OpenCount++;
+	shareAccess->Readers	  += file->ReadAccess;
+	shareAccess->Writers	  += file->WriteAccess;
+	shareAccess->Deleters	  += file->DeleteAccess;
+	shareAccess->SharedRead	  += file->SharedRead;
+	shareAccess->SharedWrite  += file->SharedWrite;
+	shareAccess->SharedDelete += file->SharedDelete;
+}
+
+void IoRemoveShareAccess(FILE_OBJECT *file, SHARE_ACCESS *shareAccess)
+{
+	ASSERT(file);
+	ASSERT(shareAccess);
+
+	SimObject *const header = Header(file);
+
+	if((!file->ReadAccess && !file->WriteAccess && !file->DeleteAccess) || (header && (header->Flags & c_fileIgnoreShare)))
+	{
+		return;
+	}
+
+	ASSERT(shareAccess->OpenCount);
+
+	shareAccess->OpenCount--;
+	shareAccess->Readers	  -= file->ReadAccess;
+	shareAccess->Writers	  -= file->WriteAccess;
+	shareAccess->Deleters	  -= file->DeleteAccess;
+	shareAccess->SharedRead	  -= file->SharedRead;
+	shareAccess->SharedWrite  -= file->SharedWrite;
+	shareAccess->SharedDelete -= file->SharedDelete;
+}
+
+NTSTATUS IoCreateFileSpecifyDeviceObjectHint(HANDLE *handle,
+											 ACCESS_MASK access,
+											 OBJECT_ATTRIBUTES *attributes,
+											 IO_STATUS_BLOCK *status,
+											 LARGE_INTEGER *allocation,
+											 ULONG attribs,
+											 ULONG share,
+											 ULONG disposition,
+											 ULONG options,
+											 void *ea,
+											 ULONG eaLength,
+											 ULONG type,
+											 void *parameters,
+											 ULONG flags,
+											 void *hint)
+{
+	UNREFERENCED_PARAMETER(allocation);
+	UNREFERENCED_PARAMETER(ea);
+	UNREFERENCED_PARAMETER(eaLength);
+	UNREFERENCED_PARAMETER(type);
+	UNREFERENCED_PARAMETER(parameters);
+
+	ASSERT(attributes);
+	ASSERT(!attributes->RootDirectory);
+
+	WCHAR path[c_pathLength];
+
+	if(!CopyName(attributes->ObjectName, path, c_pathLength))
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	return Create(path,
+				  access,
+				  attribs,
+				  share,
+				  disposition,
+				  options,
+				  (attributes->Attributes & OBJ_CASE_INSENSITIVE) != 0,
+				  flags,
+				  KernelMode,
+				  (DEVICE_OBJECT*) hint,
+				  handle,
+				  status);
+}
+
+// MDLS ////
+
+MDL* IoAllocateMdl(void *address, ULONG length, BOOLEAN secondary, BOOLEAN quota, IRP *irp)
+{
+	UNREFERENCED_PARAMETER(quota);
+
+	MDL *const mdl = NewMdl(address, length, true);
+
+	if(irp)
+	{
+		if(secondary)
+		{
+			MDL **last = &irp->MdlAddress;
+
+			while(*last)
+			{
+				last = &(*last)->Next;
+			}
+
+			*last = mdl;
+		}
+		else
+		{
+			irp->MdlAddress = mdl;
+		}
+	}
+
+	return mdl;
+}
+
+void IoFreeMdl(MDL *mdl)
+{
+	CSimKernel::Free(mdl);
+}
+
+void MmBuildMdlForNonPagedPool(MDL *mdl)
+{
+	UNREFERENCED_PARAMETER(mdl);
+}
+
+void MmProbeAndLockPages(MDL *mdl, KPROCESSOR_MODE mode, LOCK_OPERATION operation)
+{
+	UNREFERENCED_PARAMETER(mdl);
+	UNREFERENCED_PARAMETER(mode);
+	UNREFERENCED_PARAMETER(operation);
+}
+
+void MmUnlockPages(MDL *mdl)
+{
+	UNREFERENCED_PARAMETER(mdl);
+}
+
+void MmPrepareMdlForReuse(MDL *mdl)
+{
+	UNREFERENCED_PARAMETER(mdl);
+}
+
+void ProbeForRead(void const* address, SIZE_T length, ULONG alignment)
+{
+	UNREFERENCED_PARAMETER(address);
+	UNREFERENCED_PARAMETER(length);
+	UNREFERENCED_PARAMETER(alignment);
+}
+
+void ProbeForWrite(void *address, SIZE_T length, ULONG alignment)
+{
+	UNREFERENCED_PARAMETER(address);
+	UNREFERENCED_PARAMETER(length);
+	UNREFERENCED_PARAMETER(alignment);
+}
+
+// FILE SYSTEM RUNTIME ////
+
+NTSTATUS FsRtlInsertPerStreamContext(PFSRTL_ADVANCED_FCB_HEADER header, PFSRTL_PER_STREAM_CONTEXT context)
+{
+	ASSERT(header);
+	ASSERT(context);
+
+	if(!(header->Flags2 & FSRTL_FLAG2_SUPPORTS_FILTER_CONTEXTS))
+	{
+		return STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	InsertHeadList(&header->FilterContexts, &context->Links);
+
+	return STATUS_SUCCESS;
+}
+
+PFSRTL_PER_STREAM_CONTEXT FsRtlLookupPerStreamContextInternal(PFSRTL_ADVANCED_FCB_HEADER header, void *owner, void *instance)
+{
+	ASSERT(header);
+
+	for(LIST_ENTRY *entry = header->FilterContexts.Flink; entry != &header->FilterContexts; entry = entry->Flink)
+	{
+		FSRTL_PER_STREAM_CONTEXT *const context = CONTAINING_RECORD(entry, FSRTL_PER_STREAM_CONTEXT, Links);
+
+		if((!owner || (context->OwnerId == owner)) && (!instance || (context->InstanceId == instance)))
+		{
+			return context;
+		}
+	}
+
+	return 0;
+}
+
+PFSRTL_PER_STREAM_CONTEXT FsRtlRemovePerStreamContext(PFSRTL_ADVANCED_FCB_HEADER header, void *owner, void *instance)
+{
+	FSRTL_PER_STREAM_CONTEXT *const context = FsRtlLookupPerStreamContextInternal(header, owner, instance);
+
+	if(context)
+	{
+		RemoveEntryList(&context->Links);
+	}
+
+	return context;
+}
+
+void FsRtlTeardownPerStreamContexts(PFSRTL_ADVANCED_FCB_HEADER header)
+{
+	ASSERT(header);
+
+	while(!IsListEmpty(&header->FilterContexts))
+	{
+		FSRTL_PER_STREAM_CONTEXT *const context = CONTAINING_RECORD(RemoveHeadList(&header->FilterContexts), FSRTL_PER_STREAM_CONTEXT, Links);
+
+		if(context->FreeCallback)
+		{
+			context->FreeCallback(context);
+		}
+	}
+}
+
+NTSTATUS FsRtlRegisterFileSystemFilterCallbacks(DRIVER_OBJECT *driver, FS_FILTER_CALLBACKS *callbacks)
+{
+	UNREFERENCED_PARAMETER(driver);
+	UNREFERENCED_PARAMETER(callbacks);
+
+	// The simulated file system never calls them, as it holds no section locks
+	return STATUS_SUCCESS;
+}
+
+void* MmGetSystemRoutineAddress(UNICODE_STRING *name)
+{
+	static SimRoutine const routines[] =
+	{
+		{ "FsRtlRegisterFileSystemFilterCallbacks",	(void*) &FsRtlRegisterFileSystemFilterCallbacks },
+		{ "FsRtlInsertPerStreamContext",			(void*) &FsRtlInsertPerStreamContext },
+		{ "FsRtlLookupPerStreamContextInternal",	(void*) &FsRtlLookupPerStreamContextInternal },
+		{ "FsRtlRemovePerStreamContext",			(void*) &FsRtlRemovePerStreamContext },
+		{ "IoAttachDeviceToDeviceStackSafe",		(void*) &IoAttachDeviceToDeviceStackSafe },
+		{ "IoEnumerateDeviceObjectList",			(void*) &IoEnumerateDeviceObjectList },
+		{ "IoGetLowerDeviceObject",					(void*) &IoGetLowerDeviceObject },
+		{ "IoGetDeviceAttachmentBaseRef",			(void*) &IoGetDeviceAttachmentBaseRef },
+		{ "IoGetDiskDeviceObject",					(void*) &IoGetDiskDeviceObject },
+		{ "IoGetAttachedDeviceReference",			(void*) &IoGetAttachedDeviceReference },
+		{ "RtlGetVersion",							(void*) &RtlGetVersion },
+	};
+
+	ASSERT(name);
+
+	for(ULONG index = 0; index < sizeof(routines) / sizeof(routines[0]); ++index)
+	{
+		char const* const routine = routines[index].Name;
+		ULONG const length		  = (ULONG) strlen(routine);
+
+		if(name->Length != length * sizeof(WCHAR))
+		{
+			continue;
+		}
+
+		ULONG pos = 0;
+
+		while((pos < length) && (name->Buffer[pos] == (WCHAR) routine[pos]))
+		{
+			pos++;
+		}
+
+		if(pos == length)
+		{
+			return routines[index].Routine;
+		}
+	}
+
+	return 0;
+}
+
+// REGISTRY ////
+
+static bool KeyPath(OBJECT_ATTRIBUTES *attributes, WCHAR *path)
+{
+	ASSERT(attributes);
+
+	path[0] = UNICODE_NULL;
+
+	if(attributes->RootDirectory)
+	{
+		SimHandle *const root = LookupHandle(attributes->RootDirectory, c_objectKey);
+
+		if(!root)
+		{
+			return false;
+		}
+
+		wcscpy(path, ((SimKey*) root->Object)->Path);
+	}
+
+	UNICODE_STRING const* name = attributes->ObjectName;
+
+	if(name && name->Length)
+	{
+		ULONG const length = (ULONG) wcslen(path);
+
+		if(length + 1 + name->Length / sizeof(WCHAR) >= c_pathLength)
+		{
+			return false;
+		}
+
+		if(length && (name->Buffer[0] != L'\\'))
+		{
+			wcscat(path, L"\\");
+		}
+
+		CopyName(name, path + wcslen(path), c_pathLength - (ULONG) wcslen(path));
+	}
+
+	// No trailing separators
+	for(ULONG length = (ULONG) wcslen(path); length && (path[length - 1] == L'\\'); --length)
+	{
+		path[length - 1] = UNICODE_NULL;
+	}
+
+	return true;
+}
+
+NTSTATUS ZwOpenKey(HANDLE *key, ACCESS_MASK access, OBJECT_ATTRIBUTES *attributes)
+{
+	UNREFERENCED_PARAMETER(access);
+
+	ASSERT(key);
+
+	WCHAR path[c_pathLength];
+
+	if(!KeyPath(attributes, path))
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	SimKey *const found = FindKey(path, false);
+
+	if(!found)
+	{
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	*key = InsertHandle(found, c_objectKey);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS ZwCreateKey(HANDLE *key, ACCESS_MASK access, OBJECT_ATTRIBUTES *attributes, ULONG index, UNICODE_STRING *type, ULONG options, ULONG *disposition)
+{
+	UNREFERENCED_PARAMETER(access);
+	UNREFERENCED_PARAMETER(index);
+	UNREFERENCED_PARAMETER(type);
+	UNREFERENCED_PARAMETER(options);
+
+	ASSERT(key);
+
+	WCHAR path[c_pathLength];
+
+	if(!KeyPath(attributes, path))
+	{
+		return STATUS_OBJECT_NAME_INVALID;
+	}
+
+	SimKey *found = FindKey(path, false);
+
+	if(disposition)
+	{
+		*disposition = found ? 2 : 1;		// REG_OPENED_EXISTING_KEY, REG_CREATED_NEW_KEY
+	}
+
+	if(!found)
+	{
+		found = FindKey(path, true);
+	}
+
+	*key = InsertHandle(found, c_objectKey);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS ZwQueryKey(HANDLE key, KEY_INFORMATION_CLASS type, void *information, ULONG length, ULONG *result)
+{
+	SimHandle *const entry = LookupHandle(key, c_objectKey);
+
+	if(!entry)
+	{
+		return STATUS_INVALID_HANDLE;
+	}
+
+	if(KeyFullInformation != type)
+	{
+		return STATUS_NOT_IMPLEMENTED;
+	}
+
+	if(result)
+	{
+		*result = sizeof(KEY_FULL_INFORMATION);
+	}
+
+	if(length < sizeof(KEY_FULL_INFORMATION))
+	{
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	SimKey *const found = (SimKey*) entry->Object;
+	ULONG const pathLength = (ULONG) wcslen(found->Path);
+
+	KEY_FULL_INFORMATION *const full = (KEY_FULL_INFORMATION*) information;
+	memset(full, 0, sizeof(KEY_FULL_INFORMATION));
+
+	full->Values = found->Count;
+
+	// Direct subkeys only
+	for(ULONG index = 0; index < c_keys; ++index)
+	{
+		LPCWSTR const path = s_keys[index].Path;
+
+		if((wcslen(path) > pathLength + 1) && !_wcsnicmp(path, found->Path, pathLength) && (path[pathLength] == L'\\'))
+		{
+			LPCWSTR rest = path + pathLength + 1;
+
+			while(*rest && (*rest != L'\\'))
+			{
+				rest++;
+			}
+
+			if(!*rest)
+			{
+				full->SubKeys++;
+			}
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS QueryValue(SimValue *value, KEY_VALUE_INFORMATION_CLASS type, void *information, ULONG length, ULONG *result)
+{
+	if(KeyValuePartialInformation == type)
+	{
+		ULONG const header = FIELD_OFFSET(KEY_VALUE_PARTIAL_INFORMATION, Data);
+
+		if(result)
+		{
+			*result = header + value->Size;
+		}
+
+		if(length < header)
+		{
+			return STATUS_BUFFER_TOO_SMALL;
+		}
+
+		KEY_VALUE_PARTIAL_INFORMATION *const partial = (KEY_VALUE_PARTIAL_INFORMATION*) information;
+
+		partial->TitleIndex = 0;
+		partial->Type		= value->Type;
+		partial->DataLength = value->Size;
+
+		if(length < header + value->Size)
+		{
+			return STATUS_BUFFER_OVERFLOW;
+		}
+
+		memcpy(partial->Data, value->Data, value->Size);
+
+		return STATUS_SUCCESS;
+	}
+
+	if(KeyValueBasicInformation == type)
+	{
+		ULONG const header	   = FIELD_OFFSET(KEY_VALUE_BASIC_INFORMATION, Name);
+		ULONG const nameLength = (ULONG) wcslen(value->Name) * sizeof(WCHAR);
+
+		if(result)
+		{
+			*result = header + nameLength;
+		}
+
+		if(length < header)
+		{
+			return STATUS_BUFFER_TOO_SMALL;
+		}
+
+		KEY_VALUE_BASIC_INFORMATION *const basic = (KEY_VALUE_BASIC_INFORMATION*) information;
+
+		basic->TitleIndex = 0;
+		basic->Type		  = value->Type;
+		basic->NameLength = nameLength;
+
+		if(length < header + nameLength)
+		{
+			return STATUS_BUFFER_OVERFLOW;
+		}
+
+		memcpy(basic->Name, value->Name, nameLength);
+
+		return STATUS_SUCCESS;
+	}
+
+	return STATUS_NOT_IMPLEMENTED;
+}
+
+NTSTATUS ZwQueryValueKey(HANDLE key, UNICODE_STRING *name, KEY_VALUE_INFORMATION_CLASS type, void *information, ULONG length, ULONG *result)
+{
+	ASSERT(name);
+
+	SimHandle *const entry = LookupHandle(key, c_objectKey);
+
+	if(!entry)
+	{
+		return STATUS_INVALID_HANDLE;
+	}
+
+	SimValue *const value = FindValue((SimKey*) entry->Object, name->Buffer, name->Length / sizeof(WCHAR));
+
+	if(!value)
+	{
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	return QueryValue(value, type, information, length, result);
+}
+
+NTSTATUS ZwEnumerateValueKey(HANDLE key, ULONG index, KEY_VALUE_INFORMATION_CLASS type, void *information, ULONG length, ULONG *result)
+{
+	SimHandle *const entry = LookupHandle(key, c_objectKey);
+
+	if(!entry)
+	{
+		return STATUS_INVALID_HANDLE;
+	}
+
+	SimKey *const found = (SimKey*) entry->Object;
+
+	if(index >= found->Count)
+	{
+		return STATUS_NO_MORE_ENTRIES;
+	}
+
+	return QueryValue(&found->Values[index], type, information, length, result);
+}
+
+NTSTATUS ZwSetValueKey(HANDLE key, UNICODE_STRING *name, ULONG index, ULONG type, void *data, ULONG size)
+{
+	UNREFERENCED_PARAMETER(index);
+
+	ASSERT(name);
+
+	SimHandle *const entry = LookupHandle(key, c_objectKey);
+
+	if(!entry)
+	{
+		return STATUS_INVALID_HANDLE;
+	}
+
+	return SetValue((SimKey*) entry->Object, name->Buffer, name->Length / sizeof(WCHAR), type, data, size);
+}
+
+NTSTATUS ZwDeleteValueKey(HANDLE key, UNICODE_STRING *name)
+{
+	ASSERT(name);
+
+	SimHandle *const entry = LookupHandle(key, c_objectKey);
+
+	if(!entry)
+	{
+		return STATUS_INVALID_HANDLE;
+	}
+
+	SimKey *const found	  = (SimKey*) entry->Object;
+	SimValue *const value = FindValue(found, name->Buffer, name->Length / sizeof(WCHAR));
+
+	if(!value)
+	{
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	ULONG const index = (ULONG) (value - found->Values);
+
+	memmove(value, value + 1, (found->Count - index - 1) * sizeof(SimValue));
+	found->Count--;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS ZwFlushKey(HANDLE key)
+{
+	return LookupHandle(key, c_objectKey) ? STATUS_SUCCESS : STATUS_INVALID_HANDLE;
+}
+
+NTSTATUS ZwOpenSymbolicLinkObject(HANDLE *link, ACCESS_MASK access, OBJECT_ATTRIBUTES *attributes)
+{
+	UNREFERENCED_PARAMETER(access);
+
+	ASSERT(link);
+	ASSERT(attributes);
+
+	SimLink *const found = FindLink(attributes->ObjectName);
+
+	if(!found)
+	{
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	*link = InsertHandle(found, c_objectLink);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS ZwQuerySymbolicLinkObject(HANDLE link, UNICODE_STRING *target, ULONG *length)
+{
+	ASSERT(target);
+
+	SimHandle *const entry = LookupHandle(link, c_objectLink);
+
+	if(!entry)
+	{
+		return STATUS_INVALID_HANDLE;
+	}
+
+	LPCWSTR const resolved = ((SimLink*) entry->Object)->Target;
+	ULONG const size	   = (ULONG) wcslen(resolved) * sizeof(WCHAR);
+
+	if(length)
+	{
+		*length = size;
+	}
+
+	if(target->MaximumLength < size)
+	{
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	memcpy(target->Buffer, resolved, size);
+	target->Length = (USHORT) size;
+
+	if(size + sizeof(WCHAR) <= target->MaximumLength)
+	{
+		target->Buffer[size / sizeof(WCHAR)] = UNICODE_NULL;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS ZwClose(HANDLE handle)
+{
+	SimHandle *const entry = LookupHandle(handle);
+
+	if(!entry)
+	{
+		return STATUS_INVALID_HANDLE;
+	}
+
+	void *const object = entry->Object;
+	ULONG const type   = entry->Type;
+
+	entry->Object = 0;
+	entry->Type	  = c_objectNone;
+
+	if(c_objectEvent == type)
+	{
+		ObDereferenceObject(object);
+	}
+	else if((c_objectFile == type) || (c_objectThread == type))
+	{
+		SimObject *const header = Header(object);
+		ASSERT(header);
+
+		// Last handle of a file, the file system drops its share access and the cache
+		if(!--header->Handles && (c_objectFile == type))
+		{
+			FILE_OBJECT *const file = (FILE_OBJECT*) object;
+
+			CloseFile(file, CSimKernel::RelatedDevice(file), IRP_MJ_CLEANUP);
+
+			header->Flags |= c_fileCleaned;
+			file->Flags	  |= FO_CLEANUP_COMPLETE;
+		}
+
+		ObDereferenceObject(object);
+	}
+
+	return STATUS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
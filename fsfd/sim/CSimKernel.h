@@ -0,0 +1,521 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CSimKernel.h: interface for the CSimKernel class and the kernel calls it stands in for.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CSimKernel_H__3E8A51C7_0F2D_4B96_A4C3_61D7E90B52F8__INCLUDED_)
+#define AFX_CSimKernel_H__3E8A51C7_0F2D_4B96_A4C3_61D7E90B52F8__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CSimKernel
+{
+	// Kernel of the replay harness. Runs the driver's classes on a single thread, so locks only check
+	// their use and waits never block: an unsignaled wait first runs queued work items, then either times
+	// out by advancing the clock or reports a deadlock. System threads are created terminated, so workers
+	// of the driver never run, unless s_threads is set. They then run as coroutines on the same thread,
+	// started and resumed from Run whenever their wait is satisfied or has timed out. The tick count and
+	// the system time are virtual and only advance when told, which keeps replays deterministic. Requests
+	// sent down with IoCallDriver are completed synchronously by the device's MajorFunction, see
+	// CSimFileSystem.
+	//
+	// Allocations made by the driver are counted. Those of the I/O manager side below, the file system and
+	// the replayer are not, so the counters show what the driver itself costs per request.
+
+public:
+
+	enum c_constants
+	{
+		c_tickIncrement		= 156250,				// 100ns units per tick, as on most machines
+		c_irpStackSize		= 8,
+		c_devices			= 128,
+		c_drivers			= 8,
+		c_handles			= 1024,
+		c_processes			= 64,
+		c_nameLength		= 128,					// characters of object names
+		c_systemProcess		= 4,
+	};
+
+	struct Counters
+	{
+		ULONG			Allocations;				// pool, IRPs, MDLs and devices
+		ULONG			Frees;
+		ULONGLONG		AllocatedBytes;
+		LONG			Outstanding;				// not freed yet
+		ULONG			Lookaside;					// served from a lookaside list, no pool involved
+		ULONG			Irps;						// allocated by the driver
+		ULONG			Waits;						// on events, semaphores and threads
+		ULONG			LockAcquisitions;			// resources and fast mutexes
+	};
+
+	static void					Init();
+	static void					Close();
+
+	static void					Advance(LONGLONG time);		// 100ns units
+	static LONGLONG				Now();
+
+	static Counters const&		Statistics();
+	static void					Reset();
+
+								// Requests that follow are issued by this process, created on first use
+	static void					SetProcess(ULONG process, LUID const* luid = 0);
+	static ULONG				Process();
+
+	static void					SetRegistry(LPCWSTR key, LPCWSTR name, ULONG type, void const* data, ULONG size);
+
+								// Objects of the file system and the replayer
+	static DRIVER_OBJECT*		CreateDriver(LPCWSTR name);
+	static DEVICE_OBJECT*		CreateDevice(DRIVER_OBJECT *driver, LPCWSTR name, ULONG extensionSize, ULONG type, ULONG characteristics);
+	static void					RegisterFileSystem(DEVICE_OBJECT *control);
+	static DEVICE_OBJECT*		RelatedDevice(FILE_OBJECT *file);
+	static HANDLE				CreateEvent(EVENT_TYPE type);	// as a client passes to the driver, closed with ZwClose
+
+								// I/O manager side of user mode requests on handles
+	static NTSTATUS				Open(LPCWSTR path, ACCESS_MASK access, ULONG share, ULONG disposition, ULONG options, HANDLE *handle, ULONG_PTR *information = 0);
+	static NTSTATUS				ReadWrite(HANDLE handle, UCHAR major, LONGLONG offset, void *buffer, ULONG length, ULONG_PTR *information = 0);
+	static NTSTATUS				Information(HANDLE handle, UCHAR major, ULONG type, void *buffer, ULONG length);
+	static NTSTATUS				Flush(HANDLE handle);
+	static NTSTATUS				Control(HANDLE handle, ULONG code, void *input, ULONG inputLength, void *output, ULONG outputLength, ULONG_PTR *information = 0);
+
+								// Paging I/O, as the cache manager issues it
+	static NTSTATUS				Page(FILE_OBJECT *file, UCHAR major, LONGLONG offset, void *buffer, ULONG length, ULONG_PTR *information = 0);
+	static void					DeferDereference(FILE_OBJECT *file);
+
+	static void*				Allocate(SIZE_T size, bool count = true);
+	static void					Free(void *memory);
+
+	static void					Run();						// queued work items, deferred dereferences and system threads
+
+								// Requests that follow run on this processor
+	static void					SetProcessor(ULONG processor);
+
+								// DATA
+	static ULONG				s_verbose;
+	static bool					s_threads;					// system threads run
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// MEMORY ////
+
+void*		ExAllocatePoolWithTag(POOL_TYPE type, SIZE_T size, ULONG tag);
+void		ExFreePool(void *memory);
+void		ExFreePoolWithTag(void *memory, ULONG tag);
+
+#define ExAllocatePool(type, size) ExAllocatePoolWithTag((type), (size), FILF_POOL_TAG)
+
+void		ExInitializeNPagedLookasideList(NPAGED_LOOKASIDE_LIST *list, void *allocate, void *free, ULONG flags, SIZE_T size, ULONG tag, USHORT depth);
+void		ExDeleteNPagedLookasideList(NPAGED_LOOKASIDE_LIST *list);
+void*		ExAllocateFromNPagedLookasideList(NPAGED_LOOKASIDE_LIST *list);
+void		ExFreeToNPagedLookasideList(NPAGED_LOOKASIDE_LIST *list, void *entry);
+
+#define RtlZeroMemory(target, size)			memset((target), 0, (size))
+#define RtlFillMemory(target, size, fill)	memset((target), (fill), (size))
+#define RtlCopyMemory(target, source, size)	memcpy((target), (source), (size))
+#define RtlMoveMemory(target, source, size)	memmove((target), (source), (size))
+#define RtlEqualMemory(a, b, size)			(!memcmp((a), (b), (size)))
+
+SIZE_T		RtlCompareMemory(void const* a, void const* b, SIZE_T size);
+
+// LISTS ////
+
+inline void InitializeListHead(LIST_ENTRY *head)
+{
+	head->Flink = head->Blink = head;
+}
+
+inline bool IsListEmpty(LIST_ENTRY const* head)
+{
+	return head->Flink == head;
+}
+
+inline BOOLEAN RemoveEntryList(LIST_ENTRY *entry)
+{
+	LIST_ENTRY *const next = entry->Flink;
+	LIST_ENTRY *const prev = entry->Blink;
+
+	prev->Flink = next;
+	next->Blink = prev;
+
+	return next == prev;
+}
+
+inline LIST_ENTRY* RemoveHeadList(LIST_ENTRY *head)
+{
+	LIST_ENTRY *const entry = head->Flink;
+	RemoveEntryList(entry);
+
+	return entry;
+}
+
+inline LIST_ENTRY* RemoveTailList(LIST_ENTRY *head)
+{
+	LIST_ENTRY *const entry = head->Blink;
+	RemoveEntryList(entry);
+
+	return entry;
+}
+
+inline void InsertTailList(LIST_ENTRY *head, LIST_ENTRY *entry)
+{
+	LIST_ENTRY *const prev = head->Blink;
+
+	entry->Flink = head;
+	entry->Blink = prev;
+	prev->Flink	 = entry;
+	head->Blink	 = entry;
+}
+
+inline void InsertHeadList(LIST_ENTRY *head, LIST_ENTRY *entry)
+{
+	LIST_ENTRY *const next = head->Flink;
+
+	entry->Flink = next;
+	entry->Blink = head;
+	next->Blink	 = entry;
+	head->Flink	 = entry;
+}
+
+LIST_ENTRY*	ExInterlockedInsertTailList(LIST_ENTRY *head, LIST_ENTRY *entry, KSPIN_LOCK *lock);
+LIST_ENTRY*	ExInterlockedRemoveHeadList(LIST_ENTRY *head, KSPIN_LOCK *lock);
+
+// INTERLOCKED ////
+
+#define InterlockedIncrement(target)					__sync_add_and_fetch((target), 1)
+#define InterlockedDecrement(target)					__sync_sub_and_fetch((target), 1)
+#define InterlockedExchange(target, value)				__sync_lock_test_and_set((target), (value))
+#define InterlockedExchangeAdd(target, value)			__sync_fetch_and_add((target), (value))
+#define InterlockedCompareExchange(target, value, comparand)	__sync_val_compare_and_swap((target), (comparand), (value))
+#define InterlockedCompareExchange64(target, value, comparand)	__sync_val_compare_and_swap((target), (comparand), (value))
+#define InterlockedCompareExchangePointer(target, value, comparand) \
+	((void*) __sync_val_compare_and_swap((void**) (target), (void*) (comparand), (void*) (value)))
+#define InterlockedOr(target, value)					__sync_fetch_and_or((target), (value))
+#define InterlockedAnd(target, value)					__sync_fetch_and_and((target), (value))
+
+inline void ExInterlockedAddLargeStatistic(LARGE_INTEGER *target, ULONG value)
+{
+	__sync_fetch_and_add(&target->QuadPart, (LONGLONG) value);
+}
+
+// SYNCHRONIZATION ////
+
+void		KeInitializeSpinLock(KSPIN_LOCK *lock);
+void		KeAcquireSpinLock(KSPIN_LOCK *lock, KIRQL *irql);
+void		KeReleaseSpinLock(KSPIN_LOCK *lock, KIRQL irql);
+
+void		ExInitializeFastMutex(FAST_MUTEX *mutex);
+void		ExAcquireFastMutex(FAST_MUTEX *mutex);
+void		ExReleaseFastMutex(FAST_MUTEX *mutex);
+
+NTSTATUS	ExInitializeResourceLite(ERESOURCE *resource);
+NTSTATUS	ExDeleteResourceLite(ERESOURCE *resource);
+BOOLEAN		ExAcquireResourceExclusiveLite(ERESOURCE *resource, BOOLEAN wait);
+BOOLEAN		ExAcquireResourceSharedLite(ERESOURCE *resource, BOOLEAN wait);
+BOOLEAN		ExAcquireSharedStarveExclusive(ERESOURCE *resource, BOOLEAN wait);
+BOOLEAN		ExAcquireSharedWaitForExclusive(ERESOURCE *resource, BOOLEAN wait);
+void		ExReleaseResourceLite(ERESOURCE *resource);
+BOOLEAN		ExIsResourceAcquiredExclusiveLite(ERESOURCE *resource);
+ULONG		ExIsResourceAcquiredSharedLite(ERESOURCE *resource);
+
+#define FsRtlEnterFileSystem()
+#define FsRtlExitFileSystem()
+#define KeEnterCriticalRegion()
+#define KeLeaveCriticalRegion()
+
+void		KeInitializeEvent(KEVENT *event, EVENT_TYPE type, BOOLEAN state);
+LONG		KeSetEvent(KEVENT *event, LONG increment, BOOLEAN wait);
+void		KeClearEvent(KEVENT *event);
+LONG		KeResetEvent(KEVENT *event);
+LONG		KeReadStateEvent(KEVENT *event);
+
+void		KeInitializeSemaphore(KSEMAPHORE *semaphore, LONG count, LONG limit);
+LONG		KeReleaseSemaphore(KSEMAPHORE *semaphore, LONG increment, LONG adjustment, BOOLEAN wait);
+
+NTSTATUS	KeWaitForSingleObject(void *object, KWAIT_REASON reason, KPROCESSOR_MODE mode, BOOLEAN alertable, LARGE_INTEGER *timeout);
+NTSTATUS	KeWaitForMultipleObjects(ULONG count, void *objects[], ULONG type, KWAIT_REASON reason, KPROCESSOR_MODE mode, BOOLEAN alertable, LARGE_INTEGER *timeout, void *waitBlocks);
+NTSTATUS	KeDelayExecutionThread(KPROCESSOR_MODE mode, BOOLEAN alertable, LARGE_INTEGER *interval);
+
+#define WaitAll		0
+#define WaitAny		1
+
+extern POBJECT_TYPE *ExEventObjectType;
+extern POBJECT_TYPE *ExSemaphoreObjectType;
+extern POBJECT_TYPE *IoFileObjectType;
+extern POBJECT_TYPE *PsThreadType;
+
+// TIME, PROCESSORS, THREADS ////
+
+void		KeQueryTickCount(LARGE_INTEGER *count);
+ULONG		KeQueryTimeIncrement();
+void		KeQuerySystemTime(LARGE_INTEGER *time);
+ULONGLONG	KeQueryInterruptTime();
+LARGE_INTEGER KeQueryPerformanceCounter(LARGE_INTEGER *frequency);
+
+KIRQL		KeGetCurrentIrql();
+ULONG		KeGetCurrentProcessorNumber();
+PKTHREAD	KeGetCurrentThread();
+LONG		KeSetPriorityThread(PKTHREAD thread, LONG priority);
+
+extern CCHAR KeNumberProcessors;
+
+PEPROCESS	PsGetCurrentProcess();
+HANDLE		PsGetCurrentProcessId();
+PETHREAD	PsGetCurrentThread();
+HANDLE		PsGetCurrentThreadId();
+BOOLEAN		PsGetVersion(ULONG *major, ULONG *minor, ULONG *build, UNICODE_STRING *csd);
+NTSTATUS	PsCreateSystemThread(HANDLE *thread, ULONG access, OBJECT_ATTRIBUTES *attributes, HANDLE process, void *client, PKSTART_ROUTINE routine, void *context);
+NTSTATUS	PsTerminateSystemThread(NTSTATUS status);
+NTSTATUS	PsSetCreateProcessNotifyRoutine(PCREATE_PROCESS_NOTIFY_ROUTINE routine, BOOLEAN remove);
+NTSTATUS	PsSetLoadImageNotifyRoutine(PLOAD_IMAGE_NOTIFY_ROUTINE routine);
+NTSTATUS	PsRemoveLoadImageNotifyRoutine(PLOAD_IMAGE_NOTIFY_ROUTINE routine);
+PACCESS_TOKEN PsReferencePrimaryToken(PEPROCESS process);
+void		PsDereferencePrimaryToken(PACCESS_TOKEN token);
+
+extern "C" NTSTATUS PsSetCreateProcessNotifyRoutineMustSuccess(PCREATE_PROCESS_NOTIFY_ROUTINE routine, BOOLEAN remove);
+
+NTSTATUS	RtlGetVersion(RTL_OSVERSIONINFOW *version);
+
+void		ExQueueWorkItem(WORK_QUEUE_ITEM *item, WORK_QUEUE_TYPE type);
+
+#define ExInitializeWorkItem(item, routine, context) \
+	{ (item)->WorkerRoutine = (routine); (item)->Parameter = (context); (item)->List.Flink = 0; }
+
+void		IoGetStackLimits(ULONG_PTR *low, ULONG_PTR *high);
+ULONG_PTR	IoGetRemainingStackSize();
+IRP*		IoGetTopLevelIrp();
+void		IoSetTopLevelIrp(IRP *irp);
+BOOLEAN		IoIs32bitProcess(IRP *irp);
+ULONG		IoGetRequestorProcessId(IRP *irp);
+
+// SECURITY ////
+
+void		SeCaptureSubjectContext(SECURITY_SUBJECT_CONTEXT *context);
+void		SeReleaseSubjectContext(SECURITY_SUBJECT_CONTEXT *context);
+void		SeLockSubjectContext(SECURITY_SUBJECT_CONTEXT *context);
+void		SeUnlockSubjectContext(SECURITY_SUBJECT_CONTEXT *context);
+NTSTATUS	SeQueryAuthenticationIdToken(PACCESS_TOKEN token, LUID *luid);
+NTSTATUS	SeQueryInformationToken(PACCESS_TOKEN token, TOKEN_INFORMATION_CLASS type, void **information);
+NTSTATUS	SeMarkLogonSessionForTerminationNotification(LUID *luid);
+NTSTATUS	SeRegisterLogonSessionTerminatedRoutine(NTSTATUS (*routine)(LUID*));
+NTSTATUS	SeUnregisterLogonSessionTerminatedRoutine(NTSTATUS (*routine)(LUID*));
+
+#define SeQuerySubjectContextToken(context) \
+	(((context)->ClientToken) ? (context)->ClientToken : (context)->PrimaryToken)
+
+// OBJECTS ////
+
+void		ObReferenceObject(void *object);
+void		ObDereferenceObject(void *object);
+#define		ObDereferenceObjectDeferDelete(object) ObDereferenceObject(object)
+NTSTATUS	ObReferenceObjectByHandle(HANDLE handle, ACCESS_MASK access, void *type, KPROCESSOR_MODE mode, void **object, void *information);
+NTSTATUS	ObQueryNameString(void *object, OBJECT_NAME_INFORMATION *name, ULONG length, ULONG *returned);
+
+// STRINGS ////
+
+void		RtlInitUnicodeString(UNICODE_STRING *target, LPCWSTR source);
+void		RtlCopyUnicodeString(UNICODE_STRING *target, UNICODE_STRING const* source);
+NTSTATUS	RtlAppendUnicodeStringToString(UNICODE_STRING *target, UNICODE_STRING const* source);
+NTSTATUS	RtlAppendUnicodeToString(UNICODE_STRING *target, LPCWSTR source);
+BOOLEAN		RtlEqualUnicodeString(UNICODE_STRING const* a, UNICODE_STRING const* b, BOOLEAN caseInsensitive);
+LONG		RtlCompareUnicodeString(UNICODE_STRING const* a, UNICODE_STRING const* b, BOOLEAN caseInsensitive);
+WCHAR		RtlUpcaseUnicodeChar(WCHAR wc);
+NTSTATUS	RtlVolumeDeviceToDosName(void *device, UNICODE_STRING *name);
+
+BOOLEAN		FsRtlDoesNameContainWildCards(UNICODE_STRING *name);
+BOOLEAN		FsRtlIsNameInExpression(UNICODE_STRING *expression, UNICODE_STRING *name, BOOLEAN ignoreCase, WCHAR *upcaseTable);
+
+// 16 bit wide strings, the C library ones use 32 bit characters
+#define wcslen		SimWcslen
+#define wcscpy		SimWcscpy
+#define wcscat		SimWcscat
+#define _wcsnicmp	SimWcsnicmp
+
+size_t		SimWcslen(wchar_t const* s);
+wchar_t*	SimWcscpy(wchar_t *target, wchar_t const* source);
+wchar_t*	SimWcscat(wchar_t *target, wchar_t const* source);
+int			SimWcsnicmp(wchar_t const* a, wchar_t const* b, size_t count);
+
+// DEVICES AND IRPS ////
+
+NTSTATUS	IoCreateDevice(DRIVER_OBJECT *driver, ULONG extensionSize, UNICODE_STRING *name, ULONG type, ULONG characteristics, BOOLEAN exclusive, DEVICE_OBJECT **device);
+void		IoDeleteDevice(DEVICE_OBJECT *device);
+NTSTATUS	IoAttachDeviceToDeviceStackSafe(DEVICE_OBJECT *source, DEVICE_OBJECT *target, DEVICE_OBJECT **attached);
+DEVICE_OBJECT* IoAttachDeviceToDeviceStack(DEVICE_OBJECT *source, DEVICE_OBJECT *target);
+void		IoDetachDevice(DEVICE_OBJECT *target);
+DEVICE_OBJECT* IoGetAttachedDeviceReference(DEVICE_OBJECT *device);
+DEVICE_OBJECT* IoGetDeviceAttachmentBaseRef(DEVICE_OBJECT *device);
+DEVICE_OBJECT* IoGetLowerDeviceObject(DEVICE_OBJECT *device);
+NTSTATUS	IoGetDiskDeviceObject(DEVICE_OBJECT *device, DEVICE_OBJECT **disk);
+NTSTATUS	IoGetDeviceObjectPointer(UNICODE_STRING *name, ACCESS_MASK access, FILE_OBJECT **file, DEVICE_OBJECT **device);
+NTSTATUS	IoEnumerateDeviceObjectList(DRIVER_OBJECT *driver, DEVICE_OBJECT **list, ULONG size, ULONG *count);
+NTSTATUS	IoRegisterFsRegistrationChange(DRIVER_OBJECT *driver, void (*routine)(DEVICE_OBJECT*, BOOLEAN));
+void		IoUnregisterFsRegistrationChange(DRIVER_OBJECT *driver, void (*routine)(DEVICE_OBJECT*, BOOLEAN));
+NTSTATUS	IoRegisterShutdownNotification(DEVICE_OBJECT *device);
+void		IoUnregisterShutdownNotification(DEVICE_OBJECT *device);
+NTSTATUS	IoCreateSymbolicLink(UNICODE_STRING *link, UNICODE_STRING *target);
+NTSTATUS	IoDeleteSymbolicLink(UNICODE_STRING *link);
+
+IRP*		IoAllocateIrp(CCHAR stackSize, BOOLEAN quota);
+void		IoFreeIrp(IRP *irp);
+void		IoReuseIrp(IRP *irp, NTSTATUS status);
+IRP*		IoBuildDeviceIoControlRequest(ULONG code, DEVICE_OBJECT *device, void *input, ULONG inputLength, void *output, ULONG outputLength, BOOLEAN internal, KEVENT *event, IO_STATUS_BLOCK *status);
+NTSTATUS	IoCallDriver(DEVICE_OBJECT *device, IRP *irp);
+void		IoCompleteRequest(IRP *irp, CCHAR increment);
+void		IoCancelFileOpen(DEVICE_OBJECT *device, FILE_OBJECT *file);
+
+PDRIVER_CANCEL IoSetCancelRoutine(IRP *irp, PDRIVER_CANCEL routine);
+void		IoAcquireCancelSpinLock(KIRQL *irql);
+void		IoReleaseCancelSpinLock(KIRQL irql);
+BOOLEAN		IoCancelIrp(IRP *irp);
+
+FILE_OBJECT* IoCreateStreamFileObjectLite(FILE_OBJECT *file, DEVICE_OBJECT *device);
+NTSTATUS	IoCreateFileSpecifyDeviceObjectHint(HANDLE *handle, ACCESS_MASK access, OBJECT_ATTRIBUTES *attributes, IO_STATUS_BLOCK *status, LARGE_INTEGER *allocation, ULONG attribs, ULONG share, ULONG disposition, ULONG options, void *ea, ULONG eaLength, ULONG type, void *parameters, ULONG flags, void *hint);
+
+typedef struct _SHARE_ACCESS
+{
+	ULONG		OpenCount;
+	ULONG		Readers;
+	ULONG		Writers;
+	ULONG		Deleters;
+	ULONG		SharedRead;
+	ULONG		SharedWrite;
+	ULONG		SharedDelete;
+} SHARE_ACCESS, *PSHARE_ACCESS;
+
+NTSTATUS	IoCheckShareAccess(ACCESS_MASK access, ULONG share, FILE_OBJECT *file, SHARE_ACCESS *shareAccess, BOOLEAN update);
+void		IoSetShareAccess(ACCESS_MASK access, ULONG share, FILE_OBJECT *file, SHARE_ACCESS *shareAccess);
+void		IoRemoveShareAccess(FILE_OBJECT *file, SHARE_ACCESS *shareAccess);
+
+#define CreateFileTypeNone				0
+#define IO_FORCE_ACCESS_CHECK			0x0001
+#define IO_OPEN_TARGET_DIRECTORY		0x0004
+#define IO_NO_PARAMETER_CHECKING		0x0100
+#define IO_IGNORE_SHARE_ACCESS_CHECK	0x0800
+
+inline IO_STACK_LOCATION* IoGetCurrentIrpStackLocation(IRP *irp)
+{
+	return irp->Tail.Overlay.CurrentStackLocation;
+}
+
+inline IO_STACK_LOCATION* IoGetNextIrpStackLocation(IRP *irp)
+{
+	return irp->Tail.Overlay.CurrentStackLocation - 1;
+}
+
+inline void IoSkipCurrentIrpStackLocation(IRP *irp)
+{
+	irp->CurrentLocation++;
+	irp->Tail.Overlay.CurrentStackLocation++;
+}
+
+inline void IoSetNextIrpStackLocation(IRP *irp)
+{
+	irp->CurrentLocation--;
+	irp->Tail.Overlay.CurrentStackLocation--;
+}
+
+inline void IoCopyCurrentIrpStackLocationToNext(IRP *irp)
+{
+	IO_STACK_LOCATION *const current = IoGetCurrentIrpStackLocation(irp);
+	IO_STACK_LOCATION *const next	 = IoGetNextIrpStackLocation(irp);
+
+	memcpy(next, current, FIELD_OFFSET(IO_STACK_LOCATION, CompletionRoutine));
+	next->Control = 0;
+}
+
+inline void IoSetCompletionRoutine(IRP *irp, PIO_COMPLETION_ROUTINE routine, void *context, BOOLEAN success, BOOLEAN error, BOOLEAN cancel)
+{
+	IO_STACK_LOCATION *const next = IoGetNextIrpStackLocation(irp);
+
+	next->CompletionRoutine = routine;
+	next->Context			= context;
+	next->Control			= 0;
+
+	if(success)
+	{
+		next->Control |= SL_INVOKE_ON_SUCCESS;
+	}
+	if(error)
+	{
+		next->Control |= SL_INVOKE_ON_ERROR;
+	}
+	if(cancel)
+	{
+		next->Control |= SL_INVOKE_ON_CANCEL;
+	}
+}
+
+inline void IoMarkIrpPending(IRP *irp)
+{
+	IoGetCurrentIrpStackLocation(irp)->Control |= SL_PENDING_RETURNED;
+}
+
+// MDLS ////
+
+MDL*		IoAllocateMdl(void *address, ULONG length, BOOLEAN secondary, BOOLEAN quota, IRP *irp);
+void		IoFreeMdl(MDL *mdl);
+void		MmBuildMdlForNonPagedPool(MDL *mdl);
+void		MmProbeAndLockPages(MDL *mdl, KPROCESSOR_MODE mode, LOCK_OPERATION operation);
+void		MmUnlockPages(MDL *mdl);
+void		MmPrepareMdlForReuse(MDL *mdl);
+void*		MmGetSystemRoutineAddress(UNICODE_STRING *name);
+
+#define MmInitializeMdl(mdl, address, length) \
+	{ memset((mdl), 0, sizeof(MDL)); (mdl)->StartVa = (address); (mdl)->MappedSystemVa = (address); (mdl)->ByteCount = (length); }
+#define MmGetMdlVirtualAddress(mdl)				((mdl)->StartVa)
+#define MmGetSystemAddressForMdlSafe(mdl, prio)	((mdl)->MappedSystemVa)
+#define MmGetMdlByteCount(mdl)					((mdl)->ByteCount)
+
+void		ProbeForRead(void const* address, SIZE_T length, ULONG alignment);
+void		ProbeForWrite(void *address, SIZE_T length, ULONG alignment);
+
+// CACHE MANAGER AND FILE SYSTEM RUNTIME ////
+
+BOOLEAN		CcIsFileCached(FILE_OBJECT *file);
+void		CcFlushCache(SECTION_OBJECT_POINTERS *section, LARGE_INTEGER *offset, ULONG length, IO_STATUS_BLOCK *status);
+BOOLEAN		CcPurgeCacheSection(SECTION_OBJECT_POINTERS *section, LARGE_INTEGER *offset, ULONG length, BOOLEAN uninitialize);
+void		CcSetFileSizes(FILE_OBJECT *file, CC_FILE_SIZES *sizes);
+LARGE_INTEGER* CcGetFileSizePointer(FILE_OBJECT *file);
+void		CcSetAdditionalCacheAttributes(FILE_OBJECT *file, BOOLEAN disableReadAhead, BOOLEAN disableWriteBehind);
+BOOLEAN		CcZeroData(FILE_OBJECT *file, LARGE_INTEGER *start, LARGE_INTEGER *end, BOOLEAN wait);
+BOOLEAN		MmFlushImageSection(SECTION_OBJECT_POINTERS *section, ULONG type);
+BOOLEAN		MmForceSectionClosed(SECTION_OBJECT_POINTERS *section, BOOLEAN delete_);
+
+enum _MMFLUSH_TYPE { MmFlushForDelete, MmFlushForWrite };
+
+NTSTATUS	FsRtlInsertPerStreamContext(PFSRTL_ADVANCED_FCB_HEADER header, PFSRTL_PER_STREAM_CONTEXT context);
+PFSRTL_PER_STREAM_CONTEXT FsRtlLookupPerStreamContextInternal(PFSRTL_ADVANCED_FCB_HEADER header, void *owner, void *instance);
+PFSRTL_PER_STREAM_CONTEXT FsRtlRemovePerStreamContext(PFSRTL_ADVANCED_FCB_HEADER header, void *owner, void *instance);
+
+void		FsRtlTeardownPerStreamContexts(PFSRTL_ADVANCED_FCB_HEADER header);
+
+#define FsRtlGetPerStreamContextPointer(file) ((PFSRTL_ADVANCED_FCB_HEADER) (file)->FsContext)
+
+NTSTATUS	FsRtlRegisterFileSystemFilterCallbacks(DRIVER_OBJECT *driver, FS_FILTER_CALLBACKS *callbacks);
+NTSTATUS	FsRtlRegisterUncProviderEx(HANDLE *handle, UNICODE_STRING *name, DEVICE_OBJECT *device, ULONG flags);
+NTSTATUS	FsRtlMupGetProviderIdFromName(UNICODE_STRING *name, ULONG *provider);
+NTSTATUS	FsRtlMupGetProviderInfoFromFileObject(FILE_OBJECT *file, ULONG level, void *buffer, ULONG *bufferSize);
+
+// REGISTRY ////
+
+NTSTATUS	ZwOpenKey(HANDLE *key, ACCESS_MASK access, OBJECT_ATTRIBUTES *attributes);
+NTSTATUS	ZwCreateKey(HANDLE *key, ACCESS_MASK access, OBJECT_ATTRIBUTES *attributes, ULONG index, UNICODE_STRING *type, ULONG options, ULONG *disposition);
+NTSTATUS	ZwQueryKey(HANDLE key, KEY_INFORMATION_CLASS type, void *information, ULONG length, ULONG *result);
+NTSTATUS	ZwQueryValueKey(HANDLE key, UNICODE_STRING *name, KEY_VALUE_INFORMATION_CLASS type, void *information, ULONG length, ULONG *result);
+NTSTATUS	ZwEnumerateValueKey(HANDLE key, ULONG index, KEY_VALUE_INFORMATION_CLASS type, void *information, ULONG length, ULONG *result);
+NTSTATUS	ZwSetValueKey(HANDLE key, UNICODE_STRING *name, ULONG index, ULONG type, void *data, ULONG size);
+NTSTATUS	ZwDeleteValueKey(HANDLE key, UNICODE_STRING *name);
+NTSTATUS	ZwFlushKey(HANDLE key);
+NTSTATUS	ZwOpenSymbolicLinkObject(HANDLE *link, ACCESS_MASK access, OBJECT_ATTRIBUTES *attributes);
+NTSTATUS	ZwQuerySymbolicLinkObject(HANDLE link, UNICODE_STRING *target, ULONG *length);
+NTSTATUS	ZwClose(HANDLE handle);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // !defined(AFX_CSimKernel_H__3E8A51C7_0F2D_4B96_A4C3_61D7E90B52F8__INCLUDED_)
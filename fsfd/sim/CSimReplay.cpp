@@ -0,0 +1,1637 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CSimReplay.cpp: implementation of the CSimReplay class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "driver.h"
+#include "IoControl.h"
+
+#include "CSimFileSystem.h"
+#include "CSimReplay.h"
+
+extern "C" NTSTATUS DriverEntry(DRIVER_OBJECT *driver, UNICODE_STRING *registry);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct CSimReplay::Shadow
+{
+	Shadow*			Next;
+	WCHAR			Path[CSimFileSystem::c_pathLength];
+	UCHAR*			Data;						// as the application sees it
+	ULONG			Size;
+	ULONG			Capacity;
+	ULONG			Handles;
+	bool			Exists;
+	bool			Unknown;					// opened without being written by the trace, not verified
+	bool			DeletePending;
+};
+
+struct CSimReplay::Handle
+{
+	HANDLE			Handle;
+	Shadow*			File;						// 0 for directories
+	bool			Used;
+};
+
+struct CSimReplay::Measure
+{
+	ULONG			Count;
+	ULONG			Capacity;
+	ULONGLONG*		Samples;					// nanoseconds
+	ULONGLONG		Allocations;
+	ULONGLONG		AllocatedBytes;
+	ULONGLONG		Irps;
+	ULONGLONG		Locks;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// STATICS ////
+
+bool						CSimReplay::s_verbose	= false;
+
+CSimReplay::Shadow*			CSimReplay::s_shadows	= 0;
+CSimReplay::Handle*			CSimReplay::s_handles	= 0;
+CSimReplay::Measure*		CSimReplay::s_measures	= 0;
+
+HANDLE						CSimReplay::s_control	= 0;
+char const*					CSimReplay::s_trace		= "";
+ULONG						CSimReplay::s_line		= 0;
+ULONG						CSimReplay::s_failed	= 0;
+
+LONGLONG					CSimReplay::s_start		= 0;
+CSimKernel::Counters		CSimReplay::s_counters;
+
+static LPCWSTR const		s_registry	= L"\\REGISTRY\\MACHINE\\SYSTEM\\CurrentControlSet\\Services\\XAzFileCrypt";
+static LPCWSTR const		s_dosVolume	= L"\\??\\C:";
+
+static char const* const	s_operations[CSimReplay::c_opCount] =
+{
+	"create", "read", "write", "setinfo", "queryinfo", "flush", "close", "control"
+};
+
+static char const* const	s_counterNames[FILFILE_STAT_COUNT] =
+{
+	"CREATE_TRACKED", "CREATE_SKIPPED", "HEADER_PROBES", "KEY_REQUESTS", "KEY_FAILED", "KEY_WAIT", "BOUNCE_BUFFERS",
+	"NONALIGNED_RMW", "CACHE_HITS", "CACHE_MISSES", "AUTOCONFIG_OPENS", "AUTOCONFIG_AVOIDED", "DECISION_HITS",
+	"READAHEAD_HITS", "WIPE_DEFERRED", "WIPE_FAILED"
+};
+
+// Suffixes of the ENCRYPTED_ and DECRYPTED_ byte counters, by cipher mode
+static char const* const	s_modeNames[FILFILE_STAT_MODES] =
+{
+	"NULL", "CTR", "CFB", "EME", "EME2", "XTS", 0, 0
+};
+
+static char const* const	s_stageNames[FILFILE_STAT_STAGES] =
+{
+	"precreate", "postcreate", "entity", "blacklist", "applist", "header", "tracker", 0
+};
+
+static struct
+{
+	char const*		Name;
+	NTSTATUS		Status;
+}
+const s_statuses[] =
+{
+	{ "SUCCESS",				STATUS_SUCCESS },
+	{ "END_OF_FILE",			STATUS_END_OF_FILE },
+	{ "ACCESS_DENIED",			STATUS_ACCESS_DENIED },
+	{ "SHARING_VIOLATION",		STATUS_SHARING_VIOLATION },
+	{ "DELETE_PENDING",			STATUS_DELETE_PENDING },
+	{ "OBJECT_NAME_NOT_FOUND",	STATUS_OBJECT_NAME_NOT_FOUND },
+	{ "OBJECT_NAME_COLLISION",	STATUS_OBJECT_NAME_COLLISION },
+	{ "OBJECT_NAME_INVALID",	STATUS_OBJECT_NAME_INVALID },
+	{ "OBJECT_PATH_NOT_FOUND",	STATUS_OBJECT_PATH_NOT_FOUND },
+	{ "NOT_A_DIRECTORY",		STATUS_NOT_A_DIRECTORY },
+	{ "FILE_IS_A_DIRECTORY",	STATUS_FILE_IS_A_DIRECTORY },
+	{ "DIRECTORY_NOT_EMPTY",	STATUS_DIRECTORY_NOT_EMPTY },
+	{ "CANNOT_DELETE",			STATUS_CANNOT_DELETE },
+	{ "INVALID_PARAMETER",		STATUS_INVALID_PARAMETER },
+	{ "NOT_SUPPORTED",			STATUS_NOT_SUPPORTED },
+};
+
+static struct
+{
+	char const*		Name;
+	ULONG			Value;
+}
+const s_dispositions[] =
+{
+	{ "supersede",		FILE_SUPERSEDE },
+	{ "open",			FILE_OPEN },
+	{ "create",			FILE_CREATE },
+	{ "open_if",		FILE_OPEN_IF },
+	{ "overwrite",		FILE_OVERWRITE },
+	{ "overwrite_if",	FILE_OVERWRITE_IF },
+},
+s_options[] =
+{
+	{ "dir",			FILE_DIRECTORY_FILE },
+	{ "file",			FILE_NON_DIRECTORY_FILE },
+	{ "nocache",		FILE_NO_INTERMEDIATE_BUFFERING },
+	{ "through",		FILE_WRITE_THROUGH },
+	{ "sequential",		FILE_SEQUENTIAL_ONLY },
+	{ "deleteonclose",	FILE_DELETE_ON_CLOSE },
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static ULONGLONG Clock()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (ULONGLONG) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static bool Number(char const* text, ULONGLONG *value)
+{
+	char *end = 0;
+	*value	  = strtoull(text, &end, 0);
+
+	return end && (end != text) && !*end;
+}
+
+static ULONG Widen(char const* source, WCHAR *target, ULONG targetLength)
+{
+	ULONG length = 0;
+
+	while(source[length] && (length + 1 < targetLength))
+	{
+		target[length] = (WCHAR) (UCHAR) source[length];
+		length++;
+	}
+
+	target[length] = UNICODE_NULL;
+
+	return length;
+}
+
+static int CompareSamples(void const* a, void const* b)
+{
+	ULONGLONG const x = *(ULONGLONG const*) a;
+	ULONGLONG const y = *(ULONGLONG const*) b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CSimReplay::Fail(char const* format, ...)
+{
+	fprintf(stderr, "%s:%lu: ", s_trace, (unsigned long) s_line);
+
+	va_list arguments;
+	va_start(arguments, format);
+	vfprintf(stderr, format, arguments);
+	va_end(arguments);
+
+	fputc('\n', stderr);
+
+	s_failed++;
+
+	return false;
+}
+
+bool CSimReplay::Check(NTSTATUS status, NTSTATUS expected, char const* what)
+{
+	if(status != expected)
+	{
+		return Fail("%s returned 0x%08x, expected 0x%08x", what, (unsigned) status, (unsigned) expected);
+	}
+
+	return true;
+}
+
+void CSimReplay::Begin()
+{
+	s_counters = CSimKernel::Statistics();
+	s_start	   = Clock();
+}
+
+void CSimReplay::End(ULONG operation)
+{
+	ULONGLONG const elapsed = Clock() - s_start;
+
+	ASSERT(operation < c_opCount);
+
+	// Work items and cache dereferences the request has left belong to it
+	CSimKernel::Run();
+
+	CSimKernel::Counters const& now = CSimKernel::Statistics();
+	Measure *const measure			= &s_measures[operation];
+
+	if(measure->Count == measure->Capacity)
+	{
+		measure->Capacity = measure->Capacity ? 2 * measure->Capacity : 256;
+		measure->Samples  = (ULONGLONG*) realloc(measure->Samples, measure->Capacity * sizeof(ULONGLONG));
+
+		if(!measure->Samples)
+		{
+			abort();
+		}
+	}
+
+	measure->Samples[measure->Count++] = elapsed;
+
+	measure->Allocations	+= now.Allocations - s_counters.Allocations;
+	measure->AllocatedBytes += now.AllocatedBytes - s_counters.AllocatedBytes;
+	measure->Irps			+= now.Irps - s_counters.Irps;
+	measure->Locks			+= now.LockAcquisitions - s_counters.LockAcquisitions;
+}
+
+CSimReplay::Shadow* CSimReplay::FindShadow(LPCWSTR path, bool create)
+{
+	for(Shadow *shadow = s_shadows; shadow; shadow = shadow->Next)
+	{
+		if(!_wcsnicmp(shadow->Path, path, CSimFileSystem::c_pathLength))
+		{
+			return shadow;
+		}
+	}
+
+	if(!create)
+	{
+		return 0;
+	}
+
+	Shadow *const shadow = (Shadow*) calloc(1, sizeof(Shadow));
+
+	if(!shadow)
+	{
+		abort();
+	}
+
+	wcscpy(shadow->Path, path);
+
+	shadow->Next = s_shadows;
+	s_shadows	 = shadow;
+
+	return shadow;
+}
+
+CSimReplay::Handle* CSimReplay::FindHandle(char const* argument, bool open)
+{
+	ULONGLONG index = 0;
+
+	if(!Number(argument, &index) || (index >= c_handles))
+	{
+		Fail("invalid handle [%s]", argument);
+
+		return 0;
+	}
+
+	Handle *const handle = &s_handles[index];
+
+	if(handle->Used == open)
+	{
+		Fail(open ? "handle %s is in use" : "handle %s is not open", argument);
+
+		return 0;
+	}
+
+	return handle;
+}
+
+bool CSimReplay::Resize(Shadow *shadow, ULONG size)
+{
+	ASSERT(shadow);
+
+	if(size > 0x10000000)
+	{
+		return false;
+	}
+
+	if(size > shadow->Capacity)
+	{
+		ULONG const capacity = max(size, 2 * shadow->Capacity);
+		UCHAR *const data	 = (UCHAR*) realloc(shadow->Data, capacity);
+
+		if(!data)
+		{
+			abort();
+		}
+
+		memset(data + shadow->Capacity, 0, capacity - shadow->Capacity);
+
+		shadow->Data	 = data;
+		shadow->Capacity = capacity;
+	}
+
+	// Shrinking leaves zeros behind, growing shows them
+	if(size < shadow->Size)
+	{
+		memset(shadow->Data + size, 0, shadow->Size - size);
+	}
+
+	shadow->Size = size;
+
+	return true;
+}
+
+void CSimReplay::Pattern(UCHAR *buffer, LONGLONG offset, ULONG length, ULONG seed)
+{
+	// Different in every byte and every 256 byte block, so misplaced data shows
+	for(ULONG index = 0; index < length; ++index)
+	{
+		LONGLONG const position = offset + index;
+
+		buffer[index] = (UCHAR) (position * 131 + (position >> 8) * 7 + seed * 29 + 1);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int CSimReplay::Run(FILE *trace, char const* name)
+{
+	ASSERT(trace);
+
+	s_trace = name;
+	s_line	= 0;
+
+	if(!s_measures)
+	{
+		s_measures = (Measure*) calloc(c_opCount, sizeof(Measure));
+		s_handles  = (Handle*) calloc(c_handles, sizeof(Handle));
+
+		if(!s_measures || !s_handles)
+		{
+			abort();
+		}
+	}
+
+	// Whole trace first, repeat blocks jump back
+	char **lines  = 0;
+	ULONG count	  = 0;
+	ULONG size	  = 0;
+
+	char buffer[c_lineLength];
+
+	while(fgets(buffer, sizeof(buffer), trace))
+	{
+		if(count == size)
+		{
+			size  = size ? 2 * size : 256;
+			lines = (char**) realloc(lines, size * sizeof(char*));
+
+			if(!lines)
+			{
+				abort();
+			}
+		}
+
+		lines[count++] = strdup(buffer);
+	}
+
+	struct
+	{
+		ULONG	Line;
+		ULONG	Remaining;
+	}
+	repeats[8];
+
+	ULONG depth = 0;
+
+	for(ULONG current = 0; current < count; ++current)
+	{
+		s_line = current + 1;
+
+		char line[c_lineLength];
+		strcpy(line, lines[current]);
+
+		char *const comment = strchr(line, '#');
+
+		if(comment)
+		{
+			*comment = 0;
+		}
+
+		char *arguments[c_arguments];
+		ULONG argumentCount = 0;
+
+		for(char *token = strtok(line, " \t\r\n"); token; token = strtok(0, " \t\r\n"))
+		{
+			if(argumentCount == c_arguments)
+			{
+				Fail("too many arguments");
+				break;
+			}
+
+			arguments[argumentCount++] = token;
+		}
+
+		if(!argumentCount)
+		{
+			continue;
+		}
+
+		if(!strcmp(arguments[0], "repeat"))
+		{
+			ULONGLONG times = 0;
+
+			if((argumentCount != 2) || !Number(arguments[1], &times) || !times || (depth == sizeof(repeats) / sizeof(repeats[0])))
+			{
+				Fail("invalid repeat");
+				break;
+			}
+
+			repeats[depth].Line		 = current;
+			repeats[depth].Remaining = (ULONG) times;
+			depth++;
+
+			continue;
+		}
+
+		if(!strcmp(arguments[0], "end"))
+		{
+			if(!depth)
+			{
+				Fail("end without repeat");
+				break;
+			}
+
+			if(--repeats[depth - 1].Remaining)
+			{
+				current = repeats[depth - 1].Line;
+			}
+			else
+			{
+				depth--;
+			}
+
+			continue;
+		}
+
+		if(s_verbose)
+		{
+			fprintf(stderr, "%s:%lu: %s", s_trace, (unsigned long) s_line, lines[current]);
+		}
+
+		if(!Execute(arguments, argumentCount) && s_verbose)
+		{
+			fprintf(stderr, "%s:%lu: failed\n", s_trace, (unsigned long) s_line);
+		}
+	}
+
+	if(depth)
+	{
+		Fail("repeat without end");
+	}
+
+	for(ULONG index = 0; index < count; ++index)
+	{
+		free(lines[index]);
+	}
+
+	free(lines);
+
+	return (int) s_failed;
+}
+
+bool CSimReplay::Execute(char *arguments[], ULONG count)
+{
+	ASSERT(arguments);
+	ASSERT(count);
+
+	char const*const command = arguments[0];
+
+	// Expected status, if any, comes last
+	NTSTATUS expected = STATUS_SUCCESS;
+
+	if((count >= 3) && !strcmp(arguments[count - 2], "="))
+	{
+		char const*const name = arguments[count - 1];
+		ULONGLONG value		  = 0;
+		bool found			  = false;
+
+		for(ULONG index = 0; index < sizeof(s_statuses) / sizeof(s_statuses[0]); ++index)
+		{
+			if(!strcmp(s_statuses[index].Name, name))
+			{
+				expected = s_statuses[index].Status;
+				found	 = true;
+				break;
+			}
+		}
+
+		if(!found)
+		{
+			if(!Number(name, &value))
+			{
+				return Fail("unknown status [%s]", name);
+			}
+
+			expected = (NTSTATUS) (ULONG) value;
+		}
+
+		count -= 2;
+	}
+
+	ULONGLONG value = 0;
+
+	if(!strcmp(command, "registry"))
+	{
+		if((count != 3) || !Number(arguments[2], &value))
+		{
+			return Fail("usage: registry <name> <value>");
+		}
+
+		WCHAR key[256];
+		WCHAR name[64];
+
+		wcscpy(key, s_registry);
+		wcscat(key, L"\\Parameters");
+
+		Widen(arguments[1], name, 64);
+
+		ULONG const dword = (ULONG) value;
+
+		CSimKernel::SetRegistry(key, name, REG_DWORD, &dword, sizeof(dword));
+
+		return true;
+	}
+
+	if(!strcmp(command, "start"))
+	{
+		return Start();
+	}
+
+	if(!strcmp(command, "process"))
+	{
+		if((count < 2) || (count > 3) || !Number(arguments[1], &value))
+		{
+			return Fail("usage: process <pid> [luid]");
+		}
+
+		ULONGLONG luidValue = 0;
+
+		if((3 == count) && !Number(arguments[2], &luidValue))
+		{
+			return Fail("invalid luid [%s]", arguments[2]);
+		}
+
+		LUID luid;
+		luid.LowPart  = (ULONG) luidValue;
+		luid.HighPart = (LONG) (luidValue >> 32);
+
+		CSimKernel::SetProcess((ULONG) value, (3 == count) ? &luid : 0);
+
+		return true;
+	}
+
+	if(!strcmp(command, "advance"))
+	{
+		if((count != 2) || !Number(arguments[1], &value))
+		{
+			return Fail("usage: advance <milliseconds>");
+		}
+
+		CSimKernel::Advance((LONGLONG) value * 10000);
+		CSimKernel::Run();
+
+		return true;
+	}
+
+	if(!strcmp(command, "entity") || !strcmp(command, "exclude") || !strcmp(command, "autoconfig"))
+	{
+		return Entity(arguments, count, expected);
+	}
+
+	if(!strcmp(command, "file") || !strcmp(command, "mkdir"))
+	{
+		bool const directory = !strcmp(command, "mkdir");
+
+		if(directory ? (count != 2) : ((count < 3) || (count > 4) || !Number(arguments[2], &value)))
+		{
+			return Fail(directory ? "usage: mkdir <path>" : "usage: file <path> <size> [seed]");
+		}
+
+		WCHAR path[CSimFileSystem::c_pathLength];
+		Widen(arguments[1], path, CSimFileSystem::c_pathLength);
+
+		if(directory)
+		{
+			return Check(CSimFileSystem::AddDirectory(path), STATUS_SUCCESS, "mkdir");
+		}
+
+		ULONGLONG seed = 0;
+
+		if((4 == count) && !Number(arguments[3], &seed))
+		{
+			return Fail("invalid seed [%s]", arguments[3]);
+		}
+
+		Shadow *const shadow = FindShadow(path, true);
+
+		if(!Resize(shadow, (ULONG) value))
+		{
+			return Fail("file too large");
+		}
+
+		Pattern(shadow->Data, 0, shadow->Size, (ULONG) seed);
+
+		shadow->Exists  = true;
+		shadow->Unknown = false;
+
+		return Check(CSimFileSystem::AddFile(path, shadow->Data, shadow->Size), STATUS_SUCCESS, "file");
+	}
+
+	if(!strcmp(command, "open"))
+	{
+		return Open(arguments, count, expected);
+	}
+
+	if(!strcmp(command, "read") || !strcmp(command, "write"))
+	{
+		return ReadWrite(arguments, count, expected, !strcmp(command, "write"));
+	}
+
+	if(!strcmp(command, "expect"))
+	{
+		return Expect(arguments, count);
+	}
+
+	if(!strcmp(command, "stored"))
+	{
+		return Stored(arguments, count);
+	}
+
+	if(!strcmp(command, "reset"))
+	{
+		if(count != 1)
+		{
+			return Fail("usage: reset");
+		}
+
+		FILFILE_STATISTICS total;
+
+		return Statistics(&total, true);
+	}
+
+	// Requests on open handles
+	if(count < 2)
+	{
+		return Fail("unknown command [%s]", command);
+	}
+
+	Handle *const handle = FindHandle(arguments[1], false);
+
+	if(!handle)
+	{
+		return false;
+	}
+
+	Shadow *const shadow = handle->File;
+
+	if(!strcmp(command, "close"))
+	{
+		Begin();
+
+		NTSTATUS const status = ZwClose(handle->Handle);
+
+		End(c_opClose);
+
+		handle->Used = false;
+
+		if(shadow && !--shadow->Handles && shadow->DeletePending)
+		{
+			shadow->Exists		  = false;
+			shadow->DeletePending = false;
+			shadow->Size		  = 0;
+		}
+
+		return Check(status, expected, "close");
+	}
+
+	if(!strcmp(command, "flush"))
+	{
+		Begin();
+
+		NTSTATUS const status = CSimKernel::Flush(handle->Handle);
+
+		End(c_opFlush);
+
+		return Check(status, expected, "flush");
+	}
+
+	if(!strcmp(command, "eof"))
+	{
+		if((count != 3) || !Number(arguments[2], &value))
+		{
+			return Fail("usage: eof <handle> <size>");
+		}
+
+		FILE_END_OF_FILE_INFORMATION info;
+		info.EndOfFile.QuadPart = (LONGLONG) value;
+
+		Begin();
+
+		NTSTATUS const status = CSimKernel::Information(handle->Handle, IRP_MJ_SET_INFORMATION, FileEndOfFileInformation, &info, sizeof(info));
+
+		End(c_opSetInfo);
+
+		if(NT_SUCCESS(status) && shadow && !Resize(shadow, (ULONG) value))
+		{
+			return Fail("file too large");
+		}
+
+		return Check(status, expected, "eof");
+	}
+
+	if(!strcmp(command, "delete"))
+	{
+		FILE_DISPOSITION_INFORMATION info;
+		info.DeleteFile = true;
+
+		Begin();
+
+		NTSTATUS const status = CSimKernel::Information(handle->Handle, IRP_MJ_SET_INFORMATION, FileDispositionInformation, &info, sizeof(info));
+
+		End(c_opSetInfo);
+
+		if(NT_SUCCESS(status) && shadow)
+		{
+			shadow->DeletePending = true;
+		}
+
+		return Check(status, expected, "delete");
+	}
+
+	if(!strcmp(command, "rename"))
+	{
+		if((count < 3) || (count > 4) || ((4 == count) && strcmp(arguments[3], "replace")))
+		{
+			return Fail("usage: rename <handle> <path> [replace]");
+		}
+
+		WCHAR path[CSimFileSystem::c_pathLength];
+		Widen(arguments[2], path, CSimFileSystem::c_pathLength);
+
+		// Qualified with the drive, as MoveFile passes it
+		WCHAR qualified[CSimFileSystem::c_pathLength + 8];
+		wcscpy(qualified, s_dosVolume);
+		wcscat(qualified, path);
+
+		ULONG const pathSize = (ULONG) wcslen(qualified) * sizeof(WCHAR);
+		ULONG const size	 = FIELD_OFFSET(FILE_RENAME_INFORMATION, FileName) + pathSize;
+
+		FILE_RENAME_INFORMATION *const info = (FILE_RENAME_INFORMATION*) calloc(1, size);
+
+		if(!info)
+		{
+			abort();
+		}
+
+		info->ReplaceIfExists = (4 == count);
+		info->FileNameLength  = pathSize;
+
+		memcpy(info->FileName, qualified, pathSize);
+
+		Begin();
+
+		NTSTATUS const status = CSimKernel::Information(handle->Handle, IRP_MJ_SET_INFORMATION, FileRenameInformation, info, size);
+
+		End(c_opSetInfo);
+
+		free(info);
+
+		if(NT_SUCCESS(status) && shadow)
+		{
+			// A replaced file is gone
+			Shadow *const target = FindShadow(path, false);
+
+			if(target && (target != shadow))
+			{
+				target->Exists	= false;
+				target->Path[0] = UNICODE_NULL;
+			}
+
+			wcscpy(shadow->Path, path);
+		}
+
+		return Check(status, expected, "rename");
+	}
+
+	if(!strcmp(command, "query"))
+	{
+		FILE_STANDARD_INFORMATION info;
+		memset(&info, 0, sizeof(info));
+
+		Begin();
+
+		NTSTATUS const status = CSimKernel::Information(handle->Handle, IRP_MJ_QUERY_INFORMATION, FileStandardInformation, &info, sizeof(info));
+
+		End(c_opQueryInfo);
+
+		if(!Check(status, expected, "query"))
+		{
+			return false;
+		}
+
+		// Encrypted files must not show their Header
+		if(NT_SUCCESS(status) && shadow && !shadow->Unknown && (info.EndOfFile.QuadPart != shadow->Size))
+		{
+			return Fail("query: size is %lld, expected %lu", (long long) info.EndOfFile.QuadPart, (unsigned long) shadow->Size);
+		}
+
+		return true;
+	}
+
+	return Fail("unknown command [%s]", command);
+}
+
+bool CSimReplay::Start()
+{
+	if(s_control)
+	{
+		return Fail("started already");
+	}
+
+	DRIVER_OBJECT *const driver = CSimKernel::CreateDriver(L"\\Driver\\XAzFileCrypt");
+
+	UNICODE_STRING registry;
+	RtlInitUnicodeString(&registry, s_registry);
+
+	NTSTATUS status = DriverEntry(driver, &registry);
+
+	if(NT_ERROR(status))
+	{
+		return Fail("DriverEntry failed [0x%08x]", (unsigned) status);
+	}
+
+	status = CSimKernel::Open(L"\\FileSystem\\XAzFileCrypt", GENERIC_READ | GENERIC_WRITE, 0, FILE_OPEN, 0, &s_control);
+
+	if(NT_ERROR(status))
+	{
+		return Fail("opening the control device failed [0x%08x]", (unsigned) status);
+	}
+
+	FILFILE_CONTROL control;
+	memset(&control, 0, sizeof(control));
+
+	control.Flags = FILFILE_CONTROL_SET | FILFILE_CONTROL_ADD;
+
+	status = Control(IOCTL_FILFILE_SET_STATE, &control, sizeof(control));
+
+	if(NT_ERROR(status))
+	{
+		return Fail("activation failed [0x%08x]", (unsigned) status);
+	}
+
+	// Mount the volume, so the driver attaches before Entities are added
+	WCHAR root[16];
+	wcscpy(root, s_dosVolume);
+	wcscat(root, L"\\");
+
+	HANDLE handle = 0;
+	status = CSimKernel::Open(root, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_OPEN, FILE_DIRECTORY_FILE, &handle);
+
+	if(NT_ERROR(status))
+	{
+		return Fail("mounting the volume failed [0x%08x]", (unsigned) status);
+	}
+
+	ZwClose(handle);
+	CSimKernel::Run();
+
+	return true;
+}
+
+NTSTATUS CSimReplay::Control(ULONG code, FILFILE_CONTROL *control, ULONG size, void *output, ULONG outputSize)
+{
+	ASSERT(control);
+	ASSERT(size >= sizeof(FILFILE_CONTROL));
+
+	control->Magic	 = FILFILE_CONTROL_MAGIC;
+	control->Version = FILFILE_CONTROL_VERSION;
+	control->Size	 = size;
+
+	Begin();
+
+	NTSTATUS const status = CSimKernel::Control(s_control, code, control, size, output, outputSize);
+
+	End(c_opControl);
+
+	return status;
+}
+
+NTSTATUS CSimReplay::AutoConfig(LPCWSTR directory, UCHAR const* payload, ULONG payloadSize)
+{
+	ASSERT(directory);
+	ASSERT(payload);
+
+	WCHAR path[CSimFileSystem::c_pathLength];
+
+	wcscpy(path, directory);
+	wcscat(path, g_filFileAutoConfigName);
+
+	ULONG const pathSize = (ULONG) (wcslen(path) + 1) * sizeof(WCHAR);
+	ULONG const size	 = sizeof(FILFILE_CONTROL) + pathSize + payloadSize;
+
+	UCHAR *const buffer = (UCHAR*) calloc(1, size);
+
+	if(!buffer)
+	{
+		abort();
+	}
+
+	FILFILE_CONTROL *const control = (FILFILE_CONTROL*) buffer;
+
+	control->Flags		= FILFILE_CONTROL_AUTOCONF | FILFILE_CONTROL_ADD;
+	control->PathOffset = sizeof(FILFILE_CONTROL);
+	control->PathLength = pathSize;
+
+	memcpy(buffer + control->PathOffset, path, pathSize);
+
+	FILFILE_CONTROL_OUT out;
+	RtlZeroMemory(&out, sizeof(out));
+
+	// Have the driver open the file below itself
+	NTSTATUS status = Control(IOCTL_FILFILE_OPEN_FILE, control, sizeof(FILFILE_CONTROL) + pathSize, &out, sizeof(out));
+
+	if(NT_SUCCESS(status))
+	{
+		HANDLE const file = (HANDLE)(ULONG_PTR) out.Value;
+
+		RtlZeroMemory(control, sizeof(FILFILE_CONTROL));
+
+		control->Flags		   = FILFILE_CONTROL_HANDLE | FILFILE_CONTROL_AUTOCONF;
+		control->Value1		   = out.Value;
+		control->Value2		   = ~0u;		// any depth
+		control->PayloadOffset = sizeof(FILFILE_CONTROL);
+		control->PayloadSize   = payloadSize;
+
+		memcpy(buffer + control->PayloadOffset, payload, payloadSize);
+
+		status = Control(IOCTL_FILFILE_SET_HEADER, control, sizeof(FILFILE_CONTROL) + payloadSize);
+
+		ZwClose(file);
+	}
+
+	free(buffer);
+
+	return status;
+}
+
+bool CSimReplay::Entity(char *arguments[], ULONG count, NTSTATUS expected)
+{
+	bool const negative	  = !strcmp(arguments[0], "exclude");
+	bool const autoConfig = !strcmp(arguments[0], "autoconfig");
+
+	if(negative ? (count != 2) : autoConfig ? (count != 3) : ((count < 3) || (count > 4)))
+	{
+		return Fail(negative ? "usage: exclude <path>" : autoConfig ? "usage: autoconfig <path> <key>" : "usage: entity <path> <key> [mode]");
+	}
+
+	if(!s_control)
+	{
+		return Fail("not started");
+	}
+
+	UCHAR key[32];
+	ULONG keySize = 0;
+
+	if(!negative)
+	{
+		char const* hex = arguments[2];
+		ULONG const length = (ULONG) strlen(hex);
+
+		if((length & 1) || (length / 2 > sizeof(key)))
+		{
+			return Fail("invalid key [%s]", hex);
+		}
+
+		for(keySize = 0; keySize < length / 2; ++keySize)
+		{
+			char digits[3] = { hex[2 * keySize], hex[2 * keySize + 1], 0 };
+			char *end	   = 0;
+
+			key[keySize] = (UCHAR) strtoul(digits, &end, 16);
+
+			if(*end)
+			{
+				return Fail("invalid key [%s]", hex);
+			}
+		}
+	}
+
+	ULONGLONG mode = 0;
+
+	if((4 == count) && !Number(arguments[3], &mode))
+	{
+		return Fail("invalid mode [%s]", arguments[3]);
+	}
+
+	// Full path on the simulated volume
+	WCHAR path[CSimFileSystem::c_pathLength];
+	WCHAR relative[CSimFileSystem::c_pathLength];
+
+	Widen(arguments[1], relative, CSimFileSystem::c_pathLength);
+
+	wcscpy(path, CSimFileSystem::Volume());
+	wcscat(path, relative);
+
+	// The Entity's Payload identifies its Header, derive it from the key
+	UCHAR payload[16];
+
+	for(ULONG index = 0; index < sizeof(payload); ++index)
+	{
+		payload[index] = (UCHAR) ((keySize ? key[index % keySize] : 0) ^ (0x5a + index));
+	}
+
+	// Only the AutoConfig file, as SetAutoConfig writes it
+	if(autoConfig)
+	{
+		if(L'\\' != path[wcslen(path) - 1])
+		{
+			return Fail("autoconfig: not a directory [%s]", arguments[1]);
+		}
+
+		return Check(AutoConfig(path, payload, sizeof(payload)), expected, arguments[0]);
+	}
+
+	ULONG const pathSize = (ULONG) (wcslen(path) + 1) * sizeof(WCHAR);
+	ULONG const size	 = sizeof(FILFILE_CONTROL) + pathSize + (negative ? 0 : sizeof(payload) + keySize);
+
+	UCHAR *const buffer = (UCHAR*) calloc(1, size);
+
+	if(!buffer)
+	{
+		abort();
+	}
+
+	FILFILE_CONTROL *const control = (FILFILE_CONTROL*) buffer;
+
+	control->Flags		= FILFILE_CONTROL_ADD | (negative ? FILFILE_CONTROL_ACTIVE : 0);
+	control->Value2		= mode;
+	control->PathOffset = sizeof(FILFILE_CONTROL);
+	control->PathLength = pathSize;
+
+	memcpy(buffer + control->PathOffset, path, pathSize);
+
+	if(!negative)
+	{
+		control->PayloadOffset = control->PathOffset + pathSize;
+		control->PayloadSize   = sizeof(payload);
+		control->CryptoOffset  = control->PayloadOffset + sizeof(payload);
+		control->CryptoSize	   = keySize;
+
+		memcpy(buffer + control->PayloadOffset, payload, sizeof(payload));
+		memcpy(buffer + control->CryptoOffset, key, keySize);
+	}
+
+	NTSTATUS status = STATUS_SUCCESS;
+
+	// Directory Entities are backed by an AutoConfig file, write it first as the daemon does
+	if(!negative && (L'\\' == path[wcslen(path) - 1]))
+	{
+		status = AutoConfig(path, payload, sizeof(payload));
+	}
+
+	if(NT_SUCCESS(status))
+	{
+		status = Control(IOCTL_FILFILE_ENTITY, control, size);
+	}
+
+	free(buffer);
+
+	return Check(status, expected, arguments[0]);
+}
+
+bool CSimReplay::Open(char *arguments[], ULONG count, NTSTATUS expected)
+{
+	if(count < 5)
+	{
+		return Fail("usage: open <handle> <path> <disposition> <r|w|rw|rwd> [options]");
+	}
+
+	Handle *const handle = FindHandle(arguments[1], true);
+
+	if(!handle)
+	{
+		return false;
+	}
+
+	ULONG disposition = ~0u;
+
+	for(ULONG index = 0; index < sizeof(s_dispositions) / sizeof(s_dispositions[0]); ++index)
+	{
+		if(!strcmp(s_dispositions[index].Name, arguments[3]))
+		{
+			disposition = s_dispositions[index].Value;
+			break;
+		}
+	}
+
+	if(~0u == disposition)
+	{
+		return Fail("unknown disposition [%s]", arguments[3]);
+	}
+
+	ACCESS_MASK access = SYNCHRONIZE;
+
+	for(char const* flag = arguments[4]; *flag; ++flag)
+	{
+		switch(*flag)
+		{
+			case 'r':
+				access |= GENERIC_READ;
+				break;
+			case 'w':
+				access |= GENERIC_WRITE;
+				break;
+			case 'd':
+				access |= DELETE;
+				break;
+			case 'a':
+				access |= FILE_READ_ATTRIBUTES;
+				break;
+			default:
+				return Fail("unknown access [%s]", arguments[4]);
+		}
+	}
+
+	ULONG options = FILE_SYNCHRONOUS_IO_NONALERT;
+
+	for(ULONG argument = 5; argument < count; ++argument)
+	{
+		ULONG index = 0;
+
+		for(; index < sizeof(s_options) / sizeof(s_options[0]); ++index)
+		{
+			if(!strcmp(s_options[index].Name, arguments[argument]))
+			{
+				options |= s_options[index].Value;
+				break;
+			}
+		}
+
+		if(index == sizeof(s_options) / sizeof(s_options[0]))
+		{
+			return Fail("unknown option [%s]", arguments[argument]);
+		}
+	}
+
+	WCHAR relative[CSimFileSystem::c_pathLength];
+	WCHAR path[CSimFileSystem::c_pathLength + 8];
+
+	Widen(arguments[2], relative, CSimFileSystem::c_pathLength);
+
+	wcscpy(path, s_dosVolume);
+	wcscat(path, relative);
+
+	HANDLE opened			  = 0;
+	ULONG_PTR information	  = 0;
+	ULONG const share		  = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+
+	Begin();
+
+	NTSTATUS const status = CSimKernel::Open(path, access, share, disposition, options, &opened, &information);
+
+	End(c_opCreate);
+
+	if(!Check(status, expected, "open"))
+	{
+		if(NT_SUCCESS(status))
+		{
+			ZwClose(opened);
+		}
+
+		return false;
+	}
+
+	if(NT_ERROR(status))
+	{
+		return true;
+	}
+
+	handle->Handle = opened;
+	handle->Used   = true;
+	handle->File   = 0;
+
+	if(!(options & FILE_DIRECTORY_FILE))
+	{
+		Shadow *const shadow = FindShadow(relative, true);
+
+		if((FILE_CREATED == information) || (FILE_OVERWRITTEN == information) || (FILE_SUPERSEDED == information))
+		{
+			Resize(shadow, 0);
+
+			shadow->Unknown = false;
+		}
+		else if(!shadow->Exists)
+		{
+			shadow->Unknown = true;
+		}
+
+		shadow->Exists = true;
+		shadow->Handles++;
+
+		if(options & FILE_DELETE_ON_CLOSE)
+		{
+			shadow->DeletePending = true;
+		}
+
+		handle->File = shadow;
+	}
+
+	return true;
+}
+
+bool CSimReplay::ReadWrite(char *arguments[], ULONG count, NTSTATUS expected, bool write)
+{
+	ULONGLONG offset = 0;
+	ULONGLONG length = 0;
+	ULONGLONG seed	 = 0;
+
+	if((count < 4) || (count > (write ? 5u : 4u)) || !Number(arguments[2], &offset) || !Number(arguments[3], &length) ||
+	   ((5 == count) && !Number(arguments[4], &seed)) || (length > 0x1000000))
+	{
+		return Fail(write ? "usage: write <handle> <offset> <length> [seed]" : "usage: read <handle> <offset> <length>");
+	}
+
+	Handle *const handle = FindHandle(arguments[1], false);
+
+	if(!handle)
+	{
+		return false;
+	}
+
+	Shadow *const shadow = handle->File;
+
+	// Reads past the end fail, as on the file system
+	if(!write && (STATUS_SUCCESS == expected) && shadow && !shadow->Unknown && (offset >= shadow->Size) && length)
+	{
+		expected = STATUS_END_OF_FILE;
+	}
+
+	UCHAR *const buffer = (UCHAR*) malloc((size_t) length + 1);
+
+	if(!buffer)
+	{
+		abort();
+	}
+
+	if(write)
+	{
+		Pattern(buffer, (LONGLONG) offset, (ULONG) length, (ULONG) seed);
+	}
+	else
+	{
+		memset(buffer, 0xcc, (size_t) length);
+	}
+
+	ULONG_PTR information = 0;
+
+	Begin();
+
+	NTSTATUS const status = CSimKernel::ReadWrite(handle->Handle, write ? IRP_MJ_WRITE : IRP_MJ_READ, (LONGLONG) offset, buffer, (ULONG) length, &information);
+
+	End(write ? c_opWrite : c_opRead);
+
+	bool result = Check(status, expected, arguments[0]);
+
+	if(result && NT_SUCCESS(status) && shadow)
+	{
+		if(write)
+		{
+			if(information != length)
+			{
+				result = Fail("write: %lu bytes written, expected %lu", (unsigned long) information, (unsigned long) length);
+			}
+			else
+			{
+				if(offset + length > shadow->Size)
+				{
+					Resize(shadow, (ULONG) (offset + length));
+				}
+
+				memcpy(shadow->Data + offset, buffer, (size_t) length);
+			}
+		}
+		else if(!shadow->Unknown)
+		{
+			ULONGLONG const available = (offset < shadow->Size) ? min(length, shadow->Size - offset) : 0;
+
+			if(information != available)
+			{
+				result = Fail("read: %lu bytes read, expected %lu", (unsigned long) information, (unsigned long) available);
+			}
+			else if(memcmp(buffer, shadow->Data + offset, (size_t) available))
+			{
+				ULONG first = 0;
+
+				while(buffer[first] == shadow->Data[offset + first])
+				{
+					first++;
+				}
+
+				result = Fail("read: data differs at offset %llu", (unsigned long long) (offset + first));
+			}
+		}
+	}
+
+	free(buffer);
+
+	return result;
+}
+
+bool CSimReplay::Statistics(FILFILE_STATISTICS *total, bool reset)
+{
+	ASSERT(total);
+
+	memset(total, 0, sizeof(*total));
+
+	if(!s_control)
+	{
+		return false;
+	}
+
+	FILFILE_STATISTICS entries[8];
+
+	FILFILE_CONTROL control;
+	memset(&control, 0, sizeof(control));
+
+	control.Magic	= FILFILE_CONTROL_MAGIC;
+	control.Version = FILFILE_CONTROL_VERSION;
+	control.Size	= sizeof(control);
+	control.Flags	= reset ? FILFILE_CONTROL_REM : 0;
+
+	ULONG_PTR information = 0;
+
+	// Not timed, the report must not disturb what it reports
+	NTSTATUS const status = CSimKernel::Control(s_control, IOCTL_FILFILE_STATISTICS, &control, sizeof(control), entries, sizeof(entries), &information);
+
+	if(NT_ERROR(status))
+	{
+		return Fail("statistics failed [0x%08x]", (unsigned) status);
+	}
+
+	// Driver wide counters and those of each Volume add up
+	for(ULONG entry = 0; entry < information / sizeof(FILFILE_STATISTICS); ++entry)
+	{
+		for(ULONG index = 0; index < FILFILE_STAT_COUNT; ++index)
+		{
+			total->Counter[index] += entries[entry].Counter[index];
+		}
+
+		for(ULONG index = 0; index < FILFILE_STAT_MODES; ++index)
+		{
+			total->Encrypted[index] += entries[entry].Encrypted[index];
+			total->Decrypted[index] += entries[entry].Decrypted[index];
+		}
+
+		for(ULONG index = 0; index < FILFILE_STAT_STAGES; ++index)
+		{
+			total->StageCalls[index] += entries[entry].StageCalls[index];
+			total->StageTime[index]	 += entries[entry].StageTime[index];
+		}
+	}
+
+	return true;
+}
+
+bool CSimReplay::Expect(char *arguments[], ULONG count)
+{
+	ULONGLONG value = 0;
+
+	if((count != 3) || !Number(arguments[2], &value))
+	{
+		return Fail("usage: expect <counter> <value>");
+	}
+
+	FILFILE_STATISTICS total;
+
+	if(!Statistics(&total))
+	{
+		return false;
+	}
+
+	ULONGLONG const* counter = 0;
+
+	for(ULONG index = 0; !counter && (index < FILFILE_STAT_COUNT); ++index)
+	{
+		if(!strcmp(s_counterNames[index], arguments[1]))
+		{
+			counter = &total.Counter[index];
+		}
+	}
+
+	// Bytes per cipher mode, e.g. ENCRYPTED_XTS
+	for(ULONG index = 0; !counter && (index < FILFILE_STAT_MODES) && s_modeNames[index]; ++index)
+	{
+		if(!strncmp(arguments[1], "ENCRYPTED_", 10) && !strcmp(arguments[1] + 10, s_modeNames[index]))
+		{
+			counter = &total.Encrypted[index];
+		}
+		else if(!strncmp(arguments[1], "DECRYPTED_", 10) && !strcmp(arguments[1] + 10, s_modeNames[index]))
+		{
+			counter = &total.Decrypted[index];
+		}
+	}
+
+	if(!counter)
+	{
+		return Fail("unknown counter [%s]", arguments[1]);
+	}
+
+	if(*counter != value)
+	{
+		return Fail("counter %s is %llu, expected %llu", arguments[1], (unsigned long long) *counter, (unsigned long long) value);
+	}
+
+	return true;
+}
+
+bool CSimReplay::Stored(char *arguments[], ULONG count)
+{
+	if((count != 3) || (strcmp(arguments[2], "plain") && strcmp(arguments[2], "cipher") && strcmp(arguments[2], "missing")))
+	{
+		return Fail("usage: stored <path> plain|cipher|missing");
+	}
+
+	WCHAR path[CSimFileSystem::c_pathLength];
+	Widen(arguments[1], path, CSimFileSystem::c_pathLength);
+
+	LONGLONG size	  = 0;
+	UCHAR const* data = 0;
+
+	NTSTATUS const status = CSimFileSystem::QueryFile(path, &size, &data);
+
+	if(!strcmp(arguments[2], "missing"))
+	{
+		return NT_ERROR(status) ? true : Fail("stored: %s exists", arguments[1]);
+	}
+
+	if(NT_ERROR(status))
+	{
+		return Fail("stored: %s does not exist", arguments[1]);
+	}
+
+	Shadow const*const shadow = FindShadow(path, false);
+
+	if(!shadow || shadow->Unknown)
+	{
+		return Fail("stored: contents of %s are unknown", arguments[1]);
+	}
+
+	bool const plain = (size == shadow->Size) && !memcmp(data, shadow->Data, shadow->Size);
+
+	if(!strcmp(arguments[2], "plain") != plain)
+	{
+		return Fail("stored: %s is %s", arguments[1], plain ? "plain" : "not plain");
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CSimReplay::Report(FILE *out)
+{
+	ASSERT(out);
+
+	if(!s_measures)
+	{
+		return;
+	}
+
+	fprintf(out, "%-10s %8s %10s %10s %10s %10s %10s %10s %8s %8s\n",
+			"operation", "count", "mean[us]", "p50[us]", "p99[us]", "max[us]", "allocs/op", "bytes/op", "irps/op", "locks/op");
+
+	for(ULONG operation = 0; operation < c_opCount; ++operation)
+	{
+		Measure *const measure = &s_measures[operation];
+
+		if(!measure->Count)
+		{
+			continue;
+		}
+
+		qsort(measure->Samples, measure->Count, sizeof(ULONGLONG), CompareSamples);
+
+		ULONGLONG sum = 0;
+
+		for(ULONG index = 0; index < measure->Count; ++index)
+		{
+			sum += measure->Samples[index];
+		}
+
+		double const count = measure->Count;
+
+		fprintf(out, "%-10s %8lu %10.2f %10.2f %10.2f %10.2f %10.2f %10.1f %8.2f %8.2f\n",
+				s_operations[operation],
+				(unsigned long) measure->Count,
+				sum / count / 1000.0,
+				measure->Samples[(measure->Count - 1) / 2] / 1000.0,
+				measure->Samples[(ULONG) ((measure->Count - 1) * 0.99)] / 1000.0,
+				measure->Samples[measure->Count - 1] / 1000.0,
+				measure->Allocations / count,
+				measure->AllocatedBytes / count,
+				measure->Irps / count,
+				measure->Locks / count);
+	}
+
+	FILFILE_STATISTICS total;
+
+	if(Statistics(&total))
+	{
+		bool header = false;
+
+		for(ULONG stage = 0; stage < FILFILE_STAT_STAGES; ++stage)
+		{
+			if(!total.StageCalls[stage] || !s_stageNames[stage])
+			{
+				continue;
+			}
+
+			if(!header)
+			{
+				fprintf(out, "\n%-10s %8s %10s\n", "stage", "calls", "mean[us]");
+				header = true;
+			}
+
+			fprintf(out, "%-10s %8llu %10.2f\n",
+					s_stageNames[stage],
+					(unsigned long long) total.StageCalls[stage],
+					(double) total.StageTime[stage] / total.StageCalls[stage]);
+		}
+
+		fprintf(out, "\n");
+
+		for(ULONG index = 0; index < FILFILE_STAT_COUNT; ++index)
+		{
+			if(total.Counter[index])
+			{
+				fprintf(out, "%-18s %10llu\n", s_counterNames[index], (unsigned long long) total.Counter[index]);
+			}
+		}
+
+		for(ULONG index = 0; (index < FILFILE_STAT_MODES) && s_modeNames[index]; ++index)
+		{
+			if(total.Encrypted[index] || total.Decrypted[index])
+			{
+				fprintf(out, "ENCRYPTED_%-8s %10llu\nDECRYPTED_%-8s %10llu\n",
+						s_modeNames[index], (unsigned long long) total.Encrypted[index],
+						s_modeNames[index], (unsigned long long) total.Decrypted[index]);
+			}
+		}
+	}
+
+	fprintf(out, "%-18s %10ld\n", "OUTSTANDING", (long) CSimKernel::Statistics().Outstanding);
+}
+
+void CSimReplay::Close()
+{
+	if(s_handles)
+	{
+		for(ULONG index = 0; index < c_handles; ++index)
+		{
+			if(s_handles[index].Used)
+			{
+				ZwClose(s_handles[index].Handle);
+			}
+		}
+
+		free(s_handles);
+		s_handles = 0;
+	}
+
+	if(s_control)
+	{
+		ZwClose(s_control);
+		s_control = 0;
+	}
+
+	CSimKernel::Run();
+
+	if(s_measures)
+	{
+		for(ULONG operation = 0; operation < c_opCount; ++operation)
+		{
+			free(s_measures[operation].Samples);
+		}
+
+		free(s_measures);
+		s_measures = 0;
+	}
+
+	while(s_shadows)
+	{
+		Shadow *const shadow = s_shadows;
+		s_shadows			 = shadow->Next;
+
+		free(shadow->Data);
+		free(shadow);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CSimReplay.h: interface for the CSimReplay class.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_CSimReplay_H__C2F7A93E_6B18_4D05_9E4A_27B8D3F160E1__INCLUDED_)
+#define AFX_CSimReplay_H__C2F7A93E_6B18_4D05_9E4A_27B8D3F160E1__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <stdio.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class CSimReplay
+{
+	// Feeds a recorded stream of create, read, write and close requests through the driver, which sits on
+	// top of CSimFileSystem. Each request is timed and the allocations the driver made for it are counted,
+	// the report lists both per operation type, followed by the decision stages the driver profiled itself.
+	// Data read back is checked against what was written, and the trace can check statuses, counters of the
+	// driver and whether files are stored encrypted. See traces/README for the format.
+
+public:
+
+	enum c_constants
+	{
+		c_handles			= 64,
+		c_lineLength		= 1024,
+		c_arguments			= 16,
+	};
+
+	enum c_operations
+	{
+		c_opCreate			= 0,
+		c_opRead,
+		c_opWrite,
+		c_opSetInfo,
+		c_opQueryInfo,
+		c_opFlush,
+		c_opClose,
+		c_opControl,
+		c_opCount,
+	};
+
+	static int					Run(FILE *trace, char const* name);		// failed checks
+	static void					Report(FILE *out);
+	static void					Close();
+
+								// DATA
+	static bool					s_verbose;
+
+private:
+
+	struct Shadow;
+	struct Handle;
+	struct Measure;
+
+	static bool					Execute(char *arguments[], ULONG count);
+	static bool					Start();
+	static bool					Entity(char *arguments[], ULONG count, NTSTATUS expected);
+	static NTSTATUS				AutoConfig(LPCWSTR directory, UCHAR const* payload, ULONG payloadSize);
+	static bool					Open(char *arguments[], ULONG count, NTSTATUS expected);
+	static bool					ReadWrite(char *arguments[], ULONG count, NTSTATUS expected, bool write);
+	static bool					Expect(char *arguments[], ULONG count);
+	static bool					Stored(char *arguments[], ULONG count);
+
+	static NTSTATUS				Control(ULONG code, FILFILE_CONTROL *control, ULONG size, void *output = 0, ULONG outputSize = 0);
+	static bool					Statistics(FILFILE_STATISTICS *total, bool reset = false);
+
+	static void					Begin();
+	static void					End(ULONG operation);
+	static bool					Check(NTSTATUS status, NTSTATUS expected, char const* what);
+	static bool					Fail(char const* format, ...);
+
+	static Shadow*				FindShadow(LPCWSTR path, bool create);
+	static Handle*				FindHandle(char const* argument, bool open);
+	static bool					Resize(Shadow *shadow, ULONG size);
+	static void					Pattern(UCHAR *buffer, LONGLONG offset, ULONG length, ULONG seed);
+
+								// DATA
+	static Shadow*				s_shadows;
+	static Handle*				s_handles;
+	static Measure*				s_measures;
+
+	static HANDLE				s_control;
+	static char const*			s_trace;
+	static ULONG				s_line;
+	static ULONG				s_failed;
+
+	static LONGLONG				s_start;
+	static CSimKernel::Counters	s_counters;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // !defined(AFX_CSimReplay_H__C2F7A93E_6B18_4D05_9E4A_27B8D3F160E1__INCLUDED_)
@@ -0,0 +1,1367 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// driver.h - user mode stand-in for Driver.h and the NTIFS header, see CSimKernel
+//
+// Author: Michael Alexander Priske
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _DRIVER_H_
+#define _DRIVER_H_
+
+// Only the types, constants and calls the driver uses are defined here, with the names and semantics of the
+// kernel but not its layouts. Calls are implemented by CSimKernel, requests sent down end in CSimFileSystem.
+// Build with -fshort-wchar, so that WCHAR and L"" literals are 16 bit as on Windows.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef DBG
+#define DBG 0
+#endif
+
+// The WDK defines this for x64 builds, the fixed memory pools of the ciphers are sized by it
+#if defined(__x86_64__) && !defined(_AMD64_)
+#define _AMD64_ 1
+#endif
+
+// COMPILER ///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define __int64				long long
+#define __stdcall
+#define __cdecl
+#define __fastcall
+#define __forceinline		inline
+#define __declspec(x)
+#define DECLSPEC_CACHEALIGN	__attribute__((aligned(64)))
+#define NTAPI
+#define NTKERNELAPI
+#define IN
+#define OUT
+#define OPTIONAL
+#define VOID				void
+
+// No SEH in user mode, the guarded block always runs and no handler is ever entered
+#define __try				if(1)
+#define __except(filter)	else if(0)
+#define __finally			if(1)
+#define __leave				do {} while(0)
+
+#define EXCEPTION_EXECUTE_HANDLER	1
+#define GetExceptionCode()			STATUS_UNSUCCESSFUL
+
+#define C_ASSERT(e)			static_assert(e, #e)
+#define UNREFERENCED_PARAMETER(p)	((void) (p))
+
+// The cipher headers drop offsetof of the DDK, so this one does not depend on it. Records in device
+// extensions hold classes and are not standard layout, CONTAINING_RECORD takes the DDK's form for them
+#define FIELD_OFFSET(type, field)	((LONG) __builtin_offsetof(type, field))
+#define CONTAINING_RECORD(address, type, field) ((type*) ((char*) (address) - (ULONG_PTR) (&((type*) 0)->field)))
+
+#define min(a, b)			(((a) < (b)) ? (a) : (b))
+#define max(a, b)			(((a) > (b)) ? (a) : (b))
+
+// TYPES //////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef unsigned char		UCHAR, *PUCHAR, BYTE;
+typedef char				CHAR, *PCHAR, *LPSTR;
+typedef char const*			LPCSTR, *PCSTR;
+typedef unsigned short		USHORT, *PUSHORT, WORD;
+typedef short				SHORT, CSHORT;
+typedef unsigned int		ULONG, *PULONG, ULONG32, *PULONG32, DWORD, CLONG;
+typedef int					LONG, *PLONG;
+typedef long long			LONGLONG, *PLONGLONG;
+typedef unsigned long long	ULONGLONG, *PULONGLONG, ULONG64;
+typedef uintptr_t			ULONG_PTR, SIZE_T;
+typedef intptr_t			LONG_PTR;
+typedef unsigned char		BOOLEAN, *PBOOLEAN;
+typedef int					BOOL;
+typedef void*				PVOID;
+typedef void*				HANDLE, **PHANDLE;
+typedef wchar_t				WCHAR, *PWCHAR, *PWSTR, *LPWSTR;
+typedef wchar_t const*		LPCWSTR, *PCWSTR;
+typedef LONG				NTSTATUS;
+typedef ULONG				ACCESS_MASK;
+typedef UCHAR				KIRQL, *PKIRQL;
+typedef ULONG_PTR			KSPIN_LOCK, *PKSPIN_LOCK;
+typedef ULONG_PTR			ERESOURCE_THREAD;
+typedef USHORT				NODE_TYPE_CODE;
+typedef SHORT				NODE_BYTE_SIZE;
+
+C_ASSERT(sizeof(WCHAR) == 2);
+C_ASSERT(sizeof(ULONG) == 4);
+
+#define TRUE				1
+#define FALSE				0
+#ifndef NULL
+#define NULL				0
+#endif
+#define UNICODE_NULL		((WCHAR) 0)
+
+#define MAXLONG				0x7fffffff
+#define MAXULONG			0xffffffff
+#define MAXUSHORT			0xffff
+
+typedef union _LARGE_INTEGER
+{
+	struct
+	{
+		ULONG		LowPart;
+		LONG		HighPart;
+	};
+	struct
+	{
+		ULONG		LowPart;
+		LONG		HighPart;
+	} u;
+	LONGLONG		QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _LUID
+{
+	ULONG			LowPart;
+	LONG			HighPart;
+} LUID, *PLUID;
+
+typedef struct _GUID
+{
+	ULONG			Data1;
+	USHORT			Data2;
+	USHORT			Data3;
+	UCHAR			Data4[8];
+} GUID;
+
+typedef struct _LIST_ENTRY
+{
+	struct _LIST_ENTRY	*Flink;
+	struct _LIST_ENTRY	*Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _SINGLE_LIST_ENTRY
+{
+	struct _SINGLE_LIST_ENTRY *Next;
+} SINGLE_LIST_ENTRY, *PSINGLE_LIST_ENTRY;
+
+typedef struct _UNICODE_STRING
+{
+	USHORT			Length;
+	USHORT			MaximumLength;
+	PWSTR			Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef UNICODE_STRING const* PCUNICODE_STRING;
+
+typedef struct _ANSI_STRING
+{
+	USHORT			Length;
+	USHORT			MaximumLength;
+	PCHAR			Buffer;
+} ANSI_STRING, *PANSI_STRING;
+
+#define RTL_CONSTANT_STRING(s) { sizeof(s) - sizeof((s)[0]), sizeof(s), (PWSTR) (s) }
+
+// STATUS /////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define NT_SUCCESS(status)	(((NTSTATUS) (status)) >= 0)
+#define NT_ERROR(status)	((((ULONG) (status)) >> 30) == 3)
+
+#define STATUS_SUCCESS						((NTSTATUS) 0x00000000L)
+#define STATUS_WAIT_0						((NTSTATUS) 0x00000000L)
+#define STATUS_WAIT_1						((NTSTATUS) 0x00000001L)
+#define STATUS_ALERTED						((NTSTATUS) 0x00000101L)
+#define STATUS_TIMEOUT						((NTSTATUS) 0x00000102L)
+#define STATUS_PENDING						((NTSTATUS) 0x00000103L)
+#define STATUS_REPARSE						((NTSTATUS) 0x00000104L)
+#define STATUS_MORE_ENTRIES					((NTSTATUS) 0x00000105L)
+#define STATUS_MORE_PROCESSING_REQUIRED		((NTSTATUS) 0xC0000016L)
+#define STATUS_OBJECT_NAME_EXISTS			((NTSTATUS) 0x40000000L)
+#define STATUS_IMAGE_ALREADY_LOADED			((NTSTATUS) 0xC000010EL)
+#define STATUS_BUFFER_OVERFLOW				((NTSTATUS) 0x80000005L)
+#define STATUS_NO_MORE_FILES				((NTSTATUS) 0x80000006L)
+#define STATUS_NO_MORE_ENTRIES				((NTSTATUS) 0x8000001AL)
+#define STATUS_UNSUCCESSFUL					((NTSTATUS) 0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED				((NTSTATUS) 0xC0000002L)
+#define STATUS_INFO_LENGTH_MISMATCH			((NTSTATUS) 0xC0000004L)
+#define STATUS_INVALID_HANDLE				((NTSTATUS) 0xC0000008L)
+#define STATUS_INVALID_PARAMETER			((NTSTATUS) 0xC000000DL)
+#define STATUS_NO_SUCH_DEVICE				((NTSTATUS) 0xC000000EL)
+#define STATUS_NO_SUCH_FILE					((NTSTATUS) 0xC000000FL)
+#define STATUS_INVALID_DEVICE_REQUEST		((NTSTATUS) 0xC0000010L)
+#define STATUS_END_OF_FILE					((NTSTATUS) 0xC0000011L)
+#define STATUS_ACCESS_DENIED				((NTSTATUS) 0xC0000022L)
+#define STATUS_OBJECT_TYPE_MISMATCH			((NTSTATUS) 0xC0000024L)
+#define STATUS_BUFFER_TOO_SMALL				((NTSTATUS) 0xC0000023L)
+#define STATUS_OBJECT_NAME_INVALID			((NTSTATUS) 0xC0000033L)
+#define STATUS_OBJECT_NAME_NOT_FOUND		((NTSTATUS) 0xC0000034L)
+#define STATUS_OBJECT_NAME_COLLISION		((NTSTATUS) 0xC0000035L)
+#define STATUS_OBJECT_PATH_NOT_FOUND		((NTSTATUS) 0xC000003AL)
+#define STATUS_SHARING_VIOLATION			((NTSTATUS) 0xC0000043L)
+#define STATUS_QUOTA_EXCEEDED				((NTSTATUS) 0xC0000044L)
+#define STATUS_DELETE_PENDING				((NTSTATUS) 0xC0000056L)
+#define STATUS_INSUFFICIENT_RESOURCES		((NTSTATUS) 0xC000009AL)
+#define STATUS_MEDIA_WRITE_PROTECTED		((NTSTATUS) 0xC00000A2L)
+#define STATUS_DEVICE_NOT_READY				((NTSTATUS) 0xC00000A3L)
+#define STATUS_IO_TIMEOUT					((NTSTATUS) 0xC00000B5L)
+#define STATUS_FILE_IS_A_DIRECTORY			((NTSTATUS) 0xC00000BAL)
+#define STATUS_NOT_SUPPORTED				((NTSTATUS) 0xC00000BBL)
+#define STATUS_BAD_NETWORK_NAME				((NTSTATUS) 0xC00000CCL)
+#define STATUS_NOT_SAME_DEVICE				((NTSTATUS) 0xC00000D4L)
+#define STATUS_FILE_CORRUPT_ERROR			((NTSTATUS) 0xC0000102L)
+#define STATUS_DIRECTORY_NOT_EMPTY			((NTSTATUS) 0xC0000101L)
+#define STATUS_NOT_A_DIRECTORY				((NTSTATUS) 0xC0000103L)
+#define STATUS_CANCELLED					((NTSTATUS) 0xC0000120L)
+#define STATUS_CANNOT_DELETE				((NTSTATUS) 0xC0000121L)
+#define STATUS_FILE_CLOSED					((NTSTATUS) 0xC0000128L)
+#define STATUS_UNRECOGNIZED_VOLUME			((NTSTATUS) 0xC000014FL)
+#define STATUS_MAPPED_FILE_SIZE_ZERO		((NTSTATUS) 0xC000011EL)
+#define STATUS_INVALID_USER_BUFFER			((NTSTATUS) 0xC00000E8L)
+#define STATUS_DEVICE_NOT_CONNECTED			((NTSTATUS) 0xC000009DL)
+#define STATUS_DEVICE_BUSY					((NTSTATUS) 0x80000011L)
+
+// DEBUG //////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define ASSERT(e)			assert(e)
+#define PAGED_CODE()
+
+extern "C" ULONG DbgPrint(char const* format, ...);
+
+extern char const* g_debugHeader;
+
+#if DBG
+#define DBGPRINT_N(format) DbgPrint format;
+#define DBGPRINT(format) { DbgPrint(g_debugHeader); DbgPrint format; }
+#else
+#define DBGPRINT(x)
+#define DBGPRINT_N(x)
+#endif
+
+#define FILF_POOL_TAG 'XDKX'
+
+#define MAKELONG(w1, w2) (((ULONG)(w1) << 16) | (ULONG)(w2))
+#define HIWORD(ul) (((ULONG)(ul)) >> 16)
+#define LOWORD(ul) (((ULONG)(ul)) & 0x0000ffff)
+
+// Code segments do not exist here, GCC ignores the pragmas
+#define PAGEDCODE			code_seg("PAGE")
+#define LOCKEDCODE			code_seg()
+#define INITCODE			code_seg("INIT")
+
+#define ABSOLUTE(wait)		(wait)
+#define RELATIVE(wait)		(-(wait))
+
+#define NANOSECONDS(nanos)		(((signed __int64) (nanos)) / 100L)
+#define MICROSECONDS(micros)	(((signed __int64) (micros)) * NANOSECONDS(1000L))
+#define MILLISECONDS(milli)		(((signed __int64) (milli)) * MICROSECONDS(1000L))
+#define SECONDS(seconds)		(((signed __int64) (seconds)) * MILLISECONDS(1000L))
+
+// CONSTANTS //////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define PAGE_SIZE						0x1000
+#define ROUND_TO_PAGES(size)			(((ULONG_PTR) (size) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define SYSTEM_CACHE_ALIGNMENT_SIZE		64
+#define MM_MAXIMUM_DISK_IO_SIZE			(0x10000)
+
+#define PASSIVE_LEVEL					0
+#define APC_LEVEL						1
+#define DISPATCH_LEVEL					2
+
+#define LOW_REALTIME_PRIORITY			16
+#define IO_NO_INCREMENT					0
+#define IO_DISK_INCREMENT				1
+#define EVENT_INCREMENT					1
+#define SEMAPHORE_INCREMENT				1
+
+#define DELETE							0x00010000L
+#define READ_CONTROL					0x00020000L
+#define SYNCHRONIZE						0x00100000L
+#define STANDARD_RIGHTS_READ			READ_CONTROL
+#define STANDARD_RIGHTS_WRITE			READ_CONTROL
+#define STANDARD_RIGHTS_EXECUTE			READ_CONTROL
+#define GENERIC_READ					0x80000000L
+#define GENERIC_WRITE					0x40000000L
+#define GENERIC_EXECUTE					0x20000000L
+#define GENERIC_ALL						0x10000000L
+#define EVENT_ALL_ACCESS				0x1F0003
+#define SEMAPHORE_ALL_ACCESS			0x1F0003
+#define THREAD_ALL_ACCESS				0x1F03FF
+#define KEY_QUERY_VALUE					0x0001
+#define KEY_SET_VALUE					0x0002
+
+#define FILE_READ_DATA					0x0001
+#define FILE_LIST_DIRECTORY				0x0001
+#define FILE_WRITE_DATA					0x0002
+#define FILE_ADD_FILE					0x0002
+#define FILE_APPEND_DATA				0x0004
+#define FILE_ADD_SUBDIRECTORY			0x0004
+#define FILE_READ_EA					0x0008
+#define FILE_WRITE_EA					0x0010
+#define FILE_EXECUTE					0x0020
+#define FILE_TRAVERSE					0x0020
+#define FILE_DELETE_CHILD				0x0040
+#define FILE_READ_ATTRIBUTES			0x0080
+#define FILE_WRITE_ATTRIBUTES			0x0100
+#define FILE_GENERIC_READ				(STANDARD_RIGHTS_READ | FILE_READ_DATA | FILE_READ_ATTRIBUTES | FILE_READ_EA | SYNCHRONIZE)
+#define FILE_GENERIC_WRITE				(STANDARD_RIGHTS_WRITE | FILE_WRITE_DATA | FILE_WRITE_ATTRIBUTES | FILE_WRITE_EA | FILE_APPEND_DATA | SYNCHRONIZE)
+
+#define FILE_SHARE_READ					0x00000001
+#define FILE_SHARE_WRITE				0x00000002
+#define FILE_SHARE_DELETE				0x00000004
+#define FILE_SHARE_VALID_FLAGS			0x00000007
+
+#define FILE_ATTRIBUTE_READONLY			0x00000001
+#define FILE_ATTRIBUTE_HIDDEN			0x00000002
+#define FILE_ATTRIBUTE_SYSTEM			0x00000004
+#define FILE_ATTRIBUTE_DIRECTORY		0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE			0x00000020
+#define FILE_ATTRIBUTE_NORMAL			0x00000080
+#define FILE_ATTRIBUTE_SPARSE_FILE		0x00000200
+#define FILE_ATTRIBUTE_COMPRESSED		0x00000800
+#define FILE_ATTRIBUTE_ENCRYPTED		0x00004000
+
+#define FILE_SUPERSEDE					0x00000000
+#define FILE_OPEN						0x00000001
+#define FILE_CREATE						0x00000002
+#define FILE_OPEN_IF					0x00000003
+#define FILE_OVERWRITE					0x00000004
+#define FILE_OVERWRITE_IF				0x00000005
+
+#define FILE_DIRECTORY_FILE				0x00000001
+#define FILE_WRITE_THROUGH				0x00000002
+#define FILE_SEQUENTIAL_ONLY			0x00000004
+#define FILE_NO_INTERMEDIATE_BUFFERING	0x00000008
+#define FILE_SYNCHRONOUS_IO_ALERT		0x00000010
+#define FILE_SYNCHRONOUS_IO_NONALERT	0x00000020
+#define FILE_NON_DIRECTORY_FILE			0x00000040
+#define FILE_CREATE_TREE_CONNECTION		0x00000080
+#define FILE_COMPLETE_IF_OPLOCKED		0x00000100
+#define FILE_DELETE_ON_CLOSE			0x00001000
+#define FILE_OPEN_BY_FILE_ID			0x00002000
+#define FILE_OPEN_FOR_BACKUP_INTENT		0x00004000
+#define FILE_OPEN_REPARSE_POINT			0x00200000
+#define FILE_OPEN_FOR_FREE_SPACE_QUERY	0x00800000
+
+#define FILE_SUPERSEDED					0x00000000
+#define FILE_OPENED						0x00000001
+#define FILE_CREATED					0x00000002
+#define FILE_OVERWRITTEN				0x00000003
+#define FILE_EXISTS						0x00000004
+#define FILE_DOES_NOT_EXIST				0x00000005
+
+#define FILE_DEVICE_CD_ROM_FILE_SYSTEM		0x00000003
+#define FILE_DEVICE_DFS_FILE_SYSTEM			0x00000035
+#define FILE_DEVICE_DISK					0x00000007
+#define FILE_DEVICE_DISK_FILE_SYSTEM		0x00000008
+#define FILE_DEVICE_FILE_SYSTEM				0x00000009
+#define FILE_DEVICE_MULTI_UNC_PROVIDER		0x00000010
+#define FILE_DEVICE_NETWORK_FILE_SYSTEM		0x00000014
+#define FILE_DEVICE_TAPE_FILE_SYSTEM		0x00000020
+#define FILE_DEVICE_UNKNOWN					0x00000022
+#define FILE_DEVICE_SECURE_OPEN				0x00000100
+#define FILE_REMOTE_DEVICE					0x00000010
+
+#define FILE_ANY_ACCESS					0
+#define FILE_READ_ACCESS				0x0001
+#define FILE_WRITE_ACCESS				0x0002
+#define METHOD_BUFFERED					0
+#define METHOD_IN_DIRECT				1
+#define METHOD_OUT_DIRECT				2
+#define METHOD_NEITHER					3
+
+#define CTL_CODE(type, function, method, access) (((type) << 16) | ((access) << 14) | ((function) << 2) | (method))
+
+#define FSCTL_SET_COMPRESSION			CTL_CODE(0x9, 16, METHOD_BUFFERED, FILE_READ_DATA | FILE_WRITE_DATA)
+#define FSCTL_MOVE_FILE					CTL_CODE(0x9, 29, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_SET_ENCRYPTION			CTL_CODE(0x9, 53, METHOD_NEITHER, FILE_ANY_ACCESS)
+#define FSCTL_QUERY_ALLOCATED_RANGES	CTL_CODE(0x9, 51, METHOD_NEITHER, FILE_READ_DATA)
+
+#define COMPRESSION_FORMAT_NONE			0
+#define FILE_SET_ENCRYPTION				0x00000001
+#define STREAM_SET_ENCRYPTION			0x00000003
+
+#define IRP_MJ_CREATE					0x00
+#define IRP_MJ_CREATE_NAMED_PIPE		0x01
+#define IRP_MJ_CLOSE					0x02
+#define IRP_MJ_READ						0x03
+#define IRP_MJ_WRITE					0x04
+#define IRP_MJ_QUERY_INFORMATION		0x05
+#define IRP_MJ_SET_INFORMATION			0x06
+#define IRP_MJ_QUERY_EA					0x07
+#define IRP_MJ_SET_EA					0x08
+#define IRP_MJ_FLUSH_BUFFERS			0x09
+#define IRP_MJ_QUERY_VOLUME_INFORMATION	0x0a
+#define IRP_MJ_SET_VOLUME_INFORMATION	0x0b
+#define IRP_MJ_DIRECTORY_CONTROL		0x0c
+#define IRP_MJ_FILE_SYSTEM_CONTROL		0x0d
+#define IRP_MJ_DEVICE_CONTROL			0x0e
+#define IRP_MJ_INTERNAL_DEVICE_CONTROL	0x0f
+#define IRP_MJ_SHUTDOWN					0x10
+#define IRP_MJ_LOCK_CONTROL				0x11
+#define IRP_MJ_CLEANUP					0x12
+#define IRP_MJ_CREATE_MAILSLOT			0x13
+#define IRP_MJ_QUERY_SECURITY			0x14
+#define IRP_MJ_SET_SECURITY				0x15
+#define IRP_MJ_MAXIMUM_FUNCTION			0x1b
+
+#define IRP_MN_NORMAL					0x00
+#define IRP_MN_QUERY_DIRECTORY			0x01
+#define IRP_MN_NOTIFY_CHANGE_DIRECTORY	0x02
+#define IRP_MN_USER_FS_REQUEST			0x00
+#define IRP_MN_MOUNT_VOLUME				0x01
+#define IRP_MN_LOAD_FILE_SYSTEM			0x03
+#define IRP_MN_MDL						0x02
+#define IRP_MN_COMPLETE					0x04
+
+#define IRP_NOCACHE						0x00000001
+#define IRP_PAGING_IO					0x00000002
+#define IRP_SYNCHRONOUS_API				0x00000004
+#define IRP_SYNCHRONOUS_PAGING_IO		0x00000040
+#define IRP_READ_OPERATION				0x00000100
+#define IRP_WRITE_OPERATION				0x00000200
+#define IRP_CLOSE_OPERATION				0x00000400
+#define IRP_DEFER_IO_COMPLETION			0x00000800
+
+#define SL_PENDING_RETURNED				0x01
+#define SL_INVOKE_ON_CANCEL				0x20
+#define SL_INVOKE_ON_SUCCESS			0x40
+#define SL_INVOKE_ON_ERROR				0x80
+#define SL_OPEN_PAGING_FILE				0x02
+#define SL_OPEN_TARGET_DIRECTORY		0x04
+#define SL_WRITE_THROUGH				0x04
+#define SL_CASE_SENSITIVE				0x80
+#define SL_RESTART_SCAN					0x01
+#define SL_RETURN_SINGLE_ENTRY			0x02
+#define SL_INDEX_SPECIFIED				0x04
+
+#define FO_FILE_OPEN					0x00000001
+#define FO_SYNCHRONOUS_IO				0x00000002
+#define FO_ALERTABLE_IO					0x00000004
+#define FO_NO_INTERMEDIATE_BUFFERING	0x00000008
+#define FO_WRITE_THROUGH				0x00000010
+#define FO_SEQUENTIAL_ONLY				0x00000020
+#define FO_CACHE_SUPPORTED				0x00000040
+#define FO_NAMED_PIPE					0x00000080
+#define FO_STREAM_FILE					0x00000100
+#define FO_MAILSLOT						0x00000200
+#define FO_DIRECT_DEVICE_OPEN			0x00000800
+#define FO_FILE_MODIFIED				0x00001000
+#define FO_CLEANUP_COMPLETE				0x00004000
+#define FO_DELETE_ON_CLOSE				0x00010000
+#define FO_VOLUME_OPEN					0x00400000
+#define FO_REMOTE_ORIGIN				0x01000000
+
+#define DO_BUFFERED_IO					0x00000004
+#define DO_DIRECT_IO					0x00000010
+#define DO_DEVICE_INITIALIZING			0x00000080
+
+#define OBJ_CASE_INSENSITIVE			0x00000040L
+#define OBJ_KERNEL_HANDLE				0x00000200L
+
+#define REG_SZ							1
+#define REG_DWORD						4
+#define REG_OPTION_NON_VOLATILE			0
+
+#define VER_SUITE_TERMINAL				0x00000010
+#define VER_SUITE_SINGLEUSERTS			0x00000100
+
+#define TOKEN_SOURCE_LENGTH				8
+
+#define FSRTL_MAX_TOP_LEVEL_IRP_FLAG	((ULONG_PTR) 0xFFFF)
+
+// ENUMS //////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef char				CCHAR;
+typedef CCHAR				KPROCESSOR_MODE;
+
+enum _MODE { KernelMode, UserMode, MaximumMode };
+
+typedef enum _POOL_TYPE
+{
+	NonPagedPool,
+	PagedPool,
+	NonPagedPoolMustSucceed,
+	DontUseThisType,
+	NonPagedPoolCacheAligned,
+	PagedPoolCacheAligned,
+} POOL_TYPE;
+
+typedef enum _EVENT_TYPE { NotificationEvent, SynchronizationEvent } EVENT_TYPE;
+
+typedef enum _KWAIT_REASON { Executive, UserRequest, WrQueue = 15 } KWAIT_REASON;
+
+typedef enum _TIMER_TYPE { NotificationTimer, SynchronizationTimer } TIMER_TYPE;
+
+typedef enum _WORK_QUEUE_TYPE { CriticalWorkQueue, DelayedWorkQueue, HyperCriticalWorkQueue } WORK_QUEUE_TYPE;
+
+typedef enum _LOCK_OPERATION { IoReadAccess, IoWriteAccess, IoModifyAccess } LOCK_OPERATION;
+
+typedef enum _MM_PAGE_PRIORITY { LowPagePriority, NormalPagePriority = 16, HighPagePriority = 32 } MM_PAGE_PRIORITY;
+
+typedef enum _FILE_INFORMATION_CLASS
+{
+	FileDirectoryInformation			= 1,
+	FileFullDirectoryInformation,
+	FileBothDirectoryInformation,
+	FileBasicInformation,
+	FileStandardInformation,
+	FileInternalInformation,
+	FileEaInformation,
+	FileAccessInformation,
+	FileNameInformation,
+	FileRenameInformation,
+	FileLinkInformation,
+	FileNamesInformation,
+	FileDispositionInformation,
+	FilePositionInformation,
+	FileFullEaInformation,
+	FileModeInformation,
+	FileAlignmentInformation,
+	FileAllInformation,
+	FileAllocationInformation,
+	FileEndOfFileInformation,
+	FileAlternateNameInformation,
+	FileStreamInformation,
+	FilePipeInformation,
+	FilePipeLocalInformation,
+	FilePipeRemoteInformation,
+	FileMailslotQueryInformation,
+	FileMailslotSetInformation,
+	FileCompressionInformation,
+	FileObjectIdInformation,
+	FileCompletionInformation,
+	FileMoveClusterInformation,
+	FileQuotaInformation,
+	FileReparsePointInformation,
+	FileNetworkOpenInformation,
+	FileAttributeTagInformation,
+	FileTrackingInformation,
+	FileIdBothDirectoryInformation,
+	FileIdFullDirectoryInformation,
+	FileValidDataLengthInformation,
+	FileShortNameInformation,
+	FileMaximumInformation
+} FILE_INFORMATION_CLASS;
+
+typedef enum _FS_INFORMATION_CLASS
+{
+	FileFsVolumeInformation = 1,
+	FileFsAttributeInformation = 5,
+	FileFsDeviceInformation = 4,
+} FS_INFORMATION_CLASS;
+
+typedef enum _KEY_INFORMATION_CLASS { KeyBasicInformation, KeyNodeInformation, KeyFullInformation } KEY_INFORMATION_CLASS;
+
+typedef enum _KEY_VALUE_INFORMATION_CLASS
+{
+	KeyValueBasicInformation,
+	KeyValueFullInformation,
+	KeyValuePartialInformation
+} KEY_VALUE_INFORMATION_CLASS;
+
+
+typedef enum _SECURITY_IMPERSONATION_LEVEL { SecurityAnonymous, SecurityIdentification, SecurityImpersonation, SecurityDelegation } SECURITY_IMPERSONATION_LEVEL;
+
+typedef enum _TOKEN_INFORMATION_CLASS { TokenUser = 1, TokenSource = 7, TokenStatistics = 10, TokenSessionId = 12 } TOKEN_INFORMATION_CLASS;
+
+typedef enum _PROCESSINFOCLASS { ProcessBasicInformation, ProcessImageFileName = 27 } PROCESSINFOCLASS;
+
+typedef enum _FAST_IO_POSSIBLE { FastIoIsNotPossible, FastIoIsPossible, FastIoIsQuestionable } FAST_IO_POSSIBLE;
+
+typedef enum _FSRTL_COMPARISON_RESULT { LessThan = -1, EqualTo = 0, GreaterThan = 1 } FSRTL_COMPARISON_RESULT;
+
+
+// OBJECTS ////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct _IRP;
+struct _DEVICE_OBJECT;
+struct _DRIVER_OBJECT;
+struct _FILE_OBJECT;
+struct _KTHREAD;
+struct _EPROCESS;
+struct _MDL;
+
+typedef struct _KTHREAD	*PKTHREAD, *PETHREAD;
+typedef struct _EPROCESS*	PEPROCESS;
+typedef struct _OBJECT_TYPE*	POBJECT_TYPE;
+typedef void*				PACCESS_TOKEN;
+typedef void*				PSECURITY_DESCRIPTOR;
+
+typedef struct _DISPATCHER_HEADER
+{
+	LONG			SignalState;
+	UCHAR			Type;
+} DISPATCHER_HEADER;
+
+typedef struct _KEVENT
+{
+	DISPATCHER_HEADER	Header;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+typedef struct _KSEMAPHORE
+{
+	DISPATCHER_HEADER	Header;
+	LONG				Limit;
+} KSEMAPHORE, *PKSEMAPHORE, *PRKSEMAPHORE;
+
+typedef struct _KMUTEX
+{
+	DISPATCHER_HEADER	Header;
+} KMUTEX, *PKMUTEX;
+
+typedef struct _FAST_MUTEX
+{
+	LONG			Count;
+	PKTHREAD		Owner;
+} FAST_MUTEX, *PFAST_MUTEX;
+
+// Recursive for exclusive owners, counts shared ones; a single replay thread never waits on it
+typedef struct _ERESOURCE
+{
+	LONG			Exclusive;
+	LONG			Shared;
+	PKTHREAD		Owner;
+} ERESOURCE, *PERESOURCE;
+
+typedef struct _KDPC
+{
+	void			(*Routine)(struct _KDPC*, void*, void*, void*);
+	void*			Context;
+} KDPC, *PKDPC, *PRKDPC;
+
+typedef void KDEFERRED_ROUTINE(KDPC *dpc, void *context, void *arg1, void *arg2);
+typedef KDEFERRED_ROUTINE *PKDEFERRED_ROUTINE;
+
+typedef struct _KTIMER
+{
+	DISPATCHER_HEADER	Header;
+	LARGE_INTEGER		DueTime;
+	KDPC*				Dpc;
+} KTIMER, *PKTIMER;
+
+typedef void WORKER_THREAD_ROUTINE(void *context);
+typedef WORKER_THREAD_ROUTINE *PWORKER_THREAD_ROUTINE;
+
+typedef struct _WORK_QUEUE_ITEM
+{
+	LIST_ENTRY				List;
+	PWORKER_THREAD_ROUTINE	WorkerRoutine;
+	void*					Parameter;
+} WORK_QUEUE_ITEM, *PWORK_QUEUE_ITEM;
+
+typedef struct _IO_WORKITEM *PIO_WORKITEM;
+typedef void IO_WORKITEM_ROUTINE(struct _DEVICE_OBJECT *device, void *context);
+typedef IO_WORKITEM_ROUTINE *PIO_WORKITEM_ROUTINE;
+
+typedef struct _NPAGED_LOOKASIDE_LIST
+{
+	ULONG			Size;
+	ULONG			Tag;
+	USHORT			Depth;			// entries kept on the list at most
+	USHORT			Count;
+	SINGLE_LIST_ENTRY ListHead;
+} NPAGED_LOOKASIDE_LIST, *PNPAGED_LOOKASIDE_LIST, PAGED_LOOKASIDE_LIST, *PPAGED_LOOKASIDE_LIST;
+
+typedef struct _IO_STATUS_BLOCK
+{
+	union
+	{
+		NTSTATUS	Status;
+		void*		Pointer;
+	};
+	ULONG_PTR		Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef struct _MDL
+{
+	struct _MDL*	Next;
+	CSHORT			Size;
+	CSHORT			MdlFlags;
+	void*			MappedSystemVa;
+	void*			StartVa;
+	ULONG			ByteCount;
+	ULONG			ByteOffset;
+} MDL, *PMDL;
+
+typedef struct _VPB
+{
+	CSHORT					Type;
+	CSHORT					Size;
+	USHORT					Flags;
+	USHORT					VolumeLabelLength;
+	struct _DEVICE_OBJECT*	DeviceObject;
+	struct _DEVICE_OBJECT*	RealDevice;
+	ULONG					SerialNumber;
+	ULONG					ReferenceCount;
+	WCHAR					VolumeLabel[32];
+} VPB, *PVPB;
+
+typedef struct _SECTION_OBJECT_POINTERS
+{
+	void*			DataSectionObject;
+	void*			SharedCacheMap;
+	void*			ImageSectionObject;
+} SECTION_OBJECT_POINTERS, *PSECTION_OBJECT_POINTERS;
+
+typedef struct _OBJECT_ATTRIBUTES
+{
+	ULONG			Length;
+	HANDLE			RootDirectory;
+	UNICODE_STRING*	ObjectName;
+	ULONG			Attributes;
+	void*			SecurityDescriptor;
+	void*			SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, *POBJECT_ATTRIBUTES;
+
+#define InitializeObjectAttributes(p, n, a, r, s) \
+	{ (p)->Length = sizeof(OBJECT_ATTRIBUTES); (p)->RootDirectory = (r); (p)->Attributes = (a); \
+	  (p)->ObjectName = (n); (p)->SecurityDescriptor = (s); (p)->SecurityQualityOfService = 0; }
+
+typedef struct _OBJECT_NAME_INFORMATION
+{
+	UNICODE_STRING	Name;
+} OBJECT_NAME_INFORMATION, *POBJECT_NAME_INFORMATION;
+
+typedef struct _TOKEN_SOURCE
+{
+	CHAR			SourceName[TOKEN_SOURCE_LENGTH];
+	LUID			SourceIdentifier;
+} TOKEN_SOURCE;
+
+typedef struct _SECURITY_SUBJECT_CONTEXT
+{
+	PACCESS_TOKEN	ClientToken;
+	SECURITY_IMPERSONATION_LEVEL ImpersonationLevel;
+	PACCESS_TOKEN	PrimaryToken;
+	void*			ProcessAuditId;
+} SECURITY_SUBJECT_CONTEXT, *PSECURITY_SUBJECT_CONTEXT;
+
+typedef struct _ACCESS_STATE
+{
+	LUID						OperationID;
+	BOOLEAN						SecurityEvaluated;
+	ACCESS_MASK					RemainingDesiredAccess;
+	ACCESS_MASK					PreviouslyGrantedAccess;
+	ACCESS_MASK					OriginalDesiredAccess;
+	SECURITY_SUBJECT_CONTEXT	SubjectSecurityContext;
+} ACCESS_STATE, *PACCESS_STATE;
+
+typedef struct _IO_SECURITY_CONTEXT
+{
+	void*			SecurityQos;
+	PACCESS_STATE	AccessState;
+	ACCESS_MASK		DesiredAccess;
+	ULONG			FullCreateOptions;
+} IO_SECURITY_CONTEXT, *PIO_SECURITY_CONTEXT;
+
+typedef struct _FILE_OBJECT
+{
+	CSHORT					Type;
+	CSHORT					Size;
+	struct _DEVICE_OBJECT*	DeviceObject;
+	PVPB					Vpb;
+	void*					FsContext;
+	void*					FsContext2;
+	PSECTION_OBJECT_POINTERS SectionObjectPointer;
+	void*					PrivateCacheMap;
+	NTSTATUS				FinalStatus;
+	struct _FILE_OBJECT*	RelatedFileObject;
+	BOOLEAN					LockOperation;
+	BOOLEAN					DeletePending;
+	BOOLEAN					ReadAccess;
+	BOOLEAN					WriteAccess;
+	BOOLEAN					DeleteAccess;
+	BOOLEAN					SharedRead;
+	BOOLEAN					SharedWrite;
+	BOOLEAN					SharedDelete;
+	ULONG					Flags;
+	UNICODE_STRING			FileName;
+	LARGE_INTEGER			CurrentByteOffset;
+	ULONG					Waiters;
+	ULONG					Busy;
+	void*					LastLock;
+	KEVENT					Lock;
+	KEVENT					Event;
+} FILE_OBJECT, *PFILE_OBJECT;
+
+typedef struct _IO_STACK_LOCATION
+{
+	UCHAR			MajorFunction;
+	UCHAR			MinorFunction;
+	UCHAR			Flags;
+	UCHAR			Control;
+
+	union
+	{
+		struct
+		{
+			PIO_SECURITY_CONTEXT	SecurityContext;
+			ULONG					Options;
+			USHORT					FileAttributes;
+			USHORT					ShareAccess;
+			ULONG					EaLength;
+		} Create;
+
+		struct
+		{
+			ULONG					Length;
+			ULONG					Key;
+			LARGE_INTEGER			ByteOffset;
+		} Read;
+
+		struct
+		{
+			ULONG					Length;
+			ULONG					Key;
+			LARGE_INTEGER			ByteOffset;
+		} Write;
+
+		struct
+		{
+			ULONG					Length;
+			UNICODE_STRING*			FileName;
+			FILE_INFORMATION_CLASS	FileInformationClass;
+			ULONG					FileIndex;
+		} QueryDirectory;
+
+		struct
+		{
+			ULONG					Length;
+			FILE_INFORMATION_CLASS	FileInformationClass;
+		} QueryFile;
+
+		struct
+		{
+			ULONG					Length;
+			FILE_INFORMATION_CLASS	FileInformationClass;
+			struct _FILE_OBJECT*	FileObject;
+			union
+			{
+				struct
+				{
+					BOOLEAN			ReplaceIfExists;
+					BOOLEAN			AdvanceOnly;
+				};
+				ULONG				ClusterCount;
+				HANDLE				DeleteHandle;
+			};
+		} SetFile;
+
+		struct
+		{
+			ULONG					Length;
+			FS_INFORMATION_CLASS	FsInformationClass;
+		} QueryVolume;
+
+		struct
+		{
+			ULONG					OutputBufferLength;
+			ULONG					InputBufferLength;
+			ULONG					FsControlCode;
+			void*					Type3InputBuffer;
+		} FileSystemControl;
+
+		struct
+		{
+			ULONG					OutputBufferLength;
+			ULONG					InputBufferLength;
+			ULONG					IoControlCode;
+			void*					Type3InputBuffer;
+		} DeviceIoControl;
+
+		struct
+		{
+			PVPB					Vpb;
+			struct _DEVICE_OBJECT*	DeviceObject;
+		} MountVolume;
+
+		struct
+		{
+			void*					Argument1;
+			void*					Argument2;
+			void*					Argument3;
+			void*					Argument4;
+		} Others;
+	} Parameters;
+
+	struct _DEVICE_OBJECT*	DeviceObject;
+	struct _FILE_OBJECT*	FileObject;
+
+	NTSTATUS				(*CompletionRoutine)(struct _DEVICE_OBJECT*, struct _IRP*, void*);
+	void*					Context;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _IRP
+{
+	CSHORT					Type;
+	USHORT					Size;
+	PMDL					MdlAddress;
+	ULONG					Flags;
+
+	union
+	{
+		struct _IRP*		MasterIrp;
+		LONG				IrpCount;
+		void*				SystemBuffer;
+	} AssociatedIrp;
+
+	LIST_ENTRY				ThreadListEntry;
+	IO_STATUS_BLOCK			IoStatus;
+	KPROCESSOR_MODE			RequestorMode;
+	BOOLEAN					PendingReturned;
+	CHAR					StackCount;
+	CHAR					CurrentLocation;
+	BOOLEAN					Cancel;
+	KIRQL					CancelIrql;
+	PIO_STATUS_BLOCK		UserIosb;
+	PKEVENT					UserEvent;
+	void					(*CancelRoutine)(struct _DEVICE_OBJECT*, struct _IRP*);
+	void*					UserBuffer;
+
+	struct
+	{
+		struct
+		{
+			void*					DriverContext[4];
+			PETHREAD				Thread;
+			LIST_ENTRY				ListEntry;
+			IO_STACK_LOCATION*		CurrentStackLocation;
+			struct _FILE_OBJECT*	OriginalFileObject;
+		} Overlay;
+	} Tail;
+
+	IO_STACK_LOCATION		Stack[8];		// stack locations follow in the kernel, here they are part of the IRP
+} IRP, *PIRP;
+
+typedef NTSTATUS DRIVER_DISPATCH(struct _DEVICE_OBJECT *device, IRP *irp);
+typedef DRIVER_DISPATCH *PDRIVER_DISPATCH;
+
+typedef void DRIVER_CANCEL(struct _DEVICE_OBJECT *device, IRP *irp);
+typedef DRIVER_CANCEL *PDRIVER_CANCEL;
+
+typedef NTSTATUS IO_COMPLETION_ROUTINE(struct _DEVICE_OBJECT *device, IRP *irp, void *context);
+typedef IO_COMPLETION_ROUTINE *PIO_COMPLETION_ROUTINE;
+
+typedef struct _FAST_IO_DISPATCH
+{
+	ULONG			SizeOfFastIoDispatch;
+	BOOLEAN		(*FastIoCheckIfPossible)(struct _FILE_OBJECT*, LARGE_INTEGER*, ULONG, BOOLEAN, ULONG, BOOLEAN, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoRead)(struct _FILE_OBJECT*, LARGE_INTEGER*, ULONG, BOOLEAN, ULONG, void*, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoWrite)(struct _FILE_OBJECT*, LARGE_INTEGER*, ULONG, BOOLEAN, ULONG, void*, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoQueryBasicInfo)(struct _FILE_OBJECT*, BOOLEAN, struct _FILE_BASIC_INFORMATION*, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoQueryStandardInfo)(struct _FILE_OBJECT*, BOOLEAN, struct _FILE_STANDARD_INFORMATION*, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoLock)(struct _FILE_OBJECT*, LARGE_INTEGER*, LARGE_INTEGER*, PEPROCESS, ULONG, BOOLEAN, BOOLEAN, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoUnlockSingle)(struct _FILE_OBJECT*, LARGE_INTEGER*, LARGE_INTEGER*, PEPROCESS, ULONG, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoUnlockAll)(struct _FILE_OBJECT*, PEPROCESS, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoUnlockAllByKey)(struct _FILE_OBJECT*, void*, ULONG, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoDeviceControl)(struct _FILE_OBJECT*, BOOLEAN, void*, ULONG, void*, ULONG, ULONG, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	void		(*AcquireFileForNtCreateSection)(struct _FILE_OBJECT*);
+	void		(*ReleaseFileForNtCreateSection)(struct _FILE_OBJECT*);
+	void		(*FastIoDetachDevice)(struct _DEVICE_OBJECT*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoQueryNetworkOpenInfo)(struct _FILE_OBJECT*, BOOLEAN, struct _FILE_NETWORK_OPEN_INFORMATION*, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	NTSTATUS		(*AcquireForModWrite)(struct _FILE_OBJECT*, LARGE_INTEGER*, struct _ERESOURCE**, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*MdlRead)(struct _FILE_OBJECT*, LARGE_INTEGER*, ULONG, ULONG, struct _MDL**, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*MdlReadComplete)(struct _FILE_OBJECT*, struct _MDL*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*PrepareMdlWrite)(struct _FILE_OBJECT*, LARGE_INTEGER*, ULONG, ULONG, struct _MDL**, IO_STATUS_BLOCK*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*MdlWriteComplete)(struct _FILE_OBJECT*, LARGE_INTEGER*, struct _MDL*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoReadCompressed)(struct _FILE_OBJECT*, LARGE_INTEGER*, ULONG, ULONG, void*, struct _MDL**, IO_STATUS_BLOCK*, struct _COMPRESSED_DATA_INFO*, ULONG, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoWriteCompressed)(struct _FILE_OBJECT*, LARGE_INTEGER*, ULONG, ULONG, void*, struct _MDL**, IO_STATUS_BLOCK*, struct _COMPRESSED_DATA_INFO*, ULONG, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*MdlReadCompleteCompressed)(struct _FILE_OBJECT*, struct _MDL*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*MdlWriteCompleteCompressed)(struct _FILE_OBJECT*, LARGE_INTEGER*, struct _MDL*, struct _DEVICE_OBJECT*);
+	BOOLEAN		(*FastIoQueryOpen)(struct _IRP*, struct _FILE_NETWORK_OPEN_INFORMATION*, struct _DEVICE_OBJECT*);
+	NTSTATUS		(*ReleaseForModWrite)(struct _FILE_OBJECT*, struct _ERESOURCE*, struct _DEVICE_OBJECT*);
+	NTSTATUS		(*AcquireForCcFlush)(struct _FILE_OBJECT*, struct _DEVICE_OBJECT*);
+	NTSTATUS		(*ReleaseForCcFlush)(struct _FILE_OBJECT*, struct _DEVICE_OBJECT*);
+} FAST_IO_DISPATCH, *PFAST_IO_DISPATCH;
+
+typedef struct _DRIVER_EXTENSION
+{
+	struct _DRIVER_OBJECT*	DriverObject;
+} DRIVER_EXTENSION;
+
+typedef struct _DRIVER_OBJECT
+{
+	CSHORT					Type;
+	CSHORT					Size;
+	struct _DEVICE_OBJECT*	DeviceObject;
+	ULONG					Flags;
+	DRIVER_EXTENSION*		DriverExtension;
+	UNICODE_STRING			DriverName;
+	PFAST_IO_DISPATCH		FastIoDispatch;
+	void*					DriverUnload;
+	PDRIVER_DISPATCH		MajorFunction[IRP_MJ_MAXIMUM_FUNCTION + 1];
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef struct _DEVICE_OBJECT
+{
+	CSHORT					Type;
+	USHORT					Size;
+	LONG					ReferenceCount;
+	struct _DRIVER_OBJECT*	DriverObject;
+	struct _DEVICE_OBJECT*	NextDevice;
+	struct _DEVICE_OBJECT*	AttachedDevice;
+	ULONG					Flags;
+	ULONG					Characteristics;
+	PVPB					Vpb;
+	void*					DeviceExtension;
+	ULONG					DeviceType;
+	CCHAR					StackSize;
+	ULONG					AlignmentRequirement;
+	USHORT					SectorSize;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+// FILE SYSTEM ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct _FSRTL_COMMON_FCB_HEADER
+{
+	NODE_TYPE_CODE	NodeTypeCode;
+	NODE_BYTE_SIZE	NodeByteSize;
+	UCHAR			Flags;
+	UCHAR			IsFastIoPossible;
+	UCHAR			Flags2;
+	UCHAR			Reserved;
+	PERESOURCE		Resource;
+	PERESOURCE		PagingIoResource;
+	LARGE_INTEGER	AllocationSize;
+	LARGE_INTEGER	FileSize;
+	LARGE_INTEGER	ValidDataLength;
+} FSRTL_COMMON_FCB_HEADER, *PFSRTL_COMMON_FCB_HEADER;
+
+typedef struct _FSRTL_ADVANCED_FCB_HEADER : FSRTL_COMMON_FCB_HEADER
+{
+	PFAST_MUTEX		FastMutex;
+	LIST_ENTRY		FilterContexts;
+	void*			PushLock;
+	void**			FileContextSupportPointer;
+} FSRTL_ADVANCED_FCB_HEADER, *PFSRTL_ADVANCED_FCB_HEADER;
+
+#define FSRTL_FLAG2_SUPPORTS_FILTER_CONTEXTS	(0x02)
+
+typedef void FREE_CONTEXT_ROUTINE(void *context);
+
+typedef struct _FSRTL_PER_STREAM_CONTEXT
+{
+	LIST_ENTRY		Links;
+	void*			OwnerId;
+	void*			InstanceId;
+	void			(*FreeCallback)(void *context);
+} FSRTL_PER_STREAM_CONTEXT, *PFSRTL_PER_STREAM_CONTEXT;
+
+#define FsRtlInitPerStreamContext(ctx, owner, instance, callback) \
+	{ (ctx)->OwnerId = (owner); (ctx)->InstanceId = (instance); (ctx)->FreeCallback = (callback); }
+
+#define FsRtlSupportsPerStreamContexts(file) \
+	(((file)->FsContext) && (((PFSRTL_ADVANCED_FCB_HEADER) (file)->FsContext)->Flags2 & FSRTL_FLAG2_SUPPORTS_FILTER_CONTEXTS))
+
+typedef struct _CC_FILE_SIZES
+{
+	LARGE_INTEGER	AllocationSize;
+	LARGE_INTEGER	FileSize;
+	LARGE_INTEGER	ValidDataLength;
+} CC_FILE_SIZES, *PCC_FILE_SIZES;
+
+typedef struct _FS_FILTER_CALLBACKS
+{
+	ULONG			SizeOfFsFilterCallbacks;
+	ULONG			Reserved;
+	void*			Callbacks[12];
+} FS_FILTER_CALLBACKS, *PFS_FILTER_CALLBACKS;
+
+typedef struct _FILE_BASIC_INFORMATION
+{
+	LARGE_INTEGER	CreationTime;
+	LARGE_INTEGER	LastAccessTime;
+	LARGE_INTEGER	LastWriteTime;
+	LARGE_INTEGER	ChangeTime;
+	ULONG			FileAttributes;
+} FILE_BASIC_INFORMATION, *PFILE_BASIC_INFORMATION;
+
+typedef struct _FILE_STANDARD_INFORMATION
+{
+	LARGE_INTEGER	AllocationSize;
+	LARGE_INTEGER	EndOfFile;
+	ULONG			NumberOfLinks;
+	BOOLEAN			DeletePending;
+	BOOLEAN			Directory;
+} FILE_STANDARD_INFORMATION, *PFILE_STANDARD_INFORMATION;
+
+typedef struct _FILE_NETWORK_OPEN_INFORMATION
+{
+	LARGE_INTEGER	CreationTime;
+	LARGE_INTEGER	LastAccessTime;
+	LARGE_INTEGER	LastWriteTime;
+	LARGE_INTEGER	ChangeTime;
+	LARGE_INTEGER	AllocationSize;
+	LARGE_INTEGER	EndOfFile;
+	ULONG			FileAttributes;
+} FILE_NETWORK_OPEN_INFORMATION, *PFILE_NETWORK_OPEN_INFORMATION;
+
+typedef struct _FILE_NAME_INFORMATION
+{
+	ULONG			FileNameLength;
+	WCHAR			FileName[1];
+} FILE_NAME_INFORMATION, *PFILE_NAME_INFORMATION;
+
+typedef struct _FILE_POSITION_INFORMATION
+{
+	LARGE_INTEGER	CurrentByteOffset;
+} FILE_POSITION_INFORMATION;
+
+typedef struct _FILE_INTERNAL_INFORMATION
+{
+	LARGE_INTEGER	IndexNumber;
+} FILE_INTERNAL_INFORMATION;
+
+typedef struct _FILE_EA_INFORMATION
+{
+	ULONG			EaSize;
+} FILE_EA_INFORMATION;
+
+typedef struct _FILE_ACCESS_INFORMATION
+{
+	ACCESS_MASK		AccessFlags;
+} FILE_ACCESS_INFORMATION;
+
+typedef struct _FILE_MODE_INFORMATION
+{
+	ULONG			Mode;
+} FILE_MODE_INFORMATION;
+
+typedef struct _FILE_ALIGNMENT_INFORMATION
+{
+	ULONG			AlignmentRequirement;
+} FILE_ALIGNMENT_INFORMATION;
+
+typedef struct _FILE_ALL_INFORMATION
+{
+	FILE_BASIC_INFORMATION		BasicInformation;
+	FILE_STANDARD_INFORMATION	StandardInformation;
+	FILE_INTERNAL_INFORMATION	InternalInformation;
+	FILE_EA_INFORMATION			EaInformation;
+	FILE_ACCESS_INFORMATION		AccessInformation;
+	FILE_POSITION_INFORMATION	PositionInformation;
+	FILE_MODE_INFORMATION		ModeInformation;
+	FILE_ALIGNMENT_INFORMATION	AlignmentInformation;
+	FILE_NAME_INFORMATION		NameInformation;
+} FILE_ALL_INFORMATION, *PFILE_ALL_INFORMATION;
+
+typedef struct _FILE_END_OF_FILE_INFORMATION
+{
+	LARGE_INTEGER	EndOfFile;
+} FILE_END_OF_FILE_INFORMATION, *PFILE_END_OF_FILE_INFORMATION;
+
+typedef struct _FILE_ALLOCATION_INFORMATION
+{
+	LARGE_INTEGER	AllocationSize;
+} FILE_ALLOCATION_INFORMATION, *PFILE_ALLOCATION_INFORMATION;
+
+typedef struct _FILE_DISPOSITION_INFORMATION
+{
+	BOOLEAN			DeleteFile;
+} FILE_DISPOSITION_INFORMATION, *PFILE_DISPOSITION_INFORMATION;
+
+typedef struct _FILE_RENAME_INFORMATION
+{
+	BOOLEAN			ReplaceIfExists;
+	HANDLE			RootDirectory;
+	ULONG			FileNameLength;
+	WCHAR			FileName[1];
+} FILE_RENAME_INFORMATION, *PFILE_RENAME_INFORMATION;
+
+typedef struct _FILE_STREAM_INFORMATION
+{
+	ULONG			NextEntryOffset;
+	ULONG			StreamNameLength;
+	LARGE_INTEGER	StreamSize;
+	LARGE_INTEGER	StreamAllocationSize;
+	WCHAR			StreamName[1];
+} FILE_STREAM_INFORMATION, *PFILE_STREAM_INFORMATION;
+
+typedef struct _FILE_DIRECTORY_INFORMATION
+{
+	ULONG			NextEntryOffset;
+	ULONG			FileIndex;
+	LARGE_INTEGER	CreationTime;
+	LARGE_INTEGER	LastAccessTime;
+	LARGE_INTEGER	LastWriteTime;
+	LARGE_INTEGER	ChangeTime;
+	LARGE_INTEGER	EndOfFile;
+	LARGE_INTEGER	AllocationSize;
+	ULONG			FileAttributes;
+	ULONG			FileNameLength;
+	WCHAR			FileName[1];
+} FILE_DIRECTORY_INFORMATION, *PFILE_DIRECTORY_INFORMATION;
+
+typedef struct _FILE_FULL_DIR_INFORMATION
+{
+	ULONG			NextEntryOffset;
+	ULONG			FileIndex;
+	LARGE_INTEGER	CreationTime;
+	LARGE_INTEGER	LastAccessTime;
+	LARGE_INTEGER	LastWriteTime;
+	LARGE_INTEGER	ChangeTime;
+	LARGE_INTEGER	EndOfFile;
+	LARGE_INTEGER	AllocationSize;
+	ULONG			FileAttributes;
+	ULONG			FileNameLength;
+	ULONG			EaSize;
+	WCHAR			FileName[1];
+} FILE_FULL_DIR_INFORMATION, *PFILE_FULL_DIR_INFORMATION;
+
+typedef struct _FILE_ID_FULL_DIR_INFORMATION
+{
+	ULONG			NextEntryOffset;
+	ULONG			FileIndex;
+	LARGE_INTEGER	CreationTime;
+	LARGE_INTEGER	LastAccessTime;
+	LARGE_INTEGER	LastWriteTime;
+	LARGE_INTEGER	ChangeTime;
+	LARGE_INTEGER	EndOfFile;
+	LARGE_INTEGER	AllocationSize;
+	ULONG			FileAttributes;
+	ULONG			FileNameLength;
+	ULONG			EaSize;
+	LARGE_INTEGER	FileId;
+	WCHAR			FileName[1];
+} FILE_ID_FULL_DIR_INFORMATION, *PFILE_ID_FULL_DIR_INFORMATION;
+
+typedef struct _FILE_BOTH_DIR_INFORMATION
+{
+	ULONG			NextEntryOffset;
+	ULONG			FileIndex;
+	LARGE_INTEGER	CreationTime;
+	LARGE_INTEGER	LastAccessTime;
+	LARGE_INTEGER	LastWriteTime;
+	LARGE_INTEGER	ChangeTime;
+	LARGE_INTEGER	EndOfFile;
+	LARGE_INTEGER	AllocationSize;
+	ULONG			FileAttributes;
+	ULONG			FileNameLength;
+	ULONG			EaSize;
+	CCHAR			ShortNameLength;
+	WCHAR			ShortName[12];
+	WCHAR			FileName[1];
+} FILE_BOTH_DIR_INFORMATION, *PFILE_BOTH_DIR_INFORMATION;
+
+typedef struct _FILE_ID_BOTH_DIR_INFORMATION
+{
+	ULONG			NextEntryOffset;
+	ULONG			FileIndex;
+	LARGE_INTEGER	CreationTime;
+	LARGE_INTEGER	LastAccessTime;
+	LARGE_INTEGER	LastWriteTime;
+	LARGE_INTEGER	ChangeTime;
+	LARGE_INTEGER	EndOfFile;
+	LARGE_INTEGER	AllocationSize;
+	ULONG			FileAttributes;
+	ULONG			FileNameLength;
+	ULONG			EaSize;
+	CCHAR			ShortNameLength;
+	WCHAR			ShortName[12];
+	LARGE_INTEGER	FileId;
+	WCHAR			FileName[1];
+} FILE_ID_BOTH_DIR_INFORMATION, *PFILE_ID_BOTH_DIR_INFORMATION;
+
+typedef struct _FILE_NAMES_INFORMATION
+{
+	ULONG			NextEntryOffset;
+	ULONG			FileIndex;
+	ULONG			FileNameLength;
+	WCHAR			FileName[1];
+} FILE_NAMES_INFORMATION, *PFILE_NAMES_INFORMATION;
+
+typedef struct _FILE_ALLOCATED_RANGE_BUFFER
+{
+	LARGE_INTEGER	FileOffset;
+	LARGE_INTEGER	Length;
+} FILE_ALLOCATED_RANGE_BUFFER, *PFILE_ALLOCATED_RANGE_BUFFER;
+
+typedef struct _MOVE_FILE_DATA
+{
+	HANDLE			FileHandle;
+	LARGE_INTEGER	StartingVcn;
+	LARGE_INTEGER	StartingLcn;
+	ULONG			ClusterCount;
+} MOVE_FILE_DATA, *PMOVE_FILE_DATA;
+
+typedef struct _ENCRYPTION_BUFFER
+{
+	ULONG			EncryptionOperation;
+	ULONG			Private[1];
+} ENCRYPTION_BUFFER, *PENCRYPTION_BUFFER;
+
+typedef struct _KEY_FULL_INFORMATION
+{
+	LARGE_INTEGER	LastWriteTime;
+	ULONG			TitleIndex;
+	ULONG			ClassOffset;
+	ULONG			ClassLength;
+	ULONG			SubKeys;
+	ULONG			MaxNameLen;
+	ULONG			MaxClassLen;
+	ULONG			Values;
+	ULONG			MaxValueNameLen;
+	ULONG			MaxValueDataLen;
+	WCHAR			Class[1];
+} KEY_FULL_INFORMATION, *PKEY_FULL_INFORMATION;
+
+typedef struct _KEY_VALUE_BASIC_INFORMATION
+{
+	ULONG			TitleIndex;
+	ULONG			Type;
+	ULONG			NameLength;
+	WCHAR			Name[1];
+} KEY_VALUE_BASIC_INFORMATION, *PKEY_VALUE_BASIC_INFORMATION;
+
+typedef struct _KEY_VALUE_PARTIAL_INFORMATION
+{
+	ULONG			TitleIndex;
+	ULONG			Type;
+	ULONG			DataLength;
+	UCHAR			Data[1];
+} KEY_VALUE_PARTIAL_INFORMATION, *PKEY_VALUE_PARTIAL_INFORMATION;
+
+typedef struct _RTL_OSVERSIONINFOW
+{
+	ULONG			dwOSVersionInfoSize;
+	ULONG			dwMajorVersion;
+	ULONG			dwMinorVersion;
+	ULONG			dwBuildNumber;
+	ULONG			dwPlatformId;
+	WCHAR			szCSDVersion[128];
+} RTL_OSVERSIONINFOW, *PRTL_OSVERSIONINFOW;
+
+typedef struct _RTL_OSVERSIONINFOEXW
+{
+	ULONG			dwOSVersionInfoSize;
+	ULONG			dwMajorVersion;
+	ULONG			dwMinorVersion;
+	ULONG			dwBuildNumber;
+	ULONG			dwPlatformId;
+	WCHAR			szCSDVersion[128];
+	USHORT			wServicePackMajor;
+	USHORT			wServicePackMinor;
+	USHORT			wSuiteMask;
+	UCHAR			wProductType;
+	UCHAR			wReserved;
+} RTL_OSVERSIONINFOEXW, *PRTL_OSVERSIONINFOEXW;
+
+typedef struct _IMAGE_INFO
+{
+	ULONG			Properties;
+	void*			ImageBase;
+	ULONG			ImageSelector;
+	SIZE_T			ImageSize;
+	ULONG			ImageSectionNumber;
+} IMAGE_INFO, *PIMAGE_INFO;
+
+typedef void (*PCREATE_PROCESS_NOTIFY_ROUTINE)(HANDLE parent, HANDLE process, BOOLEAN create);
+typedef void (*PLOAD_IMAGE_NOTIFY_ROUTINE)(UNICODE_STRING *image, HANDLE process, IMAGE_INFO *info);
+typedef void (*PKSTART_ROUTINE)(void *context);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "CSimKernel.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#endif //_DRIVER_H_
@@ -0,0 +1,34 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// ntddndis.h - user mode stand-in for the NDIS query interface, see CSimKernel
+//
+// Author: Michael Alexander Priske
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _NTDDNDIS_H_
+#define _NTDDNDIS_H_
+
+// No NDIS devices exist in the simulation, the MAC address query always fails
+#define IOCTL_NDIS_QUERY_GLOBAL_STATS	0x00170002
+
+#define OID_GEN_MEDIA_IN_USE			0x00010104
+#define OID_802_3_CURRENT_ADDRESS		0x01010102
+#define OID_WAN_CURRENT_ADDRESS			0x04010102
+#define OID_WW_GEN_CURRENT_ADDRESS		0x0901010A
+
+typedef enum _NDIS_MEDIUM
+{
+	NdisMedium802_3,
+	NdisMedium802_5,
+	NdisMediumFddi,
+	NdisMediumWan,
+	NdisMediumLocalTalk,
+	NdisMediumDix,
+	NdisMediumArcnetRaw,
+	NdisMediumArcnet878_2,
+	NdisMediumAtm,
+	NdisMediumWirelessWan,
+} NDIS_MEDIUM, *PNDIS_MEDIUM;
+
+#endif // _NTDDNDIS_H_
@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// replay.cpp: runs the driver in user mode and replays recorded request traces through it.
+//
+// Author: Michael Alexander Priske
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string.h>
+
+#include "driver.h"
+#include "IoControl.h"
+
+#include "CSimFileSystem.h"
+#include "CSimReplay.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static char const s_usage[] =
+	"usage: fsfd_replay [-v] [-k] [-q] <trace>...\n"
+	"\n"
+	"  -v            echo each request of the trace\n"
+	"  -k            trace requests on the kernel side too\n"
+	"  -q            no report, only failed checks\n";
+
+int main(int argc, char *argv[])
+{
+	bool quiet	= false;
+	int current = 1;
+
+	for(; (current < argc) && (argv[current][0] == '-'); ++current)
+	{
+		if(!strcmp(argv[current], "-v"))
+		{
+			CSimReplay::s_verbose = true;
+		}
+		else if(!strcmp(argv[current], "-k"))
+		{
+			CSimKernel::s_verbose++;
+		}
+		else if(!strcmp(argv[current], "-q"))
+		{
+			quiet = true;
+		}
+		else
+		{
+			fputs(s_usage, stderr);
+			return 2;
+		}
+	}
+
+	if(current == argc)
+	{
+		fputs(s_usage, stderr);
+		return 2;
+	}
+
+	CSimKernel::Init();
+	CSimFileSystem::Init();
+
+	int failed = 0;
+
+	for(; current < argc; ++current)
+	{
+		FILE *const trace = fopen(argv[current], "r");
+
+		if(!trace)
+		{
+			fprintf(stderr, "fsfd_replay: cannot open %s\n", argv[current]);
+
+			failed++;
+			continue;
+		}
+
+		failed += CSimReplay::Run(trace, argv[current]);
+
+		fclose(trace);
+	}
+
+	if(!quiet)
+	{
+		CSimReplay::Report(stdout);
+	}
+
+	CSimReplay::Close();
+	CSimFileSystem::Close();
+	CSimKernel::Close();
+
+	if(failed)
+	{
+		fprintf(stderr, "fsfd_replay: %d checks failed\n", failed);
+	}
+
+	return failed ? 1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -82,6 +82,7 @@ INC_DEPS = $(INC_DEPS) \
 	$(SOURCE_DIR)\priv\pgpStr2Key.h \
 	$(SOURCE_DIR)\priv\pgpSymmetricCipherPriv.h \
 	$(SOURCE_DIR)\priv\pgpUsuals.h \
+	$(SOURCE_DIR)\priv\pgpXTSPriv.h \
 \
 	$(SOURCE_DIR)\pub\pflTypes.h \
 	$(SOURCE_DIR)\pub\pgpBase.h \
@@ -102,6 +103,7 @@ INC_DEPS = $(INC_DEPS) \
 	$(SOURCE_DIR)\pub\pgpSymmetricCipher.h \
 	$(SOURCE_DIR)\pub\pgpTypes.h \
 	$(SOURCE_DIR)\pub\pgpUtilities.h \
+	$(SOURCE_DIR)\pub\pgpXTS.h \
 	$(SOURCE_DIR)\pub\pgpMemoryMgr.h
 
 #	$(SOURCE_DIR)\priv\pgpMallocFlat.h
@@ -134,6 +136,7 @@ OBJECTS = $(OBJECTS) \
 	$(BUILD_DIR)\pSHA5122.obj \
 	$(BUILD_DIR)\pStr2Key.obj \
 	$(BUILD_DIR)\pSym.obj \
+	$(BUILD_DIR)\pXTS.obj \
 	$(BUILD_DIR)\pgpMemoryMgr.obj
 #	$(BUILD_DIR)\pgpMallocFlat.obj 
 
@@ -158,6 +161,7 @@ $(BUILD_DIR)\pSHA512.obj		: priv\$(*B).c $(INC_DEPS)
 $(BUILD_DIR)\pSHA5122.obj		: priv\$(*B).c $(INC_DEPS)
 $(BUILD_DIR)\pStr2Key.obj		: priv\$(*B).c $(INC_DEPS)
 $(BUILD_DIR)\pSym.obj			: priv\$(*B).c $(INC_DEPS)
+$(BUILD_DIR)\pXTS.obj			: priv\$(*B).c $(INC_DEPS)
 $(BUILD_DIR)\pgpMemoryMgr.obj	: priv\$(*B).c $(INC_DEPS)
 
 # pgpMallocFlat requires a definition for msb that we don't have
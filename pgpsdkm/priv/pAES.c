@@ -1402,6 +1402,8 @@ PGPCipherVTBL const cipherAES256 = {
 
 #if defined(UNITTEST) && UNITTEST
 
+#include <time.h>
+
 /* Test vectors, first line from each ECB known answer test */
 
 /* 128 bit key */
@@ -1520,9 +1522,9 @@ main(void)
 		t0 = time(NULL);
 		while( i++ < 1024*1024*50 )
 			aesEncrypt(priv, P3, X);
-		t1 = time(t1);
+		t1 = time(NULL);
 
-		printf("%d seconds total for AES256 encryption, %.02g sec/Mb\n", t1-t0, (t1-t0)/(16.*50) );
+		printf("%d seconds total for AES256 encryption, %.02g sec/Mb\n", (int) (t1-t0), (t1-t0)/(16.*50) );
 	 }
 		
 	return 0;	/* normal exit */
@@ -0,0 +1,1168 @@
+/*____________________________________________________________________________
+	Copyright (C) 2007 PGP Corporation
+	All rights reserved.
+
+	XTS is the narrow block tweakable mode of IEEE Std 1619-2007.  Each
+	cipher block costs a single cipher invocation plus a multiplication
+	by alpha in GF(2^128), the tweak is encrypted once per data unit.
+	Blocks of a data unit do not depend on each other, unlike EME2.
+
+	Data units must be a multiple of the cipher block size, so ciphertext
+	stealing is not supported.  The tweak is the data unit number followed
+	by the per-file nonce, both LSB first.
+
+	Any cipher block aligned range of a data unit can be processed on its
+	own, by advancing the encrypted tweak to the first block of the range.
+	So large data units do not force large I/O.
+
+	$Id: pXTS.c $
+____________________________________________________________________________*/
+#include "pgpConfig.h"
+#include "pgpSDKPriv.h"
+#include <string.h>
+
+#include "pgpSDKBuildFlags.h"
+#include "pgpMem.h"
+#include "pgpErrors.h"
+#include "pgpSymmetricCipherPriv.h"
+#include "pgpXTSPriv.h"
+#include "pgpPFLPriv.h"
+
+
+
+#define PGPValidateXTS( XTS )	\
+	PGPValidateParam( pgpXTSIsValid( XTS ) );
+
+
+#define XOR4(out,in1,in2)	\
+		out[0] = in1[0] ^ in2[0]; \
+		out[1] = in1[1] ^ in2[1]; \
+		out[2] = in1[2] ^ in2[2]; \
+		out[3] = in1[3] ^ in2[3];
+
+#define XOR4E(out,in)	\
+		out[0] ^= in[0]; \
+		out[1] ^= in[1]; \
+		out[2] ^= in[2]; \
+		out[3] ^= in[3];
+
+
+/*____________________________________________________________________________
+	XTS uses two cipher contexts (typically AES), one for data and one
+	for the tweak.
+____________________________________________________________________________*/
+
+
+struct PGPXTSContext
+{
+#define kXTSMagic		0xBAAB0917
+	PGPUInt32						magic;
+	PGPMemoryMgrRef					memoryMgr;
+	PGPBoolean						XTSInited;
+	PGPSize							dataUnitSize;
+	PGPSymmetricCipherContextRef	symmetricRef;
+	PGPSymmetricCipherContextRef	tweakRef;
+};
+
+	static PGPBoolean
+pgpXTSIsValid( const PGPXTSContext * ref)
+{
+	PGPBoolean	valid	= FALSE;
+
+	valid	= IsntNull( ref ) && ref->magic	 == kXTSMagic;
+
+	return( valid );
+}
+
+
+
+/*____________________________________________________________________________
+	Internal forward references
+____________________________________________________________________________*/
+
+static void		pgpXTSInit( PGPXTSContext *	ref, void const * key );
+
+
+
+/*____________________________________________________________________________
+	Exported routines
+____________________________________________________________________________*/
+	PGPError
+PGPNewXTSContext(
+	PGPSymmetricCipherContextRef	symmetricRef,
+	PGPSize							dataUnitSize,
+	PGPXTSContextRef *				outRef )
+{
+	PGPXTSContextRef				newRef	= NULL;
+	PGPError						err	= kPGPError_NoErr;
+	PGPMemoryMgrRef					memoryMgr	= NULL;
+	PGPSize							blockSize;
+
+	PGPValidatePtr( outRef );
+	*outRef	= NULL;
+	PGPValidatePtr( symmetricRef );
+
+	pgpEnterPGPErrorFunction();
+
+	err = PGPGetSymmetricCipherSizes( symmetricRef, NULL, &blockSize );
+	if( IsPGPError( err ) )
+		return err;
+
+	if( blockSize != PGP_XTS_CIPHER_BLOCKSIZE )
+		return kPGPError_BadParams;
+
+	if( dataUnitSize == 0 || dataUnitSize % PGP_XTS_CIPHER_BLOCKSIZE != 0 )
+		return kPGPError_BadParams;
+
+	memoryMgr	= pgpGetSymmetricCipherMemoryMgr( symmetricRef );
+	newRef	= (PGPXTSContextRef)
+			PGPNewData( memoryMgr,
+				sizeof( *newRef ), 0 | kPGPMemoryMgrFlags_Clear);
+
+	if ( IsntNull( newRef ) )
+	{
+#if PGP_DEBUG
+		/* make original invalid to enforce semantics */
+		PGPSymmetricCipherContextRef	tempRef;
+		err	= PGPCopySymmetricCipherContext( symmetricRef, &tempRef );
+		if ( IsntPGPError( err ) )
+		{
+			PGPFreeSymmetricCipherContext( symmetricRef );
+			symmetricRef	= tempRef;
+		}
+		err	= kPGPError_NoErr;
+#endif
+
+		newRef->magic			= kXTSMagic;
+		newRef->XTSInited		= FALSE;
+		newRef->dataUnitSize	= dataUnitSize;
+		newRef->symmetricRef	= symmetricRef;
+		newRef->memoryMgr		= memoryMgr;
+
+		/* second instance of the same cipher for the tweak key */
+		err	= PGPCopySymmetricCipherContext( symmetricRef, &newRef->tweakRef );
+
+		if ( IsPGPError( err ) )
+		{
+			PGPFreeXTSContext( newRef );
+			newRef	= NULL;
+		}
+	}
+	else
+	{
+		/* we own it, so dispose it */
+		PGPFreeSymmetricCipherContext( symmetricRef );
+		err	= kPGPError_OutOfMemory;
+	}
+
+	*outRef	= newRef;
+	return( err );
+}
+
+
+
+/*____________________________________________________________________________
+____________________________________________________________________________*/
+	PGPError
+PGPFreeXTSContext( PGPXTSContextRef ref )
+{
+	PGPError		err	= kPGPError_NoErr;
+
+	PGPValidateXTS( ref );
+	pgpEnterPGPErrorFunction();
+
+	PGPFreeSymmetricCipherContext( ref->symmetricRef );
+
+	if ( IsntNull( ref->tweakRef ) )
+	{
+		PGPFreeSymmetricCipherContext( ref->tweakRef );
+	}
+
+	pgpClearMemory( ref, sizeof( *ref ) );
+	PGPFreeData( ref );
+
+	return( err );
+}
+
+
+
+/*____________________________________________________________________________
+____________________________________________________________________________*/
+	PGPError
+PGPCopyXTSContext(
+	PGPXTSContextRef	inRef,
+	PGPXTSContextRef *	outRef )
+{
+	PGPError			err	= kPGPError_NoErr;
+	PGPXTSContextRef	newRef	= NULL;
+
+	PGPValidatePtr( outRef );
+	*outRef	= NULL;
+	PGPValidateXTS( inRef );
+
+	pgpEnterPGPErrorFunction();
+
+	newRef	= (PGPXTSContextRef)
+		PGPNewData( inRef->memoryMgr,
+		sizeof( *newRef ), 0);
+
+	if ( IsntNull( newRef ) )
+	{
+		*newRef		= *inRef;
+
+		/* clear symmetric ciphers in case later allocation fails */
+		newRef->symmetricRef = NULL;
+		newRef->tweakRef	 = NULL;
+
+		/* copy symmetric ciphers */
+		err	= PGPCopySymmetricCipherContext(
+				inRef->symmetricRef, &newRef->symmetricRef );
+
+		if ( IsntPGPError( err ) )
+		{
+			err	= PGPCopySymmetricCipherContext(
+					inRef->tweakRef, &newRef->tweakRef );
+		}
+
+		if ( IsPGPError( err ) )
+		{
+			if ( IsntNull( newRef->symmetricRef ) )
+			{
+				PGPFreeXTSContext( newRef );
+			}
+			else
+			{
+				pgpClearMemory( newRef, sizeof( *newRef ) );
+				PGPFreeData( newRef );
+			}
+			newRef	= NULL;
+		}
+	}
+	else
+	{
+		err	= kPGPError_OutOfMemory;
+	}
+
+	*outRef	= newRef;
+	return( err );
+}
+
+
+
+/*____________________________________________________________________________
+____________________________________________________________________________*/
+	PGPError
+PGPInitXTS(
+	PGPXTSContextRef	ref,
+	const void *		key )
+{
+	PGPError			err	= kPGPError_NoErr;
+
+	PGPValidateXTS( ref );
+	PGPValidateParam( IsntNull( key ) );
+
+	pgpEnterPGPErrorFunction();
+
+	pgpXTSInit( ref, key );
+
+	return( err );
+}
+
+
+/*____________________________________________________________________________
+____________________________________________________________________________*/
+	PGPError
+PGPXTSEncrypt(
+	PGPXTSContextRef	ref,
+	const void *		in,
+	PGPSize				bytesIn,
+	void *				out,
+	PGPUInt64			offset,
+	PGPUInt64			nonce )
+{
+	PGPError			err = kPGPError_NoErr;
+
+	PGPValidatePtr( out );
+	PGPValidateXTS( ref );
+	PGPValidatePtr( in );
+	PGPValidateParam( bytesIn != 0 );
+
+	pgpEnterPGPErrorFunction();
+#if PGP_ENCRYPT_DISABLE
+	err = kPGPError_FeatureNotAvailable;
+#else
+	if ( ref->XTSInited )
+	{
+		err = pgpXTSEncryptInternal( ref, in, bytesIn, out, offset, nonce );
+	}
+	else
+	{
+		err	= kPGPError_ImproperInitialization;
+	}
+#endif
+
+	return err;
+}
+
+
+/*____________________________________________________________________________
+____________________________________________________________________________*/
+	PGPError
+PGPXTSDecrypt(
+	PGPXTSContextRef	ref,
+	const void *		in,
+	PGPSize				bytesIn,
+	void *				out,
+	PGPUInt64			offset,
+	PGPUInt64			nonce )
+{
+	PGPError			err = kPGPError_NoErr;
+
+	PGPValidatePtr( out );
+	PGPValidateXTS( ref );
+	PGPValidatePtr( in );
+	PGPValidateParam( bytesIn != 0 );
+
+	pgpEnterPGPErrorFunction();
+
+#if PGP_DECRYPT_DISABLE
+	err = kPGPError_FeatureNotAvailable;
+#else
+	if ( ref->XTSInited )
+	{
+		err = pgpXTSDecryptInternal( ref, in, bytesIn, out, offset, nonce );
+	}
+	else
+	{
+		err	= kPGPError_ImproperInitialization;
+	}
+#endif
+
+	return err;
+}
+
+
+/*____________________________________________________________________________
+____________________________________________________________________________*/
+	PGPError
+PGPXTSEncryptAt(
+	PGPXTSContextRef	ref,
+	const void *		in,
+	PGPSize				bytesIn,
+	void *				out,
+	PGPUInt64			byteOffset,
+	PGPUInt64			nonce )
+{
+	PGPError			err = kPGPError_NoErr;
+
+	PGPValidatePtr( out );
+	PGPValidateXTS( ref );
+	PGPValidatePtr( in );
+	PGPValidateParam( bytesIn != 0 );
+
+	pgpEnterPGPErrorFunction();
+#if PGP_ENCRYPT_DISABLE
+	err = kPGPError_FeatureNotAvailable;
+#else
+	if ( ref->XTSInited )
+	{
+		err = pgpXTSEncryptAtInternal( ref, in, bytesIn, out, byteOffset, nonce );
+	}
+	else
+	{
+		err	= kPGPError_ImproperInitialization;
+	}
+#endif
+
+	return err;
+}
+
+
+/*____________________________________________________________________________
+____________________________________________________________________________*/
+	PGPError
+PGPXTSDecryptAt(
+	PGPXTSContextRef	ref,
+	const void *		in,
+	PGPSize				bytesIn,
+	void *				out,
+	PGPUInt64			byteOffset,
+	PGPUInt64			nonce )
+{
+	PGPError			err = kPGPError_NoErr;
+
+	PGPValidatePtr( out );
+	PGPValidateXTS( ref );
+	PGPValidatePtr( in );
+	PGPValidateParam( bytesIn != 0 );
+
+	pgpEnterPGPErrorFunction();
+
+#if PGP_DECRYPT_DISABLE
+	err = kPGPError_FeatureNotAvailable;
+#else
+	if ( ref->XTSInited )
+	{
+		err = pgpXTSDecryptAtInternal( ref, in, bytesIn, out, byteOffset, nonce );
+	}
+	else
+	{
+		err	= kPGPError_ImproperInitialization;
+	}
+#endif
+
+	return err;
+}
+
+
+
+/*____________________________________________________________________________
+____________________________________________________________________________*/
+	PGPError
+PGPXTSGetSymmetricCipher(
+	PGPXTSContextRef				ref,
+	PGPSymmetricCipherContextRef *	outRef )
+{
+	PGPError						err	= kPGPError_NoErr;
+	PGPSymmetricCipherContextRef	symmetricRef	= NULL;
+
+	PGPValidatePtr( outRef );
+	*outRef	= NULL;
+	PGPValidateXTS( ref );
+
+	pgpEnterPGPErrorFunction();
+
+	symmetricRef	= ref->symmetricRef;
+
+	*outRef	= symmetricRef;
+	return( err );
+}
+
+
+
+
+/*____________________________________________________________________________
+____________________________________________________________________________*/
+	PGPError
+PGPXTSGetSizes(
+	PGPXTSContextRef				ref,
+	PGPSize							*pKeySize,
+	PGPSize							*pBlockSize )
+{
+	PGPError						err	= kPGPError_NoErr;
+	PGPSize							keySize;
+
+	if( IsntNull( pKeySize ) )
+		PGPValidatePtr( pKeySize );
+	if( IsntNull( pBlockSize ) )
+		PGPValidatePtr( pBlockSize );
+	if( IsntNull( pKeySize ) )
+		*pKeySize = 0;
+	if( IsntNull( pBlockSize ) )
+		*pBlockSize = 0;
+	PGPValidateXTS( ref );
+
+	pgpEnterPGPErrorFunction();
+
+	PGPGetSymmetricCipherSizes( ref->symmetricRef, &keySize, NULL );
+
+	/* data key and tweak key */
+	if( IsntNull( pKeySize ) )
+		*pKeySize = 2 * keySize;
+
+	if( IsntNull( pBlockSize ) )
+		*pBlockSize = ref->dataUnitSize;
+
+	return( err );
+}
+
+
+
+
+
+#ifdef PRAGMA_MARK_SUPPORTED
+#pragma mark --- Internal Routines ---
+#endif
+
+
+
+
+
+
+
+/*____________________________________________________________________________
+	Do a finite field multiplication by alpha (2) per IEEE 1619, which
+	matches the EME2 one.  obuf may be same as ibuf
+____________________________________________________________________________*/
+
+
+#if PGP_WORDSBIGENDIAN
+
+#define LOAD4(i,b,o)  i = ((b[o+3]<<24) | (b[o+2]<<16) | (b[o+1]<<8) | b[o+0])
+#define STORE4(b,o,i) b[o+3] = i>>24; b[o+2] = i>>16; b[o+1] = i>>8; b[o+0] = i
+
+
+static void
+mul2 (PGPUInt32 *obufw, PGPUInt32 *ibufw)
+{
+	PGPByte *ibuf = (PGPByte *)ibufw;
+	PGPByte *obuf = (PGPByte *)obufw;
+	PGPUInt32 ib0, ib1, ib2, ib3;
+	PGPUInt32 ob0, ob1, ob2, ob3;
+	PGPUInt32 hibit;
+	PGPUInt32 carry;
+
+	LOAD4(ib0, ibuf, 0);
+	LOAD4(ib1, ibuf, 4);
+	LOAD4(ib2, ibuf, 8);
+	LOAD4(ib3, ibuf, 12);
+
+	hibit = ib3 & 0x80000000;
+	carry = ib2 & 0x80000000;
+	ob3 = (ib3 << 1) | (carry >> 31);
+	carry = ib1 & 0x80000000;
+	ob2 = (ib2 << 1) | (carry >> 31);
+	carry = ib0 & 0x80000000;
+	ob1 = (ib1 << 1) | (carry >> 31);
+	ob0 = ib0 << 1;
+	if (hibit)
+		ob0 ^= 0x87;	/* finite field polynomial */
+
+	STORE4(obuf, 0, ob0);
+	STORE4(obuf, 4, ob1);
+	STORE4(obuf, 8, ob2);
+	STORE4(obuf, 12, ob3);
+}
+
+#else
+
+/* This is a faster version only for little endian machines */
+static void
+mul2 (PGPUInt32 *obuf, PGPUInt32 *ibuf)
+{
+	/* branch free conditional xor of the polynomial */
+	PGPUInt32 poly = (PGPUInt32)(0 - (ibuf[3] >> 31)) & 0x87;
+
+	obuf[3] = (ibuf[3] << 1) | (ibuf[2] >> 31);
+	obuf[2] = (ibuf[2] << 1) | (ibuf[1] >> 31);
+	obuf[1] = (ibuf[1] << 1) | (ibuf[0] >> 31);
+	obuf[0] = (ibuf[0] << 1) ^ poly;
+}
+#endif
+
+
+/*____________________________________________________________________________
+	Compute the initial tweak of a data unit, which is the encrypted data
+	unit number and nonce.
+____________________________________________________________________________*/
+
+
+static void
+xtsTweak (PGPSymmetricCipherContextRef tweakref,
+	PGPUInt32 T[PGP_XTS_CIPHER_BLOCKWORDS], PGPUInt64 offset, PGPUInt64 nonce)
+{
+	PGPByte *tbuf = (PGPByte *)T;
+	PGPUInt32 index;
+
+	/* Load T with tweak in LSB form, independent of word order */
+	for (index=0; index < 8; index++)
+	{
+		tbuf[index]	  = (PGPByte)(offset >> (8 * index));
+		tbuf[index+8] = (PGPByte)(nonce  >> (8 * index));
+	}
+
+	PGPSymmetricCipherEncrypt (tweakref, T, T);
+}
+
+
+/*____________________________________________________________________________
+	Encrypt blocks of one XTS data unit, starting at cipher block first.
+____________________________________________________________________________*/
+
+
+static PGPError
+xtsEncrypt (PGPSymmetricCipherContextRef aesref,
+	PGPSymmetricCipherContextRef tweakref, PGPSize first, PGPSize blocks,
+	PGPByte const *ibuf, PGPByte *obuf, PGPUInt64 offset, PGPUInt64 nonce)
+{
+	PGPUInt32 const *ibufwp = (PGPUInt32 const *)ibuf;
+	PGPUInt32 *obufwp = (PGPUInt32 *)obuf;
+	PGPSize block;
+	PGPUInt32 T[PGP_XTS_CIPHER_BLOCKWORDS];
+
+	xtsTweak (tweakref, T, offset, nonce);
+
+	for (block=0; block < first; block++)
+		mul2 (T, T);
+
+	for (block=0; block < blocks; block++)
+	{
+		XOR4 (obufwp, ibufwp, T);
+		PGPSymmetricCipherEncrypt (aesref, obufwp, obufwp);
+		XOR4E (obufwp, T);
+		mul2 (T, T);
+		ibufwp += PGP_XTS_CIPHER_BLOCKWORDS;
+		obufwp += PGP_XTS_CIPHER_BLOCKWORDS;
+	}
+
+	pgpClearMemory (T, sizeof (T));
+
+	return kPGPError_NoErr;
+}
+
+
+/*____________________________________________________________________________
+	Decrypt blocks of one XTS data unit, starting at cipher block first.
+	Note that the tweak is always encrypted, only data blocks get decrypted
+____________________________________________________________________________*/
+
+
+static PGPError
+xtsDecrypt (PGPSymmetricCipherContextRef aesref,
+	PGPSymmetricCipherContextRef tweakref, PGPSize first, PGPSize blocks,
+	PGPByte const *ibuf, PGPByte *obuf, PGPUInt64 offset, PGPUInt64 nonce)
+{
+	PGPUInt32 const *ibufwp = (PGPUInt32 const *)ibuf;
+	PGPUInt32 *obufwp = (PGPUInt32 *)obuf;
+	PGPSize block;
+	PGPUInt32 T[PGP_XTS_CIPHER_BLOCKWORDS];
+
+	xtsTweak (tweakref, T, offset, nonce);
+
+	for (block=0; block < first; block++)
+		mul2 (T, T);
+
+	for (block=0; block < blocks; block++)
+	{
+		XOR4 (obufwp, ibufwp, T);
+		PGPSymmetricCipherDecrypt (aesref, obufwp, obufwp);
+		XOR4E (obufwp, T);
+		mul2 (T, T);
+		ibufwp += PGP_XTS_CIPHER_BLOCKWORDS;
+		obufwp += PGP_XTS_CIPHER_BLOCKWORDS;
+	}
+
+	pgpClearMemory (T, sizeof (T));
+
+	return kPGPError_NoErr;
+}
+
+
+/*____________________________________________________________________________
+	Initialize contexts.
+____________________________________________________________________________*/
+
+
+	static void
+pgpXTSInit(
+	PGPXTSContext *		ref,
+	void const *		key )
+{
+	PGPSize				keySize = 0;
+
+	PGPGetSymmetricCipherSizes( ref->symmetricRef, &keySize, NULL );
+
+	PGPInitSymmetricCipher( ref->symmetricRef, key );
+	PGPInitSymmetricCipher( ref->tweakRef, (PGPByte const *) key + keySize );
+
+	ref->XTSInited		= TRUE;
+}
+
+
+
+/*____________________________________________________________________________
+	Encrypt a buffer of data units, using a block cipher in XTS mode.
+____________________________________________________________________________*/
+	PGPError
+pgpXTSEncryptInternal(
+	PGPXTSContext *		ref,
+	void const *		srcParam,
+	PGPSize				len,
+	void *				destParam,
+	PGPUInt64			offset,
+	PGPUInt64			nonce )
+{
+	const PGPByte *	src = (const PGPByte *) srcParam;
+	PGPByte *		dest = (PGPByte *) destParam;
+
+	/* Length must be a multiple of data unit size */
+	if( len % ref->dataUnitSize != 0 )
+	{
+		return kPGPError_BadParams;
+	}
+
+	while( len != 0 )
+	{
+		xtsEncrypt(ref->symmetricRef, ref->tweakRef, 0, ref->dataUnitSize / PGP_XTS_CIPHER_BLOCKSIZE,
+			src, dest, offset, nonce);
+
+		/* Loop until we have exhausted the data */
+		src += ref->dataUnitSize;
+		dest += ref->dataUnitSize;
+		len -= ref->dataUnitSize;
+		++offset;
+	}
+
+	return kPGPError_NoErr;
+}
+
+/*____________________________________________________________________________
+	Decrypt a buffer of data units, using a block cipher in XTS mode.
+____________________________________________________________________________*/
+	PGPError
+pgpXTSDecryptInternal(
+	PGPXTSContext *		ref,
+	void const *		srcParam,
+	PGPSize				len,
+	void *				destParam,
+	PGPUInt64			offset,
+	PGPUInt64			nonce )
+{
+	const PGPByte *	src = (const PGPByte *) srcParam;
+	PGPByte *		dest = (PGPByte *) destParam;
+
+	/* Length must be a multiple of data unit size */
+	if( len % ref->dataUnitSize != 0 )
+	{
+		return kPGPError_BadParams;
+	}
+
+	while( len != 0 )
+	{
+		xtsDecrypt(ref->symmetricRef, ref->tweakRef, 0, ref->dataUnitSize / PGP_XTS_CIPHER_BLOCKSIZE,
+			src, dest, offset, nonce);
+
+		/* Loop until we have exhausted the data */
+		src += ref->dataUnitSize;
+		dest += ref->dataUnitSize;
+		len -= ref->dataUnitSize;
+		++offset;
+	}
+
+	return kPGPError_NoErr;
+}
+
+/*____________________________________________________________________________
+	Encrypt a cipher block aligned byte range, which may start and end
+	within a data unit.
+____________________________________________________________________________*/
+	PGPError
+pgpXTSEncryptAtInternal(
+	PGPXTSContext *		ref,
+	void const *		srcParam,
+	PGPSize				len,
+	void *				destParam,
+	PGPUInt64			byteOffset,
+	PGPUInt64			nonce )
+{
+	const PGPByte *	src = (const PGPByte *) srcParam;
+	PGPByte *		dest = (PGPByte *) destParam;
+	PGPUInt64		offset = byteOffset / ref->dataUnitSize;
+	PGPSize			unitBlocks = ref->dataUnitSize / PGP_XTS_CIPHER_BLOCKSIZE;
+	PGPSize			first;
+	PGPSize			blocks;
+
+	/* Range must be aligned to cipher blocks */
+	if( len % PGP_XTS_CIPHER_BLOCKSIZE != 0 ||
+		byteOffset % PGP_XTS_CIPHER_BLOCKSIZE != 0 )
+	{
+		return kPGPError_BadParams;
+	}
+
+	first = (PGPSize) (byteOffset % ref->dataUnitSize) / PGP_XTS_CIPHER_BLOCKSIZE;
+
+	while( len != 0 )
+	{
+		blocks = unitBlocks - first;
+
+		if( blocks > len / PGP_XTS_CIPHER_BLOCKSIZE )
+			blocks = len / PGP_XTS_CIPHER_BLOCKSIZE;
+
+		xtsEncrypt(ref->symmetricRef, ref->tweakRef, first, blocks, src, dest, offset, nonce);
+
+		/* Loop until we have exhausted the data */
+		src += blocks * PGP_XTS_CIPHER_BLOCKSIZE;
+		dest += blocks * PGP_XTS_CIPHER_BLOCKSIZE;
+		len -= blocks * PGP_XTS_CIPHER_BLOCKSIZE;
+		first = 0;
+		++offset;
+	}
+
+	return kPGPError_NoErr;
+}
+
+/*____________________________________________________________________________
+	Decrypt a cipher block aligned byte range, which may start and end
+	within a data unit.
+____________________________________________________________________________*/
+	PGPError
+pgpXTSDecryptAtInternal(
+	PGPXTSContext *		ref,
+	void const *		srcParam,
+	PGPSize				len,
+	void *				destParam,
+	PGPUInt64			byteOffset,
+	PGPUInt64			nonce )
+{
+	const PGPByte *	src = (const PGPByte *) srcParam;
+	PGPByte *		dest = (PGPByte *) destParam;
+	PGPUInt64		offset = byteOffset / ref->dataUnitSize;
+	PGPSize			unitBlocks = ref->dataUnitSize / PGP_XTS_CIPHER_BLOCKSIZE;
+	PGPSize			first;
+	PGPSize			blocks;
+
+	/* Range must be aligned to cipher blocks */
+	if( len % PGP_XTS_CIPHER_BLOCKSIZE != 0 ||
+		byteOffset % PGP_XTS_CIPHER_BLOCKSIZE != 0 )
+	{
+		return kPGPError_BadParams;
+	}
+
+	first = (PGPSize) (byteOffset % ref->dataUnitSize) / PGP_XTS_CIPHER_BLOCKSIZE;
+
+	while( len != 0 )
+	{
+		blocks = unitBlocks - first;
+
+		if( blocks > len / PGP_XTS_CIPHER_BLOCKSIZE )
+			blocks = len / PGP_XTS_CIPHER_BLOCKSIZE;
+
+		xtsDecrypt(ref->symmetricRef, ref->tweakRef, first, blocks, src, dest, offset, nonce);
+
+		/* Loop until we have exhausted the data */
+		src += blocks * PGP_XTS_CIPHER_BLOCKSIZE;
+		dest += blocks * PGP_XTS_CIPHER_BLOCKSIZE;
+		len -= blocks * PGP_XTS_CIPHER_BLOCKSIZE;
+		first = 0;
+		++offset;
+	}
+
+	return kPGPError_NoErr;
+}
+
+
+
+#if defined(UNITTEST) && UNITTEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pgpEME2.h"
+
+/* Test vectors of IEEE Std 1619-2007 Annex B, the data unit sequence number
+   is passed as offset with a zero nonce */
+
+/* Vector 1, 32 byte data unit, plaintext 0x00 */
+static PGPByte K1_1[] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+static PGPByte C1_1[] = {
+	0x91, 0x7c, 0xf6, 0x9e, 0xbd, 0x68, 0xb2, 0xec, 0x9b, 0x9f, 0xe9, 0xa3, 0xea, 0xdd, 0xa6, 0x92,
+	0xcd, 0x43, 0xd2, 0xf5, 0x95, 0x98, 0xed, 0x85, 0x8c, 0x02, 0xc2, 0x65, 0x2f, 0xbf, 0x92, 0x2e
+};
+
+/* Vector 2, 32 byte data unit, plaintext 0x44 */
+static PGPByte K1_2[] = {
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22
+};
+static PGPByte C1_2[] = {
+	0xc4, 0x54, 0x18, 0x5e, 0x6a, 0x16, 0x93, 0x6e, 0x39, 0x33, 0x40, 0x38, 0xac, 0xef, 0x83, 0x8b,
+	0xfb, 0x18, 0x6f, 0xff, 0x74, 0x80, 0xad, 0xc4, 0x28, 0x93, 0x82, 0xec, 0xd6, 0xd3, 0x94, 0xf0
+};
+
+/* Vector 3, 32 byte data unit, plaintext 0x44 */
+static PGPByte K1_3[] = {
+	0xff, 0xfe, 0xfd, 0xfc, 0xfb, 0xfa, 0xf9, 0xf8, 0xf7, 0xf6, 0xf5, 0xf4, 0xf3, 0xf2, 0xf1, 0xf0,
+	0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22
+};
+static PGPByte C1_3[] = {
+	0xaf, 0x85, 0x33, 0x6b, 0x59, 0x7a, 0xfc, 0x1a, 0x90, 0x0b, 0x2e, 0xb2, 0x1e, 0xc9, 0x49, 0xd2,
+	0x92, 0xdf, 0x4c, 0x04, 0x7e, 0x0b, 0x21, 0x53, 0x21, 0x86, 0xa5, 0x97, 0x1a, 0x22, 0x7a, 0x89
+};
+
+/* Vector 4, 512 byte data unit, plaintext counts 0..255 twice */
+static PGPByte K1_4[] = {
+	0x27, 0x18, 0x28, 0x18, 0x28, 0x45, 0x90, 0x45, 0x23, 0x53, 0x60, 0x28, 0x74, 0x71, 0x35, 0x26,
+	0x31, 0x41, 0x59, 0x26, 0x53, 0x58, 0x97, 0x93, 0x23, 0x84, 0x62, 0x64, 0x33, 0x83, 0x27, 0x95
+};
+static PGPByte C1_4[] = {
+	0x27, 0xa7, 0x47, 0x9b, 0xef, 0xa1, 0xd4, 0x76, 0x48, 0x9f, 0x30, 0x8c, 0xd4, 0xcf, 0xa6, 0xe2,
+	0xa9, 0x6e, 0x4b, 0xbe, 0x32, 0x08, 0xff, 0x25, 0x28, 0x7d, 0xd3, 0x81, 0x96, 0x16, 0xe8, 0x9c,
+	0xc7, 0x8c, 0xf7, 0xf5, 0xe5, 0x43, 0x44, 0x5f, 0x83, 0x33, 0xd8, 0xfa, 0x7f, 0x56, 0x00, 0x00,
+	0x05, 0x27, 0x9f, 0xa5, 0xd8, 0xb5, 0xe4, 0xad, 0x40, 0xe7, 0x36, 0xdd, 0xb4, 0xd3, 0x54, 0x12,
+	0x32, 0x80, 0x63, 0xfd, 0x2a, 0xab, 0x53, 0xe5, 0xea, 0x1e, 0x0a, 0x9f, 0x33, 0x25, 0x00, 0xa5,
+	0xdf, 0x94, 0x87, 0xd0, 0x7a, 0x5c, 0x92, 0xcc, 0x51, 0x2c, 0x88, 0x66, 0xc7, 0xe8, 0x60, 0xce,
+	0x93, 0xfd, 0xf1, 0x66, 0xa2, 0x49, 0x12, 0xb4, 0x22, 0x97, 0x61, 0x46, 0xae, 0x20, 0xce, 0x84,
+	0x6b, 0xb7, 0xdc, 0x9b, 0xa9, 0x4a, 0x76, 0x7a, 0xae, 0xf2, 0x0c, 0x0d, 0x61, 0xad, 0x02, 0x65,
+	0x5e, 0xa9, 0x2d, 0xc4, 0xc4, 0xe4, 0x1a, 0x89, 0x52, 0xc6, 0x51, 0xd3, 0x31, 0x74, 0xbe, 0x51,
+	0xa1, 0x0c, 0x42, 0x11, 0x10, 0xe6, 0xd8, 0x15, 0x88, 0xed, 0xe8, 0x21, 0x03, 0xa2, 0x52, 0xd8,
+	0xa7, 0x50, 0xe8, 0x76, 0x8d, 0xef, 0xff, 0xed, 0x91, 0x22, 0x81, 0x0a, 0xae, 0xb9, 0x9f, 0x91,
+	0x72, 0xaf, 0x82, 0xb6, 0x04, 0xdc, 0x4b, 0x8e, 0x51, 0xbc, 0xb0, 0x82, 0x35, 0xa6, 0xf4, 0x34,
+	0x13, 0x32, 0xe4, 0xca, 0x60, 0x48, 0x2a, 0x4b, 0xa1, 0xa0, 0x3b, 0x3e, 0x65, 0x00, 0x8f, 0xc5,
+	0xda, 0x76, 0xb7, 0x0b, 0xf1, 0x69, 0x0d, 0xb4, 0xea, 0xe2, 0x9c, 0x5f, 0x1b, 0xad, 0xd0, 0x3c,
+	0x5c, 0xcf, 0x2a, 0x55, 0xd7, 0x05, 0xdd, 0xcd, 0x86, 0xd4, 0x49, 0x51, 0x1c, 0xeb, 0x7e, 0xc3,
+	0x0b, 0xf1, 0x2b, 0x1f, 0xa3, 0x5b, 0x91, 0x3f, 0x9f, 0x74, 0x7a, 0x8a, 0xfd, 0x1b, 0x13, 0x0e,
+	0x94, 0xbf, 0xf9, 0x4e, 0xff, 0xd0, 0x1a, 0x91, 0x73, 0x5c, 0xa1, 0x72, 0x6a, 0xcd, 0x0b, 0x19,
+	0x7c, 0x4e, 0x5b, 0x03, 0x39, 0x36, 0x97, 0xe1, 0x26, 0x82, 0x6f, 0xb6, 0xbb, 0xde, 0x8e, 0xcc,
+	0x1e, 0x08, 0x29, 0x85, 0x16, 0xe2, 0xc9, 0xed, 0x03, 0xff, 0x3c, 0x1b, 0x78, 0x60, 0xf6, 0xde,
+	0x76, 0xd4, 0xce, 0xcd, 0x94, 0xc8, 0x11, 0x98, 0x55, 0xef, 0x52, 0x97, 0xca, 0x67, 0xe9, 0xf3,
+	0xe7, 0xff, 0x72, 0xb1, 0xe9, 0x97, 0x85, 0xca, 0x0a, 0x7e, 0x77, 0x20, 0xc5, 0xb3, 0x6d, 0xc6,
+	0xd7, 0x2c, 0xac, 0x95, 0x74, 0xc8, 0xcb, 0xbc, 0x2f, 0x80, 0x1e, 0x23, 0xe5, 0x6f, 0xd3, 0x44,
+	0xb0, 0x7f, 0x22, 0x15, 0x4b, 0xeb, 0xa0, 0xf0, 0x8c, 0xe8, 0x89, 0x1e, 0x64, 0x3e, 0xd9, 0x95,
+	0xc9, 0x4d, 0x9a, 0x69, 0xc9, 0xf1, 0xb5, 0xf4, 0x99, 0x02, 0x7a, 0x78, 0x57, 0x2a, 0xee, 0xbd,
+	0x74, 0xd2, 0x0c, 0xc3, 0x98, 0x81, 0xc2, 0x13, 0xee, 0x77, 0x0b, 0x10, 0x10, 0xe4, 0xbe, 0xa7,
+	0x18, 0x84, 0x69, 0x77, 0xae, 0x11, 0x9f, 0x7a, 0x02, 0x3a, 0xb5, 0x8c, 0xca, 0x0a, 0xd7, 0x52,
+	0xaf, 0xe6, 0x56, 0xbb, 0x3c, 0x17, 0x25, 0x6a, 0x9f, 0x6e, 0x9b, 0xf1, 0x9f, 0xdd, 0x5a, 0x38,
+	0xfc, 0x82, 0xbb, 0xe8, 0x72, 0xc5, 0x53, 0x9e, 0xdb, 0x60, 0x9e, 0xf4, 0xf7, 0x9c, 0x20, 0x3e,
+	0xbb, 0x14, 0x0f, 0x2e, 0x58, 0x3c, 0xb2, 0xad, 0x15, 0xb4, 0xaa, 0x5b, 0x65, 0x50, 0x16, 0xa8,
+	0x44, 0x92, 0x77, 0xdb, 0xd4, 0x77, 0xef, 0x2c, 0x8d, 0x6c, 0x01, 0x7d, 0xb7, 0x38, 0xb1, 0x8d,
+	0xeb, 0x4a, 0x42, 0x7d, 0x19, 0x23, 0xce, 0x3f, 0xf2, 0x62, 0x73, 0x57, 0x79, 0xa4, 0x18, 0xf2,
+	0x0a, 0x28, 0x2d, 0xf9, 0x20, 0x14, 0x7b, 0xea, 0xbe, 0x42, 0x1e, 0xe5, 0x31, 0x9d, 0x05, 0x68
+};
+
+/* Vector 10, AES-256, 512 byte data unit, plaintext counts 0..255 twice */
+static PGPByte K2_10[] = {
+	0x27, 0x18, 0x28, 0x18, 0x28, 0x45, 0x90, 0x45, 0x23, 0x53, 0x60, 0x28, 0x74, 0x71, 0x35, 0x26,
+	0x62, 0x49, 0x77, 0x57, 0x24, 0x70, 0x93, 0x69, 0x99, 0x59, 0x57, 0x49, 0x66, 0x96, 0x76, 0x27,
+	0x31, 0x41, 0x59, 0x26, 0x53, 0x58, 0x97, 0x93, 0x23, 0x84, 0x62, 0x64, 0x33, 0x83, 0x27, 0x95,
+	0x02, 0x88, 0x41, 0x97, 0x16, 0x93, 0x99, 0x37, 0x51, 0x05, 0x82, 0x09, 0x74, 0x94, 0x45, 0x92
+};
+static PGPByte C2_10[] = {
+	0x1c, 0x3b, 0x3a, 0x10, 0x2f, 0x77, 0x03, 0x86, 0xe4, 0x83, 0x6c, 0x99, 0xe3, 0x70, 0xcf, 0x9b,
+	0xea, 0x00, 0x80, 0x3f, 0x5e, 0x48, 0x23, 0x57, 0xa4, 0xae, 0x12, 0xd4, 0x14, 0xa3, 0xe6, 0x3b,
+	0x5d, 0x31, 0xe2, 0x76, 0xf8, 0xfe, 0x4a, 0x8d, 0x66, 0xb3, 0x17, 0xf9, 0xac, 0x68, 0x3f, 0x44,
+	0x68, 0x0a, 0x86, 0xac, 0x35, 0xad, 0xfc, 0x33, 0x45, 0xbe, 0xfe, 0xcb, 0x4b, 0xb1, 0x88, 0xfd,
+	0x57, 0x76, 0x92, 0x6c, 0x49, 0xa3, 0x09, 0x5e, 0xb1, 0x08, 0xfd, 0x10, 0x98, 0xba, 0xec, 0x70,
+	0xaa, 0xa6, 0x69, 0x99, 0xa7, 0x2a, 0x82, 0xf2, 0x7d, 0x84, 0x8b, 0x21, 0xd4, 0xa7, 0x41, 0xb0,
+	0xc5, 0xcd, 0x4d, 0x5f, 0xff, 0x9d, 0xac, 0x89, 0xae, 0xba, 0x12, 0x29, 0x61, 0xd0, 0x3a, 0x75,
+	0x71, 0x23, 0xe9, 0x87, 0x0f, 0x8a, 0xcf, 0x10, 0x00, 0x02, 0x08, 0x87, 0x89, 0x14, 0x29, 0xca,
+	0x2a, 0x3e, 0x7a, 0x7d, 0x7d, 0xf7, 0xb1, 0x03, 0x55, 0x16, 0x5c, 0x8b, 0x9a, 0x6d, 0x0a, 0x7d,
+	0xe8, 0xb0, 0x62, 0xc4, 0x50, 0x0d, 0xc4, 0xcd, 0x12, 0x0c, 0x0f, 0x74, 0x18, 0xda, 0xe3, 0xd0,
+	0xb5, 0x78, 0x1c, 0x34, 0x80, 0x3f, 0xa7, 0x54, 0x21, 0xc7, 0x90, 0xdf, 0xe1, 0xde, 0x18, 0x34,
+	0xf2, 0x80, 0xd7, 0x66, 0x7b, 0x32, 0x7f, 0x6c, 0x8c, 0xd7, 0x55, 0x7e, 0x12, 0xac, 0x3a, 0x0f,
+	0x93, 0xec, 0x05, 0xc5, 0x2e, 0x04, 0x93, 0xef, 0x31, 0xa1, 0x2d, 0x3d, 0x92, 0x60, 0xf7, 0x9a,
+	0x28, 0x9d, 0x6a, 0x37, 0x9b, 0xc7, 0x0c, 0x50, 0x84, 0x14, 0x73, 0xd1, 0xa8, 0xcc, 0x81, 0xec,
+	0x58, 0x3e, 0x96, 0x45, 0xe0, 0x7b, 0x8d, 0x96, 0x70, 0x65, 0x5b, 0xa5, 0xbb, 0xcf, 0xec, 0xc6,
+	0xdc, 0x39, 0x66, 0x38, 0x0a, 0xd8, 0xfe, 0xcb, 0x17, 0xb6, 0xba, 0x02, 0x46, 0x9a, 0x02, 0x0a,
+	0x84, 0xe1, 0x8e, 0x8f, 0x84, 0x25, 0x20, 0x70, 0xc1, 0x3e, 0x9f, 0x1f, 0x28, 0x9b, 0xe5, 0x4f,
+	0xbc, 0x48, 0x14, 0x57, 0x77, 0x8f, 0x61, 0x60, 0x15, 0xe1, 0x32, 0x7a, 0x02, 0xb1, 0x40, 0xf1,
+	0x50, 0x5e, 0xb3, 0x09, 0x32, 0x6d, 0x68, 0x37, 0x8f, 0x83, 0x74, 0x59, 0x5c, 0x84, 0x9d, 0x84,
+	0xf4, 0xc3, 0x33, 0xec, 0x44, 0x23, 0x88, 0x51, 0x43, 0xcb, 0x47, 0xbd, 0x71, 0xc5, 0xed, 0xae,
+	0x9b, 0xe6, 0x9a, 0x2f, 0xfe, 0xce, 0xb1, 0xbe, 0xc9, 0xde, 0x24, 0x4f, 0xbe, 0x15, 0x99, 0x2b,
+	0x11, 0xb7, 0x7c, 0x04, 0x0f, 0x12, 0xbd, 0x8f, 0x6a, 0x97, 0x5a, 0x44, 0xa0, 0xf9, 0x0c, 0x29,
+	0xa9, 0xab, 0xc3, 0xd4, 0xd8, 0x93, 0x92, 0x72, 0x84, 0xc5, 0x87, 0x54, 0xcc, 0xe2, 0x94, 0x52,
+	0x9f, 0x86, 0x14, 0xdc, 0xd2, 0xab, 0xa9, 0x91, 0x92, 0x5f, 0xed, 0xc4, 0xae, 0x74, 0xff, 0xac,
+	0x6e, 0x33, 0x3b, 0x93, 0xeb, 0x4a, 0xff, 0x04, 0x79, 0xda, 0x9a, 0x41, 0x0e, 0x44, 0x50, 0xe0,
+	0xdd, 0x7a, 0xe4, 0xc6, 0xe2, 0x91, 0x09, 0x00, 0x57, 0x5d, 0xa4, 0x01, 0xfc, 0x07, 0x05, 0x9f,
+	0x64, 0x5e, 0x8b, 0x7e, 0x9b, 0xfd, 0xef, 0x33, 0x94, 0x30, 0x54, 0xff, 0x84, 0x01, 0x14, 0x93,
+	0xc2, 0x7b, 0x34, 0x29, 0xea, 0xed, 0xb4, 0xed, 0x53, 0x76, 0x44, 0x1a, 0x77, 0xed, 0x43, 0x85,
+	0x1a, 0xd7, 0x7f, 0x16, 0xf5, 0x41, 0xdf, 0xd2, 0x69, 0xd5, 0x0d, 0x6a, 0x5f, 0x14, 0xfb, 0x0a,
+	0xab, 0x1c, 0xbb, 0x4c, 0x15, 0x50, 0xbe, 0x97, 0xf7, 0xab, 0x40, 0x66, 0x19, 0x3c, 0x4c, 0xaa,
+	0x77, 0x3d, 0xad, 0x38, 0x01, 0x4b, 0xd2, 0x09, 0x2f, 0xa7, 0x55, 0xc8, 0x24, 0xbb, 0x5e, 0x54,
+	0xc4, 0xf3, 0x6f, 0xfd, 0xa9, 0xfc, 0xea, 0x70, 0xb9, 0xc6, 0xe6, 0x93, 0xe1, 0x48, 0xc1, 0x51
+};
+
+
+static int
+xtsTest (PGPMemoryMgrRef mgr, PGPCipherAlgorithm alg, PGPSize unitSize,
+	PGPByte const *key, PGPByte const *pattern, PGPByte const *C, PGPSize size,
+	PGPUInt64 offset, int number)
+{
+	PGPSymmetricCipherContextRef aes = NULL;
+	PGPXTSContextRef xts = NULL;
+	PGPByte P[512], X[512];
+	PGPSize i;
+	int failed = 1;
+
+	for (i=0; i < size; i++)
+		P[i] = IsntNull (pattern) ? *pattern : (PGPByte) i;
+
+	if (IsntPGPError (PGPNewSymmetricCipherContext (mgr, alg, &aes)) &&
+		IsntPGPError (PGPNewXTSContext (aes, unitSize, &xts)) &&
+		IsntPGPError (PGPInitXTS (xts, key)))
+	{
+		PGPXTSEncrypt (xts, P, size, X, offset, 0);
+		if (memcmp (C, X, size) == 0)
+		{
+			printf ("Encryption test %d passed\n", number);
+
+			/* decrypt in place */
+			PGPXTSDecrypt (xts, X, size, X, offset, 0);
+			if (memcmp (P, X, size) == 0)
+			{
+				printf ("Decryption test %d passed\n", number);
+				failed = 0;
+			}
+			else
+				printf ("ERROR ON DECRYPTION TEST %d\n", number);
+		}
+		else
+			printf ("ERROR ON ENCRYPTION TEST %d\n", number);
+	}
+	else
+		printf ("ERROR ON SETUP OF TEST %d\n", number);
+
+	if (IsntNull (xts))
+		PGPFreeXTSContext (xts);
+
+	return failed;
+}
+
+
+/*
+ * Process a buffer as 4096 byte data units in 512 byte pieces, as the driver
+ * does for sector sized I/O, which must match processing complete data units.
+ * With 512 byte data units the range calls must match the unit calls, so
+ * existing files read the same.
+ */
+static int
+xtsRangeTest (PGPMemoryMgrRef mgr, PGPSize unitSize, int number)
+{
+	static PGPByte P[4 * 4096], X[4 * 4096], Y[4 * 4096];
+	PGPSymmetricCipherContextRef aes = NULL;
+	PGPXTSContextRef xts = NULL;
+	PGPSize i;
+	int failed = 1;
+
+	for (i=0; i < sizeof (P); i++)
+		P[i] = (PGPByte) (i * 7);
+
+	if (IsntPGPError (PGPNewSymmetricCipherContext (mgr, kPGPCipherAlgorithm_AES256, &aes)) &&
+		IsntPGPError (PGPNewXTSContext (aes, unitSize, &xts)) &&
+		IsntPGPError (PGPInitXTS (xts, K2_10)))
+	{
+		/* complete data units, starting at unit 3 */
+		PGPXTSEncrypt (xts, P, sizeof (P), X, 3, 0x1234);
+
+		/* same data in sector pieces, in reverse order */
+		for (i=sizeof (P); i != 0; i -= 512)
+			PGPXTSEncryptAt (xts, P + i - 512, 512, Y + i - 512, 3 * unitSize + i - 512, 0x1234);
+
+		if (memcmp (X, Y, sizeof (X)) == 0)
+		{
+			/* one range which starts and ends within data units */
+			PGPXTSDecryptAt (xts, X + 48, sizeof (X) - 96, Y + 48, 3 * unitSize + 48, 0x1234);
+			PGPXTSDecryptAt (xts, X, 48, Y, 3 * unitSize, 0x1234);
+			PGPXTSDecryptAt (xts, X + sizeof (X) - 48, 48, Y + sizeof (X) - 48,
+				3 * unitSize + sizeof (X) - 48, 0x1234);
+
+			if (memcmp (P, Y, sizeof (P)) == 0)
+			{
+				printf ("Range test %d passed\n", number);
+				failed = 0;
+			}
+			else
+				printf ("ERROR ON RANGE DECRYPTION TEST %d\n", number);
+		}
+		else
+			printf ("ERROR ON RANGE ENCRYPTION TEST %d\n", number);
+	}
+	else
+		printf ("ERROR ON SETUP OF RANGE TEST %d\n", number);
+
+	if (IsntNull (xts))
+		PGPFreeXTSContext (xts);
+
+	return failed;
+}
+
+
+int
+main(void)
+{	/* Test driver for XTS mode, compares throughput with EME2 */
+	PGPMemoryMgrRef mgr = NULL;
+	PGPByte const zero = 0x00;
+	PGPByte const fill = 0x44;
+	int failed = 0;
+
+	PGPNewMemoryMgrPosix (malloc, free, realloc, &mgr);
+
+	failed += xtsTest (mgr, kPGPCipherAlgorithm_AES128, 32, K1_1, &zero, C1_1, sizeof (C1_1), 0, 1);
+	failed += xtsTest (mgr, kPGPCipherAlgorithm_AES128, 32, K1_2, &fill, C1_2, sizeof (C1_2), 0x3333333333, 2);
+	failed += xtsTest (mgr, kPGPCipherAlgorithm_AES128, 32, K1_3, &fill, C1_3, sizeof (C1_3), 0x3333333333, 3);
+	failed += xtsTest (mgr, kPGPCipherAlgorithm_AES128, 512, K1_4, NULL, C1_4, sizeof (C1_4), 0, 4);
+	failed += xtsTest (mgr, kPGPCipherAlgorithm_AES256, 512, K2_10, NULL, C2_10, sizeof (C2_10), 0xff, 10);
+
+	failed += xtsRangeTest (mgr, 512, 11);
+	failed += xtsRangeTest (mgr, 4096, 12);
+
+	/* perform bulk encryption test, 64 MB per mode and data unit */
+	{
+		static PGPByte buffer[1024*1024];
+		PGPSymmetricCipherContextRef aes;
+		PGPXTSContextRef xts;
+		PGPEME2ContextRef eme2;
+		PGPSize unit;
+		clock_t t0;
+		int i;
+
+		for (unit=512; unit <= 4096; unit *= 8)
+		{
+			PGPNewSymmetricCipherContext (mgr, kPGPCipherAlgorithm_AES256, &aes);
+			PGPNewXTSContext (aes, unit, &xts);
+			PGPInitXTS (xts, K2_10);
+
+			t0 = clock ();
+			for (i=0; i < 64; i++)
+				PGPXTSEncrypt (xts, buffer, sizeof (buffer), buffer, i * (sizeof (buffer) / unit), 1);
+
+			printf ("XTS-AES256 (%u byte units): %.02g sec/Mb\n", (unsigned) unit,
+				(double) (clock () - t0) / CLOCKS_PER_SEC / 64);
+
+			/* page sized I/O, as issued by the cache manager */
+			t0 = clock ();
+			for (i=0; i < 64 * 256; i++)
+				PGPXTSEncryptAt (xts, buffer, 4096, buffer, (PGPUInt64) i * 4096, 1);
+
+			printf ("XTS-AES256 (%u byte units): %.02g usec per 4 KB write\n", (unsigned) unit,
+				(double) (clock () - t0) * 1000000 / CLOCKS_PER_SEC / (64 * 256));
+
+			/* the same pages coded sector by sector, each sector advancing the tweak within its unit */
+			if (unit > 512)
+			{
+				PGPSize sector;
+
+				t0 = clock ();
+				for (i=0; i < 64 * 256; i++)
+					for (sector=0; sector < 4096; sector += 512)
+						PGPXTSEncryptAt (xts, buffer + sector, 512, buffer + sector, (PGPUInt64) i * 4096 + sector, 1);
+
+				printf ("XTS-AES256 (%u byte units): %.02g usec per 4 KB write in sectors\n", (unsigned) unit,
+					(double) (clock () - t0) * 1000000 / CLOCKS_PER_SEC / (64 * 256));
+			}
+
+			PGPFreeXTSContext (xts);
+		}
+
+		PGPNewSymmetricCipherContext (mgr, kPGPCipherAlgorithm_AES256, &aes);
+		PGPNewEME2Context (aes, &eme2);
+		PGPInitEME2 (eme2, K2_10);
+
+		t0 = clock ();
+		for (i=0; i < 64; i++)
+			PGPEME2Encrypt (eme2, buffer, sizeof (buffer), buffer, i * (sizeof (buffer) / 512), 1);
+
+		printf ("EME2-AES256 (512 byte blocks): %.02g sec/Mb\n",
+			(double) (clock () - t0) / CLOCKS_PER_SEC / 64);
+
+		PGPFreeEME2Context (eme2);
+	}
+
+	PGPFreeMemoryMgr (mgr);
+
+	return failed;	/* normal exit on zero */
+} /* main */
+
+#endif /* UNITTEST */
+
+/*__Editor_settings____
+
+	Local Variables:
+	tab-width: 4
+	End:
+	vi: ts=4 sw=4
+	vim: si
+_____________________*/
@@ -58,7 +58,9 @@ ____________________________________________________________________________*/
 
 /* How can we live without these anywhere? */
 #ifndef MEM_MEMCPY
-#ifndef _WIN64
+#if defined(PGP_UNIX)
+#include <string.h>
+#elif !defined(_WIN64)
 void *memcpy( void *, const void *, unsigned );
 #endif
 #define MEM_MEMCPY(dst,src,cnt) memcpy(dst,src,cnt)
@@ -94,6 +96,12 @@ static __inline unsigned long __msb(unsigned long word)  {
 	_BitScanReverse( &ret, word );
 	return ret;
 }
+#elif defined(__GNUC__)
+/* bsrl only takes 32 bit operands, unsigned long is 64 bits on LP64 */
+static inline unsigned long __msb(unsigned long word)
+{
+	return sizeof(word) * 8 - 1 - __builtin_clzl(word);
+}
 #else
 static inline unsigned long __msb(unsigned long word)
 {
@@ -104,6 +112,9 @@ static inline unsigned long __msb(unsigned long word)
 }
 #endif
 
+/* Low bits of a pointer, for alignment checks */
+#define MEM_LOW_BITS(p) ((unsigned)(unsigned long long)(p))
+
 #define MAX_LEFT_CNT 0xe0	/* catches errors */
 
 /* Fibonacci numbers < 2^32. Choose the buffer size from one of these
@@ -134,9 +145,20 @@ struct mem_flat_header  {
 
 #define not_a_mem_flat_header_tail 0xff
 
+/* Blocks start at any byte, so headers are copied in and out rather than accessed in place */
+MEM_INLINE static struct mem_flat_header get_header( void const *p )  {
+	struct mem_flat_header h;
+	MEM_MEMCPY( &h, p, sizeof(h) );
+	return h;
+}
+
+MEM_INLINE static void put_header( void *p, struct mem_flat_header h )  {
+	MEM_MEMCPY( p, &h, sizeof(h) );
+}
+
 int malloc_flat_init( void *buf, unsigned size, struct mem_flat_region_descriptor *descr )  {
 	unsigned i;
-	struct mem_flat_header *h = (struct mem_flat_header *)buf;
+	struct mem_flat_header h;
 
 	descr->signature = 0;
 	descr->p = NULL;
@@ -159,9 +181,11 @@ int malloc_flat_init( void *buf, unsigned size, struct mem_flat_region_descripto
 	descr->signature = MEM_SIG;
 
 	/* boorstrap with single block */
-	h->is_empty = 1;
-	h->idx = i;
-	h->left_cnt = 0;  
+	h.is_empty = 1;
+	h.idx = i;
+	h.left_cnt = 0;  
+	h.is_gap = 0;
+	put_header( buf, h );
 
 	return 0;
 }
@@ -191,77 +215,86 @@ static int idx_from_size(unsigned size)  {
 
 /* Recursively: S_i = S_i-1 (left) + S_i-2 (right) */
 static unsigned char *split( unsigned char *p, int idx )  {
-	struct mem_flat_header *h, *h2;
+	struct mem_flat_header h, h2;
+	unsigned char *p2;
 
 	MEM_ASSERT( idx>=2 );
 
-	h = (struct mem_flat_header *)p;
-	MEM_ASSERT( h->is_empty );
-	MEM_ASSERT( idx <= h->idx );
+	h = get_header( p );
+	MEM_ASSERT( h.is_empty );
+	MEM_ASSERT( idx <= h.idx );
 
-	if( idx == h->idx /*|| idx < 2*/ )  {
+	if( idx == h.idx /*|| idx < 2*/ )  {
 		return p;
 	}
-	MEM_ASSERT( idx < h->idx );
+	MEM_ASSERT( idx < h.idx );
 	
 	/* make new left (the bigger one) */
-	h->idx--;
-	h->left_cnt++;
+	h.idx--;
+	h.left_cnt++;
+	put_header( p, h );
 
 	/* make new empty right (the smaller one) */
-	h2 = (struct mem_flat_header *)(p + F[h->idx]);
-	h2->is_empty = 1;
-	h2->idx = h->idx-1;
-	h2->left_cnt = 0;
+	p2 = p + F[h.idx];
+	h2 = get_header( p2 );
+	h2.is_empty = 1;
+	h2.idx = h.idx-1;
+	h2.left_cnt = 0;
+	put_header( p2, h2 );
 
-	MEM_ASSERT( idx <= h->idx );
-	if( idx >= h->idx-1 )
-		return h2->idx == idx ? (unsigned char *)h2 : (unsigned char *)h;
+	MEM_ASSERT( idx <= h.idx );
+	if( idx >= h.idx-1 )
+		return h2.idx == idx ? p2 : p;
 
 	/* tail recursion */
-	return split( (unsigned char *)h2, idx );
+	return split( p2, idx );
 }
 
 /* Called to merge freed block pointed by p. 
  * Inverse to split(). 
  */
 static void merge( unsigned char *p, void *start_p )  {
-	struct mem_flat_header *h = (struct mem_flat_header *)p;
-	struct mem_flat_header *h2;
+	struct mem_flat_header h = get_header( p );
+	struct mem_flat_header h2;
+	unsigned char *p2;
 
-	MEM_ASSERT(h->is_empty==1);
+	MEM_ASSERT(h.is_empty==1);
 	
 	/* freeing a right block */
-	if( h->left_cnt==0 )  {
+	if( h.left_cnt==0 )  {
 		if( (void*)p==start_p )	/* this is actually the very last block */
 			return;
 
 		/* left header */
-		h2 = (struct mem_flat_header *)(p-F[h->idx+1]);
-		if( h2->is_empty==1 && h2->idx == h->idx+1 )  {
-			MEM_ASSERT( h2->left_cnt>0 );
-			h2->idx = h->idx+2;
-			h2->left_cnt--;
+		p2 = p-F[h.idx+1];
+		h2 = get_header( p2 );
+		if( h2.is_empty==1 && h2.idx == h.idx+1 )  {
+			MEM_ASSERT( h2.left_cnt>0 );
+			h2.idx = h.idx+2;
+			h2.left_cnt--;
+			put_header( p2, h2 );
 			// todo: clean the h
-			merge( (void*)h2, start_p );
+			merge( p2, start_p );
 		}
 	}
 	else  {
 		/* freeing a left block */
-		MEM_ASSERT( h->left_cnt>=1 );
-		h2 = (struct mem_flat_header *)(p+F[h->idx]);
-		if( h2->is_empty==1 && h2->idx == h->idx-1 )  {
-			MEM_ASSERT( h2->left_cnt==0 );
-			h->idx ++;
-			h->left_cnt--;
+		MEM_ASSERT( h.left_cnt>=1 );
+		p2 = p+F[h.idx];
+		h2 = get_header( p2 );
+		if( h2.is_empty==1 && h2.idx == h.idx-1 )  {
+			MEM_ASSERT( h2.left_cnt==0 );
+			h.idx ++;
+			h.left_cnt--;
+			put_header( p, h );
 			// todo: clean the h2
-			merge( (void*)h, start_p );
+			merge( p, start_p );
 		}
 	}
 }
 
 /* returns preceeding header; takes care of ptr alignment */
-static struct mem_flat_header *header_from_ptr(void *ptr)  {
+static unsigned char *header_from_ptr(void *ptr)  {
 	unsigned char *p = ptr;
 	if( p==NULL )
 		return NULL;
@@ -274,16 +307,21 @@ static struct mem_flat_header *header_from_ptr(void *ptr)  {
 	if( p[-1] == not_a_mem_flat_header_tail )
 		p--;
 
-	MEM_ASSERT( !(((struct mem_flat_header *)p)-1)->is_empty );
-	MEM_ASSERT( (((struct mem_flat_header *)p)-1)->left_cnt < MAX_LEFT_CNT );
-	MEM_ASSERT( p!=ptr || (((struct mem_flat_header *)p)-1)->is_gap==0 );
+	MEM_ASSERT( !get_header(p-sizeof(struct mem_flat_header)).is_empty );
+	MEM_ASSERT( get_header(p-sizeof(struct mem_flat_header)).left_cnt < MAX_LEFT_CNT );
+	MEM_ASSERT( p!=ptr || get_header(p-sizeof(struct mem_flat_header)).is_gap==0 );
 
-	return ((struct mem_flat_header *)p)-1;
+	return p-sizeof(struct mem_flat_header);
 }
 
-MEM_INLINE static void *ptr_from_header( struct mem_flat_header *h )  {
-	unsigned char *p = (unsigned char *)(h+1);
-	if( (h->is_gap = ((((unsigned)p) & (sizeof(unsigned)-1)) != 0)) == 0 )  {
+MEM_INLINE static void *ptr_from_header( unsigned char *ph )  {
+	struct mem_flat_header h = get_header( ph );
+	unsigned char *p = ph+sizeof(struct mem_flat_header);
+
+	h.is_gap = ((MEM_LOW_BITS(p) & (sizeof(unsigned)-1)) != 0);
+	put_header( ph, h );
+
+	if( h.is_gap == 0 )  {
 		MEM_ASSERT( p[-1] != not_a_mem_flat_header_tail );
 		return p;
 	}
@@ -291,13 +329,13 @@ MEM_INLINE static void *ptr_from_header( struct mem_flat_header *h )  {
 	MEM_ASSERT(F[0]>sizeof(unsigned));
 
 	*p++ = not_a_mem_flat_header_tail;
-	if( ((unsigned)p & (sizeof(unsigned)-1)) == 2 )
+	if( (MEM_LOW_BITS(p) & (sizeof(unsigned)-1)) == 2 )
 		*p++ = not_a_mem_flat_header_tail;
-	if( ((unsigned)p & (sizeof(unsigned)-1)) == 3 )
+	if( (MEM_LOW_BITS(p) & (sizeof(unsigned)-1)) == 3 )
 		*p++ = not_a_mem_flat_header_tail;
 
 	/* aligned? */
-	MEM_ASSERT( (((unsigned)p) & (sizeof(unsigned)-1)) == 0 );
+	MEM_ASSERT( (MEM_LOW_BITS(p) & (sizeof(unsigned)-1)) == 0 );
 
 	return p;
 }
@@ -305,8 +343,7 @@ MEM_INLINE static void *ptr_from_header( struct mem_flat_header *h )  {
 void *malloc_flat( struct mem_flat_region_descriptor const *descr, unsigned size )  {
 	int idx;
 	unsigned char *p;
-	struct mem_flat_header *h;
-	struct mem_flat_header *h0;
+	struct mem_flat_header h;
 
 	unsigned char *p_best;
 	int idx_best;
@@ -324,104 +361,117 @@ void *malloc_flat( struct mem_flat_region_descriptor const *descr, unsigned size
 	/* Go over free blocks and find the best one */	
 	p = descr->p;
 
-	h0 = h = (struct mem_flat_header*)p;
+	h = get_header( p );
 
-	idx_best = h0->idx+1;	/* infinity */
+	idx_best = h.idx+1;	/* infinity */
 	p_best = NULL;
 
 	/* look for the best empty block */
 	while( p-(const unsigned char *)descr->p < descr->size )  {
-		if( h->is_empty && h->idx >= idx && h->idx < idx_best )  {
+		h = get_header( p );
+		if( h.is_empty && h.idx >= idx && h.idx < idx_best )  {
 			p_best = p;
-			idx_best = h->idx;
+			idx_best = h.idx;
 		}
-		MEM_ASSERT(h->idx>=0 && h->idx < sizeof(F)/sizeof(F[0]));
-		p += F[h->idx];
-		h = (struct mem_flat_header*)p;
+		MEM_ASSERT(h.idx>=0 && h.idx < sizeof(F)/sizeof(F[0]));
+		p += F[h.idx];
 	}
 
 	/* now split the empty block and return it */
-	if( (h = (struct mem_flat_header*)p_best) != NULL )  {
-		struct mem_flat_header *h2[2];
+	if( (p = p_best) != NULL )  {
+		unsigned char *p2[2];
+		struct mem_flat_header h2;
 		if( idx < 2 )  {
 			if( idx_best >= 2 )  {
 				/* squeeze more out of F[2] block: split one more time */
-				h2[1] = (struct mem_flat_header*)split( p_best, 2 /*F[2]*/ );
-				MEM_ASSERT(h2[1]->idx==2 && idx < 2);
-
-				h2[1]->idx--;	/* F[1] */
-				h2[1]->left_cnt++;
-
-				h2[0] = (struct mem_flat_header*)(((unsigned char *)(h2[1]))+F[1]);
-				h2[0]->is_empty = 1;
-				h2[0]->idx=0;	/* F[0] */
-				h2[0]->left_cnt = 0;
-
-				h = h2[idx];
+				p2[1] = split( p_best, 2 /*F[2]*/ );
+				h2 = get_header( p2[1] );
+				MEM_ASSERT(h2.idx==2 && idx < 2);
+
+				h2.idx--;	/* F[1] */
+				h2.left_cnt++;
+				put_header( p2[1], h2 );
+
+				p2[0] = p2[1]+F[1];
+				h2 = get_header( p2[0] );
+				h2.is_empty = 1;
+				h2.idx=0;	/* F[0] */
+				h2.left_cnt = 0;
+				put_header( p2[0], h2 );
+
+				p = p2[idx];
 			}
-			/* else use best block h which we cannot split further */
+			/* else use best block p which we cannot split further */
 		}
 		else
-			h = (struct mem_flat_header*)split( p_best, idx );
-
-		/* return the body of block pointed by h: take care of sizeof(unsigned) alignment */
-		h->is_empty = 0;
-		MEM_ASSERT( h->left_cnt < MAX_LEFT_CNT );
-		return ptr_from_header(h);
+			p = split( p_best, idx );
+
+		/* return the body of block pointed by p: take care of sizeof(unsigned) alignment */
+		h = get_header( p );
+		h.is_empty = 0;
+		put_header( p, h );
+		MEM_ASSERT( h.left_cnt < MAX_LEFT_CNT );
+		return ptr_from_header(p);
 	}
 
 	return NULL;
 }
 
 void free_flat( struct mem_flat_region_descriptor const *descr, void *ptr )  {
-	struct mem_flat_header *h;
+	unsigned char *ph;
+	struct mem_flat_header h;
 
-	h = header_from_ptr( ptr );
-	if( h==NULL )
+	ph = header_from_ptr( ptr );
+	if( ph==NULL )
 		return;
 
 	//debug_print_all();
 
-	MEM_ASSERT( ((unsigned)ptr & (sizeof(unsigned)-1)) == 0 );
-	MEM_ASSERT( h->left_cnt < MAX_LEFT_CNT );
-	MEM_ASSERT( h->is_empty==0 );
+	h = get_header( ph );
+	MEM_ASSERT( (MEM_LOW_BITS(ptr) & (sizeof(unsigned)-1)) == 0 );
+	MEM_ASSERT( h.left_cnt < MAX_LEFT_CNT );
+	MEM_ASSERT( h.is_empty==0 );
 
-	h->is_empty = 1;
-	merge( (unsigned char *)h, descr->p );
+	h.is_empty = 1;
+	put_header( ph, h );
+	merge( ph, descr->p );
 }
 
 /* TODO: this only works OK for increasing in size blocks */
 void *realloc_flat(struct mem_flat_region_descriptor const *descr, void *ptr, unsigned size)  {
 	//unsigned char *p = ptr;
-	struct mem_flat_header *h;
-	struct mem_flat_header *h2;
+	unsigned char *ph;
+	struct mem_flat_header h;
+	struct mem_flat_header h2;
 	unsigned char *p2;
 	int old_body_size;
 
 	size = size+sizeof(struct mem_flat_header)+sizeof(unsigned)-1;
 
-	h = header_from_ptr(ptr);
-	if( h != NULL )  {
-		MEM_ASSERT( !h->is_empty );
-		MEM_ASSERT( h->left_cnt < MAX_LEFT_CNT );
-		old_body_size = F[h->idx]-sizeof(struct mem_flat_header)-sizeof(unsigned)+1;
+	ph = header_from_ptr(ptr);
+	if( ph != NULL )  {
+		h = get_header( ph );
+		MEM_ASSERT( !h.is_empty );
+		MEM_ASSERT( h.left_cnt < MAX_LEFT_CNT );
+		old_body_size = F[h.idx]-sizeof(struct mem_flat_header)-sizeof(unsigned)+1;
 		MEM_ASSERT( old_body_size > 0 );
 		/* quick attempt to merge with the right block without memcpy */
-		while( F[h->idx] < size )  {
-			h2 = (struct mem_flat_header *)((unsigned char*)h+F[h->idx]);
-			if( h->left_cnt>0 && h2->is_empty && h2->idx == h->idx-1 )  {
-				MEM_ASSERT( h2->left_cnt<MAX_LEFT_CNT );	/* this one is really bad */
-				MEM_ASSERT( h2->left_cnt==0 );
-				h->idx++;
-				MEM_ASSERT( h->idx < sizeof(F)/sizeof(F[0]) );	/* due to existence of left block */
-				h->left_cnt--;
+		while( F[h.idx] < size )  {
+			h2 = get_header( ph+F[h.idx] );
+			if( h.left_cnt>0 && h2.is_empty && h2.idx == h.idx-1 )  {
+				MEM_ASSERT( h2.left_cnt<MAX_LEFT_CNT );	/* this one is really bad */
+				MEM_ASSERT( h2.left_cnt==0 );
+				h.idx++;
+				MEM_ASSERT( h.idx < sizeof(F)/sizeof(F[0]) );	/* due to existence of left block */
+				h.left_cnt--;
+				put_header( ph, h );
 			}
 			else
 				break;
 		}
-		if( F[h->idx] >= size )  {
-			MEM_ASSERT( !h->is_empty );
-			/* TODO: reduce the block if F[h->idx-1] > size too */
+		if( F[h.idx] >= size )  {
+			MEM_ASSERT( !h.is_empty );
+			/* TODO: reduce the block if F[h.idx-1] > size too */
 			return ptr;	/* lucky to maintain the same ptr */
 		}
 
@@ -433,8 +483,9 @@ void *realloc_flat(struct mem_flat_region_descriptor const *descr, void *ptr, un
 
 		/* shortcut to free_flat() */
 		MEM_ASSERT( ptr != p2 );
-		h->is_empty = 1;
-		merge( (unsigned char *)h, descr->p );
+		h.is_empty = 1;
+		put_header( ph, h );
+		merge( ph, descr->p );
 
 		MEM_ASSERT( ((unsigned)p2 & (sizeof(unsigned)-1)) == 0 );
 
@@ -447,20 +498,20 @@ void *realloc_flat(struct mem_flat_region_descriptor const *descr, void *ptr, un
 
 #ifdef TEST
 void debug_print_all( struct mem_flat_region_descriptor const *descr )  {
-	struct mem_flat_header *h = (struct mem_flat_header *)descr->p;
 	unsigned char *p = descr->p;
+	struct mem_flat_header h;
 	int n=0;
-	if( h==NULL )  {
+	if( p==NULL )  {
 		printf("The heap is empty\n");
 		return;
 	}
 	while( p - (unsigned char *)descr->p < descr->size )  {
+		h = get_header( p );
 		printf("%p [F[%02u]=%08d] is_empty=%d left_cnt=%02d\n", 
-			ptr_from_header(h), h->idx, F[h->idx], h->is_empty, h->left_cnt );
+			ptr_from_header(p), h.idx, F[h.idx], h.is_empty, h.left_cnt );
 		n++;
 
-		p += F[h->idx];
-		h = (struct mem_flat_header*)p;
+		p += F[h.idx];
 	}
 	printf("%d total blocks\n", n);
 	
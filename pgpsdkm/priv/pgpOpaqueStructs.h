@@ -46,6 +46,7 @@ typedef struct PGPCFBContext				PGPCFBContext;
 typedef struct PGPCBCContext				PGPCBCContext;
 typedef struct PGPEMEContext				PGPEMEContext;
 typedef struct PGPEME2Context				PGPEME2Context;
+typedef struct PGPXTSContext				PGPXTSContext;
 typedef struct PGPSymmetricCipherContext	PGPSymmetricCipherContext;
 
 typedef struct PGPRandomVTBL				PGPRandomVTBL;
@@ -0,0 +1,54 @@
+/*____________________________________________________________________________
+        Copyright (C) 2002 PGP Corporation
+        All rights reserved.
+
+        $Id: pgpXTSPriv.h $
+____________________________________________________________________________*/
+
+#ifndef Included_pgpXTSPriv_h	/* [ */
+#define Included_pgpXTSPriv_h
+
+#include "pgpOpaqueStructs.h"
+#include "pgpSymmetricCipher.h"
+#include "pgpXTS.h"
+
+
+PGP_BEGIN_C_DECLARATIONS
+
+
+#define PGP_XTS_CIPHER_BLOCKSIZE 16
+
+#define PGP_XTS_CIPHER_BLOCKWORDS (PGP_XTS_CIPHER_BLOCKSIZE/sizeof(PGPUInt32))
+
+
+
+/*____________________________________________________________________________
+	internal glue routine follow; use is discouraged
+____________________________________________________________________________*/
+
+PGPError 	pgpXTSDecryptInternal(PGPXTSContextRef ref, const void *in,
+					PGPSize bytesIn, void *	out, PGPUInt64 offset,
+					PGPUInt64 nonce );
+PGPError 	pgpXTSEncryptInternal(PGPXTSContextRef ref, const void *in,
+					PGPSize bytesIn, void *	out, PGPUInt64 offset,
+					PGPUInt64 nonce );
+PGPError 	pgpXTSDecryptAtInternal(PGPXTSContextRef ref, const void *in,
+					PGPSize bytesIn, void *	out, PGPUInt64 byteOffset,
+					PGPUInt64 nonce );
+PGPError 	pgpXTSEncryptAtInternal(PGPXTSContextRef ref, const void *in,
+					PGPSize bytesIn, void *	out, PGPUInt64 byteOffset,
+					PGPUInt64 nonce );
+
+PGP_END_C_DECLARATIONS
+
+#endif /* ] Included_pgpXTSPriv_h */
+
+
+/*__Editor_settings____
+
+	Local Variables:
+	tab-width: 4
+	End:
+	vi: ts=4 sw=4
+	vim: si
+_____________________*/
@@ -48,6 +48,7 @@ typedef struct PGPCBCContext *				PGPCBCContextRef;
 typedef struct PGPCFBContext *				PGPCFBContextRef;
 typedef struct PGPEMEContext *				PGPEMEContextRef;
 typedef struct PGPEME2Context *				PGPEME2ContextRef;
+typedef struct PGPXTSContext *				PGPXTSContextRef;
 typedef struct PGPSymmetricCipherContext *	PGPSymmetricCipherContextRef;
 
 /*____________________________________________________________________________
@@ -14,6 +14,7 @@
 #define PGPContinueHash			mini_PGPContinueHash
 #define PGPCopyEMEContext		mini_PGPCopyEMEContext
 #define PGPCopyEME2Context		mini_PGPCopyEME2Context
+#define PGPCopyXTSContext		mini_PGPCopyXTSContext
 #define pgpCRC32Buffer			mini_pgpCRC32Buffer
 #define pgpCRC32			mini_pgpCRC32
 #define PGPEMEDecrypt			mini_PGPEMEDecrypt
@@ -25,6 +26,7 @@
 #define PGPFreeDataExternal		mini_PGPFreeDataExternal
 #define PGPFreeEMEContext		mini_PGPFreeEMEContext
 #define PGPFreeEME2Context		mini_PGPFreeEME2Context
+#define PGPFreeXTSContext		mini_PGPFreeXTSContext
 #define PGPFreeHashContext		mini_PGPFreeHashContext
 #define PGPFreeMemoryMgrExternal	mini_PGPFreeMemoryMgrExternal
 #define PGPFreeS2K			mini_PGPFreeS2K
@@ -34,11 +36,13 @@
 #define PGPInitCBC			mini_PGPInitCBC
 #define PGPInitEME			mini_PGPInitEME
 #define PGPInitEME2				mini_PGPInitEME2
+#define PGPInitXTS				mini_PGPInitXTS
 #define PGPInitSymmetricCipher		mini_PGPInitSymmetricCipher
 #define PGPNewCBCContext		mini_PGPNewCBCContext
 #define PGPNewDataExternal		mini_PGPNewDataExternal
 #define PGPNewEMEContext		mini_PGPNewEMEContext
 #define PGPNewEME2Context		mini_PGPNewEME2Context
+#define PGPNewXTSContext		mini_PGPNewXTSContext
 #define PGPNewFixedSizeMemoryMgr	mini_PGPNewFixedSizeMemoryMgr
 #define PGPNewMemoryMgrExternal		mini_PGPNewMemoryMgrExternal
 #define PGPNewMemoryMgrPosix		mini_PGPNewMemoryMgrPosix
@@ -50,6 +54,10 @@
 #define PGPPKCS1Unpack			mini_PGPPKCS1Unpack
 #define PGPSymmetricCipherDecrypt	mini_PGPSymmetricCipherDecrypt
 #define PGPSymmetricCipherEncrypt	mini_PGPSymmetricCipherEncrypt
+#define PGPXTSDecrypt			mini_PGPXTSDecrypt
+#define PGPXTSDecryptAt			mini_PGPXTSDecryptAt
+#define PGPXTSEncrypt			mini_PGPXTSEncrypt
+#define PGPXTSEncryptAt			mini_PGPXTSEncryptAt
 #define PGPInitCFB				mini_PGPInitCFB
 #define	PGPNewCFBContext		mini_PGPNewCFBContext
 #define	PGPCFBEncrypt			mini_PGPCFBEncrypt
@@ -57,4 +65,6 @@
 #define	PGPCFBGetSymmetricCipher	mini_PGPCFBGetSymmetricCipher
 #define	PGPEMEGetSymmetricCipher	mini_PGPEMEGetSymmetricCipher
 #define	PGPEME2GetSymmetricCipher	mini_PGPEME2GetSymmetricCipher
+#define	PGPXTSGetSymmetricCipher	mini_PGPXTSGetSymmetricCipher
+#define	PGPXTSGetSizes			mini_PGPXTSGetSizes
 
@@ -0,0 +1,112 @@
+/*____________________________________________________________________________
+	Copyright (C) 2002 PGP Corporation
+	All rights reserved.
+
+	$Id: pgpXTS.h $
+____________________________________________________________________________*/
+
+#ifndef Included_pgpXTS_h	/* [ */
+#define Included_pgpXTS_h
+
+#include "pgpSymmetricCipher.h"
+
+
+PGP_BEGIN_C_DECLARATIONS
+
+/*____________________________________________________________________________
+	An XTS context requires use of a symmetric cipher which has
+	been created (but whose key has not been set).  The symmetric
+	cipher must have a block size of 16 bytes.  An error will
+	be returned if this condition does not hold.
+
+	dataUnitSize is the size of one tweaked data unit in bytes, typically
+	512 or 4096.  It must be a non-zero multiple of the cipher block size.
+
+	After the call, the XTSContextRef "owns" the symmetric ref
+	and will dispose of it properly (even if an error occurs).
+	The caller should no longer reference it.
+____________________________________________________________________________*/
+
+PGPError 	PGPSDKM_PUBLIC_API PGPNewXTSContext( PGPSymmetricCipherContextRef ref,
+					PGPSize dataUnitSize, PGPXTSContextRef *outRef );
+
+/*____________________________________________________________________________
+	Disposal clears all data in memory before releasing it.
+____________________________________________________________________________*/
+
+PGPError 	PGPSDKM_PUBLIC_API PGPFreeXTSContext( PGPXTSContextRef ref );
+
+/*____________________________________________________________________________
+	Make an exact copy, including current state.  Original is not changed.
+____________________________________________________________________________*/
+
+PGPError 	PGPSDKM_PUBLIC_API PGPCopyXTSContext( PGPXTSContextRef ref, PGPXTSContextRef *outRef );
+
+/*____________________________________________________________________________
+	Key the XTS context.  The key is the data key followed by the tweak
+	key, each the key size of the underlying symmetric cipher.
+____________________________________________________________________________*/
+
+PGPError 	PGPSDKM_PUBLIC_API PGPInitXTS( PGPXTSContextRef ref, const void *key );
+
+/*____________________________________________________________________________
+	Call repeatedly to process arbitrary amounts of data.  Each call must
+	have bytesIn be a multiple of the data unit size.  offset is the
+	offset in data units from the front of the file.  nonce is a per-file
+	constant which should be unique among all files that are encrypted with
+	the same key.  The tweak is offset and nonce, both LSB first, which
+	gives the IEEE 1619 data unit sequence number for a zero nonce.
+____________________________________________________________________________*/
+
+PGPError 	PGPSDKM_PUBLIC_API PGPXTSEncrypt( PGPXTSContextRef ref, const void *in,
+					PGPSize bytesIn, void *out, PGPUInt64 offset,
+					PGPUInt64 nonce );
+
+PGPError 	PGPSDKM_PUBLIC_API PGPXTSDecrypt( PGPXTSContextRef ref, const void *in,
+					PGPSize bytesIn, void *out, PGPUInt64 offset,
+					PGPUInt64 nonce );
+
+/*____________________________________________________________________________
+	Same as above, but for any range of cipher blocks.  byteOffset is the
+	offset in bytes from the front of the file, byteOffset and bytesIn
+	must be multiples of the cipher block size.  The range may start and
+	end within a data unit, so large data units can be used with small I/O.
+	The result equals that of processing the complete data units.
+____________________________________________________________________________*/
+
+PGPError 	PGPSDKM_PUBLIC_API PGPXTSEncryptAt( PGPXTSContextRef ref, const void *in,
+					PGPSize bytesIn, void *out, PGPUInt64 byteOffset,
+					PGPUInt64 nonce );
+
+PGPError 	PGPSDKM_PUBLIC_API PGPXTSDecryptAt( PGPXTSContextRef ref, const void *in,
+					PGPSize bytesIn, void *out, PGPUInt64 byteOffset,
+					PGPUInt64 nonce );
+
+/*____________________________________________________________________________
+	Determine key and block size for XTS mode.  Key size covers both keys,
+	block size is the data unit size given on creation.
+____________________________________________________________________________*/
+
+PGPError 	PGPSDKM_PUBLIC_API PGPXTSGetSizes( PGPXTSContextRef ref,
+					PGPSize *keySize, PGPSize *blockSize );
+
+/*____________________________________________________________________________
+	Get the symmetric cipher being used for data of this XTS context.
+____________________________________________________________________________*/
+
+PGPError 	PGPSDKM_PUBLIC_API PGPXTSGetSymmetricCipher( PGPXTSContextRef ref,
+					PGPSymmetricCipherContextRef *outRef );
+
+PGP_END_C_DECLARATIONS
+
+#endif /* ] Included_pgpXTS_h */
+
+
+/*__Editor_settings____
+
+	Local Variables:
+	tab-width: 4
+	End:
+	vi: ts=4 sw=4
+	vim: si
+_____________________*/
@@ -0,0 +1,20 @@
+/* unix/pgpConfig.h.  Linux and other non Darwin systems.  */
+/*
+ * pgpConfig.h -- Configuration for the PGPcdk.  This file contains
+ * the configuration information for the PGPcdk, and it should be
+ * included in all PGPcdk source files.
+ *
+ * $Id: pgpConfig.h 37664 2005-08-09 04:46:54Z jason $
+ */
+
+#include "pgpPFLConfig.h"
+
+/* Tags for exported functions, needed for dynamic linking on some platforms */
+#define PGPTTYE
+
+
+/* Mini-SDK changes some of APIs in incompatible way, for example, 
+ * it replaces SDK context with memory manager. For this reason
+ * mini-SDK APIs get mini_ internal prefix.
+*/
+#include "pgpSDKAPINamespace.h"